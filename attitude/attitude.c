@@ -0,0 +1,290 @@
+/*******************************************************************************
+*
+* FILE:
+* 		attitude.c
+*
+* DESCRIPTION:
+* 		Contains API functions for the on-board attitude estimator. Implements
+*       a Mahony complementary filter on the unit quaternion, updated once
+*       per IMU sample at the configured gyroscope output data rate
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Standard Includes
+------------------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <math.h>
+
+
+/*------------------------------------------------------------------------------
+ Project Includes
+------------------------------------------------------------------------------*/
+#include "main.h"
+#include "imu.h"
+#include "attitude.h"
+#include "cycles.h"
+
+
+/*------------------------------------------------------------------------------
+ Global Variables
+------------------------------------------------------------------------------*/
+
+/* Current filter state */
+static ATTITUDE_STATE attitude_state = { 1.0f, 0.0f, 0.0f, 0.0f,
+                                         0.0f, 0.0f, 0.0f };
+
+/* Integral feedback terms */
+static float integral_x;
+static float integral_y;
+static float integral_z;
+
+/* Sample period and half sample period, precomputed at init */
+static float sample_period;
+static float half_sample_period;
+static bool  attitude_initialized = false;
+
+/* Worst case update time in CPU cycles */
+static uint32_t max_update_cycles;
+
+
+/*------------------------------------------------------------------------------
+ API Functions
+------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		attitude_init                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Initialize the estimator from the IMU configuration passed to          *
+*       imu_init. The sample period is derived from the gyroscope ODR          *
+*                                                                              *
+*******************************************************************************/
+ATTITUDE_STATUS attitude_init
+	(
+	IMU_CONFIG* imu_config_ptr /* IMU configuration settings */
+	)
+{
+/*------------------------------------------------------------------------------
+ Implementation
+------------------------------------------------------------------------------*/
+
+/* Sample period, ODR setting n corresponds to 25*2^(n-6) Hz */
+if ( imu_config_ptr -> gyro_odr < IMU_ODR_0P78 ||
+     imu_config_ptr -> gyro_odr > IMU_ODR_3K2 )
+	{
+	return ATTITUDE_UNSUPPORTED_ODR;
+	}
+sample_period      = ldexpf( 0.04f, IMU_ODR_25 - (int) imu_config_ptr -> gyro_odr );
+half_sample_period = 0.5f*sample_period;
+
+/* Start the cycle counter for update timing */
+cycles_init();
+
+attitude_reset();
+attitude_initialized = true;
+return ATTITUDE_OK;
+} /* attitude_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		attitude_reset                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Reset the attitude to the identity quaternion                          *
+*                                                                              *
+*******************************************************************************/
+void attitude_reset
+	(
+	void
+	)
+{
+attitude_state.q0     = 1.0f;
+attitude_state.q1     = 0.0f;
+attitude_state.q2     = 0.0f;
+attitude_state.q3     = 0.0f;
+attitude_state.rate_x = 0.0f;
+attitude_state.rate_y = 0.0f;
+attitude_state.rate_z = 0.0f;
+integral_x            = 0.0f;
+integral_y            = 0.0f;
+integral_z            = 0.0f;
+max_update_cycles     = 0;
+} /* attitude_reset */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		attitude_update                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Propagate the filter by one IMU sample. Must be called once per        *
+*       gyroscope sample at the ODR passed to attitude_init                    *
+*                                                                              *
+*******************************************************************************/
+ATTITUDE_STATUS attitude_update
+	(
+	IMU_SI_DATA* imu_si_data_ptr /* Latest accelerometer and gyroscope sample,
+	                                converted by imu_convert                 */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables
+------------------------------------------------------------------------------*/
+uint32_t start_cycles;       /* Cycle counter at entry                */
+uint32_t update_cycles;      /* Cycles spent in this update           */
+float    ax, ay, az;         /* Accelerometer sample, normalized      */
+float    gx, gy, gz;         /* Gyroscope sample, rad/s               */
+float    norm_sq;            /* Squared vector magnitude              */
+float    recip_norm;         /* Reciprocal of vector magnitude        */
+float    half_vx;            /* Estimated gravity direction, halved   */
+float    half_vy;
+float    half_vz;
+float    half_ex;            /* Gravity direction error, halved       */
+float    half_ey;
+float    half_ez;
+float    q0, q1, q2, q3;     /* Local copy of the quaternion          */
+
+
+/*------------------------------------------------------------------------------
+ Initializations
+------------------------------------------------------------------------------*/
+if ( !attitude_initialized )
+	{
+	return ATTITUDE_NOT_INITIALIZED;
+	}
+start_cycles = DWT->CYCCNT;
+q0           = attitude_state.q0;
+q1           = attitude_state.q1;
+q2           = attitude_state.q2;
+q3           = attitude_state.q3;
+gx           = imu_si_data_ptr -> gyro_x;
+gy           = imu_si_data_ptr -> gyro_y;
+gz           = imu_si_data_ptr -> gyro_z;
+ax           = imu_si_data_ptr -> accel_x;
+ay           = imu_si_data_ptr -> accel_y;
+az           = imu_si_data_ptr -> accel_z;
+
+
+/*------------------------------------------------------------------------------
+ Implementation
+------------------------------------------------------------------------------*/
+
+/* Export the measured body rates before feedback is applied */
+attitude_state.rate_x = gx;
+attitude_state.rate_y = gy;
+attitude_state.rate_z = gz;
+
+/* Gravity correction, skipped for a zero sample to avoid a divide by zero */
+norm_sq = ax*ax + ay*ay + az*az;
+if ( norm_sq > 0.0f )
+	{
+	recip_norm = 1.0f/sqrtf( norm_sq );
+	ax        *= recip_norm;
+	ay        *= recip_norm;
+	az        *= recip_norm;
+
+	/* Gravity direction predicted by the current attitude */
+	half_vx = q1*q3 - q0*q2;
+	half_vy = q0*q1 + q2*q3;
+	half_vz = q0*q0 - 0.5f + q3*q3;
+
+	/* Error is the cross product of measured and predicted direction */
+	half_ex = ay*half_vz - az*half_vy;
+	half_ey = az*half_vx - ax*half_vz;
+	half_ez = ax*half_vy - ay*half_vx;
+
+	/* Integral feedback */
+	if ( ATTITUDE_TWO_KI > 0.0f )
+		{
+		integral_x += ATTITUDE_TWO_KI*half_ex*sample_period;
+		integral_y += ATTITUDE_TWO_KI*half_ey*sample_period;
+		integral_z += ATTITUDE_TWO_KI*half_ez*sample_period;
+		gx         += integral_x;
+		gy         += integral_y;
+		gz         += integral_z;
+		}
+
+	/* Proportional feedback */
+	gx += ATTITUDE_TWO_KP*half_ex;
+	gy += ATTITUDE_TWO_KP*half_ey;
+	gz += ATTITUDE_TWO_KP*half_ez;
+	}
+
+/* Integrate the quaternion rate of change, q_dot = 0.5*q*omega */
+gx *= half_sample_period;
+gy *= half_sample_period;
+gz *= half_sample_period;
+attitude_state.q0 = q0 + ( -q1*gx - q2*gy - q3*gz );
+attitude_state.q1 = q1 + (  q0*gx + q2*gz - q3*gy );
+attitude_state.q2 = q2 + (  q0*gy - q1*gz + q3*gx );
+attitude_state.q3 = q3 + (  q0*gz + q1*gy - q2*gx );
+
+/* Renormalize */
+norm_sq = attitude_state.q0*attitude_state.q0 +
+          attitude_state.q1*attitude_state.q1 +
+          attitude_state.q2*attitude_state.q2 +
+          attitude_state.q3*attitude_state.q3;
+recip_norm = 1.0f/sqrtf( norm_sq );
+attitude_state.q0 *= recip_norm;
+attitude_state.q1 *= recip_norm;
+attitude_state.q2 *= recip_norm;
+attitude_state.q3 *= recip_norm;
+
+/* Track the worst case update time */
+update_cycles = DWT->CYCCNT - start_cycles;
+if ( update_cycles > max_update_cycles )
+	{
+	max_update_cycles = update_cycles;
+	}
+
+return ATTITUDE_OK;
+} /* attitude_update */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		attitude_get_state                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the current attitude and angular rate state                        *
+*                                                                              *
+*******************************************************************************/
+void attitude_get_state
+	(
+	ATTITUDE_STATE* state_ptr /* Out: attitude and rate state */
+	)
+{
+*state_ptr = attitude_state;
+} /* attitude_get_state */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		attitude_get_max_cycles                                                *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the worst case number of CPU cycles spent in attitude_update       *
+*       since the last reset                                                   *
+*                                                                              *
+*******************************************************************************/
+uint32_t attitude_get_max_cycles
+	(
+	void
+	)
+{
+return max_update_cycles;
+} /* attitude_get_max_cycles */
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
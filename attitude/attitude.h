@@ -0,0 +1,103 @@
+/*******************************************************************************
+*
+* FILE:
+* 		attitude.h
+*
+* DESCRIPTION:
+* 		Contains API functions for the on-board attitude estimator. Implements
+*       a Mahony complementary filter on the unit quaternion, updated once
+*       per IMU sample at the configured gyroscope output data rate
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef ATTITUDE_H
+#define ATTITUDE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32h7xx_hal.h"
+#include "imu.h"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Filter gains, 2*Kp and 2*Ki in the Mahony formulation */
+#define ATTITUDE_TWO_KP             ( 1.0f  )
+#define ATTITUDE_TWO_KI             ( 0.0f  )
+
+
+/*------------------------------------------------------------------------------
+ Typdefs
+------------------------------------------------------------------------------*/
+
+/* Attitude estimator return codes */
+typedef enum _ATTITUDE_STATUS
+	{
+	ATTITUDE_OK               = 0,
+	ATTITUDE_UNSUPPORTED_ODR     ,
+	ATTITUDE_NOT_INITIALIZED
+	} ATTITUDE_STATUS;
+
+/* Attitude and angular rate state, laid out for direct export through the
+   sensor module */
+typedef struct _ATTITUDE_STATE
+	{
+	float q0;     /* Quaternion scalar part                 */
+	float q1;     /* Quaternion vector part, x              */
+	float q2;     /* Quaternion vector part, y              */
+	float q3;     /* Quaternion vector part, z              */
+	float rate_x; /* Body angular rate about x, rad/s       */
+	float rate_y; /* Body angular rate about y, rad/s       */
+	float rate_z; /* Body angular rate about z, rad/s       */
+	} ATTITUDE_STATE;
+
+
+/*------------------------------------------------------------------------------
+ Function Prototypes
+------------------------------------------------------------------------------*/
+
+/* Initialize the estimator from the IMU configuration passed to imu_init */
+ATTITUDE_STATUS attitude_init
+	(
+	IMU_CONFIG* imu_config_ptr
+	);
+
+/* Reset the attitude to the identity quaternion */
+void attitude_reset
+	(
+	void
+	);
+
+/* Propagate the filter by one IMU sample */
+ATTITUDE_STATUS attitude_update
+	(
+	IMU_SI_DATA* imu_si_data_ptr
+	);
+
+/* Get the current attitude and angular rate state */
+void attitude_get_state
+	(
+	ATTITUDE_STATE* state_ptr
+	);
+
+/* Get the worst case number of CPU cycles spent in attitude_update */
+uint32_t attitude_get_max_cycles
+	(
+	void
+	);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* ATTITUDE_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
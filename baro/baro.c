@@ -14,7 +14,6 @@
 ------------------------------------------------------------------------------*/
 #include <stdbool.h>
 #include <string.h>
-#include <math.h>
 
 
 /*------------------------------------------------------------------------------
@@ -35,6 +34,64 @@ static BARO_CONFIG   baro_configuration;
 /* Baro calibration coefficients for measurement compensation */
 static BARO_CAL_DATA baro_cal_data;
 
+/* Raw FIFO contents, with room for the trailing sensor time frame */
+static uint8_t       baro_fifo_buffer[BARO_FIFO_SIZE + BARO_FIFO_SENSORTIME_SIZE];
+
+/* Sensor time of the newest frame from the last FIFO read */
+static uint32_t      baro_fifo_last_time;
+
+/* Interrupt driven sampling. The I2C transfer lands in baro_it_buffer and is
+   published to baro_it_sample on completion, baro_it_seq is odd while the
+   sample is being updated */
+static uint8_t           baro_it_buffer[BARO_PRESS_TEMP_BURST_SIZE];
+volatile static uint8_t  baro_it_sample[BARO_PRESS_TEMP_BURST_SIZE];
+volatile static uint32_t baro_it_seq     = 0;     /* Sample sequence number */
+volatile static bool     baro_it_busy    = false; /* Transfer in progress   */
+volatile static bool     baro_it_pending = false; /* Data ready while the 
+                                                     bus was busy           */
+volatile static bool     baro_bus_claimed = false; /* Blocking transfer on
+                                                      BARO_I2C in progress */
+
+/* Ground level reference pressure for altitude, Pa */
+static float         baro_ground_pressure = BARO_STD_SEA_LEVEL_PRESS;
+
+/* Pressure ratio to altitude exponent tables. The ratio r = m*2^e is split 
+   into its float mantissa and exponent so that r^k = m^k*2^(e*k). The 
+   mantissa table holds m^k at BARO_ALT_TABLE_SIZE - 1 uniform steps over 
+   [1,2] for linear interpolation, the exponent table holds the altitude 
+   scale times 2^(e*k) for e = BARO_ALT_EXP_MIN ... BARO_ALT_EXP_MAX */
+static const float   baro_alt_mant_table[BARO_ALT_TABLE_SIZE] = 
+	{
+	1.000000000f, 1.001481750f, 1.002954228f, 1.004417563f, 1.005871880f, 1.007317304f,
+	1.008753953f, 1.010181948f, 1.011601403f, 1.013012431f, 1.014415144f, 1.015809651f,
+	1.017196057f, 1.018574468f, 1.019944985f, 1.021307709f, 1.022662738f, 1.024010170f,
+	1.025350097f, 1.026682614f, 1.028007810f, 1.029325776f, 1.030636599f, 1.031940365f,
+	1.033237158f, 1.034527061f, 1.035810155f, 1.037086520f, 1.038356235f, 1.039619376f,
+	1.040876019f, 1.042126238f, 1.043370107f, 1.044607696f, 1.045839077f, 1.047064318f,
+	1.048283487f, 1.049496651f, 1.050703877f, 1.051905228f, 1.053100768f, 1.054290559f,
+	1.055474664f, 1.056653141f, 1.057826052f, 1.058993453f, 1.060155403f, 1.061311959f,
+	1.062463175f, 1.063609107f, 1.064749808f, 1.065885332f, 1.067015731f, 1.068141056f,
+	1.069261358f, 1.070376686f, 1.071487091f, 1.072592619f, 1.073693319f, 1.074789238f,
+	1.075880421f, 1.076966915f, 1.078048764f, 1.079126012f, 1.080198702f, 1.081266878f,
+	1.082330582f, 1.083389856f, 1.084444740f, 1.085495274f, 1.086541500f, 1.087583456f,
+	1.088621180f, 1.089654712f, 1.090684088f, 1.091709346f, 1.092730522f, 1.093747654f,
+	1.094760775f, 1.095769922f, 1.096775130f, 1.097776431f, 1.098773861f, 1.099767452f,
+	1.100757237f, 1.101743249f, 1.102725520f, 1.103704081f, 1.104678963f, 1.105650198f,
+	1.106617815f, 1.107581844f, 1.108542316f, 1.109499260f, 1.110452703f, 1.111402675f,
+	1.112349204f, 1.113292317f, 1.114232042f, 1.115168407f, 1.116101437f, 1.117031160f,
+	1.117957600f, 1.118880785f, 1.119800740f, 1.120717489f, 1.121631057f, 1.122541470f,
+	1.123448752f, 1.124352925f, 1.125254015f, 1.126152044f, 1.127047036f, 1.127939013f,
+	1.128827998f, 1.129714013f, 1.130597082f, 1.131477224f, 1.132354462f, 1.133228818f,
+	1.134100311f, 1.134968964f, 1.135834797f, 1.136697830f, 1.137558083f, 1.138415576f,
+	1.139270329f, 1.140122362f, 1.140971693f
+	};
+
+static const float   baro_alt_exp_table[BARO_ALT_EXP_MAX - BARO_ALT_EXP_MIN + 1] =
+	{
+	15434.9886f, 17610.8851f, 20093.5214f, 22926.1392f, 26158.0758f,
+	29845.6241f, 34053.0123f, 38853.5231f, 44330.7700f, 50580.1537f
+	};
+
 
 /*------------------------------------------------------------------------------
  Internal function prototypes 
@@ -58,7 +115,7 @@ static int16_t bytes_to_int16_t
 static BARO_STATUS read_regs
 	(
 	uint8_t  reg_addr, /* In:  Register address            */
-	uint8_t  num_regs, /* In:  Number of registers to read */
+	uint16_t num_regs, /* In:  Number of registers to read */
 	uint8_t* pData     /* Out: Register contents           */
 	);
 
@@ -77,17 +134,31 @@ static BARO_STATUS load_cal_data
 	);
 
 /* Apply the compensation formula to raw temperature readouts */
-static float temp_compensate
+static int32_t temp_compensate
 	(
 	uint32_t raw_readout
 	);
 
 /* Apply the compensation formula to raw pressure readouts */
-static float press_compensate 
+static uint32_t press_compensate 
 	(
 	uint32_t raw_readout
 	);
 
+/* Start an interrupt driven read of the data registers */
+static void start_read_IT
+	(
+	void
+	);
+
+/* Parse raw FIFO contents into timestamped samples */
+static uint16_t fifo_parse
+	(
+	uint16_t          fifo_length, /* In:  Number of bytes read from FIFO */
+	BARO_FIFO_SAMPLE* samples_ptr, /* Out: Parsed samples                 */
+	uint16_t          max_samples  /* In:  Capacity of samples buffer     */
+	);
+
 /* Reset the baro sensor */
 static BARO_STATUS baro_reset
 	(
@@ -346,47 +417,81 @@ BARO_STATUS baro_get_pressure
 /*------------------------------------------------------------------------------
 Local variables 
 ------------------------------------------------------------------------------*/
-uint8_t     pressure_bytes[3]; /* Pressure raw readout bytes, LSB first   */
-uint32_t    raw_pressure;      /* Pressure raw readout in uint32_t format */
-float       comp_temp;         /* Compensation temperature                */
-BARO_STATUS baro_status;       /* Return codes for baro API calls         */
+float       comp_temp;         /* Compensation temperature, discarded     */
+
+
+/*------------------------------------------------------------------------------
+API function implementation 
+------------------------------------------------------------------------------*/
+
+/* Pressure compensation needs a temperature from the same sample, read both */
+return baro_get_press_temp( pressure_ptr, &comp_temp );
+} /* baro_get_pressure */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_get_press_temp                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		retrieves a pressure and temperature reading from the sensor in a      *
+*       single I2C transaction                                                 *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_get_press_temp
+	(
+    float* pressure_ptr, /* Out: Baro pressure    */
+    float* temp_ptr      /* Out: Baro temperature */
+	)
+{
+/*------------------------------------------------------------------------------
+Local variables 
+------------------------------------------------------------------------------*/
+uint8_t     data_bytes[BARO_PRESS_TEMP_BURST_SIZE]; /* Pressure then 
+                                                       temperature bytes, 
+                                                       LSB first            */
+uint32_t    raw_pressure;      /* Pressure raw readout in uint32_t format    */
+uint32_t    raw_temp;          /* Temperature raw readout in uint32_t format */
+BARO_STATUS baro_status;       /* Return codes for baro API calls            */
 
 
 /*------------------------------------------------------------------------------
 Initializations
 ------------------------------------------------------------------------------*/
 raw_pressure = 0;
-comp_temp    = 0;
+raw_temp     = 0;
 baro_status  = BARO_OK;
-memset( &pressure_bytes[0], 0, sizeof( pressure_bytes ) );
+memset( &data_bytes[0], 0, sizeof( data_bytes ) );
 
 
 /*------------------------------------------------------------------------------
 API function implementation 
 ------------------------------------------------------------------------------*/
 
-/* Read 3 consecutive pressure data registers */
+/* Read the 3 pressure and 3 temperature data registers in one burst */
 baro_status = read_regs( BARO_REG_PRESS_DATA, 
-                         sizeof( pressure_bytes ), 
-						 &pressure_bytes[0] );
+                         sizeof( data_bytes ), 
+						 &data_bytes[0] );
 if ( baro_status != BARO_OK )
 	{
 	return BARO_I2C_ERROR;
 	}
 
-/* Combine all bytes value to 24 bit value */
-raw_pressure = ( ( (uint32_t) pressure_bytes[2] << 16 ) |
-                 ( (uint32_t) pressure_bytes[1] <<  8 ) |
-				 ( (uint32_t) pressure_bytes[0]       ) );
-
-/* Get compensation temperature for pressure compensation calculation */
-baro_status   = baro_get_temp( &comp_temp );
+/* Combine all bytes value to 24 bit values */
+raw_pressure = ( ( (uint32_t) data_bytes[2] << 16 ) |
+                 ( (uint32_t) data_bytes[1] <<  8 ) |
+				 ( (uint32_t) data_bytes[0]       ) );
+raw_temp     = ( ( (uint32_t) data_bytes[5] << 16 ) |
+                 ( (uint32_t) data_bytes[4] <<  8 ) |
+				 ( (uint32_t) data_bytes[3]       ) );
 
-/* Compensate using calibration data */
-*pressure_ptr = press_compensate( raw_pressure );
+/* Compensate temperature first, pressure compensation depends on it */
+*temp_ptr     = ( (float) temp_compensate ( raw_temp     ) )/100.0f;
+*pressure_ptr = ( (float) press_compensate( raw_pressure ) )/100.0f;
 
 return BARO_OK;
-} /* baro_get_pressure */
+} /* baro_get_press_temp */
 
 
 /*******************************************************************************
@@ -437,8 +542,8 @@ raw_temp = ( ( (uint32_t) temp_bytes[2] << 16 ) |
              ( (uint32_t) temp_bytes[1] <<  8 ) |
 			 ( (uint32_t) temp_bytes[0]       ) ); 
 
-/* Adjust using calibration data */
-*temp_ptr = temp_compensate( raw_temp );
+/* Adjust using calibration data, compensated output is in 0.01 degC */
+*temp_ptr = ( (float) temp_compensate( raw_temp ) )/100.0f;
 
 return BARO_OK;
 
@@ -451,18 +556,679 @@ return BARO_OK;
 * 		baro_get_altitude                                                      *
 *                                                                              *
 * DESCRIPTION:                                                                 * 
-* 		gets the altitude of the rocket from the sensor readouts               *
+* 		gets the altitude of the rocket above the ground reference captured    *
+*       with baro_set_ground_ref, or above standard sea level pressure if no   *
+*       reference has been captured                                            *
 *                                                                              *
 *******************************************************************************/
 BARO_STATUS baro_get_altitude
 	(
-    void
+    float* altitude_ptr /* Out: Altitude above ground reference, m */
 	)
 {
+/*------------------------------------------------------------------------------
+Local variables 
+------------------------------------------------------------------------------*/
+float       pressure;    /* Compensated pressure, Pa             */
+float       temp;        /* Compensated temperature, discarded   */
+BARO_STATUS baro_status; /* Return codes for baro API calls      */
+
+
+/*------------------------------------------------------------------------------
+API function implementation 
+------------------------------------------------------------------------------*/
+baro_status = baro_get_press_temp( &pressure, &temp );
+if ( baro_status != BARO_OK )
+	{
+	return baro_status;
+	}
+*altitude_ptr = baro_press_to_altitude( pressure, baro_ground_pressure );
 return BARO_OK;
 } /* baro_get_altitude */
 
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_set_ground_ref                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Captures the ground level reference pressure for baro_get_altitude by  *
+*       averaging consecutive samples at the configured output data rate.      *
+*       Call once the vehicle is armed on the pad                              *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_set_ground_ref
+	(
+	uint16_t num_samples /* In: Number of samples to average */
+	)
+{
+/*------------------------------------------------------------------------------
+Local variables 
+------------------------------------------------------------------------------*/
+float       pressure;     /* Compensated pressure, Pa             */
+float       temp;         /* Compensated temperature, discarded   */
+float       pressure_sum; /* Sum of pressure samples              */
+uint16_t    i;            /* Loop counter                         */
+BARO_STATUS baro_status;  /* Return codes for baro API calls      */
+
+
+/*------------------------------------------------------------------------------
+Initializations
+------------------------------------------------------------------------------*/
+pressure_sum = 0.0f;
+if ( num_samples == 0 )
+	{
+	return BARO_FAIL;
+	}
+
+
+/*------------------------------------------------------------------------------
+API function implementation 
+------------------------------------------------------------------------------*/
+for ( i = 0; i < num_samples; ++i )
+	{
+	baro_status = baro_get_press_temp( &pressure, &temp );
+	if ( baro_status != BARO_OK )
+		{
+		return baro_status;
+		}
+	pressure_sum += pressure;
+
+	/* Wait for the next sample */
+	HAL_Delay( BARO_ODR_PERIOD_MS( baro_configuration.ODR_setting ) );
+	}
+baro_ground_pressure = pressure_sum/( (float) num_samples );
+return BARO_OK;
+} /* baro_set_ground_ref */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_press_to_altitude                                                 *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Converts a pressure to altitude above a reference pressure using the   *
+*       international barometric formula h = 44330.77*(1 - (p/p0)^0.190263).   *
+*       The power is evaluated from the ratio's float mantissa and exponent    *
+*       with the precomputed tables, the interpolation error is below 0.06 m   *
+*       for pressure ratios between 2^-8 and 4, ratios outside this range are  *
+*       clamped                                                                *
+*                                                                              *
+*******************************************************************************/
+float baro_press_to_altitude
+	(
+	float pressure,    /* In: Pressure, Pa           */
+	float ref_pressure /* In: Reference pressure, Pa */
+	)
+{
+/*------------------------------------------------------------------------------
+Local variables 
+------------------------------------------------------------------------------*/
+float    ratio;       /* Pressure ratio p/p0                        */
+uint32_t ratio_bits;  /* IEEE 754 representation of the ratio       */
+int32_t  exponent;    /* Unbiased exponent of the ratio             */
+uint32_t index;       /* Mantissa table index                       */
+float    frac;        /* Interpolation fraction within table step   */
+float    mant_pow;    /* Mantissa raised to the barometric exponent */
+
+
+/*------------------------------------------------------------------------------
+Initializations
+------------------------------------------------------------------------------*/
+ratio = pressure/ref_pressure;
+if      ( !( ratio >= BARO_ALT_RATIO_MIN ) )
+	{
+	ratio = BARO_ALT_RATIO_MIN;
+	}
+else if ( ratio > BARO_ALT_RATIO_MAX )
+	{
+	ratio = BARO_ALT_RATIO_MAX;
+	}
+memcpy( &ratio_bits, &ratio, sizeof( ratio_bits ) );
+
+
+/*------------------------------------------------------------------------------
+API function implementation 
+------------------------------------------------------------------------------*/
+
+/* Split into exponent, table index and interpolation fraction */
+exponent = (int32_t) ( ( ratio_bits >> 23 ) & 0xFF ) - 127;
+index    = ( ratio_bits >> ( 23 - BARO_ALT_TABLE_BITS ) ) & 
+           ( ( 1 << BARO_ALT_TABLE_BITS ) - 1 );
+frac     = (float) ( ratio_bits & ( ( 1 << ( 23 - BARO_ALT_TABLE_BITS ) ) - 1 ) )*
+           ( 1.0f/( 1 << ( 23 - BARO_ALT_TABLE_BITS ) ) );
+
+/* m^k by linear interpolation, then scale by 2^(e*k) */
+mant_pow = baro_alt_mant_table[index] + 
+           frac*( baro_alt_mant_table[index + 1] - baro_alt_mant_table[index] );
+return BARO_ALT_SCALE - 
+       mant_pow*baro_alt_exp_table[exponent - BARO_ALT_EXP_MIN];
+} /* baro_press_to_altitude */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_fifo_enable                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Flushes and enables the sensor FIFO with pressure and temperature      *
+*       frames and the sensor time frame. The watermark flag is raised once    *
+*       watermark_frames samples are buffered. The sensor must be configured   *
+*       in normal mode with pressure and temperature enabled                   *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_fifo_enable
+	(
+	uint16_t watermark_frames /* In: FIFO watermark in samples */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+BARO_STATUS baro_status;     /* Baro API call return codes       */
+uint16_t    watermark_bytes; /* FIFO watermark in bytes          */
+uint8_t     int_ctrl;        /* Contents of INT_CTRL register    */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+if ( watermark_frames == 0                    || 
+     watermark_frames >  BARO_FIFO_MAX_FRAMES )
+	{
+	return BARO_UNSUPPORTED_CONFIG;
+	}
+watermark_bytes = watermark_frames*BARO_FIFO_PRESS_TEMP_SIZE;
+int_ctrl        = 0;
+
+
+/*------------------------------------------------------------------------------
+ API function implementation 
+------------------------------------------------------------------------------*/
+
+/* Start from an empty FIFO */
+baro_status = baro_flush_fifo();
+if ( baro_status != BARO_OK )
+	{
+	return BARO_FIFO_ERROR;
+	}
+
+/* Watermark, 9 bit byte count */
+baro_status = write_reg( BARO_REG_FIFO_WTM, (uint8_t) watermark_bytes );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+baro_status = write_reg( BARO_REG_FIFO_WTM + 1, 
+                         (uint8_t) ( watermark_bytes >> 8 ) );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+
+/* No subsampling, store IIR filtered data */
+baro_status = write_reg( BARO_REG_FIFO_CONFIG_2, BARO_FIFO_DATA_FILTERED );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+
+/* Enable the watermark status flag, preserving the interrupt pin settings */
+baro_status = read_regs( BARO_REG_INT_CTRL, sizeof( int_ctrl ), &int_ctrl );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+baro_status = write_reg( BARO_REG_INT_CTRL, int_ctrl | BARO_INT_FWTM_EN );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+
+/* Enable the FIFO with pressure, temperature and sensor time frames */
+baro_fifo_last_time = 0;
+return write_reg( BARO_REG_FIFO_CONFIG_1, BARO_FIFO_MODE_EN  | 
+                                          BARO_FIFO_TIME_EN  |
+                                          BARO_FIFO_PRESS_EN |
+                                          BARO_FIFO_TEMP_EN );
+} /* baro_fifo_enable */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_fifo_disable                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Disables and flushes the sensor FIFO                                   *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_fifo_disable
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+BARO_STATUS baro_status; /* Baro API call return codes */
+
+
+/*------------------------------------------------------------------------------
+ API function implementation 
+------------------------------------------------------------------------------*/
+baro_status = write_reg( BARO_REG_FIFO_CONFIG_1, 0 );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+return baro_flush_fifo();
+} /* baro_fifo_disable */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_fifo_watermark_reached                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Checks the FIFO watermark flag. Reading the interrupt status register  *
+*       clears the flag                                                        *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_fifo_watermark_reached
+	(
+	bool* reached_ptr /* Out: Watermark reached flag */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+BARO_STATUS baro_status; /* Baro API call return codes         */
+uint8_t     int_status;  /* Contents of INT_STATUS register    */
+
+
+/*------------------------------------------------------------------------------
+ API function implementation 
+------------------------------------------------------------------------------*/
+baro_status = read_regs( BARO_REG_INT_STATUS, 
+                         sizeof( int_status ), 
+                         &int_status );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+*reached_ptr = ( ( int_status & BARO_INT_STATUS_FWTM ) != 0 );
+return BARO_OK;
+} /* baro_fifo_watermark_reached */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_fifo_read                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Drains the sensor FIFO in one burst and parses the frames into         *
+*       compensated, timestamped samples, oldest first. Samples beyond         *
+*       max_samples are discarded, a buffer of BARO_FIFO_MAX_FRAMES samples    *
+*       never loses data                                                       *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_fifo_read
+	(
+	BARO_FIFO_SAMPLE* samples_ptr,    /* Out: Parsed samples             */
+	uint16_t          max_samples,    /* In:  Capacity of samples buffer */
+	uint16_t*         num_samples_ptr /* Out: Number of samples parsed   */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+BARO_STATUS baro_status;    /* Baro API call return codes              */
+uint8_t     length_bytes[2];/* Contents of FIFO_LENGTH registers       */
+uint16_t    fifo_length;    /* Number of bytes in the FIFO             */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+*num_samples_ptr = 0;
+
+
+/*------------------------------------------------------------------------------
+ API function implementation 
+------------------------------------------------------------------------------*/
+
+/* Number of buffered bytes */
+baro_status = read_regs( BARO_REG_FIFO_LENGTH, 
+                         sizeof( length_bytes ), 
+                         &length_bytes[0] );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+fifo_length = bytes_to_uint16_t( length_bytes[0], 
+                                 length_bytes[1] & BARO_FIFO_LENGTH_MSB_MASK );
+if ( fifo_length == 0 )
+	{
+	return BARO_OK;
+	}
+if ( fifo_length > BARO_FIFO_SIZE )
+	{
+	return BARO_FIFO_ERROR;
+	}
+
+/* Read the frames plus the sensor time frame appended once the FIFO 
+   has been drained */
+baro_status = read_regs( BARO_REG_FIFO_DATA, 
+                         fifo_length + BARO_FIFO_SENSORTIME_SIZE, 
+                         &baro_fifo_buffer[0] );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+
+*num_samples_ptr = fifo_parse( fifo_length + BARO_FIFO_SENSORTIME_SIZE, 
+                               samples_ptr, 
+                               max_samples );
+return BARO_OK;
+} /* baro_fifo_read */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_enable_drdy_IT                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Enables the data ready interrupt on the sensor INT pin, push-pull and  *
+*       active high. Each data ready edge passed to baro_drdy_ISR starts an    *
+*       interrupt driven read of the data registers, the latest sample is      *
+*       available through baro_get_sample                                      *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_enable_drdy_IT
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+BARO_STATUS baro_status; /* Baro API call return codes       */
+uint8_t     int_ctrl;    /* Contents of INT_CTRL register    */
+
+
+/*------------------------------------------------------------------------------
+ API function implementation 
+------------------------------------------------------------------------------*/
+
+/* Preserve the FIFO interrupt enables */
+baro_status = read_regs( BARO_REG_INT_CTRL, sizeof( int_ctrl ), &int_ctrl );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+int_ctrl &= ~( BARO_INT_OD | BARO_INT_LATCH );
+int_ctrl |= BARO_INT_LEVEL_HIGH | BARO_INT_DRDY_EN;
+baro_status = write_reg( BARO_REG_INT_CTRL, int_ctrl );
+if ( baro_status != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
+return BARO_OK;
+} /* baro_enable_drdy_IT */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_get_sample                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Gets the latest pressure and temperature sample read on a data ready   *
+*       interrupt. Returns BARO_NO_DATA if no sample has been read yet         *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_get_sample
+	(
+	float* pressure_ptr, /* Out: Baro pressure    */
+	float* temp_ptr      /* Out: Baro temperature */
+	)
+{
+/*------------------------------------------------------------------------------
+Local variables 
+------------------------------------------------------------------------------*/
+uint8_t     data_bytes[BARO_PRESS_TEMP_BURST_SIZE]; /* Sample copy        */
+uint32_t    seq;               /* Sample sequence number before the copy     */
+uint32_t    raw_pressure;      /* Pressure raw readout in uint32_t format    */
+uint32_t    raw_temp;          /* Temperature raw readout in uint32_t format */
+uint32_t    primask;           /* Interrupt mask on entry                    */
+uint8_t     i;                 /* Loop counter                               */
+
+
+/*------------------------------------------------------------------------------
+API function implementation 
+------------------------------------------------------------------------------*/
+
+/* Retry a data ready edge that arrived while the bus was busy, with 
+   interrupts masked so a new edge cannot start a read at the same time */
+primask = __get_PRIMASK();
+__disable_irq();
+if ( baro_it_pending && !baro_it_busy && !baro_bus_claimed )
+	{
+	baro_it_pending = false;
+	start_read_IT();
+	}
+__set_PRIMASK( primask );
+
+/* Copy the sample, retrying if the read complete interrupt updated it */
+do
+	{
+	seq = baro_it_seq;
+	for ( i = 0; i < sizeof( data_bytes ); ++i )
+		{
+		data_bytes[i] = baro_it_sample[i];
+		}
+	} while ( ( seq & 1 ) || ( seq != baro_it_seq ) );
+if ( seq == 0 )
+	{
+	return BARO_NO_DATA;
+	}
+
+/* Combine all bytes value to 24 bit values */
+raw_pressure = ( ( (uint32_t) data_bytes[2] << 16 ) |
+                 ( (uint32_t) data_bytes[1] <<  8 ) |
+				 ( (uint32_t) data_bytes[0]       ) );
+raw_temp     = ( ( (uint32_t) data_bytes[5] << 16 ) |
+                 ( (uint32_t) data_bytes[4] <<  8 ) |
+				 ( (uint32_t) data_bytes[3]       ) );
+
+/* Compensate temperature first, pressure compensation depends on it */
+*temp_ptr     = ( (float) temp_compensate ( raw_temp     ) )/100.0f;
+*pressure_ptr = ( (float) press_compensate( raw_pressure ) )/100.0f;
+
+return BARO_OK;
+} /* baro_get_sample */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_bus_acquire                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Claims BARO_I2C for a blocking transfer. Data ready edges are deferred *
+*       while the bus is claimed and an interrupt driven read in progress is   *
+*       waited for, since the HAL rejects a blocking transfer on a busy        *
+*       handle. Drivers sharing the bus, and the blocking baro API itself,     *
+*       wrap their transfers with baro_bus_acquire and baro_bus_release.       *
+*       Claims do not nest. Returns BARO_TIMEOUT without holding the claim if  *
+*       the read in progress does not complete within HAL_SENSOR_TIMEOUT       *
+*                                                                              *
+*******************************************************************************/
+BARO_STATUS baro_bus_acquire
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+Local variables 
+------------------------------------------------------------------------------*/
+uint32_t start_tick; /* Time at start of wait, ms */
+
+
+/*------------------------------------------------------------------------------
+API function implementation 
+------------------------------------------------------------------------------*/
+baro_bus_claimed = true;
+start_tick       = HAL_GetTick();
+while ( baro_it_busy )
+	{
+	if ( ( HAL_GetTick() - start_tick ) > HAL_SENSOR_TIMEOUT )
+		{
+		baro_bus_release();
+		return BARO_TIMEOUT;
+		}
+	}
+return BARO_OK;
+} /* baro_bus_acquire */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_bus_release                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Releases a claim taken with baro_bus_acquire and starts the data       *
+*       register read for a data ready edge that arrived during the claim      *
+*                                                                              *
+*******************************************************************************/
+void baro_bus_release
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+Local variables 
+------------------------------------------------------------------------------*/
+uint32_t primask; /* Interrupt mask on entry */
+
+
+/*------------------------------------------------------------------------------
+API function implementation 
+------------------------------------------------------------------------------*/
+primask = __get_PRIMASK();
+__disable_irq();
+baro_bus_claimed = false;
+if ( baro_it_pending && !baro_it_busy )
+	{
+	baro_it_pending = false;
+	start_read_IT();
+	}
+__set_PRIMASK( primask );
+} /* baro_bus_release */
+
+
+/*------------------------------------------------------------------------------
+ Interrupt Service Routines 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_drdy_ISR                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		Sensor INT pin data ready interrupt, starts a read of the data         *
+*       registers, or defers it to baro_bus_release while a blocking transfer  *
+*       holds the bus. Call from HAL_GPIO_EXTI_Callback                        *
+*                                                                              *
+*******************************************************************************/
+void baro_drdy_ISR
+	(
+	void
+	)
+{
+if ( baro_it_busy )
+	{
+	return;
+	}
+if ( baro_bus_claimed )
+	{
+	baro_it_pending = true;
+	return;
+	}
+start_read_IT();
+} /* baro_drdy_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_read_cplt_ISR                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		I2C read complete interrupt, publishes the sample. Call from           *
+*       HAL_I2C_MemRxCpltCallback                                              *
+*                                                                              *
+*******************************************************************************/
+void baro_read_cplt_ISR
+	(
+	I2C_HandleTypeDef* hi2c /* In: I2C handle of the completed transfer */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+uint8_t i; /* Loop counter */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( hi2c != &( BARO_I2C ) || !baro_it_busy )
+	{
+	return;
+	}
+baro_it_seq++;
+for ( i = 0; i < sizeof( baro_it_buffer ); ++i )
+	{
+	baro_it_sample[i] = baro_it_buffer[i];
+	}
+baro_it_seq++;
+baro_it_busy = false;
+} /* baro_read_cplt_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   * 
+* 		baro_error_ISR                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 * 
+* 		I2C error interrupt, drops the transfer in progress. Call from         *
+*       HAL_I2C_ErrorCallback                                                  *
+*                                                                              *
+*******************************************************************************/
+void baro_error_ISR
+	(
+	I2C_HandleTypeDef* hi2c /* In: I2C handle of the failed transfer */
+	)
+{
+if ( hi2c == &( BARO_I2C ) )
+	{
+	baro_it_busy = false;
+	}
+} /* baro_error_ISR */
+
+
 /*------------------------------------------------------------------------------
  Internal procedures 
 ------------------------------------------------------------------------------*/
@@ -521,7 +1287,7 @@ return ( (int16_t) bytes_comb );
 static BARO_STATUS read_regs
 	(
 	uint8_t  reg_addr, /* In:  Register address            */
-	uint8_t  num_regs, /* In:  Number of registers to read */
+	uint16_t num_regs, /* In:  Number of registers to read */
 	uint8_t* pData     /* Out: Register contents           */
 	)
 {   
@@ -543,7 +1309,11 @@ i2c_timeout = BARO_DEFAULT_TIMEOUT*num_regs;
  Implementation 
 ------------------------------------------------------------------------------*/
 
-/* Read I2C register*/
+/* Read I2C register, serialized with the interrupt driven reads */
+if ( baro_bus_acquire() != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
 hal_status = HAL_I2C_Mem_Read( &( BARO_I2C )       ,
 				               BARO_I2C_ADDR       ,
 				               reg_addr            ,
@@ -551,6 +1321,7 @@ hal_status = HAL_I2C_Mem_Read( &( BARO_I2C )       ,
 				               pData               ,
 				               num_regs            , 
 				               i2c_timeout );
+baro_bus_release();
 if ( hal_status != HAL_OK )
 	{
 	return BARO_I2C_ERROR;
@@ -588,7 +1359,11 @@ HAL_StatusTypeDef hal_status; /* HAL API Return codes */
  Implementation 
 ------------------------------------------------------------------------------*/
 
-/* Write to register with I2C */
+/* Write to register with I2C, serialized with the interrupt driven reads */
+if ( baro_bus_acquire() != BARO_OK )
+	{
+	return BARO_I2C_ERROR;
+	}
 hal_status = HAL_I2C_Mem_Write( &( BARO_I2C )       ,
 				                BARO_I2C_ADDR       ,
 				                reg_addr            ,
@@ -596,6 +1371,7 @@ hal_status = HAL_I2C_Mem_Write( &( BARO_I2C )       ,
 				                &data               ,
 				                sizeof( uint8_t )   , 
 				                BARO_DEFAULT_TIMEOUT );
+baro_bus_release();
 if ( hal_status != HAL_OK )
 	{
 	return BARO_I2C_ERROR;
@@ -668,28 +1444,26 @@ cal_data_int.par_p11 = (int8_t) buffer[20];
 
 
 /*------------------------------------------------------------------------------
- Convert to floating point format ( BMP390 Datasheet pg. 55 ) 
+ Pre-scale for the fixed-point compensation ( BMP390 Datasheet sec. 8.5 ) 
 ------------------------------------------------------------------------------*/
 
 /* Temp Compensation */
-baro_cal_data.par_t1   = ( ( (float) cal_data_int.par_t1  )/( 0.00390625f        ) );
-baro_cal_data.par_t2   = ( ( (float) cal_data_int.par_t2  )/( 1073741824.0f      ) );
-baro_cal_data.par_t3   = ( ( (float) cal_data_int.par_t3  )/( 281474976710656.0f ) );
+baro_cal_data.par_t1   = ( (int64_t) cal_data_int.par_t1 ) << 8;
+baro_cal_data.par_t2   = ( (int64_t) cal_data_int.par_t2 ) << 18;
+baro_cal_data.par_t3   = ( (int64_t) cal_data_int.par_t3 );
 
 /* Pressure Compensation */
-baro_cal_data.par_p1   = ( (float) ( cal_data_int.par_p1 - 16384 ) );
-baro_cal_data.par_p1  /= ( 1048576.0f );
-baro_cal_data.par_p2   = ( (float) ( cal_data_int.par_p2 - 16384 ) );
-baro_cal_data.par_p2  /= ( 536870912.0f );
-baro_cal_data.par_p3   = ( ( (float) cal_data_int.par_p3  )/( 4294967296.0f           ) );
-baro_cal_data.par_p4   = ( ( (float) cal_data_int.par_p4  )/( 137438953472.0f         ) );
-baro_cal_data.par_p5   = ( ( (float) cal_data_int.par_p5  )/( 0.125f                  ) );
-baro_cal_data.par_p6   = ( ( (float) cal_data_int.par_p6  )/( 64.0f                   ) );
-baro_cal_data.par_p7   = ( ( (float) cal_data_int.par_p7  )/( 256.0f                  ) );
-baro_cal_data.par_p8   = ( ( (float) cal_data_int.par_p8  )/( 32768.0f                ) );
-baro_cal_data.par_p9   = ( ( (float) cal_data_int.par_p9  )/( 281474976710656.0f      ) );
-baro_cal_data.par_p10  = ( ( (float) cal_data_int.par_p10 )/( 281474976710656.0f      ) );
-baro_cal_data.par_p11  = ( ( (float) cal_data_int.par_p11 )/( 36893488147419103232.0f ) );
+baro_cal_data.par_p1   = ( (int64_t) cal_data_int.par_p1 - 16384 )*70368744177664;
+baro_cal_data.par_p2   = ( (int64_t) cal_data_int.par_p2 - 16384 )*2097152;
+baro_cal_data.par_p3   = ( (int64_t) cal_data_int.par_p3  )*4;
+baro_cal_data.par_p4   = ( (int64_t) cal_data_int.par_p4  );
+baro_cal_data.par_p5   = ( (int64_t) cal_data_int.par_p5  ) << 47;
+baro_cal_data.par_p6   = ( (int64_t) cal_data_int.par_p6  ) << 22;
+baro_cal_data.par_p7   = ( (int64_t) cal_data_int.par_p7  )*16;
+baro_cal_data.par_p8   = ( (int64_t) cal_data_int.par_p8  );
+baro_cal_data.par_p9   = ( (int64_t) cal_data_int.par_p9  )*65536;
+baro_cal_data.par_p10  = ( (int64_t) cal_data_int.par_p10 );
+baro_cal_data.par_p11  = ( (int64_t) cal_data_int.par_p11 );
 
 /* Load Successful */
 return BARO_OK;
@@ -703,10 +1477,12 @@ return BARO_OK;
 *       temp_compensate                                                        *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Apply the compensation formula to raw temperature readout              *
+*       Apply the compensation formula to raw temperature readout. Returns     *
+*       the temperature in 0.01 degC and updates the linearized temperature    *
+*       used for pressure compensation                                         *
 *                                                                              *
 *******************************************************************************/
-static float temp_compensate
+static int32_t temp_compensate
 	(
 	uint32_t raw_readout
 	)
@@ -714,25 +1490,18 @@ static float temp_compensate
 /*------------------------------------------------------------------------------
  Local variables  
 ------------------------------------------------------------------------------*/
-float partial_data1; /* Intermediate compensation results */
-float partial_data2;
-
-
-/*------------------------------------------------------------------------------
- Initializations 
-------------------------------------------------------------------------------*/
-partial_data1 = 0;
-partial_data2 = 0;
+int64_t partial_data1; /* Intermediate compensation results */
+int64_t partial_data2;
 
 
 /*------------------------------------------------------------------------------
  Calculations 
 ------------------------------------------------------------------------------*/
-partial_data1 = (float)( raw_readout - baro_cal_data.par_t1 );
-partial_data2 = (float)( partial_data1*baro_cal_data.par_t2 );
-baro_cal_data.comp_temp = (float)( partial_data2 + 
-                            powf( partial_data1, 2)*baro_cal_data.par_t3 );
-return baro_cal_data.comp_temp;
+partial_data1       = (int64_t) raw_readout - baro_cal_data.par_t1;
+partial_data2       = partial_data1*baro_cal_data.par_t2 + 
+                      partial_data1*partial_data1*baro_cal_data.par_t3;
+baro_cal_data.t_lin = partial_data2/4294967296;
+return (int32_t) ( ( baro_cal_data.t_lin*25 )/16384 );
 
 } /* temp_compensate */
 
@@ -743,10 +1512,11 @@ return baro_cal_data.comp_temp;
 *       press_compensate                                                       *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Apply the compensation formula to raw pressure readouts                *
+*       Apply the compensation formula to raw pressure readouts. Returns the   *
+*       pressure in 0.01 Pa, temp_compensate must be called first              *
 *                                                                              *
 *******************************************************************************/
-static float press_compensate 
+static uint32_t press_compensate 
 	(
 	uint32_t raw_readout
 	)
@@ -754,50 +1524,58 @@ static float press_compensate
 /*------------------------------------------------------------------------------
  Local variables  
 ------------------------------------------------------------------------------*/
-float partial_data1; /* Intermediate compensation results */
-float partial_data2;
-float partial_data3;
-float partial_data4;
-float partial_out1;
-float partial_out2;
+int64_t t_lin;         /* Linearized temperature                */
+int64_t t_lin_sq;      /* Squared linearized temperature        */
+int64_t t_lin_cu;      /* Cubed linearized temperature, scaled  */
+int64_t raw_press;     /* Raw pressure readout                  */
+int64_t partial_data1; /* Intermediate compensation results     */
+int64_t partial_data2;
+int64_t partial_data3;
+int64_t offset;        /* Pressure offset term                  */
+int64_t sensitivity;   /* Pressure sensitivity term             */
 
 
 /*------------------------------------------------------------------------------
  Initializations 
 ------------------------------------------------------------------------------*/
-partial_data1 = 0;
-partial_data2 = 0;
-partial_data3 = 0;
-partial_data3 = 0;
-partial_out1  = 0;
-partial_out2  = 0;
+t_lin     = baro_cal_data.t_lin;
+raw_press = (int64_t) raw_readout;
+t_lin_sq  = t_lin*t_lin;
+t_lin_cu  = ( ( t_lin_sq/64 )*t_lin )/256;
 
 
 /*------------------------------------------------------------------------------
  Calculations 
 ------------------------------------------------------------------------------*/
-partial_data1 = baro_cal_data.par_p6*baro_cal_data.comp_temp;
-partial_data2 = baro_cal_data.par_p7*powf( baro_cal_data.comp_temp, 2 );
-partial_data3 = baro_cal_data.par_p8*powf( baro_cal_data.comp_temp, 3 );
-partial_out1  =  ( baro_cal_data.par_p5 + partial_data1 + 
-                   partial_data2        + partial_data3 );
-
-partial_data1 = baro_cal_data.par_p2*baro_cal_data.comp_temp;
-partial_data2 = baro_cal_data.par_p3*powf( baro_cal_data.comp_temp, 2 );
-partial_data3 = baro_cal_data.par_p4*powf( baro_cal_data.comp_temp, 3 );
-partial_out2  = (float) raw_readout*( baro_cal_data.par_p1 + 
-                                      partial_data1        +
-									  partial_data2        +
-									  partial_data3 );
-
-partial_data1 = powf( ( (float) raw_readout ), 2 );
-partial_data2 = ( baro_cal_data.par_p9 + 
-                  baro_cal_data.par_p10*baro_cal_data.comp_temp );
-partial_data3 = partial_data1*partial_data2;
-partial_data4 = ( partial_data3 + 
-                  powf( ( (float) raw_readout ), 3 )*baro_cal_data.par_p11 );
-
-return partial_out1 + partial_out2 + partial_data4;
+
+/* Offset, polynomial in temperature */
+offset      = baro_cal_data.par_p5                        + 
+              ( baro_cal_data.par_p8*t_lin_cu )/32        + 
+              baro_cal_data.par_p7*t_lin_sq               + 
+              baro_cal_data.par_p6*t_lin;
+
+/* Sensitivity, polynomial in temperature */
+sensitivity = baro_cal_data.par_p1                        + 
+              ( baro_cal_data.par_p4*t_lin_cu )/32        + 
+              baro_cal_data.par_p3*t_lin_sq               + 
+              baro_cal_data.par_p2*t_lin;
+
+/* First order pressure term */
+partial_data1 = ( sensitivity/16777216 )*raw_press;
+
+/* Second order pressure term, divided by 10 before the final product 
+   to avoid overflow */
+partial_data2 = ( ( baro_cal_data.par_p10*t_lin + baro_cal_data.par_p9 )*
+                  raw_press )/8192;
+partial_data2 = ( ( raw_press*( partial_data2/10 ) )/512 )*10;
+
+/* Third order pressure term */
+partial_data3 = ( baro_cal_data.par_p11*( raw_press*raw_press ) )/65536;
+partial_data3 = ( partial_data3*raw_press )/128;
+
+/* Combine and scale to 0.01 Pa */
+partial_data1 = offset/4 + partial_data1 + partial_data2 + partial_data3;
+return (uint32_t) ( ( ( (uint64_t) partial_data1 )*25 )/1099511627776 );
 
 } /* press_compensate */
 
@@ -838,6 +1616,203 @@ return write_reg( BARO_REG_CMD, BARO_CMD_FIFO_FLUSH );
 } /* baro_flush_fifo */
 
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+*       start_read_IT                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start an interrupt driven read of the pressure and temperature data    *
+*       registers. If the bus is busy with another transfer the read is        *
+*       retried from baro_get_sample                                           *
+*                                                                              *
+*******************************************************************************/
+static void start_read_IT
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+HAL_StatusTypeDef hal_status;  /* HAL API Return codes */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+baro_it_busy = true;
+hal_status   = HAL_I2C_Mem_Read_IT( &( BARO_I2C )          ,
+                                    BARO_I2C_ADDR          ,
+                                    BARO_REG_PRESS_DATA    ,
+                                    I2C_MEMADD_SIZE_8BIT   ,
+                                    &baro_it_buffer[0]     ,
+                                    sizeof( baro_it_buffer ) );
+if ( hal_status != HAL_OK )
+	{
+	baro_it_busy    = false;
+	baro_it_pending = true;
+	}
+} /* start_read_IT */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+*       fifo_parse                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Parse raw FIFO contents into compensated samples. The FIFO only        *
+*       reports the sensor time at the end of a read, so samples are           *
+*       timestamped backwards from it at the ODR frame interval. Returns the   *
+*       number of samples parsed                                               *
+*                                                                              *
+*******************************************************************************/
+static uint16_t fifo_parse
+	(
+	uint16_t          fifo_length, /* In:  Number of bytes read from FIFO */
+	BARO_FIFO_SAMPLE* samples_ptr, /* Out: Parsed samples                 */
+	uint16_t          max_samples  /* In:  Capacity of samples buffer     */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+uint8_t* frame_ptr;     /* Current frame                                  */
+uint16_t index;         /* Byte index of current frame                    */
+uint16_t num_frames;    /* Number of sample frames, partial ones included */
+uint16_t num_samples;   /* Number of samples stored                       */
+uint32_t raw_temp;      /* Raw temperature readout                        */
+uint32_t raw_pressure;  /* Raw pressure readout                           */
+uint32_t frame_ticks;   /* Sensor time between frames                     */
+uint32_t newest_time;   /* Sensor time of the newest frame                */
+bool     time_found;    /* Sensor time frame present                      */
+uint16_t i;             /* Loop counter                                   */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+index       = 0;
+num_frames  = 0;
+num_samples = 0;
+newest_time = 0;
+time_found  = false;
+frame_ticks = BARO_ODR_PERIOD_TICKS( baro_configuration.ODR_setting );
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Walk the frames */
+while ( index < fifo_length )
+	{
+	frame_ptr = &baro_fifo_buffer[index];
+	switch ( frame_ptr[0] )
+		{
+		case BARO_FIFO_FRAME_PRESS_TEMP:
+			{
+			if ( index + BARO_FIFO_PRESS_TEMP_SIZE > fifo_length )
+				{
+				index = fifo_length;
+				break;
+				}
+
+			/* Temperature precedes pressure in FIFO frames */
+			if ( num_samples < max_samples )
+				{
+				raw_temp     = ( ( (uint32_t) frame_ptr[3] << 16 ) |
+				                 ( (uint32_t) frame_ptr[2] <<  8 ) |
+				                 ( (uint32_t) frame_ptr[1]       ) );
+				raw_pressure = ( ( (uint32_t) frame_ptr[6] << 16 ) |
+				                 ( (uint32_t) frame_ptr[5] <<  8 ) |
+				                 ( (uint32_t) frame_ptr[4]       ) );
+				samples_ptr[num_samples].temp     = 
+				    ( (float) temp_compensate ( raw_temp     ) )/100.0f;
+				samples_ptr[num_samples].pressure = 
+				    ( (float) press_compensate( raw_pressure ) )/100.0f;
+
+				/* Frame position, turned into the sensor time below */
+				samples_ptr[num_samples].sensor_time = num_frames;
+				num_samples++;
+				}
+			num_frames++;
+			index += BARO_FIFO_PRESS_TEMP_SIZE;
+			break;
+			}
+
+		case BARO_FIFO_FRAME_TEMP:
+		case BARO_FIFO_FRAME_PRESS:
+			{
+			/* Partial frames around a configuration change are not stored 
+			   but still take a frame interval */
+			if ( index + BARO_FIFO_SINGLE_SIZE > fifo_length )
+				{
+				index = fifo_length;
+				break;
+				}
+			num_frames++;
+			index += BARO_FIFO_SINGLE_SIZE;
+			break;
+			}
+
+		case BARO_FIFO_FRAME_SENSORTIME:
+			{
+			if ( index + BARO_FIFO_SENSORTIME_SIZE > fifo_length )
+				{
+				index = fifo_length;
+				break;
+				}
+			newest_time = ( ( (uint32_t) frame_ptr[3] << 16 ) |
+			                ( (uint32_t) frame_ptr[2] <<  8 ) |
+			                ( (uint32_t) frame_ptr[1]       ) );
+			time_found  = true;
+			index      += BARO_FIFO_SENSORTIME_SIZE;
+			break;
+			}
+
+		case BARO_FIFO_FRAME_CONFIG_ERR:
+		case BARO_FIFO_FRAME_CONFIG_CHG:
+			{
+			index += BARO_FIFO_CONFIG_SIZE;
+			break;
+			}
+
+		default:
+			{
+			/* Empty frame or unrecognized header, end of data */
+			index = fifo_length;
+			break;
+			}
+		}
+	}
+
+/* The newest frame was sampled on the last frame interval boundary before 
+   the sensor time frame, otherwise extrapolate from the previous read */
+if ( time_found )
+	{
+	newest_time -= newest_time % frame_ticks;
+	}
+else
+	{
+	newest_time = ( baro_fifo_last_time + num_frames*frame_ticks ) & 
+	              BARO_SENSORTIME_MASK;
+	}
+baro_fifo_last_time = newest_time;
+
+/* Timestamp stored samples from their frame positions */
+for ( i = 0; i < num_samples; ++i )
+	{
+	samples_ptr[i].sensor_time = ( newest_time - 
+	                               ( num_frames - 1 - 
+	                                 samples_ptr[i].sensor_time )*frame_ticks ) &
+	                             BARO_SENSORTIME_MASK;
+	}
+return num_samples;
+} /* fifo_parse */
+
+
 /*******************************************************************************
 * END OF FILE                                                                  * 
 *******************************************************************************/
\ No newline at end of file
@@ -17,6 +17,7 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include "stm32h7xx_hal.h"
 
 /*------------------------------------------------------------------------------
@@ -32,6 +33,13 @@ extern "C" {
 #define BARO_REG_ERR_REG        ( 0x02 )
 #define BARO_REG_PRESS_DATA     ( 0x04 )  
 #define BARO_REG_TEMP_DATA      ( 0x07 ) 
+#define BARO_REG_INT_STATUS     ( 0x11 )
+#define BARO_REG_FIFO_LENGTH    ( 0x12 )
+#define BARO_REG_FIFO_DATA      ( 0x14 )
+#define BARO_REG_FIFO_WTM       ( 0x15 )
+#define BARO_REG_FIFO_CONFIG_1  ( 0x17 )
+#define BARO_REG_FIFO_CONFIG_2  ( 0x18 )
+#define BARO_REG_INT_CTRL       ( 0x19 )
 #define BARO_REG_PWR_CTRL       ( 0x1B )
 #define BARO_REG_OSR            ( 0x1C ) 
 #define BARO_REG_ODR            ( 0x1D )
@@ -56,6 +64,9 @@ extern "C" {
 #define BMP390_DEVICE_ID        ( 0x60 )
 #define BMP388_DEVICE_ID        ( 0x50 )
 
+/* Size of a combined pressure and temperature readout in bytes */
+#define BARO_PRESS_TEMP_BURST_SIZE ( 6 )
+
 /* Size of calibration data in bytes */
 #define BARO_CAL_BUFFER_SIZE    ( 21   )
 
@@ -66,6 +77,63 @@ extern "C" {
 	#define BARO_DEFAULT_TIMEOUT    ( 0xFFFFFFFF )
 #endif /* ifndef SDR_DEBUG */
 
+/* FIFO register bitfields */
+#define BARO_FIFO_MODE_EN          ( 0x01 ) /* FIFO_CONFIG_1 */
+#define BARO_FIFO_TIME_EN          ( 0x04 )
+#define BARO_FIFO_PRESS_EN         ( 0x08 )
+#define BARO_FIFO_TEMP_EN          ( 0x10 )
+#define BARO_FIFO_DATA_FILTERED    ( 0x08 ) /* FIFO_CONFIG_2 */
+#define BARO_INT_FWTM_EN           ( 0x08 ) /* INT_CTRL      */
+#define BARO_INT_STATUS_FWTM       ( 0x01 ) /* INT_STATUS    */
+#define BARO_INT_OD                ( 0x01 ) /* INT_CTRL      */
+#define BARO_INT_LEVEL_HIGH        ( 0x02 )
+#define BARO_INT_LATCH             ( 0x04 )
+#define BARO_INT_DRDY_EN           ( 0x40 )
+#define BARO_FIFO_LENGTH_MSB_MASK  ( 0x01 )
+
+/* FIFO frame headers */
+#define BARO_FIFO_FRAME_PRESS_TEMP ( 0x94 )
+#define BARO_FIFO_FRAME_TEMP       ( 0x90 )
+#define BARO_FIFO_FRAME_PRESS      ( 0x84 )
+#define BARO_FIFO_FRAME_SENSORTIME ( 0xA0 )
+#define BARO_FIFO_FRAME_EMPTY      ( 0x80 )
+#define BARO_FIFO_FRAME_CONFIG_ERR ( 0x44 )
+#define BARO_FIFO_FRAME_CONFIG_CHG ( 0x48 )
+
+/* FIFO frame sizes in bytes, including the header */
+#define BARO_FIFO_PRESS_TEMP_SIZE  ( 7   )
+#define BARO_FIFO_SINGLE_SIZE      ( 4   )
+#define BARO_FIFO_SENSORTIME_SIZE  ( 4   )
+#define BARO_FIFO_CONFIG_SIZE      ( 2   )
+
+/* FIFO capacity in bytes and in pressure and temperature frames */
+#define BARO_FIFO_SIZE             ( 512 )
+#define BARO_FIFO_MAX_FRAMES       ( BARO_FIFO_SIZE/BARO_FIFO_PRESS_TEMP_SIZE )
+
+/* Sensor time counter, 24 bit at 25.6 kHz ( 39.0625 us per tick ) */
+#define BARO_SENSORTIME_MASK       ( 0x00FFFFFF )
+#define BARO_SENSORTIME_TO_US( t ) ( ( (uint64_t) ( t )*625 )/16 )
+
+/* Sensor time ticks between FIFO frames for a BARO_ODR_SETTING */
+#define BARO_ODR_PERIOD_TICKS( odr ) ( 128U << ( odr ) )
+
+/* Sample period in ms of a BARO_ODR_SETTING */
+#define BARO_ODR_PERIOD_MS( odr ) ( 5U << ( odr ) )
+
+/* Barometric formula, h = BARO_ALT_SCALE*( 1 - (p/p0)^BARO_ALT_EXPONENT ) */
+#define BARO_ALT_SCALE           ( 44330.77f  )
+#define BARO_ALT_EXPONENT        ( 0.190263f  )
+#define BARO_STD_SEA_LEVEL_PRESS ( 101325.0f  )
+
+/* Altitude power function tables, mantissa table index bits and the range 
+   of pressure ratio exponents covered */
+#define BARO_ALT_TABLE_BITS      ( 7 )
+#define BARO_ALT_TABLE_SIZE      ( ( 1 << BARO_ALT_TABLE_BITS ) + 1 )
+#define BARO_ALT_EXP_MIN         ( -8 )
+#define BARO_ALT_EXP_MAX         ( 1  )
+#define BARO_ALT_RATIO_MIN       ( 0.00390625f )
+#define BARO_ALT_RATIO_MAX       ( 3.99f       )
+
 /* Baro sensor command codes */
 #define BARO_CMD_RESET          ( 0xB6 )
 #define BARO_CMD_FIFO_FLUSH     ( 0xB0 )
@@ -88,7 +156,8 @@ typedef enum _BARO_STATUS
 	BARO_CAL_ERROR              ,
 	BARO_I2C_ERROR              ,
 	BARO_CANNOT_RESET           ,
-	BARO_FIFO_ERROR
+	BARO_FIFO_ERROR             ,
+	BARO_NO_DATA
 	} BARO_STATUS;
 
 /* Sensor enable encodings */
@@ -180,6 +249,14 @@ typedef struct _BARO_CONFIG
 
 	} BARO_CONFIG;
 
+/* Timestamped sample parsed from the sensor FIFO */
+typedef struct _BARO_FIFO_SAMPLE
+	{
+	uint32_t sensor_time; /* Sensor time of the sample, 39.0625 us ticks */
+	float    pressure;    /* Compensated pressure, Pa                    */
+	float    temp;        /* Compensated temperature, degC               */
+	} BARO_FIFO_SAMPLE;
+
 /* Baro calibration data struct in integer format */
 typedef struct _BARO_CAL_DATA_INT
 	{
@@ -202,29 +279,32 @@ typedef struct _BARO_CAL_DATA_INT
 	int8_t   par_p11;
 	} BARO_CAL_DATA_INT;
 
-/* Baro calibration data struct in floating point format */
+/* Baro calibration data struct, pre-scaled for the fixed-point compensation 
+   formulas ( BMP390 Datasheet section 8.5 ). Each coefficient is stored with
+   its constant scale factor already applied so the per-sample compensation 
+   only needs multiplications and shifts */
 typedef struct _BARO_CAL_DATA
 	{
 	/* Temperature Compensation Coefficients */
-	float par_t1;
-	float par_t2;
-	float par_t3;
+	int64_t par_t1;     /* 2^8*par_t1                  */
+	int64_t par_t2;     /* 2^18*par_t2                 */
+	int64_t par_t3;
 
 	/* Pressure Compensation Coefficients */
-	float par_p1;
-	float par_p2;
-	float par_p3;
-	float par_p4;
-	float par_p5;
-	float par_p6;
-	float par_p7;
-	float par_p8;
-	float par_p9;
-	float par_p10;
-	float par_p11;
-
-	/* Temperature Compensated Measurement, for pressure compensation */
-	float comp_temp;
+	int64_t par_p1;     /* 2^46*( par_p1 - 2^14 )      */
+	int64_t par_p2;     /* 2^21*( par_p2 - 2^14 )      */
+	int64_t par_p3;     /* 2^2*par_p3                  */
+	int64_t par_p4;
+	int64_t par_p5;     /* 2^47*par_p5                 */
+	int64_t par_p6;     /* 2^22*par_p6                 */
+	int64_t par_p7;     /* 2^4*par_p7                  */
+	int64_t par_p8;
+	int64_t par_p9;     /* 2^16*par_p9                 */
+	int64_t par_p10;
+	int64_t par_p11;
+
+	/* Linearized temperature in 2^-16 degC, for pressure compensation */
+	int64_t t_lin;
 
 	} BARO_CAL_DATA;
 
@@ -258,16 +338,105 @@ BARO_STATUS baro_get_pressure
     float* pressure_ptr 
 	);
 
+/* gets pressure and temp data from sensor in a single transaction */
+BARO_STATUS baro_get_press_temp
+	(
+    float* pressure_ptr,
+    float* temp_ptr
+	);
+
 /* gets temp data from sensor */
 BARO_STATUS baro_get_temp
 	(
     float* temp_ptr 
 	);
 
-/* converts pressure and temp data into altitude --> do research on formula */
+/* enables the sensor FIFO with pressure, temperature and sensor time */
+BARO_STATUS baro_fifo_enable
+	(
+	uint16_t watermark_frames
+	);
+
+/* disables the sensor FIFO */
+BARO_STATUS baro_fifo_disable
+	(
+	void
+	);
+
+/* checks if the FIFO watermark has been reached */
+BARO_STATUS baro_fifo_watermark_reached
+	(
+	bool* reached_ptr
+	);
+
+/* drains the sensor FIFO into a buffer of timestamped samples */
+BARO_STATUS baro_fifo_read
+	(
+	BARO_FIFO_SAMPLE* samples_ptr,
+	uint16_t          max_samples,
+	uint16_t*         num_samples_ptr
+	);
+
+/* enables the data ready interrupt on the sensor INT pin */
+BARO_STATUS baro_enable_drdy_IT
+	(
+	void
+	);
+
+/* gets the latest interrupt driven pressure and temp sample */
+BARO_STATUS baro_get_sample
+	(
+	float* pressure_ptr,
+	float* temp_ptr
+	);
+
+/* claims BARO_I2C for a blocking transfer of a driver sharing the bus */
+BARO_STATUS baro_bus_acquire
+	(
+	void
+	);
+
+/* releases BARO_I2C and starts a data ready read deferred by the claim */
+void baro_bus_release
+	(
+	void
+	);
+
+/* sensor INT pin data ready interrupt, call from the EXTI callback */
+void baro_drdy_ISR
+	(
+	void
+	);
+
+/* I2C read complete interrupt, call from HAL_I2C_MemRxCpltCallback */
+void baro_read_cplt_ISR
+	(
+	I2C_HandleTypeDef* hi2c
+	);
+
+/* I2C error interrupt, call from HAL_I2C_ErrorCallback */
+void baro_error_ISR
+	(
+	I2C_HandleTypeDef* hi2c
+	);
+
+/* gets altitude above the ground reference from sensor */
 BARO_STATUS baro_get_altitude
 	(
-    void
+    float* altitude_ptr
+	);
+
+/* captures the ground reference pressure for altitude */
+BARO_STATUS baro_set_ground_ref
+	(
+	uint16_t num_samples
+	);
+
+/* converts a pressure to altitude above a reference pressure */
+float baro_press_to_altitude
+	(
+	float pressure,
+	float ref_pressure
 	);
 
 
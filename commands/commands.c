@@ -13,19 +13,198 @@
  Standard Includes                                                               
 ------------------------------------------------------------------------------*/
 #include <stdbool.h>
+#include <string.h>
 
 /*------------------------------------------------------------------------------
  Project Includes                                                               
 ------------------------------------------------------------------------------*/
 #include "main.h"
 #include "commands.h"
-#ifdef USE_RS485
-    #include "rs485.h"
+#include "transport.h"
+#include "cycles.h"
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE ) || defined( VALVE_CONTROLLER  )
+	#include "sensor.h"
 #endif
-#include "usb.h"
-#ifdef VALVE_CONTROLLER
-    #include "valve.h"
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE )
+	#include "flash.h"
+	#include "ignition.h"
 #endif
+#if defined( VALVE_CONTROLLER )
+	#include "valve.h"
+	#include "solenoid.h"
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Global Variables 
+------------------------------------------------------------------------------*/
+
+/* Opcode to handler lookup, 0 for an unregistered opcode, otherwise one more
+   than the index into the handler and stats arrays */
+static uint8_t     cmd_index[256];
+
+/* Registered handlers and their execution times */
+static CMD_HANDLER cmd_handlers[CMD_MAX_HANDLERS];
+static CMD_STATS   cmd_stats[CMD_MAX_HANDLERS];
+static uint8_t     cmd_opcodes[CMD_MAX_HANDLERS];
+static uint8_t     num_handlers = 0;
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE )
+/* Flash buffer of the application, set by cmd_register_flash */
+static HFLASH_BUFFER* cmd_flash_handle = NULL;
+#endif
+
+/* Framed command in progress. Its handler reads the payload and writes the
+   response through cmd_frame_link, the response goes out in frames with
+   the header of the command */
+static const FRAME*     cmd_frame_ptr    = NULL;
+static const TRANSPORT* cmd_frame_source = NULL; /* Link the frame came on */
+static size_t           cmd_rx_offset    = 0;    /* Payload bytes read     */
+static uint8_t          cmd_reply_buffer[FRAME_MAX_PAYLOAD];
+static size_t           cmd_reply_size   = 0;    /* Response bytes pending */
+
+
+/*------------------------------------------------------------------------------
+ Internal function prototypes 
+------------------------------------------------------------------------------*/
+
+/* Start a framed command and return the link its handler uses */
+static const TRANSPORT* cmd_frame_open
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+
+/* Send the rest of the response of a framed command */
+static TRANSPORT_STATUS cmd_frame_close
+	(
+	void
+	);
+
+/* Send the pending response bytes of a framed command in one frame */
+static TRANSPORT_STATUS frame_link_send
+	(
+	uint32_t timeout
+	);
+
+/* Framed command link operations */
+static TRANSPORT_STATUS frame_link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	);
+
+static TRANSPORT_STATUS frame_link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	);
+
+static TRANSPORT_STATUS frame_link_receive_async
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	size_t*     rx_count
+	);
+
+static void frame_link_flush
+	(
+	void
+	);
+
+static size_t frame_link_available
+	(
+	void
+	);
+
+/* Send a response to the source of a command */
+static CMD_STATUS cmd_reply
+	(
+	const CMD_CONTEXT* cmd_ptr ,
+	const void*        tx_data_ptr,
+	size_t             tx_data_size
+	);
+
+/* Get the subcommand code of a command */
+static CMD_STATUS cmd_get_subcommand
+	(
+	const CMD_CONTEXT* cmd_ptr       ,
+	uint8_t*           subcommand_ptr
+	);
+
+/* PING_OP handler */
+static CMD_STATUS ping_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+
+/* DIAG_OP handler */
+static CMD_STATUS diag_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE ) || defined( VALVE_CONTROLLER  )
+/* SENSOR_OP handler */
+static CMD_STATUS sensor_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+#endif
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE )
+/* FLASH_OP handler */
+static CMD_STATUS flash_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+
+/* IGNITE_OP handler */
+static CMD_STATUS ignite_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+#endif
+
+#if defined( VALVE_CONTROLLER )
+/* VALVE_OP handler */
+static CMD_STATUS valve_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+
+/* SOL_OP handler */
+static CMD_STATUS sol_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Framed Command Link
+------------------------------------------------------------------------------*/
+
+/* Link handed to the handler of a framed command, the timeout and kind of
+   link are those of the link the frame came on */
+static TRANSPORT cmd_frame_link = 
+	{
+	.transmit       = frame_link_transmit     ,
+	.receive        = frame_link_receive      ,
+	.receive_async  = frame_link_receive_async,
+	.flush          = frame_link_flush        ,
+	.transmit_async = NULL                    ,
+	.tx_wait        = NULL                    ,
+	.available      = frame_link_available    ,
+	.timeout        = HAL_DEFAULT_TIMEOUT     ,
+	.link           = TRANSPORT_LINK_USB
+	};
 
 
 /*------------------------------------------------------------------------------
@@ -35,61 +214,982 @@
 
 /*******************************************************************************
 *                                                                              *
-* PROCEDURE:                                                                   * 
-* 		ping                                                                   *
+* PROCEDURE:                                                                   *
+* 		cmd_dispatch_init                                                      *
 *                                                                              *
-* DESCRIPTION:                                                                 * 
-* 		Sends a 1 byte response back to host PC to signal a functioning        * 
-*       serial connection                                                      *
+* DESCRIPTION:                                                                 *
+*       Clear the dispatch table and execution times, start the cycle counter  *
+*       and register the handlers of the commands the board supports. FLASH_OP *
+*       needs the flash buffer of the application, see cmd_register_flash      *
 *                                                                              *
 *******************************************************************************/
-void ping
-    (
-    #ifndef VALVE_CONTROLLER
-        void
-    #else
-        CMD_SOURCE cmd_source
-    #endif
-    )
+void cmd_dispatch_init
+	(
+	void
+	)
+{
+memset( &cmd_index[0]   , 0, sizeof( cmd_index    ) );
+memset( &cmd_handlers[0], 0, sizeof( cmd_handlers ) );
+memset( &cmd_opcodes[0] , 0, sizeof( cmd_opcodes  ) );
+num_handlers = 0;
+cmd_reset_stats();
+
+/* Start the cycle counter for command timing */
+cycles_init();
+
+cmd_register( PING_OP, ping_cmd );
+cmd_register( DIAG_OP, diag_cmd );
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE ) || defined( VALVE_CONTROLLER  )
+cmd_register( SENSOR_OP, sensor_cmd );
+#endif
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE )
+cmd_flash_handle = NULL;
+cmd_register( IGNITE_OP, ignite_cmd );
+#endif
+
+#if defined( VALVE_CONTROLLER )
+cmd_register( VALVE_OP, valve_cmd );
+cmd_register( SOL_OP  , sol_cmd   );
+#endif
+} /* cmd_dispatch_init */
+
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE )
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_register_flash                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Register the FLASH_OP handler with the flash buffer of the application *
+*                                                                              *
+*******************************************************************************/
+CMD_STATUS cmd_register_flash
+	(
+	HFLASH_BUFFER* pflash_handle
+	)
+{
+if ( pflash_handle == NULL )
+	{
+	return CMD_FAIL;
+	}
+cmd_flash_handle = pflash_handle;
+return cmd_register( FLASH_OP, flash_cmd );
+} /* cmd_register_flash */
+#endif
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_register                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Register a handler for an opcode. Registering an opcode again replaces *
+*       its handler                                                            *
+*                                                                              *
+*******************************************************************************/
+CMD_STATUS cmd_register
+	(
+	uint8_t     opcode ,
+	CMD_HANDLER handler
+	)
+{
+/* Replace an existing handler */
+if ( cmd_index[opcode] != 0 )
+	{
+	cmd_handlers[cmd_index[opcode] - 1] = handler;
+	return CMD_OK;
+	}
+
+if ( num_handlers >= CMD_MAX_HANDLERS )
+	{
+	return CMD_TABLE_FULL;
+	}
+cmd_handlers[num_handlers] = handler;
+cmd_opcodes[num_handlers]  = opcode;
+num_handlers++;
+cmd_index[opcode]          = num_handlers;
+return CMD_OK;
+} /* cmd_register */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_dispatch                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Run the handler registered for a command in constant time and record   *
+*       its execution time in CPU cycles. The handler of a framed command gets *
+*       a link that reads the payload and sends its response in frames         *
+*                                                                              *
+*******************************************************************************/
+CMD_STATUS cmd_dispatch
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
 {
 /*------------------------------------------------------------------------------
- Local variables                                                                     
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t     index;        /* Handler index + 1                */
+CMD_STATS*  stats_ptr;    /* Opcode statistics                */
+CMD_STATUS  cmd_status;   /* Handler return code              */
+uint32_t    start_cycles; /* Cycle counter at entry           */
+uint32_t    cycles;       /* Cycles in the handler            */
+CMD_CONTEXT frame_cmd;    /* Framed command on the frame link */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+index = cmd_index[cmd_ptr->opcode];
+if ( index == 0 )
+	{
+	return CMD_UNRECOGNIZED;
+	}
+stats_ptr = &( cmd_stats[index - 1] );
+if ( cmd_ptr->frame_ptr != NULL )
+	{
+	frame_cmd               = *cmd_ptr;
+	frame_cmd.transport_ptr = cmd_frame_open( cmd_ptr );
+	cmd_ptr                 = &frame_cmd;
+	}
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+start_cycles = DWT->CYCCNT;
+cmd_status   = cmd_handlers[index - 1]( cmd_ptr );
+cycles       = DWT->CYCCNT - start_cycles;
+
+if ( ( cmd_ptr->frame_ptr != NULL        ) && 
+     ( cmd_frame_close() != TRANSPORT_OK ) && 
+     ( cmd_status == CMD_OK              ) )
+	{
+	cmd_status = CMD_FAIL;
+	}
+
+stats_ptr->count++;
+stats_ptr->total_cycles += cycles;
+if ( cycles < stats_ptr->min_cycles )
+	{
+	stats_ptr->min_cycles = cycles;
+	}
+if ( cycles > stats_ptr->max_cycles )
+	{
+	stats_ptr->max_cycles = cycles;
+	}
+return cmd_status;
+} /* cmd_dispatch */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_dispatch_frames                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Decode the bytes waiting on a link and dispatch each complete frame    *
+*       with its payload. Does not wait for more bytes, a frame split across   *
+*       calls stays in the decoder. Returns CMD_OK if every handler succeeded, *
+*       otherwise the last failing status                                      *
+*                                                                              *
+*******************************************************************************/
+CMD_STATUS cmd_dispatch_frames
+	(
+	const TRANSPORT* transport_ptr,
+	FRAME_DECODER*   decoder_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t     rx_buffer[CMD_RX_CHUNK_SIZE]; /* Received bytes            */
+size_t      rx_size;                      /* Bytes in rx_buffer        */
+size_t      rx_offset;                    /* Bytes decoded             */
+size_t      consumed;                     /* Bytes used by the decoder */
+FRAME       frame;                        /* Decoded frame             */
+CMD_CONTEXT cmd;                          /* Command of the frame      */
+CMD_STATUS  cmd_status;                   /* Handler return code       */
+CMD_STATUS  status;                       /* Return code               */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+status            = CMD_OK;
+cmd.transport_ptr = transport_ptr;
+cmd.frame_ptr     = &frame;
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+while ( ( rx_size = transport_available( transport_ptr ) ) > 0 )
+	{
+	if ( rx_size > sizeof( rx_buffer ) )
+		{
+		rx_size = sizeof( rx_buffer );
+		}
+	if ( transport_receive( transport_ptr, &rx_buffer[0], rx_size, 
+	                        transport_ptr->timeout ) != TRANSPORT_OK )
+		{
+		return CMD_FAIL;
+		}
+
+	for ( rx_offset = 0; rx_offset < rx_size; rx_offset += consumed )
+		{
+		if ( frame_decode( decoder_ptr, &rx_buffer[rx_offset], 
+		                   rx_size - rx_offset, &consumed, 
+		                   &frame ) != FRAME_OK )
+			{
+			continue;
+			}
+		cmd.opcode = frame.header.opcode;
+		cmd_status = cmd_dispatch( &cmd );
+		if ( cmd_status != CMD_OK )
+			{
+			status = cmd_status;
+			}
+		}
+	}
+return status;
+} /* cmd_dispatch_frames */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_get_stats                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the execution time statistics of an opcode                         *
+*                                                                              *
+*******************************************************************************/
+CMD_STATUS cmd_get_stats
+	(
+	uint8_t    opcode   ,
+	CMD_STATS* stats_ptr
+	)
+{
+if ( cmd_index[opcode] == 0 )
+	{
+	return CMD_UNRECOGNIZED;
+	}
+*stats_ptr = cmd_stats[cmd_index[opcode] - 1];
+return CMD_OK;
+} /* cmd_get_stats */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_reset_stats                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Clear the execution time statistics of all opcodes                     *
+*                                                                              *
+*******************************************************************************/
+void cmd_reset_stats
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t i; /* Handler index */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+memset( &cmd_stats[0], 0, sizeof( cmd_stats ) );
+for ( i = 0; i < CMD_MAX_HANDLERS; ++i )
+	{
+	cmd_stats[i].min_cycles = UINT32_MAX;
+	}
+} /* cmd_reset_stats */
+
+
+/*------------------------------------------------------------------------------
+ Internal procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_reply                                                              *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Send a response to the source of a command. The response of a framed   *
+*       command goes out in a frame with the same opcode, subcommand and       *
+*       sequence number. Returns CMD_FAIL if the response could not be sent    *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS cmd_reply
+	(
+	const CMD_CONTEXT* cmd_ptr     ,
+	const void*        tx_data_ptr ,
+	size_t             tx_data_size
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+TRANSPORT_STATUS transport_status; /* Transmit return code */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+transport_status = transport_transmit( cmd_ptr->transport_ptr, 
+                                       tx_data_ptr, tx_data_size, 
+                                       cmd_ptr->transport_ptr->timeout );
+return ( transport_status == TRANSPORT_OK ) ? CMD_OK : CMD_FAIL;
+} /* cmd_reply */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_frame_open                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start a framed command and return the link its handler uses            *
+*                                                                              *
+*******************************************************************************/
+static const TRANSPORT* cmd_frame_open
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+cmd_frame_ptr          = cmd_ptr->frame_ptr;
+cmd_frame_source       = cmd_ptr->transport_ptr;
+cmd_rx_offset          = 0;
+cmd_reply_size         = 0;
+cmd_frame_link.timeout = cmd_frame_source->timeout;
+cmd_frame_link.link    = cmd_frame_source->link;
+return &cmd_frame_link;
+} /* cmd_frame_open */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_frame_close                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Send the rest of the response of a framed command. A command without   *
+*       a response sends nothing                                               *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS cmd_frame_close
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+TRANSPORT_STATUS transport_status; /* Transmit return code */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+transport_status = TRANSPORT_OK;
+if ( cmd_reply_size > 0 )
+	{
+	transport_status = frame_link_send( cmd_frame_source->timeout );
+	}
+cmd_frame_ptr = NULL;
+return transport_status;
+} /* cmd_frame_close */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_link_send                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Send the pending response bytes of a framed command in one frame with  *
+*       the header of the command                                              *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS frame_link_send
+	(
+	uint32_t timeout
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
 ------------------------------------------------------------------------------*/
-uint8_t    response;   /* A0002 Response Code */
+FRAME_HEADER header; /* Response frame header */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+header         = cmd_frame_ptr->header;
+header.length  = (uint16_t) cmd_reply_size;
+cmd_reply_size = 0;
+return transport_transmit_frame( cmd_frame_source, &header, 
+                                 &cmd_reply_buffer[0], timeout );
+} /* frame_link_send */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_link_transmit                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Add bytes to the response of a framed command, sending a frame each    *
+*       time the payload fills up. A write that fits in one frame is not split *
+*       across two. Fails once the command has finished                        *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS frame_link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+const uint8_t*   data_ptr;         /* Next byte to add      */
+size_t           chunk;            /* Bytes added at a time */
+TRANSPORT_STATUS transport_status; /* Transmit return code  */
 
 
 /*------------------------------------------------------------------------------
  Initializations 
 ------------------------------------------------------------------------------*/
-response = PING_RESPONSE_CODE; /* Code specific to board and revision */
+if ( cmd_frame_ptr == NULL )
+	{
+	return TRANSPORT_FAIL;
+	}
+data_ptr = tx_data_ptr;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( ( cmd_reply_size + tx_data_size > sizeof( cmd_reply_buffer ) ) && 
+     ( tx_data_size <= sizeof( cmd_reply_buffer )                 ) )
+	{
+	transport_status = frame_link_send( timeout );
+	if ( transport_status != TRANSPORT_OK )
+		{
+		return transport_status;
+		}
+	}
+
+while ( tx_data_size > 0 )
+	{
+	if ( cmd_reply_size == sizeof( cmd_reply_buffer ) )
+		{
+		transport_status = frame_link_send( timeout );
+		if ( transport_status != TRANSPORT_OK )
+			{
+			return transport_status;
+			}
+		}
+	chunk = sizeof( cmd_reply_buffer ) - cmd_reply_size;
+	if ( chunk > tx_data_size )
+		{
+		chunk = tx_data_size;
+		}
+	memcpy( &cmd_reply_buffer[cmd_reply_size], data_ptr, chunk );
+	cmd_reply_size += chunk;
+	data_ptr       += chunk;
+	tx_data_size   -= chunk;
+	}
+return TRANSPORT_OK;
+} /* frame_link_transmit */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_link_receive                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Read the arguments of a framed command from its payload. The frame     *
+*       carries every argument, so a read past the payload, or after the       *
+*       command has finished, fails right away                                 *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS frame_link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	)
+{
+if ( ( cmd_frame_ptr == NULL ) || ( rx_data_size > frame_link_available() ) )
+	{
+	return TRANSPORT_FAIL;
+	}
+memcpy( rx_data_ptr, &( cmd_frame_ptr->payload[cmd_rx_offset] ), 
+        rx_data_size );
+cmd_rx_offset += rx_data_size;
+return TRANSPORT_OK;
+} /* frame_link_receive */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_link_receive_async                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Take the unread payload of a framed command, up to rx_data_size. No    *
+*       more bytes will arrive once the payload is used up, so that fails      *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS frame_link_receive_async
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	size_t*     rx_count
+	)
+{
+*rx_count = frame_link_available();
+if ( *rx_count > rx_data_size )
+	{
+	*rx_count = rx_data_size;
+	}
+if ( ( *rx_count == 0 ) && ( rx_data_size > 0 ) )
+	{
+	return TRANSPORT_FAIL;
+	}
+return frame_link_receive( rx_data_ptr, *rx_count, 0 );
+} /* frame_link_receive_async */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_link_flush                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Discard the unread payload of a framed command                         *
+*                                                                              *
+*******************************************************************************/
+static void frame_link_flush
+	(
+	void
+	)
+{
+if ( cmd_frame_ptr != NULL )
+	{
+	cmd_rx_offset = cmd_frame_ptr->header.length;
+	}
+} /* frame_link_flush */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_link_available                                                   *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Number of payload bytes of a framed command not read yet               *
+*                                                                              *
+*******************************************************************************/
+static size_t frame_link_available
+	(
+	void
+	)
+{
+if ( cmd_frame_ptr == NULL )
+	{
+	return 0;
+	}
+return cmd_frame_ptr->header.length - cmd_rx_offset;
+} /* frame_link_available */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cmd_get_subcommand                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the subcommand code of a command, from the header of a framed      *
+*       command or the next byte from the source of a legacy command           *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS cmd_get_subcommand
+	(
+	const CMD_CONTEXT* cmd_ptr       ,
+	uint8_t*           subcommand_ptr
+	)
+{
+if ( cmd_ptr->frame_ptr != NULL )
+	{
+	*subcommand_ptr = cmd_ptr->frame_ptr->header.subcommand;
+	return CMD_OK;
+	}
+
+if ( transport_receive( cmd_ptr->transport_ptr, subcommand_ptr, 
+                        sizeof( uint8_t ), 
+                        cmd_ptr->transport_ptr->timeout ) != TRANSPORT_OK )
+	{
+	return CMD_FAIL;
+	}
+return CMD_OK;
+} /* cmd_get_subcommand */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		ping_cmd                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       PING_OP handler, sends the board response code                         *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS ping_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables                                                                     
+------------------------------------------------------------------------------*/
+uint8_t response; /* Board response code */
+
+
+/*------------------------------------------------------------------------------
+ Command Implementation                                                         
+------------------------------------------------------------------------------*/
+response = PING_RESPONSE_CODE;
+return cmd_reply( cmd_ptr, &response, sizeof( response ) );
+} /* ping_cmd */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		diag_cmd                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       DIAG_OP handler. DIAG_SUBCMD_STATS sends a CMD_DIAG_ENTRY for each     *
+*       registered opcode in pages that fit in one frame, each page led by the *
+*       number of entries and the index of its first entry. DIAG_SUBCMD_RESET  *
+*       clears the statistics and replies with a CMD_STATUS byte               *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS diag_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables                                                                     
+------------------------------------------------------------------------------*/
+uint8_t        subcommand; /* Diagnostics subcommand                    */
+uint8_t        response[CMD_DIAG_PAGE_HEADER + 
+                        CMD_DIAG_PAGE_ENTRIES*sizeof( CMD_DIAG_ENTRY )];
+                           /* Page header followed by the entries       */
+CMD_DIAG_ENTRY entry;      /* Statistics of one opcode                  */
+uint8_t        first;      /* Handler index of the first page entry     */
+uint8_t        count;      /* Entries in the page                       */
+uint8_t        i;          /* Handler index                             */
 
 
 /*------------------------------------------------------------------------------
  Command Implementation                                                         
 ------------------------------------------------------------------------------*/
-#ifdef VALVE_CONTROLLER 
-    if ( cmd_source == CMD_SOURCE_USB )
-        {
-        usb_transmit( &response         , 
-                      sizeof( response ), 
-                      HAL_DEFAULT_TIMEOUT );
-        }
-    else
-        {
-        valve_transmit( &response         , 
-                        sizeof( response ), 
-                        HAL_DEFAULT_TIMEOUT );
-        }
+if ( cmd_get_subcommand( cmd_ptr, &subcommand ) != CMD_OK )
+	{
+	return CMD_FAIL;
+	}
+
+switch ( subcommand )
+	{
+	case DIAG_SUBCMD_STATS:
+		{
+		/* An empty table still sends its header */
+		first = 0;
+		do
+			{
+			count = num_handlers - first;
+			if ( count > CMD_DIAG_PAGE_ENTRIES )
+				{
+				count = CMD_DIAG_PAGE_ENTRIES;
+				}
+			response[0] = num_handlers;
+			response[1] = first;
+			for ( i = first; i < first + count; ++i )
+				{
+				memset( &entry, 0, sizeof( entry ) );
+				entry.opcode = cmd_opcodes[i];
+				entry.count  = cmd_stats[i].count;
+				if ( entry.count > 0 )
+					{
+					entry.min_cycles = cmd_stats[i].min_cycles;
+					entry.max_cycles = cmd_stats[i].max_cycles;
+					entry.avg_cycles = (uint32_t) ( cmd_stats[i].total_cycles / 
+					                                cmd_stats[i].count );
+					}
+				memcpy( &( response[CMD_DIAG_PAGE_HEADER + 
+				                    ( i - first )*sizeof( entry )] ), 
+				        &entry, sizeof( entry ) );
+				}
+			if ( cmd_reply( cmd_ptr, &response[0], CMD_DIAG_PAGE_HEADER + 
+			                count*sizeof( CMD_DIAG_ENTRY ) ) != CMD_OK )
+				{
+				return CMD_FAIL;
+				}
+			first += count;
+			} while ( first < num_handlers );
+		return CMD_OK;
+		}
+
+	case DIAG_SUBCMD_RESET:
+		{
+		cmd_reset_stats();
+		response[0] = CMD_OK;
+		return cmd_reply( cmd_ptr, &response[0], sizeof( uint8_t ) );
+		}
+
+	default:
+		{
+		return CMD_UNRECOGNIZED;
+		}
+	}
+} /* diag_cmd */
+
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE ) || defined( VALVE_CONTROLLER  )
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		sensor_cmd                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       SENSOR_OP handler, runs the sensor subcommand on the source link       *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS sensor_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables                                                                     
+------------------------------------------------------------------------------*/
+uint8_t       subcommand;    /* Sensor subcommand   */
+SENSOR_STATUS sensor_status; /* Sensor return code  */
+
+
+/*------------------------------------------------------------------------------
+ Command Implementation                                                         
+------------------------------------------------------------------------------*/
+if ( cmd_get_subcommand( cmd_ptr, &subcommand ) != CMD_OK )
+	{
+	return CMD_FAIL;
+	}
+
+sensor_status = sensor_cmd_execute( subcommand, cmd_ptr->transport_ptr );
+if ( sensor_status == SENSOR_OK )
+	{
+	return CMD_OK;
+	}
+else if ( sensor_status == SENSOR_UNRECOGNIZED_OP )
+	{
+	return CMD_UNRECOGNIZED;
+	}
+return CMD_FAIL;
+} /* sensor_cmd */
+#endif
+
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE )
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		flash_cmd                                                              *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       FLASH_OP handler, runs the flash subcommand on the application flash   *
+*       buffer                                                                 *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS flash_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables                                                                     
+------------------------------------------------------------------------------*/
+uint8_t      subcommand;   /* Flash subcommand   */
+FLASH_STATUS flash_status; /* Flash return code  */
+
+
+/*------------------------------------------------------------------------------
+ Command Implementation                                                         
+------------------------------------------------------------------------------*/
+if ( cmd_flash_handle == NULL )
+	{
+	return CMD_FAIL;
+	}
+if ( cmd_get_subcommand( cmd_ptr, &subcommand ) != CMD_OK )
+	{
+	return CMD_FAIL;
+	}
+
+flash_status = flash_cmd_execute( subcommand, cmd_flash_handle, 
+                                  cmd_ptr->transport_ptr );
+if ( flash_status == FLASH_OK )
+	{
+	return CMD_OK;
+	}
+else if ( flash_status == FLASH_UNRECOGNIZED_OP )
+	{
+	return CMD_UNRECOGNIZED;
+	}
+return CMD_FAIL;
+} /* flash_cmd */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		ignite_cmd                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       IGNITE_OP handler, runs the ignition subcommand and replies with its   *
+*       response code                                                          *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS ignite_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables                                                                     
+------------------------------------------------------------------------------*/
+uint8_t    subcommand; /* Ignition subcommand                          */
+IGN_STATUS ign_status; /* Continuity bits or ignition response code    */
+uint8_t    response;   /* Response byte                                */
+
+
+/*------------------------------------------------------------------------------
+ Command Implementation                                                         
+------------------------------------------------------------------------------*/
+if ( cmd_get_subcommand( cmd_ptr, &subcommand ) != CMD_OK )
+	{
+	return CMD_FAIL;
+	}
+
+ign_status = ign_cmd_execute( (IGN_SUBCOMMAND) subcommand );
+response   = (uint8_t) ign_status;
+if ( cmd_reply( cmd_ptr, &response, sizeof( response ) ) != CMD_OK )
+	{
+	return CMD_FAIL;
+	}
+return ( ign_status == IGN_UNRECOGNIZED_CMD ) ? CMD_UNRECOGNIZED : CMD_OK;
+} /* ignite_cmd */
+#endif
+
+
+#if defined( VALVE_CONTROLLER )
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_cmd                                                              *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       VALVE_OP handler, runs the valve subcommand on the source link         *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS valve_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables                                                                     
+------------------------------------------------------------------------------*/
+uint8_t      subcommand;   /* Valve subcommand   */
+VALVE_STATUS valve_status; /* Valve return code  */
+
+
+/*------------------------------------------------------------------------------
+ Command Implementation                                                         
+------------------------------------------------------------------------------*/
+if ( cmd_get_subcommand( cmd_ptr, &subcommand ) != CMD_OK )
+	{
+	return CMD_FAIL;
+	}
+
+valve_status = valve_cmd_execute( subcommand, cmd_ptr->transport_ptr );
+if ( valve_status == VALVE_OK )
+	{
+	return CMD_OK;
+	}
+else if ( valve_status == VALVE_UNRECOGNIZED_SUBCOMMAND )
+	{
+	return CMD_UNRECOGNIZED;
+	}
+return CMD_FAIL;
+} /* valve_cmd */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		sol_cmd                                                                *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       SOL_OP handler, runs the solenoid actuation code on the source link    *
+*                                                                              *
+*******************************************************************************/
+static CMD_STATUS sol_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables                                                                     
+------------------------------------------------------------------------------*/
+uint8_t subcommand; /* Solenoid actuation code */
+
+
+/*------------------------------------------------------------------------------
+ Command Implementation                                                         
+------------------------------------------------------------------------------*/
+if ( cmd_get_subcommand( cmd_ptr, &subcommand ) != CMD_OK )
+	{
+	return CMD_FAIL;
+	}
+
+solenoid_cmd_execute( subcommand, cmd_ptr->transport_ptr );
+return CMD_OK;
+} /* sol_cmd */
 #endif
-#ifdef ENGINE_CONTROLLER
-    #if defined( USE_RS485 )
-        rs485_transmit( &response, sizeof( response ), RS485_DEFAULT_TIMEOUT );
-    #else
-        usb_transmit( &response, sizeof( response ), HAL_DEFAULT_TIMEOUT );
-    #endif
-#endif /* #ifdef ENGINE_CONTROLLER */
-
-} /* ping */
 
 
 /*******************************************************************************
@@ -17,6 +17,18 @@ extern "C" {
 #endif
 
 
+/*------------------------------------------------------------------------------
+ Includes 
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include "frame.h"
+#include "transport.h"
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE )
+	#include "flash.h"
+#endif
+
+
 /*------------------------------------------------------------------------------
  Macros 
 ------------------------------------------------------------------------------*/
@@ -24,6 +36,7 @@ extern "C" {
 /* sdec command codes */
 #define PING_OP 	   0x01    /* ping command opcode        */
 #define CONNECT_OP	   0x02    /* connect command opcode     */
+#define DIAG_OP        0x05    /* diagnostics command opcode */
 #define IGNITE_OP	   0x20    /* ignition command opcode    */
 #define POWER_OP       0x21    /* Power command opcode       */
 #define FLASH_OP       0x22    /* flash command opcode       */
@@ -65,19 +78,127 @@ extern "C" {
 #define FIRMWARE_DUAL_DEPLOY    ( 0x03 ) /* Dual Deploy Firmware */
 #define FIRMWARE_HOTFIRE        ( 0x04 ) /* Hotfire Firmware     */
 
+/* Diagnostics subcommand codes */
+#define DIAG_SUBCMD_STATS       ( 0x01 ) /* Send command timing stats  */
+#define DIAG_SUBCMD_RESET       ( 0x02 ) /* Clear command timing stats */
+
+/* DIAG_SUBCMD_STATS response pages, a page header and as many entries as
+   fit in one frame */
+#define CMD_DIAG_PAGE_HEADER    ( 2 )
+#define CMD_DIAG_PAGE_ENTRIES   ( ( FRAME_MAX_PAYLOAD - CMD_DIAG_PAGE_HEADER ) \
+                                  / sizeof( CMD_DIAG_ENTRY ) )
+
+/* Maximum number of registered command handlers */
+#define CMD_MAX_HANDLERS        ( 16 )
+
+/* Bytes cmd_dispatch_frames reads from a link at a time */
+#define CMD_RX_CHUNK_SIZE       ( 64 )
+
+
+/*------------------------------------------------------------------------------
+ Typdefs 
+------------------------------------------------------------------------------*/
+
+/* Command dispatch return codes */
+typedef enum _CMD_STATUS
+	{
+	CMD_OK               = 0,
+	CMD_FAIL                ,
+	CMD_UNRECOGNIZED        ,   /* No handler for the opcode           */
+	CMD_TABLE_FULL              /* CMD_MAX_HANDLERS already registered */
+	} CMD_STATUS;
+
+/* Command being executed, passed to every handler */
+typedef struct _CMD_CONTEXT
+	{
+	uint8_t          opcode;
+	const TRANSPORT* transport_ptr; /* Link the command came from. The 
+	                                   handler of a framed command gets a 
+	                                   link that reads the payload and 
+	                                   sends the response in frames       */
+	const FRAME*     frame_ptr;     /* Framed command, NULL for a legacy 
+	                                   byte command                       */
+	} CMD_CONTEXT;
+
+/* Command handler */
+typedef CMD_STATUS ( *CMD_HANDLER )
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+
+/* Execution time statistics of one opcode, in CPU cycles */
+typedef struct _CMD_STATS
+	{
+	uint32_t count;        /* Number of invocations       */
+	uint32_t min_cycles;   /* Fastest invocation          */
+	uint32_t max_cycles;   /* Slowest invocation          */
+	uint64_t total_cycles; /* Sum over all invocations    */
+	} CMD_STATS;
+
+/* DIAG_SUBCMD_STATS response entry. The entries are sent in pages of up to
+   CMD_DIAG_PAGE_ENTRIES, each page starts with the total number of entries
+   and the index of its first entry */
+typedef struct _CMD_DIAG_ENTRY
+	{
+	uint32_t count;
+	uint32_t min_cycles;
+	uint32_t avg_cycles;
+	uint32_t max_cycles;
+	uint8_t  opcode;
+	uint8_t  reserved[3];
+	} CMD_DIAG_ENTRY;
+
 
 /*------------------------------------------------------------------------------
  Function Prototypes 
 ------------------------------------------------------------------------------*/
 
-/* Sends a single response byte back to sender */
-void ping
+/* Clear the dispatch table and register the commands of the board */
+void cmd_dispatch_init
+	(
+	void
+	);
+
+#if defined( FLIGHT_COMPUTER      ) || defined( ENGINE_CONTROLLER ) || \
+    defined( FLIGHT_COMPUTER_LITE )
+/* Register the flash command with the flash buffer of the application */
+CMD_STATUS cmd_register_flash
+	(
+	HFLASH_BUFFER* pflash_handle
+	);
+#endif
+
+/* Register a handler for an opcode */
+CMD_STATUS cmd_register
+	(
+	uint8_t     opcode ,
+	CMD_HANDLER handler
+	);
+
+/* Run the handler registered for a command and record its execution time */
+CMD_STATUS cmd_dispatch
+	(
+	const CMD_CONTEXT* cmd_ptr
+	);
+
+/* Decode the frames waiting on a link and dispatch their commands */
+CMD_STATUS cmd_dispatch_frames
+	(
+	const TRANSPORT* transport_ptr, /* Link to receive on         */
+	FRAME_DECODER*   decoder_ptr    /* Frame decoder of the link  */
+	);
+
+/* Get the execution time statistics of an opcode */
+CMD_STATUS cmd_get_stats
+	(
+	uint8_t    opcode   ,
+	CMD_STATS* stats_ptr
+	);
+
+/* Clear the execution time statistics of all opcodes */
+void cmd_reset_stats
 	(
-	#ifndef VALVE_CONTROLLER
-		void
-	#else
-		CMD_SOURCE cmd_source
-	#endif
+	void
 	);
 
 #ifdef __cplusplus
@@ -0,0 +1,48 @@
+/*******************************************************************************
+*
+* FILE: 
+* 		cycles.c
+*
+* DESCRIPTION: 
+* 		Contains the setup of the DWT cycle counter that the attitude, kalman,
+*       rs485 and command modules use to time their work
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Project Includes                                                                     
+------------------------------------------------------------------------------*/
+#include "main.h"
+#include "cycles.h"
+
+
+/*------------------------------------------------------------------------------
+ Procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cycles_init                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start the DWT cycle counter. Enables the trace block and unlocks the   *
+*       DWT registers first, the counter keeps running if it already was       *
+*                                                                              *
+*******************************************************************************/
+void cycles_init
+	(
+	void
+	)
+{
+CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+DWT->LAR          = 0xC5ACCE55;
+DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+} /* cycles_init */
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,40 @@
+/*******************************************************************************
+*
+* FILE: 
+* 		cycles.h
+*
+* DESCRIPTION: 
+* 		Contains the setup of the DWT cycle counter that the attitude, kalman,
+*       rs485 and command modules use to time their work
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Function Prototypes 
+------------------------------------------------------------------------------*/
+
+/* Start the DWT cycle counter, read it through DWT->CYCCNT */
+void cycles_init
+	(
+	void
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CYCLES_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -33,7 +33,7 @@
 ------------------------------------------------------------------------------*/
 #include "main.h"
 #include "flash.h"
-#include "usb.h"
+#include "transport.h"
 #include "led.h"
 
 
@@ -84,13 +84,16 @@ static FLASH_STATUS write_disable
 * 		flash_cmd_execute                                                      *
 *                                                                              *
 * DESCRIPTION:                                                                 * 
-* 		Executes a flash subcommand based on input from the sdec terminal      *
+* 		Executes a flash subcommand based on input from the sdec terminal.     *
+*       Addresses and write data are received and read data sent on the        *
+*       link the command came from                                             *
 *                                                                              *
 *******************************************************************************/
 FLASH_STATUS flash_cmd_execute
 	(
     uint8_t             subcommand   ,
-	HFLASH_BUFFER*      pflash_handle
+	HFLASH_BUFFER*      pflash_handle,
+	const TRANSPORT*    transport_ptr  /* Link the command came from */
     )
 {
 /*------------------------------------------------------------------------------
@@ -103,7 +106,7 @@ uint8_t          address[3];          /* flash address in byte form           */
 uint8_t*         pbuffer;             /* Position within flash buffer         */
 uint8_t          buffer[512];         /* buffer (flash extract)               */
 FLASH_STATUS     flash_status;        /* Return value of flash API calls      */
-USB_STATUS       usb_status;          /* Return value of USB API calls        */
+TRANSPORT_STATUS link_status;         /* Return value of transport calls      */
 
 
 /*------------------------------------------------------------------------------
@@ -126,12 +129,13 @@ switch ( opcode )
     case FLASH_SUBCMD_READ:
         {
 
-		/* Get flash address from USB */
-		usb_status = usb_receive( &( address[0] )  , 
-                                  sizeof( address ), 
-                                  HAL_DEFAULT_TIMEOUT );
+		/* Get flash address from the link */
+		link_status = transport_receive( transport_ptr    ,
+		                                 &( address[0] )  , 
+		                                 sizeof( address ), 
+		                                 HAL_DEFAULT_TIMEOUT );
 		
-		if ( usb_status != USB_OK )
+		if ( link_status != TRANSPORT_OK )
 			{
 			return FLASH_USB_ERROR;
 			}
@@ -148,12 +152,13 @@ switch ( opcode )
 				return FLASH_FAIL;
 				}
 
-			/* Transmit bytes from pbuffer over USB */
-			usb_status = usb_transmit( pflash_handle -> pbuffer,
-                                       num_bytes               ,
-									   HAL_FLASH_TIMEOUT );
+			/* Transmit bytes from pbuffer over the link */
+			link_status = transport_transmit( transport_ptr           ,
+			                                  pflash_handle -> pbuffer,
+			                                  num_bytes               ,
+			                                  HAL_FLASH_TIMEOUT );
 
-			if ( usb_status != USB_OK )
+			if ( link_status != TRANSPORT_OK )
 				{
 				/* Bytes not transimitted */
 				return FLASH_USB_ERROR;
@@ -184,11 +189,12 @@ switch ( opcode )
     case FLASH_SUBCMD_WRITE:
         {
 		/* Get Address bits */
-		usb_status = usb_receive( &( address[0] )  ,
-                                  sizeof( address ),
-                                  HAL_DEFAULT_TIMEOUT );
+		link_status = transport_receive( transport_ptr    ,
+		                                 &( address[0] )  ,
+		                                 sizeof( address ),
+		                                 HAL_DEFAULT_TIMEOUT );
 
-		if ( usb_status != USB_OK )	
+		if ( link_status != TRANSPORT_OK )	
 			{
 			/* Address not recieved */
 			return FLASH_USB_ERROR;
@@ -202,12 +208,13 @@ switch ( opcode )
 			for ( int i = 0; i < num_bytes; i++ )
 				{
 				pbuffer = ( pflash_handle -> pbuffer ) + i;
-				flash_status = usb_receive( pbuffer          , 
-                                            sizeof( uint8_t ),
-                                            HAL_DEFAULT_TIMEOUT );
+				link_status = transport_receive( transport_ptr    ,
+				                                 pbuffer          , 
+				                                 sizeof( uint8_t ),
+				                                 HAL_DEFAULT_TIMEOUT );
 
-				/* Return if usb call failed */
-				if ( usb_status != USB_OK )
+				/* Return if the link call failed */
+				if ( link_status != TRANSPORT_OK )
 					{
 					/* Bytes not received */
 				    return FLASH_USB_ERROR;	
@@ -238,12 +245,13 @@ switch ( opcode )
 		flash_status = flash_get_status( pflash_handle );
 
 		/* Send status register contents back to PC */
-		usb_status = usb_transmit( &( pflash_handle -> status_register ),
-                                   sizeof( uint8_t )                    ,
-                                   HAL_DEFAULT_TIMEOUT );
+		link_status = transport_transmit( transport_ptr                        ,
+		                                  &( pflash_handle -> status_register ),
+		                                  sizeof( uint8_t )                    ,
+		                                  HAL_DEFAULT_TIMEOUT );
 
 		/* Return status code */
-		if      ( usb_status   != USB_OK   )
+		if      ( link_status  != TRANSPORT_OK )
 			{
 			return FLASH_USB_ERROR;
 			}
@@ -268,7 +276,8 @@ switch ( opcode )
 			flash_status = flash_read( pflash_handle, sizeof( buffer ) );
 			if( flash_status == FLASH_OK )
 				{
-				usb_transmit( &buffer, sizeof( buffer ), HAL_FLASH_TIMEOUT );
+				transport_transmit( transport_ptr, &buffer[0], sizeof( buffer ),
+				                    HAL_FLASH_TIMEOUT );
 				}
 			else
 				{
@@ -28,6 +28,7 @@ Includes
 
 /* Project includes */
 #include "sensor.h"
+#include "transport.h"
 
 
 /*------------------------------------------------------------------------------
@@ -178,7 +179,7 @@ typedef enum FLASH_STATUS
 	FLASH_TIMEOUT             ,
 	FLASH_WRITE_PROTECTED     ,
 	FLASH_WRITE_TIMEOUT       ,
-	FLASH_USB_ERROR           ,
+	FLASH_USB_ERROR           , /* Serial link error */
 	FLASH_SPI_ERROR           ,
 	FLASH_CANNOT_WRITE_ENABLE ,
 	FLASH_INVALID_INPUT       ,
@@ -227,8 +228,9 @@ typedef enum _FLASH_BLOCK_SIZE
 /* Executes a flash subcommand based on user input from the sdec terminal */
 FLASH_STATUS flash_cmd_execute
 	(
-    uint8_t        flash_subcommand,
-    HFLASH_BUFFER* pflash_handle   
+    uint8_t          flash_subcommand,
+    HFLASH_BUFFER*   pflash_handle   ,
+    const TRANSPORT* transport_ptr     /* Link the command came from */
     );
 
 /* Initializes the flash chip */
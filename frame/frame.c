@@ -0,0 +1,543 @@
+/*******************************************************************************
+*
+* FILE: 
+* 		frame.c
+*
+* DESCRIPTION: 
+* 		Contains API functions for the framed SDEC command protocol. Each frame
+*       is a header (opcode, subcommand, sequence, payload length), a 
+*       payload and a CRC-16/CCITT, COBS encoded and terminated by a zero 
+*       byte. The codec has no hardware dependencies so the same source can
+*       be built into host tools
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Standard Includes                                                              
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+
+/*------------------------------------------------------------------------------
+ Project Includes                                                               
+------------------------------------------------------------------------------*/
+#include "frame.h"
+
+
+/*------------------------------------------------------------------------------
+ Preprocesor Directives 
+------------------------------------------------------------------------------*/
+
+/* Largest COBS block code, a full block without an implied zero */
+#define FRAME_COBS_MAX_CODE     ( 0xFF )
+
+
+/*------------------------------------------------------------------------------
+ Global Variables 
+------------------------------------------------------------------------------*/
+
+/* CRC-16/CCITT remainders of each 4 bit value, processed a nibble at a time 
+   to keep the table small */
+static const uint16_t crc_table[16] = 
+	{
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+	};
+
+
+/*------------------------------------------------------------------------------
+ Internal function prototypes 
+------------------------------------------------------------------------------*/
+
+/* COBS encode a block of data and append the delimiter */
+static size_t cobs_encode
+	(
+	const uint8_t* data_ptr,
+	size_t         size    ,
+	uint8_t*       out_ptr ,
+	size_t         out_size
+	);
+
+/* Append a decoded byte to the decoder buffer */
+static bool decoder_append
+	(
+	FRAME_DECODER* decoder_ptr,
+	uint8_t        byte
+	);
+
+/* Check a complete decoded frame and fill in the frame structure */
+static FRAME_STATUS decoder_finish
+	(
+	FRAME_DECODER* decoder_ptr,
+	FRAME*         frame_ptr
+	);
+
+/* Drop the current frame and wait for the next one */
+static void decoder_reset
+	(
+	FRAME_DECODER* decoder_ptr
+	);
+
+
+/*------------------------------------------------------------------------------
+ Procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_crc16                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Update a CRC-16/CCITT (polynomial 0x1021, MSB first) with a block of   *
+*       data. Start from FRAME_CRC_INIT                                        *
+*                                                                              *
+*******************************************************************************/
+uint16_t frame_crc16
+	(
+	uint16_t       crc     , /* CRC so far, FRAME_CRC_INIT to start */
+	const uint8_t* data_ptr, /* Data to add                         */
+	size_t         size      /* Number of bytes                     */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+size_t i; /* Byte index */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+for ( i = 0; i < size; ++i )
+	{
+	crc = (uint16_t) ( ( crc << 4 ) ^ 
+	                   crc_table[( crc >> 12 ) ^ ( data_ptr[i] >> 4   )] );
+	crc = (uint16_t) ( ( crc << 4 ) ^ 
+	                   crc_table[( crc >> 12 ) ^ ( data_ptr[i] & 0x0F )] );
+	}
+return crc;
+} /* frame_crc16 */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_encode                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Build a frame from a header and payload, append the CRC and COBS       *
+*       encode it into the output buffer, including the trailing delimiter.    *
+*       FRAME_ENCODED_SIZE gives the output buffer size needed                 *
+*                                                                              *
+*******************************************************************************/
+FRAME_STATUS frame_encode
+	(
+	const FRAME_HEADER* header_ptr  , /* Header, length is the payload size */
+	const void*         payload_ptr , /* Payload, may be NULL if empty      */
+	uint8_t*            out_ptr     , /* Encoded output buffer              */
+	size_t              out_size    , /* Size of the output buffer          */
+	size_t*             encoded_size  /* Number of bytes written            */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t  raw[FRAME_MAX_SIZE]; /* Unencoded frame        */
+size_t   raw_size;            /* Unencoded frame size   */
+uint16_t crc;                 /* Frame CRC              */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+*encoded_size = 0;
+if ( header_ptr->length > FRAME_MAX_PAYLOAD )
+	{
+	return FRAME_TOO_LONG;
+	}
+raw_size = FRAME_HEADER_SIZE + header_ptr->length + FRAME_CRC_SIZE;
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+
+/* Header */
+raw[0] = header_ptr->opcode;
+raw[1] = header_ptr->subcommand;
+raw[2] = header_ptr->sequence;
+raw[3] = (uint8_t) (   header_ptr->length        & 0xFF );
+raw[4] = (uint8_t) ( ( header_ptr->length >> 8 ) & 0xFF );
+
+/* Payload */
+if ( header_ptr->length > 0 )
+	{
+	memcpy( &( raw[FRAME_HEADER_SIZE] ), payload_ptr, header_ptr->length );
+	}
+
+/* CRC over header and payload, little endian */
+crc = frame_crc16( FRAME_CRC_INIT, &( raw[0] ), raw_size - FRAME_CRC_SIZE );
+raw[raw_size - 2] = (uint8_t) (   crc        & 0xFF );
+raw[raw_size - 1] = (uint8_t) ( ( crc >> 8 ) & 0xFF );
+
+/* Encode */
+*encoded_size = cobs_encode( &( raw[0] ), raw_size, out_ptr, out_size );
+if ( *encoded_size == 0 )
+	{
+	return FRAME_BUFFER_TOO_SMALL;
+	}
+return FRAME_OK;
+} /* frame_encode */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_decoder_init                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Reset a decoder to wait for the start of a frame and clear its         *
+*       statistics                                                             *
+*                                                                              *
+*******************************************************************************/
+void frame_decoder_init
+	(
+	FRAME_DECODER* decoder_ptr
+	)
+{
+decoder_reset( decoder_ptr );
+decoder_ptr->num_frames = 0;
+decoder_ptr->num_errors = 0;
+} /* frame_decoder_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_decode_byte                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Feed one received byte to the decoder. COBS is undone on the fly so    *
+*       the frame is checked as soon as its delimiter arrives. Returns         *
+*       FRAME_INCOMPLETE until a frame ends, FRAME_OK with the frame filled    *
+*       in, or an error code for a dropped frame. Any delimiter resynchronizes *
+*       the decoder, so a lost byte only costs the frame it was part of        *
+*                                                                              *
+*******************************************************************************/
+FRAME_STATUS frame_decode_byte
+	(
+	FRAME_DECODER* decoder_ptr, /* Decoder state              */
+	uint8_t        byte       , /* Received byte              */
+	FRAME*         frame_ptr    /* Decoded frame on FRAME_OK  */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+FRAME_STATUS frame_status; /* Result of the finished frame */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+
+/* End of frame */
+if ( byte == FRAME_DELIMITER )
+	{
+	/* Idle delimiters between frames, or the end of a dropped frame */
+	if ( decoder_ptr->discard || ( decoder_ptr->code == 0 ) )
+		{
+		decoder_reset( decoder_ptr );
+		return FRAME_INCOMPLETE;
+		}
+
+	/* Delimiter in the middle of a COBS block */
+	if ( decoder_ptr->remaining != 0 )
+		{
+		decoder_reset( decoder_ptr );
+		decoder_ptr->num_errors++;
+		return FRAME_COBS_ERROR;
+		}
+
+	frame_status = decoder_finish( decoder_ptr, frame_ptr );
+	decoder_reset( decoder_ptr );
+	if ( frame_status == FRAME_OK )
+		{
+		decoder_ptr->num_frames++;
+		}
+	else
+		{
+		decoder_ptr->num_errors++;
+		}
+	return frame_status;
+	}
+
+/* Dropping an oversize frame */
+if ( decoder_ptr->discard )
+	{
+	return FRAME_INCOMPLETE;
+	}
+
+/* Start of a COBS block, the previous block ended in a zero unless it was 
+   a full block */
+if ( decoder_ptr->remaining == 0 )
+	{
+	if ( ( decoder_ptr->code != 0                   ) && 
+	     ( decoder_ptr->code != FRAME_COBS_MAX_CODE ) && 
+	     !decoder_append( decoder_ptr, 0 ) )
+		{
+		return FRAME_TOO_LONG;
+		}
+	decoder_ptr->code      = byte;
+	decoder_ptr->remaining = byte - 1;
+	return FRAME_INCOMPLETE;
+	}
+
+/* Data byte */
+decoder_ptr->remaining--;
+if ( !decoder_append( decoder_ptr, byte ) )
+	{
+	return FRAME_TOO_LONG;
+	}
+return FRAME_INCOMPLETE;
+} /* frame_decode_byte */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		frame_decode                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Feed a block of received bytes to the decoder, stopping after the      *
+*       first complete or rejected frame so pipelined frames can be handled    *
+*       one at a time. consumed is set to the number of bytes used             *
+*                                                                              *
+*******************************************************************************/
+FRAME_STATUS frame_decode
+	(
+	FRAME_DECODER* decoder_ptr, /* Decoder state               */
+	const uint8_t* data_ptr   , /* Received bytes              */
+	size_t         size       , /* Number of received bytes    */
+	size_t*        consumed   , /* Number of bytes used        */
+	FRAME*         frame_ptr    /* Decoded frame on FRAME_OK   */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+FRAME_STATUS frame_status; /* Decoder result */
+size_t       i;            /* Byte index     */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+for ( i = 0; i < size; ++i )
+	{
+	frame_status = frame_decode_byte( decoder_ptr, data_ptr[i], frame_ptr );
+	if ( frame_status != FRAME_INCOMPLETE )
+		{
+		*consumed = i + 1;
+		return frame_status;
+		}
+	}
+*consumed = size;
+return FRAME_INCOMPLETE;
+} /* frame_decode */
+
+
+/*------------------------------------------------------------------------------
+ Internal procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cobs_encode                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       COBS encode a block of data and append the delimiter. Returns the      *
+*       number of bytes written, or 0 if the output buffer is too small        *
+*                                                                              *
+*******************************************************************************/
+static size_t cobs_encode
+	(
+	const uint8_t* data_ptr,
+	size_t         size    ,
+	uint8_t*       out_ptr ,
+	size_t         out_size
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+size_t  code_pos; /* Output index of the current block code */
+size_t  out_pos;  /* Next output index                      */
+uint8_t code;     /* Current block code                     */
+size_t  i;        /* Input index                            */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+if ( out_size < size + ( size / 254 ) + 2 )
+	{
+	return 0;
+	}
+code_pos = 0;
+out_pos  = 1;
+code     = 1;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+for ( i = 0; i < size; ++i )
+	{
+	if ( data_ptr[i] == 0 )
+		{
+		/* Zero ends the block */
+		out_ptr[code_pos] = code;
+		code_pos          = out_pos++;
+		code              = 1;
+		}
+	else
+		{
+		out_ptr[out_pos++] = data_ptr[i];
+		code++;
+		if ( code == FRAME_COBS_MAX_CODE )
+			{
+			/* Full block */
+			out_ptr[code_pos] = code;
+			code_pos          = out_pos++;
+			code              = 1;
+			}
+		}
+	}
+out_ptr[code_pos]  = code;
+out_ptr[out_pos++] = FRAME_DELIMITER;
+return out_pos;
+} /* cobs_encode */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		decoder_append                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Append a decoded byte to the decoder buffer. An oversize frame is      *
+*       counted as an error and dropped up to its delimiter                    *
+*                                                                              *
+*******************************************************************************/
+static bool decoder_append
+	(
+	FRAME_DECODER* decoder_ptr,
+	uint8_t        byte
+	)
+{
+if ( decoder_ptr->count >= FRAME_MAX_SIZE )
+	{
+	decoder_ptr->discard = true;
+	decoder_ptr->num_errors++;
+	return false;
+	}
+decoder_ptr->buffer[decoder_ptr->count++] = byte;
+return true;
+} /* decoder_append */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		decoder_finish                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Check the length and CRC of a complete decoded frame and fill in the   *
+*       frame structure                                                        *
+*                                                                              *
+*******************************************************************************/
+static FRAME_STATUS decoder_finish
+	(
+	FRAME_DECODER* decoder_ptr,
+	FRAME*         frame_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+const uint8_t* buffer;      /* Decoded frame         */
+size_t         count;       /* Decoded frame size    */
+uint16_t       length;      /* Header payload length */
+uint16_t       crc;         /* Received CRC          */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+buffer = &( decoder_ptr->buffer[0] );
+count  = decoder_ptr->count;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( count < FRAME_HEADER_SIZE + FRAME_CRC_SIZE )
+	{
+	return FRAME_LENGTH_ERROR;
+	}
+
+length = (uint16_t) ( buffer[3] | ( buffer[4] << 8 ) );
+if ( length != count - FRAME_HEADER_SIZE - FRAME_CRC_SIZE )
+	{
+	return FRAME_LENGTH_ERROR;
+	}
+
+crc = (uint16_t) ( buffer[count - 2] | ( buffer[count - 1] << 8 ) );
+if ( crc != frame_crc16( FRAME_CRC_INIT, buffer, count - FRAME_CRC_SIZE ) )
+	{
+	return FRAME_CRC_ERROR;
+	}
+
+frame_ptr->header.opcode     = buffer[0];
+frame_ptr->header.subcommand = buffer[1];
+frame_ptr->header.sequence   = buffer[2];
+frame_ptr->header.length     = length;
+frame_ptr->payload           = &( buffer[FRAME_HEADER_SIZE] );
+return FRAME_OK;
+} /* decoder_finish */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		decoder_reset                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Drop the current frame and wait for the next one. The buffer contents  *
+*       are kept so the last decoded payload stays valid                       *
+*                                                                              *
+*******************************************************************************/
+static void decoder_reset
+	(
+	FRAME_DECODER* decoder_ptr
+	)
+{
+decoder_ptr->count     = 0;
+decoder_ptr->code      = 0;
+decoder_ptr->remaining = 0;
+decoder_ptr->discard   = false;
+} /* decoder_reset */
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,160 @@
+/*******************************************************************************
+*
+* FILE: 
+* 		frame.h
+*
+* DESCRIPTION: 
+* 		Contains API functions for the framed SDEC command protocol. Each frame
+*       is a header (opcode, subcommand, sequence, payload length), a 
+*       payload and a CRC-16/CCITT, COBS encoded and terminated by a zero 
+*       byte. The codec has no hardware dependencies so the same source can
+*       be built into host tools
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FRAME_H
+#define FRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Includes 
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+/*------------------------------------------------------------------------------
+ Macros 
+------------------------------------------------------------------------------*/
+
+/* Frame delimiter, never appears inside an encoded frame */
+#define FRAME_DELIMITER         ( 0x00 )
+
+/* Field sizes in bytes */
+#define FRAME_HEADER_SIZE       ( 5   )
+#define FRAME_CRC_SIZE          ( 2   )
+#define FRAME_MAX_PAYLOAD       ( 256 )
+#define FRAME_MAX_SIZE          ( FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + \
+                                  FRAME_CRC_SIZE )
+
+/* Worst case encoded size of a frame with n payload bytes, including the COBS
+   overhead and the delimiter */
+#define FRAME_ENCODED_SIZE( n ) ( ( FRAME_HEADER_SIZE + ( n ) + FRAME_CRC_SIZE ) \
+                                  + ( ( FRAME_HEADER_SIZE + ( n ) +              \
+                                        FRAME_CRC_SIZE ) / 254 ) + 2 )
+#define FRAME_MAX_ENCODED_SIZE  ( FRAME_ENCODED_SIZE( FRAME_MAX_PAYLOAD ) )
+
+/* CRC-16/CCITT-FALSE initial value, polynomial 0x1021 */
+#define FRAME_CRC_INIT          ( 0xFFFF )
+
+
+/*------------------------------------------------------------------------------
+ Typdefs 
+------------------------------------------------------------------------------*/
+
+/* Frame return codes */
+typedef enum _FRAME_STATUS
+	{
+	FRAME_OK                = 0,
+	FRAME_INCOMPLETE           , /* More bytes needed                     */
+	FRAME_TOO_LONG             , /* Frame exceeds FRAME_MAX_SIZE          */
+	FRAME_COBS_ERROR           , /* Truncated or malformed COBS block     */
+	FRAME_LENGTH_ERROR         , /* Header length does not match frame    */
+	FRAME_CRC_ERROR            , /* CRC mismatch                          */
+	FRAME_BUFFER_TOO_SMALL       /* Encode output buffer too small        */
+	} FRAME_STATUS;
+
+/* Frame header, the length is sent little endian */
+typedef struct _FRAME_HEADER
+	{
+	uint8_t  opcode;     /* SDEC command opcode                   */
+	uint8_t  subcommand; /* Subcommand code                       */
+	uint8_t  sequence;   /* Sender sequence number, echoed in the 
+	                        response to match pipelined commands  */
+	uint16_t length;     /* Payload length in bytes               */
+	} FRAME_HEADER;
+
+/* Decoded frame */
+typedef struct _FRAME
+	{
+	FRAME_HEADER   header;
+	const uint8_t* payload; /* Points into the decoder buffer, valid until 
+	                           the decoder is fed again                */
+	} FRAME;
+
+/* Incremental frame decoder state */
+typedef struct _FRAME_DECODER
+	{
+	uint8_t  buffer[FRAME_MAX_SIZE]; /* Decoded bytes of the current frame */
+	size_t   count;                  /* Number of decoded bytes            */
+	uint8_t  code;                   /* Current COBS block code            */
+	uint8_t  remaining;              /* Bytes left in the COBS block       */
+	bool     discard;                /* Dropping bytes until a delimiter   */
+	uint32_t num_frames;             /* Frames decoded                     */
+	uint32_t num_errors;             /* Frames dropped                     */
+	} FRAME_DECODER;
+
+
+/*------------------------------------------------------------------------------
+ Function Prototypes 
+------------------------------------------------------------------------------*/
+
+/* Update a CRC-16/CCITT with a block of data */
+uint16_t frame_crc16
+	(
+	uint16_t       crc     , /* CRC so far, FRAME_CRC_INIT to start */
+	const uint8_t* data_ptr, /* Data to add                         */
+	size_t         size      /* Number of bytes                     */
+	);
+
+/* Build and COBS encode a frame, including the trailing delimiter */
+FRAME_STATUS frame_encode
+	(
+	const FRAME_HEADER* header_ptr  , /* Header, length is the payload size */
+	const void*         payload_ptr , /* Payload, may be NULL if empty      */
+	uint8_t*            out_ptr     , /* Encoded output buffer              */
+	size_t              out_size    , /* Size of the output buffer          */
+	size_t*             encoded_size  /* Number of bytes written            */
+	);
+
+/* Reset a decoder to wait for the start of a frame */
+void frame_decoder_init
+	(
+	FRAME_DECODER* decoder_ptr
+	);
+
+/* Feed one received byte to the decoder */
+FRAME_STATUS frame_decode_byte
+	(
+	FRAME_DECODER* decoder_ptr, /* Decoder state              */
+	uint8_t        byte       , /* Received byte              */
+	FRAME*         frame_ptr    /* Decoded frame on FRAME_OK  */
+	);
+
+/* Feed a block of received bytes to the decoder, stopping after the first 
+   complete or rejected frame */
+FRAME_STATUS frame_decode
+	(
+	FRAME_DECODER* decoder_ptr, /* Decoder state               */
+	const uint8_t* data_ptr   , /* Received bytes              */
+	size_t         size       , /* Number of received bytes    */
+	size_t*        consumed   , /* Number of bytes used        */
+	FRAME*         frame_ptr    /* Decoded frame on FRAME_OK   */
+	);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* FRAME_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
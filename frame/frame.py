@@ -0,0 +1,132 @@
+# Host side encoder and decoder for the framed SDEC command protocol, 
+# matches frame.c
+#
+# Frame layout before COBS encoding, multi-byte fields little endian:
+#   opcode (1) | subcommand (1) | sequence (1) | length (2) | payload | crc (2)
+# The CRC is CRC-16/CCITT-FALSE over the header and payload. The encoded 
+# frame is terminated by a zero byte
+
+FRAME_DELIMITER   = 0x00
+FRAME_HEADER_SIZE = 5
+FRAME_CRC_SIZE    = 2
+FRAME_MAX_PAYLOAD = 256
+FRAME_MAX_SIZE    = FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + FRAME_CRC_SIZE
+FRAME_CRC_INIT    = 0xFFFF
+
+
+# CRC-16/CCITT, polynomial 0x1021, MSB first
+def crc16( data, crc = FRAME_CRC_INIT ):
+	for byte in data:
+		crc ^= byte << 8
+		for i in range( 8 ):
+			if ( crc & 0x8000 ):
+				crc = ( ( crc << 1 ) ^ 0x1021 ) & 0xFFFF
+			else:
+				crc = ( crc << 1 ) & 0xFFFF
+	return crc
+
+# COBS encode a block of bytes and append the delimiter
+def cobs_encode( data ):
+	out      = bytearray( [ 0 ] )
+	code_pos = 0
+	code     = 1
+	for byte in data:
+		if ( byte == 0 ):
+			out[code_pos] = code
+			code_pos      = len( out )
+			code          = 1
+			out.append( 0 )
+		else:
+			out.append( byte )
+			code += 1
+			if ( code == 0xFF ):
+				out[code_pos] = code
+				code_pos      = len( out )
+				code          = 1
+				out.append( 0 )
+	out[code_pos] = code
+	out.append( FRAME_DELIMITER )
+	return bytes( out )
+
+# Build and encode a frame
+def encode( opcode, subcommand, sequence, payload = b"" ):
+	if ( len( payload ) > FRAME_MAX_PAYLOAD ):
+		raise ValueError( "payload too long" )
+	raw  = bytes( [ opcode, subcommand, sequence, 
+	                len( payload ) & 0xFF, ( len( payload ) >> 8 ) & 0xFF ] )
+	raw += bytes( payload )
+	crc  = crc16( raw )
+	raw += bytes( [ crc & 0xFF, ( crc >> 8 ) & 0xFF ] )
+	return cobs_encode( raw )
+
+# Decoded frame
+class Frame:
+	def __init__( self, opcode, subcommand, sequence, payload ):
+		self.opcode     = opcode
+		self.subcommand = subcommand
+		self.sequence   = sequence
+		self.payload    = payload
+
+	def __repr__( self ):
+		return "Frame( op=0x%02X, sub=0x%02X, seq=%d, payload=%s )" % ( 
+		       self.opcode, self.subcommand, self.sequence, self.payload.hex() )
+
+# Incremental decoder, feed it bytes as they arrive from the serial port. 
+# Corrupt frames are dropped and counted, the decoder resynchronizes on the
+# next delimiter
+class Decoder:
+	def __init__( self ):
+		self.buffer     = bytearray()
+		self.dropping   = False
+		self.num_frames = 0
+		self.num_errors = 0
+
+	# Returns a list of the frames completed by data
+	def feed( self, data ):
+		frames = []
+		for byte in data:
+			if ( byte != FRAME_DELIMITER ):
+				if ( self.dropping ):
+					continue
+				self.buffer.append( byte )
+				if ( len( self.buffer ) > FRAME_MAX_SIZE + FRAME_MAX_SIZE//254 + 1 ):
+					# Oversize, drop it and resynchronize on the next delimiter
+					self.buffer   = bytearray()
+					self.dropping = True
+				continue
+			if   ( self.dropping ):
+				self.num_errors += 1
+				self.dropping    = False
+			elif ( len( self.buffer ) > 0 ):
+				frame = self.decode( bytes( self.buffer ) )
+				if ( frame is None ):
+					self.num_errors += 1
+				else:
+					self.num_frames += 1
+					frames.append( frame )
+			self.buffer = bytearray()
+		return frames
+
+	# Decode one encoded frame without its delimiter, None if it is corrupt
+	@staticmethod
+	def decode( encoded ):
+		raw = bytearray()
+		i   = 0
+		while ( i < len( encoded ) ):
+			code = encoded[i]
+			if ( ( code == 0 ) or ( i + code > len( encoded ) ) ):
+				return None
+			raw += encoded[i+1:i+code]
+			i   += code
+			if ( ( code != 0xFF ) and ( i < len( encoded ) ) ):
+				raw.append( 0 )
+		if ( ( len( raw ) < FRAME_HEADER_SIZE + FRAME_CRC_SIZE ) or 
+		     ( len( raw ) > FRAME_MAX_SIZE ) ):
+			return None
+		length = raw[3] | ( raw[4] << 8 )
+		if ( length != len( raw ) - FRAME_HEADER_SIZE - FRAME_CRC_SIZE ):
+			return None
+		crc = raw[-2] | ( raw[-1] << 8 )
+		if ( crc != crc16( raw[:-FRAME_CRC_SIZE] ) ):
+			return None
+		return Frame( raw[0], raw[1], raw[2], bytes( raw[FRAME_HEADER_SIZE:-FRAME_CRC_SIZE] ) )
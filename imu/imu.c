@@ -13,6 +13,8 @@
  Standard Includes                                                              
 ------------------------------------------------------------------------------*/
 #include <string.h>
+#include <stdbool.h>
+#include <math.h>
 
 /*------------------------------------------------------------------------------
  Project Includes                                                               
@@ -20,6 +22,27 @@
 #include "main.h"
 #include "sdr_pin_defines_A0002.h"
 #include "imu.h"
+#ifdef USE_SENSOR_IT
+    #include "baro.h"
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Macros 
+------------------------------------------------------------------------------*/
+
+/* With USE_SENSOR_IT the baro reads BARO_I2C from its data ready interrupt,
+   so blocking IMU transfers claim the bus first when the IMU shares it */
+#ifdef USE_SENSOR_IT
+    #define IMU_BUS_SHARED          ( &( IMU_I2C ) == &( BARO_I2C ) )
+    #define IMU_BUS_ACQUIRE()       ( !IMU_BUS_SHARED ||                      \
+                                      baro_bus_acquire() == BARO_OK )
+    #define IMU_BUS_RELEASE()       do { if ( IMU_BUS_SHARED )                \
+                                             { baro_bus_release(); } } while ( 0 )
+#else
+    #define IMU_BUS_ACQUIRE()       ( true )
+    #define IMU_BUS_RELEASE()       do { } while ( 0 )
+#endif
 
 
 /*------------------------------------------------------------------------------
@@ -33,6 +56,30 @@
     };
 #endif
 
+/* BMM150 trim values, read once by mag_init */
+#if defined( A0002_REV2 )
+    static IMU_MAG_TRIM mag_trim;
+#endif
+
+/* Raw count to SI unit scale factors, set by imu_conv_config */
+static float accel_scale;
+static float gyro_scale;
+
+/* Active calibration, defaults to no correction */
+static IMU_CAL imu_cal = { 
+    { 0.0f, 0.0f, 0.0f },
+    { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+    { 0.0f, 0.0f, 0.0f },
+    { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } }
+    };
+
+/* Scale and calibration folded into a single affine map per sensor, 
+   out = conv_matrix*raw - conv_offset, so imu_convert only multiplies and adds */
+static float accel_conv_matrix[3][3];
+static float accel_conv_offset[3];
+static float gyro_conv_matrix[3][3];
+static float gyro_conv_offset[3];
+
 /*------------------------------------------------------------------------------
  Internal function prototypes 
 ------------------------------------------------------------------------------*/
@@ -87,6 +134,39 @@ static IMU_STATUS write_mag_reg
     ); 
 #endif 
 
+#if defined( A0002_REV2 )
+/* Read and cache the magnetometer trim registers */
+static IMU_STATUS mag_read_trim
+    (
+    void
+    );
+
+/* Trim compensation of one magnetometer sample */
+static void mag_compensate
+    (
+    int16_t   mag_x_raw, /* Raw X data, 13 bit        */
+    int16_t   mag_y_raw, /* Raw Y data, 13 bit        */
+    int16_t   mag_z_raw, /* Raw Z data, 15 bit        */
+    uint16_t  rhall    , /* Hall resistance, 14 bit   */
+    IMU_DATA* pIMU       /* Compensated output        */
+    );
+
+/* Trim compensation of the X or Y axis */
+static inline int16_t mag_compensate_xy
+    (
+    int16_t mag_raw , /* Raw axis data                        */
+    int8_t  dig_1   , /* Axis offset trim, dig_x1 or dig_y1    */
+    int8_t  dig_2   , /* Axis gain trim, dig_x2 or dig_y2      */
+    int32_t xy_sens   /* Hall sensitivity term common to X/Y  */
+    );
+#endif /* #if defined( A0002_REV2 ) */
+
+/* Fold the scale factors and calibration into the conversion tables */
+static void update_conv_tables
+    (
+    void
+    );
+
 
 /*------------------------------------------------------------------------------
  Procedures 
@@ -248,6 +328,13 @@ if ( imu_status != IMU_OK )
         }
 #endif /* #if defined( A0002_REV2 ) */
 
+/* Precompute unit conversion for the configured ranges */
+imu_status = imu_conv_config( imu_config_ptr );
+if ( imu_status != IMU_OK )
+    {
+    return IMU_CONFIG_FAIL;
+    }
+
 /* IMU Inititialization Successful */
 return IMU_OK;
 } /* imu_init */
@@ -312,9 +399,9 @@ if ( imu_status != IMU_OK )
 #endif
 
 /* Export data to IMU sstruct */
-pIMU->accel_x = accel_x_raw;
-pIMU->accel_y = accel_y_raw;
-pIMU->accel_z = accel_z_raw;
+pIMU->accel_x = (int16_t) accel_x_raw;
+pIMU->accel_y = (int16_t) accel_y_raw;
+pIMU->accel_z = (int16_t) accel_z_raw;
 
 return IMU_OK;
 } /* imu_get_accel_xyz */
@@ -378,9 +465,9 @@ if ( imu_status != IMU_OK )
 #endif
 
 /* Export Sensor Readouts */
-pIMU->gyro_x = gyro_x_raw;
-pIMU->gyro_y = gyro_y_raw;
-pIMU->gyro_z = gyro_z_raw; 
+pIMU->gyro_x = (int16_t) gyro_x_raw;
+pIMU->gyro_y = (int16_t) gyro_y_raw;
+pIMU->gyro_z = (int16_t) gyro_z_raw; 
 
 return IMU_OK;
 } /* imu_get_gyro_xyz */
@@ -404,10 +491,18 @@ IMU_STATUS imu_get_mag_xyz
 /*------------------------------------------------------------------------------
  Local variables 
 ------------------------------------------------------------------------------*/
-uint8_t     regMag[6];    /* Magnetometer register bytes      */
-uint16_t    mag_x_raw;    /* Raw magnetometer sensor readouts */ 
-uint16_t    mag_y_raw; 
-uint16_t    mag_z_raw; 
+#if   defined( A0002_REV1 )
+    uint8_t     regMag[6];    /* Magnetometer register bytes      */
+    uint16_t    mag_x_raw;    /* Raw magnetometer sensor readouts */ 
+    uint16_t    mag_y_raw; 
+    uint16_t    mag_z_raw; 
+#elif defined( A0002_REV2 )
+    uint8_t     regMag[MAG_DATA_BURST_SIZE]; /* Data and Hall resistance bytes */
+    int16_t     mag_x_raw;    /* Raw magnetometer sensor readouts */ 
+    int16_t     mag_y_raw; 
+    int16_t     mag_z_raw; 
+    uint16_t    rhall;        /* Hall resistance readout          */
+#endif
 IMU_STATUS  imu_status;   /* IMU status return codes          */
 
 
@@ -415,7 +510,8 @@ IMU_STATUS  imu_status;   /* IMU status return codes          */
  API function implementation 
 ------------------------------------------------------------------------------*/
 
-/* Read MAG_X, MAG_Y, MAG_Z high byte and low byte registers */
+/* Read MAG_X, MAG_Y, MAG_Z high byte and low byte registers. The BMM150 Hall 
+   resistance follows the data registers and is read in the same burst */
 #if   defined( A0002_REV1 )
     imu_status = read_mag_regs( IMU_REG_MAG_XOUT_H, 
                                 &regMag[0]        , 
@@ -427,9 +523,9 @@ IMU_STATUS  imu_status;   /* IMU status return codes          */
 #endif
 
 /* Check for HAL IMU error */
-if ( imu_status == IMU_TIMEOUT )
+if ( imu_status != IMU_OK )
 	{
-	return IMU_TIMEOUT;
+	return imu_status;
 	}
 
 /* Combine high byte and low byte to 16 bit data */
@@ -437,20 +533,25 @@ if ( imu_status == IMU_TIMEOUT )
     mag_x_raw  = ( (uint16_t) regMag[1] ) << 8 | regMag[0];
     mag_y_raw  = ( (uint16_t) regMag[3] ) << 8 | regMag[2];
     mag_z_raw  = ( (uint16_t) regMag[5] ) << 8 | regMag[4];
+
+    /* Export sensor data */
+    pIMU->mag_x = (int16_t) mag_x_raw;
+    pIMU->mag_y = (int16_t) mag_y_raw;
+    pIMU->mag_z = (int16_t) mag_z_raw;
 #elif defined( A0002_REV2 )
-    mag_x_raw  = (   (uint16_t) regMag[1]                         << MAG_XY_MSB_BITSHIFT ) | 
-                 ( ( (uint16_t) regMag[0] && MAG_XY_LSB_BITMASK ) >> MAG_XY_LSB_BITSHIFT );
-    mag_y_raw  = (   (uint16_t) regMag[3]                         << MAG_XY_MSB_BITSHIFT ) | 
-                 ( ( (uint16_t) regMag[2] && MAG_XY_LSB_BITMASK ) >> MAG_XY_LSB_BITSHIFT );
-    mag_z_raw  = (   (uint16_t) regMag[5]                         << MAG_Z_MSB_BITSHIFT  ) | 
-                 ( ( (uint16_t) regMag[4] && MAG_Z_LSB_BITMASK )  >> MAG_Z_LSB_BITSHIFT  );
+    mag_x_raw  = ( (int16_t) ( ( (uint16_t) regMag[1] << 8 ) | 
+                               ( regMag[0] & MAG_XY_LSB_BITMASK ) ) ) >> MAG_XY_LSB_BITSHIFT;
+    mag_y_raw  = ( (int16_t) ( ( (uint16_t) regMag[3] << 8 ) | 
+                               ( regMag[2] & MAG_XY_LSB_BITMASK ) ) ) >> MAG_XY_LSB_BITSHIFT;
+    mag_z_raw  = ( (int16_t) ( ( (uint16_t) regMag[5] << 8 ) | 
+                               ( regMag[4] & MAG_Z_LSB_BITMASK  ) ) ) >> MAG_Z_LSB_BITSHIFT;
+    rhall      = ( ( (uint16_t) regMag[7] << 8 ) | 
+                   ( regMag[6] & MAG_RHALL_LSB_BITMASK ) ) >> MAG_RHALL_LSB_BITSHIFT;
+
+    /* Compensate and export sensor data */
+    mag_compensate( mag_x_raw, mag_y_raw, mag_z_raw, rhall, pIMU );
 #endif
 
-/* Export sensor data */
-pIMU->mag_x = mag_x_raw;
-pIMU->mag_y = mag_y_raw;
-pIMU->mag_z = mag_z_raw;
-
 return IMU_OK;
 } /* imu_get_mag_xyz */
 
@@ -496,10 +597,237 @@ return imu_status;
 } /* imu_get_device_id */
 
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		imu_conv_config                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Precompute the raw count to SI unit scale factors for the configured   *
+*       accelerometer and gyroscope measurement ranges                         *
+*                                                                              *
+*******************************************************************************/
+IMU_STATUS imu_conv_config
+    (
+    IMU_CONFIG* imu_config_ptr /* IMU Configuration Settings */
+    )
+{
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( imu_config_ptr -> acc_range  > IMU_ACC_RANGE_16G  ||
+     imu_config_ptr -> gyro_range > IMU_GYRO_RANGE_125  )
+    {
+    return IMU_UNSUPPORTED_RANGE;
+    }
+
+/* Accel range setting n is +-2^(n+1) g, gyro range setting n is 
+   +-2000/2^n deg/s, both over the full signed 16 bit scale */
+accel_scale = ldexpf( 2.0f   , imu_config_ptr -> acc_range   )*
+              ( IMU_GRAVITY/IMU_FULL_SCALE_COUNTS );
+gyro_scale  = ldexpf( 2000.0f, -(int) imu_config_ptr -> gyro_range )*
+              ( IMU_DEG_TO_RAD/IMU_FULL_SCALE_COUNTS );
+update_conv_tables();
+
+return IMU_OK;
+} /* imu_conv_config */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		imu_conv_set_cal                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Set the bias and misalignment/scale calibration                        *
+*                                                                              *
+*******************************************************************************/
+void imu_conv_set_cal
+    (
+    IMU_CAL* imu_cal_ptr
+    )
+{
+imu_cal = *imu_cal_ptr;
+update_conv_tables();
+} /* imu_conv_set_cal */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		imu_conv_load_cal                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Validate a calibration blob read from flash and apply it. The blob     *
+*       is the IMU_CAL_MAGIC word, an IMU_CAL struct and a 32 bit sum of the   *
+*       IMU_CAL bytes, all little-endian                                       *
+*                                                                              *
+*******************************************************************************/
+IMU_STATUS imu_conv_load_cal
+    (
+    uint8_t* cal_blob_ptr, /* Calibration blob          */
+    uint32_t blob_size     /* Size of the blob in bytes */
+    )
+{
+/*------------------------------------------------------------------------------
+ Local variables 
+------------------------------------------------------------------------------*/
+IMU_CAL  cal;          /* Calibration parsed from the blob   */
+uint32_t magic;        /* Blob identifier                    */
+uint32_t checksum;     /* Checksum stored in the blob        */
+uint32_t sum;          /* Checksum computed over the payload */
+uint8_t* payload_ptr;  /* Start of the IMU_CAL payload       */
+float*   value_ptr;    /* Iterator over calibration values   */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+magic       = 0;
+checksum    = 0;
+sum         = 0;
+payload_ptr = cal_blob_ptr + sizeof( magic );
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( blob_size < IMU_CAL_BLOB_SIZE )
+    {
+    return IMU_CAL_ERROR;
+    }
+
+/* Check the identifier and checksum */
+memcpy( &magic   , cal_blob_ptr                      , sizeof( magic    ) );
+memcpy( &checksum, payload_ptr + sizeof( IMU_CAL )   , sizeof( checksum ) );
+for ( uint32_t i = 0; i < sizeof( IMU_CAL ); ++i )
+    {
+    sum += payload_ptr[i];
+    }
+if ( magic != IMU_CAL_MAGIC || sum != checksum )
+    {
+    return IMU_CAL_ERROR;
+    }
+
+/* Reject erased or corrupted values */
+memcpy( &cal, payload_ptr, sizeof( IMU_CAL ) );
+value_ptr = (float*) &cal;
+for ( uint32_t i = 0; i < sizeof( IMU_CAL )/sizeof( float ); ++i )
+    {
+    if ( !isfinite( value_ptr[i] ) )
+        {
+        return IMU_CAL_ERROR;
+        }
+    }
+
+imu_conv_set_cal( &cal );
+return IMU_OK;
+} /* imu_conv_load_cal */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		imu_convert                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Convert a batch of raw readouts to calibrated SI units. The            *
+*       conversion tables are copied to locals so the loop body is nine        *
+*       multiply-adds and three subtractions per sensor with no reloads.       *
+*       Magnetometer readouts are only scaled here, by the per-board           *
+*       MAG_UT_PER_LSB; BMM150 trim compensation is done in imu_get_mag_xyz    *
+*                                                                              *
+*******************************************************************************/
+void imu_convert
+    (
+    const IMU_DATA* restrict raw_ptr,    /* Raw readouts, ie. FIFO frames */
+    IMU_SI_DATA*    restrict si_ptr ,    /* Converted readouts            */
+    uint32_t                 num_samples /* Number of readouts            */
+    )
+{
+/*------------------------------------------------------------------------------
+ Local variables 
+------------------------------------------------------------------------------*/
+float am[3][3];   /* Accelerometer conversion matrix */
+float ao[3];      /* Accelerometer offset            */
+float gm[3][3];   /* Gyroscope conversion matrix     */
+float go[3];      /* Gyroscope offset                */
+float ms;         /* Magnetometer scale              */
+float x, y, z;    /* Raw readout as float            */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+memcpy( am, accel_conv_matrix, sizeof( am ) );
+memcpy( ao, accel_conv_offset, sizeof( ao ) );
+memcpy( gm, gyro_conv_matrix , sizeof( gm ) );
+memcpy( go, gyro_conv_offset , sizeof( go ) );
+ms = MAG_UT_PER_LSB;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+for ( uint32_t i = 0; i < num_samples; ++i )
+    {
+    x = (float) raw_ptr[i].accel_x;
+    y = (float) raw_ptr[i].accel_y;
+    z = (float) raw_ptr[i].accel_z;
+    si_ptr[i].accel_x = am[0][0]*x + am[0][1]*y + am[0][2]*z - ao[0];
+    si_ptr[i].accel_y = am[1][0]*x + am[1][1]*y + am[1][2]*z - ao[1];
+    si_ptr[i].accel_z = am[2][0]*x + am[2][1]*y + am[2][2]*z - ao[2];
+
+    x = (float) raw_ptr[i].gyro_x;
+    y = (float) raw_ptr[i].gyro_y;
+    z = (float) raw_ptr[i].gyro_z;
+    si_ptr[i].gyro_x  = gm[0][0]*x + gm[0][1]*y + gm[0][2]*z - go[0];
+    si_ptr[i].gyro_y  = gm[1][0]*x + gm[1][1]*y + gm[1][2]*z - go[1];
+    si_ptr[i].gyro_z  = gm[2][0]*x + gm[2][1]*y + gm[2][2]*z - go[2];
+
+    si_ptr[i].mag_x   = ms*(float) raw_ptr[i].mag_x;
+    si_ptr[i].mag_y   = ms*(float) raw_ptr[i].mag_y;
+    si_ptr[i].mag_z   = ms*(float) raw_ptr[i].mag_z;
+    }
+} /* imu_convert */
+
+
 /*------------------------------------------------------------------------------
  Internal procedures 
 ------------------------------------------------------------------------------*/
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		update_conv_tables                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Fold the scale factors and calibration into the conversion tables.     *
+*       matrix*( scale*raw - bias ) = ( scale*matrix )*raw - matrix*bias       *
+*                                                                              *
+*******************************************************************************/
+static void update_conv_tables
+    (
+    void
+    )
+{
+for ( int row = 0; row < 3; ++row )
+    {
+    accel_conv_offset[row] = 0.0f;
+    gyro_conv_offset[row]  = 0.0f;
+    for ( int col = 0; col < 3; ++col )
+        {
+        accel_conv_matrix[row][col] = accel_scale*imu_cal.accel_matrix[row][col];
+        gyro_conv_matrix[row][col]  = gyro_scale *imu_cal.gyro_matrix[row][col];
+        accel_conv_offset[row]     += imu_cal.accel_matrix[row][col]*
+                                      imu_cal.accel_bias[col];
+        gyro_conv_offset[row]      += imu_cal.gyro_matrix[row][col]*
+                                      imu_cal.gyro_bias[col];
+        }
+    }
+} /* update_conv_tables */
+
+
 #if defined( A0002_REV2 )
 /*******************************************************************************
 *                                                                              *
@@ -556,6 +884,13 @@ else if ( device_id != MAG_ID )
     return IMU_MAG_UNRECOGNIZED_ID; 
     }
 
+/* Cache the factory trim values for compensation */
+imu_status = mag_read_trim();
+if ( imu_status != IMU_OK )
+    {
+    return imu_status;
+    }
+
 /* Set the magnetometer operating mode and output data rate */
 imu_status = write_mag_reg( MAG_REG_CTRL1, 
                             ( imu_config_ptr -> mag_op_mode ) |
@@ -580,6 +915,203 @@ if ( imu_status != IMU_OK )
 /* Successful magnetometer Initialization */
 return IMU_OK;
 } /* mag_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		mag_read_trim                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Read and cache the magnetometer trim registers in a single burst       *
+*                                                                              *
+*******************************************************************************/
+static IMU_STATUS mag_read_trim
+    (
+    void
+    )
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+IMU_STATUS imu_status;                        /* IMU API return codes     */
+uint8_t    trim_regs[MAG_TRIM_BURST_SIZE];    /* DIG_X1 through DIG_XY1   */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+memset( &trim_regs[0], 0, sizeof( trim_regs ) );
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+imu_status = read_mag_regs( MAG_REG_DIG_X1, &trim_regs[0], sizeof( trim_regs ) );
+if ( imu_status != IMU_OK )
+    {
+    return imu_status;
+    }
+
+/* Unpack the burst by register address */
+mag_trim.dig_x1   = (int8_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_X1 )];
+mag_trim.dig_y1   = (int8_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Y1 )];
+mag_trim.dig_x2   = (int8_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_X2 )];
+mag_trim.dig_y2   = (int8_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Y2 )];
+mag_trim.dig_xy1  =          trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_XY1 )];
+mag_trim.dig_xy2  = (int8_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_XY2 )];
+mag_trim.dig_z1   = (uint16_t) ( ( (uint16_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Z1_MSB )] << 8 ) |
+                                 trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Z1_LSB )] );
+mag_trim.dig_z2   = (int16_t)  ( ( (uint16_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Z2_MSB )] << 8 ) |
+                                 trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Z2_LSB )] );
+mag_trim.dig_z3   = (int16_t)  ( ( (uint16_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Z3_MSB )] << 8 ) |
+                                 trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Z3_LSB )] );
+mag_trim.dig_z4   = (int16_t)  ( ( (uint16_t) trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Z4_MSB )] << 8 ) |
+                                 trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_Z4_LSB )] );
+mag_trim.dig_xyz1 = (uint16_t) ( ( (uint16_t) ( trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_XYZ1_MSB )] & 
+                                                MAG_XYZ1_MSB_BITMASK ) << 8 ) |
+                                 trim_regs[MAG_TRIM_INDEX( MAG_REG_DIG_XYZ1_LSB )] );
+
+return IMU_OK;
+} /* mag_read_trim */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		mag_compensate                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Trim compensation of one magnetometer sample, following the Bosch      *
+*       fixed-point reference without the final division by 16 so the output   *
+*       keeps 1/16 uT resolution. The Hall resistance dependent X/Y term is    *
+*       shared between both axes, leaving one division for X/Y and one for Z   *
+*       per sample; the remaining divisions are by powers of two               *
+*                                                                              *
+*******************************************************************************/
+static void mag_compensate
+    (
+    int16_t   mag_x_raw, /* Raw X data, 13 bit        */
+    int16_t   mag_y_raw, /* Raw Y data, 13 bit        */
+    int16_t   mag_z_raw, /* Raw Z data, 15 bit        */
+    uint16_t  rhall    , /* Hall resistance, 14 bit   */
+    IMU_DATA* pIMU       /* Compensated output        */
+    )
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+uint16_t hall_ref;    /* Hall resistance used for X/Y                   */
+int16_t  hall_ratio;  /* dig_xyz1/rhall - 1, Q14                        */
+int32_t  xy_sens;     /* Hall sensitivity term common to X and Y        */
+int32_t  z_hall;      /* Hall resistance relative to the trim reference */
+int32_t  z_offset;    /* Z numerator terms                              */
+int32_t  z_raw_scaled;
+int16_t  z_sens;      /* Z Hall sensitivity correction                  */
+int32_t  z_comp;      /* Compensated Z                                  */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+hall_ref = ( rhall != 0 ) ? rhall : mag_trim.dig_xyz1;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* X and Y axes */
+if ( hall_ref != 0 )
+    {
+    hall_ratio  = (int16_t) ( (uint16_t) ( ( (int32_t) mag_trim.dig_xyz1*16384 )/
+                                           hall_ref ) - (uint16_t) 0x4000 );
+    xy_sens     = ( ( (int32_t) mag_trim.dig_xy2*( ( (int32_t) hall_ratio*hall_ratio )/128 ) +
+                      (int32_t) hall_ratio*( (int16_t) mag_trim.dig_xy1*128 ) )/512 ) + 
+                  (int32_t) 0x100000;
+    pIMU->mag_x = mag_compensate_xy( mag_x_raw, mag_trim.dig_x1, mag_trim.dig_x2,
+                                     xy_sens );
+    pIMU->mag_y = mag_compensate_xy( mag_y_raw, mag_trim.dig_y1, mag_trim.dig_y2,
+                                     xy_sens );
+    }
+else
+    {
+    pIMU->mag_x = MAG_OVERFLOW_OUTPUT;
+    pIMU->mag_y = MAG_OVERFLOW_OUTPUT;
+    }
+
+/* Z axis */
+if ( mag_z_raw         != MAG_OVERFLOW_ADC_Z && 
+     mag_trim.dig_z1   != 0                  && mag_trim.dig_z2 != 0 && 
+     mag_trim.dig_xyz1 != 0                  && rhall           != 0  )
+    {
+    z_hall       = (int16_t) rhall - (int16_t) mag_trim.dig_xyz1;
+    z_offset     = ( (int32_t) mag_trim.dig_z3*z_hall )/4;
+    z_raw_scaled = ( (int32_t) ( mag_z_raw - mag_trim.dig_z4 ) )*32768;
+    z_sens       = (int16_t) ( ( (int32_t) mag_trim.dig_z1*( (int16_t) rhall*2 ) + 
+                                 32768 )/65536 );
+    z_comp       = ( z_raw_scaled - z_offset )/( mag_trim.dig_z2 + z_sens );
+    if      ( z_comp >  MAG_SATURATION_OUTPUT )
+        {
+        z_comp =  MAG_SATURATION_OUTPUT;
+        }
+    else if ( z_comp < -MAG_SATURATION_OUTPUT )
+        {
+        z_comp = -MAG_SATURATION_OUTPUT;
+        }
+    pIMU->mag_z = (int16_t) z_comp;
+    }
+else
+    {
+    pIMU->mag_z = MAG_OVERFLOW_OUTPUT;
+    }
+} /* mag_compensate */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		mag_compensate_xy                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Trim compensation of the X or Y axis in 1/16 uT                        *
+*                                                                              *
+*******************************************************************************/
+static inline int16_t mag_compensate_xy
+    (
+    int16_t mag_raw , /* Raw axis data                        */
+    int8_t  dig_1   , /* Axis offset trim, dig_x1 or dig_y1    */
+    int8_t  dig_2   , /* Axis gain trim, dig_x2 or dig_y2      */
+    int32_t xy_sens   /* Hall sensitivity term common to X/Y  */
+    )
+{
+/*------------------------------------------------------------------------------
+ Local variables  
+------------------------------------------------------------------------------*/
+int32_t sens;   /* Axis sensitivity      */
+int32_t comp;   /* Compensated axis data */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( mag_raw == MAG_OVERFLOW_ADC_XY )
+    {
+    return MAG_OVERFLOW_OUTPUT;
+    }
+sens = ( xy_sens*( (int32_t) dig_2 + 0xA0 ) )/4096;
+comp = (int16_t) ( ( (int32_t) mag_raw*sens )/8192 );
+comp = comp + (int32_t) dig_1*8;
+if      ( comp >  MAG_SATURATION_OUTPUT )
+    {
+    comp =  MAG_SATURATION_OUTPUT;
+    }
+else if ( comp < -MAG_SATURATION_OUTPUT )
+    {
+    comp = -MAG_SATURATION_OUTPUT;
+    }
+return (int16_t) comp;
+} /* mag_compensate_xy */
 #endif /* #if defined( A0002_REV2 ) */
 
 
@@ -612,6 +1144,10 @@ HAL_StatusTypeDef hal_status;     /* Status return code of I2C HAL */
 ------------------------------------------------------------------------------*/
 
 /* Read I2C registers */
+if ( !IMU_BUS_ACQUIRE() )
+	{
+	return IMU_MAG_ERROR;
+	}
 hal_status = HAL_I2C_Mem_Read( &( IMU_I2C )        , 
                                IMU_MAG_ADDR        , 
                                reg_addr            , 
@@ -619,6 +1155,7 @@ hal_status = HAL_I2C_Mem_Read( &( IMU_I2C )        ,
                                data_ptr            , 
                                num_regs            , 
                                HAL_IMU_TIMEOUT );
+IMU_BUS_RELEASE();
 
 /* Return status code of I2C HAL */
 if ( hal_status != HAL_OK ) 
@@ -661,6 +1198,10 @@ HAL_StatusTypeDef hal_status;    /* Status of I2C HAL */
 ------------------------------------------------------------------------------*/
 
 /* Read I2C register */
+if ( !IMU_BUS_ACQUIRE() )
+	{
+	return IMU_ERROR;
+	}
 hal_status = HAL_I2C_Mem_Read( &( IMU_I2C )        , 
                                IMU_ADDR            , 
                                reg_addr            , 
@@ -668,6 +1209,7 @@ hal_status = HAL_I2C_Mem_Read( &( IMU_I2C )        ,
                                data_ptr            , 
                                num_regs            , 
                                HAL_MAX_DELAY );
+IMU_BUS_RELEASE();
 
 if ( hal_status != HAL_OK )
 	{
@@ -711,6 +1253,10 @@ hal_status = HAL_OK;
 /*------------------------------------------------------------------------------
  Implementation 
 ------------------------------------------------------------------------------*/
+if ( !IMU_BUS_ACQUIRE() )
+	{
+	return IMU_I2C_ERROR;
+	}
 hal_status = HAL_I2C_Mem_Write( &( IMU_I2C )        , 
                                 IMU_ADDR            , 
                                 reg_addr            , 
@@ -718,6 +1264,7 @@ hal_status = HAL_I2C_Mem_Write( &( IMU_I2C )        ,
                                 &data               , 
                                 sizeof( uint8_t )   , 
                                 HAL_IMU_TIMEOUT );
+IMU_BUS_RELEASE();
 if ( hal_status != HAL_OK )
     {
     return IMU_I2C_ERROR;
@@ -760,6 +1307,10 @@ hal_status = HAL_OK;
 /*------------------------------------------------------------------------------
  Implementation 
 ------------------------------------------------------------------------------*/
+if ( !IMU_BUS_ACQUIRE() )
+	{
+	return IMU_I2C_ERROR;
+	}
 hal_status = HAL_I2C_Mem_Write( &( IMU_I2C ), 
                                 IMU_ADDR            , 
                                 reg_addr            , 
@@ -767,6 +1318,7 @@ hal_status = HAL_I2C_Mem_Write( &( IMU_I2C ),
                                 data_ptr            , 
                                 num_regs            , 
                                 HAL_MAX_DELAY );
+IMU_BUS_RELEASE();
 if ( hal_status != HAL_OK )
     {
     return IMU_I2C_ERROR;
@@ -808,6 +1360,10 @@ hal_status = HAL_OK;
 /*------------------------------------------------------------------------------
  Implementation 
 ------------------------------------------------------------------------------*/
+if ( !IMU_BUS_ACQUIRE() )
+	{
+	return IMU_I2C_ERROR;
+	}
 hal_status = HAL_I2C_Mem_Write( &( IMU_I2C )        , 
                                 IMU_MAG_ADDR        , 
                                 reg_addr            , 
@@ -815,6 +1371,7 @@ hal_status = HAL_I2C_Mem_Write( &( IMU_I2C )        ,
                                 &data               , 
                                 sizeof( uint8_t )   , 
                                 HAL_IMU_TIMEOUT );
+IMU_BUS_RELEASE();
 if ( hal_status != HAL_OK )
     {
     return IMU_I2C_ERROR;
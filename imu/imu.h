@@ -48,13 +48,47 @@ extern "C" {
 /* Timeouts */
 #define HAL_IMU_TIMEOUT             10
 
-/* Register Bitmasks/Bitshifts */
+/* Unit conversion */
+#define IMU_GRAVITY                 9.80665f  /* m/s^2 per g        */
+#define IMU_DEG_TO_RAD              0.017453293f
+#define IMU_FULL_SCALE_COUNTS       32768.0f
+
+/* Calibration blob identification */
+#define IMU_CAL_MAGIC               0x43554D49 /* "IMUC" little-endian */
+#define IMU_CAL_BLOB_SIZE           ( sizeof( uint32_t ) + sizeof( IMU_CAL ) + \
+                                      sizeof( uint32_t ) )
+
+/* Register Bitmasks/Bitshifts, the MSB/LSB pair is combined into a signed 
+   16 bit value and arithmetically shifted down to the data width */
 #define MAG_XY_LSB_BITMASK          0b11111000
-#define MAG_XY_LSB_BITSHIFT         3 /* Bit 3 to position 0 */
-#define MAG_XY_MSB_BITSHIFT         5 /* Bit 0 to position 5 */
+#define MAG_XY_LSB_BITSHIFT         3 /* 13 bit X/Y data      */
 #define MAG_Z_LSB_BITMASK           0b11111110
-#define MAG_Z_LSB_BITSHIFT          1 /* Bit 1 to position 0 */
-#define MAG_Z_MSB_BITSHIFT          7 /* Bit 0 to position 7 */
+#define MAG_Z_LSB_BITSHIFT          1 /* 15 bit Z data        */
+#define MAG_RHALL_LSB_BITMASK       0b11111100
+#define MAG_RHALL_LSB_BITSHIFT      2 /* 14 bit Hall resistance */
+#define MAG_XYZ1_MSB_BITMASK        0b01111111
+
+/* Magnetometer data burst, DATAX_L through HALLR_H */
+#define MAG_DATA_BURST_SIZE         8
+
+/* Magnetometer trim register burst, DIG_X1 through DIG_XY1 */
+#define MAG_TRIM_BURST_SIZE         21
+#define MAG_TRIM_INDEX( reg )       ( ( reg ) - MAG_REG_DIG_X1 )
+
+/* Magnetometer overflow codes, compensated output is in 1/16 uT */
+#define MAG_OVERFLOW_ADC_XY         ( -4096  )
+#define MAG_OVERFLOW_ADC_Z          ( -16384 )
+#define MAG_OVERFLOW_OUTPUT         ( -32768 )
+#define MAG_SATURATION_OUTPUT       ( 32767  )
+
+/* Magnetometer output scale. The BMM150 output is trim compensated to 
+   1/16 uT, the AK8963 inside the MPU9250 reads 0.15 uT per LSB in its 16 bit 
+   output mode */
+#if   defined( A0002_REV1 )
+    #define MAG_UT_PER_LSB          0.15f
+#elif defined( A0002_REV2 )
+    #define MAG_UT_PER_LSB          ( 1.0f/16.0f )
+#endif
 
 
 /*------------------------------------------------------------------------------
@@ -193,6 +227,22 @@ extern "C" {
     #define MAG_REG_HIGH_THRESH         0x50
     #define MAG_REG_REP_CTRL_XY         0x51
     #define MAG_REG_REP_CTRL_Z          0x52
+    #define MAG_REG_DIG_X1              0x5D
+    #define MAG_REG_DIG_Y1              0x5E
+    #define MAG_REG_DIG_Z4_LSB          0x62
+    #define MAG_REG_DIG_Z4_MSB          0x63
+    #define MAG_REG_DIG_X2              0x64
+    #define MAG_REG_DIG_Y2              0x65
+    #define MAG_REG_DIG_Z2_LSB          0x68
+    #define MAG_REG_DIG_Z2_MSB          0x69
+    #define MAG_REG_DIG_Z1_LSB          0x6A
+    #define MAG_REG_DIG_Z1_MSB          0x6B
+    #define MAG_REG_DIG_XYZ1_LSB        0x6C
+    #define MAG_REG_DIG_XYZ1_MSB        0x6D
+    #define MAG_REG_DIG_Z3_LSB          0x6E
+    #define MAG_REG_DIG_Z3_MSB          0x6F
+    #define MAG_REG_DIG_XY2             0x70
+    #define MAG_REG_DIG_XY1             0x71
 #endif
 
   
@@ -203,18 +253,58 @@ extern "C" {
 /* Structure for imu containing all accel, gyro, and mag data */
 typedef struct _IMU_DATA 
 	{
-    uint16_t    accel_x;
-    uint16_t    accel_y;
-    uint16_t    accel_z;
-    uint16_t    gyro_x ;
-    uint16_t    gyro_y ;
-    uint16_t    gyro_z ;
-    uint16_t    mag_x  ;
-    uint16_t    mag_y  ;
-    uint16_t    mag_z  ;
+    int16_t     accel_x;
+    int16_t     accel_y;
+    int16_t     accel_z;
+    int16_t     gyro_x ;
+    int16_t     gyro_y ;
+    int16_t     gyro_z ;
+    int16_t     mag_x  ;
+    int16_t     mag_y  ;
+    int16_t     mag_z  ;
 	uint16_t    temp   ;
 	} IMU_DATA;
 
+/* IMU readouts converted to SI units */
+typedef struct _IMU_SI_DATA
+	{
+    float       accel_x; /* m/s^2 */
+    float       accel_y;
+    float       accel_z;
+    float       gyro_x ; /* rad/s */
+    float       gyro_y ;
+    float       gyro_z ;
+    float       mag_x  ; /* uT    */
+    float       mag_y  ;
+    float       mag_z  ;
+	} IMU_SI_DATA;
+
+/* BMM150 factory trim values */
+typedef struct _IMU_MAG_TRIM
+	{
+    int8_t      dig_x1;
+    int8_t      dig_y1;
+    int8_t      dig_x2;
+    int8_t      dig_y2;
+    uint16_t    dig_z1;
+    int16_t     dig_z2;
+    int16_t     dig_z3;
+    int16_t     dig_z4;
+    uint8_t     dig_xy1;
+    int8_t      dig_xy2;
+    uint16_t    dig_xyz1;
+	} IMU_MAG_TRIM;
+
+/* Sensor calibration, applied as out = matrix*( in - bias ) with in and bias
+   in SI units */
+typedef struct _IMU_CAL
+	{
+    float       accel_bias[3];      /* m/s^2                         */
+    float       accel_matrix[3][3]; /* Misalignment/scale correction */
+    float       gyro_bias[3];       /* rad/s                         */
+    float       gyro_matrix[3][3];  /* Misalignment/scale correction */
+	} IMU_CAL;
+
 /* Sensor Enable Configuration */
 typedef enum _IMU_SENSOR_ENABLE
     {
@@ -340,7 +430,9 @@ typedef enum IMU_STATUS
     IMU_INIT_FAIL          ,
     IMU_CONFIG_FAIL        ,
     IMU_MAG_UNRECOGNIZED_ID,
-    IMU_MAG_INIT_FAIL
+    IMU_MAG_INIT_FAIL      ,
+    IMU_UNSUPPORTED_RANGE  ,
+    IMU_CAL_ERROR
 	} IMU_STATUS;
 
 
@@ -368,7 +460,7 @@ IMU_STATUS imu_get_gyro_xyz
     );
 
 /* Return the pointer to structure that updates the x,y,z magnetometer values from 
-   the IMU */
+   the IMU, trim compensated in 1/16 uT on the BMM150 */
 IMU_STATUS imu_get_mag_xyz
     (
     IMU_DATA *pIMU
@@ -380,6 +472,34 @@ IMU_STATUS imu_get_device_id
     uint8_t* pdevice_id 
     );
 
+/* Precompute the raw count to SI unit scale factors for the configured 
+   measurement ranges, called by imu_init */
+IMU_STATUS imu_conv_config
+    (
+    IMU_CONFIG* imu_config_ptr /* IMU Configuration Settings */
+    );
+
+/* Set the bias and misalignment/scale calibration */
+void imu_conv_set_cal
+    (
+    IMU_CAL* imu_cal_ptr
+    );
+
+/* Validate a calibration blob read from flash and apply it */
+IMU_STATUS imu_conv_load_cal
+    (
+    uint8_t* cal_blob_ptr, /* Calibration blob             */
+    uint32_t blob_size     /* Size of the blob in bytes    */
+    );
+
+/* Convert a batch of raw readouts to calibrated SI units */
+void imu_convert
+    (
+    const IMU_DATA* raw_ptr,    /* Raw readouts, ie. FIFO frames */
+    IMU_SI_DATA*    si_ptr ,    /* Converted readouts            */
+    uint32_t        num_samples /* Number of readouts            */
+    );
+
 /* Change configuration of accel, gyro, mag */
 void IMU_config
     (
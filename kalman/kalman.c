@@ -0,0 +1,538 @@
+/*******************************************************************************
+*
+* FILE:
+* 		kalman.c
+*
+* DESCRIPTION:
+* 		Contains API functions for the vertical state estimator. Implements a
+*       fixed-size linear Kalman filter on altitude, vertical velocity and
+*       accelerometer bias, propagated at the IMU rate with the accelerometer
+*       projected onto the vertical through the attitude quaternion and
+*       corrected with baro altitude at the baro rate. Detects launch, apogee
+*       and main deployment altitude events and fires the parachute charges
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Standard Includes
+------------------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <math.h>
+
+
+/*------------------------------------------------------------------------------
+ Project Includes
+------------------------------------------------------------------------------*/
+#include "main.h"
+#include "imu.h"
+#include "attitude.h"
+#include "kalman.h"
+#include "cycles.h"
+
+
+/*------------------------------------------------------------------------------
+ Global Variables
+------------------------------------------------------------------------------*/
+
+/* Current state estimate and event state */
+static KALMAN_STATE kalman_state;
+
+/* State covariance, symmetric, upper triangle stored */
+static float p00, p01, p02;
+static float p11, p12;
+static float p22;
+
+/* Sample period terms and process noise, precomputed at init */
+static float sample_period;
+static float half_period_sq;
+static float q00, q01, q11, q22;
+static float main_altitude = KALMAN_MAIN_ALTITUDE;
+static bool  kalman_initialized = false;
+
+/* Apogee debounce, timed in IMU samples so it does not depend on how often
+   the baro updates. predict_count counts kalman_predict calls and 
+   descent_start is the count at which the velocity went negative */
+static uint32_t apogee_samples;
+static uint32_t predict_count;
+static uint32_t descent_start;
+static bool     descending;
+
+/* Events whose charges have already been fired by kalman_deploy */
+static uint8_t  deployed_events;
+
+/* Worst case predict and update times in CPU cycles */
+static uint32_t max_predict_cycles;
+static uint32_t max_update_cycles;
+
+
+/*------------------------------------------------------------------------------
+ Internal function prototypes
+------------------------------------------------------------------------------*/
+
+/* Advance the flight phase and latch events */
+static void detect_events
+	(
+	void
+	);
+
+
+/*------------------------------------------------------------------------------
+ API Functions
+------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		kalman_init                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Initialize the estimator from the IMU configuration passed to          *
+*       imu_init. The sample period is derived from the accelerometer ODR      *
+*                                                                              *
+*******************************************************************************/
+KALMAN_STATUS kalman_init
+	(
+	IMU_CONFIG* imu_config_ptr /* IMU configuration settings */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables
+------------------------------------------------------------------------------*/
+float accel_var; /* Accelerometer noise variance */
+
+
+/*------------------------------------------------------------------------------
+ Implementation
+------------------------------------------------------------------------------*/
+
+/* Sample period, ODR setting n corresponds to 25*2^(n-6) Hz */
+if ( imu_config_ptr -> acc_odr < IMU_ODR_0P78 ||
+     imu_config_ptr -> acc_odr > IMU_ODR_3K2 )
+	{
+	return KALMAN_UNSUPPORTED_ODR;
+	}
+sample_period  = ldexpf( 0.04f, IMU_ODR_25 - (int) imu_config_ptr -> acc_odr );
+half_period_sq = 0.5f*sample_period*sample_period;
+
+/* Process noise, acceleration noise enters through [dt^2/2, dt, 0] and the
+   bias is a random walk */
+accel_var = KALMAN_ACCEL_NOISE*KALMAN_ACCEL_NOISE;
+q00       = half_period_sq*half_period_sq*accel_var;
+q01       = half_period_sq*sample_period*accel_var;
+q11       = sample_period*sample_period*accel_var;
+q22       = KALMAN_BIAS_NOISE*KALMAN_BIAS_NOISE*sample_period;
+
+/* Apogee debounce in samples, at least one */
+apogee_samples = (uint32_t) ( KALMAN_APOGEE_DEBOUNCE/sample_period );
+if ( apogee_samples == 0 )
+	{
+	apogee_samples = 1;
+	}
+
+/* Start the cycle counter for update timing */
+cycles_init();
+
+kalman_reset( 0.0f );
+kalman_initialized = true;
+return KALMAN_OK;
+} /* kalman_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		kalman_reset                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Reset the estimator to rest on the pad at the given altitude and       *
+*       clear all events                                                       *
+*                                                                              *
+*******************************************************************************/
+void kalman_reset
+	(
+	float altitude /* In: Initial altitude above ground reference, m */
+	)
+{
+kalman_state.altitude        = altitude;
+kalman_state.velocity        = 0.0f;
+kalman_state.accel_bias      = 0.0f;
+kalman_state.apogee_altitude = altitude;
+kalman_state.phase           = KALMAN_PHASE_PAD;
+kalman_state.events          = 0;
+p00                          = KALMAN_INIT_ALT_VAR;
+p01                          = 0.0f;
+p02                          = 0.0f;
+p11                          = KALMAN_INIT_VEL_VAR;
+p12                          = 0.0f;
+p22                          = KALMAN_INIT_BIAS_VAR;
+predict_count                = 0;
+descending                   = false;
+deployed_events              = 0;
+max_predict_cycles           = 0;
+max_update_cycles            = 0;
+} /* kalman_reset */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		kalman_predict                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Propagate the filter by one IMU sample. Must be called once per        *
+*       accelerometer sample at the ODR passed to kalman_init, with the        *
+*       attitude already updated from the same sample. The specific force is   *
+*       rotated into the attitude reference frame, whose z axis is the         *
+*       vertical the attitude estimator levelled to on the pad, so it reads    *
+*       +1 g at rest regardless of how the board is mounted or the vehicle     *
+*       is pitched over                                                        *
+*                                                                              *
+*******************************************************************************/
+KALMAN_STATUS kalman_predict
+	(
+	IMU_SI_DATA*    imu_si_data_ptr, /* In: Calibrated IMU sample  */
+	ATTITUDE_STATE* attitude_ptr     /* In: Current attitude       */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables
+------------------------------------------------------------------------------*/
+uint32_t start_cycles;  /* Cycle counter at entry                  */
+uint32_t cycles;        /* Cycles spent in this call               */
+float    vert_accel;    /* Vertical specific force, m/s^2          */
+float    accel;         /* Bias corrected vertical acceleration    */
+float    a00, a01, a02; /* Rows of F*P                             */
+float    a11, a12;
+
+
+/*------------------------------------------------------------------------------
+ Initializations
+------------------------------------------------------------------------------*/
+if ( !kalman_initialized )
+	{
+	return KALMAN_NOT_INITIALIZED;
+	}
+start_cycles = DWT->CYCCNT;
+
+
+/*------------------------------------------------------------------------------
+ Implementation
+------------------------------------------------------------------------------*/
+
+/* Vertical component of the specific force, the body accelerometer dotted
+   with the last row of the body to reference rotation matrix */
+vert_accel = 2.0f*( attitude_ptr -> q1*attitude_ptr -> q3 - 
+                    attitude_ptr -> q0*attitude_ptr -> q2 )*
+                    imu_si_data_ptr -> accel_x +
+             2.0f*( attitude_ptr -> q0*attitude_ptr -> q1 + 
+                    attitude_ptr -> q2*attitude_ptr -> q3 )*
+                    imu_si_data_ptr -> accel_y +
+             ( attitude_ptr -> q0*attitude_ptr -> q0 - 
+               attitude_ptr -> q1*attitude_ptr -> q1 -
+               attitude_ptr -> q2*attitude_ptr -> q2 + 
+               attitude_ptr -> q3*attitude_ptr -> q3 )*
+               imu_si_data_ptr -> accel_z;
+
+/* State propagation */
+accel                    = vert_accel - IMU_GRAVITY - kalman_state.accel_bias;
+kalman_state.altitude   += kalman_state.velocity*sample_period +
+                           accel*half_period_sq;
+kalman_state.velocity   += accel*sample_period;
+
+/* Covariance propagation, P = F*P*F' + Q with
+   F = [ 1 dt -dt^2/2; 0 1 -dt; 0 0 1 ] */
+a00 = p00 + sample_period*p01 - half_period_sq*p02;
+a01 = p01 + sample_period*p11 - half_period_sq*p12;
+a02 = p02 + sample_period*p12 - half_period_sq*p22;
+a11 = p11 - sample_period*p12;
+a12 = p12 - sample_period*p22;
+p00 = a00 + sample_period*a01 - half_period_sq*a02 + q00;
+p01 = a01 - sample_period*a02                      + q01;
+p02 = a02;
+p11 = a11 - sample_period*a12                      + q11;
+p12 = a12;
+p22 = p22                                          + q22;
+
+predict_count++;
+detect_events();
+
+/* Track the worst case update time */
+cycles = DWT->CYCCNT - start_cycles;
+if ( cycles > max_predict_cycles )
+	{
+	max_predict_cycles = cycles;
+	}
+
+return KALMAN_OK;
+} /* kalman_predict */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		kalman_update_baro                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Correct the filter with a baro altitude measurement above the same     *
+*       ground reference, as returned by baro_get_altitude                     *
+*                                                                              *
+*******************************************************************************/
+KALMAN_STATUS kalman_update_baro
+	(
+	float altitude /* In: Baro altitude, m */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables
+------------------------------------------------------------------------------*/
+uint32_t start_cycles;  /* Cycle counter at entry                  */
+uint32_t cycles;        /* Cycles spent in this call               */
+float    recip_s;       /* Reciprocal of the innovation variance   */
+float    innovation;    /* Measurement residual                    */
+float    k0, k1, k2;    /* Kalman gain                             */
+
+
+/*------------------------------------------------------------------------------
+ Initializations
+------------------------------------------------------------------------------*/
+if ( !kalman_initialized )
+	{
+	return KALMAN_NOT_INITIALIZED;
+	}
+start_cycles = DWT->CYCCNT;
+
+
+/*------------------------------------------------------------------------------
+ Implementation
+------------------------------------------------------------------------------*/
+
+/* Gain, H = [ 1 0 0 ] so the innovation variance is a scalar */
+recip_s    = 1.0f/( p00 + KALMAN_BARO_NOISE*KALMAN_BARO_NOISE );
+k0         = p00*recip_s;
+k1         = p01*recip_s;
+k2         = p02*recip_s;
+innovation = altitude - kalman_state.altitude;
+
+/* State correction */
+kalman_state.altitude   += k0*innovation;
+kalman_state.velocity   += k1*innovation;
+kalman_state.accel_bias += k2*innovation;
+
+/* Covariance correction, P = P - K*H*P, first row used before overwrite */
+p22 -= k2*p02;
+p12 -= k1*p02;
+p11 -= k1*p01;
+p02 -= k0*p02;
+p01 -= k0*p01;
+p00 -= k0*p00;
+
+detect_events();
+
+/* Track the worst case update time */
+cycles = DWT->CYCCNT - start_cycles;
+if ( cycles > max_update_cycles )
+	{
+	max_update_cycles = cycles;
+	}
+
+return KALMAN_OK;
+} /* kalman_update_baro */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		kalman_set_main_altitude                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Set the altitude above ground for the main deployment event            *
+*                                                                              *
+*******************************************************************************/
+void kalman_set_main_altitude
+	(
+	float altitude /* In: Main deployment altitude, m */
+	)
+{
+main_altitude = altitude;
+} /* kalman_set_main_altitude */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		kalman_get_state                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the current vertical state estimate, flight phase and events       *
+*                                                                              *
+*******************************************************************************/
+void kalman_get_state
+	(
+	KALMAN_STATE* state_ptr /* Out: vertical state */
+	)
+{
+*state_ptr = kalman_state;
+} /* kalman_get_state */
+
+
+#if defined( FLIGHT_COMPUTER )
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		kalman_deploy                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Fire the drogue charge once the apogee event is latched and the main   *
+*       charge once the main event is latched. Each charge is fired at most    *
+*       once per kalman_reset, also when the ignition reports a failure, since *
+*       a charge without continuity will not light on a retry. The ignition    *
+*       pulse blocks for IGN_BURN_DELAY, so call from the flight loop after    *
+*       the filter update and never from an interrupt. Returns the ignition    *
+*       status of the last charge fired, IGN_OK when none was due              *
+*                                                                              *
+*******************************************************************************/
+IGN_STATUS kalman_deploy
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local variables
+------------------------------------------------------------------------------*/
+uint8_t    due_events; /* Latched events not yet deployed */
+IGN_STATUS ign_status; /* Ignition return code            */
+
+
+/*------------------------------------------------------------------------------
+ Initializations
+------------------------------------------------------------------------------*/
+due_events = kalman_state.events & ~deployed_events;
+ign_status = IGN_OK;
+
+
+/*------------------------------------------------------------------------------
+ Implementation
+------------------------------------------------------------------------------*/
+
+/* Drogue at apogee */
+if ( due_events & KALMAN_EVENT_APOGEE )
+	{
+	deployed_events |= KALMAN_EVENT_APOGEE;
+	ign_status       = ign_deploy_drogue();
+	}
+
+/* Main at the deployment altitude, always after the drogue */
+if ( due_events & KALMAN_EVENT_MAIN )
+	{
+	deployed_events |= KALMAN_EVENT_MAIN;
+	ign_status       = ign_deploy_main();
+	}
+
+return ign_status;
+} /* kalman_deploy */
+#endif /* #if defined( FLIGHT_COMPUTER ) */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		kalman_get_max_cycles                                                  *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the worst case number of CPU cycles spent in kalman_predict and    *
+*       kalman_update_baro since the last reset                                *
+*                                                                              *
+*******************************************************************************/
+void kalman_get_max_cycles
+	(
+	uint32_t* predict_cycles_ptr, /* Out: kalman_predict worst case     */
+	uint32_t* update_cycles_ptr   /* Out: kalman_update_baro worst case */
+	)
+{
+*predict_cycles_ptr = max_predict_cycles;
+*update_cycles_ptr  = max_update_cycles;
+} /* kalman_get_max_cycles */
+
+
+/*------------------------------------------------------------------------------
+ Internal procedures
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		detect_events                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Advance the flight phase from the current estimate and latch the       *
+*       corresponding events. The apogee debounce is timed in IMU samples, so  *
+*       the detection time does not depend on the baro update rate             *
+*                                                                              *
+*******************************************************************************/
+static void detect_events
+	(
+	void
+	)
+{
+switch ( kalman_state.phase )
+	{
+	case KALMAN_PHASE_PAD:
+		{
+		if ( kalman_state.velocity > KALMAN_LAUNCH_VELOCITY )
+			{
+			kalman_state.phase   = KALMAN_PHASE_ASCENT;
+			kalman_state.events |= KALMAN_EVENT_LAUNCH;
+			}
+		break;
+		}
+
+	case KALMAN_PHASE_ASCENT:
+		{
+		if ( kalman_state.altitude > kalman_state.apogee_altitude )
+			{
+			kalman_state.apogee_altitude = kalman_state.altitude;
+			}
+
+		/* Apogee once the velocity has stayed negative for apogee_samples 
+		   IMU samples, however many baro updates arrive meanwhile */
+		if ( kalman_state.velocity >= 0.0f )
+			{
+			descending = false;
+			break;
+			}
+		if ( !descending )
+			{
+			descending    = true;
+			descent_start = predict_count;
+			}
+		if ( predict_count - descent_start >= apogee_samples )
+			{
+			kalman_state.phase   = KALMAN_PHASE_DESCENT;
+			kalman_state.events |= KALMAN_EVENT_APOGEE;
+			}
+		break;
+		}
+
+	case KALMAN_PHASE_DESCENT:
+		{
+		if ( kalman_state.altitude < main_altitude )
+			{
+			kalman_state.phase   = KALMAN_PHASE_MAIN_DESCENT;
+			kalman_state.events |= KALMAN_EVENT_MAIN;
+			}
+		break;
+		}
+
+	default:
+		{
+		break;
+		}
+	}
+} /* detect_events */
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,161 @@
+/*******************************************************************************
+*
+* FILE:
+* 		kalman.h
+*
+* DESCRIPTION:
+* 		Contains API functions for the vertical state estimator. Implements a
+*       fixed-size linear Kalman filter on altitude, vertical velocity and
+*       accelerometer bias, propagated at the IMU rate with the accelerometer
+*       projected onto the vertical through the attitude quaternion and
+*       corrected with baro altitude at the baro rate. Detects launch, apogee
+*       and main deployment altitude events and fires the parachute charges
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef KALMAN_H
+#define KALMAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32h7xx_hal.h"
+#include "imu.h"
+#include "attitude.h"
+#if defined( FLIGHT_COMPUTER )
+	#include "ignition.h"
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Noise parameters: accelerometer noise in m/s^2, accelerometer bias random
+   walk in m/s^2/sqrt(s) and baro altitude noise in m */
+#define KALMAN_ACCEL_NOISE          ( 0.5f   )
+#define KALMAN_BIAS_NOISE           ( 0.02f  )
+#define KALMAN_BARO_NOISE           ( 1.0f   )
+
+/* Initial state variances for altitude, velocity and bias */
+#define KALMAN_INIT_ALT_VAR         ( 1.0f   )
+#define KALMAN_INIT_VEL_VAR         ( 0.1f   )
+#define KALMAN_INIT_BIAS_VAR        ( 1.0f   )
+
+/* Event detection thresholds. Launch is declared once the vertical velocity
+   exceeds KALMAN_LAUNCH_VELOCITY, apogee once the velocity has been negative
+   for KALMAN_APOGEE_DEBOUNCE seconds after launch */
+#define KALMAN_LAUNCH_VELOCITY      ( 15.0f  )
+#define KALMAN_APOGEE_DEBOUNCE      ( 0.1f   )
+
+/* Default main parachute deployment altitude above ground, m ( 500 ft ) */
+#define KALMAN_MAIN_ALTITUDE        ( 152.4f )
+
+/* Event flags */
+#define KALMAN_EVENT_LAUNCH         ( 0x01 )
+#define KALMAN_EVENT_APOGEE         ( 0x02 )
+#define KALMAN_EVENT_MAIN           ( 0x04 )
+
+
+/*------------------------------------------------------------------------------
+ Typdefs
+------------------------------------------------------------------------------*/
+
+/* Vertical state estimator return codes */
+typedef enum _KALMAN_STATUS
+	{
+	KALMAN_OK               = 0,
+	KALMAN_UNSUPPORTED_ODR     ,
+	KALMAN_NOT_INITIALIZED
+	} KALMAN_STATUS;
+
+/* Flight phase */
+typedef enum _KALMAN_PHASE
+	{
+	KALMAN_PHASE_PAD          = 0,
+	KALMAN_PHASE_ASCENT          ,
+	KALMAN_PHASE_DESCENT         ,
+	KALMAN_PHASE_MAIN_DESCENT
+	} KALMAN_PHASE;
+
+/* Vertical state estimate */
+typedef struct _KALMAN_STATE
+	{
+	float        altitude;        /* Altitude above ground reference, m     */
+	float        velocity;        /* Vertical velocity, m/s                 */
+	float        accel_bias;      /* Axial accelerometer bias, m/s^2        */
+	float        apogee_altitude; /* Highest estimated altitude, m          */
+	KALMAN_PHASE phase;           /* Current flight phase                   */
+	uint8_t      events;          /* Latched KALMAN_EVENT flags             */
+	} KALMAN_STATE;
+
+
+/*------------------------------------------------------------------------------
+ Function Prototypes
+------------------------------------------------------------------------------*/
+
+/* Initialize the estimator from the IMU configuration passed to imu_init */
+KALMAN_STATUS kalman_init
+	(
+	IMU_CONFIG* imu_config_ptr
+	);
+
+/* Reset the estimator to rest at the given altitude */
+void kalman_reset
+	(
+	float altitude
+	);
+
+/* Propagate the filter by one IMU sample at the current attitude */
+KALMAN_STATUS kalman_predict
+	(
+	IMU_SI_DATA*    imu_si_data_ptr,
+	ATTITUDE_STATE* attitude_ptr
+	);
+
+/* Correct the filter with a baro altitude measurement */
+KALMAN_STATUS kalman_update_baro
+	(
+	float altitude
+	);
+
+/* Set the main parachute deployment altitude */
+void kalman_set_main_altitude
+	(
+	float altitude
+	);
+
+/* Get the current vertical state estimate */
+void kalman_get_state
+	(
+	KALMAN_STATE* state_ptr
+	);
+
+#if defined( FLIGHT_COMPUTER )
+/* Fire the drogue and main charges for newly latched apogee and main
+   events */
+IGN_STATUS kalman_deploy
+	(
+	void
+	);
+#endif
+
+/* Get the worst case number of CPU cycles spent in predict and update */
+void kalman_get_max_cycles
+	(
+	uint32_t* predict_cycles_ptr,
+	uint32_t* update_cycles_ptr
+	);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* KALMAN_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
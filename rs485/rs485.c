@@ -4,7 +4,9 @@
 * 		rs485.c
 *
 * DESCRIPTION: 
-* 		Contains API functions to transmit data over RS485 
+* 		Contains API functions to transmit data over RS485. The polled bus 
+*       layer is built on boards that define RS485_SLOT_TIM, the point to 
+*       point calls on every board
 *
 *******************************************************************************/
 
@@ -18,17 +20,117 @@
 	#include "sdr_pin_defines_L0002.h"
 #endif
 
+#include <string.h>
+
 /*------------------------------------------------------------------------------
  Project Includes                                                                     
 ------------------------------------------------------------------------------*/
 #include "main.h"
 #include "rs485.h"
+#include "frame.h"
+#include "cycles.h"
+
+
+/*------------------------------------------------------------------------------
+ Preprocesor Directives 
+------------------------------------------------------------------------------*/
+
+/* Transmit buffer size for a bus frame with a full payload */
+#define RS485_TX_BUFFER_SIZE    ( FRAME_ENCODED_SIZE( RS485_MAX_PAYLOAD ) )
+
+/* Schedule index of an address that is not scheduled */
+#define RS485_NO_SLOT           ( 0xFF )
+
+/* Ring and queue index masks */
+#define RS485_RX_MASK           ( RS485_RX_BUFFER_SIZE - 1 )
+#define RS485_RX_QUEUE_MASK     ( RS485_RX_QUEUE_DEPTH - 1 )
 
 
 /*------------------------------------------------------------------------------
 Global Variables                                                                  
 ------------------------------------------------------------------------------*/
 
+/* Bus layer owns the UART once started */
+volatile static bool       bus_active = false;
+
+#ifdef RS485_SLOT_TIM
+/* Bus configuration */
+static RS485_BUS_CONFIG    bus_config;
+
+/* Circular DMA receive ring, the parser and its position in the ring */
+static uint8_t             rx_buffer[RS485_RX_BUFFER_SIZE] __attribute__(( aligned( 32 ) ));
+static FRAME_DECODER       bus_decoder;
+volatile static uint16_t   parse_pos = 0;
+static RS485_RX_STATS      rx_stats;
+
+/* Encoded frame being transmitted */
+static uint8_t             tx_buffer[RS485_TX_BUFFER_SIZE];
+
+/* Master schedule state */
+volatile static uint8_t    slot_index    = 0;     /* Slot being polled         */
+volatile static bool       reply_pending = false; /* Waiting on a reply        */
+volatile static uint32_t   poll_cycles   = 0;     /* Cycle counter at the poll */
+volatile static uint8_t    poll_sequence = 0;     /* Sequence of the last poll */
+
+/* Per-slot poll payloads and node statistics, master only */
+static uint8_t             poll_data[RS485_MAX_SLOTS][RS485_MAX_PAYLOAD];
+volatile static uint8_t    poll_size[RS485_MAX_SLOTS];
+static RS485_NODE_STATS    node_stats[RS485_MAX_SLOTS];
+
+/* Reply payload, node only */
+static uint8_t             reply_data[RS485_MAX_PAYLOAD];
+volatile static uint8_t    reply_size = 0;
+
+/* Reply waiting out the turnaround, node only */
+volatile static bool       reply_due      = false;
+volatile static uint8_t    reply_sequence = 0;
+
+/* Received message queue. Single producer, the receive ISR, and single 
+   consumer, the main loop, so the indices need no lock */
+static RS485_BUS_MSG       rx_queue[RS485_RX_QUEUE_DEPTH];
+volatile static uint8_t    rx_head = 0;     /* Written by the receive ISR */
+volatile static uint8_t    rx_tail = 0;     /* Written by the consumer    */
+#endif /* #ifdef RS485_SLOT_TIM */
+
+
+/*------------------------------------------------------------------------------
+ Internal function prototypes 
+------------------------------------------------------------------------------*/
+#ifdef RS485_SLOT_TIM
+/* Encode a bus frame and start sending it */
+static RS485_STATUS bus_transmit
+	(
+	uint8_t        dest    ,
+	uint8_t        sequence,
+	const uint8_t* data_ptr,
+	uint8_t        size
+	);
+
+/* Handle a decoded bus frame */
+static void bus_frame_received
+	(
+	const FRAME* frame_ptr
+	);
+
+/* Schedule slot of a node address */
+static uint8_t bus_slot
+	(
+	uint8_t address
+	);
+
+/* Parse the receive ring up to the DMA write position */
+static void bus_parse
+	(
+	uint16_t rx_pos
+	);
+
+/* Drive or release the bus */
+static void bus_driver_enable
+	(
+	bool enable
+	);
+#endif /* #ifdef RS485_SLOT_TIM */
+
 
 /*------------------------------------------------------------------------------
  Procedures 
@@ -65,6 +167,12 @@ hal_status = HAL_OK;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The bus layer owns the UART */
+if ( bus_active )
+	{
+	return RS485_BUSY;
+	}
+
 /* Transmit byte */
 hal_status = HAL_UART_Transmit( &( RS485_HUART  ),
                                 &tx_byte         , 
@@ -115,6 +223,12 @@ hal_status = HAL_OK;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The bus layer owns the UART */
+if ( bus_active )
+	{
+	return RS485_BUSY;
+	}
+
 /* Transmit byte */
 hal_status = HAL_UART_Transmit( &( RS485_HUART ),
                                 tx_buffer_ptr  , 
@@ -164,6 +278,12 @@ hal_status = HAL_OK;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The bus layer owns the UART */
+if ( bus_active )
+	{
+	return RS485_BUSY;
+	}
+
 /* Receive byte */
 hal_status = HAL_UART_Receive( &( RS485_HUART )  ,
                                p_rx_byte        , 
@@ -221,6 +341,12 @@ hal_status = HAL_OK;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The bus layer owns the UART */
+if ( bus_active )
+	{
+	return RS485_BUSY;
+	}
+
 /* Receive data */
 hal_status = HAL_UART_Receive( &( RS485_HUART ),
                                rx_buffer_ptr  , 
@@ -278,6 +404,12 @@ hal_status = HAL_OK;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The bus layer owns the UART */
+if ( bus_active )
+	{
+	return RS485_BUSY;
+	}
+
 /* Receive data */
 hal_status = HAL_UART_Receive_IT( &( RS485_HUART ),
                                   rx_buffer_ptr   , 
@@ -295,6 +427,756 @@ else
 } /* rs485_receive_IT */
 
 
+#ifdef RS485_SLOT_TIM
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_bus_init                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start the multi-drop bus layer. Bus frames use the frame codec with the*
+*       opcode field carrying the destination address and the subcommand field *
+*       the source address, so every frame is COBS delimited and CRC checked.  *
+*       The master polls the schedule from the slot timer, nodes reply to polls*
+*       addressed to them once the slot timer has timed the turnaround         *
+*                                                                              *
+*******************************************************************************/
+RS485_STATUS rs485_bus_init
+	(
+	const RS485_BUS_CONFIG* config_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t i; /* Slot index */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+if ( ( config_ptr->num_slots > RS485_MAX_SLOTS            ) || 
+     ( config_ptr->address  == RS485_ADDR_BROADCAST       ) || 
+     ( ( config_ptr->role    == RS485_ROLE_MASTER ) != 
+       ( config_ptr->address == RS485_ADDR_MASTER )       ) )
+	{
+	return RS485_INVALID_ADDR;
+	}
+bus_config    = *config_ptr;
+slot_index    = bus_config.num_slots;
+reply_pending = false;
+reply_size    = 0;
+reply_due     = false;
+parse_pos     = 0;
+rx_head       = 0;
+rx_tail       = 0;
+memset( &rx_stats, 0, sizeof( rx_stats ) );
+memset( (void*) &poll_size[0], 0, sizeof( poll_size  ) );
+memset( &node_stats[0]       , 0, sizeof( node_stats ) );
+for ( i = 0; i < RS485_MAX_SLOTS; ++i )
+	{
+	node_stats[i].min_latency_us = UINT32_MAX;
+	}
+frame_decoder_init( &bus_decoder );
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+
+/* Start the cycle counter for latency and turnaround timing */
+cycles_init();
+
+/* Nodes time the turnaround with the slot timer, load the period now so
+   each poll only has to restart the counter */
+if ( bus_config.role == RS485_ROLE_NODE )
+	{
+	HAL_TIM_Base_Stop_IT( &( RS485_SLOT_TIM ) );
+	__HAL_TIM_SET_AUTORELOAD( &( RS485_SLOT_TIM ), RS485_TURNAROUND_US - 1 );
+	HAL_TIM_GenerateEvent( &( RS485_SLOT_TIM ), TIM_EVENTSOURCE_UPDATE );
+	__HAL_TIM_CLEAR_FLAG( &( RS485_SLOT_TIM ), TIM_FLAG_UPDATE );
+	}
+
+/* Listen */
+bus_driver_enable( false );
+if ( HAL_UARTEx_ReceiveToIdle_DMA( &( RS485_HUART ), 
+                                   rx_buffer     , 
+                                   RS485_RX_BUFFER_SIZE ) != HAL_OK )
+	{
+	return RS485_ERROR;
+	}
+bus_active = true;
+return RS485_OK;
+} /* rs485_bus_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_bus_set_poll_data                                                *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Master, set the payload sent with the next poll of a node. The payload *
+*       is sent once, later polls carry no payload until it is set again       *
+*                                                                              *
+*******************************************************************************/
+RS485_STATUS rs485_bus_set_poll_data
+	(
+	uint8_t     address ,   /* Node to send to  */
+	const void* data_ptr,   /* Payload          */
+	uint8_t     size        /* Payload size     */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t  slot;    /* Schedule slot of the node      */
+uint32_t primask; /* Interrupt mask state at entry  */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+slot = bus_slot( address );
+if ( slot == RS485_NO_SLOT )
+	{
+	return RS485_INVALID_ADDR;
+	}
+if ( size > RS485_MAX_PAYLOAD )
+	{
+	return RS485_PAYLOAD_TOO_LONG;
+	}
+
+/* Keep the slot ISR from sending a half written payload */
+primask = __get_PRIMASK();
+__disable_irq();
+memcpy( &( poll_data[slot][0] ), data_ptr, size );
+poll_size[slot] = size;
+__set_PRIMASK( primask );
+return RS485_OK;
+} /* rs485_bus_set_poll_data */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_bus_set_reply_data                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Node, set the payload sent in reply to polls. The payload is repeated  *
+*       in every reply until it is replaced                                    *
+*                                                                              *
+*******************************************************************************/
+RS485_STATUS rs485_bus_set_reply_data
+	(
+	const void* data_ptr,   /* Payload          */
+	uint8_t     size        /* Payload size     */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t primask; /* Interrupt mask state at entry */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+if ( size > RS485_MAX_PAYLOAD )
+	{
+	return RS485_PAYLOAD_TOO_LONG;
+	}
+
+primask = __get_PRIMASK();
+__disable_irq();
+memcpy( &( reply_data[0] ), data_ptr, size );
+reply_size = size;
+__set_PRIMASK( primask );
+return RS485_OK;
+} /* rs485_bus_set_reply_data */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_bus_receive                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the oldest received message with a payload, false if the queue is  *
+*       empty. Lock free, must only be called from one context                 *
+*                                                                              *
+*******************************************************************************/
+bool rs485_bus_receive
+	(
+	RS485_BUS_MSG* msg_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t tail; /* Local copy of the queue tail */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+tail = rx_tail;
+if ( tail == rx_head )
+	{
+	return false;
+	}
+
+/* Copy out before handing the entry back to the ISR */
+*msg_ptr = rx_queue[tail & RS485_RX_QUEUE_MASK];
+__DMB();
+rx_tail  = tail + 1;
+return true;
+} /* rs485_bus_receive */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_bus_get_rx_stats                                                 *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the receive engine statistics                                      *
+*                                                                              *
+*******************************************************************************/
+void rs485_bus_get_rx_stats
+	(
+	RS485_RX_STATS* stats_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t primask; /* Interrupt mask state at entry */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+primask = __get_PRIMASK();
+__disable_irq();
+*stats_ptr = rx_stats;
+__set_PRIMASK( primask );
+} /* rs485_bus_get_rx_stats */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_bus_get_node_stats                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Master, get the bus statistics of a scheduled node                     *
+*                                                                              *
+*******************************************************************************/
+RS485_STATUS rs485_bus_get_node_stats
+	(
+	uint8_t           address  ,
+	RS485_NODE_STATS* stats_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t  slot;    /* Schedule slot of the node      */
+uint32_t primask; /* Interrupt mask state at entry  */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+slot = bus_slot( address );
+if ( slot == RS485_NO_SLOT )
+	{
+	return RS485_INVALID_ADDR;
+	}
+
+primask = __get_PRIMASK();
+__disable_irq();
+*stats_ptr = node_stats[slot];
+__set_PRIMASK( primask );
+return RS485_OK;
+} /* rs485_bus_get_node_stats */
+#endif /* #ifdef RS485_SLOT_TIM */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_bus_active                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       True once the bus layer owns the UART                                  *
+*                                                                              *
+*******************************************************************************/
+bool rs485_bus_active
+	(
+	void
+	)
+{
+return bus_active;
+} /* rs485_bus_active */
+
+
+#ifdef RS485_SLOT_TIM
+/*------------------------------------------------------------------------------
+ Interrupt Service Routines 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_bus_slot_ISR                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Slot timer interrupt, call from HAL_TIM_PeriodElapsedCallback for      *
+*       RS485_SLOT_TIM. On the master it closes the current slot, counting a   *
+*       timeout if its node did not reply, and polls the node in the next slot.*
+*       A poll that would cut off a frame still being sent is skipped. On a    *
+*       node it ends the turnaround and sends the reply to the last poll       *
+*                                                                              *
+*******************************************************************************/
+void rs485_bus_slot_ISR
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t slot; /* Next slot */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Node, the turnaround is over */
+if ( bus_config.role == RS485_ROLE_NODE )
+	{
+	HAL_TIM_Base_Stop_IT( &( RS485_SLOT_TIM ) );
+	if ( reply_due )
+		{
+		reply_due = false;
+		if ( bus_transmit( RS485_ADDR_MASTER, reply_sequence, 
+		                   &( reply_data[0] ), reply_size ) != RS485_OK )
+			{
+			rx_stats.tx_skipped++;
+			}
+		}
+	return;
+	}
+if ( bus_config.num_slots == 0 )
+	{
+	return;
+	}
+
+/* Close the current slot */
+if ( reply_pending )
+	{
+	node_stats[slot_index].timeouts++;
+	reply_pending = false;
+	}
+
+/* Poll the next node, the poll payload is kept for the next poll if the 
+   bus is still busy */
+slot = slot_index + 1;
+if ( slot >= bus_config.num_slots )
+	{
+	slot = 0;
+	}
+slot_index = slot;
+poll_sequence++;
+reply_pending = true;
+poll_cycles   = DWT->CYCCNT;
+if ( bus_transmit( bus_config.schedule[slot], poll_sequence, 
+                   &( poll_data[slot][0] ), poll_size[slot] ) != RS485_OK )
+	{
+	reply_pending = false;
+	node_stats[slot].skipped++;
+	return;
+	}
+node_stats[slot].polls++;
+poll_size[slot] = 0;
+} /* rs485_bus_slot_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_tx_complete_ISR                                                  *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Transmit complete interrupt, call from HAL_UART_TxCpltCallback. The    *
+*       stop bit of the last byte has left the UART, release the bus           *
+*                                                                              *
+*******************************************************************************/
+void rs485_tx_complete_ISR
+	(
+	void
+	)
+{
+bus_driver_enable( false );
+} /* rs485_tx_complete_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_rx_event_ISR                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Receive event interrupt, call from HAL_UARTEx_RxEventCallback. Runs on *
+*       half, full and idle line events of the circular DMA and parses every   *
+*       byte received since the last event, so frames are handled one idle     *
+*       character after their delimiter at any baud rate                       *
+*                                                                              *
+*******************************************************************************/
+void rs485_rx_event_ISR
+	(
+	uint16_t rx_pos     /* Write position in the DMA ring */
+	)
+{
+bus_parse( rx_pos & RS485_RX_MASK );
+} /* rs485_rx_event_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_error_ISR                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       UART error interrupt, call from HAL_UART_ErrorCallback. An overrun,    *
+*       receive DMA or receiver timeout error stops the receive DMA, restart it*
+*       and drop the partial frame once it is running again. Noise, framing and*
+*       parity errors and transmit errors leave the receive DMA and the parser *
+*       alone, the frame CRC catches a damaged byte                            *
+*                                                                              *
+*******************************************************************************/
+void rs485_error_ISR
+	(
+	void
+	)
+{
+if ( !bus_active || ( RS485_HUART.ErrorCode == HAL_UART_ERROR_NONE ) )
+	{
+	return;
+	}
+rx_stats.uart_errors++;
+
+/* The HAL leaves the receiver ready once it has aborted the receive DMA */
+if ( ( RS485_HUART.RxState == HAL_UART_STATE_READY                  ) && 
+     ( HAL_UARTEx_ReceiveToIdle_DMA( &( RS485_HUART ), rx_buffer, 
+                                     RS485_RX_BUFFER_SIZE ) == HAL_OK ) )
+	{
+	rx_stats.rx_restarts++;
+	parse_pos = 0;
+	frame_decoder_init( &bus_decoder );
+	}
+
+/* A transmit error ends the transfer without a complete callback */
+if ( RS485_HUART.gState == HAL_UART_STATE_READY )
+	{
+	bus_driver_enable( false );
+	}
+} /* rs485_error_ISR */
+
+
+/*------------------------------------------------------------------------------
+ Internal procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		bus_transmit                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Encode a bus frame and start sending it, the driver is released by the *
+*       transmit complete interrupt. Returns RS485_BUSY without touching the   *
+*       transmit buffer or the driver while the previous frame is being sent   *
+*                                                                              *
+*******************************************************************************/
+static RS485_STATUS bus_transmit
+	(
+	uint8_t        dest    ,
+	uint8_t        sequence,
+	const uint8_t* data_ptr,
+	uint8_t        size
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+FRAME_HEADER header;  /* Bus frame header    */
+size_t       tx_size; /* Encoded frame size  */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* The UART still reads the buffer of the frame in flight */
+if ( RS485_HUART.gState != HAL_UART_STATE_READY )
+	{
+	return RS485_BUSY;
+	}
+
+header.opcode     = dest;
+header.subcommand = bus_config.address;
+header.sequence   = sequence;
+header.length     = size;
+if ( frame_encode( &header, data_ptr, &tx_buffer[0], sizeof( tx_buffer ), 
+                   &tx_size ) != FRAME_OK )
+	{
+	return RS485_ERROR;
+	}
+
+bus_driver_enable( true );
+if ( HAL_UART_Transmit_IT( &( RS485_HUART ), &tx_buffer[0], 
+                           (uint16_t) tx_size ) != HAL_OK )
+	{
+	bus_driver_enable( false );
+	return RS485_ERROR;
+	}
+return RS485_OK;
+} /* bus_transmit */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		bus_frame_received                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Handle a decoded bus frame. The master matches replies to the open     *
+*       slot and records the latency. Nodes answer polls addressed to them     *
+*       from the slot timer once the turnaround guard time has passed, so the  *
+*       receive interrupt never waits on the bus                               *
+*                                                                              *
+*******************************************************************************/
+static void bus_frame_received
+	(
+	const FRAME* frame_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t           dest;       /* Destination address         */
+uint8_t           source;     /* Source address              */
+RS485_NODE_STATS* stats_ptr;  /* Statistics of the open slot */
+uint32_t          latency_us; /* Poll to reply time          */
+RS485_BUS_MSG*    msg_ptr;    /* Queue entry                 */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+dest   = frame_ptr->header.opcode;
+source = frame_ptr->header.subcommand;
+if ( ( dest != bus_config.address ) && ( dest != RS485_ADDR_BROADCAST ) )
+	{
+	return;
+	}
+if ( frame_ptr->header.length > RS485_MAX_PAYLOAD )
+	{
+	return;
+	}
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Master, accept only the reply to the open slot */
+if ( bus_config.role == RS485_ROLE_MASTER )
+	{
+	if ( !reply_pending                                      || 
+	     ( source != bus_config.schedule[slot_index]       ) || 
+	     ( frame_ptr->header.sequence != poll_sequence     ) )
+		{
+		return;
+		}
+	reply_pending = false;
+	latency_us    = ( DWT->CYCCNT - poll_cycles )/( SystemCoreClock/1000000 );
+	stats_ptr     = &( node_stats[slot_index] );
+	stats_ptr->replies++;
+	stats_ptr->total_latency_us += latency_us;
+	if ( latency_us < stats_ptr->min_latency_us )
+		{
+		stats_ptr->min_latency_us = latency_us;
+		}
+	if ( latency_us > stats_ptr->max_latency_us )
+		{
+		stats_ptr->max_latency_us = latency_us;
+		}
+	}
+else if ( source != RS485_ADDR_MASTER )
+	{
+	/* Nodes only listen to the master */
+	return;
+	}
+
+/* Queue payloads for the application, dropping the new message if full */
+if      ( frame_ptr->header.length == 0                            )
+	{
+	/* Nothing to deliver */
+	}
+else if ( (uint8_t) ( rx_head - rx_tail ) >= RS485_RX_QUEUE_DEPTH )
+	{
+	rx_stats.queue_drops++;
+	}
+else
+	{
+	msg_ptr           = &( rx_queue[rx_head & RS485_RX_QUEUE_MASK] );
+	msg_ptr->source   = source;
+	msg_ptr->dest     = dest;
+	msg_ptr->sequence = frame_ptr->header.sequence;
+	msg_ptr->length   = (uint8_t) frame_ptr->header.length;
+	memcpy( &( msg_ptr->payload[0] ), frame_ptr->payload, msg_ptr->length );
+	__DMB();
+	rx_head++;
+	}
+
+/* Node, reply to a poll addressed to it. Broadcasts are not answered */
+if ( ( bus_config.role == RS485_ROLE_NODE ) && ( dest == bus_config.address ) )
+	{
+	/* Let the master release the bus, a newer poll replaces one whose 
+	   turnaround has not ended */
+	reply_sequence = frame_ptr->header.sequence;
+	reply_due      = true;
+	__HAL_TIM_SET_COUNTER( &( RS485_SLOT_TIM ), 0 );
+	__HAL_TIM_CLEAR_FLAG( &( RS485_SLOT_TIM ), TIM_FLAG_UPDATE );
+	HAL_TIM_Base_Start_IT( &( RS485_SLOT_TIM ) );
+	}
+} /* bus_frame_received */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		bus_slot                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Schedule slot of a node address, RS485_NO_SLOT if not scheduled        *
+*                                                                              *
+*******************************************************************************/
+static uint8_t bus_slot
+	(
+	uint8_t address
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t i; /* Slot index */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+for ( i = 0; i < bus_config.num_slots; ++i )
+	{
+	if ( bus_config.schedule[i] == address )
+		{
+		return i;
+		}
+	}
+return RS485_NO_SLOT;
+} /* bus_slot */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		bus_parse                                                              *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Parse the receive ring from the last parsed byte up to the DMA write   *
+*       position, handling every complete frame. A corrupt frame received while*
+*       a reply is due is charged to the polled node                           *
+*                                                                              *
+*******************************************************************************/
+static void bus_parse
+	(
+	uint16_t rx_pos
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint16_t     pos;          /* Ring read position */
+FRAME        frame;        /* Decoded frame      */
+FRAME_STATUS frame_status; /* Decoder result     */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+pos = parse_pos;
+if ( pos == rx_pos )
+	{
+	return;
+	}
+#if defined( __DCACHE_PRESENT ) && ( __DCACHE_PRESENT == 1U )
+	SCB_InvalidateDCache_by_Addr( rx_buffer, RS485_RX_BUFFER_SIZE );
+#endif
+while ( pos != rx_pos )
+	{
+	frame_status = frame_decode_byte( &bus_decoder, rx_buffer[pos], &frame );
+	pos          = ( pos + 1 ) & RS485_RX_MASK;
+	rx_stats.bytes++;
+	if      ( frame_status == FRAME_OK         )
+		{
+		rx_stats.frames++;
+		bus_frame_received( &frame );
+		}
+	else if ( frame_status != FRAME_INCOMPLETE )
+		{
+		rx_stats.frame_errors++;
+		if ( reply_pending )
+			{
+			node_stats[slot_index].frame_errors++;
+			}
+		}
+	}
+parse_pos = pos;
+} /* bus_parse */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		bus_driver_enable                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Drive or release the bus. Boards without a DE pin define use the UART  *
+*       hardware driver enable                                                 *
+*                                                                              *
+*******************************************************************************/
+static void bus_driver_enable
+	(
+	bool enable
+	)
+{
+#ifdef RS485_DE_PIN
+	HAL_GPIO_WritePin( RS485_DE_GPIO_PORT, RS485_DE_PIN, 
+	                   enable ? GPIO_PIN_SET : GPIO_PIN_RESET );
+#else
+	(void) enable;
+#endif
+} /* bus_driver_enable */
+#endif /* #ifdef RS485_SLOT_TIM */
+
+
 /*******************************************************************************
 * END OF FILE                                                                  *
 *******************************************************************************/
\ No newline at end of file
@@ -4,7 +4,13 @@
 * 		rs485.h
 *
 * DESCRIPTION: 
-* 		Contains API functions to transmit data over RS485 
+* 		Contains API functions to transmit data over RS485. The UART is used 
+*       either point to point, by the blocking transmit and receive calls and 
+*       the transport_rs485 link built on them, or by the multi-drop bus 
+*       layer. The two are exclusive: once rs485_bus_init has started the bus,
+*       the blocking calls return RS485_BUSY and bus traffic is read with 
+*       rs485_bus_receive. The bus layer is only built on boards that define
+*       RS485_SLOT_TIM
 *
 *******************************************************************************/
 
@@ -18,6 +24,14 @@ extern "C" {
 #endif
 
 
+/*------------------------------------------------------------------------------
+ Includes 
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "frame.h"
+
+
 /*------------------------------------------------------------------------------
  Typdefs 
 ------------------------------------------------------------------------------*/
@@ -27,9 +41,20 @@ typedef enum RS485_STATUS
 	{
 	RS485_OK = 0,
     RS485_ERROR,
-	RS485_TIMEOUT	
+	RS485_TIMEOUT,
+	RS485_INVALID_ADDR,     /* Address not in the bus schedule      */
+	RS485_PAYLOAD_TOO_LONG, /* Payload over RS485_MAX_PAYLOAD bytes */
+	RS485_BUSY              /* Previous frame still being sent, or 
+	                           the bus layer owns the UART          */
 	} RS485_STATUS;
 
+/* Bus role */
+typedef enum _RS485_ROLE
+	{
+	RS485_ROLE_MASTER = 0, /* Runs the polling schedule       */
+	RS485_ROLE_NODE        /* Replies when polled             */
+	} RS485_ROLE;
+
 
 /*------------------------------------------------------------------------------
  Macros 
@@ -45,6 +70,88 @@ typedef enum RS485_STATUS
 #endif /* SDR_DEBUG */
 
 
+/* Bus addresses. The master is always RS485_ADDR_MASTER, nodes use 1 to 
+   RS485_ADDR_BROADCAST - 1 */
+#define RS485_ADDR_MASTER              ( 0x00 )
+#define RS485_ADDR_ENGINE_CONTROLLER   ( 0x01 )
+#define RS485_ADDR_VALVE_CONTROLLER    ( 0x02 )
+#define RS485_ADDR_BROADCAST           ( 0xFF )
+
+/* Maximum number of slots in the polling schedule */
+#define RS485_MAX_SLOTS                ( 8    )
+
+/* Maximum application payload of a bus frame */
+#define RS485_MAX_PAYLOAD              ( 64   )
+
+/* Guard time before a node drives the bus after a poll, lets the master 
+   finish its stop bit and release the driver. Timed by RS485_SLOT_TIM */
+#define RS485_TURNAROUND_US            ( 20   )
+
+/* Circular DMA receive ring, power of two. The ring is parsed on every half, 
+   full and idle line event, so it must hold at least twice the bytes that 
+   arrive within the worst case interrupt latency */
+#define RS485_RX_BUFFER_SIZE           ( 256  )
+
+/* Received message queue depth, power of two */
+#define RS485_RX_QUEUE_DEPTH           ( 16   )
+
+
+/*------------------------------------------------------------------------------
+ Typdefs 
+------------------------------------------------------------------------------*/
+
+/* Bus configuration. The master polls schedule[0] to schedule[num_slots-1] 
+   in order, one slot per call to rs485_bus_slot_ISR, so the period of the 
+   slot timer, RS485_SLOT_TIM, sets the slot length and the update rate of 
+   every node. A node runs RS485_SLOT_TIM as a one shot turnaround timer 
+   instead, so on a node it must count at 1 MHz */
+typedef struct _RS485_BUS_CONFIG
+	{
+	RS485_ROLE role;
+	uint8_t    address;                   /* Own bus address            */
+	uint8_t    num_slots;                 /* Master only                */
+	uint8_t    schedule[RS485_MAX_SLOTS]; /* Master only, node addresses*/
+	} RS485_BUS_CONFIG;
+
+/* Per-node bus statistics, kept by the master */
+typedef struct _RS485_NODE_STATS
+	{
+	uint32_t polls;            /* Polls sent                          */
+	uint32_t replies;          /* Valid replies received in the slot  */
+	uint32_t timeouts;         /* Slots that ended without a reply    */
+	uint32_t skipped;          /* Slots not polled, the previous frame
+	                              was still being sent                */
+	uint32_t frame_errors;     /* Corrupt frames received in the slot */
+	uint32_t min_latency_us;   /* Poll start to reply decoded         */
+	uint32_t max_latency_us;
+	uint64_t total_latency_us;
+	} RS485_NODE_STATS;
+
+/* Received bus message */
+typedef struct _RS485_BUS_MSG
+	{
+	uint8_t  source;                     /* Sender address        */
+	uint8_t  dest;                       /* Own or broadcast      */
+	uint8_t  sequence;                   /* Poll sequence number  */
+	uint8_t  length;                     /* Payload length        */
+	uint8_t  payload[RS485_MAX_PAYLOAD];
+	} RS485_BUS_MSG;
+
+/* Receive engine statistics */
+typedef struct _RS485_RX_STATS
+	{
+	uint32_t bytes;        /* Bytes parsed                              */
+	uint32_t frames;       /* Valid frames decoded                      */
+	uint32_t frame_errors; /* Corrupt or oversized frames               */
+	uint32_t queue_drops;  /* Messages dropped on a full queue          */
+	uint32_t uart_errors;  /* UART errors                               */
+	uint32_t rx_restarts;  /* Receive DMA restarts after an error that 
+	                          stopped it                                */
+	uint32_t tx_skipped;   /* Node replies not sent, the previous frame 
+	                          was still being sent                      */
+	} RS485_RX_STATS;
+
+
 /*------------------------------------------------------------------------------
  Function Prototypes 
 ------------------------------------------------------------------------------*/
@@ -86,6 +193,77 @@ RS485_STATUS rs485_receive_IT
 	size_t   rx_buffer_size   /* Number of bytes to recevie    */
 	);
 
+/* Start the multi-drop bus layer */
+RS485_STATUS rs485_bus_init
+	(
+	const RS485_BUS_CONFIG* config_ptr
+	);
+
+/* Master, set the payload sent with the next poll of a node */
+RS485_STATUS rs485_bus_set_poll_data
+	(
+	uint8_t     address ,   /* Node to send to  */
+	const void* data_ptr,   /* Payload          */
+	uint8_t     size        /* Payload size     */
+	);
+
+/* Node, set the payload sent in reply to polls */
+RS485_STATUS rs485_bus_set_reply_data
+	(
+	const void* data_ptr,   /* Payload          */
+	uint8_t     size        /* Payload size     */
+	);
+
+/* True once the bus layer owns the UART */
+bool rs485_bus_active
+	(
+	void
+	);
+
+/* Get the oldest received message with a payload, false if none queued */
+bool rs485_bus_receive
+	(
+	RS485_BUS_MSG* msg_ptr
+	);
+
+/* Master, get the bus statistics of a node */
+RS485_STATUS rs485_bus_get_node_stats
+	(
+	uint8_t           address  ,
+	RS485_NODE_STATS* stats_ptr
+	);
+
+/* Slot timer interrupt, call from HAL_TIM_PeriodElapsedCallback for 
+   RS485_SLOT_TIM */
+void rs485_bus_slot_ISR
+	(
+	void
+	);
+
+/* Transmit complete interrupt, call from HAL_UART_TxCpltCallback */
+void rs485_tx_complete_ISR
+	(
+	void
+	);
+
+/* Get the receive engine statistics */
+void rs485_bus_get_rx_stats
+	(
+	RS485_RX_STATS* stats_ptr
+	);
+
+/* Receive event interrupt, call from HAL_UARTEx_RxEventCallback */
+void rs485_rx_event_ISR
+	(
+	uint16_t rx_pos     /* Write position in the DMA ring */
+	);
+
+/* UART error interrupt, call from HAL_UART_ErrorCallback */
+void rs485_error_ISR
+	(
+	void
+	);
+
 
 #ifdef __cplusplus
 }
@@ -39,10 +39,12 @@
 #if defined( FLIGHT_COMPUTER )
 	#include "imu.h"
 	#include "baro.h"
+	#include "attitude.h"
 #elif defined( FLIGHT_COMPUTER_LITE )
 	#include "baro.h"
 #endif
 #include "usb.h"
+#include "transport.h"
 #include "sensor.h"
 #if defined( ENGINE_CONTROLLER )
 	#include "pressure.h"
@@ -61,6 +63,21 @@
 /* Hash table of sensor readout sizes and offsets */
 static SENSOR_DATA_SIZE_OFFSETS sensor_size_offsets_table[ NUM_SENSORS ];
 
+/* Sensor poll sessions, one for each link with a poll in progress */
+static SENSOR_POLL_SESSION sensor_sessions[ SENSOR_MAX_SESSIONS ];
+
+/* Status reported for a failure of each kind of link */
+static const SENSOR_STATUS sensor_link_errors[ TRANSPORT_NUM_LINKS ] = 
+	{
+	[ TRANSPORT_LINK_USB   ] = SENSOR_USB_FAIL        ,
+	[ TRANSPORT_LINK_UART  ] = SENSOR_VALVE_UART_ERROR,
+	[ TRANSPORT_LINK_RS485 ] = SENSOR_RS485_ERROR
+	};
+
+/* Sensor poll replies dropped because the transmit queue was full or the
+   link failed to send them, counted from the transmit callback too */
+static volatile uint32_t sensor_tx_drops = 0;
+
 
 /*------------------------------------------------------------------------------
  Internal function prototypes 
@@ -85,6 +102,26 @@ void static extract_sensor_bytes
 	uint8_t*     num_sensor_bytes
 	);
 
+/* Find the poll session of a link, or open one on a free slot */
+static SENSOR_POLL_SESSION* session_open
+	(
+	const TRANSPORT* transport_ptr
+	);
+
+/* Step a poll session on the bytes its link has received */
+static SENSOR_STATUS session_service
+	(
+	SENSOR_POLL_SESSION* session_ptr
+	);
+
+/* Release a poll reply buffer once the link has sent it */
+static void session_tx_done
+	(
+	const void*      tx_data_ptr ,
+	size_t           tx_data_size,
+	TRANSPORT_STATUS tx_status
+	);
+
 /* reads from all sensors using the MCUs ADCs */
 #ifdef L0002_REV5
 SENSOR_STATUS sensor_adc_burst_read
@@ -171,6 +208,13 @@ void sensor_init
 	sensor_size_offsets_table[ 9  ].offset = 18; /* SENSOR_IMUT  */
 	sensor_size_offsets_table[ 10 ].offset = 20; /* SENSOR_PRES  */
 	sensor_size_offsets_table[ 11 ].offset = 24; /* SENSOR_TEMP  */
+	sensor_size_offsets_table[ 12 ].offset = 28; /* SENSOR_ATTW  */
+	sensor_size_offsets_table[ 13 ].offset = 32; /* SENSOR_ATTX  */
+	sensor_size_offsets_table[ 14 ].offset = 36; /* SENSOR_ATTY  */
+	sensor_size_offsets_table[ 15 ].offset = 40; /* SENSOR_ATTZ  */
+	sensor_size_offsets_table[ 16 ].offset = 44; /* SENSOR_RATEX */
+	sensor_size_offsets_table[ 17 ].offset = 48; /* SENSOR_RATEY */
+	sensor_size_offsets_table[ 18 ].offset = 52; /* SENSOR_RATEZ */
 
 	/* Sensor Sizes   */
 	sensor_size_offsets_table[ 0  ].size   = 2;  /* SENSOR_ACCX  */
@@ -185,6 +229,13 @@ void sensor_init
 	sensor_size_offsets_table[ 9  ].size   = 2;  /* SENSOR_IMUT  */
 	sensor_size_offsets_table[ 10 ].size   = 4;  /* SENSOR_PRES  */
 	sensor_size_offsets_table[ 11 ].size   = 4;  /* SENSOR_TEMP  */
+	sensor_size_offsets_table[ 12 ].size   = 4;  /* SENSOR_ATTW  */
+	sensor_size_offsets_table[ 13 ].size   = 4;  /* SENSOR_ATTX  */
+	sensor_size_offsets_table[ 14 ].size   = 4;  /* SENSOR_ATTY  */
+	sensor_size_offsets_table[ 15 ].size   = 4;  /* SENSOR_ATTZ  */
+	sensor_size_offsets_table[ 16 ].size   = 4;  /* SENSOR_RATEX */
+	sensor_size_offsets_table[ 17 ].size   = 4;  /* SENSOR_RATEY */
+	sensor_size_offsets_table[ 18 ].size   = 4;  /* SENSOR_RATEZ */
 #elif defined( ENGINE_CONTROLLER )
 	/* Sensor offsets */
 	sensor_size_offsets_table[ 0  ].offset = 0;  /* SENSOR_PT0  */
@@ -241,50 +292,33 @@ void sensor_init
 *******************************************************************************/
 SENSOR_STATUS sensor_cmd_execute 
 	(
-	#ifndef VALVE_CONTROLLER
-		uint8_t subcommand 
-	#else
-		uint8_t    subcommand,   /* SDEC subcommand         */
-		CMD_SOURCE cmd_source    /* Serial interface source */
-	#endif
+	uint8_t          subcommand   , /* SDEC subcommand            */
+	const TRANSPORT* transport_ptr  /* Link the command came from */
     )
 {
 
 /*------------------------------------------------------------------------------
  Local Variables  
 ------------------------------------------------------------------------------*/
-SENSOR_STATUS sensor_status;                         /* Status indicating if 
-                                                       subcommand function 
-                                                       returned properly      */
-USB_STATUS    usb_status;                            /* USB return codes      */
-SENSOR_DATA   sensor_data;                           /* Struct with all sensor 
-                                                        data                  */
-uint8_t       sensor_data_bytes[ SENSOR_DATA_SIZE ]; /* Byte array with sensor 
-                                                       readouts               */
-uint8_t       num_sensor_bytes = SENSOR_DATA_SIZE;   /* Size of data in bytes */
-uint8_t       num_sensors;                           /* Number of sensors to 
-                                                        use for polling       */
-uint8_t       poll_sensors[ SENSOR_MAX_NUM_POLL ];   /* Codes for sensors to
-                                                        be polled             */
-uint8_t       sensor_poll_cmd;                       /* Command codes used by 
-                                                        sensor poll           */
-#ifdef VALVE_CONTROLLER
-	VALVE_STATUS valve_status; /* status codes from valve API */
-#endif
+SENSOR_STATUS        sensor_status;                         /* Status indicating 
+                                                               if subcommand 
+                                                               function returned
+                                                               properly       */
+SENSOR_DATA          sensor_data;                           /* Struct with all 
+                                                               sensor data    */
+uint8_t              sensor_data_bytes[ SENSOR_DATA_SIZE ]; /* Byte array with
+                                                               sensor readouts*/
+uint8_t              num_sensor_bytes = SENSOR_DATA_SIZE;   /* Size of data in 
+                                                               bytes          */
+SENSOR_POLL_SESSION* session_ptr;                           /* Poll session of
+                                                               the link       */
 
 /*------------------------------------------------------------------------------
  Initializations  
 ------------------------------------------------------------------------------*/
-usb_status      = USB_OK;
 sensor_status   = SENSOR_OK;
-#ifdef VALVE_CONTROLLER
-	valve_status = VALVE_OK;
-#endif
-num_sensors     = 0;
-sensor_poll_cmd = 0;
 memset( &sensor_data_bytes[0], 0, sizeof( sensor_data_bytes ) );
 memset( &sensor_data         , 0, sizeof( sensor_data       ) );
-memset( &poll_sensors[0]     , 0, sizeof( poll_sensors      ) );
 
 
 /*------------------------------------------------------------------------------
@@ -297,228 +331,15 @@ switch ( subcommand )
 	--------------------------------------------------------------------------*/
     case SENSOR_POLL_CODE:
 		{
-		/* Determine the number of sensors to poll */
-		#ifndef VALVE_CONTROLLER 
-			usb_status = usb_receive( &num_sensors, 
-									sizeof( num_sensors ), 
-									HAL_DEFAULT_TIMEOUT );
-			if ( usb_status != USB_OK )
-				{
-				return SENSOR_USB_FAIL;
-				}
-		#else
-			if ( cmd_source == CMD_SOURCE_USB )
-				{
-				usb_status = usb_receive( &num_sensors, 
-										sizeof( num_sensors ), 
-										HAL_DEFAULT_TIMEOUT );
-				if ( usb_status != USB_OK )
-					{
-					return SENSOR_USB_FAIL;
-					}
-				}
-			else
-				{
-				valve_status = valve_receive( &num_sensors, 
-				                              sizeof( num_sensors ), 
-											  HAL_DEFAULT_TIMEOUT );
-				if ( valve_status != VALVE_OK )
-					{
-					return SENSOR_VALVE_UART_ERROR;
-					}
-				}
-		#endif /* #ifdef VALVE_CONTROLLER */
-
-		/* Determine which sensors to poll */
-		#ifndef VALVE_CONTROLLER 
-			usb_status = usb_receive( &poll_sensors[0],
-									num_sensors     , 
-									HAL_SENSOR_TIMEOUT );
-			if ( usb_status != USB_OK )
-				{
-				return SENSOR_USB_FAIL;
-				}
-		#else
-			if ( cmd_source == CMD_SOURCE_USB )
-				{
-				usb_status = usb_receive( &poll_sensors[0],
-										num_sensors     , 
-										HAL_SENSOR_TIMEOUT );
-				if ( usb_status != USB_OK )
-					{
-					return SENSOR_USB_FAIL;
-					}
-				}
-			else
-				{
-				valve_status = valve_receive( &poll_sensors[0],
-											num_sensors     ,
-											HAL_SENSOR_TIMEOUT );
-				if ( valve_status != VALVE_OK )
-					{
-					return SENSOR_VALVE_UART_ERROR;
-					}
-				}
-		#endif /* #ifndef VALVE_CONTROLLER */
-
-		/* Receive initiating command code  */
-		#ifndef VALVE_CONTROLLER
-			usb_status = usb_receive( &sensor_poll_cmd,
-									sizeof( sensor_poll_cmd ),
-									HAL_DEFAULT_TIMEOUT );
-			if      ( usb_status      != USB_OK            )
-				{
-				return SENSOR_USB_FAIL; /* USB error */
-				}
-			else if ( sensor_poll_cmd != SENSOR_POLL_START )
-				{
-				/* SDEC fails to initiate sensor poll */
-				return SENSOR_POLL_FAIL_TO_START;
-				}
-		#else
-			if ( cmd_source == CMD_SOURCE_USB )
-				{
-				usb_status = usb_receive( &sensor_poll_cmd,
-										sizeof( sensor_poll_cmd ),
-										HAL_DEFAULT_TIMEOUT );
-				if      ( usb_status      != USB_OK            )
-					{
-					return SENSOR_USB_FAIL; /* USB error */
-					}
-				else if ( sensor_poll_cmd != SENSOR_POLL_START )
-					{
-					/* SDEC fails to initiate sensor poll */
-					return SENSOR_POLL_FAIL_TO_START;
-					}
-				}
-			else
-				{
-				valve_status = valve_receive( &sensor_poll_cmd, 
-											sizeof( sensor_poll_cmd ), 
-											HAL_DEFAULT_TIMEOUT );
-				if ( valve_status != VALVE_OK )
-					{
-					return SENSOR_VALVE_UART_ERROR;
-					}
-				else if ( sensor_poll_cmd != SENSOR_POLL_START )
-					{
-					return SENSOR_POLL_FAIL_TO_START;
-					}
-				}
-		#endif
-
-		/* Start polling sensors */
-		while ( sensor_poll_cmd != SENSOR_POLL_STOP )
+		/* Open a poll session on the link and take what it has received so
+		   far. The session does not hold the caller, sensor_poll_service 
+		   steps it from the main loop until SENSOR_POLL_STOP */
+		session_ptr = session_open( transport_ptr );
+		if ( session_ptr == NULL )
 			{
-			/* Get command code */
-			#ifndef VALVE_CONTROLLER 
-				usb_status = usb_receive( &sensor_poll_cmd         ,
-										sizeof( sensor_poll_cmd ),
-										HAL_DEFAULT_TIMEOUT );
-				if ( usb_status != USB_OK ) 
-					{
-					return SENSOR_USB_FAIL;
-					}
-			#else
-				if ( cmd_source == CMD_SOURCE_USB )
-					{
-					usb_status = usb_receive( &sensor_poll_cmd         ,
-											sizeof( sensor_poll_cmd ),
-											HAL_DEFAULT_TIMEOUT );
-					if ( usb_status != USB_OK ) 
-						{
-						return SENSOR_USB_FAIL;
-						}
-					}
-				else
-					{
-					valve_status = valve_receive( &sensor_poll_cmd         , 
-					                              sizeof( sensor_poll_cmd ), 
-												  HAL_DEFAULT_TIMEOUT );
-					if ( valve_status != VALVE_OK )
-						{
-						return SENSOR_VALVE_UART_ERROR;
-						}
-					}
-			#endif /* #ifndef VALVE_CONTROLLER */
-			
-			/* Execute command */
-			switch ( sensor_poll_cmd )
-				{
-
-				/* Poll Sensors */
-				case SENSOR_POLL_REQUEST:
-					{
-					sensor_status = sensor_poll( &sensor_data    , 
-												 &poll_sensors[0],
-												 num_sensors );
-					if ( sensor_status != SENSOR_OK )
-						{
-						return SENSOR_POLL_FAIL;
-						}
-					else
-						{
-						/* Copy over sensor data into buffer */
-						extract_sensor_bytes( &sensor_data, 
-						                      &poll_sensors[0],
-											  num_sensors     ,
-											  &sensor_data_bytes[0],
-											  &num_sensor_bytes );
-
-						/* Transmit sensor bytes back to SDEC */
-						usb_transmit( &sensor_data_bytes[0],
-						              num_sensor_bytes     ,
-									  HAL_SENSOR_TIMEOUT );
-								
-						break;
-						}
-					} /* case SENSOR_POLL_REQUEST */
-
-				/* STOP Executtion */
-				case SENSOR_POLL_STOP:
-					{
-					/* Do nothing */
-					break;
-					} /* case SENSOR_POLL_STOP */
-
-				/* WAIT, Pause execution */
-				case SENSOR_POLL_WAIT:
-					{
-					/* Poll USB port until resume signal arrives */
-					while( sensor_poll_cmd != SENSOR_POLL_RESUME )
-						{
-						#ifndef VALVE_CONTROLLER
-							usb_receive( &sensor_poll_cmd, 
-										sizeof( sensor_poll_cmd ),
-										HAL_DEFAULT_TIMEOUT );
-						#else
-							if ( cmd_source == CMD_SOURCE_USB )
-								{
-								usb_receive( &sensor_poll_cmd, 
-											sizeof( sensor_poll_cmd ),
-											HAL_DEFAULT_TIMEOUT );
-								}
-							else
-								{
-								valve_receive( &sensor_poll_cmd         , 
-								               sizeof( sensor_poll_cmd ), 
-											   HAL_DEFAULT_TIMEOUT );
-								}
-						#endif
-						}
-					break;
-					} /* case SENSOR_POLL_WAIT */
-
-				/* Erroneous Command*/
-				default:
-					{
-					return SENSOR_POLL_UNRECOGNIZED_CMD;
-					}
-				} /* switch( sensor_poll_cmd ) */
-
-			} /* while( sensor_poll_cmd != SENSOR_POLL_STOP ) */
-		
-		return sensor_status ;
+			return SENSOR_POLL_FAIL;
+			}
+		return session_service( session_ptr );
         } /* SENSOR_POLL_CODE */ 
 
 	/*--------------------------------------------------------------------------
@@ -527,24 +348,10 @@ switch ( subcommand )
 	case SENSOR_DUMP_CODE: 
 		{
 		/* Tell the PC how many bytes to expect */
-		#ifndef VALVE_CONTROLLER 
-			usb_transmit( &num_sensor_bytes,
-						sizeof( num_sensor_bytes ), 
-						HAL_DEFAULT_TIMEOUT );
-		#else
-			if ( cmd_source == CMD_SOURCE_USB )
-				{
-				usb_transmit( &num_sensor_bytes,
-							sizeof( num_sensor_bytes ), 
-							HAL_DEFAULT_TIMEOUT );
-				}
-			else
-				{
-				valve_transmit( &num_sensor_bytes, 
-				                sizeof( num_sensor_bytes ), 
-								HAL_DEFAULT_TIMEOUT );
-				}
-		#endif /* #ifndef VALVE_CONTROLLER */
+		transport_transmit( transport_ptr             , 
+		                    &num_sensor_bytes         , 
+		                    sizeof( num_sensor_bytes ), 
+		                    HAL_DEFAULT_TIMEOUT );
 
 		/* Get the sensor readings */
 	    sensor_status = sensor_dump( &sensor_data );	
@@ -555,24 +362,10 @@ switch ( subcommand )
 		/* Transmit sensor readings to PC */
 		if ( sensor_status == SENSOR_OK )
 			{
-			#ifndef VALVE_CONTROLLER
-				usb_transmit( &sensor_data_bytes[0]      , 
-							sizeof( sensor_data_bytes ), 
-							HAL_SENSOR_TIMEOUT );
-			#else
-				if ( cmd_source == CMD_SOURCE_USB )
-					{
-					usb_transmit( &sensor_data_bytes[0]      , 
-								sizeof( sensor_data_bytes ), 
-								HAL_SENSOR_TIMEOUT );
-					}
-				else
-					{
-					valve_transmit( &sensor_data_bytes[0],
-					                sizeof( sensor_data_bytes ), 
-									HAL_SENSOR_TIMEOUT );
-					}
-			#endif /* #ifndef VALVE_CONTROLLER */
+			transport_transmit( transport_ptr              , 
+			                    &sensor_data_bytes[0]      , 
+			                    sizeof( sensor_data_bytes ), 
+			                    HAL_SENSOR_TIMEOUT );
 			return ( sensor_status );
             }
 		else
@@ -594,6 +387,101 @@ switch ( subcommand )
 } /* sensor_cmd_execute */
 
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		sensor_get_tx_drops                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Number of sensor poll replies dropped because the transmit queue of    *
+*       the link was full or the link failed to send them                      *
+*                                                                              *
+*******************************************************************************/
+uint32_t sensor_get_tx_drops
+	(
+	void
+	)
+{
+return sensor_tx_drops;
+} /* sensor_get_tx_drops */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		sensor_poll_service                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Steps every open sensor poll session on the bytes its link has         *
+*       received, without waiting. Called from the main loop, returns the last *
+*       session error                                                          *
+*                                                                              *
+*******************************************************************************/
+SENSOR_STATUS sensor_poll_service
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables  
+------------------------------------------------------------------------------*/
+SENSOR_STATUS sensor_status;  /* Last session error        */
+SENSOR_STATUS session_status; /* Status of current session */
+
+
+/*------------------------------------------------------------------------------
+ Initializations  
+------------------------------------------------------------------------------*/
+sensor_status = SENSOR_OK;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+for ( uint8_t i = 0; i < SENSOR_MAX_SESSIONS; ++i )
+	{
+	if ( sensor_sessions[i].state != SENSOR_SESSION_CLOSED )
+		{
+		session_status = session_service( &sensor_sessions[i] );
+		if ( session_status != SENSOR_OK )
+			{
+			sensor_status = session_status;
+			}
+		}
+	}
+
+return sensor_status;
+} /* sensor_poll_service */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		sensor_poll_active                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Checks for an open sensor poll session on a link. The bytes the link   *
+*       receives belong to the session until it stops, not to the command      *
+*       loop                                                                   *
+*                                                                              *
+*******************************************************************************/
+bool sensor_poll_active
+	(
+	const TRANSPORT* transport_ptr /* Link to check */
+	)
+{
+for ( uint8_t i = 0; i < SENSOR_MAX_SESSIONS; ++i )
+	{
+	if ( ( sensor_sessions[i].state         != SENSOR_SESSION_CLOSED ) &&
+	     ( sensor_sessions[i].transport_ptr == transport_ptr         ) )
+		{
+		return true;
+		}
+	}
+return false;
+} /* sensor_poll_active */
+
+
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
@@ -616,8 +504,7 @@ SENSOR_STATUS sensor_dump
 	IMU_STATUS      accel_status;           /* IMU sensor status codes     */       
 	IMU_STATUS      gyro_status;
 	IMU_STATUS      mag_status; 
-	BARO_STATUS     press_status;           /* Baro Sensor status codes    */
-	BARO_STATUS     temp_status;
+	BARO_STATUS     baro_status;            /* Baro Sensor status codes    */
 #elif defined( ENGINE_CONTROLLER    )
 	#ifdef L0002_REV4
 		PRESSURE_STATUS pt_status;          /* Pressure status codes       */
@@ -628,8 +515,7 @@ SENSOR_STATUS sensor_dump
 		THERMO_STATUS   tc_status;          /* Thermocouple status codes   */
 	#endif
 #elif defined( FLIGHT_COMPUTER_LITE )
-	BARO_STATUS     press_status;           /* Baro Sensor status codes    */
-	BARO_STATUS     temp_status;
+	BARO_STATUS     baro_status;            /* Baro Sensor status codes    */
 #endif
 
 /*------------------------------------------------------------------------------
@@ -639,8 +525,7 @@ SENSOR_STATUS sensor_dump
 	accel_status = IMU_OK;         
 	gyro_status  = IMU_OK;
 	mag_status   = IMU_OK; 
-	press_status = BARO_OK;           
-	temp_status  = BARO_OK;
+	baro_status  = BARO_OK;           
 #elif defined( ENGINE_CONTROLLER    )
 	#ifdef L0002_REV4
 		pt_status    = PRESSURE_OK;          
@@ -650,8 +535,7 @@ SENSOR_STATUS sensor_dump
 		tc_status     = THERMO_OK;
 	#endif
 #elif defined( FLIGHT_COMPUTER_LITE )
-	press_status = BARO_OK;           
-	temp_status  = BARO_OK;
+	baro_status  = BARO_OK;           
 #endif
 
 /*------------------------------------------------------------------------------
@@ -669,8 +553,16 @@ SENSOR_STATUS sensor_dump
 											  // as struct padding
 
 	/* Baro sensors */
-	temp_status  = baro_get_temp    ( &(sensor_data_ptr -> baro_temp     ) );
-	press_status = baro_get_pressure( &(sensor_data_ptr -> baro_pressure ) );
+	#ifdef USE_SENSOR_IT
+	baro_status  = baro_get_sample    ( &(sensor_data_ptr -> baro_pressure ),
+	                                    &(sensor_data_ptr -> baro_temp     ) );
+	#else
+	baro_status  = baro_get_press_temp( &(sensor_data_ptr -> baro_pressure ),
+	                                    &(sensor_data_ptr -> baro_temp     ) );
+	#endif
+
+	/* Attitude estimate */
+	attitude_get_state( &( sensor_data_ptr -> attitude ) );
 
 #elif defined( ENGINE_CONTROLLER )
 	#ifndef L0002_REV5
@@ -689,8 +581,13 @@ SENSOR_STATUS sensor_dump
 	//                              THERMO_HOT_JUNCTION );
 #elif defined( FLIGHT_COMPUTER_LITE )
 	/* Baro sensors */
-	temp_status  = baro_get_temp    ( &(sensor_data_ptr -> baro_temp     ) );
-	press_status = baro_get_pressure( &(sensor_data_ptr -> baro_pressure ) );
+	#ifdef USE_SENSOR_IT
+	baro_status  = baro_get_sample    ( &(sensor_data_ptr -> baro_pressure ),
+	                                    &(sensor_data_ptr -> baro_temp     ) );
+	#else
+	baro_status  = baro_get_press_temp( &(sensor_data_ptr -> baro_pressure ),
+	                                    &(sensor_data_ptr -> baro_temp     ) );
+	#endif
 
 #elif defined( VALVE_CONTROLLER     )
 	/* Main Valve encoders */
@@ -715,8 +612,7 @@ SENSOR_STATUS sensor_dump
 		{
 		return SENSOR_MAG_ERROR;	
 		}
-	else if ( press_status != BARO_OK ||
-			temp_status  != BARO_OK  )
+	else if ( baro_status  != BARO_OK )
 		{
 		return SENSOR_BARO_ERROR;
 		}
@@ -757,8 +653,7 @@ SENSOR_STATUS sensor_dump
 			}
 	#endif
 #elif defined( FLIGHT_COMPUTER_LITE )
-	if ( press_status != BARO_OK ||
-		 temp_status  != BARO_OK  )
+	if ( baro_status != BARO_OK )
 		{
 		return SENSOR_BARO_ERROR;
 		}
@@ -815,6 +710,10 @@ SENSOR_ID* sensor_id_ptr;    /* Pointer to sensor id                */
 	bool imu_accel_read;
 	bool imu_gyro_read;
 	bool imu_mag_read;
+	bool attitude_read;
+#endif
+#if ( defined( FLIGHT_COMPUTER )  || defined( FLIGHT_COMPUTER_LITE ) )
+	bool baro_read;
 #endif
 
 /*------------------------------------------------------------------------------
@@ -843,6 +742,10 @@ sensor_id         = *(sensor_id_ptr   );
 	imu_accel_read = false;
 	imu_gyro_read  = false;
 	imu_mag_read   = false;
+	attitude_read  = false;
+#endif
+#if ( defined( FLIGHT_COMPUTER )  || defined( FLIGHT_COMPUTER_LITE ) )
+	baro_read      = false;
 #endif
 
 /* Burst read ADC sensors on Engine controller Rev 5 */
@@ -852,8 +755,12 @@ sensor_id         = *(sensor_id_ptr   );
 		{
 		return sensor_status;
 		}
+	#ifdef USE_SENSOR_IT
+	thermo_status = temp_get_sample( &( sensor_data_ptr -> tc_temp ) );
+	#else
 	thermo_status = temp_get_temp( &( sensor_data_ptr -> tc_temp ),
 				                   THERMO_HOT_JUNCTION );
+	#endif
 	if ( thermo_status != THERMO_OK )
 		{
 		return SENSOR_TC_ERROR;
@@ -1005,30 +912,61 @@ for ( int i = 0; i < num_sensors; ++i )
 				sensor_data_ptr -> imu_data.temp = 0;
 				break;
 				}
+
+			case SENSOR_ATTW:
+			case SENSOR_ATTX:
+			case SENSOR_ATTY:
+			case SENSOR_ATTZ:
+			case SENSOR_RATEX:
+			case SENSOR_RATEY:
+			case SENSOR_RATEZ:
+				{
+				if ( !attitude_read )
+					{
+					attitude_get_state( &( sensor_data_ptr -> attitude ) );
+					attitude_read = true;
+					}
+				break;
+				}
 		#endif /* #if defined( FLIGHT_COMPUTER ) */
 
 		#if ( defined( FLIGHT_COMPUTER )  || defined( FLIGHT_COMPUTER_LITE ) )
 			case SENSOR_PRES:
 				{
-				baro_status = baro_get_temp(     &( sensor_data_ptr -> baro_temp     ) );
-				if ( baro_status != BARO_OK )
+				if ( !baro_read )
 					{
-					return SENSOR_BARO_ERROR;
-					}
-				baro_status = baro_get_pressure( &( sensor_data_ptr -> baro_pressure ) );
-				if ( baro_status != BARO_OK )
-					{
-					return SENSOR_BARO_ERROR;
+					#ifdef USE_SENSOR_IT
+					baro_status = baro_get_sample    ( &( sensor_data_ptr -> baro_pressure ),
+					                                   &( sensor_data_ptr -> baro_temp     ) );
+					#else
+					baro_status = baro_get_press_temp( &( sensor_data_ptr -> baro_pressure ),
+					                                   &( sensor_data_ptr -> baro_temp     ) );
+					#endif
+					if ( baro_status != BARO_OK )
+						{
+						return SENSOR_BARO_ERROR;
+						}
+					baro_read = true;
 					}
 				break;
 				}
 
 			case SENSOR_TEMP:
 				{
-				baro_status = baro_get_temp( &( sensor_data_ptr -> baro_temp ) );
-				if ( baro_status != BARO_OK )
+				if ( !baro_read )
 					{
-					return SENSOR_BARO_ERROR;
+					#ifdef USE_SENSOR_IT
+					baro_status = baro_get_sample    ( &( sensor_data_ptr -> baro_pressure ),
+					                                   &( sensor_data_ptr -> baro_temp     ) );
+					#else
+					baro_status = baro_get_press_temp( &( sensor_data_ptr -> baro_pressure ),
+					                                   &( sensor_data_ptr -> baro_temp     ) );
+					#endif
+					if ( baro_status != BARO_OK )
+						{
+						return SENSOR_BARO_ERROR;
+						}
+					baro_read = true;
 					}
 				break;
 				}
@@ -1125,8 +1063,12 @@ for ( int i = 0; i < num_sensors; ++i )
 
 			case SENSOR_TC:
 				{
+				#ifdef USE_SENSOR_IT
+				thermo_status = temp_get_sample( &( sensor_data_ptr -> tc_temp ) );
+				#else
 				thermo_status = temp_get_temp( &( sensor_data_ptr -> tc_temp ),
 				                               THERMO_HOT_JUNCTION );
+				#endif
 				if ( thermo_status != THERMO_OK )
 					{
 					return SENSOR_TC_ERROR;
@@ -1323,6 +1265,309 @@ for ( uint8_t i = 0; i < num_sensors; ++i )
 
 } /* extract_sensor_bytes */
 
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		session_open                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Finds the poll session of a link, or opens one on a free slot. A new   *
+*       poll on a link restarts its session. The transmit buffers keep their   *
+*       state, a reply still queued from the last poll is released by its      *
+*       callback                                                               *
+*                                                                              *
+*******************************************************************************/
+static SENSOR_POLL_SESSION* session_open
+	(
+	const TRANSPORT* transport_ptr /* Link the poll command came from */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables  
+------------------------------------------------------------------------------*/
+SENSOR_POLL_SESSION* session_ptr; /* Session of the link */
+
+
+/*------------------------------------------------------------------------------
+ Initializations  
+------------------------------------------------------------------------------*/
+session_ptr = NULL;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Reuse the slot the link had last, otherwise take the first free one */
+for ( uint8_t i = 0; i < SENSOR_MAX_SESSIONS; ++i )
+	{
+	if      ( sensor_sessions[i].transport_ptr == transport_ptr )
+		{
+		session_ptr = &sensor_sessions[i];
+		break;
+		}
+	else if ( ( session_ptr             == NULL                  ) &&
+	          ( sensor_sessions[i].state == SENSOR_SESSION_CLOSED ) )
+		{
+		session_ptr = &sensor_sessions[i];
+		}
+	}
+if ( session_ptr == NULL )
+	{
+	return NULL;
+	}
+
+session_ptr->transport_ptr = transport_ptr;
+session_ptr->state         = SENSOR_SESSION_COUNT;
+session_ptr->num_sensors   = 0;
+session_ptr->num_ids       = 0;
+session_ptr->cmd_pending   = false;
+return session_ptr;
+} /* session_open */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		session_service                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Steps a poll session on the bytes its link has received and returns    *
+*       once the link has no more. A poll request that finds both transmit     *
+*       buffers queued is held until one is released. A link error, a stop or  *
+*       a bad command closes the session                                       *
+*                                                                              *
+*******************************************************************************/
+static SENSOR_STATUS session_service
+	(
+	SENSOR_POLL_SESSION* session_ptr /* Session to step */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables  
+------------------------------------------------------------------------------*/
+const TRANSPORT* transport_ptr;    /* Link of the session                    */
+SENSOR_STATUS    link_error;       /* Status returned for a link error       */
+SENSOR_DATA      sensor_data;      /* Struct with all sensor data            */
+uint8_t          num_sensor_bytes; /* Size of poll reply in bytes            */
+uint8_t*         tx_bytes_ptr;     /* Transmit buffer of the poll reply      */
+size_t           rx_count;         /* Bytes taken from the link              */
+
+
+/*------------------------------------------------------------------------------
+ Initializations  
+------------------------------------------------------------------------------*/
+transport_ptr    = session_ptr->transport_ptr;
+link_error       = sensor_link_errors[ transport_ptr->link ];
+num_sensor_bytes = 0;
+rx_count         = 0;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+while ( session_ptr->state != SENSOR_SESSION_CLOSED )
+	{
+	/* Sensor IDs are taken as a block */
+	if ( session_ptr->state == SENSOR_SESSION_IDS )
+		{
+		if ( session_ptr->num_ids == session_ptr->num_sensors )
+			{
+			session_ptr->state = SENSOR_SESSION_START;
+			continue;
+			}
+		if ( transport_receive_async( transport_ptr                                   ,
+		                              &session_ptr->poll_sensors[ session_ptr->num_ids ],
+		                              session_ptr->num_sensors - session_ptr->num_ids ,
+		                              &rx_count ) != TRANSPORT_OK )
+			{
+			session_ptr->state = SENSOR_SESSION_CLOSED;
+			return link_error;
+			}
+		if ( rx_count == 0 )
+			{
+			return SENSOR_OK;
+			}
+		session_ptr->num_ids += (uint8_t) rx_count;
+		continue;
+		}
+
+	/* Every other state takes one command byte, a poll request held for a 
+	   transmit buffer is not read again */
+	if ( !session_ptr->cmd_pending )
+		{
+		if ( transport_receive_async( transport_ptr                  ,
+		                              &session_ptr->poll_cmd         ,
+		                              sizeof( session_ptr->poll_cmd ),
+		                              &rx_count ) != TRANSPORT_OK )
+			{
+			session_ptr->state = SENSOR_SESSION_CLOSED;
+			return link_error;
+			}
+		if ( rx_count == 0 )
+			{
+			return SENSOR_OK;
+			}
+		}
+
+	switch ( session_ptr->state )
+		{
+		/* Number of sensors to poll */
+		case SENSOR_SESSION_COUNT:
+			{
+			if ( session_ptr->poll_cmd > SENSOR_MAX_NUM_POLL )
+				{
+				session_ptr->state = SENSOR_SESSION_CLOSED;
+				return SENSOR_POLL_FAIL;
+				}
+			session_ptr->num_sensors = session_ptr->poll_cmd;
+			session_ptr->num_ids     = 0;
+			session_ptr->state       = SENSOR_SESSION_IDS;
+			break;
+			} /* case SENSOR_SESSION_COUNT */
+
+		/* Initiating command code */
+		case SENSOR_SESSION_START:
+			{
+			if ( session_ptr->poll_cmd != SENSOR_POLL_START )
+				{
+				/* SDEC fails to initiate sensor poll */
+				session_ptr->state = SENSOR_SESSION_CLOSED;
+				return SENSOR_POLL_FAIL_TO_START;
+				}
+			session_ptr->state = SENSOR_SESSION_RUN;
+			break;
+			} /* case SENSOR_SESSION_START */
+
+		/* Paused, every byte up to the resume signal is dropped */
+		case SENSOR_SESSION_WAIT:
+			{
+			if ( session_ptr->poll_cmd == SENSOR_POLL_RESUME )
+				{
+				session_ptr->state = SENSOR_SESSION_RUN;
+				}
+			break;
+			} /* case SENSOR_SESSION_WAIT */
+
+		/* Poll commands */
+		default:
+			{
+			if      ( session_ptr->poll_cmd == SENSOR_POLL_REQUEST )
+				{
+				/* Hold the request until the buffer queued two polls ago 
+				   has gone out */
+				tx_bytes_ptr = &session_ptr->tx_bytes[ session_ptr->tx_index ][0];
+				if ( session_ptr->tx_busy[ session_ptr->tx_index ] )
+					{
+					session_ptr->cmd_pending = true;
+					return SENSOR_OK;
+					}
+				session_ptr->cmd_pending = false;
+
+				if ( sensor_poll( &sensor_data                , 
+				                  &session_ptr->poll_sensors[0],
+				                  session_ptr->num_sensors ) != SENSOR_OK )
+					{
+					session_ptr->state = SENSOR_SESSION_CLOSED;
+					return SENSOR_POLL_FAIL;
+					}
+
+				/* Copy over sensor data into buffer */
+				extract_sensor_bytes( &sensor_data                 , 
+				                      &session_ptr->poll_sensors[0],
+				                      session_ptr->num_sensors     ,
+				                      tx_bytes_ptr                 ,
+				                      &num_sensor_bytes );
+
+				/* Queue sensor bytes for transmission back to SDEC and 
+				   keep polling while they drain. The buffer is busy until 
+				   its callback, which may run before the queue call 
+				   returns on a blocking link. A reply that finds the queue 
+				   full is dropped and counted, its buffer is refilled by 
+				   the next poll */
+				session_ptr->tx_busy[ session_ptr->tx_index ] = true;
+				switch ( transport_transmit_async( transport_ptr   ,
+				                                   tx_bytes_ptr    ,
+				                                   num_sensor_bytes,
+				                                   session_tx_done ) )
+					{
+					case TRANSPORT_OK:
+						{
+						session_ptr->tx_index ^= 1;
+						break;
+						}
+					case TRANSPORT_BUSY:
+						{
+						session_ptr->tx_busy[ session_ptr->tx_index ] = false;
+						sensor_tx_drops++;
+						break;
+						}
+					default:
+						{
+						session_ptr->tx_busy[ session_ptr->tx_index ] = false;
+						session_ptr->state = SENSOR_SESSION_CLOSED;
+						return link_error;
+						}
+					}
+				}
+			else if ( session_ptr->poll_cmd == SENSOR_POLL_WAIT )
+				{
+				session_ptr->state = SENSOR_SESSION_WAIT;
+				}
+			else if ( session_ptr->poll_cmd == SENSOR_POLL_STOP )
+				{
+				session_ptr->state = SENSOR_SESSION_CLOSED;
+				}
+			else
+				{
+				/* Erroneous Command */
+				session_ptr->state = SENSOR_SESSION_CLOSED;
+				return SENSOR_POLL_UNRECOGNIZED_CMD;
+				}
+			break;
+			} /* default */
+		} /* switch ( session_ptr->state ) */
+	} /* while ( session_ptr->state != SENSOR_SESSION_CLOSED ) */
+
+return SENSOR_OK;
+} /* session_service */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		session_tx_done                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Transmit callback of a poll reply, releases its buffer. A reply the    *
+*       link failed to send is counted as dropped                              *
+*                                                                              *
+*******************************************************************************/
+static void session_tx_done
+	(
+	const void*      tx_data_ptr , /* Reply buffer          */
+	size_t           tx_data_size, /* Size of reply         */
+	TRANSPORT_STATUS tx_status     /* Result of the send    */
+	)
+{
+for ( uint8_t i = 0; i < SENSOR_MAX_SESSIONS; ++i )
+	{
+	for ( uint8_t j = 0; j < 2; ++j )
+		{
+		if ( tx_data_ptr == &sensor_sessions[i].tx_bytes[j][0] )
+			{
+			sensor_sessions[i].tx_busy[j] = false;
+			if ( tx_status != TRANSPORT_OK )
+				{
+				sensor_tx_drops++;
+				}
+			return;
+			}
+		}
+	}
+} /* session_tx_done */
+
 #ifdef L0002_REV5
 /*******************************************************************************
 *                                                                              *
@@ -20,6 +20,7 @@ extern "C" {
 #include "stm32h7xx_hal.h"
 #if defined( FLIGHT_COMPUTER )
 	#include "imu.h"
+	#include "attitude.h"
 #endif
 
 /*------------------------------------------------------------------------------
@@ -30,8 +31,10 @@ Includes
 #ifdef UNIT_TEST
 	#include <stdint.h>
 #endif
+#include <stdbool.h>
 
 /* Project includes */
+#include "transport.h"
 #if defined( ENGINE_CONTROLLER )
 	#include "pressure.h"
 #endif
@@ -48,11 +51,15 @@ Includes
 /* Max allowed number of sensors for polling */
 #define SENSOR_MAX_NUM_POLL     ( 5    )
 
+/* Sensor poll sessions open at once, one per link */
+#define SENSOR_MAX_SESSIONS     ( TRANSPORT_NUM_LINKS )
+
 #if   defined( FLIGHT_COMPUTER   )
 	/* General */
-	#define NUM_SENSORS         ( 12   )
+	#define NUM_SENSORS         ( 19   )
 	#define IMU_DATA_SIZE       ( 20   )
-	#define SENSOR_DATA_SIZE	( 28   )
+	#define ATTITUDE_DATA_SIZE  ( 28   )
+	#define SENSOR_DATA_SIZE	( 56   )
 #elif defined( ENGINE_CONTROLLER )
 	/* General */
 	#define NUM_SENSORS         ( 10   )
@@ -106,6 +113,7 @@ typedef enum
 	SENSOR_POLL_UNRECOGNIZED_CMD ,
 	SENSOR_VALVE_UART_ERROR      ,
 	SENSOR_ADC_POLL_ERROR        ,
+	SENSOR_RS485_ERROR           ,
     SENSOR_FAIL   
     } SENSOR_STATUS;
 
@@ -119,6 +127,18 @@ typedef enum
 	SENSOR_POLL_STOP    = 0x74
 	} SENSOR_POLL_CMD;
 
+/* Sensor poll session states, a session steps through the poll setup and
+   then takes poll commands until SENSOR_POLL_STOP */
+typedef enum
+	{
+	SENSOR_SESSION_CLOSED = 0,
+	SENSOR_SESSION_COUNT     , /* Waiting for the number of sensors */
+	SENSOR_SESSION_IDS       , /* Waiting for the sensor IDs        */
+	SENSOR_SESSION_START     , /* Waiting for SENSOR_POLL_START     */
+	SENSOR_SESSION_RUN       , /* Taking poll commands              */
+	SENSOR_SESSION_WAIT        /* Paused until SENSOR_POLL_RESUME   */
+	} SENSOR_SESSION_STATE;
+
 /* Sensor idenification code instance*/
 typedef uint8_t SENSOR_ID;
 
@@ -137,7 +157,14 @@ typedef enum
 		SENSOR_MAGZ  = 0x08,
 		SENSOR_IMUT  = 0x09,
 		SENSOR_PRES  = 0x0A,
-		SENSOR_TEMP  = 0x0B
+		SENSOR_TEMP  = 0x0B,
+		SENSOR_ATTW  = 0x0C,
+		SENSOR_ATTX  = 0x0D,
+		SENSOR_ATTY  = 0x0E,
+		SENSOR_ATTZ  = 0x0F,
+		SENSOR_RATEX = 0x10,
+		SENSOR_RATEY = 0x11,
+		SENSOR_RATEZ = 0x12
 	#elif ( defined( ENGINE_CONTROLLER ) || defined( GROUND_STATION ) )
 		SENSOR_PT0   = 0x00,
 		SENSOR_PT1   = 0x01,
@@ -162,9 +189,10 @@ typedef enum
 typedef struct SENSOR_DATA 
 	{
 	#if   defined( FLIGHT_COMPUTER      )
-		IMU_DATA imu_data;
-		float    baro_pressure;
-		float    baro_temp;	
+		IMU_DATA       imu_data;
+		float          baro_pressure;
+		float          baro_temp;	
+		ATTITUDE_STATE attitude;
 	#elif ( defined( ENGINE_CONTROLLER ) || defined( GROUND_STATION ) )
 		uint32_t pt_pressures[ NUM_PTS ];
 		uint32_t load_cell_force;
@@ -178,6 +206,23 @@ typedef struct SENSOR_DATA
 	#endif /* #elif defined( ENGINE_CONTROLLER ) */
 	} SENSOR_DATA;
 
+/* Sensor poll session of one link. Each session has its own pair of 
+   transmit buffers, one is filled while the other is sent */
+typedef struct SENSOR_POLL_SESSION
+	{
+	uint8_t              tx_bytes[2][ SENSOR_DATA_SIZE ] 
+	                         __attribute__(( aligned( 32 ) ));
+	volatile bool        tx_busy[2];  /* Buffer queued on the link        */
+	uint8_t              tx_index;    /* Buffer the next poll fills       */
+	const TRANSPORT*     transport_ptr;
+	SENSOR_SESSION_STATE state;
+	uint8_t              num_sensors;
+	uint8_t              num_ids;     /* Sensor IDs received so far       */
+	SENSOR_ID            poll_sensors[ SENSOR_MAX_NUM_POLL ];
+	uint8_t              poll_cmd;    /* Poll command being executed      */
+	bool                 cmd_pending; /* poll_cmd waits for a free buffer */
+	} SENSOR_POLL_SESSION;
+
 /* Sensor Data sizes and offsets */
 typedef struct SENSOR_DATA_SIZE_OFFSETS
 	{
@@ -213,14 +258,30 @@ void sensor_init
 /* Execute a sensor subcommand */
 SENSOR_STATUS sensor_cmd_execute
 	(
-	#ifndef VALVE_CONTROLLER
-		uint8_t subcommand
-	#else
-		uint8_t    subcommand,   /* SDEC subcommand         */
-		CMD_SOURCE cmd_source    /* serial interface source */
-	#endif
+	uint8_t          subcommand   , /* SDEC subcommand            */
+	const TRANSPORT* transport_ptr  /* Link the command came from */
     );
 
+/* Step the open sensor poll sessions on the bytes their links have 
+   received, without waiting */
+SENSOR_STATUS sensor_poll_service
+	(
+	void
+	);
+
+/* Check for an open sensor poll session on a link, its received bytes 
+   belong to the session until it stops */
+bool sensor_poll_active
+	(
+	const TRANSPORT* transport_ptr
+	);
+
+/* Number of sensor poll replies dropped on a full transmit queue */
+uint32_t sensor_get_tx_drops
+	(
+	void
+	);
+
 /* Poll specific sensors on the board */
 SENSOR_STATUS sensor_poll
 	(
@@ -16,8 +16,7 @@
 #include "sdr_pin_defines_L0005.h"
 #include "solenoid.h"
 #include "stm32h7xx_hal.h"
-#include "usb.h"
-#include "valve.h"
+#include "transport.h"
 
 
 /*------------------------------------------------------------------------------
@@ -98,7 +97,8 @@ psol_GPIO_handle -> GPIO_pin = 1 << solenoid_pin_map[solenoid_num-1];
 *******************************************************************************/
 void solenoid_cmd_execute
 	(
-	uint8_t solenoid_cmd_opcode  /* Solenoid actuation code */
+	uint8_t          solenoid_cmd_opcode, /* Solenoid actuation code    */
+	const TRANSPORT* transport_ptr        /* Link the command came from */
 	)
 {
 /*------------------------------------------------------------------------------
@@ -165,11 +165,8 @@ switch(solenoid_base_code)
 	case SOL_GETSTATE_CODE:
 		{
 		sol_state = solenoid_get_state();
-		#if   defined( TERMINAL )
-			usb_transmit( &sol_state, sizeof( sol_state ), HAL_DEFAULT_TIMEOUT );
-		#elif defined( HOTFIRE  ) 
-			valve_transmit( &sol_state, sizeof( sol_state ), HAL_DEFAULT_TIMEOUT );
-		#endif
+		transport_transmit( transport_ptr, &sol_state, sizeof( sol_state ), 
+		                    HAL_DEFAULT_TIMEOUT );
 		break;
 		}
 
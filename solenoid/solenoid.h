@@ -20,6 +20,7 @@ extern "C" {
  Includes 
 ------------------------------------------------------------------------------*/
 #include "stm32h7xx_hal.h"
+#include "transport.h"
 
 
 /*------------------------------------------------------------------------------
@@ -76,7 +77,8 @@ void solenoid_map
 /* Execute a solenoid command */
 void solenoid_cmd_execute
 	(
-	uint8_t solenoid_cmd_opcode  /* Solenoid actuation code */
+	uint8_t          solenoid_cmd_opcode, /* Solenoid actuation code    */
+	const TRANSPORT* transport_ptr        /* Link the command came from */
 	); /* solenoid_cmd_execute */
 
 /* Turn a solenoid on */
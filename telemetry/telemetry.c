@@ -0,0 +1,643 @@
+/*******************************************************************************
+*
+* FILE:
+* 		telemetry.c
+*
+* DESCRIPTION:
+* 		Contains API functions for the telemetry scheduler. Each channel has a
+*       priority, a target rate and a nominal size. The link budget is shared
+*       out in priority order when the scheduler is planned, so a channel
+*       only loses rate once everything above it is fully served. At run
+*       time a token bucket holds the radio to the budget and due samples
+*       are packed in priority order, stopping at the first one the bucket
+*       cannot afford. Both charge the radio's own per packet overhead
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Standard Includes
+------------------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <string.h>
+
+
+/*------------------------------------------------------------------------------
+ Project Includes
+------------------------------------------------------------------------------*/
+#include "main.h"
+#include "wireless.h"
+#include "telemetry.h"
+
+
+/*------------------------------------------------------------------------------
+ Preprocesor Directives
+------------------------------------------------------------------------------*/
+
+/* Token bucket depth in packets, bounds the burst after an idle period */
+#define TLM_BUCKET_PACKETS          ( 2 )
+
+
+/*------------------------------------------------------------------------------
+ Global Variables
+------------------------------------------------------------------------------*/
+
+/* Default channel table */
+static const TLM_CHANNEL_CONFIG tlm_default_channels[TLM_NUM_CHANNELS] = 
+	{
+	/* TLM_CH_STATE    */ { 0, 10.0f, 10 },
+	/* TLM_CH_IGNITION */ { 1,  2.0f, 1  },
+	/* TLM_CH_BARO_ALT */ { 2, 10.0f, 4  },
+	/* TLM_CH_VALVES   */ { 3,  5.0f, 2  },
+	/* TLM_CH_GPS      */ { 4,  1.0f, 16 }
+	};
+
+/* Scheduler configuration */
+static TLM_CONFIG         tlm_config;
+
+/* Channel configuration, plan and statistics */
+static TLM_CHANNEL_CONFIG channel_config[TLM_NUM_CHANNELS];
+static TLM_CHANNEL_STATS  channel_stats[TLM_NUM_CHANNELS];
+static uint32_t           channel_period[TLM_NUM_CHANNELS]; /* ms, 0 is off  */
+static uint32_t           channel_due[TLM_NUM_CHANNELS];    /* Next send, ms */
+
+/* Channels planned at or below the packet rate ride in packets started by 
+   faster channels, they only start one after a full packet period late */
+static bool               channel_rides[TLM_NUM_CHANNELS];
+static uint32_t           packet_period; /* ms */
+
+/* Latest sample of each channel, written by tlm_publish */
+static uint8_t            channel_data[TLM_NUM_CHANNELS][TLM_MAX_RECORD_SIZE];
+static uint8_t            channel_size[TLM_NUM_CHANNELS];
+volatile static bool      channel_fresh[TLM_NUM_CHANNELS];
+static uint32_t           channel_ready[TLM_NUM_CHANNELS]; /* Fresh since, ms */
+
+/* Channels in priority order */
+static uint8_t            channel_order[TLM_NUM_CHANNELS];
+
+/* Token bucket in thousandths of a byte, refilled from the tick count */
+static uint32_t           bucket;
+static uint32_t           bucket_tick;
+
+/* Packet under construction and its sequence number */
+static uint8_t            tlm_packet[TLM_MAX_PACKET_SIZE];
+static uint16_t           tlm_sequence;
+
+/* Scheduler statistics */
+static TLM_STATS          tlm_stats;
+
+
+/*------------------------------------------------------------------------------
+ Internal function prototypes
+------------------------------------------------------------------------------*/
+
+/* Share the link budget out to the channels in priority order */
+static void tlm_plan
+	(
+	void
+	);
+
+/* Refill the token bucket */
+static void tlm_refill
+	(
+	uint32_t tick
+	);
+
+
+/*------------------------------------------------------------------------------
+ API Functions
+------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_init                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Initialize the scheduler with the default channel table and plan the   *
+*       link budget. On LoRa the packet size is cut to what the modem settings *
+*       send within TLM_MAX_PACKET_TIME                                        *
+*                                                                              *
+*******************************************************************************/
+TLM_STATUS tlm_init
+	(
+	const TLM_CONFIG* config_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+size_t max_size; /* Largest packet the radio sends in time */
+
+
+/*------------------------------------------------------------------------------
+ Initializations
+------------------------------------------------------------------------------*/
+if ( config_ptr->packet_size > TLM_MAX_PACKET_SIZE )
+	{
+	return TLM_INVALID_CONFIG;
+	}
+tlm_config = *config_ptr;
+
+/* A slow LoRa setting can make even a short packet take too long on air */
+max_size = rf_max_payload( tlm_config.module, TLM_MAX_PACKET_TIME );
+if ( tlm_config.packet_size > max_size )
+	{
+	tlm_config.packet_size = (uint16_t) max_size;
+	}
+if ( tlm_config.packet_size <= TLM_PACKET_HEADER_SIZE + 
+                               TLM_RECORD_HEADER_SIZE )
+	{
+	return TLM_INVALID_CONFIG;
+	}
+tlm_sequence = 0;
+memcpy( &channel_config[0], &tlm_default_channels[0], sizeof( channel_config ) );
+memset( &channel_stats[0] , 0, sizeof( channel_stats ) );
+memset( &tlm_stats        , 0, sizeof( tlm_stats     ) );
+memset( (void*) &channel_fresh[0], 0, sizeof( channel_fresh ) );
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation
+------------------------------------------------------------------------------*/
+tlm_plan();
+return TLM_OK;
+} /* tlm_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_set_channel                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Change the priority, rate or size of a channel and replan the budget   *
+*                                                                              *
+*******************************************************************************/
+TLM_STATUS tlm_set_channel
+	(
+	TLM_CHANNEL               channel   ,
+	const TLM_CHANNEL_CONFIG* config_ptr
+	)
+{
+if ( channel >= TLM_NUM_CHANNELS )
+	{
+	return TLM_INVALID_CHANNEL;
+	}
+if ( ( config_ptr->size > TLM_MAX_RECORD_SIZE ) || ( config_ptr->rate < 0.0f ) )
+	{
+	return TLM_INVALID_CONFIG;
+	}
+channel_config[channel] = *config_ptr;
+tlm_plan();
+return TLM_OK;
+} /* tlm_set_channel */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_set_budget                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Change the link budget and replan, for example when the radio falls    *
+*       back to a slower data rate                                             *
+*                                                                              *
+*******************************************************************************/
+void tlm_set_budget
+	(
+	uint32_t budget     /* Bytes per second */
+	)
+{
+tlm_config.budget = budget;
+tlm_plan();
+} /* tlm_set_budget */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_publish                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Publish the latest sample of a channel. Only the newest sample is kept,*
+*       publishing faster than the planned rate just refreshes it. Safe to call*
+*       from interrupt context                                                 *
+*                                                                              *
+*******************************************************************************/
+TLM_STATUS tlm_publish
+	(
+	TLM_CHANNEL channel ,
+	const void* data_ptr,
+	size_t      size
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t primask; /* Interrupt mask state at entry */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation
+------------------------------------------------------------------------------*/
+if ( channel >= TLM_NUM_CHANNELS )
+	{
+	return TLM_INVALID_CHANNEL;
+	}
+if ( size > TLM_MAX_RECORD_SIZE )
+	{
+	return TLM_TOO_LONG;
+	}
+
+primask = __get_PRIMASK();
+__disable_irq();
+memcpy( &( channel_data[channel][0] ), data_ptr, size );
+channel_size[channel]  = (uint8_t) size;
+if ( !channel_fresh[channel] )
+	{
+	channel_ready[channel] = HAL_GetTick();
+	}
+channel_fresh[channel] = true;
+__set_PRIMASK( primask );
+return TLM_OK;
+} /* tlm_publish */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_update                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Send due channels, call from the main loop. Counts a drop for every    *
+*       send slot that passed with a sample ready. Once a channel that starts  *
+*       packets is due, packs the due channels in priority order into one      *
+*       packet, stopping at the first channel the token bucket cannot afford so*
+*       lower priorities never starve higher ones. Never blocks, a busy radio  *
+*       only delays the packet                                                 *
+*                                                                              *
+*******************************************************************************/
+void tlm_update
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t tick;                         /* Current time, ms               */
+uint8_t  included[TLM_NUM_CHANNELS];   /* Channels in the packet         */
+uint8_t  num_records;                  /* Records in the packet          */
+bool     start;                        /* A channel starts a packet      */
+uint16_t pos;                          /* Packet write position          */
+uint32_t missed;                       /* Send slots missed              */
+uint32_t primask;                      /* Interrupt mask state at entry  */
+uint8_t  channel;                      /* Channel index                  */
+uint8_t  i;                            /* Loop counter                   */
+
+
+/*------------------------------------------------------------------------------
+ Initializations
+------------------------------------------------------------------------------*/
+tick        = HAL_GetTick();
+num_records = 0;
+pos         = TLM_PACKET_HEADER_SIZE;
+tlm_refill( tick );
+
+/* Keep the channel schedules current */
+for ( channel = 0; channel < TLM_NUM_CHANNELS; ++channel )
+	{
+	if ( channel_period[channel] == 0 )
+		{
+		continue;
+		}
+
+	/* Skip whole slots that passed without a send, keeping the phase. A 
+	   slot that ended after the pending sample was published is a drop */
+	if ( (int32_t) ( tick - channel_due[channel] ) >= 
+	     (int32_t) channel_period[channel] )
+		{
+		missed = ( tick - channel_due[channel] )/channel_period[channel];
+		if ( channel_fresh[channel] )
+			{
+			if ( (int32_t) ( channel_ready[channel] - channel_due[channel] ) < 
+			     (int32_t) channel_period[channel] )
+				{
+				channel_stats[channel].dropped += missed;
+				}
+			else
+				{
+				channel_stats[channel].dropped += missed - 
+				    ( channel_ready[channel] - channel_due[channel] )/
+				    channel_period[channel];
+				}
+			}
+		channel_due[channel] += missed*channel_period[channel];
+		}
+	}
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation
+------------------------------------------------------------------------------*/
+
+/* Only send when a channel that starts packets is due */
+start = false;
+for ( channel = 0; channel < TLM_NUM_CHANNELS; ++channel )
+	{
+	if ( ( channel_period[channel] != 0 ) && channel_fresh[channel] && 
+	     ( (int32_t) ( tick - channel_due[channel] ) >= 
+	       ( channel_rides[channel] ? (int32_t) packet_period : 0 ) ) )
+		{
+		start = true;
+		}
+	}
+if ( !start )
+	{
+	return;
+	}
+
+/* Let the radio drain, the samples stay ready and the bucket fills */
+if ( rf_tx_pending( tlm_config.module ) >= TLM_RADIO_QUEUE_LIMIT )
+	{
+	tlm_stats.radio_busy++;
+	return;
+	}
+
+/* Pack due channels by priority */
+for ( i = 0; i < TLM_NUM_CHANNELS; ++i )
+	{
+	channel = channel_order[i];
+	if ( ( channel_period[channel] == 0 ) || !channel_fresh[channel] || 
+	     ( (int32_t) ( tick - channel_due[channel] ) < 0 ) )
+		{
+		continue;
+		}
+
+	/* Out of budget, nothing below this channel may go first */
+	if ( bucket < 1000U*( tlm_config.packet_overhead + pos + 
+	                      TLM_RECORD_HEADER_SIZE + channel_size[channel] ) )
+		{
+		break;
+		}
+
+	/* Packet full, the channel waits for the next packet */
+	if ( pos + TLM_RECORD_HEADER_SIZE + channel_size[channel] > 
+	     tlm_config.packet_size )
+		{
+		continue;
+		}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	tlm_packet[pos++] = channel;
+	tlm_packet[pos++] = channel_size[channel];
+	memcpy( &tlm_packet[pos], &( channel_data[channel][0] ), 
+	        channel_size[channel] );
+	pos                   += channel_size[channel];
+	channel_fresh[channel] = false;
+	__set_PRIMASK( primask );
+	included[num_records++] = channel;
+	}
+if ( num_records == 0 )
+	{
+	return;
+	}
+
+/* Header */
+memcpy( &tlm_packet[0], &tlm_sequence, sizeof( tlm_sequence ) );
+memcpy( &tlm_packet[2], &tick        , sizeof( tick         ) );
+tlm_packet[6] = num_records;
+
+if ( rf_send( tlm_config.module, tlm_config.dest_addr, 
+              tlm_packet, pos ) != RF_OK )
+	{
+	/* Retry with the latest samples on the next update */
+	tlm_stats.send_errors++;
+	for ( i = 0; i < num_records; ++i )
+		{
+		channel_fresh[included[i]] = true;
+		}
+	return;
+	}
+
+tlm_sequence++;
+bucket -= 1000U*( tlm_config.packet_overhead + pos );
+tlm_stats.packets++;
+tlm_stats.bytes += pos;
+for ( i = 0; i < num_records; ++i )
+	{
+	channel = included[i];
+	channel_stats[channel].sent++;
+	channel_due[channel] += channel_period[channel];
+	}
+} /* tlm_update */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_get_channel_stats                                                  *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the statistics of a channel, including the rate the budget allows  *
+*                                                                              *
+*******************************************************************************/
+TLM_STATUS tlm_get_channel_stats
+	(
+	TLM_CHANNEL        channel  ,
+	TLM_CHANNEL_STATS* stats_ptr
+	)
+{
+if ( channel >= TLM_NUM_CHANNELS )
+	{
+	return TLM_INVALID_CHANNEL;
+	}
+*stats_ptr = channel_stats[channel];
+return TLM_OK;
+} /* tlm_get_channel_stats */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_get_stats                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the scheduler statistics                                           *
+*                                                                              *
+*******************************************************************************/
+void tlm_get_stats
+	(
+	TLM_STATS* stats_ptr
+	)
+{
+*stats_ptr = tlm_stats;
+} /* tlm_get_stats */
+
+
+/*------------------------------------------------------------------------------
+ Internal procedures
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_plan                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Share the link budget out to the channels in priority order. Packets   *
+*       go out at the fastest planned rate and slower channels ride in them, so*
+*       a channel costs its records plus the header and radio overhead of any  *
+*       packets it adds above that rate. A channel the remaining budget cannot *
+*       fully serve runs at the rate that is left and everything below it gets *
+*       nothing. Restarts every channel schedule and refills the bucket        *
+*                                                                              *
+*******************************************************************************/
+static void tlm_plan
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+float   remaining;    /* Budget left, bytes per second          */
+float   packet_rate;  /* Packet rate of the channels so far, Hz */
+float   packet_cost;  /* Bytes per packet outside the records   */
+float   record_cost;  /* Bytes per sample of the channel        */
+float   rate;         /* Planned rate, Hz                       */
+float   cost;         /* Budget used by the channel             */
+uint8_t channel;      /* Channel index                          */
+uint8_t i;            /* Loop counter                           */
+uint8_t j;            /* Insertion index                        */
+
+
+/*------------------------------------------------------------------------------
+ Initializations
+------------------------------------------------------------------------------*/
+remaining   = (float) tlm_config.budget;
+packet_rate = 0.0f;
+packet_cost = (float) ( TLM_PACKET_HEADER_SIZE + tlm_config.packet_overhead );
+bucket_tick = HAL_GetTick();
+bucket      = 1000U*TLM_BUCKET_PACKETS*
+              ( tlm_config.packet_size + tlm_config.packet_overhead );
+
+
+/*------------------------------------------------------------------------------
+ Implementation
+------------------------------------------------------------------------------*/
+
+/* Stable insertion sort by priority */
+for ( i = 0; i < TLM_NUM_CHANNELS; ++i )
+	{
+	j = i;
+	while ( ( j > 0 ) && ( channel_config[channel_order[j - 1]].priority > 
+	                       channel_config[i].priority ) )
+		{
+		channel_order[j] = channel_order[j - 1];
+		j--;
+		}
+	channel_order[j] = i;
+	}
+
+for ( i = 0; i < TLM_NUM_CHANNELS; ++i )
+	{
+	channel     = channel_order[i];
+	record_cost = (float) ( TLM_RECORD_HEADER_SIZE + 
+	                        channel_config[channel].size );
+	rate        = channel_config[channel].rate;
+
+	/* Cost of the full rate */
+	cost = rate*record_cost;
+	if ( rate > packet_rate )
+		{
+		cost += ( rate - packet_rate )*packet_cost;
+		}
+
+	/* Largest rate the rest of the budget carries */
+	if ( cost > remaining )
+		{
+		if ( remaining <= packet_rate*record_cost )
+			{
+			rate = remaining/record_cost;
+			}
+		else
+			{
+			rate = ( remaining + packet_rate*packet_cost )/
+			       ( record_cost + packet_cost );
+			}
+		cost = remaining;
+		}
+	if ( rate < TLM_MIN_RATE )
+		{
+		rate = 0.0f;
+		cost = 0.0f;
+		}
+
+	remaining             -= cost;
+	channel_rides[channel] = ( rate <= packet_rate );
+	if ( rate > packet_rate )
+		{
+		packet_rate = rate;
+		}
+	channel_stats[channel].target_rate  = channel_config[channel].rate;
+	channel_stats[channel].planned_rate = rate;
+	channel_period[channel] = ( rate > 0.0f ) ? 
+	                          (uint32_t) ( 1000.0f/rate + 0.5f ) : 0;
+	channel_due[channel]    = bucket_tick;
+	}
+packet_period = ( packet_rate > 0.0f ) ? (uint32_t) ( 1000.0f/packet_rate ) : 0;
+} /* tlm_plan */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tlm_refill                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Refill the token bucket for the time since the last refill, capped at  *
+*       TLM_BUCKET_PACKETS full packets                                        *
+*                                                                              *
+*******************************************************************************/
+static void tlm_refill
+	(
+	uint32_t tick
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t elapsed; /* Time since the last refill, ms */
+uint32_t cap;     /* Bucket depth                   */
+
+
+/*------------------------------------------------------------------------------
+ Implementation
+------------------------------------------------------------------------------*/
+elapsed     = tick - bucket_tick;
+bucket_tick = tick;
+cap         = 1000U*TLM_BUCKET_PACKETS*
+              ( tlm_config.packet_size + tlm_config.packet_overhead );
+
+/* Budget is in bytes per second and the bucket in thousandths of a byte, 
+   so one ms adds budget thousandths */
+if ( elapsed > cap/( tlm_config.budget + 1 ) + 1 )
+	{
+	bucket = cap;
+	return;
+	}
+bucket += elapsed*tlm_config.budget;
+if ( bucket > cap )
+	{
+	bucket = cap;
+	}
+} /* tlm_refill */
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,181 @@
+/*******************************************************************************
+*
+* FILE:
+* 		telemetry.h
+*
+* DESCRIPTION:
+* 		Contains API functions for the telemetry scheduler. Channels are 
+*       published by the flight loop and packed into radio packets by 
+*       priority within a byte per second link budget, so the critical 
+*       channels get through at a known rate and the low priority channels 
+*       are thinned out first when the link cannot carry everything
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "wireless.h"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Packet layout, little endian:
+       uint16_t sequence
+       uint32_t time, ms
+       uint8_t  number of records
+   followed by the records:
+       uint8_t  channel
+       uint8_t  length
+       uint8_t  data[length]                                                  */
+#define TLM_PACKET_HEADER_SIZE      ( 7   )
+#define TLM_RECORD_HEADER_SIZE      ( 2   )
+
+/* Largest channel sample */
+#define TLM_MAX_RECORD_SIZE         ( 32  )
+
+/* Largest packet, also limited by the radio */
+#define TLM_MAX_PACKET_SIZE         ( RF_MAX_PAYLOAD )
+
+/* Channels planned below this rate are not sent at all, Hz */
+#define TLM_MIN_RATE                ( 0.05f )
+
+/* Longest time on air of a packet on radios that report it (LoRa), us. Keeps
+   a packet from holding the channel past the next state sample */
+#define TLM_MAX_PACKET_TIME         ( 100000 )
+
+/* Radio transmit queue level at which the scheduler holds off */
+#define TLM_RADIO_QUEUE_LIMIT       ( 2   )
+
+
+/*------------------------------------------------------------------------------
+ Typdefs
+------------------------------------------------------------------------------*/
+
+/* Telemetry scheduler return codes */
+typedef enum _TLM_STATUS
+	{
+	TLM_OK               = 0,
+	TLM_INVALID_CHANNEL     ,
+	TLM_TOO_LONG            ,
+	TLM_INVALID_CONFIG
+	} TLM_STATUS;
+
+/* Telemetry channels */
+typedef enum _TLM_CHANNEL
+	{
+	TLM_CH_STATE       = 0,  /* Vertical state estimate            */
+	TLM_CH_IGNITION       ,  /* Ignition continuity                */
+	TLM_CH_BARO_ALT       ,  /* Baro altitude                      */
+	TLM_CH_VALVES         ,  /* Valve states                       */
+	TLM_CH_GPS            ,  /* GPS fix, reserved                  */
+	TLM_NUM_CHANNELS
+	} TLM_CHANNEL;
+
+/* Channel configuration. Priority 0 is the most important */
+typedef struct _TLM_CHANNEL_CONFIG
+	{
+	uint8_t priority;
+	float   rate;             /* Target rate, Hz                       */
+	uint8_t size;             /* Nominal sample size used for planning */
+	} TLM_CHANNEL_CONFIG;
+
+/* Scheduler configuration */
+typedef struct _TLM_CONFIG
+	{
+	WIRELESS_MOD_CODES module;          /* Radio to send on              */
+	uint64_t           dest_addr;       /* Destination, XBee only        */
+	uint32_t           budget;          /* Link budget, bytes per second */
+	uint16_t           packet_size;     /* Largest packet, bytes         */
+	uint16_t           packet_overhead; /* Radio framing and headers per
+	                                       packet, bytes                 */
+	} TLM_CONFIG;
+
+/* Channel statistics */
+typedef struct _TLM_CHANNEL_STATS
+	{
+	float    target_rate;     /* Configured rate, Hz                    */
+	float    planned_rate;    /* Rate the budget allows, Hz             */
+	uint32_t sent;            /* Samples sent                           */
+	uint32_t dropped;         /* Send slots missed with a sample ready  */
+	} TLM_CHANNEL_STATS;
+
+/* Scheduler statistics */
+typedef struct _TLM_STATS
+	{
+	uint32_t packets;         /* Packets handed to the radio            */
+	uint32_t bytes;           /* Bytes handed to the radio              */
+	uint32_t radio_busy;      /* Updates held off by a full radio queue */
+	uint32_t send_errors;     /* Packets the radio refused              */
+	} TLM_STATS;
+
+
+/*------------------------------------------------------------------------------
+ Function Prototypes
+------------------------------------------------------------------------------*/
+
+/* Initialize the scheduler with the default channel table */
+TLM_STATUS tlm_init
+	(
+	const TLM_CONFIG* config_ptr
+	);
+
+/* Change the priority, rate or size of a channel and replan */
+TLM_STATUS tlm_set_channel
+	(
+	TLM_CHANNEL               channel   ,
+	const TLM_CHANNEL_CONFIG* config_ptr
+	);
+
+/* Change the link budget and replan */
+void tlm_set_budget
+	(
+	uint32_t budget     /* Bytes per second */
+	);
+
+/* Publish the latest sample of a channel */
+TLM_STATUS tlm_publish
+	(
+	TLM_CHANNEL channel ,
+	const void* data_ptr,
+	size_t      size
+	);
+
+/* Send due channels, call from the main loop */
+void tlm_update
+	(
+	void
+	);
+
+/* Get the statistics of a channel */
+TLM_STATUS tlm_get_channel_stats
+	(
+	TLM_CHANNEL        channel  ,
+	TLM_CHANNEL_STATS* stats_ptr
+	);
+
+/* Get the scheduler statistics */
+void tlm_get_stats
+	(
+	TLM_STATS* stats_ptr
+	);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* TELEMETRY_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -26,6 +26,23 @@
  Global Variables 
 ------------------------------------------------------------------------------*/
 
+/* Interrupt driven read sequence */
+volatile static THERMO_IT_STATE temp_it_state    = THERMO_IT_IDLE;
+static THERMO_JUNCTION          temp_it_junction = THERMO_HOT_JUNCTION;
+static uint8_t                  temp_it_status;   /* Status register buffer */
+static uint8_t                  temp_it_bytes[2]; /* Temperature buffer     */
+static uint8_t                  temp_it_clear;    /* Status clear buffer    */
+
+/* Latest interrupt driven sample */
+volatile static uint32_t        temp_it_sample;
+volatile static bool            temp_it_sample_valid = false;
+
+/* Earliest tick to start the next read sequence and the conversion time of
+   the configured ADC resolution */
+volatile static uint32_t        temp_it_next_tick;
+static uint32_t                 temp_conv_time = THERMO_CONV_TIME_MS( 
+                                                 THERMO_18BIT_ADC );
+
 
 /*------------------------------------------------------------------------------
  Internal function prototypes 
@@ -46,6 +63,14 @@ static THERMO_STATUS read_reg
     uint8_t  num_bytes     /* Number of bytes to read   */
     );
 
+/* Start an interrupt driven register read */
+static bool read_reg_IT
+    (
+    uint8_t  reg_id,       /* Thermocouple register id  */
+    uint8_t* reg_data_ptr, /* Pointer to output         */
+    uint8_t  num_bytes     /* Number of bytes to read   */
+    );
+
 
 /*------------------------------------------------------------------------------
  API Functions 
@@ -121,6 +146,9 @@ if ( thermo_status != THERMO_OK )
     return thermo_status;
     }
 
+/* Pace the interrupt driven status reads to the conversion time */
+temp_conv_time = THERMO_CONV_TIME_MS( thermo_config_ptr -> adc_resolution );
+
 /* Get the device status */
 thermo_status = temp_get_status( &( thermo_config_ptr -> status ) );
 if ( thermo_status != THERMO_OK )
@@ -153,6 +181,7 @@ THERMO_STATUS temp_get_temp
 THERMO_STATUS thermo_status; /* Return codes from temp functions    */
 uint8_t       temp_bytes[2]; /* Bytes read from thermocouple        */
 uint8_t       data_reg_id;   /* ID of register containing temp data */
+uint32_t      start_tick;    /* Time at start of wait, ms           */
 
 
 /*------------------------------------------------------------------------------
@@ -184,7 +213,14 @@ switch ( junction )
 ------------------------------------------------------------------------------*/
 
 /* Wait for temperature measurement ready flag */
-while ( !temp_is_temp_ready() ){}
+start_tick = HAL_GetTick();
+while ( !temp_is_temp_ready() )
+    {
+    if ( ( HAL_GetTick() - start_tick ) > THERMO_DRDY_TIMEOUT )
+        {
+        return THERMO_TIMEOUT;
+        }
+    }
 
 /* Read temperature data register */
 thermo_status = read_reg( data_reg_id   , 
@@ -351,6 +387,230 @@ else
 } /* temp_get_device_id */
 
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		temp_start_read_IT                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start an interrupt driven read sequence. The status register is read   *
+*       first and, once a measurement is ready, the temperature register is    *
+*       read and the data ready flag cleared, all from the I2C completion      *
+*       interrupts. The sample is available through temp_get_sample            *
+*                                                                              *
+*******************************************************************************/
+THERMO_STATUS temp_start_read_IT
+    (
+    THERMO_JUNCTION junction  /* Cold or hot junction measurement */
+    )
+{
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( junction != THERMO_COLD_JUNCTION && 
+     junction != THERMO_HOT_JUNCTION )
+    {
+    return THERMO_INVALID_JUNCTION;
+    }
+if ( temp_it_state != THERMO_IT_IDLE )
+    {
+    return THERMO_BUSY;
+    }
+
+/* Invalidate the sample when switching junctions */
+if ( junction != temp_it_junction )
+    {
+    temp_it_sample_valid = false;
+    }
+temp_it_junction = junction;
+
+/* Start with the status register */
+temp_it_state = THERMO_IT_STATUS;
+if ( !read_reg_IT( THERMO_STATUS_REG_ID, &temp_it_status, 
+                   sizeof( temp_it_status ) ) )
+    {
+    temp_it_state = THERMO_IT_IDLE;
+    return THERMO_I2C_ERROR;
+    }
+return THERMO_OK;
+} /* temp_start_read_IT */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		temp_get_sample                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the latest interrupt driven temperature sample of the junction     *
+*       passed to temp_start_read_IT. The cached sample is returned without    *
+*       bus traffic, the next read sequence is started only once a new         *
+*       conversion is due. Returns THERMO_NO_DATA until a sample has been read *
+*                                                                              *
+*******************************************************************************/
+THERMO_STATUS temp_get_sample
+    (
+    uint32_t* temp_ptr /* Pointer to write temperature */
+    )
+{
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Keep the sequence running, at most once per conversion */
+if ( temp_it_state == THERMO_IT_IDLE &&
+     (int32_t) ( HAL_GetTick() - temp_it_next_tick ) >= 0 )
+    {
+    temp_start_read_IT( temp_it_junction );
+    }
+
+if ( !temp_it_sample_valid )
+    {
+    return THERMO_NO_DATA;
+    }
+*temp_ptr = temp_it_sample;
+return THERMO_OK;
+} /* temp_get_sample */
+
+
+/*------------------------------------------------------------------------------
+ Interrupt Service Routines 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		temp_read_cplt_ISR                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       I2C read complete interrupt, advances the read sequence. Call from     *
+*       HAL_I2C_MemRxCpltCallback                                              *
+*                                                                              *
+*******************************************************************************/
+void temp_read_cplt_ISR
+    (
+    I2C_HandleTypeDef* hi2c /* I2C handle of the completed transfer */
+    )
+{
+/*------------------------------------------------------------------------------
+ Local Variables  
+------------------------------------------------------------------------------*/
+HAL_StatusTypeDef hal_status; /* Return codes from I2C HAL */
+uint8_t           data_reg_id; /* ID of register containing temp data */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( hi2c != &( THERMO_I2C ) )
+    {
+    return;
+    }
+
+switch ( temp_it_state )
+    {
+    /* Status read, fetch the measurement if one is ready */
+    case THERMO_IT_STATUS:
+        {
+        if ( !( temp_it_status & THERMO_STATUS_DATA_RDY_BITMASK ) )
+            {
+            temp_it_next_tick = HAL_GetTick() + temp_conv_time/4;
+            temp_it_state     = THERMO_IT_IDLE;
+            break;
+            }
+        if ( temp_it_junction == THERMO_COLD_JUNCTION )
+            {
+            data_reg_id = THERMO_COLD_JUNC_TEMP_REG_ID;
+            }
+        else
+            {
+            data_reg_id = THERMO_HOT_JUNC_TEMP_REG_ID;
+            }
+        temp_it_state = THERMO_IT_DATA;
+        if ( !read_reg_IT( data_reg_id, &temp_it_bytes[0], 
+                           sizeof( temp_it_bytes ) ) )
+            {
+            temp_it_state = THERMO_IT_IDLE;
+            }
+        break;
+        }
+
+    /* Temperature read, publish and clear the data ready flag */
+    case THERMO_IT_DATA:
+        {
+        temp_it_sample       = ( (uint32_t) temp_it_bytes[0] << 8 ) |
+                               ( (uint32_t) temp_it_bytes[1] << 0 );
+        temp_it_sample_valid = true;
+        temp_it_next_tick    = HAL_GetTick() + temp_conv_time;
+        temp_it_clear        = 0;
+        temp_it_state        = THERMO_IT_CLEAR;
+        hal_status = HAL_I2C_Mem_Write_IT( &( THERMO_I2C )         , 
+                                           THERMO_I2C_ADDR         ,
+                                           THERMO_STATUS_REG_ID    ,
+                                           I2C_MEMADD_SIZE_8BIT    ,
+                                           &temp_it_clear          ,
+                                           sizeof( temp_it_clear ) );
+        if ( hal_status != HAL_OK )
+            {
+            temp_it_state = THERMO_IT_IDLE;
+            }
+        break;
+        }
+
+    default:
+        {
+        break;
+        }
+    }
+} /* temp_read_cplt_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		temp_write_cplt_ISR                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       I2C write complete interrupt, ends the read sequence. Call from        *
+*       HAL_I2C_MemTxCpltCallback                                              *
+*                                                                              *
+*******************************************************************************/
+void temp_write_cplt_ISR
+    (
+    I2C_HandleTypeDef* hi2c /* I2C handle of the completed transfer */
+    )
+{
+if ( hi2c == &( THERMO_I2C ) && temp_it_state == THERMO_IT_CLEAR )
+    {
+    temp_it_state = THERMO_IT_IDLE;
+    }
+} /* temp_write_cplt_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		temp_error_ISR                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       I2C error interrupt, abandons the read sequence. Call from             *
+*       HAL_I2C_ErrorCallback                                                  *
+*                                                                              *
+*******************************************************************************/
+void temp_error_ISR
+    (
+    I2C_HandleTypeDef* hi2c /* I2C handle of the failed transfer */
+    )
+{
+if ( hi2c == &( THERMO_I2C ) )
+    {
+    temp_it_next_tick = HAL_GetTick() + temp_conv_time/4;
+    temp_it_state     = THERMO_IT_IDLE;
+    }
+} /* temp_error_ISR */
+
+
 /*------------------------------------------------------------------------------
  Internal procedures 
 ------------------------------------------------------------------------------*/
@@ -477,6 +737,42 @@ return THERMO_OK;
 } /* read_reg */
 
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		read_reg_IT                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start an interrupt driven read of a thermocouple register, returns     *
+*       true if the transfer was started                                       *
+*                                                                              *
+*******************************************************************************/
+static bool read_reg_IT
+    (
+    uint8_t  reg_id,       /* Thermocouple register id  */
+    uint8_t* reg_data_ptr, /* Pointer to output         */
+    uint8_t  num_bytes     /* Number of bytes to read   */
+    )
+{
+/*------------------------------------------------------------------------------
+ Local Variables  
+------------------------------------------------------------------------------*/
+HAL_StatusTypeDef hal_status; /* Return codes from I2C HAL     */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+hal_status = HAL_I2C_Mem_Read_IT( &( THERMO_I2C )     , 
+                                  THERMO_I2C_ADDR     , 
+                                  reg_id              ,
+                                  I2C_MEMADD_SIZE_8BIT,
+                                  reg_data_ptr        ,
+                                  num_bytes );
+return ( hal_status == HAL_OK );
+} /* read_reg_IT */
+
+
 /*******************************************************************************
 * END OF FILE                                                                  * 
 *******************************************************************************/
\ No newline at end of file
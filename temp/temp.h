@@ -60,6 +60,16 @@ extern "C" {
 #define THERMO_STATUS_DATA_RDY_BITMASK   0b01000000
 #define THERMO_STATUS_BURST_BITMASK      0b10000000
 
+/* Maximum wait for a measurement in temp_get_temp, ms. Covers an 18-bit 
+   conversion of both junctions */
+#define THERMO_DRDY_TIMEOUT              500
+
+/* Hot junction conversion time for each THERMO_ADC_RES setting, ms. The
+   interrupt driven sequence reads the status register only once this has
+   elapsed since the last sample, and after a quarter of it when the status 
+   read found no measurement ready */
+#define THERMO_CONV_TIME_MS( adc_res )   ( 320 >> ( 2*( adc_res ) ) )
+
 
 /*------------------------------------------------------------------------------
  Typdefs 
@@ -72,7 +82,10 @@ typedef enum THERMO_STATUS
     THERMO_I2C_ERROR       ,
     THERMO_UNRECOGNIZED_ID ,
     THERMO_INVALID_JUNCTION,
-    THERMO_FAIL 
+    THERMO_FAIL            ,
+    THERMO_TIMEOUT         ,
+    THERMO_BUSY            ,
+    THERMO_NO_DATA
     } THERMO_STATUS;
 
 /* Thermocouple junctions */
@@ -82,6 +95,15 @@ typedef enum THERMO_JUNCTION
     THERMO_HOT_JUNCTION
     } THERMO_JUNCTION;
 
+/* Interrupt driven read sequence states */
+typedef enum THERMO_IT_STATE
+    {
+    THERMO_IT_IDLE = 0,  /* No transfer in progress                */
+    THERMO_IT_STATUS  ,  /* Reading the status register            */
+    THERMO_IT_DATA    ,  /* Reading the temperature register       */
+    THERMO_IT_CLEAR      /* Clearing the data ready flag           */
+    } THERMO_IT_STATE;
+
 /* Thermocouple types */
 typedef enum THERMO_TYPE
     {
@@ -197,6 +219,36 @@ THERMO_STATUS temp_get_device_id
     uint8_t* device_id_ptr
     );
 
+/* Start an interrupt driven status and temperature read sequence */
+THERMO_STATUS temp_start_read_IT
+    (
+    THERMO_JUNCTION junction /* Cold or hot junction measurement */
+    );
+
+/* Get the latest interrupt driven temperature sample */
+THERMO_STATUS temp_get_sample
+    (
+    uint32_t* temp_ptr /* Pointer to write temperature */
+    );
+
+/* I2C read complete interrupt, call from HAL_I2C_MemRxCpltCallback */
+void temp_read_cplt_ISR
+    (
+    I2C_HandleTypeDef* hi2c
+    );
+
+/* I2C write complete interrupt, call from HAL_I2C_MemTxCpltCallback */
+void temp_write_cplt_ISR
+    (
+    I2C_HandleTypeDef* hi2c
+    );
+
+/* I2C error interrupt, call from HAL_I2C_ErrorCallback */
+void temp_error_ISR
+    (
+    I2C_HandleTypeDef* hi2c
+    );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,313 @@
+/*******************************************************************************
+*
+* FILE:
+* 		hal_stub.c
+*
+* DESCRIPTION:
+* 		Default host implementations of the HAL functions declared in
+*       stm32h7xx_hal.h. Every function is weak and succeeds without side
+*       effects, so a test only defines the calls it needs to observe or
+*       drive. PRIMASK is modelled as a plain flag
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "main.h"
+
+#define WEAK __attribute__(( weak ))
+
+
+/*------------------------------------------------------------------------------
+ Peripherals
+------------------------------------------------------------------------------*/
+static CoreDebug_Type stub_core_debug;
+static DWT_Type       stub_dwt;
+CoreDebug_Type*       CoreDebug       = &stub_core_debug;
+DWT_Type*             DWT             = &stub_dwt;
+uint32_t              SystemCoreClock = 480000000;
+
+static DMA_HandleTypeDef stub_dma_rx[3];
+static DMA_HandleTypeDef stub_dma_tx[3];
+UART_HandleTypeDef huart1 = { NULL, &stub_dma_rx[0], &stub_dma_tx[0],
+                              HAL_UART_STATE_READY, HAL_UART_STATE_READY };
+UART_HandleTypeDef huart2 = { NULL, &stub_dma_rx[1], &stub_dma_tx[1],
+                              HAL_UART_STATE_READY, HAL_UART_STATE_READY };
+UART_HandleTypeDef huart3 = { NULL, &stub_dma_rx[2], &stub_dma_tx[2],
+                              HAL_UART_STATE_READY, HAL_UART_STATE_READY };
+
+static TIM_TypeDef stub_tim[6];
+TIM_HandleTypeDef  htim1 = { &stub_tim[0] };
+TIM_HandleTypeDef  htim2 = { &stub_tim[1] };
+TIM_HandleTypeDef  htim3 = { &stub_tim[2] };
+TIM_HandleTypeDef  htim4 = { &stub_tim[3] };
+TIM_HandleTypeDef  htim5 = { &stub_tim[4] };
+TIM_HandleTypeDef  htim6 = { &stub_tim[5] };
+
+I2C_HandleTypeDef  hi2c1;
+SPI_HandleTypeDef  hspi1;
+GPIO_TypeDef       stub_gpio;
+
+static uint32_t stub_primask;
+
+
+/*------------------------------------------------------------------------------
+ Core
+------------------------------------------------------------------------------*/
+WEAK uint32_t HAL_GetTick ( void ) { return 0; }
+WEAK void HAL_Delay ( uint32_t delay ) { (void) delay; }
+WEAK void HAL_NVIC_EnableIRQ ( IRQn_Type irqn ) { (void) irqn; }
+WEAK void HAL_NVIC_DisableIRQ ( IRQn_Type irqn ) { (void) irqn; }
+WEAK void __disable_irq ( void ) { stub_primask = 1; }
+WEAK void __enable_irq ( void ) { stub_primask = 0; }
+WEAK uint32_t __get_PRIMASK ( void ) { return stub_primask; }
+WEAK void __set_PRIMASK ( uint32_t primask ) { stub_primask = primask; }
+WEAK void __DMB ( void ) { __sync_synchronize(); }
+WEAK void SCB_InvalidateDCache_by_Addr ( void* addr, int32_t size )
+	{ (void) addr; (void) size; }
+WEAK void SCB_CleanDCache_by_Addr ( void* addr, int32_t size )
+	{ (void) addr; (void) size; }
+
+
+/*------------------------------------------------------------------------------
+ GPIO
+------------------------------------------------------------------------------*/
+WEAK GPIO_PinState HAL_GPIO_ReadPin ( GPIO_TypeDef* port, uint16_t pin )
+	{
+	return ( port -> IDR & pin ) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+	}
+
+WEAK void HAL_GPIO_WritePin ( GPIO_TypeDef* port, uint16_t pin,
+                              GPIO_PinState state )
+	{
+	if ( state == GPIO_PIN_SET ) port -> ODR |= pin;
+	else                         port -> ODR &= ~(uint32_t) pin;
+	}
+
+WEAK void HAL_GPIO_TogglePin ( GPIO_TypeDef* port, uint16_t pin )
+	{
+	port -> ODR ^= pin;
+	}
+
+
+/*------------------------------------------------------------------------------
+ UART, the blocking calls reject an empty transfer as the HAL does
+------------------------------------------------------------------------------*/
+WEAK HAL_StatusTypeDef HAL_UART_Transmit ( UART_HandleTypeDef* huart,
+                                           const uint8_t* data, uint16_t size,
+                                           uint32_t timeout )
+	{
+	(void) huart; (void) timeout;
+	return ( ( data == NULL ) || ( size == 0 ) ) ? HAL_ERROR : HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_UART_Receive ( UART_HandleTypeDef* huart,
+                                          uint8_t* data, uint16_t size,
+                                          uint32_t timeout )
+	{
+	(void) huart; (void) timeout;
+	return ( ( data == NULL ) || ( size == 0 ) ) ? HAL_ERROR : HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_UART_Transmit_IT ( UART_HandleTypeDef* huart,
+                                              const uint8_t* data,
+                                              uint16_t size )
+	{ (void) huart; (void) data; (void) size; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_UART_Receive_IT ( UART_HandleTypeDef* huart,
+                                             uint8_t* data, uint16_t size )
+	{ (void) huart; (void) data; (void) size; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_UART_Transmit_DMA ( UART_HandleTypeDef* huart,
+                                               const uint8_t* data,
+                                               uint16_t size )
+	{ (void) huart; (void) data; (void) size; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_UART_AbortTransmit ( UART_HandleTypeDef* huart )
+	{ huart -> gState = HAL_UART_STATE_READY; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_UART_AbortReceive ( UART_HandleTypeDef* huart )
+	{ huart -> RxState = HAL_UART_STATE_READY; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA ( UART_HandleTypeDef* huart,
+                                                      uint8_t* data,
+                                                      uint16_t size )
+	{
+	(void) data;
+	if ( huart -> RxState != HAL_UART_STATE_READY )
+		{
+		return HAL_BUSY;
+		}
+	huart -> RxState      = HAL_UART_STATE_BUSY_RX;
+	huart -> hdmarx -> NDTR = size;
+	return HAL_OK;
+	}
+
+
+/*------------------------------------------------------------------------------
+ I2C
+------------------------------------------------------------------------------*/
+WEAK HAL_StatusTypeDef HAL_I2C_Mem_Read ( I2C_HandleTypeDef* hi2c,
+                                          uint16_t addr, uint16_t reg,
+                                          uint16_t reg_size, uint8_t* data,
+                                          uint16_t size, uint32_t timeout )
+	{
+	(void) hi2c; (void) addr; (void) reg; (void) reg_size; (void) timeout;
+	for ( uint16_t i = 0; i < size; ++i ) data[i] = 0;
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_I2C_Mem_Write ( I2C_HandleTypeDef* hi2c,
+                                           uint16_t addr, uint16_t reg,
+                                           uint16_t reg_size, uint8_t* data,
+                                           uint16_t size, uint32_t timeout )
+	{
+	(void) hi2c; (void) addr; (void) reg; (void) reg_size; (void) data;
+	(void) size; (void) timeout;
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_I2C_Mem_Read_IT ( I2C_HandleTypeDef* hi2c,
+                                             uint16_t addr, uint16_t reg,
+                                             uint16_t reg_size, uint8_t* data,
+                                             uint16_t size )
+	{
+	(void) hi2c; (void) addr; (void) reg; (void) reg_size; (void) data;
+	(void) size;
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_I2C_Mem_Write_IT ( I2C_HandleTypeDef* hi2c,
+                                              uint16_t addr, uint16_t reg,
+                                              uint16_t reg_size, uint8_t* data,
+                                              uint16_t size )
+	{
+	(void) hi2c; (void) addr; (void) reg; (void) reg_size; (void) data;
+	(void) size;
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_I2C_Master_Transmit ( I2C_HandleTypeDef* hi2c,
+                                                 uint16_t addr, uint8_t* data,
+                                                 uint16_t size,
+                                                 uint32_t timeout )
+	{
+	(void) hi2c; (void) addr; (void) data; (void) size; (void) timeout;
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_I2C_Master_Receive ( I2C_HandleTypeDef* hi2c,
+                                                uint16_t addr, uint8_t* data,
+                                                uint16_t size,
+                                                uint32_t timeout )
+	{
+	(void) hi2c; (void) addr; (void) timeout;
+	for ( uint16_t i = 0; i < size; ++i ) data[i] = 0;
+	return HAL_OK;
+	}
+
+
+/*------------------------------------------------------------------------------
+ SPI
+------------------------------------------------------------------------------*/
+WEAK HAL_StatusTypeDef HAL_SPI_Transmit ( SPI_HandleTypeDef* hspi,
+                                          uint8_t* data, uint16_t size,
+                                          uint32_t timeout )
+	{ (void) hspi; (void) data; (void) size; (void) timeout; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_SPI_Receive ( SPI_HandleTypeDef* hspi,
+                                         uint8_t* data, uint16_t size,
+                                         uint32_t timeout )
+	{
+	(void) hspi; (void) timeout;
+	for ( uint16_t i = 0; i < size; ++i ) data[i] = 0;
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_SPI_TransmitReceive ( SPI_HandleTypeDef* hspi,
+                                                 uint8_t* tx_data,
+                                                 uint8_t* rx_data,
+                                                 uint16_t size,
+                                                 uint32_t timeout )
+	{
+	(void) hspi; (void) tx_data; (void) timeout;
+	for ( uint16_t i = 0; i < size; ++i ) rx_data[i] = 0;
+	return HAL_OK;
+	}
+
+
+/*------------------------------------------------------------------------------
+ Timers
+------------------------------------------------------------------------------*/
+WEAK HAL_StatusTypeDef HAL_TIM_Base_Start ( TIM_HandleTypeDef* htim )
+	{ htim -> Instance -> CR1 |= TIM_CR1_CEN; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_Base_Stop ( TIM_HandleTypeDef* htim )
+	{ htim -> Instance -> CR1 &= ~TIM_CR1_CEN; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_Base_Start_IT ( TIM_HandleTypeDef* htim )
+	{
+	htim -> Instance -> DIER |= TIM_IT_UPDATE;
+	htim -> Instance -> CR1  |= TIM_CR1_CEN;
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_TIM_Base_Stop_IT ( TIM_HandleTypeDef* htim )
+	{
+	htim -> Instance -> DIER &= ~TIM_IT_UPDATE;
+	htim -> Instance -> CR1  &= ~TIM_CR1_CEN;
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_TIM_PWM_Start ( TIM_HandleTypeDef* htim,
+                                           uint32_t channel )
+	{ (void) channel; htim -> Instance -> CR1 |= TIM_CR1_CEN; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_PWM_Stop ( TIM_HandleTypeDef* htim,
+                                          uint32_t channel )
+	{ (void) channel; htim -> Instance -> CR1 &= ~TIM_CR1_CEN; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_OC_Start_IT ( TIM_HandleTypeDef* htim,
+                                             uint32_t channel )
+	{ (void) htim; (void) channel; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_OC_Stop_IT ( TIM_HandleTypeDef* htim,
+                                            uint32_t channel )
+	{ (void) htim; (void) channel; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_Encoder_Start ( TIM_HandleTypeDef* htim,
+                                               uint32_t channel )
+	{ (void) htim; (void) channel; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_Encoder_Stop ( TIM_HandleTypeDef* htim,
+                                              uint32_t channel )
+	{ (void) htim; (void) channel; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_GenerateEvent ( TIM_HandleTypeDef* htim,
+                                               uint32_t event )
+	{
+	if ( event & TIM_EVENTSOURCE_UPDATE )
+		{
+		htim -> Instance -> CNT = 0;
+		htim -> Instance -> SR |= TIM_FLAG_UPDATE;
+		}
+	return HAL_OK;
+	}
+
+WEAK HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization
+	( TIM_HandleTypeDef* htim, TIM_MasterConfigTypeDef* config )
+	{ (void) htim; (void) config; return HAL_OK; }
+
+WEAK HAL_StatusTypeDef HAL_TIM_SlaveConfigSynchro
+	( TIM_HandleTypeDef* htim, TIM_SlaveConfigTypeDef* config )
+	{
+	htim -> Instance -> SMCR = config -> SlaveMode | config -> InputTrigger;
+	return HAL_OK;
+	}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,51 @@
+/*******************************************************************************
+*
+* FILE:
+* 		main.h
+*
+* DESCRIPTION:
+* 		Host stand-in for the board main.h. Declares the peripheral handles
+*       and board-wide settings the modules expect from the application
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef MAIN_H
+#define MAIN_H
+
+#include "stm32h7xx_hal.h"
+
+
+/*------------------------------------------------------------------------------
+ Peripheral handles, defined in hal_stub.c
+------------------------------------------------------------------------------*/
+extern I2C_HandleTypeDef  hi2c1;
+extern SPI_HandleTypeDef  hspi1;
+extern UART_HandleTypeDef huart1;
+extern UART_HandleTypeDef huart2;
+extern UART_HandleTypeDef huart3;
+extern TIM_HandleTypeDef  htim1;
+extern TIM_HandleTypeDef  htim2;
+extern TIM_HandleTypeDef  htim3;
+extern TIM_HandleTypeDef  htim4;
+extern TIM_HandleTypeDef  htim5;
+extern TIM_HandleTypeDef  htim6;
+extern GPIO_TypeDef       stub_gpio;
+
+
+/*------------------------------------------------------------------------------
+ Board settings
+------------------------------------------------------------------------------*/
+#define HAL_DEFAULT_TIMEOUT         ( 1 )
+#define HAL_SENSOR_TIMEOUT          ( 1 )
+#define USB_HUART                   huart1
+#define RS485_HUART                 huart2
+#define VALVE_HUART                 huart3
+
+
+#endif /* MAIN_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
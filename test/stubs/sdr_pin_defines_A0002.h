@@ -0,0 +1,8 @@
+/* Host stand-in for the flight computer (A0002) pin definitions */
+#ifndef SDR_PIN_DEFINES_A0002_H
+#define SDR_PIN_DEFINES_A0002_H
+
+#define IMU_I2C                     hi2c1
+#define BARO_I2C                    hi2c1
+
+#endif /* SDR_PIN_DEFINES_A0002_H */
@@ -0,0 +1,20 @@
+/* Host stand-in for the ground station (A0005) pin definitions */
+#ifndef SDR_PIN_DEFINES_A0005_H
+#define SDR_PIN_DEFINES_A0005_H
+
+#define XBEE_HUART                  huart3
+#define XBEE_CTS_GPIO_PORT          ( &stub_gpio )
+#define XBEE_CTS_PIN                ( 1U << 0 )
+#define XBEE_RTS_GPIO_PORT          ( &stub_gpio )
+#define XBEE_RTS_PIN                ( 1U << 1 )
+#define RS485_SLOT_TIM              htim6
+#define RS485_DE_GPIO_PORT          ( &stub_gpio )
+#define RS485_DE_PIN                ( 1U << 2 )
+#define LORA_SPI                    hspi1
+#define LORA_SS_GPIO_PORT           ( &stub_gpio )
+#define LORA_SS_PIN                 ( 1U << 3 )
+#define LORA_RST_GPIO_PORT          ( &stub_gpio )
+#define LORA_RST_PIN                ( 1U << 4 )
+#define LORA_DIO0_IRQn              ( 10 )
+
+#endif /* SDR_PIN_DEFINES_A0005_H */
@@ -0,0 +1,8 @@
+/* Host stand-in for the flight computer lite (A0007) pin definitions */
+#ifndef SDR_PIN_DEFINES_A0007_H
+#define SDR_PIN_DEFINES_A0007_H
+
+#define IMU_I2C                     hi2c1
+#define BARO_I2C                    hi2c1
+
+#endif /* SDR_PIN_DEFINES_A0007_H */
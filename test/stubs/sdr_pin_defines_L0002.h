@@ -0,0 +1,10 @@
+/* Host stand-in for the engine controller (L0002) pin definitions */
+#ifndef SDR_PIN_DEFINES_L0002_H
+#define SDR_PIN_DEFINES_L0002_H
+
+#define THERMO_I2C                  hi2c1
+#define RS485_SLOT_TIM              htim6
+#define RS485_DE_GPIO_PORT          ( &stub_gpio )
+#define RS485_DE_PIN                ( 1U << 2 )
+
+#endif /* SDR_PIN_DEFINES_L0002_H */
@@ -0,0 +1,49 @@
+/* Host stand-in for the valve controller (L0005) pin definitions */
+#ifndef SDR_PIN_DEFINES_L0005_H
+#define SDR_PIN_DEFINES_L0005_H
+
+/* Step, encoder and trace timers */
+#define VALVE_LOX_TIM               htim1
+#define VALVE_LOX_TIM_CHANNEL       TIM_CHANNEL_1
+#define VALVE_FUEL_TIM              htim2
+#define VALVE_FUEL_TIM_CHANNEL      TIM_CHANNEL_1
+#define VALVE_LOX_ENC_TIM           htim3
+#define VALVE_FUEL_ENC_TIM          htim4
+#define VALVE_TRACE_TIM             htim5
+#define VALVE_SYNC_ITR              TIM_TS_ITR0
+
+/* Step timer clock, motor resolution and default motion profile */
+#define VALVE_STEP_TIM_FREQ         ( 1000000 )
+#define VALVE_STEPS_PER_REV         ( 3200.0f )
+#define VALVE_DEFAULT_START_RATE    ( 400.0f   )
+#define VALVE_DEFAULT_MAX_RATE      ( 4000.0f  )
+#define VALVE_DEFAULT_ACCEL         ( 20000.0f )
+
+/* Encoder channels */
+#define LOX_ENC_GPIO_PORT           ( &stub_gpio )
+#define LOX_ENC_A_PIN               ( 1U << 0 )
+#define LOX_ENC_B_PIN               ( 1U << 1 )
+#define KER_ENC_GPIO_PORT           ( &stub_gpio )
+#define KER_ENC_A_PIN               ( 1U << 2 )
+#define KER_ENC_B_PIN               ( 1U << 3 )
+
+/* Photogates */
+#define PHOTOGATE_GPIO_PORT         ( &stub_gpio )
+#define LOX_PHOTOGATE_PIN           ( 1U << 4 )
+#define FUEL_PHOTOGATE_PIN          ( 1U << 5 )
+
+/* Stepper drivers */
+#define LOX_EN_GPIO_PORT            ( &stub_gpio )
+#define LOX_EN_PIN                  ( 1U << 6 )
+#define KER_EN_GPIO_PORT            ( &stub_gpio )
+#define KER_EN_PIN                  ( 1U << 7 )
+#define LOX_DIR_GPIO_PORT           ( &stub_gpio )
+#define LOX_DIR_PIN                 ( 1U << 8 )
+#define KER_DIR_GPIO_PORT           ( &stub_gpio )
+#define KER_DIR_PIN                 ( 1U << 9 )
+
+/* USB detect */
+#define USB_DETECT_GPIO_PORT        ( &stub_gpio )
+#define USB_DETECT_PIN              ( 1U << 10 )
+
+#endif /* SDR_PIN_DEFINES_L0005_H */
@@ -0,0 +1,324 @@
+/*******************************************************************************
+*
+* FILE:
+* 		stm32h7xx_hal.h
+*
+* DESCRIPTION:
+* 		Host stand-in for the STM32H7 HAL. Declares only the types, macros and
+*       functions the firmware modules use, with peripheral registers reduced
+*       to plain structs that tests can read and drive. Default function
+*       bodies live in hal_stub.c and are weak so a test can override any of
+*       them
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32H7XX_HAL_H
+#define STM32H7XX_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*------------------------------------------------------------------------------
+ Core
+------------------------------------------------------------------------------*/
+typedef enum
+	{
+	HAL_OK      = 0x00,
+	HAL_ERROR   = 0x01,
+	HAL_BUSY    = 0x02,
+	HAL_TIMEOUT = 0x03
+	} HAL_StatusTypeDef;
+
+typedef int32_t IRQn_Type;
+
+typedef struct
+	{
+	volatile uint32_t DEMCR;
+	} CoreDebug_Type;
+
+typedef struct
+	{
+	volatile uint32_t CTRL;
+	volatile uint32_t CYCCNT;
+	volatile uint32_t LAR;
+	} DWT_Type;
+
+extern CoreDebug_Type* CoreDebug;
+extern DWT_Type*       DWT;
+extern uint32_t        SystemCoreClock;
+
+#define CoreDebug_DEMCR_TRCENA_Msk  ( 1UL << 24 )
+#define DWT_CTRL_CYCCNTENA_Msk      ( 1UL       )
+#define HAL_MAX_DELAY               ( 0xFFFFFFFFU )
+#define __DCACHE_PRESENT            ( 1U )
+
+uint32_t HAL_GetTick         ( void );
+void     HAL_Delay           ( uint32_t delay );
+void     HAL_NVIC_EnableIRQ  ( IRQn_Type irqn );
+void     HAL_NVIC_DisableIRQ ( IRQn_Type irqn );
+void     __disable_irq       ( void );
+void     __enable_irq        ( void );
+uint32_t __get_PRIMASK       ( void );
+void     __set_PRIMASK       ( uint32_t primask );
+void     __DMB               ( void );
+void     SCB_InvalidateDCache_by_Addr ( void* addr, int32_t size );
+void     SCB_CleanDCache_by_Addr      ( void* addr, int32_t size );
+
+
+/*------------------------------------------------------------------------------
+ GPIO
+------------------------------------------------------------------------------*/
+typedef struct
+	{
+	volatile uint32_t IDR;
+	volatile uint32_t ODR;
+	volatile uint32_t BSRR;
+	} GPIO_TypeDef;
+
+typedef enum
+	{
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+	} GPIO_PinState;
+
+GPIO_PinState HAL_GPIO_ReadPin  ( GPIO_TypeDef* port, uint16_t pin );
+void          HAL_GPIO_WritePin ( GPIO_TypeDef* port, uint16_t pin,
+                                  GPIO_PinState state );
+void          HAL_GPIO_TogglePin( GPIO_TypeDef* port, uint16_t pin );
+
+
+/*------------------------------------------------------------------------------
+ DMA
+------------------------------------------------------------------------------*/
+typedef struct
+	{
+	volatile uint32_t NDTR;     /* Remaining transfer count */
+	void*             Instance;
+	} DMA_HandleTypeDef;
+
+#define __HAL_DMA_GET_COUNTER( h )  ( ( h )->NDTR )
+
+
+/*------------------------------------------------------------------------------
+ UART
+------------------------------------------------------------------------------*/
+typedef struct
+	{
+	void*              Instance;
+	DMA_HandleTypeDef* hdmarx;
+	DMA_HandleTypeDef* hdmatx;
+	volatile uint32_t  gState;
+	volatile uint32_t  RxState;
+	volatile uint32_t  ErrorCode;
+	volatile uint32_t  ISR;
+	} UART_HandleTypeDef;
+
+#define HAL_UART_STATE_RESET        ( 0x00U )
+#define HAL_UART_STATE_READY        ( 0x20U )
+#define HAL_UART_STATE_BUSY_TX      ( 0x21U )
+#define HAL_UART_STATE_BUSY_RX      ( 0x22U )
+
+#define HAL_UART_ERROR_NONE         ( 0x00U )
+#define HAL_UART_ERROR_PE           ( 0x01U )
+#define HAL_UART_ERROR_NE           ( 0x02U )
+#define HAL_UART_ERROR_FE           ( 0x04U )
+#define HAL_UART_ERROR_ORE          ( 0x08U )
+#define HAL_UART_ERROR_DMA          ( 0x10U )
+#define HAL_UART_ERROR_RTO          ( 0x20U )
+
+#define UART_FLAG_RXNE              ( 1U << 5 )
+#define __HAL_UART_GET_FLAG( h, f ) ( ( ( h )->ISR & ( f ) ) == ( f ) )
+
+HAL_StatusTypeDef HAL_UART_Transmit     ( UART_HandleTypeDef* huart,
+                                          const uint8_t* data, uint16_t size,
+                                          uint32_t timeout );
+HAL_StatusTypeDef HAL_UART_Receive      ( UART_HandleTypeDef* huart,
+                                          uint8_t* data, uint16_t size,
+                                          uint32_t timeout );
+HAL_StatusTypeDef HAL_UART_Transmit_IT  ( UART_HandleTypeDef* huart,
+                                          const uint8_t* data, uint16_t size );
+HAL_StatusTypeDef HAL_UART_Receive_IT   ( UART_HandleTypeDef* huart,
+                                          uint8_t* data, uint16_t size );
+HAL_StatusTypeDef HAL_UART_Transmit_DMA ( UART_HandleTypeDef* huart,
+                                          const uint8_t* data, uint16_t size );
+HAL_StatusTypeDef HAL_UART_AbortTransmit( UART_HandleTypeDef* huart );
+HAL_StatusTypeDef HAL_UART_AbortReceive ( UART_HandleTypeDef* huart );
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA
+                                        ( UART_HandleTypeDef* huart,
+                                          uint8_t* data, uint16_t size );
+
+
+/*------------------------------------------------------------------------------
+ I2C
+------------------------------------------------------------------------------*/
+typedef struct
+	{
+	void* Instance;
+	} I2C_HandleTypeDef;
+
+#define I2C_MEMADD_SIZE_8BIT        ( 1U )
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read        ( I2C_HandleTypeDef* hi2c,
+                                            uint16_t addr, uint16_t reg,
+                                            uint16_t reg_size, uint8_t* data,
+                                            uint16_t size, uint32_t timeout );
+HAL_StatusTypeDef HAL_I2C_Mem_Write       ( I2C_HandleTypeDef* hi2c,
+                                            uint16_t addr, uint16_t reg,
+                                            uint16_t reg_size, uint8_t* data,
+                                            uint16_t size, uint32_t timeout );
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT     ( I2C_HandleTypeDef* hi2c,
+                                            uint16_t addr, uint16_t reg,
+                                            uint16_t reg_size, uint8_t* data,
+                                            uint16_t size );
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT    ( I2C_HandleTypeDef* hi2c,
+                                            uint16_t addr, uint16_t reg,
+                                            uint16_t reg_size, uint8_t* data,
+                                            uint16_t size );
+HAL_StatusTypeDef HAL_I2C_Master_Transmit ( I2C_HandleTypeDef* hi2c,
+                                            uint16_t addr, uint8_t* data,
+                                            uint16_t size, uint32_t timeout );
+HAL_StatusTypeDef HAL_I2C_Master_Receive  ( I2C_HandleTypeDef* hi2c,
+                                            uint16_t addr, uint8_t* data,
+                                            uint16_t size, uint32_t timeout );
+
+
+/*------------------------------------------------------------------------------
+ SPI
+------------------------------------------------------------------------------*/
+typedef struct
+	{
+	void* Instance;
+	} SPI_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_SPI_Transmit        ( SPI_HandleTypeDef* hspi,
+                                            uint8_t* data, uint16_t size,
+                                            uint32_t timeout );
+HAL_StatusTypeDef HAL_SPI_Receive         ( SPI_HandleTypeDef* hspi,
+                                            uint8_t* data, uint16_t size,
+                                            uint32_t timeout );
+HAL_StatusTypeDef HAL_SPI_TransmitReceive ( SPI_HandleTypeDef* hspi,
+                                            uint8_t* tx_data, uint8_t* rx_data,
+                                            uint16_t size, uint32_t timeout );
+
+
+/*------------------------------------------------------------------------------
+ Timers
+------------------------------------------------------------------------------*/
+typedef struct
+	{
+	volatile uint32_t CR1;
+	volatile uint32_t SMCR;
+	volatile uint32_t DIER;
+	volatile uint32_t SR;
+	volatile uint32_t EGR;
+	volatile uint32_t CNT;
+	volatile uint32_t ARR;
+	volatile uint32_t CCR1;
+	volatile uint32_t CCR2;
+	volatile uint32_t CCR3;
+	volatile uint32_t CCR4;
+	} TIM_TypeDef;
+
+typedef struct
+	{
+	TIM_TypeDef* Instance;
+	uint32_t     Channel;
+	} TIM_HandleTypeDef;
+
+typedef struct
+	{
+	uint32_t MasterOutputTrigger;
+	uint32_t MasterOutputTrigger2;
+	uint32_t MasterSlaveMode;
+	} TIM_MasterConfigTypeDef;
+
+typedef struct
+	{
+	uint32_t SlaveMode;
+	uint32_t InputTrigger;
+	uint32_t TriggerPolarity;
+	uint32_t TriggerPrescaler;
+	uint32_t TriggerFilter;
+	} TIM_SlaveConfigTypeDef;
+
+#define TIM_CHANNEL_1               ( 0x00U )
+#define TIM_CHANNEL_2               ( 0x04U )
+#define TIM_CHANNEL_3               ( 0x08U )
+#define TIM_CHANNEL_4               ( 0x0CU )
+#define TIM_CHANNEL_ALL             ( 0x3CU )
+#define TIM_IT_UPDATE               ( 1U << 0 )
+#define TIM_IT_CC1                  ( 1U << 1 )
+#define TIM_IT_CC2                  ( 1U << 2 )
+#define TIM_IT_CC3                  ( 1U << 3 )
+#define TIM_IT_CC4                  ( 1U << 4 )
+#define TIM_FLAG_UPDATE             ( 1U << 0 )
+#define TIM_FLAG_CC1                ( 1U << 1 )
+#define TIM_FLAG_CC2                ( 1U << 2 )
+#define TIM_FLAG_CC3                ( 1U << 3 )
+#define TIM_FLAG_CC4                ( 1U << 4 )
+#define TIM_CR1_CEN                 ( 1U << 0 )
+#define TIM_CR1_ARPE                ( 1U << 7 )
+#define TIM_EVENTSOURCE_UPDATE      ( 1U << 0 )
+#define TIM_TRGO_RESET              ( 0x00U )
+#define TIM_TRGO_ENABLE             ( 0x10U )
+#define TIM_TRGO2_RESET             ( 0x00U )
+#define TIM_MASTERSLAVEMODE_DISABLE ( 0x00U )
+#define TIM_MASTERSLAVEMODE_ENABLE  ( 0x80U )
+#define TIM_SLAVEMODE_DISABLE       ( 0x00U )
+#define TIM_SLAVEMODE_TRIGGER       ( 0x06U )
+#define TIM_TRIGGERPOLARITY_RISING  ( 0x00U )
+#define TIM_TRIGGERPRESCALER_DIV1   ( 0x00U )
+#define TIM_TS_ITR0                 ( 0x00U )
+#define TIM_TS_ITR1                 ( 0x10U )
+#define TIM_TS_ITR2                 ( 0x20U )
+#define TIM_TS_ITR3                 ( 0x30U )
+
+#define __HAL_TIM_GET_COUNTER( h )        ( ( h )->Instance->CNT )
+#define __HAL_TIM_SET_COUNTER( h, v )     ( ( h )->Instance->CNT = ( v ) )
+#define __HAL_TIM_GET_AUTORELOAD( h )     ( ( h )->Instance->ARR )
+#define __HAL_TIM_SET_AUTORELOAD( h, v )  ( ( h )->Instance->ARR = ( v ) )
+#define __HAL_TIM_SET_COMPARE( h, c, v )  \
+	( *( &( h )->Instance->CCR1 + ( ( c ) >> 2 ) ) = ( v ) )
+#define __HAL_TIM_GET_COMPARE( h, c )     \
+	( *( &( h )->Instance->CCR1 + ( ( c ) >> 2 ) ) )
+#define __HAL_TIM_ENABLE_IT( h, i )       ( ( h )->Instance->DIER |= ( i ) )
+#define __HAL_TIM_DISABLE_IT( h, i )      ( ( h )->Instance->DIER &= ~( i ) )
+#define __HAL_TIM_GET_FLAG( h, f )        ( ( ( h )->Instance->SR & ( f ) ) == ( f ) )
+#define __HAL_TIM_CLEAR_FLAG( h, f )      ( ( h )->Instance->SR &= ~( f ) )
+#define __HAL_TIM_ENABLE( h )             ( ( h )->Instance->CR1 |= TIM_CR1_CEN )
+#define __HAL_TIM_DISABLE( h )            ( ( h )->Instance->CR1 &= ~TIM_CR1_CEN )
+
+HAL_StatusTypeDef HAL_TIM_Base_Start      ( TIM_HandleTypeDef* htim );
+HAL_StatusTypeDef HAL_TIM_Base_Stop       ( TIM_HandleTypeDef* htim );
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT   ( TIM_HandleTypeDef* htim );
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT    ( TIM_HandleTypeDef* htim );
+HAL_StatusTypeDef HAL_TIM_PWM_Start       ( TIM_HandleTypeDef* htim,
+                                            uint32_t channel );
+HAL_StatusTypeDef HAL_TIM_PWM_Stop        ( TIM_HandleTypeDef* htim,
+                                            uint32_t channel );
+HAL_StatusTypeDef HAL_TIM_OC_Start_IT     ( TIM_HandleTypeDef* htim,
+                                            uint32_t channel );
+HAL_StatusTypeDef HAL_TIM_OC_Stop_IT      ( TIM_HandleTypeDef* htim,
+                                            uint32_t channel );
+HAL_StatusTypeDef HAL_TIM_Encoder_Start   ( TIM_HandleTypeDef* htim,
+                                            uint32_t channel );
+HAL_StatusTypeDef HAL_TIM_Encoder_Stop    ( TIM_HandleTypeDef* htim,
+                                            uint32_t channel );
+HAL_StatusTypeDef HAL_TIM_GenerateEvent   ( TIM_HandleTypeDef* htim,
+                                            uint32_t event );
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization
+                                          ( TIM_HandleTypeDef* htim,
+                                            TIM_MasterConfigTypeDef* config );
+HAL_StatusTypeDef HAL_TIM_SlaveConfigSynchro
+                                          ( TIM_HandleTypeDef* htim,
+                                            TIM_SlaveConfigTypeDef* config );
+
+
+#endif /* STM32H7XX_HAL_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
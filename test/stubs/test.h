@@ -0,0 +1,46 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test.h
+*
+* DESCRIPTION:
+* 		Minimal check macros shared by the host tests. A failed check prints
+*       its location and message and is counted; TEST_EXIT reports the total
+*       and turns it into the process exit status
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define TEST_CHECK( cond, ... )                                               \
+	do                                                                        \
+		{                                                                     \
+		if ( !( cond ) )                                                      \
+			{                                                                 \
+			printf( "%s:%d: FAIL: ", __FILE__, __LINE__ );                    \
+			printf( __VA_ARGS__ );                                            \
+			printf( "\n" );                                                   \
+			test_failures++;                                                  \
+			}                                                                 \
+		} while ( 0 )
+
+#define TEST_EXIT( name )                                                     \
+	do                                                                        \
+		{                                                                     \
+		printf( "%s: %s\n", ( name ), test_failures ? "FAILED" : "passed" );  \
+		return test_failures ? 1 : 0;                                         \
+		} while ( 0 )
+
+
+#endif /* TEST_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
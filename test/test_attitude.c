@@ -0,0 +1,210 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_attitude.c
+*
+* DESCRIPTION:
+* 		Host test for the Mahony attitude estimator. Checks that the filter
+*       holds a level attitude, converges to a tilted gravity vector and
+*       integrates a known body rate, then benchmarks attitude_update and
+*       fails if it exceeds the host time budget
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <math.h>
+#include <time.h>
+#include "test.h"
+#include "../attitude/attitude.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Gyro ODR under test and its sample rate */
+#define TEST_ODR                    IMU_ODR_1K6
+#define TEST_RATE_HZ                ( 1600.0f )
+
+/* Host time budget for one update. On target the update has to fit in a
+   fraction of the 625 us sample period next to logging; the estimator is a
+   fixed sequence of about 60 multiply-adds and two sqrtf, which takes well
+   under 100 ns on a desktop. Anything above the budget means a loop, a
+   division chain or a transcendental call has crept into the update */
+#define TEST_BUDGET_NS              ( 500.0 )
+
+#define TEST_BENCH_SAMPLES          ( 2000000 )
+#define TEST_BENCH_RUNS             ( 5 )
+
+#define GRAVITY                     ( 9.80665f )
+
+
+/*------------------------------------------------------------------------------
+ Helpers
+------------------------------------------------------------------------------*/
+
+/* Gravity direction predicted by the current attitude, body frame */
+static void predicted_gravity
+	(
+	const ATTITUDE_STATE* s,
+	float                 g[3]
+	)
+{
+g[0] = 2.0f*( s -> q1*s -> q3 - s -> q0*s -> q2 );
+g[1] = 2.0f*( s -> q0*s -> q1 + s -> q2*s -> q3 );
+g[2] = s -> q0*s -> q0 - s -> q1*s -> q1 - s -> q2*s -> q2 + s -> q3*s -> q3;
+}
+
+static double now_ns
+	(
+	void
+	)
+{
+struct timespec ts;
+clock_gettime( CLOCK_MONOTONIC, &ts );
+return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* A level, stationary IMU must leave the identity quaternion untouched */
+static void test_level
+	(
+	void
+	)
+{
+IMU_SI_DATA    sample = { 0.0f, 0.0f, GRAVITY };
+ATTITUDE_STATE state;
+
+attitude_reset();
+for ( int i = 0; i < 1600; ++i )
+	{
+	attitude_update( &sample );
+	}
+attitude_get_state( &state );
+TEST_CHECK( fabsf( state.q0 - 1.0f ) < 1e-6f && fabsf( state.q1 ) < 1e-6f &&
+            fabsf( state.q2 ) < 1e-6f && fabsf( state.q3 ) < 1e-6f,
+            "level attitude drifted to %f %f %f %f",
+            state.q0, state.q1, state.q2, state.q3 );
+}
+
+/* Starting level, a 30 degree tilt in the accelerometer must be tracked
+   within half a degree after twenty seconds. With 2*Kp = 1 the loop time
+   constant is two seconds */
+static void test_tilt_convergence
+	(
+	void
+	)
+{
+const float    tilt   = 30.0f*(float) M_PI/180.0f;
+IMU_SI_DATA    sample = { 0.0f, GRAVITY*sinf( tilt ), GRAVITY*cosf( tilt ) };
+ATTITUDE_STATE state;
+float          g[3];
+float          err_deg;
+
+attitude_reset();
+for ( int i = 0; i < 20*1600; ++i )
+	{
+	attitude_update( &sample );
+	}
+attitude_get_state( &state );
+predicted_gravity( &state, g );
+err_deg = acosf( fminf( 1.0f, g[1]*sinf( tilt ) + g[2]*cosf( tilt ) ) )*
+          180.0f/(float) M_PI;
+TEST_CHECK( err_deg < 0.5f, "tilt error %.3f deg after 20 s", err_deg );
+}
+
+/* A yaw rate about the gravity axis gets no accelerometer correction, so
+   one second at 1 rad/s must integrate to one radian of yaw */
+static void test_rate_integration
+	(
+	void
+	)
+{
+IMU_SI_DATA    sample = { 0.0f, 0.0f, GRAVITY, 0.0f, 0.0f, 1.0f };
+ATTITUDE_STATE state;
+float          yaw;
+
+attitude_reset();
+for ( int i = 0; i < 1600; ++i )
+	{
+	attitude_update( &sample );
+	}
+attitude_get_state( &state );
+yaw = 2.0f*atan2f( state.q3, state.q0 );
+TEST_CHECK( fabsf( yaw - 1.0f ) < 1e-3f, "integrated yaw %.5f rad", yaw );
+TEST_CHECK( state.rate_z == 1.0f, "exported rate %f", state.rate_z );
+}
+
+/* Time per update, best of several runs to reject scheduler noise */
+static void test_update_budget
+	(
+	void
+	)
+{
+static IMU_SI_DATA samples[256];
+double             best_ns = 1e30;
+double             start;
+double             per_update;
+
+for ( int i = 0; i < 256; ++i )
+	{
+	samples[i].accel_x = 0.3f*sinf( 0.1f*i );
+	samples[i].accel_y = 0.2f*cosf( 0.07f*i );
+	samples[i].accel_z = GRAVITY;
+	samples[i].gyro_x  = 0.5f*sinf( 0.05f*i );
+	samples[i].gyro_y  = 0.1f;
+	samples[i].gyro_z  = -0.2f;
+	}
+
+for ( int run = 0; run < TEST_BENCH_RUNS; ++run )
+	{
+	attitude_reset();
+	start = now_ns();
+	for ( int i = 0; i < TEST_BENCH_SAMPLES; ++i )
+		{
+		attitude_update( &samples[i & 255] );
+		}
+	per_update = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+	if ( per_update < best_ns )
+		{
+		best_ns = per_update;
+		}
+	}
+
+printf( "attitude_update: %.1f ns per update on the host "
+        "(%.2f%% of one %.0f Hz period)\n",
+        best_ns, 100.0*best_ns*TEST_RATE_HZ/1e9, TEST_RATE_HZ );
+TEST_CHECK( best_ns < TEST_BUDGET_NS, "update took %.1f ns, budget %.0f ns",
+            best_ns, TEST_BUDGET_NS );
+}
+
+
+int main
+	(
+	void
+	)
+{
+IMU_CONFIG config = { 0 };
+
+config.gyro_odr = TEST_ODR;
+TEST_CHECK( attitude_init( &config ) == ATTITUDE_OK, "attitude_init failed" );
+
+test_level();
+test_tilt_convergence();
+test_rate_integration();
+test_update_budget();
+
+TEST_EXIT( "test_attitude" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,172 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_baro_altitude.c
+*
+* DESCRIPTION:
+* 		Host test for the table based pressure to altitude conversion. Sweeps
+*       0 to 30 km above three ground references against the barometric
+*       formula in double precision, checks the ratio clamps, then compares
+*       the cost per sample with the powf implementation it replaced
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <math.h>
+#include <time.h>
+#include "test.h"
+#include "../baro/baro.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Documented interpolation error of baro_press_to_altitude */
+#define TEST_ALT_TOLERANCE_M        ( 0.06 )
+
+#define TEST_ALT_MAX_M              ( 30000.0 )
+#define TEST_PRESS_STEP_PA          ( 0.05 )
+
+#define TEST_BENCH_SAMPLES          ( 20000000 )
+
+
+/*------------------------------------------------------------------------------
+ Helpers
+------------------------------------------------------------------------------*/
+static double ref_altitude
+	(
+	double pressure,
+	double ref_pressure
+	)
+{
+return BARO_ALT_SCALE*( 1.0 - pow( pressure/ref_pressure, BARO_ALT_EXPONENT ) );
+}
+
+static double now_ns
+	(
+	void
+	)
+{
+struct timespec ts;
+clock_gettime( CLOCK_MONOTONIC, &ts );
+return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Sea level, a high desert pad and a mountain site, each from 2% below
+   ground up to 30 km */
+static void test_accuracy
+	(
+	void
+	)
+{
+static const float grounds[] = { 101325.0f, 95000.0f, 84000.0f };
+double             worst_table = 0.0;
+double             worst_powf  = 0.0;
+double             worst_press = 0.0;
+double             ref;
+double             err;
+float              p0;
+
+for ( size_t g = 0; g < sizeof( grounds )/sizeof( grounds[0] ); ++g )
+	{
+	p0 = grounds[g];
+	for ( double p = 900.0; p <= p0*1.02; p += TEST_PRESS_STEP_PA )
+		{
+		ref = ref_altitude( (float) p, p0 );
+		if ( ref > TEST_ALT_MAX_M )
+			{
+			continue;
+			}
+		err = fabs( baro_press_to_altitude( (float) p, p0 ) - ref );
+		if ( err > worst_table )
+			{
+			worst_table = err;
+			worst_press = p;
+			}
+		err = fabs( BARO_ALT_SCALE*
+		            ( 1.0f - powf( (float) p/p0, BARO_ALT_EXPONENT ) ) - ref );
+		worst_powf = fmax( worst_powf, err );
+		}
+	}
+
+printf( "baro altitude: worst error %.4f m (at %.1f Pa), powf %.4f m\n",
+        worst_table, worst_press, worst_powf );
+TEST_CHECK( worst_table < TEST_ALT_TOLERANCE_M, "altitude error %.4f m",
+            worst_table );
+}
+
+/* Out of range ratios clamp instead of indexing past the tables */
+static void test_clamp
+	(
+	void
+	)
+{
+float low  = baro_press_to_altitude( 0.0f, 101325.0f );
+float high = baro_press_to_altitude( 1e7f, 101325.0f );
+float nan  = baro_press_to_altitude( NAN , 101325.0f );
+
+TEST_CHECK( fabs( low - ref_altitude( BARO_ALT_RATIO_MIN, 1.0 ) ) < 1.0,
+            "zero pressure gives %f m", low );
+TEST_CHECK( fabs( high - ref_altitude( BARO_ALT_RATIO_MAX, 1.0 ) ) < 1.0,
+            "overpressure gives %f m", high );
+TEST_CHECK( nan == low, "NaN pressure gives %f m", nan );
+TEST_CHECK( baro_press_to_altitude( 101325.0f, 101325.0f ) == 0.0f,
+            "ground reference is not zero altitude" );
+}
+
+/* Cost per sample against the powf formula */
+static void test_benchmark
+	(
+	void
+	)
+{
+volatile float sink = 0.0f;
+double         start;
+double         table_ns;
+double         powf_ns;
+
+start = now_ns();
+for ( int i = 0; i < TEST_BENCH_SAMPLES; ++i )
+	{
+	sink += baro_press_to_altitude( 1200.0f + i*0.005f, 101325.0f );
+	}
+table_ns = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+
+start = now_ns();
+for ( int i = 0; i < TEST_BENCH_SAMPLES; ++i )
+	{
+	sink += BARO_ALT_SCALE*( 1.0f - powf( ( 1200.0f + i*0.005f )/101325.0f,
+	                                      BARO_ALT_EXPONENT ) );
+	}
+powf_ns = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+
+printf( "baro altitude: %.2f ns per sample with tables, %.2f ns with powf\n",
+        table_ns, powf_ns );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_accuracy();
+test_clamp();
+test_benchmark();
+
+TEST_EXIT( "test_baro_altitude" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,308 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_baro_compensate.c
+*
+* DESCRIPTION:
+* 		Host test for the fixed-point BMP390 compensation. Loads coefficient
+*       sets through a register model of the calibration NVM and compares
+*       temp_compensate and press_compensate against the float formulas the
+*       driver used before, across -40..85 degC and 300..1250 hPa. Reports
+*       the cost per sample of both paths
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <math.h>
+#include <time.h>
+#include "test.h"
+#include "../baro/baro.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Documented tolerance against the float path. Temperature is quantized
+   to 0.01 degC; pressure comes out in 0.01 Pa */
+#define TEST_TEMP_TOLERANCE_C       ( 0.011 )
+#define TEST_PRESS_TOLERANCE_PA     ( 0.10  )
+
+/* Raw readout sweep steps, co-prime with the 24 bit range */
+#define TEST_TEMP_STEP              ( 9973 )
+#define TEST_PRESS_STEP             ( 1009 )
+
+#define TEST_BENCH_SAMPLES          ( 5000000 )
+
+
+/*------------------------------------------------------------------------------
+ Register model
+------------------------------------------------------------------------------*/
+static uint8_t  baro_regs[256];
+static uint32_t baro_reads;
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint16_t           reg,
+	uint16_t           reg_size,
+	uint8_t*           data,
+	uint16_t           size,
+	uint32_t           timeout
+	)
+{
+if ( addr != BARO_I2C_ADDR || reg + size > sizeof( baro_regs ) )
+	{
+	return HAL_ERROR;
+	}
+memcpy( data, &baro_regs[reg], size );
+baro_reads++;
+return HAL_OK;
+}
+
+/* Program the calibration NVM, little-endian as on the part */
+static void model_set_nvm
+	(
+	const BARO_CAL_DATA_INT* c
+	)
+{
+uint8_t* nvm = &baro_regs[BARO_REG_NVM_PAR_T1];
+
+nvm[0]  = (uint8_t) c -> par_t1;  nvm[1]  = (uint8_t) ( c -> par_t1 >> 8 );
+nvm[2]  = (uint8_t) c -> par_t2;  nvm[3]  = (uint8_t) ( c -> par_t2 >> 8 );
+nvm[4]  = (uint8_t) c -> par_t3;
+nvm[5]  = (uint8_t) c -> par_p1;  nvm[6]  = (uint8_t) ( (uint16_t) c -> par_p1 >> 8 );
+nvm[7]  = (uint8_t) c -> par_p2;  nvm[8]  = (uint8_t) ( (uint16_t) c -> par_p2 >> 8 );
+nvm[9]  = (uint8_t) c -> par_p3;
+nvm[10] = (uint8_t) c -> par_p4;
+nvm[11] = (uint8_t) c -> par_p5;  nvm[12] = (uint8_t) ( c -> par_p5 >> 8 );
+nvm[13] = (uint8_t) c -> par_p6;  nvm[14] = (uint8_t) ( c -> par_p6 >> 8 );
+nvm[15] = (uint8_t) c -> par_p7;
+nvm[16] = (uint8_t) c -> par_p8;
+nvm[17] = (uint8_t) c -> par_p9;  nvm[18] = (uint8_t) ( (uint16_t) c -> par_p9 >> 8 );
+nvm[19] = (uint8_t) c -> par_p10;
+nvm[20] = (uint8_t) c -> par_p11;
+}
+
+
+/*------------------------------------------------------------------------------
+ Float reference, the previous driver implementation
+------------------------------------------------------------------------------*/
+typedef struct _REF_CAL
+	{
+	float t1, t2, t3;
+	float p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11;
+	float comp_temp;
+	} REF_CAL;
+
+static REF_CAL ref;
+
+static void ref_load
+	(
+	const BARO_CAL_DATA_INT* c
+	)
+{
+ref.t1  = (float) c -> par_t1/0.00390625f;
+ref.t2  = (float) c -> par_t2/1073741824.0f;
+ref.t3  = (float) c -> par_t3/281474976710656.0f;
+ref.p1  = (float) ( c -> par_p1 - 16384 )/1048576.0f;
+ref.p2  = (float) ( c -> par_p2 - 16384 )/536870912.0f;
+ref.p3  = (float) c -> par_p3/4294967296.0f;
+ref.p4  = (float) c -> par_p4/137438953472.0f;
+ref.p5  = (float) c -> par_p5/0.125f;
+ref.p6  = (float) c -> par_p6/64.0f;
+ref.p7  = (float) c -> par_p7/256.0f;
+ref.p8  = (float) c -> par_p8/32768.0f;
+ref.p9  = (float) c -> par_p9/281474976710656.0f;
+ref.p10 = (float) c -> par_p10/281474976710656.0f;
+ref.p11 = (float) c -> par_p11/36893488147419103232.0f;
+}
+
+static float ref_temp
+	(
+	uint32_t raw
+	)
+{
+float d1 = (float) ( raw - ref.t1 );
+float d2 = d1*ref.t2;
+ref.comp_temp = d2 + powf( d1, 2 )*ref.t3;
+return ref.comp_temp;
+}
+
+static float ref_press
+	(
+	uint32_t raw
+	)
+{
+float t  = ref.comp_temp;
+float o1 = ref.p5 + ref.p6*t + ref.p7*powf( t, 2 ) + ref.p8*powf( t, 3 );
+float o2 = (float) raw*( ref.p1 + ref.p2*t + ref.p3*powf( t, 2 ) +
+                         ref.p4*powf( t, 3 ) );
+float o3 = powf( (float) raw, 2 )*( ref.p9 + ref.p10*t ) +
+           powf( (float) raw, 3 )*ref.p11;
+return o1 + o2 + o3;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Coefficients read from three BMP390 parts */
+static const BARO_CAL_DATA_INT cal_sets[] =
+	{
+	{ 27440, 19417, -7 ,  3   , -1802, 35, 1, 19594, 23573, 3, -6 , 15758, 6, -55 },
+	{ 27550, 19470, -7 , -1116, -3022, 35, 1, 19826, 22738, 3, -9 , 15558, 5, -60 },
+	{ 26920, 19207, -10,  652 , -4205, 31, 1, 18998, 23822, 2, -10, 16104, 4, -58 }
+	};
+
+static double now_ns
+	(
+	void
+	)
+{
+struct timespec ts;
+clock_gettime( CLOCK_MONOTONIC, &ts );
+return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+/* Sweep the raw readouts that map into the sensor's operating range */
+static void test_sweep
+	(
+	const BARO_CAL_DATA_INT* c,
+	int                      set
+	)
+{
+double   worst_temp  = 0.0;
+double   worst_press = 0.0;
+long     points      = 0;
+float    temp_ref;
+float    press_ref;
+int32_t  temp_fixed;
+uint32_t press_fixed;
+
+model_set_nvm( c );
+TEST_CHECK( load_cal_data() == BARO_OK, "load_cal_data failed" );
+ref_load( c );
+
+for ( uint32_t raw_t = 0; raw_t < ( 1u << 24 ); raw_t += TEST_TEMP_STEP )
+	{
+	temp_ref   = ref_temp( raw_t );
+	temp_fixed = temp_compensate( raw_t );
+	if ( temp_ref < -40.0f || temp_ref > 85.0f )
+		{
+		continue;
+		}
+	worst_temp = fmax( worst_temp, fabs( temp_fixed/100.0 - temp_ref ) );
+
+	for ( uint32_t raw_p = 0; raw_p < ( 1u << 24 ); raw_p += TEST_PRESS_STEP )
+		{
+		press_ref = ref_press( raw_p );
+		if ( press_ref < 30000.0f || press_ref > 125000.0f )
+			{
+			continue;
+			}
+		press_fixed = press_compensate( raw_p );
+		worst_press = fmax( worst_press, fabs( press_fixed/100.0 - press_ref ) );
+		points++;
+		}
+	}
+
+printf( "baro set %d: %ld points, worst error %.4f degC %.3f Pa\n",
+        set, points, worst_temp, worst_press );
+TEST_CHECK( points > 100000, "sweep covered only %ld points", points );
+TEST_CHECK( worst_temp < TEST_TEMP_TOLERANCE_C, "temperature error %.4f degC",
+            worst_temp );
+TEST_CHECK( worst_press < TEST_PRESS_TOLERANCE_PA, "pressure error %.3f Pa",
+            worst_press );
+}
+
+/* One burst read must yield both compensated values */
+static void test_press_temp_burst
+	(
+	void
+	)
+{
+float    pressure;
+float    temp;
+uint32_t reads;
+
+model_set_nvm( &cal_sets[0] );
+load_cal_data();
+ref_load( &cal_sets[0] );
+
+/* Raw pressure 0x6B0000, raw temperature 0x800000, LSB first */
+baro_regs[BARO_REG_PRESS_DATA + 0] = 0x00;
+baro_regs[BARO_REG_PRESS_DATA + 1] = 0x00;
+baro_regs[BARO_REG_PRESS_DATA + 2] = 0x6B;
+baro_regs[BARO_REG_TEMP_DATA  + 0] = 0x00;
+baro_regs[BARO_REG_TEMP_DATA  + 1] = 0x00;
+baro_regs[BARO_REG_TEMP_DATA  + 2] = 0x80;
+
+reads = baro_reads;
+TEST_CHECK( baro_get_press_temp( &pressure, &temp ) == BARO_OK,
+            "baro_get_press_temp failed" );
+TEST_CHECK( baro_reads - reads == 1, "%u reads for one sample",
+            baro_reads - reads );
+TEST_CHECK( fabsf( temp - ref_temp( 0x800000 ) ) < TEST_TEMP_TOLERANCE_C,
+            "burst temperature %f", temp );
+TEST_CHECK( fabsf( pressure - ref_press( 0x6B0000 ) ) < 1.0f,
+            "burst pressure %f", pressure );
+}
+
+/* Cost per sample of both paths */
+static void test_benchmark
+	(
+	void
+	)
+{
+volatile uint32_t sink = 0;
+volatile float    sink_f = 0.0f;
+double            start;
+double            fixed_ns;
+double            float_ns;
+
+start = now_ns();
+for ( uint32_t i = 0; i < TEST_BENCH_SAMPLES; ++i )
+	{
+	temp_compensate( 8000000 + i );
+	sink += press_compensate( 6000000 + i );
+	}
+fixed_ns = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+
+start = now_ns();
+for ( uint32_t i = 0; i < TEST_BENCH_SAMPLES; ++i )
+	{
+	ref_temp( 8000000 + i );
+	sink_f += ref_press( 6000000 + i );
+	}
+float_ns = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+
+printf( "baro: %.1f ns per sample fixed point, %.1f ns float with powf\n",
+        fixed_ns, float_ns );
+}
+
+
+int main
+	(
+	void
+	)
+{
+for ( size_t i = 0; i < sizeof( cal_sets )/sizeof( cal_sets[0] ); ++i )
+	{
+	test_sweep( &cal_sets[i], (int) i );
+	}
+test_press_temp_burst();
+test_benchmark();
+
+TEST_EXIT( "test_baro_compensate" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,357 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_baro_fifo.c
+*
+* DESCRIPTION:
+* 		Host test for the BMP390 FIFO frame parser. A register model serves
+*       synthetic FIFO byte streams to baro_fifo_read, with the sensor time
+*       frame the part appends once the FIFO is drained. Checks that every
+*       pressure and temperature frame comes back compensated and in order,
+*       that configuration frames are skipped and partial frames keep their
+*       frame interval, that the samples line up with the sensor time frame,
+*       also across the 24 bit wrap, that a read without a sensor time frame
+*       carries on from the previous one, and that a full FIFO read into a
+*       short buffer keeps the oldest samples
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../baro/baro.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_ODR                    BARO_ODR_50HZ
+#define TEST_TICKS                  BARO_ODR_PERIOD_TICKS( TEST_ODR )
+
+/* Calibration NVM of a production part, little-endian from PAR_T1 */
+static const uint8_t test_nvm[] =
+	{
+	0x30, 0x6B, 0xD9, 0x4B, 0xF9, 0x03, 0x00, 0xF6, 0xF8, 0x23, 0x01,
+	0x8A, 0x4C, 0x15, 0x5C, 0x03, 0xFA, 0x8E, 0x3D, 0x06, 0xC9
+	};
+
+
+/*------------------------------------------------------------------------------
+ Register and FIFO model
+------------------------------------------------------------------------------*/
+static uint8_t  baro_regs[256];
+static uint8_t  fifo[BARO_FIFO_SIZE + BARO_FIFO_SENSORTIME_SIZE];
+static uint16_t fifo_length;      /* Bytes in the FIFO, the model's length */
+
+/* Expected sample of each full frame, in FIFO order */
+static BARO_FIFO_SAMPLE expect[BARO_FIFO_MAX_FRAMES];
+static uint16_t         num_expect;
+static uint16_t         num_frame_slots; /* Sample frames, partial included */
+static uint16_t         frame_slot[BARO_FIFO_MAX_FRAMES];
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint16_t           reg,
+	uint16_t           reg_size,
+	uint8_t*           data,
+	uint16_t           size,
+	uint32_t           timeout
+	)
+{
+if ( addr != BARO_I2C_ADDR )
+	{
+	return HAL_ERROR;
+	}
+if ( reg == BARO_REG_FIFO_DATA )
+	{
+	if ( size > sizeof( fifo ) )
+		{
+		return HAL_ERROR;
+		}
+	memcpy( data, fifo, size );
+	return HAL_OK;
+	}
+if ( reg == BARO_REG_FIFO_LENGTH )
+	{
+	baro_regs[BARO_REG_FIFO_LENGTH]     = (uint8_t) fifo_length;
+	baro_regs[BARO_REG_FIFO_LENGTH + 1] = (uint8_t) ( fifo_length >> 8 );
+	}
+if ( reg + size > sizeof( baro_regs ) )
+	{
+	return HAL_ERROR;
+	}
+memcpy( data, &baro_regs[reg], size );
+return HAL_OK;
+}
+
+static void fifo_reset
+	(
+	void
+	)
+{
+fifo_length     = 0;
+num_expect      = 0;
+num_frame_slots = 0;
+memset( fifo, BARO_FIFO_FRAME_EMPTY, sizeof( fifo ) );
+}
+
+static void put24
+	(
+	uint8_t* dest,
+	uint32_t value
+	)
+{
+dest[0] = (uint8_t) value;
+dest[1] = (uint8_t) ( value >> 8  );
+dest[2] = (uint8_t) ( value >> 16 );
+}
+
+/* Pressure and temperature frame, the expected sample is compensated in
+   the same temperature then pressure order as the parser */
+static void push_frame
+	(
+	uint32_t raw_temp,
+	uint32_t raw_press
+	)
+{
+uint8_t* frame = &fifo[fifo_length];
+
+frame[0] = BARO_FIFO_FRAME_PRESS_TEMP;
+put24( &frame[1], raw_temp  );
+put24( &frame[4], raw_press );
+fifo_length += BARO_FIFO_PRESS_TEMP_SIZE;
+
+expect[num_expect].temp     = temp_compensate ( raw_temp  )/100.0f;
+expect[num_expect].pressure = press_compensate( raw_press )/100.0f;
+frame_slot[num_expect++]    = num_frame_slots++;
+}
+
+/* Pressure or temperature only frame */
+static void push_partial
+	(
+	uint8_t header
+	)
+{
+fifo[fifo_length] = header;
+put24( &fifo[fifo_length + 1], 0x6A0000 );
+fifo_length += BARO_FIFO_SINGLE_SIZE;
+num_frame_slots++;
+}
+
+static void push_config
+	(
+	uint8_t header
+	)
+{
+fifo[fifo_length]     = header;
+fifo[fifo_length + 1] = 0;
+fifo_length += BARO_FIFO_CONFIG_SIZE;
+}
+
+/* Sensor time frame the part appends after the last frame, past the
+   reported length */
+static void set_sensortime
+	(
+	uint32_t sensor_time
+	)
+{
+fifo[fifo_length] = BARO_FIFO_FRAME_SENSORTIME;
+put24( &fifo[fifo_length + 1], sensor_time );
+}
+
+/* Distinct raw readouts for frame n, around 25 degC and 1000 hPa */
+static uint32_t raw_temp
+	(
+	uint32_t n
+	)
+{
+return 0x7E0000 + n*97;
+}
+
+static uint32_t raw_press
+	(
+	uint32_t n
+	)
+{
+return 0x6C0000 + n*1301;
+}
+
+/* Read the FIFO and check the samples against the expected frames, the
+   newest frame sits at newest_time */
+static void check_read
+	(
+	const char* name       ,
+	uint16_t    max_samples,
+	uint32_t    newest_time
+	)
+{
+BARO_FIFO_SAMPLE samples[BARO_FIFO_MAX_FRAMES];
+uint16_t         num_samples;
+uint16_t         num_stored;
+uint32_t         time;
+
+num_stored = ( num_expect < max_samples ) ? num_expect : max_samples;
+TEST_CHECK( baro_fifo_read( samples, max_samples, &num_samples ) == BARO_OK,
+            "%s: read failed", name );
+TEST_CHECK( num_samples == num_stored, "%s: %u samples, expected %u", name,
+            num_samples, num_stored );
+for ( uint16_t i = 0; i < num_samples && i < num_stored; ++i )
+	{
+	time = ( newest_time -
+	         ( num_frame_slots - 1 - frame_slot[i] )*TEST_TICKS ) &
+	       BARO_SENSORTIME_MASK;
+	TEST_CHECK( samples[i].temp     == expect[i].temp     &&
+	            samples[i].pressure == expect[i].pressure,
+	            "%s: sample %u is %.2f degC %.2f Pa, expected %.2f degC "
+	            "%.2f Pa", name, i, samples[i].temp, samples[i].pressure,
+	            expect[i].temp, expect[i].pressure );
+	TEST_CHECK( samples[i].sensor_time == time, "%s: sample %u at %u, "
+	            "expected %u", name, i, samples[i].sensor_time, time );
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Plain frames line up with the frame interval before the sensor time */
+static void test_frames
+	(
+	void
+	)
+{
+fifo_reset();
+for ( uint32_t n = 0; n < 40; ++n )
+	{
+	push_frame( raw_temp( n ), raw_press( n ) );
+	}
+set_sensortime( 5000*TEST_TICKS + 37 );
+check_read( "frames", BARO_FIFO_MAX_FRAMES, 5000*TEST_TICKS );
+}
+
+/* Configuration frames are skipped, partial frames are dropped but keep
+   the samples around them on their frame intervals */
+static void test_skipped_frames
+	(
+	void
+	)
+{
+fifo_reset();
+push_config( BARO_FIFO_FRAME_CONFIG_CHG );
+push_partial( BARO_FIFO_FRAME_TEMP );
+push_frame( raw_temp( 0 ), raw_press( 0 ) );
+push_frame( raw_temp( 1 ), raw_press( 1 ) );
+push_config( BARO_FIFO_FRAME_CONFIG_ERR );
+push_partial( BARO_FIFO_FRAME_PRESS );
+push_partial( BARO_FIFO_FRAME_TEMP );
+push_frame( raw_temp( 2 ), raw_press( 2 ) );
+push_config( BARO_FIFO_FRAME_CONFIG_CHG );
+push_frame( raw_temp( 3 ), raw_press( 3 ) );
+set_sensortime( 9000*TEST_TICKS + TEST_TICKS - 1 );
+check_read( "skipped frames", BARO_FIFO_MAX_FRAMES, 9000*TEST_TICKS );
+}
+
+/* An empty frame ends the data, the frame and sensor time after it are
+   not read so the samples carry on from the last read */
+static void test_empty_frame
+	(
+	void
+	)
+{
+uint32_t last = baro_fifo_last_time;
+
+fifo_reset();
+push_frame( raw_temp( 0 ), raw_press( 0 ) );
+push_frame( raw_temp( 1 ), raw_press( 1 ) );
+fifo[fifo_length] = BARO_FIFO_FRAME_EMPTY;
+fifo_length      += 1;
+fifo[fifo_length] = BARO_FIFO_FRAME_PRESS_TEMP;
+fifo_length      += BARO_FIFO_PRESS_TEMP_SIZE;
+set_sensortime( 100*TEST_TICKS );
+check_read( "empty frame", BARO_FIFO_MAX_FRAMES, last + 2*TEST_TICKS );
+}
+
+/* Without a sensor time frame the samples carry on from the last read */
+static void test_no_sensortime
+	(
+	void
+	)
+{
+uint32_t last;
+
+fifo_reset();
+push_frame( raw_temp( 0 ), raw_press( 0 ) );
+set_sensortime( 7000*TEST_TICKS );
+check_read( "before", BARO_FIFO_MAX_FRAMES, 7000*TEST_TICKS );
+last = baro_fifo_last_time;
+
+fifo_reset();
+for ( uint32_t n = 0; n < 5; ++n )
+	{
+	push_frame( raw_temp( n ), raw_press( n ) );
+	}
+check_read( "no sensor time", BARO_FIFO_MAX_FRAMES, last + 5*TEST_TICKS );
+}
+
+/* Samples before the 24 bit sensor time wrap count back across it */
+static void test_wrap
+	(
+	void
+	)
+{
+fifo_reset();
+for ( uint32_t n = 0; n < 10; ++n )
+	{
+	push_frame( raw_temp( n ), raw_press( n ) );
+	}
+set_sensortime( 3*TEST_TICKS + 5 );
+check_read( "wrap", BARO_FIFO_MAX_FRAMES, 3*TEST_TICKS );
+}
+
+/* A full FIFO read into a short buffer keeps the oldest samples on their
+   own frame intervals */
+static void test_full_fifo
+	(
+	void
+	)
+{
+fifo_reset();
+for ( uint32_t n = 0; n < BARO_FIFO_MAX_FRAMES; ++n )
+	{
+	push_frame( raw_temp( n ), raw_press( n ) );
+	}
+set_sensortime( 20000*TEST_TICKS );
+check_read( "full fifo", 16, 20000*TEST_TICKS );
+printf( "baro fifo: %d frames in %u bytes, %u ticks per frame\n",
+        BARO_FIFO_MAX_FRAMES, fifo_length, TEST_TICKS );
+}
+
+
+int main
+	(
+	void
+	)
+{
+memcpy( &baro_regs[BARO_REG_NVM_PAR_T1], test_nvm, sizeof( test_nvm ) );
+TEST_CHECK( load_cal_data() == BARO_OK, "calibration not loaded" );
+baro_configuration.ODR_setting = TEST_ODR;
+
+test_frames();
+test_skipped_frames();
+test_empty_frame();
+test_no_sensortime();
+test_wrap();
+test_full_fifo();
+
+TEST_EXIT( "test_baro_fifo" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
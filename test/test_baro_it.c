@@ -0,0 +1,290 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_baro_it.c
+*
+* DESCRIPTION:
+* 		Host test for the data ready driven baro sampling on an I2C handle
+*       shared with the IMU. Simulated INT pin edges and I2C completions drive
+*       baro_drdy_ISR and baro_read_cplt_ISR. The I2C model rejects blocking
+*       transfers on a busy handle as the HAL does and flags any interrupt
+*       driven transfer started while a blocking one is on the bus
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../baro/baro.c"
+#include "imu.h"
+
+
+/*------------------------------------------------------------------------------
+ I2C model
+------------------------------------------------------------------------------*/
+static uint8_t  baro_regs[256];
+static uint8_t* it_dest;          /* Destination of the transfer in flight */
+static uint16_t it_reg;
+static uint16_t it_size;
+static bool     it_inflight;
+static bool     blocking_active;  /* Blocking transfer on the bus          */
+static bool     edge_in_blocking; /* Raise INT during the next IMU read    */
+static bool     complete_on_tick; /* Finish the IT transfer in HAL_GetTick */
+static uint32_t collisions;       /* IT transfers started during blocking  */
+static uint32_t busy_rejects;     /* Blocking transfers rejected as busy   */
+static uint32_t it_starts;
+static uint32_t ticks;
+
+static void it_complete
+	(
+	void
+	)
+{
+memcpy( it_dest, &baro_regs[it_reg], it_size );
+it_inflight = false;
+baro_read_cplt_ISR( &hi2c1 );
+}
+
+uint32_t HAL_GetTick
+	(
+	void
+	)
+{
+if ( complete_on_tick && it_inflight )
+	{
+	it_complete();
+	}
+return ticks++;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint16_t           reg,
+	uint16_t           reg_size,
+	uint8_t*           data,
+	uint16_t           size
+	)
+{
+if ( it_inflight || blocking_active )
+	{
+	collisions += blocking_active;
+	return HAL_BUSY;
+	}
+it_dest     = data;
+it_reg      = reg;
+it_size     = size;
+it_inflight = true;
+it_starts++;
+return HAL_OK;
+}
+
+/* Blocking access from any driver on hi2c1 */
+static HAL_StatusTypeDef blocking
+	(
+	uint16_t addr,
+	uint16_t reg,
+	uint8_t* data,
+	uint16_t size,
+	bool     write
+	)
+{
+if ( it_inflight )
+	{
+	busy_rejects++;
+	return HAL_BUSY;
+	}
+blocking_active = true;
+
+/* A data ready edge in the middle of the transfer */
+if ( edge_in_blocking && addr != BARO_I2C_ADDR )
+	{
+	edge_in_blocking = false;
+	baro_drdy_ISR();
+	}
+if ( addr == BARO_I2C_ADDR )
+	{
+	if ( write ) memcpy( &baro_regs[reg], data, size );
+	else         memcpy( data, &baro_regs[reg], size );
+	}
+else if ( !write )
+	{
+	memset( data, 0x24, size );
+	}
+blocking_active = false;
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint16_t           reg,
+	uint16_t           reg_size,
+	uint8_t*           data,
+	uint16_t           size,
+	uint32_t           timeout
+	)
+{
+return blocking( addr, reg, data, size, false );
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint16_t           reg,
+	uint16_t           reg_size,
+	uint8_t*           data,
+	uint16_t           size,
+	uint32_t           timeout
+	)
+{
+return blocking( addr, reg, data, size, true );
+}
+
+/* Raw pressure and temperature in the data registers, LSB first */
+static void model_set_data
+	(
+	uint32_t raw_press,
+	uint32_t raw_temp
+	)
+{
+for ( int i = 0; i < 3; ++i )
+	{
+	baro_regs[BARO_REG_PRESS_DATA + i] = (uint8_t) ( raw_press >> 8*i );
+	baro_regs[BARO_REG_TEMP_DATA  + i] = (uint8_t) ( raw_temp  >> 8*i );
+	}
+}
+
+/* Compensated values the blocking API reports for the current registers */
+static void reference
+	(
+	float* pressure,
+	float* temp
+	)
+{
+TEST_CHECK( baro_get_press_temp( pressure, temp ) == BARO_OK,
+            "blocking reference read failed" );
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* An edge starts one read, its completion publishes the sample */
+static void test_edge_sample
+	(
+	void
+	)
+{
+float pressure;
+float temp;
+float ref_pressure;
+float ref_temp;
+
+TEST_CHECK( baro_get_sample( &pressure, &temp ) == BARO_NO_DATA,
+            "sample before the first edge" );
+model_set_data( 0x6B0000, 0x800000 );
+reference( &ref_pressure, &ref_temp );
+
+baro_drdy_ISR();
+TEST_CHECK( it_inflight && it_reg == BARO_REG_PRESS_DATA &&
+            it_size == BARO_PRESS_TEMP_BURST_SIZE, "edge started no burst" );
+baro_drdy_ISR();
+TEST_CHECK( it_starts == 1, "second edge started another read" );
+it_complete();
+TEST_CHECK( baro_get_sample( &pressure, &temp ) == BARO_OK &&
+            pressure == ref_pressure && temp == ref_temp,
+            "sample %f Pa %f C, expected %f Pa %f C", pressure, temp,
+            ref_pressure, ref_temp );
+}
+
+/* An edge during a blocking IMU read is deferred to the end of the read */
+static void test_edge_during_imu_read
+	(
+	void
+	)
+{
+uint8_t  id;
+uint32_t starts = it_starts;
+
+edge_in_blocking = true;
+TEST_CHECK( imu_get_device_id( &id ) == IMU_OK, "IMU read failed" );
+TEST_CHECK( collisions == 0, "baro read started during the IMU transfer" );
+TEST_CHECK( it_inflight && it_starts == starts + 1,
+            "deferred baro read not started on release" );
+TEST_CHECK( !baro_bus_claimed && !baro_it_pending, "claim left behind" );
+it_complete();
+}
+
+/* An IMU read waits for the baro read in flight instead of failing busy */
+static void test_imu_waits_for_baro
+	(
+	void
+	)
+{
+uint8_t id;
+
+baro_drdy_ISR();
+TEST_CHECK( it_inflight, "edge started no read" );
+complete_on_tick = true;
+TEST_CHECK( imu_get_device_id( &id ) == IMU_OK, "IMU read failed" );
+complete_on_tick = false;
+TEST_CHECK( busy_rejects == 0, "IMU transfer hit a busy handle" );
+TEST_CHECK( !it_inflight, "baro read still in flight" );
+}
+
+/* A baro read that never completes times the claim out and releases it */
+static void test_claim_timeout
+	(
+	void
+	)
+{
+uint8_t id;
+float   pressure;
+float   temp;
+
+baro_drdy_ISR();
+TEST_CHECK( imu_get_device_id( &id ) != IMU_OK, "stuck bus not reported" );
+TEST_CHECK( busy_rejects == 0 && !baro_bus_claimed,
+            "timed out claim left the bus claimed" );
+
+/* The error callback frees the driver, the next edge reads again */
+it_inflight = false;
+baro_error_ISR( &hi2c1 );
+baro_drdy_ISR();
+TEST_CHECK( it_inflight, "no read after the error" );
+it_complete();
+TEST_CHECK( baro_get_sample( &pressure, &temp ) == BARO_OK,
+            "no sample after the error" );
+}
+
+
+int main
+	(
+	void
+	)
+{
+/* Calibration NVM of a real part, t1 = 27440, t2 = 19417, t3 = -7 */
+static const uint8_t nvm[] = { 0x30, 0x6B, 0xD9, 0x4B, 0xF9 };
+
+memcpy( &baro_regs[BARO_REG_NVM_PAR_T1], nvm, sizeof( nvm ) );
+TEST_CHECK( load_cal_data() == BARO_OK, "load_cal_data failed" );
+
+test_edge_sample();
+test_edge_during_imu_read();
+test_imu_waits_for_baro();
+test_claim_timeout();
+
+TEST_EXIT( "test_baro_it" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
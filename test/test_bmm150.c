@@ -0,0 +1,316 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_bmm150.c
+*
+* DESCRIPTION:
+* 		Host test for the BMM150 trim compensation. Drives mag_read_trim and
+*       imu_get_mag_xyz through a register model of the magnetometer and
+*       compares the fixed-point output against the Bosch float reference,
+*       then benchmarks both compensations
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "test.h"
+#include "../imu/imu.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_SAMPLES                ( 200000 )
+#define TEST_BENCH_SAMPLES          ( 4000000 )
+
+/* Documented tolerance of the fixed-point path against the float reference,
+   uT. Output is quantized to 1/16 uT and the integer reference truncates
+   its intermediate terms */
+#define TEST_XY_TOLERANCE_UT        ( 0.15 )
+#define TEST_Z_TOLERANCE_UT         ( 0.35 )
+
+
+/*------------------------------------------------------------------------------
+ Register model
+------------------------------------------------------------------------------*/
+static uint8_t  mag_regs[256];
+static uint32_t mag_reads;
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint16_t           reg,
+	uint16_t           reg_size,
+	uint8_t*           data,
+	uint16_t           size,
+	uint32_t           timeout
+	)
+{
+if ( addr != IMU_MAG_ADDR || reg + size > sizeof( mag_regs ) )
+	{
+	return HAL_ERROR;
+	}
+memcpy( data, &mag_regs[reg], size );
+mag_reads++;
+return HAL_OK;
+}
+
+/* Load a trim set into the trim registers */
+static void model_set_trim
+	(
+	const IMU_MAG_TRIM* t
+	)
+{
+mag_regs[MAG_REG_DIG_X1]       = (uint8_t) t -> dig_x1;
+mag_regs[MAG_REG_DIG_Y1]       = (uint8_t) t -> dig_y1;
+mag_regs[MAG_REG_DIG_X2]       = (uint8_t) t -> dig_x2;
+mag_regs[MAG_REG_DIG_Y2]       = (uint8_t) t -> dig_y2;
+mag_regs[MAG_REG_DIG_XY1]      = t -> dig_xy1;
+mag_regs[MAG_REG_DIG_XY2]      = (uint8_t) t -> dig_xy2;
+mag_regs[MAG_REG_DIG_Z1_LSB]   = (uint8_t) t -> dig_z1;
+mag_regs[MAG_REG_DIG_Z1_MSB]   = (uint8_t) ( t -> dig_z1 >> 8 );
+mag_regs[MAG_REG_DIG_Z2_LSB]   = (uint8_t) t -> dig_z2;
+mag_regs[MAG_REG_DIG_Z2_MSB]   = (uint8_t) ( (uint16_t) t -> dig_z2 >> 8 );
+mag_regs[MAG_REG_DIG_Z3_LSB]   = (uint8_t) t -> dig_z3;
+mag_regs[MAG_REG_DIG_Z3_MSB]   = (uint8_t) ( (uint16_t) t -> dig_z3 >> 8 );
+mag_regs[MAG_REG_DIG_Z4_LSB]   = (uint8_t) t -> dig_z4;
+mag_regs[MAG_REG_DIG_Z4_MSB]   = (uint8_t) ( (uint16_t) t -> dig_z4 >> 8 );
+mag_regs[MAG_REG_DIG_XYZ1_LSB] = (uint8_t) t -> dig_xyz1;
+
+/* Bit 7 of the XYZ1 MSB is reserved and reads back set on some parts */
+mag_regs[MAG_REG_DIG_XYZ1_MSB] = (uint8_t) ( t -> dig_xyz1 >> 8 ) | 0x80;
+}
+
+/* Load one sample into the data registers. The low bits below each field
+   carry the self-test and data ready flags and are set to catch any
+   decode that fails to mask them */
+static void model_set_data
+	(
+	int16_t  x,
+	int16_t  y,
+	int16_t  z,
+	uint16_t rhall
+	)
+{
+uint16_t xr = (uint16_t) ( x*8 )     | 0x0007;
+uint16_t yr = (uint16_t) ( y*8 )     | 0x0007;
+uint16_t zr = (uint16_t) ( z*2 )     | 0x0001;
+uint16_t hr = (uint16_t) ( rhall*4 ) | 0x0003;
+
+mag_regs[MAG_REG_DATAX_L] = (uint8_t) xr;
+mag_regs[MAG_REG_DATAX_H] = (uint8_t) ( xr >> 8 );
+mag_regs[MAG_REG_DATAY_L] = (uint8_t) yr;
+mag_regs[MAG_REG_DATAY_H] = (uint8_t) ( yr >> 8 );
+mag_regs[MAG_REG_DATAZ_L] = (uint8_t) zr;
+mag_regs[MAG_REG_DATAZ_H] = (uint8_t) ( zr >> 8 );
+mag_regs[MAG_REG_HALLR_L] = (uint8_t) hr;
+mag_regs[MAG_REG_HALLR_H] = (uint8_t) ( hr >> 8 );
+}
+
+
+/*------------------------------------------------------------------------------
+ Float reference, Bosch BMM150 API
+------------------------------------------------------------------------------*/
+static float ref_compensate_xy
+	(
+	const IMU_MAG_TRIM* t,
+	int16_t             raw,
+	uint16_t            rhall,
+	int8_t              dig_1,
+	int8_t              dig_2
+	)
+{
+float hall = ( rhall != 0 ) ? (float) rhall : (float) t -> dig_xyz1;
+float x2   = ( (float) t -> dig_xyz1*16384.0f/hall ) - 16384.0f;
+float x5   = (float) t -> dig_xy2*( x2*x2/268435456.0f ) +
+             x2*(float) t -> dig_xy1/16384.0f;
+float x7   = raw*( ( x5 + 256.0f )*( (float) dig_2 + 160.0f ) );
+return ( ( x7/8192.0f ) + (float) dig_1*8.0f )/16.0f;
+}
+
+static float ref_compensate_z
+	(
+	const IMU_MAG_TRIM* t,
+	int16_t             raw,
+	uint16_t            rhall
+	)
+{
+float z0 = (float) raw - (float) t -> dig_z4;
+float z2 = (float) t -> dig_z3*( (float) rhall - (float) t -> dig_xyz1 );
+float z3 = (float) t -> dig_z1*(float) rhall/32768.0f;
+float z4 = (float) t -> dig_z2 + z3;
+return ( ( z0*131072.0f - z2 )/( z4*4.0f ) )/16.0f;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Two trim sets: a typical part and one with every offset term non-zero */
+static const IMU_MAG_TRIM trims[] =
+	{
+	{ 0 , 0, 26, 26, 24747, 763, 0  , 0  , 29, -3, 6615 },
+	{ -2, 3, -4, -6, 21000, 700, -50, 120, 26, -5, 7000 }
+	};
+
+static double now_ns
+	(
+	void
+	)
+{
+struct timespec ts;
+clock_gettime( CLOCK_MONOTONIC, &ts );
+return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+/* Random field readouts across the ADC range against the float reference */
+static void test_against_reference
+	(
+	const IMU_MAG_TRIM* t
+	)
+{
+IMU_DATA out;
+int16_t  x, y, z;
+uint16_t rhall;
+double   worst_xy = 0.0;
+double   worst_z  = 0.0;
+uint32_t reads;
+double   ref_z;
+int      saturated = 0;
+
+model_set_trim( t );
+TEST_CHECK( mag_read_trim() == IMU_OK, "trim read failed" );
+TEST_CHECK( memcmp( &mag_trim, t, sizeof( mag_trim ) ) == 0,
+            "trim registers unpacked wrongly" );
+
+srand( 7 );
+reads = mag_reads;
+for ( int i = 0; i < TEST_SAMPLES; ++i )
+	{
+	x     = (int16_t) ( rand() % 8191 - 4095 );
+	y     = (int16_t) ( rand() % 8191 - 4095 );
+	z     = (int16_t) ( rand() % 32767 - 16383 );
+	rhall = (uint16_t) ( t -> dig_xyz1 - 600 + rand() % 1200 );
+	model_set_data( x, y, z, rhall );
+	imu_get_mag_xyz( &out );
+
+	worst_xy = fmax( worst_xy, fabs( out.mag_x/16.0 -
+	                 ref_compensate_xy( t, x, rhall, t -> dig_x1, t -> dig_x2 ) ) );
+	worst_xy = fmax( worst_xy, fabs( out.mag_y/16.0 -
+	                 ref_compensate_xy( t, y, rhall, t -> dig_y1, t -> dig_y2 ) ) );
+
+	/* The 1/16 uT output saturates at 2048 uT, inside the Z axis range */
+	ref_z = ref_compensate_z( t, z, rhall );
+	if ( fabs( ref_z ) < MAG_SATURATION_OUTPUT/16.0 - 1.0 )
+		{
+		worst_z = fmax( worst_z, fabs( out.mag_z/16.0 - ref_z ) );
+		}
+	else if ( fabs( ref_z ) > MAG_SATURATION_OUTPUT/16.0 + 1.0 )
+		{
+		saturated++;
+		TEST_CHECK( out.mag_z == ( ref_z > 0 ? MAG_SATURATION_OUTPUT :
+		                                      -MAG_SATURATION_OUTPUT ),
+		            "Z %.1f uT gave %d, expected saturation", ref_z,
+		            out.mag_z );
+		}
+	}
+
+printf( "bmm150: worst error %.3f uT X/Y, %.3f uT Z, %d saturated Z\n",
+        worst_xy, worst_z, saturated );
+TEST_CHECK( worst_xy < TEST_XY_TOLERANCE_UT, "X/Y error %.3f uT", worst_xy );
+TEST_CHECK( worst_z  < TEST_Z_TOLERANCE_UT , "Z error %.3f uT", worst_z );
+TEST_CHECK( mag_reads - reads == TEST_SAMPLES,
+            "%u I2C reads for %d samples, expected one burst each",
+            mag_reads - reads, TEST_SAMPLES );
+}
+
+/* Overflow readouts must report the overflow code, not a field value */
+static void test_overflow
+	(
+	void
+	)
+{
+IMU_DATA out;
+
+model_set_trim( &trims[0] );
+mag_read_trim();
+model_set_data( MAG_OVERFLOW_ADC_XY, 100, MAG_OVERFLOW_ADC_Z, 6615 );
+imu_get_mag_xyz( &out );
+TEST_CHECK( out.mag_x == MAG_OVERFLOW_OUTPUT, "X overflow gave %d", out.mag_x );
+TEST_CHECK( out.mag_y != MAG_OVERFLOW_OUTPUT, "Y flagged as overflow" );
+TEST_CHECK( out.mag_z == MAG_OVERFLOW_OUTPUT, "Z overflow gave %d", out.mag_z );
+}
+
+/* Per-sample cost of both compensations */
+static void test_benchmark
+	(
+	void
+	)
+{
+static int16_t      xs[1024], zs[1024];
+static uint16_t     hs[1024];
+const IMU_MAG_TRIM* t = &trims[1];
+IMU_DATA            out;
+volatile float      sink = 0.0f;
+double              start;
+double              fixed_ns;
+double              float_ns;
+
+mag_trim = *t;
+for ( int i = 0; i < 1024; ++i )
+	{
+	xs[i] = (int16_t) ( rand() % 8191 - 4095 );
+	zs[i] = (int16_t) ( rand() % 32767 - 16383 );
+	hs[i] = (uint16_t) ( t -> dig_xyz1 - 600 + rand() % 1200 );
+	}
+
+start = now_ns();
+for ( int i = 0; i < TEST_BENCH_SAMPLES; ++i )
+	{
+	int k = i & 1023;
+	mag_compensate( xs[k], xs[1023 - k], zs[k], hs[k], &out );
+	sink += out.mag_x + out.mag_y + out.mag_z;
+	}
+fixed_ns = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+
+start = now_ns();
+for ( int i = 0; i < TEST_BENCH_SAMPLES; ++i )
+	{
+	int k = i & 1023;
+	sink += ref_compensate_xy( t, xs[k], hs[k], t -> dig_x1, t -> dig_x2 ) +
+	        ref_compensate_xy( t, xs[1023 - k], hs[k], t -> dig_y1, t -> dig_y2 ) +
+	        ref_compensate_z( t, zs[k], hs[k] );
+	}
+float_ns = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+
+printf( "bmm150: %.1f ns per sample fixed point, %.1f ns float reference\n",
+        fixed_ns, float_ns );
+}
+
+
+int main
+	(
+	void
+	)
+{
+for ( size_t i = 0; i < sizeof( trims )/sizeof( trims[0] ); ++i )
+	{
+	test_against_reference( &trims[i] );
+	}
+test_overflow();
+test_benchmark();
+
+TEST_EXIT( "test_bmm150" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
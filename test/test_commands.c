@@ -0,0 +1,462 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_commands.c
+*
+* DESCRIPTION:
+* 		Host test for the framed command receive path. Encoded commands are
+*       fed to cmd_dispatch_frames through a simulated link that hands over
+*       a few bytes at a time, and the responses are decoded from what the
+*       handlers send back. Checks that each frame reaches its handler with
+*       its payload, in order and with a corrupted frame in between dropped,
+*       that a handler reads its arguments from the payload and fails right
+*       away on a read past it, that responses go out in frames with the
+*       header of the command, and that a legacy command still gets a plain
+*       byte response
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../commands/commands.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_ECHO_OP                ( 0x70 )
+#define TEST_FAIL_OP                ( 0x71 )
+#define TEST_LINK_SIZE              ( 8192 )
+#define TEST_MAX_FRAMES             ( 64   )
+#define TEST_STREAM_FRAMES          ( 200  )
+
+
+/*------------------------------------------------------------------------------
+ Link model
+------------------------------------------------------------------------------*/
+static uint8_t  rx_stream[TEST_LINK_SIZE]; /* Bytes sent to the firmware */
+static size_t   rx_len;
+static size_t   rx_pos;
+static size_t   rx_max_chunk;              /* Bytes the link has at once */
+static uint8_t  tx_stream[TEST_LINK_SIZE]; /* Bytes the firmware sent    */
+static size_t   tx_len;
+
+/* Responses decoded from tx_stream */
+static FRAME_HEADER reply_header[TEST_MAX_FRAMES];
+static uint8_t      reply_payload[TEST_MAX_FRAMES][FRAME_MAX_PAYLOAD];
+static int          num_replies;
+
+/* Echo handler log */
+static uint8_t      echo_sequence[TEST_STREAM_FRAMES];
+static int          num_echoes;
+static TRANSPORT_STATUS echo_past_end;
+
+static TRANSPORT_STATUS link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	)
+{
+if ( tx_len + tx_data_size > sizeof( tx_stream ) )
+	{
+	return TRANSPORT_FAIL;
+	}
+memcpy( &tx_stream[tx_len], tx_data_ptr, tx_data_size );
+tx_len += tx_data_size;
+return TRANSPORT_OK;
+}
+
+static TRANSPORT_STATUS link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	)
+{
+if ( rx_pos + rx_data_size > rx_len )
+	{
+	return TRANSPORT_TIMEOUT;
+	}
+memcpy( rx_data_ptr, &rx_stream[rx_pos], rx_data_size );
+rx_pos += rx_data_size;
+return TRANSPORT_OK;
+}
+
+/* The link has a random number of bytes, up to rx_max_chunk, waiting */
+static size_t link_available
+	(
+	void
+	)
+{
+size_t available = rx_len - rx_pos;
+size_t chunk     = 1 + rand() % rx_max_chunk;
+
+return ( available < chunk ) ? available : chunk;
+}
+
+static const TRANSPORT test_link =
+	{
+	.transmit       = link_transmit ,
+	.receive        = link_receive  ,
+	.flush          = NULL          ,
+	.transmit_async = NULL          ,
+	.tx_wait        = NULL          ,
+	.available      = link_available,
+	.timeout        = 10            ,
+	.link           = TRANSPORT_LINK_USB
+	};
+
+static void link_reset
+	(
+	void
+	)
+{
+rx_len       = 0;
+rx_pos       = 0;
+rx_max_chunk = 1;
+tx_len       = 0;
+num_replies  = 0;
+num_echoes   = 0;
+}
+
+/* Queue a framed command for the firmware */
+static void send_frame
+	(
+	uint8_t        opcode    ,
+	uint8_t        subcommand,
+	uint8_t        sequence  ,
+	const uint8_t* payload   ,
+	uint16_t       length
+	)
+{
+FRAME_HEADER header = { opcode, subcommand, sequence, length };
+size_t       size;
+
+TEST_CHECK( frame_encode( &header, payload, &rx_stream[rx_len],
+                          sizeof( rx_stream ) - rx_len, &size ) == FRAME_OK,
+            "frame not encoded" );
+rx_len += size;
+}
+
+/* Decode the responses the firmware sent */
+static void decode_replies
+	(
+	void
+	)
+{
+FRAME_DECODER decoder;
+FRAME         frame;
+size_t        pos;
+size_t        consumed;
+
+frame_decoder_init( &decoder );
+num_replies = 0;
+for ( pos = 0; pos < tx_len; pos += consumed )
+	{
+	if ( frame_decode( &decoder, &tx_stream[pos], tx_len - pos, &consumed,
+	                   &frame ) == FRAME_OK && num_replies < TEST_MAX_FRAMES )
+		{
+		reply_header[num_replies] = frame.header;
+		memcpy( reply_payload[num_replies], frame.payload,
+		        frame.header.length );
+		num_replies++;
+		}
+	}
+TEST_CHECK( decoder.num_errors == 0, "%u bad response frames",
+            decoder.num_errors );
+}
+
+
+/*------------------------------------------------------------------------------
+ Handlers
+------------------------------------------------------------------------------*/
+
+/* Reads a count and that many bytes, sends them back followed by a block of
+   subcommand times 100 bytes, then tries to read one byte too many */
+static CMD_STATUS echo_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+uint8_t  count;
+uint8_t  data[255];
+uint8_t  block[500];
+uint8_t  extra;
+uint8_t  subcommand;
+
+if ( cmd_get_subcommand( cmd_ptr, &subcommand ) != CMD_OK ||
+     transport_receive( cmd_ptr->transport_ptr, &count, 1, 10 ) !=
+     TRANSPORT_OK ||
+     transport_receive( cmd_ptr->transport_ptr, data, count, 10 ) !=
+     TRANSPORT_OK )
+	{
+	return CMD_FAIL;
+	}
+if ( num_echoes < TEST_STREAM_FRAMES && cmd_ptr->frame_ptr != NULL )
+	{
+	echo_sequence[num_echoes++] = cmd_ptr->frame_ptr->header.sequence;
+	}
+echo_past_end = transport_receive( cmd_ptr->transport_ptr, &extra, 1, 10 );
+
+transport_transmit( cmd_ptr->transport_ptr, data, count, 10 );
+for ( size_t i = 0; i < sizeof( block ); ++i )
+	{
+	block[i] = (uint8_t) ( i ^ 0x5A );
+	}
+transport_transmit( cmd_ptr->transport_ptr, block, subcommand*100u, 10 );
+return CMD_OK;
+}
+
+static CMD_STATUS fail_cmd
+	(
+	const CMD_CONTEXT* cmd_ptr
+	)
+{
+return CMD_FAIL;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* A framed ping is answered in a frame with the header of the command */
+static void test_ping
+	(
+	void
+	)
+{
+FRAME_DECODER decoder;
+
+frame_decoder_init( &decoder );
+link_reset();
+send_frame( PING_OP, 0, 42, NULL, 0 );
+TEST_CHECK( cmd_dispatch_frames( &test_link, &decoder ) == CMD_OK,
+            "ping failed" );
+decode_replies();
+TEST_CHECK( num_replies == 1 && reply_header[0].opcode == PING_OP &&
+            reply_header[0].sequence == 42 &&
+            reply_header[0].length == 1 &&
+            reply_payload[0][0] == PING_RESPONSE_CODE,
+            "ping: %d replies", num_replies );
+}
+
+/* Send an echo command and check the response frames against the echoed
+   bytes and the block that follows them */
+static void check_echo
+	(
+	const char*     name      ,
+	uint8_t         count     ,
+	uint8_t         subcommand,
+	int             num_frames,
+	const uint16_t* lengths
+	)
+{
+FRAME_DECODER decoder;
+uint8_t       payload[256];
+uint8_t       expect[800];
+size_t        expect_len;
+size_t        pos;
+
+frame_decoder_init( &decoder );
+link_reset();
+payload[0] = count;
+for ( int i = 0; i < count; ++i )
+	{
+	payload[i + 1] = (uint8_t) ( 3*i + 1 );
+	}
+memcpy( expect, &payload[1], count );
+expect_len = count;
+for ( int i = 0; i < subcommand*100; ++i )
+	{
+	expect[expect_len++] = (uint8_t) ( i ^ 0x5A );
+	}
+
+send_frame( TEST_ECHO_OP, subcommand, 9, payload, 1 + count );
+TEST_CHECK( cmd_dispatch_frames( &test_link, &decoder ) == CMD_OK,
+            "%s: echo failed", name );
+TEST_CHECK( num_echoes == 1, "%s: handler ran %d times", name, num_echoes );
+TEST_CHECK( echo_past_end == TRANSPORT_FAIL,
+            "%s: read past the payload returned %d", name, echo_past_end );
+
+decode_replies();
+TEST_CHECK( num_replies == num_frames, "%s: %d replies, expected %d", name,
+            num_replies, num_frames );
+pos = 0;
+for ( int i = 0; i < num_replies && i < num_frames; ++i )
+	{
+	TEST_CHECK( reply_header[i].opcode     == TEST_ECHO_OP &&
+	            reply_header[i].subcommand == subcommand   &&
+	            reply_header[i].sequence   == 9            &&
+	            reply_header[i].length     == lengths[i],
+	            "%s: reply %d has %u bytes, expected %u", name, i,
+	            reply_header[i].length, lengths[i] );
+	TEST_CHECK( pos + reply_header[i].length <= expect_len &&
+	            memcmp( reply_payload[i], &expect[pos],
+	                    reply_header[i].length ) == 0,
+	            "%s: reply %d data differs", name, i );
+	pos += reply_header[i].length;
+	}
+}
+
+/* The handler reads its arguments from the payload and a read past it
+   fails. A write that fits in one frame is not split, a longer one fills
+   the frames in turn */
+static void test_payload
+	(
+	void
+	)
+{
+FRAME_DECODER decoder;
+uint8_t       payload[20];
+
+check_echo( "whole write", 200, 1, 2, (const uint16_t[]){ 200, 100 } );
+check_echo( "long write" , 200, 4, 3, 
+            (const uint16_t[]){ 256, 256, 88 } );
+check_echo( "no echo"    , 0  , 3, 2, (const uint16_t[]){ 256, 44 } );
+
+/* A payload too short for the arguments fails without waiting */
+frame_decoder_init( &decoder );
+link_reset();
+payload[0] = 50;
+send_frame( TEST_ECHO_OP, 0, 10, payload, sizeof( payload ) );
+TEST_CHECK( cmd_dispatch_frames( &test_link, &decoder ) == CMD_FAIL,
+            "short payload accepted" );
+TEST_CHECK( tx_len == 0, "short payload sent a response" );
+}
+
+/* Frames fed a few bytes at a time reach their handlers in order, and a
+   corrupted frame is dropped without losing its neighbours */
+static void test_stream
+	(
+	void
+	)
+{
+FRAME_DECODER decoder;
+uint8_t       payload[17];
+size_t        bad_start;
+int           expected = 0;
+
+frame_decoder_init( &decoder );
+link_reset();
+rx_max_chunk = 13;
+for ( int n = 0; n < TEST_STREAM_FRAMES; ++n )
+	{
+	payload[0] = (uint8_t) ( n % 17 );
+	for ( int i = 1; i < 17; ++i )
+		{
+		payload[i] = (uint8_t) rand();
+		}
+	bad_start = rx_len;
+	send_frame( TEST_ECHO_OP, 0, (uint8_t) n, payload, 1 + payload[0] );
+	if ( n % 10 == 5 )
+		{
+		rx_stream[bad_start + 3] ^= 0x10;
+		}
+	}
+
+/* The application polls the link as bytes arrive */
+while ( rx_pos < rx_len )
+	{
+	cmd_dispatch_frames( &test_link, &decoder );
+	}
+for ( int n = 0; n < TEST_STREAM_FRAMES; ++n )
+	{
+	if ( n % 10 == 5 )
+		{
+		continue;
+		}
+	if ( expected >= num_echoes || echo_sequence[expected] != (uint8_t) n )
+		{
+		TEST_CHECK( 0, "stream: frame %d not dispatched in order", n );
+		break;
+		}
+	expected++;
+	}
+TEST_CHECK( num_echoes == expected, "stream: %d frames dispatched, "
+            "expected %d", num_echoes, expected );
+TEST_CHECK( decoder.num_errors == TEST_STREAM_FRAMES/10,
+            "stream: %u frames dropped", decoder.num_errors );
+}
+
+/* Handler failures and unknown opcodes are returned */
+static void test_status
+	(
+	void
+	)
+{
+FRAME_DECODER decoder;
+
+frame_decoder_init( &decoder );
+link_reset();
+send_frame( TEST_FAIL_OP, 0, 1, NULL, 0 );
+send_frame( PING_OP     , 0, 2, NULL, 0 );
+TEST_CHECK( cmd_dispatch_frames( &test_link, &decoder ) == CMD_FAIL,
+            "handler failure not returned" );
+decode_replies();
+TEST_CHECK( num_replies == 1 && reply_header[0].sequence == 2,
+            "ping behind a failed command not answered" );
+
+link_reset();
+send_frame( 0xEE, 0, 3, NULL, 0 );
+TEST_CHECK( cmd_dispatch_frames( &test_link, &decoder ) ==
+            CMD_UNRECOGNIZED, "unknown opcode not returned" );
+}
+
+/* A legacy command reads the link and gets a plain byte response */
+static void test_legacy
+	(
+	void
+	)
+{
+CMD_CONTEXT cmd = { PING_OP, &test_link, NULL };
+uint8_t     args[4] = { 3, 7, 8, 9 };
+
+link_reset();
+TEST_CHECK( cmd_dispatch( &cmd ) == CMD_OK, "legacy ping failed" );
+TEST_CHECK( tx_len == 1 && tx_stream[0] == PING_RESPONSE_CODE,
+            "legacy ping sent %u bytes", (unsigned) tx_len );
+
+/* Subcommand 0 and three bytes from the link */
+link_reset();
+rx_stream[0] = 0;
+memcpy( &rx_stream[1], args, sizeof( args ) );
+rx_len     = 1 + sizeof( args );
+cmd.opcode = TEST_ECHO_OP;
+TEST_CHECK( cmd_dispatch( &cmd ) == CMD_OK, "legacy echo failed" );
+TEST_CHECK( tx_len == 3 && memcmp( tx_stream, &args[1], 3 ) == 0,
+            "legacy echo sent %u bytes", (unsigned) tx_len );
+}
+
+
+int main
+	(
+	void
+	)
+{
+srand( 1 );
+cmd_dispatch_init();
+TEST_CHECK( cmd_register( TEST_ECHO_OP, echo_cmd ) == CMD_OK,
+            "echo handler not registered" );
+TEST_CHECK( cmd_register( TEST_FAIL_OP, fail_cmd ) == CMD_OK,
+            "fail handler not registered" );
+
+test_ping();
+test_payload();
+test_stream();
+test_status();
+test_legacy();
+
+TEST_EXIT( "test_commands" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,378 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_frame.c
+*
+* DESCRIPTION:
+* 		Host fuzz test for the frame codec. Random frames, with payloads biased
+*       towards zero runs and full COBS blocks, are encoded into one stream
+*       and decoded in random sized chunks, and every frame must come back
+*       unchanged and in order. A corrupted frame between two good ones, with
+*       bits flipped, bytes replaced, dropped or inserted or the tail cut off,
+*       must be rejected without taking either neighbour with it. Also checks
+*       the CRC check value and that an oversize frame is dropped up to the
+*       next delimiter
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../frame/frame.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_ROUND_TRIPS            ( 20000  )
+#define TEST_CORRUPTIONS            ( 200000 )
+#define TEST_MAX_CHUNK              ( 64     )
+
+/* Accepted corrupted frames allowed, CRC-16 lets about 1 in 65536 through */
+#define TEST_MAX_FALSE_ACCEPTS      ( TEST_CORRUPTIONS/4096 )
+
+/* Corruptions applied to the middle frame */
+typedef enum
+	{
+	CORRUPT_BIT_FLIP = 0,
+	CORRUPT_REPLACE     ,
+	CORRUPT_DROP        ,
+	CORRUPT_INSERT      ,
+	CORRUPT_TRUNCATE    ,
+	CORRUPT_NUM
+	} CORRUPTION;
+
+
+/*------------------------------------------------------------------------------
+ Frame generator
+------------------------------------------------------------------------------*/
+
+typedef struct
+	{
+	FRAME_HEADER header;
+	uint8_t      payload[FRAME_MAX_PAYLOAD];
+	uint8_t      encoded[FRAME_MAX_ENCODED_SIZE + 1];
+	size_t       encoded_size;
+	} TEST_FRAME;
+
+/* Random frame, a quarter of the payloads are mostly zeros and a quarter
+   have no zeros at all so the encoder emits full 254 byte blocks */
+static void random_frame
+	(
+	TEST_FRAME* frame
+	)
+{
+int style = rand() % 4;
+
+frame->header.opcode     = rand();
+frame->header.subcommand = rand();
+frame->header.sequence   = rand();
+frame->header.length     = rand() % ( FRAME_MAX_PAYLOAD + 1 );
+for ( int i = 0; i < frame->header.length; ++i )
+	{
+	switch ( style )
+		{
+		case 0:
+			frame->payload[i] = ( rand() % 8 ) ? 0 : rand();
+			break;
+
+		case 1:
+			frame->payload[i] = 1 + rand() % 255;
+			break;
+
+		default:
+			frame->payload[i] = rand();
+			break;
+		}
+	}
+TEST_CHECK( frame_encode( &frame->header, frame->payload, frame->encoded,
+                          FRAME_MAX_ENCODED_SIZE, &frame->encoded_size )
+            == FRAME_OK, "%u byte payload not encoded", frame->header.length );
+}
+
+static bool frame_matches
+	(
+	const FRAME*      decoded,
+	const TEST_FRAME* frame
+	)
+{
+return decoded->header.opcode     == frame->header.opcode     &&
+       decoded->header.subcommand == frame->header.subcommand &&
+       decoded->header.sequence   == frame->header.sequence   &&
+       decoded->header.length     == frame->header.length     &&
+       memcmp( decoded->payload, frame->payload, frame->header.length ) == 0;
+}
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* CRC-16/CCITT-FALSE check value */
+static void test_crc
+	(
+	void
+	)
+{
+uint16_t crc = frame_crc16( FRAME_CRC_INIT, (const uint8_t*) "123456789", 9 );
+
+TEST_CHECK( crc == 0x29B1, "check value 0x%04x", crc );
+}
+
+/* Random frames survive the encoder and a chunked decoder unchanged */
+static void test_round_trip
+	(
+	void
+	)
+{
+static TEST_FRAME frames[16];
+static uint8_t    stream[16*FRAME_MAX_ENCODED_SIZE];
+FRAME_DECODER     decoder;
+FRAME             frame;
+size_t            size;
+size_t            pos;
+size_t            chunk;
+size_t            used;
+size_t            max_encoded = 0;
+uint32_t          checked     = 0;
+int               count;
+int               next;
+
+frame_decoder_init( &decoder );
+while ( checked < TEST_ROUND_TRIPS )
+	{
+	count = 1 + rand() % 16;
+	size  = 0;
+	for ( int i = 0; i < count; ++i )
+		{
+		random_frame( &frames[i] );
+		TEST_CHECK( frames[i].encoded_size <=
+		            FRAME_ENCODED_SIZE( frames[i].header.length ),
+		            "%zu bytes encoded for a %u byte payload",
+		            frames[i].encoded_size, frames[i].header.length );
+		TEST_CHECK( memchr( frames[i].encoded, FRAME_DELIMITER,
+		                    frames[i].encoded_size - 1 ) == NULL,
+		            "delimiter inside an encoded frame" );
+		if ( frames[i].encoded_size > max_encoded )
+			{
+			max_encoded = frames[i].encoded_size;
+			}
+		memcpy( &stream[size], frames[i].encoded, frames[i].encoded_size );
+		size += frames[i].encoded_size;
+		}
+
+	/* Chunks split frames anywhere, each frame is checked as it ends since
+	   the payload lives in the decoder */
+	next = 0;
+	for ( pos = 0; pos < size; pos += chunk )
+		{
+		chunk = 1 + rand() % TEST_MAX_CHUNK;
+		chunk = ( chunk < size - pos ) ? chunk : size - pos;
+		for ( size_t done = 0; done < chunk; done += used )
+			{
+			if ( frame_decode( &decoder, &stream[pos + done], chunk - done,
+			                   &used, &frame ) != FRAME_OK )
+				{
+				continue;
+				}
+			TEST_CHECK( next < count && frame_matches( &frame, &frames[next] ),
+			            "frame %d of %d decoded differently", next, count );
+			next++;
+			}
+		}
+	TEST_CHECK( next == count, "%d of %d frames decoded", next, count );
+	checked += count;
+	}
+printf( "frame: %u frames round tripped, longest encoding %zu of %d bytes\n",
+        checked, max_encoded, FRAME_MAX_ENCODED_SIZE );
+TEST_CHECK( decoder.num_errors == 0 && decoder.num_frames == checked,
+            "%u errors and %u frames for %u good frames", decoder.num_errors,
+            decoder.num_frames, checked );
+}
+
+/* A corrupted frame is rejected and its neighbours still decode */
+static void test_corruption
+	(
+	void
+	)
+{
+static TEST_FRAME frames[3];
+static uint8_t    stream[3*FRAME_MAX_ENCODED_SIZE + 1];
+static uint8_t    bad[FRAME_MAX_ENCODED_SIZE + 1];
+FRAME_DECODER     decoder;
+FRAME             frame;
+FRAME_STATUS      status;
+size_t            bad_size;
+size_t            pos;
+size_t            at;
+uint32_t          false_accepts         = 0;
+uint32_t          rejected[CORRUPT_NUM] = { 0 };
+int               good_seen;
+bool              accepted;
+CORRUPTION        corruption;
+
+frame_decoder_init( &decoder );
+for ( uint32_t n = 0; n < TEST_CORRUPTIONS; ++n )
+	{
+	for ( int i = 0; i < 3; ++i )
+		{
+		random_frame( &frames[i] );
+		}
+
+	/* Corrupt the middle frame ahead of its delimiter */
+	memcpy( bad, frames[1].encoded, frames[1].encoded_size );
+	bad_size   = frames[1].encoded_size;
+	at         = rand() % ( bad_size - 1 );
+	corruption = rand() % CORRUPT_NUM;
+	switch ( corruption )
+		{
+		case CORRUPT_BIT_FLIP:
+			bad[at] ^= 1 << ( rand() % 8 );
+			break;
+
+		case CORRUPT_REPLACE:
+			bad[at] ^= 1 + rand() % 255;
+			break;
+
+		case CORRUPT_DROP:
+			memmove( &bad[at], &bad[at + 1], bad_size - at - 1 );
+			bad_size--;
+			break;
+
+		case CORRUPT_INSERT:
+			memmove( &bad[at + 1], &bad[at], bad_size - at );
+			bad[at] = rand();
+			bad_size++;
+			break;
+
+		default:
+			bad[at]  = FRAME_DELIMITER;
+			bad_size = at + 1;
+			break;
+		}
+
+	pos = 0;
+	memcpy( &stream[pos], frames[0].encoded, frames[0].encoded_size );
+	pos += frames[0].encoded_size;
+	memcpy( &stream[pos], bad, bad_size );
+	pos += bad_size;
+	memcpy( &stream[pos], frames[2].encoded, frames[2].encoded_size );
+	pos += frames[2].encoded_size;
+
+	/* Byte at a time, anything other than the two good frames is a false
+	   accept */
+	good_seen = 0;
+	accepted  = false;
+	for ( size_t i = 0; i < pos; ++i )
+		{
+		status = frame_decode_byte( &decoder, stream[i], &frame );
+		if ( status != FRAME_OK )
+			{
+			continue;
+			}
+		if ( i == frames[0].encoded_size - 1 )
+			{
+			TEST_CHECK( frame_matches( &frame, &frames[0] ),
+			            "frame ahead of a corruption decoded differently" );
+			good_seen++;
+			}
+		else if ( i == pos - 1 )
+			{
+			TEST_CHECK( frame_matches( &frame, &frames[2] ),
+			            "frame after a corruption decoded differently" );
+			good_seen++;
+			}
+		else
+			{
+			accepted = true;
+			}
+		}
+	if ( accepted )
+		{
+		false_accepts++;
+		}
+	else
+		{
+		rejected[corruption]++;
+		}
+	TEST_CHECK( good_seen == 2, "corruption %d at byte %zu of %zu took a "
+	            "good frame with it", corruption, at, frames[1].encoded_size );
+	}
+
+printf( "frame: %u corruptions, %u bit flips, %u replaced, %u dropped, "
+        "%u inserted and %u truncated rejected, %u accepted\n",
+        TEST_CORRUPTIONS, rejected[CORRUPT_BIT_FLIP],
+        rejected[CORRUPT_REPLACE], rejected[CORRUPT_DROP],
+        rejected[CORRUPT_INSERT], rejected[CORRUPT_TRUNCATE], false_accepts );
+TEST_CHECK( false_accepts <= TEST_MAX_FALSE_ACCEPTS,
+            "%u corrupted frames accepted", false_accepts );
+}
+
+/* An oversize frame is dropped up to the next delimiter and the frame after
+   it decodes */
+static void test_oversize
+	(
+	void
+	)
+{
+static uint8_t stream[2*FRAME_MAX_ENCODED_SIZE + 1];
+TEST_FRAME     good;
+FRAME_DECODER  decoder;
+FRAME          frame;
+FRAME_STATUS   status;
+size_t         size;
+size_t         used;
+uint32_t       too_long = 0;
+bool           decoded  = false;
+
+frame_decoder_init( &decoder );
+random_frame( &good );
+
+/* Nonzero bytes well past the largest frame */
+size = FRAME_MAX_ENCODED_SIZE + 100;
+for ( size_t i = 0; i < size; ++i )
+	{
+	stream[i] = 1 + rand() % 255;
+	}
+stream[size++] = FRAME_DELIMITER;
+memcpy( &stream[size], good.encoded, good.encoded_size );
+size += good.encoded_size;
+
+for ( size_t pos = 0; pos < size; pos += used )
+	{
+	status = frame_decode( &decoder, &stream[pos], size - pos, &used, &frame );
+	if ( status == FRAME_TOO_LONG )
+		{
+		too_long++;
+		}
+	else if ( status == FRAME_OK )
+		{
+		decoded = frame_matches( &frame, &good );
+		}
+	}
+TEST_CHECK( too_long == 1, "oversize frame reported %u times", too_long );
+TEST_CHECK( decoded, "frame after an oversize frame not decoded" );
+}
+
+
+int main
+	(
+	void
+	)
+{
+srand( 1 );
+test_crc();
+test_round_trip();
+test_corruption();
+test_oversize();
+
+TEST_EXIT( "test_frame" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
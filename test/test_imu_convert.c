@@ -0,0 +1,284 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_imu_convert.c
+*
+* DESCRIPTION:
+* 		Host test for the batch raw-to-SI IMU conversion. Checks the range
+*       scale factors, the folded bias and misalignment calibration against
+*       a double precision reference, the per-board magnetometer scale and
+*       the calibration blob loader, then reports the conversion throughput
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "test.h"
+#include "../imu/imu.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#if   defined( A0002_REV1 )
+    #define TEST_NAME               "test_imu_convert (A0002_REV1)"
+#elif defined( A0002_REV2 )
+    #define TEST_NAME               "test_imu_convert (A0002_REV2)"
+#endif
+
+#define TEST_BATCH                  ( 1024 )
+#define TEST_BENCH_BATCHES          ( 20000 )
+
+/* Throughput floor, far below what any host reaches, so only a conversion
+   loop that stopped vectorizing or started calling out per sample trips it */
+#define TEST_MIN_SAMPLES_PER_S      ( 20e6 )
+
+
+/*------------------------------------------------------------------------------
+ Global Variables
+------------------------------------------------------------------------------*/
+static IMU_DATA    raw[TEST_BATCH];
+static IMU_SI_DATA si[TEST_BATCH];
+
+static const IMU_CAL test_cal =
+	{
+	{ 0.12f, -0.05f, 0.30f },
+	{ { 1.010f, 0.004f, -0.002f }, { -0.003f, 0.995f, 0.006f },
+	  { 0.001f, -0.005f, 1.020f } },
+	{ 0.010f, -0.020f, 0.005f },
+	{ { 0.998f, 0.002f, 0.000f }, { 0.001f, 1.003f, -0.004f },
+	  { 0.003f, 0.000f, 0.990f } }
+	};
+
+
+/*------------------------------------------------------------------------------
+ Helpers
+------------------------------------------------------------------------------*/
+
+/* Reference conversion of one axis triple, matrix*( scale*raw - bias ) */
+static void reference
+	(
+	const float  matrix[3][3],
+	const float  bias[3],
+	double       scale,
+	const int16_t in[3],
+	double       out[3]
+	)
+{
+for ( int row = 0; row < 3; ++row )
+	{
+	out[row] = 0.0;
+	for ( int col = 0; col < 3; ++col )
+		{
+		out[row] += matrix[row][col]*( scale*in[col] - bias[col] );
+		}
+	}
+}
+
+/* Build a calibration blob the way the ground tools write it */
+static void make_blob
+	(
+	const IMU_CAL* cal,
+	uint8_t        blob[IMU_CAL_BLOB_SIZE]
+	)
+{
+uint32_t       magic = IMU_CAL_MAGIC;
+uint32_t       sum   = 0;
+const uint8_t* bytes = (const uint8_t*) cal;
+
+for ( uint32_t i = 0; i < sizeof( IMU_CAL ); ++i )
+	{
+	sum += bytes[i];
+	}
+memcpy( blob, &magic, sizeof( magic ) );
+memcpy( blob + sizeof( magic ), cal, sizeof( IMU_CAL ) );
+memcpy( blob + sizeof( magic ) + sizeof( IMU_CAL ), &sum, sizeof( sum ) );
+}
+
+static double now_s
+	(
+	void
+	)
+{
+struct timespec ts;
+clock_gettime( CLOCK_MONOTONIC, &ts );
+return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Uncalibrated full scale readouts must map to the configured range */
+static void test_range_scale
+	(
+	void
+	)
+{
+IMU_CONFIG config = { 0 };
+IMU_CAL    identity = { { 0 }, { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+                        { 0 }, { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } } };
+IMU_DATA   sample   = { 16384, -16384, 0, 16384, 0, -16384, 160, -32, 16 };
+IMU_SI_DATA out;
+
+imu_conv_set_cal( &identity );
+config.acc_range  = IMU_ACC_RANGE_8G;
+config.gyro_range = IMU_GYRO_RANGE_500;
+TEST_CHECK( imu_conv_config( &config ) == IMU_OK, "imu_conv_config failed" );
+imu_convert( &sample, &out, 1 );
+
+/* Half scale is 4 g and 250 deg/s */
+TEST_CHECK( fabsf( out.accel_x - 4.0f*IMU_GRAVITY ) < 1e-4f &&
+            fabsf( out.accel_y + 4.0f*IMU_GRAVITY ) < 1e-4f,
+            "accel %f %f", out.accel_x, out.accel_y );
+TEST_CHECK( fabsf( out.gyro_x - 250.0f*IMU_DEG_TO_RAD ) < 1e-5f &&
+            fabsf( out.gyro_z + 250.0f*IMU_DEG_TO_RAD ) < 1e-5f,
+            "gyro %f %f", out.gyro_x, out.gyro_z );
+
+/* BMM150 output is trim compensated to 1/16 uT, AK8963 output is
+   0.15 uT per LSB */
+#if   defined( A0002_REV1 )
+TEST_CHECK( fabsf( out.mag_x - 24.0f ) < 1e-5f &&
+            fabsf( out.mag_y + 4.8f ) < 1e-5f &&
+            fabsf( out.mag_z - 2.4f ) < 1e-5f,
+            "mag %f %f %f", out.mag_x, out.mag_y, out.mag_z );
+#elif defined( A0002_REV2 )
+TEST_CHECK( out.mag_x == 10.0f && out.mag_y == -2.0f && out.mag_z == 1.0f,
+            "mag %f %f %f", out.mag_x, out.mag_y, out.mag_z );
+#endif
+}
+
+/* The folded conversion tables must match the unfolded reference */
+static void test_calibration
+	(
+	void
+	)
+{
+IMU_CONFIG config = { 0 };
+double     acc_scale;
+double     gyro_scale;
+double     ref[3];
+double     worst = 0.0;
+int16_t    in[3];
+
+config.acc_range  = IMU_ACC_RANGE_16G;
+config.gyro_range = IMU_GYRO_RANGE_2000;
+imu_conv_config( &config );
+imu_conv_set_cal( (IMU_CAL*) &test_cal );
+acc_scale  = 16.0*IMU_GRAVITY/32768.0;
+gyro_scale = 2000.0*IMU_DEG_TO_RAD/32768.0;
+
+srand( 1 );
+for ( int i = 0; i < TEST_BATCH; ++i )
+	{
+	raw[i].accel_x = (int16_t) ( rand() - RAND_MAX/2 );
+	raw[i].accel_y = (int16_t) ( rand() - RAND_MAX/2 );
+	raw[i].accel_z = (int16_t) ( rand() - RAND_MAX/2 );
+	raw[i].gyro_x  = (int16_t) ( rand() - RAND_MAX/2 );
+	raw[i].gyro_y  = (int16_t) ( rand() - RAND_MAX/2 );
+	raw[i].gyro_z  = (int16_t) ( rand() - RAND_MAX/2 );
+	}
+imu_convert( raw, si, TEST_BATCH );
+
+for ( int i = 0; i < TEST_BATCH; ++i )
+	{
+	in[0] = raw[i].accel_x; in[1] = raw[i].accel_y; in[2] = raw[i].accel_z;
+	reference( test_cal.accel_matrix, test_cal.accel_bias, acc_scale, in, ref );
+	worst = fmax( worst, fabs( si[i].accel_x - ref[0] )/160.0 );
+	worst = fmax( worst, fabs( si[i].accel_y - ref[1] )/160.0 );
+	worst = fmax( worst, fabs( si[i].accel_z - ref[2] )/160.0 );
+
+	in[0] = raw[i].gyro_x; in[1] = raw[i].gyro_y; in[2] = raw[i].gyro_z;
+	reference( test_cal.gyro_matrix, test_cal.gyro_bias, gyro_scale, in, ref );
+	worst = fmax( worst, fabs( si[i].gyro_x - ref[0] )/35.0 );
+	worst = fmax( worst, fabs( si[i].gyro_y - ref[1] )/35.0 );
+	worst = fmax( worst, fabs( si[i].gyro_z - ref[2] )/35.0 );
+	}
+
+/* Relative to full scale, a few float ulps */
+TEST_CHECK( worst < 1e-6, "calibrated conversion error %.3g of full scale",
+            worst );
+}
+
+/* Only a complete, checksummed, finite blob may replace the calibration */
+static void test_cal_loader
+	(
+	void
+	)
+{
+uint8_t blob[IMU_CAL_BLOB_SIZE];
+IMU_CAL bad = test_cal;
+
+make_blob( &test_cal, blob );
+TEST_CHECK( imu_conv_load_cal( blob, sizeof( blob ) ) == IMU_OK,
+            "valid blob rejected" );
+TEST_CHECK( memcmp( &imu_cal, &test_cal, sizeof( IMU_CAL ) ) == 0,
+            "valid blob not applied" );
+
+TEST_CHECK( imu_conv_load_cal( blob, sizeof( blob ) - 1 ) == IMU_CAL_ERROR,
+            "short blob accepted" );
+
+blob[5] ^= 0x01;
+TEST_CHECK( imu_conv_load_cal( blob, sizeof( blob ) ) == IMU_CAL_ERROR,
+            "corrupted blob accepted" );
+
+make_blob( &test_cal, blob );
+blob[0] ^= 0xFF;
+TEST_CHECK( imu_conv_load_cal( blob, sizeof( blob ) ) == IMU_CAL_ERROR,
+            "wrong magic accepted" );
+
+/* Erased flash reads as 0xFF, a NaN pattern, with a matching checksum */
+bad.gyro_bias[1] = NAN;
+make_blob( &bad, blob );
+TEST_CHECK( imu_conv_load_cal( blob, sizeof( blob ) ) == IMU_CAL_ERROR,
+            "non-finite calibration accepted" );
+TEST_CHECK( memcmp( &imu_cal, &test_cal, sizeof( IMU_CAL ) ) == 0,
+            "rejected blob changed the calibration" );
+}
+
+/* Throughput of whole FIFO batches */
+static void test_throughput
+	(
+	void
+	)
+{
+double start;
+double rate;
+
+start = now_s();
+for ( int b = 0; b < TEST_BENCH_BATCHES; ++b )
+	{
+	imu_convert( raw, si, TEST_BATCH );
+	__asm__ volatile( "" ::: "memory" );
+	}
+rate = (double) TEST_BENCH_BATCHES*TEST_BATCH/( now_s() - start );
+
+printf( "imu_convert: %.1f M samples/s on the host\n", rate*1e-6 );
+TEST_CHECK( rate > TEST_MIN_SAMPLES_PER_S, "only %.1f M samples/s",
+            rate*1e-6 );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_range_scale();
+test_calibration();
+test_cal_loader();
+test_throughput();
+
+TEST_EXIT( TEST_NAME );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
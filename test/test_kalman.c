@@ -0,0 +1,404 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_kalman.c
+*
+* DESCRIPTION:
+* 		Host replay test for the vertical Kalman filter. Replays a synthetic
+*       dual deploy flight with a vehicle pitched off vertical, sensor noise
+*       and accelerometer bias through kalman_predict, kalman_update_baro and
+*       kalman_deploy the way the flight loop calls them. The charges feed
+*       back into the simulated descent rate. Checks tracking, apogee and
+*       main detection, that each charge fires once in order, the attitude
+*       projection, that baro updates do not shorten the apogee debounce, and
+*       reports the host time per update
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test.h"
+#include "../kalman/kalman.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_ODR                    IMU_ODR_100
+#define TEST_DT                     ( 0.01 )
+#define TEST_BARO_DECIMATION        ( 2 )
+
+/* Vehicle and sensor model */
+#define SIM_TILT_RAD                ( 15.0*M_PI/180.0 )
+#define SIM_THRUST                  ( 80.0  )
+#define SIM_BURN_START_S            ( 2.0   )
+#define SIM_BURN_END_S              ( 5.0   )
+#define SIM_DRAG_BODY               ( 0.0015 )
+#define SIM_DROGUE_DESCENT          ( 20.0  )
+#define SIM_MAIN_DESCENT            ( 6.0   )
+#define SIM_ACCEL_BIAS              ( 0.3   )
+#define SIM_ACCEL_NOISE             ( 0.2   )
+#define SIM_BARO_NOISE              ( 1.0   )
+#define SIM_MAX_TIME_S              ( 400.0 )
+
+#define TEST_BENCH_SAMPLES          ( 2000000 )
+
+
+/*------------------------------------------------------------------------------
+ Ignition model
+------------------------------------------------------------------------------*/
+static int    drogue_fired;
+static int    main_fired;
+static double sim_time;
+static double drogue_time;
+static double main_time;
+static double sim_altitude;
+static double main_fire_altitude;
+
+IGN_STATUS ign_deploy_drogue
+	(
+	void
+	)
+{
+drogue_fired++;
+drogue_time = sim_time;
+return IGN_SUCCESS;
+}
+
+IGN_STATUS ign_deploy_main
+	(
+	void
+	)
+{
+main_fired++;
+main_time          = sim_time;
+main_fire_altitude = sim_altitude;
+return IGN_SUCCESS;
+}
+
+
+/*------------------------------------------------------------------------------
+ Helpers
+------------------------------------------------------------------------------*/
+
+/* Approximately normal noise, fixed seed for a repeatable trace */
+static double noise
+	(
+	void
+	)
+{
+double sum = 0.0;
+for ( int i = 0; i < 12; ++i )
+	{
+	sum += rand()/(double) RAND_MAX;
+	}
+return sum - 6.0;
+}
+
+/* Attitude pitched by angle about the body x axis */
+static void tilt_attitude
+	(
+	double          angle,
+	ATTITUDE_STATE* att
+	)
+{
+memset( att, 0, sizeof( *att ) );
+att -> q0 = (float) cos( angle/2.0 );
+att -> q1 = (float) sin( angle/2.0 );
+}
+
+/* Rotate a reference frame vector into the body frame, v_b = R'*v_e */
+static void to_body
+	(
+	const ATTITUDE_STATE* a,
+	const double          ve[3],
+	double                vb[3]
+	)
+{
+double r[3][3];
+
+r[0][0] = 1 - 2*( a -> q2*a -> q2 + a -> q3*a -> q3 );
+r[0][1] = 2*( a -> q1*a -> q2 - a -> q0*a -> q3 );
+r[0][2] = 2*( a -> q1*a -> q3 + a -> q0*a -> q2 );
+r[1][0] = 2*( a -> q1*a -> q2 + a -> q0*a -> q3 );
+r[1][1] = 1 - 2*( a -> q1*a -> q1 + a -> q3*a -> q3 );
+r[1][2] = 2*( a -> q2*a -> q3 - a -> q0*a -> q1 );
+r[2][0] = 2*( a -> q1*a -> q3 - a -> q0*a -> q2 );
+r[2][1] = 2*( a -> q2*a -> q3 + a -> q0*a -> q1 );
+r[2][2] = 1 - 2*( a -> q1*a -> q1 + a -> q2*a -> q2 );
+for ( int i = 0; i < 3; ++i )
+	{
+	vb[i] = r[0][i]*ve[0] + r[1][i]*ve[1] + r[2][i]*ve[2];
+	}
+}
+
+static double now_ns
+	(
+	void
+	)
+{
+struct timespec ts;
+clock_gettime( CLOCK_MONOTONIC, &ts );
+return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Without baro corrections a tilted board at rest must not integrate any
+   velocity, which it would at g*( 1 - cos ) if only the body z axis was
+   used */
+static void test_projection
+	(
+	void
+	)
+{
+const double   gravity[3] = { 0.0, 0.0, IMU_GRAVITY };
+ATTITUDE_STATE att;
+IMU_SI_DATA    sample = { 0 };
+KALMAN_STATE   state;
+double         fb[3];
+
+tilt_attitude( 30.0*M_PI/180.0, &att );
+to_body( &att, gravity, fb );
+sample.accel_x = (float) fb[0];
+sample.accel_y = (float) fb[1];
+sample.accel_z = (float) fb[2];
+
+kalman_reset( 0.0f );
+for ( int i = 0; i < 100; ++i )
+	{
+	kalman_predict( &sample, &att );
+	}
+kalman_get_state( &state );
+TEST_CHECK( fabsf( state.velocity ) < 1e-3f && fabsf( state.altitude ) < 1e-3f,
+            "tilted rest drifted to %f m/s, %f m", state.velocity,
+            state.altitude );
+}
+
+/* Full flight replay with the charges closing the loop on the descent */
+static void test_flight_replay
+	(
+	void
+	)
+{
+ATTITUDE_STATE att;
+IMU_SI_DATA    sample = { 0 };
+KALMAN_STATE   state;
+double         axis[3];
+double         pos[2]      = { 0.0, 0.0 };
+double         vel[2]      = { 0.0, 0.0 };
+double         fe[3];
+double         fb[3];
+double         speed;
+double         drag;
+double         true_apogee = 0.0;
+double         apogee_time = 0.0;
+double         detect_time = -1.0;
+double         worst_error = 0.0;
+bool           landed      = false;
+long           i;
+
+tilt_attitude( SIM_TILT_RAD, &att );
+axis[0] = 0.0;
+axis[1] = -sin( SIM_TILT_RAD );
+axis[2] =  cos( SIM_TILT_RAD );
+srand( 33 );
+drogue_fired = 0;
+main_fired   = 0;
+kalman_reset( 0.0f );
+
+for ( i = 0; !landed && i*TEST_DT < SIM_MAX_TIME_S; ++i )
+	{
+	sim_time = i*TEST_DT;
+
+	/* Specific force in the reference frame: thrust along the axis and
+	   drag against the velocity, the chutes set the drag */
+	speed = hypot( vel[0], vel[1] );
+	if      ( main_fired   ) drag = IMU_GRAVITY/( SIM_MAIN_DESCENT*SIM_MAIN_DESCENT );
+	else if ( drogue_fired ) drag = IMU_GRAVITY/( SIM_DROGUE_DESCENT*SIM_DROGUE_DESCENT );
+	else                     drag = SIM_DRAG_BODY;
+	fe[0] = 0.0;
+	fe[1] = -drag*speed*vel[0];
+	fe[2] = -drag*speed*vel[1];
+	if ( sim_time >= SIM_BURN_START_S && sim_time < SIM_BURN_END_S )
+		{
+		fe[1] += SIM_THRUST*axis[1];
+		fe[2] += SIM_THRUST*axis[2];
+		}
+	if ( sim_time < SIM_BURN_START_S )
+		{
+		/* On the pad the rail holds the vehicle */
+		fe[1] = 0.0;
+		fe[2] = IMU_GRAVITY;
+		}
+	else
+		{
+		vel[0] += fe[1]*TEST_DT;
+		vel[1] += ( fe[2] - IMU_GRAVITY )*TEST_DT;
+		pos[0] += vel[0]*TEST_DT;
+		pos[1] += vel[1]*TEST_DT;
+		}
+	if ( pos[1] < 0.0 && sim_time > SIM_BURN_END_S )
+		{
+		landed = true;
+		}
+	sim_altitude = pos[1];
+	if ( pos[1] > true_apogee )
+		{
+		true_apogee = pos[1];
+		apogee_time = sim_time;
+		}
+
+	/* Body frame accelerometer with bias and noise */
+	to_body( &att, fe, fb );
+	sample.accel_x = (float) ( fb[0] + SIM_ACCEL_NOISE*noise() );
+	sample.accel_y = (float) ( fb[1] + SIM_ACCEL_NOISE*noise() );
+	sample.accel_z = (float) ( fb[2] + SIM_ACCEL_BIAS + SIM_ACCEL_NOISE*noise() );
+
+	/* Flight loop */
+	kalman_predict( &sample, &att );
+	if ( i % TEST_BARO_DECIMATION == 0 )
+		{
+		kalman_update_baro( (float) ( pos[1] + SIM_BARO_NOISE*noise() ) );
+		}
+	kalman_deploy();
+
+	kalman_get_state( &state );
+	if ( ( state.events & KALMAN_EVENT_APOGEE ) && detect_time < 0.0 )
+		{
+		detect_time = sim_time;
+		}
+	if ( sim_time > SIM_BURN_START_S )
+		{
+		worst_error = fmax( worst_error, fabs( state.altitude - pos[1] ) );
+		}
+	}
+
+printf( "kalman: apogee %.1f m at %.2f s, detected %.2f s estimating %.1f m\n",
+        true_apogee, apogee_time, detect_time, state.apogee_altitude );
+printf( "kalman: main fired at %.1f m, worst altitude error %.2f m, "
+        "bias %.3f m/s^2, landed at %.1f s\n", main_fire_altitude,
+        worst_error, state.accel_bias, sim_time );
+
+TEST_CHECK( landed, "flight did not land" );
+TEST_CHECK( state.events == ( KALMAN_EVENT_LAUNCH | KALMAN_EVENT_APOGEE |
+                              KALMAN_EVENT_MAIN ), "events 0x%02x",
+            state.events );
+TEST_CHECK( detect_time >= apogee_time && detect_time - apogee_time < 1.0,
+            "apogee detected %.2f s after the true apogee",
+            detect_time - apogee_time );
+TEST_CHECK( fabs( state.apogee_altitude - true_apogee ) < 3.0,
+            "apogee estimate %.1f m, true %.1f m", state.apogee_altitude,
+            true_apogee );
+TEST_CHECK( drogue_fired == 1 && main_fired == 1,
+            "drogue fired %d times, main %d times", drogue_fired,
+            main_fired );
+TEST_CHECK( drogue_time == detect_time && main_time > drogue_time,
+            "charges out of order, drogue %.2f s main %.2f s", drogue_time,
+            main_time );
+TEST_CHECK( fabs( main_fire_altitude - KALMAN_MAIN_ALTITUDE ) < 10.0,
+            "main fired at %.1f m", main_fire_altitude );
+TEST_CHECK( worst_error < 5.0, "altitude error %.2f m", worst_error );
+TEST_CHECK( fabs( state.accel_bias - SIM_ACCEL_BIAS*cos( SIM_TILT_RAD ) ) < 0.1,
+            "bias estimate %.3f m/s^2", state.accel_bias );
+}
+
+/* The apogee debounce runs on IMU samples, baro updates in between do not
+   shorten it */
+static void test_apogee_debounce
+	(
+	void
+	)
+{
+ATTITUDE_STATE att;
+IMU_SI_DATA    sample = { 0 };
+KALMAN_STATE   state;
+uint32_t       predicts = 0;
+
+tilt_attitude( 0.0, &att );
+kalman_reset( 100.0f );
+kalman_state.phase    = KALMAN_PHASE_ASCENT;
+kalman_state.velocity = -1.0f;
+while ( predicts < 10*apogee_samples )
+	{
+	/* A burst of baro updates that agree with the estimate */
+	for ( int i = 0; i < 8; ++i )
+		{
+		kalman_update_baro( kalman_state.altitude );
+		}
+	kalman_get_state( &state );
+	if ( state.events & KALMAN_EVENT_APOGEE )
+		{
+		break;
+		}
+	kalman_predict( &sample, &att );
+	predicts++;
+	}
+TEST_CHECK( predicts == apogee_samples, "apogee after %u samples of %u",
+            predicts, apogee_samples );
+}
+
+/* Host time for one predict and one baro update */
+static void test_benchmark
+	(
+	void
+	)
+{
+ATTITUDE_STATE att;
+IMU_SI_DATA    sample = { 0.1f, -0.2f, IMU_GRAVITY };
+double         start;
+double         predict_ns;
+double         update_ns;
+
+tilt_attitude( SIM_TILT_RAD, &att );
+kalman_reset( 0.0f );
+start = now_ns();
+for ( int i = 0; i < TEST_BENCH_SAMPLES; ++i )
+	{
+	kalman_predict( &sample, &att );
+	}
+predict_ns = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+
+start = now_ns();
+for ( int i = 0; i < TEST_BENCH_SAMPLES; ++i )
+	{
+	kalman_update_baro( (float) ( i & 7 ) );
+	}
+update_ns = ( now_ns() - start )/TEST_BENCH_SAMPLES;
+
+printf( "kalman: %.1f ns per predict, %.1f ns per baro update on the host\n",
+        predict_ns, update_ns );
+}
+
+
+int main
+	(
+	void
+	)
+{
+IMU_CONFIG config = { 0 };
+
+config.acc_odr = TEST_ODR;
+TEST_CHECK( kalman_init( &config ) == KALMAN_OK, "kalman_init failed" );
+
+test_projection();
+test_flight_replay();
+test_apogee_debounce();
+test_benchmark();
+
+TEST_EXIT( "test_kalman" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,488 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_lora.c
+*
+* DESCRIPTION:
+* 		Host test for the SX127x LoRa driver against a register model of the
+*       radio. The model decodes the SPI register and FIFO accesses framed by
+*       the slave select, runs the operating modes and raises DIO0 through a
+*       masked, edge latched interrupt line. Checks the register setup, that
+*       queued packets go out back to back and in order, that the send path
+*       masks only the DIO0 interrupt and never lets it into an SPI access,
+*       that a packet which arrives as a transmit starts is read before the
+*       FIFO is reused or else counted as lost, and the RSSI offset of both
+*       RF ports
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <string.h>
+#include "test.h"
+#include "../wireless/wireless.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Packets sent in the queue test */
+#define TEST_PACKETS                ( 40 )
+
+
+/*------------------------------------------------------------------------------
+ Radio model
+------------------------------------------------------------------------------*/
+
+static uint8_t  regs[128];          /* Register file                      */
+static uint8_t  fifo[256];          /* Packet FIFO                        */
+static int      spi_addr;           /* Access address, -1 -> none yet     */
+static bool     dio0_enabled;       /* DIO0 line unmasked in the NVIC     */
+static bool     dio0_pending;       /* DIO0 edge latched by the EXTI      */
+static bool     in_dio0_isr;
+static uint32_t nested_access;      /* DIO0 ISR entered inside an access  */
+static uint32_t irq_disables;       /* Global interrupt disables          */
+
+/* Packets on air */
+static uint8_t  sent[TEST_PACKETS][RF_MAX_PAYLOAD];
+static uint8_t  sent_size[TEST_PACKETS];
+static uint32_t num_sent;
+
+/* A packet that completes at the next SPI access, 0 -> none */
+static uint8_t  rx_at_access[RF_MAX_PAYLOAD];
+static uint8_t  rx_at_access_size;
+
+static bool ss_low
+	(
+	void
+	)
+{
+return !( stub_gpio.ODR & LORA_SS_PIN );
+}
+
+/* The EXTI line raises DIO0 once it is unmasked */
+static void dio0_service
+	(
+	void
+	)
+{
+if ( dio0_pending && dio0_enabled && !in_dio0_isr )
+	{
+	dio0_pending = false;
+	in_dio0_isr  = true;
+	if ( ss_low() )
+		{
+		nested_access++;
+		}
+	rf_lora_dio0_ISR();
+	in_dio0_isr  = false;
+	}
+}
+
+/* Raise DIO0 if its mapping routes the flag to it */
+static void irq_set
+	(
+	uint8_t flags
+	)
+{
+uint8_t mapped;
+
+regs[LORA_REG_IRQ_FLAGS] |= flags;
+mapped = ( regs[LORA_REG_DIO_MAPPING_1] == LORA_DIO0_TX_DONE ) ? 
+         LORA_IRQ_TX_DONE : LORA_IRQ_RX_DONE;
+if ( flags & mapped )
+	{
+	dio0_pending = true;
+	}
+}
+
+/* A packet from the air lands in the FIFO */
+static void radio_receive
+	(
+	const uint8_t* data_ptr,
+	uint8_t        size    ,
+	uint8_t        rssi    ,
+	bool           crc_ok
+	)
+{
+if ( ( regs[LORA_REG_OP_MODE] & 0x07 ) != LORA_MODE_RX_CONTINUOUS )
+	{
+	return;
+	}
+memcpy( &fifo[regs[LORA_REG_FIFO_RX_BASE_ADDR]], data_ptr, size );
+regs[LORA_REG_FIFO_RX_CURRENT] = regs[LORA_REG_FIFO_RX_BASE_ADDR];
+regs[LORA_REG_RX_NB_BYTES]     = size;
+regs[LORA_REG_PKT_RSSI_VALUE]  = rssi;
+regs[LORA_REG_PKT_SNR_VALUE]   = 40;
+irq_set( LORA_IRQ_RX_DONE | ( crc_ok ? 0 : LORA_IRQ_CRC_ERROR ) );
+}
+
+static void reg_write
+	(
+	uint8_t addr ,
+	uint8_t value
+	)
+{
+switch ( addr )
+	{
+	case LORA_REG_FIFO:
+		fifo[regs[LORA_REG_FIFO_ADDR_PTR]++] = value;
+		break;
+
+	case LORA_REG_IRQ_FLAGS:
+		regs[addr] &= ~value;
+		break;
+
+	case LORA_REG_OP_MODE:
+		regs[addr] = value;
+		if ( ( value & 0x07 ) == LORA_MODE_TX && num_sent < TEST_PACKETS )
+			{
+			sent_size[num_sent] = regs[LORA_REG_PAYLOAD_LENGTH];
+			memcpy( sent[num_sent], &fifo[regs[LORA_REG_FIFO_TX_BASE_ADDR]],
+			        sent_size[num_sent] );
+			num_sent++;
+			}
+		break;
+
+	default:
+		regs[addr] = value;
+		break;
+	}
+}
+
+static uint8_t reg_read
+	(
+	uint8_t addr
+	)
+{
+if ( addr == LORA_REG_FIFO )
+	{
+	return fifo[regs[LORA_REG_FIFO_ADDR_PTR]++];
+	}
+return regs[addr];
+}
+
+/* Every SPI access is a point where a pending packet can complete and DIO0
+   can preempt */
+static void spi_access
+	(
+	void
+	)
+{
+if ( rx_at_access_size != 0 )
+	{
+	radio_receive( rx_at_access, rx_at_access_size, 80, true );
+	rx_at_access_size = 0;
+	}
+dio0_service();
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit
+	(
+	SPI_HandleTypeDef* hspi   ,
+	uint8_t*           data   ,
+	uint16_t           size   ,
+	uint32_t           timeout
+	)
+{
+spi_access();
+for ( uint16_t i = 0; i < size; ++i )
+	{
+	if ( spi_addr < 0 )
+		{
+		spi_addr = data[i];
+		continue;
+		}
+	reg_write( spi_addr & 0x7F, data[i] );
+	if ( ( spi_addr & 0x7F ) != LORA_REG_FIFO )
+		{
+		spi_addr++;
+		}
+	}
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive
+	(
+	SPI_HandleTypeDef* hspi   ,
+	uint8_t*           data   ,
+	uint16_t           size   ,
+	uint32_t           timeout
+	)
+{
+spi_access();
+for ( uint16_t i = 0; i < size; ++i )
+	{
+	data[i] = reg_read( spi_addr & 0x7F );
+	if ( ( spi_addr & 0x7F ) != LORA_REG_FIFO )
+		{
+		spi_addr++;
+		}
+	}
+return HAL_OK;
+}
+
+/* Slave select frames an access */
+void HAL_GPIO_WritePin
+	(
+	GPIO_TypeDef* port ,
+	uint16_t      pin  ,
+	GPIO_PinState state
+	)
+{
+if ( state == GPIO_PIN_SET )
+	{
+	port->ODR |= pin;
+	}
+else
+	{
+	port->ODR &= ~(uint32_t) pin;
+	}
+if ( pin == LORA_SS_PIN )
+	{
+	spi_addr = -1;
+	}
+}
+
+void HAL_NVIC_DisableIRQ
+	(
+	IRQn_Type irqn
+	)
+{
+if ( irqn == LORA_DIO0_IRQn )
+	{
+	dio0_enabled = false;
+	}
+}
+
+void HAL_NVIC_EnableIRQ
+	(
+	IRQn_Type irqn
+	)
+{
+if ( irqn == LORA_DIO0_IRQn )
+	{
+	dio0_enabled = true;
+	dio0_service();
+	}
+}
+
+void __disable_irq
+	(
+	void
+	)
+{
+irq_disables++;
+}
+
+/* The packet on air finishes */
+static void radio_tx_done
+	(
+	void
+	)
+{
+if ( ( regs[LORA_REG_OP_MODE] & 0x07 ) == LORA_MODE_TX )
+	{
+	regs[LORA_REG_OP_MODE] = LORA_MODE_LONG_RANGE | LORA_MODE_STDBY;
+	irq_set( LORA_IRQ_TX_DONE );
+	dio0_service();
+	}
+}
+
+/* Reset the model and start the driver */
+static void radio_start
+	(
+	uint32_t frequency
+	)
+{
+RF_LORA_CONFIG config = { frequency, RF_LORA_BW_125K, 9, 1, 8, 17, 0x34 };
+
+memset( regs, 0, sizeof( regs ) );
+regs[LORA_REG_VERSION] = LORA_VERSION;
+stub_gpio.ODR          = LORA_SS_PIN;
+dio0_enabled           = true;
+dio0_pending           = false;
+num_sent               = 0;
+nested_access          = 0;
+TEST_CHECK( rf_lora_init( &config ) == RF_OK, "radio not started" );
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Carrier, modem and receive setup */
+static void test_init
+	(
+	void
+	)
+{
+uint32_t frf;
+
+radio_start( 433000000 );
+frf = ( (uint32_t) regs[LORA_REG_FRF_MSB] << 16 ) | 
+      ( (uint32_t) regs[LORA_REG_FRF_MID] << 8  ) | regs[LORA_REG_FRF_LSB];
+TEST_CHECK( frf == 0x6C4000, "carrier register 0x%06x for 433 MHz", frf );
+TEST_CHECK( regs[LORA_REG_MODEM_CONFIG_1] == ( ( RF_LORA_BW_125K << 4 ) | 2 ) &&
+            regs[LORA_REG_MODEM_CONFIG_2] == 0x94 &&
+            regs[LORA_REG_SYNC_WORD] == 0x34,
+            "modem config 0x%02x 0x%02x, sync word 0x%02x",
+            regs[LORA_REG_MODEM_CONFIG_1], regs[LORA_REG_MODEM_CONFIG_2],
+            regs[LORA_REG_SYNC_WORD] );
+TEST_CHECK( regs[LORA_REG_OP_MODE] == 
+            ( LORA_MODE_LONG_RANGE | LORA_MODE_RX_CONTINUOUS ) &&
+            regs[LORA_REG_DIO_MAPPING_1] == LORA_DIO0_RX_DONE,
+            "not listening after init, mode 0x%02x",
+            regs[LORA_REG_OP_MODE] );
+}
+
+/* Queued packets go out in order, the queue refuses a fifth packet and the
+   radio returns to receive once it is empty */
+static void test_send_queue
+	(
+	void
+	)
+{
+uint8_t  data[RF_MAX_PAYLOAD];
+uint32_t queued = 0;
+uint32_t busy   = 0;
+uint8_t  size;
+
+radio_start( 915000000 );
+irq_disables = 0;
+while ( queued < TEST_PACKETS )
+	{
+	size = 1 + ( queued*37 ) % RF_MAX_PAYLOAD;
+	memset( data, (uint8_t) queued, size );
+	if ( rf_send( LORA, 0, data, size ) == RF_OK )
+		{
+		queued++;
+		}
+	else
+		{
+		busy++;
+		TEST_CHECK( rf_lora_tx_pending() == LORA_TX_QUEUE_DEPTH,
+		            "busy with %u queued", rf_lora_tx_pending() );
+		radio_tx_done();
+		}
+	}
+while ( rf_lora_tx_pending() != 0 )
+	{
+	radio_tx_done();
+	}
+
+printf( "lora: %u packets sent back to back, %u busy returns\n", num_sent,
+        busy );
+TEST_CHECK( num_sent == TEST_PACKETS && busy > 0, "%u of %u packets sent",
+            num_sent, TEST_PACKETS );
+for ( uint32_t i = 0; i < num_sent; ++i )
+	{
+	size = 1 + ( i*37 ) % RF_MAX_PAYLOAD;
+	TEST_CHECK( sent_size[i] == size && sent[i][0] == (uint8_t) i &&
+	            sent[i][size - 1] == (uint8_t) i, "packet %u sent as %u bytes "
+	            "of 0x%02x", i, sent_size[i], sent[i][0] );
+	}
+TEST_CHECK( regs[LORA_REG_OP_MODE] == 
+            ( LORA_MODE_LONG_RANGE | LORA_MODE_RX_CONTINUOUS ) &&
+            regs[LORA_REG_DIO_MAPPING_1] == LORA_DIO0_RX_DONE,
+            "not back in receive after the queue emptied" );
+TEST_CHECK( irq_disables == 0, "interrupts disabled %u times by the send "
+            "path", irq_disables );
+
+/* An empty payload is an error, not one over the limit */
+TEST_CHECK( rf_send( LORA, 0, data, 0 ) == RF_ERROR &&
+            rf_send( LORA, 0, data, RF_MAX_PAYLOAD + 1 ) == RF_TOO_LONG &&
+            rf_lora_tx_pending() == 0, "bad payload sizes queued" );
+}
+
+/* A packet completing while the FIFO is being loaded waits for the masked
+   DIO0 line, and is read before the transmit reuses the FIFO */
+static void test_rx_during_send
+	(
+	void
+	)
+{
+RF_PACKET     packet;
+RF_LORA_STATS stats;
+uint8_t       data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+radio_start( 915000000 );
+memset( rx_at_access, 0xC3, 20 );
+rx_at_access_size = 20;
+TEST_CHECK( rf_lora_send( data, sizeof( data ) ) == RF_OK, "send refused" );
+TEST_CHECK( nested_access == 0, "DIO0 ISR ran inside %u SPI accesses",
+            nested_access );
+TEST_CHECK( rf_lora_receive_packet( &packet ) == RF_OK &&
+            packet.length == 20 && packet.payload[19] == 0xC3,
+            "packet arriving with the send not read" );
+radio_tx_done();
+TEST_CHECK( num_sent == 1 && sent_size[0] == sizeof( data ) && 
+            sent[0][7] == 8, "transmit garbled by the receive" );
+
+/* A receive done flag seen with the transmit done is counted */
+TEST_CHECK( rf_lora_send( data, sizeof( data ) ) == RF_OK, "send refused" );
+regs[LORA_REG_IRQ_FLAGS] |= LORA_IRQ_RX_DONE;
+radio_tx_done();
+rf_lora_get_stats( &stats );
+TEST_CHECK( stats.rx_lost == 1 && stats.rx_packets == 1 && 
+            stats.tx_packets == 2, "%u lost, %u received, %u sent",
+            stats.rx_lost, stats.rx_packets, stats.tx_packets );
+}
+
+/* Packet RSSI offset of each RF port, and CRC failures */
+static void test_receive
+	(
+	void
+	)
+{
+RF_PACKET     packet;
+RF_LORA_STATS stats;
+uint8_t       data[4] = { 9, 9, 9, 9 };
+
+radio_start( 433000000 );
+radio_receive( data, sizeof( data ), 100, true );
+dio0_service();
+rf_lora_get_stats( &stats );
+TEST_CHECK( stats.last_rssi == -64 && stats.last_snr == 10,
+            "433 MHz RSSI %d dBm, SNR %d dB", stats.last_rssi,
+            stats.last_snr );
+TEST_CHECK( rf_receive_packet( LORA, &packet ) == RF_OK && 
+            packet.length == 4 && packet.payload[3] == 9,
+            "433 MHz packet not queued" );
+
+radio_start( 868000000 );
+radio_receive( data, sizeof( data ), 100, true );
+dio0_service();
+rf_lora_get_stats( &stats );
+TEST_CHECK( stats.last_rssi == -57, "868 MHz RSSI %d dBm", stats.last_rssi );
+
+radio_receive( data, sizeof( data ), 100, false );
+dio0_service();
+rf_lora_get_stats( &stats );
+TEST_CHECK( stats.rx_crc_errors == 1 && stats.rx_packets == 1,
+            "%u CRC errors, %u packets", stats.rx_crc_errors,
+            stats.rx_packets );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_init();
+test_send_queue();
+test_rx_during_send();
+test_receive();
+
+TEST_EXIT( "test_lora" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,733 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_rs485_bus.c
+*
+* DESCRIPTION:
+* 		Host simulation of the RS485 multi-drop bus. The firmware runs as the
+*       master or as a node against a simulated peer on a 1 Mbit/s line, one
+*       character every 10 us, with the receive DMA ring, its half, full and
+*       idle line events, the driver enable pin and the slot timer modeled
+*       microsecond by microsecond. Checks that the master polls every node
+*       and matches the replies, that a slot shorter than a poll skips the
+*       poll without corrupting the frame in flight or dropping the driver,
+*       and that a node replies from the slot timer after the turnaround
+*       rather than from the receive interrupt, skipping a reply while its
+*       previous one is still being sent. A node fed back to back frames at
+*       line rate must queue every one, UART errors that leave the receive
+*       DMA running must not restart it or lose a frame, an overrun that stops
+*       it must restart it and lose only the frame it cut, and the blocking
+*       calls must report busy while the bus owns the UART
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <string.h>
+#include "test.h"
+#include "../rs485/rs485.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* One character of 10 bits at 1 Mbit/s */
+#define TEST_BYTE_US                ( 10 )
+
+/* Turnaround of the simulated nodes */
+#define TEST_PEER_TURNAROUND_US     ( 20 )
+
+/* Payload of the simulated node replies */
+#define TEST_PEER_REPLY_SIZE        ( 8 )
+
+/* Longest byte queue of the simulated peer */
+#define TEST_PEER_TX_SIZE           ( 4*RS485_TX_BUFFER_SIZE )
+
+/* Back to back broadcasts in the line rate test, and the application poll
+   period of the receive queue, short enough for a full queue of the
+   shortest frames */
+#define TEST_STREAM_FRAMES          ( 3000 )
+#define TEST_STREAM_DRAIN_US        ( 1000 )
+
+
+/*------------------------------------------------------------------------------
+ Line model
+------------------------------------------------------------------------------*/
+
+/* Simulated peer, the nodes when the firmware is the master and the master
+   when it is a node */
+typedef struct
+	{
+	FRAME_DECODER decoder;
+	uint8_t       tx[TEST_PEER_TX_SIZE];  /* Bytes queued for the line     */
+	size_t        tx_len;
+	size_t        tx_pos;
+	uint32_t      tx_clock;               /* Time into the current byte    */
+	uint32_t      reply_at;               /* Node reply start, 0 -> none   */
+	FRAME_HEADER  reply_header;
+	bool          replies;                /* Nodes answer polls            */
+	uint32_t      frames;                 /* Frames decoded from the line  */
+	uint32_t      frame_errors;           /* Corrupt frames on the line    */
+	uint32_t      poll_end;               /* Last byte of the last poll    */
+	uint32_t      turnaround_min;         /* Poll end to reply start       */
+	uint32_t      turnaround_max;
+	uint32_t      replies_seen;
+	} PEER;
+
+static PEER     peer;
+static uint32_t now;            /* Simulated time in us                   */
+
+/* Firmware transmitter */
+static const uint8_t* tx_data;
+static uint16_t       tx_len;
+static uint16_t       tx_sent;
+static uint32_t       tx_clock;
+static uint32_t       tx_start;      /* Start of the frame being sent      */
+static uint32_t       tx_frames;     /* Frames started                     */
+static uint32_t       de_drops;      /* Bytes sent without the driver on   */
+static bool           in_rx_isr;     /* Receive event interrupt running    */
+static uint32_t       isr_tx_starts; /* Transmits started from it          */
+
+/* Firmware receive DMA, stopped by a blocking UART error */
+static bool           dma_running;
+static uint32_t       dma_starts;
+static bool           rx_idle_pending;
+static uint32_t       rx_idle_clock;
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA
+	(
+	UART_HandleTypeDef* huart,
+	uint8_t*            data ,
+	uint16_t            size
+	)
+{
+if ( huart->RxState != HAL_UART_STATE_READY )
+	{
+	return HAL_BUSY;
+	}
+huart->RxState      = HAL_UART_STATE_BUSY_RX;
+huart->hdmarx->NDTR = size;
+dma_running         = true;
+dma_starts++;
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT
+	(
+	UART_HandleTypeDef* huart,
+	const uint8_t*      data ,
+	uint16_t            size
+	)
+{
+if ( huart->gState != HAL_UART_STATE_READY )
+	{
+	return HAL_BUSY;
+	}
+if ( in_rx_isr )
+	{
+	isr_tx_starts++;
+	}
+huart->gState = HAL_UART_STATE_BUSY_TX;
+tx_data       = data;
+tx_len        = size;
+tx_sent       = 0;
+tx_clock      = 0;
+tx_start      = now;
+tx_frames++;
+return HAL_OK;
+}
+
+static void rx_event
+	(
+	uint16_t pos
+	)
+{
+in_rx_isr = true;
+rs485_rx_event_ISR( pos );
+in_rx_isr = false;
+}
+
+/* A byte from the peer lands in the receive DMA ring */
+static void firmware_rx_byte
+	(
+	uint8_t byte
+	)
+{
+DMA_HandleTypeDef* dma = RS485_HUART.hdmarx;
+
+if ( !dma_running )
+	{
+	return;
+	}
+rx_buffer[RS485_RX_BUFFER_SIZE - dma->NDTR] = byte;
+if ( --dma->NDTR == 0 )
+	{
+	dma->NDTR = RS485_RX_BUFFER_SIZE;
+	rx_event( RS485_RX_BUFFER_SIZE );
+	}
+else if ( dma->NDTR == RS485_RX_BUFFER_SIZE/2 )
+	{
+	rx_event( RS485_RX_BUFFER_SIZE/2 );
+	}
+rx_idle_pending = true;
+rx_idle_clock   = 0;
+}
+
+/* Queue a frame on the peer transmitter */
+static void peer_send
+	(
+	uint8_t        dest    ,
+	uint8_t        source  ,
+	uint8_t        sequence,
+	const uint8_t* data_ptr,
+	uint8_t        size
+	)
+{
+FRAME_HEADER header = { dest, source, sequence, size };
+size_t       encoded;
+
+/* Drop the bytes already on the line */
+memmove( peer.tx, &peer.tx[peer.tx_pos], peer.tx_len - peer.tx_pos );
+peer.tx_len -= peer.tx_pos;
+peer.tx_pos  = 0;
+frame_encode( &header, data_ptr, &peer.tx[peer.tx_len],
+              sizeof( peer.tx ) - peer.tx_len, &encoded );
+peer.tx_len += encoded;
+}
+
+/* A byte from the firmware reaches the peer */
+static void peer_rx_byte
+	(
+	uint8_t byte
+	)
+{
+FRAME        frame;
+FRAME_STATUS status;
+uint32_t     turnaround;
+
+status = frame_decode_byte( &peer.decoder, byte, &frame );
+if ( status == FRAME_INCOMPLETE )
+	{
+	return;
+	}
+if ( status != FRAME_OK )
+	{
+	peer.frame_errors++;
+	return;
+	}
+peer.frames++;
+
+/* Simulated nodes answer a poll after their turnaround */
+if ( bus_config.role == RS485_ROLE_MASTER )
+	{
+	if ( peer.replies )
+		{
+		peer.reply_header.opcode     = RS485_ADDR_MASTER;
+		peer.reply_header.subcommand = frame.header.opcode;
+		peer.reply_header.sequence   = frame.header.sequence;
+		peer.reply_at                = now + TEST_PEER_TURNAROUND_US;
+		}
+	return;
+	}
+
+/* Simulated master, time the reply from the end of the poll */
+turnaround = tx_start - peer.poll_end;
+peer.replies_seen++;
+if ( turnaround < peer.turnaround_min )
+	{
+	peer.turnaround_min = turnaround;
+	}
+if ( turnaround > peer.turnaround_max )
+	{
+	peer.turnaround_max = turnaround;
+	}
+}
+
+/* One microsecond of the line, the slot timer and both transmitters */
+static void tick
+	(
+	void
+	)
+{
+TIM_TypeDef* slot_tim = RS485_SLOT_TIM.Instance;
+uint8_t      reply[TEST_PEER_REPLY_SIZE];
+
+now++;
+DWT->CYCCNT += SystemCoreClock/1000000;
+
+/* Slot timer, counting at 1 MHz */
+if ( slot_tim->CR1 & TIM_CR1_CEN )
+	{
+	if ( ++slot_tim->CNT > slot_tim->ARR )
+		{
+		slot_tim->CNT = 0;
+		if ( slot_tim->DIER & TIM_IT_UPDATE )
+			{
+			rs485_bus_slot_ISR();
+			}
+		}
+	}
+
+/* Firmware transmitter, the UART reads the buffer a byte at a time */
+if ( ( RS485_HUART.gState == HAL_UART_STATE_BUSY_TX ) &&
+     ( ++tx_clock == TEST_BYTE_US ) )
+	{
+	tx_clock = 0;
+	if ( !( stub_gpio.ODR & RS485_DE_PIN ) )
+		{
+		de_drops++;
+		}
+	peer_rx_byte( tx_data[tx_sent++] );
+	if ( tx_sent == tx_len )
+		{
+		RS485_HUART.gState = HAL_UART_STATE_READY;
+		rs485_tx_complete_ISR();
+		}
+	}
+
+/* Simulated node reply */
+if ( peer.reply_at != 0 && now >= peer.reply_at )
+	{
+	peer.reply_at = 0;
+	memset( reply, peer.reply_header.subcommand, sizeof( reply ) );
+	peer_send( peer.reply_header.opcode, peer.reply_header.subcommand,
+	           peer.reply_header.sequence, reply, sizeof( reply ) );
+	}
+
+/* Peer transmitter */
+if ( peer.tx_pos < peer.tx_len && ++peer.tx_clock == TEST_BYTE_US )
+	{
+	peer.tx_clock = 0;
+	firmware_rx_byte( peer.tx[peer.tx_pos++] );
+	if ( peer.tx_pos == peer.tx_len )
+		{
+		peer.poll_end = now;
+		}
+	}
+
+/* Idle line one character after the last byte */
+if ( rx_idle_pending && dma_running && ++rx_idle_clock == TEST_BYTE_US )
+	{
+	rx_idle_pending = false;
+	rx_event( RS485_RX_BUFFER_SIZE - RS485_HUART.hdmarx->NDTR );
+	}
+}
+
+static void run
+	(
+	uint32_t us
+	)
+{
+for ( uint32_t i = 0; i < us; ++i )
+	{
+	tick();
+	}
+}
+
+/* Start the firmware in a role with an idle line */
+static void bus_start
+	(
+	const RS485_BUS_CONFIG* config_ptr
+	)
+{
+memset( &peer, 0, sizeof( peer ) );
+frame_decoder_init( &peer.decoder );
+peer.turnaround_min = UINT32_MAX;
+RS485_HUART.gState  = HAL_UART_STATE_READY;
+RS485_HUART.RxState = HAL_UART_STATE_READY;
+RS485_SLOT_TIM.Instance->CR1  = 0;
+RS485_SLOT_TIM.Instance->DIER = 0;
+RS485_SLOT_TIM.Instance->CNT  = 0;
+RS485_HUART.ErrorCode = HAL_UART_ERROR_NONE;
+stub_gpio.ODR       = 0;
+rx_idle_pending     = false;
+tx_frames           = 0;
+de_drops            = 0;
+isr_tx_starts       = 0;
+TEST_CHECK( rs485_bus_init( config_ptr ) == RS485_OK, "bus not started" );
+}
+
+/* The application runs the master slot timer */
+static void slot_timer_start
+	(
+	uint32_t slot_us
+	)
+{
+__HAL_TIM_SET_AUTORELOAD( &( RS485_SLOT_TIM ), slot_us - 1 );
+HAL_TIM_Base_Start_IT( &( RS485_SLOT_TIM ) );
+}
+
+/* A UART error interrupt. Blocking errors abort the receive DMA first */
+static void uart_error
+	(
+	uint32_t error_code,
+	bool     blocking
+	)
+{
+RS485_HUART.ErrorCode = error_code;
+if ( blocking )
+	{
+	dma_running         = false;
+	RS485_HUART.RxState = HAL_UART_STATE_READY;
+	}
+rs485_error_ISR();
+RS485_HUART.ErrorCode = HAL_UART_ERROR_NONE;
+}
+
+/* Broadcast stream state, frames are numbered by their sequence and carry
+   it in every payload byte */
+static uint32_t stream_sent;
+static uint32_t stream_got;
+static uint8_t  stream_next;
+static uint32_t stream_gaps;
+
+/* Queue the next broadcast of the stream on the peer */
+static void stream_send
+	(
+	void
+	)
+{
+uint8_t payload[RS485_MAX_PAYLOAD];
+uint8_t size = 1 + stream_sent % RS485_MAX_PAYLOAD;
+
+memset( payload, (uint8_t) stream_sent, size );
+peer_send( RS485_ADDR_BROADCAST, RS485_ADDR_MASTER, (uint8_t) stream_sent,
+           payload, size );
+stream_sent++;
+}
+
+/* Check the queued broadcasts against the stream */
+static void stream_drain
+	(
+	void
+	)
+{
+RS485_BUS_MSG msg;
+
+while ( rs485_bus_receive( &msg ) )
+	{
+	TEST_CHECK( msg.dest == RS485_ADDR_BROADCAST &&
+	            msg.length == 1 + msg.sequence % RS485_MAX_PAYLOAD &&
+	            msg.payload[msg.length - 1] == msg.sequence,
+	            "broadcast %u garbled", msg.sequence );
+	if ( msg.sequence != stream_next )
+		{
+		stream_gaps++;
+		}
+	stream_next = msg.sequence + 1;
+	stream_got++;
+	}
+}
+
+/* Keep the peer transmitter busy with broadcasts until the line goes idle,
+   draining the receive queue at the application poll rate */
+static void stream
+	(
+	uint32_t frames
+	)
+{
+uint32_t last  = stream_sent + frames;
+uint32_t drain = now;
+
+while ( stream_sent < last || peer.tx_pos < peer.tx_len )
+	{
+	if ( stream_sent < last && 
+	     peer.tx_len - peer.tx_pos < RS485_TX_BUFFER_SIZE )
+		{
+		stream_send();
+		}
+	run( TEST_BYTE_US );
+	if ( now - drain >= TEST_STREAM_DRAIN_US )
+		{
+		drain = now;
+		stream_drain();
+		}
+	}
+run( 2*TEST_BYTE_US );
+stream_drain();
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* The master polls both nodes in turn and every reply lands in its slot */
+static void test_master_polls
+	(
+	void
+	)
+{
+RS485_BUS_CONFIG config = { RS485_ROLE_MASTER, RS485_ADDR_MASTER, 2,
+                            { RS485_ADDR_ENGINE_CONTROLLER,
+                              RS485_ADDR_VALVE_CONTROLLER } };
+RS485_NODE_STATS stats[2];
+RS485_BUS_MSG    msg;
+uint8_t          command[4] = { 1, 2, 3, 4 };
+uint32_t         msgs = 0;
+
+bus_start( &config );
+peer.replies = true;
+rs485_bus_set_poll_data( RS485_ADDR_ENGINE_CONTROLLER, command,
+                         sizeof( command ) );
+slot_timer_start( 400 );
+for ( int slot = 0; slot <= 100; ++slot )
+	{
+	/* No slot after the last one, its reply still comes in */
+	run( ( slot < 100 ) ? 400 : 399 );
+	while ( rs485_bus_receive( &msg ) )
+		{
+		TEST_CHECK( msg.length == TEST_PEER_REPLY_SIZE &&
+		            msg.payload[0] == msg.source, "reply from %u garbled",
+		            msg.source );
+		msgs++;
+		}
+	}
+
+for ( int i = 0; i < 2; ++i )
+	{
+	rs485_bus_get_node_stats( config.schedule[i], &stats[i] );
+	TEST_CHECK( stats[i].polls == 50 && stats[i].replies == 50 &&
+	            stats[i].timeouts == 0 && stats[i].skipped == 0,
+	            "node %u: %u polls, %u replies, %u timeouts, %u skipped",
+	            config.schedule[i], stats[i].polls, stats[i].replies,
+	            stats[i].timeouts, stats[i].skipped );
+	}
+printf( "rs485 master: 2 nodes, %u polls each, latency %u to %u us, "
+        "%u messages queued\n", stats[0].polls, stats[0].min_latency_us,
+        stats[0].max_latency_us, msgs );
+TEST_CHECK( msgs == 100 && peer.frame_errors == 0 && de_drops == 0,
+            "%u messages, %u corrupt polls, %u bytes without the driver",
+            msgs, peer.frame_errors, de_drops );
+}
+
+/* A slot shorter than a full poll skips polls rather than overwriting the
+   frame on the wire, and the poll payload waits for the next poll */
+static void test_master_skips
+	(
+	void
+	)
+{
+RS485_BUS_CONFIG config = { RS485_ROLE_MASTER, RS485_ADDR_MASTER, 1,
+                            { RS485_ADDR_ENGINE_CONTROLLER } };
+RS485_NODE_STATS stats;
+uint8_t          command[RS485_MAX_PAYLOAD];
+uint32_t         frame_us;
+
+memset( command, 0x5A, sizeof( command ) );
+bus_start( &config );
+slot_timer_start( 300 );
+for ( int i = 0; i < 40; ++i )
+	{
+	rs485_bus_set_poll_data( RS485_ADDR_ENGINE_CONTROLLER, command,
+	                         sizeof( command ) );
+	run( 300 );
+	}
+run( 1000 );
+
+rs485_bus_get_node_stats( RS485_ADDR_ENGINE_CONTROLLER, &stats );
+frame_us = FRAME_ENCODED_SIZE( RS485_MAX_PAYLOAD )*TEST_BYTE_US;
+printf( "rs485 master: %u us polls in 300 us slots, %u sent, %u skipped, "
+        "%u corrupt\n", frame_us, stats.polls, stats.skipped,
+        peer.frame_errors );
+TEST_CHECK( stats.skipped > 0 && stats.polls == tx_frames &&
+            peer.frames == tx_frames,
+            "%u polls, %u skipped, %u frames started, %u decoded",
+            stats.polls, stats.skipped, tx_frames, peer.frames );
+TEST_CHECK( peer.frame_errors == 0, "%u polls corrupted on the wire",
+            peer.frame_errors );
+TEST_CHECK( de_drops == 0, "driver dropped for %u bytes", de_drops );
+TEST_CHECK( stats.timeouts == stats.polls - 1,
+            "%u timeouts for %u unanswered polls", stats.timeouts,
+            stats.polls );
+}
+
+/* A node replies after the turnaround from the slot timer, never from the
+   receive interrupt */
+static void test_node_turnaround
+	(
+	void
+	)
+{
+RS485_BUS_CONFIG config = { RS485_ROLE_NODE, RS485_ADDR_ENGINE_CONTROLLER };
+RS485_RX_STATS   rx;
+uint8_t          status[TEST_PEER_REPLY_SIZE] = { 9, 8, 7 };
+
+bus_start( &config );
+rs485_bus_set_reply_data( status, sizeof( status ) );
+for ( uint8_t seq = 1; seq <= 50; ++seq )
+	{
+	peer_send( RS485_ADDR_ENGINE_CONTROLLER, RS485_ADDR_MASTER, seq, NULL,
+	           0 );
+	run( 500 );
+	}
+
+rs485_bus_get_rx_stats( &rx );
+printf( "rs485 node: %u polls answered, turnaround %u to %u us\n",
+        peer.replies_seen, peer.turnaround_min, peer.turnaround_max );
+TEST_CHECK( peer.replies_seen == 50 && peer.frame_errors == 0,
+            "%u replies, %u corrupt", peer.replies_seen, peer.frame_errors );
+TEST_CHECK( isr_tx_starts == 0, "%u replies sent from the receive interrupt",
+            isr_tx_starts );
+TEST_CHECK( peer.turnaround_min >= RS485_TURNAROUND_US &&
+            peer.turnaround_max <= RS485_TURNAROUND_US + 2*TEST_BYTE_US,
+            "turnaround %u to %u us", peer.turnaround_min,
+            peer.turnaround_max );
+TEST_CHECK( rx.tx_skipped == 0 &&
+            !( RS485_SLOT_TIM.Instance->CR1 & TIM_CR1_CEN ),
+            "%u replies skipped, turnaround timer left running",
+            rx.tx_skipped );
+}
+
+/* Polls that come faster than a full reply skip the replies that would cut
+   off the one being sent */
+static void test_node_busy
+	(
+	void
+	)
+{
+RS485_BUS_CONFIG config = { RS485_ROLE_NODE, RS485_ADDR_ENGINE_CONTROLLER };
+RS485_RX_STATS   rx;
+uint8_t          status[RS485_MAX_PAYLOAD];
+
+memset( status, 0xA5, sizeof( status ) );
+bus_start( &config );
+rs485_bus_set_reply_data( status, sizeof( status ) );
+for ( uint8_t seq = 1; seq <= 20; ++seq )
+	{
+	peer_send( RS485_ADDR_ENGINE_CONTROLLER, RS485_ADDR_MASTER, seq, NULL,
+	           0 );
+	run( 300 );
+	}
+run( 1000 );
+
+rs485_bus_get_rx_stats( &rx );
+printf( "rs485 node: 20 polls every 300 us, %u full replies sent, %u "
+        "skipped\n", peer.replies_seen, rx.tx_skipped );
+TEST_CHECK( rx.tx_skipped > 0 && peer.replies_seen + rx.tx_skipped == 20,
+            "%u replies and %u skipped for 20 polls", peer.replies_seen,
+            rx.tx_skipped );
+TEST_CHECK( peer.frame_errors == 0 && de_drops == 0,
+            "%u replies corrupted, %u bytes without the driver",
+            peer.frame_errors, de_drops );
+}
+
+/* Back to back broadcasts at line rate are all queued, errors that leave the
+   receive DMA running cost nothing and an overrun costs the frame it cut */
+static void test_line_rate
+	(
+	void
+	)
+{
+RS485_BUS_CONFIG config = { RS485_ROLE_NODE, RS485_ADDR_ENGINE_CONTROLLER };
+RS485_RX_STATS   rx;
+uint32_t         starts;
+uint32_t         start_us;
+uint32_t         lost;
+
+bus_start( &config );
+stream_sent = 0;
+stream_got  = 0;
+stream_next = 0;
+stream_gaps = 0;
+start_us    = now;
+stream( TEST_STREAM_FRAMES );
+rs485_bus_get_rx_stats( &rx );
+printf( "rs485 line rate: %u broadcasts in %u us, %u queued, %u frame "
+        "errors, %u queue drops\n", stream_sent, now - start_us, stream_got,
+        rx.frame_errors, rx.queue_drops );
+TEST_CHECK( stream_got == stream_sent && stream_gaps == 0 && 
+            rx.frame_errors == 0 && rx.queue_drops == 0,
+            "%u of %u broadcasts, %u gaps", stream_got, stream_sent,
+            stream_gaps );
+
+/* Noise, framing, parity and transmit errors mid frame */
+starts = dma_starts;
+for ( int i = 0; i < 4; ++i )
+	{
+	stream( 5 );
+	stream_send();
+	run( 3*TEST_BYTE_US );
+	if ( i == 3 )
+		{
+		RS485_HUART.gState = HAL_UART_STATE_READY;
+		uart_error( HAL_UART_ERROR_DMA, false );
+		}
+	else
+		{
+		uart_error( ( uint32_t[3] ) { HAL_UART_ERROR_FE, HAL_UART_ERROR_NE,
+		                              HAL_UART_ERROR_PE }[i], false );
+		}
+	}
+stream( 5 );
+rs485_bus_get_rx_stats( &rx );
+TEST_CHECK( dma_starts == starts && rx.rx_restarts == 0 && 
+            rx.uart_errors == 4, "%u restarts for %u non-blocking errors",
+            dma_starts - starts, rx.uart_errors );
+TEST_CHECK( stream_got == stream_sent && stream_gaps == 0,
+            "%u of %u broadcasts across non-blocking errors", stream_got,
+            stream_sent );
+
+/* Overruns mid frame, the receive DMA restarts and the frame after the cut
+   one arrives */
+for ( int i = 0; i < 10; ++i )
+	{
+	stream( 3 );
+	stream_send();
+	run( 3*TEST_BYTE_US );
+	uart_error( HAL_UART_ERROR_ORE, true );
+	}
+stream( 20 );
+rs485_bus_get_rx_stats( &rx );
+lost = stream_sent - stream_got;
+printf( "rs485 line rate: 10 overruns, %u restarts, %u broadcasts lost\n",
+        rx.rx_restarts, lost );
+TEST_CHECK( dma_running && rx.rx_restarts == 10,
+            "%u receive DMA restarts for 10 overruns", rx.rx_restarts );
+TEST_CHECK( lost == 10 && stream_gaps == 10, 
+            "%u broadcasts lost, %u gaps for 10 cut frames", lost,
+            stream_gaps );
+}
+
+/* The point to point calls stay off the UART while the bus owns it */
+static void test_exclusive
+	(
+	void
+	)
+{
+RS485_BUS_CONFIG config = { RS485_ROLE_NODE, RS485_ADDR_ENGINE_CONTROLLER };
+uint8_t          byte   = 0;
+
+bus_start( &config );
+TEST_CHECK( rs485_bus_active(), "bus not reported active" );
+TEST_CHECK( rs485_transmit_byte( byte )       == RS485_BUSY &&
+            rs485_transmit( &byte, 1, 10 )    == RS485_BUSY &&
+            rs485_receive_byte( &byte )       == RS485_BUSY &&
+            rs485_receive( &byte, 1, 10 )     == RS485_BUSY &&
+            rs485_receive_IT( &byte, 1 )      == RS485_BUSY,
+            "blocking call let through while the bus owns the UART" );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_master_polls();
+test_master_skips();
+test_node_turnaround();
+test_node_busy();
+test_line_rate();
+test_exclusive();
+
+TEST_EXIT( "test_rs485_bus" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
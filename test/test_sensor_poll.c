@@ -0,0 +1,629 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_sensor_poll.c
+*
+* DESCRIPTION:
+* 		Host test for the sensor poll sessions. Poll commands arrive on two
+*       simulated links, one with a receive op that does not wait and one
+*       that only reports the bytes it has, and replies go out on a transmit
+*       queue the test drains by hand. Checks that a poll returns as soon as
+*       its link runs dry, that sessions on both links run side by side with
+*       their own buffers, that a request finding both buffers queued is held
+*       until one is sent, that WAIT, RESUME and STOP are followed, that a
+*       full queue or a failed send is counted as a drop, and that a bad
+*       command or a link error closes the session with the code of its link
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <string.h>
+#include "test.h"
+#include "../sensor/sensor.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_LINK_SIZE              ( 256 )
+#define TEST_QUEUE_DEPTH            ( 4   )
+#define TEST_OX_POS                 ( 0x11223344 )
+#define TEST_FUEL_POS               ( -1000      )
+
+
+/*------------------------------------------------------------------------------
+ Valve model
+------------------------------------------------------------------------------*/
+static int32_t ox_pos   = TEST_OX_POS;
+static int32_t fuel_pos = TEST_FUEL_POS;
+
+int32_t valve_get_ox_valve_pos
+	(
+	void
+	)
+{
+return ox_pos;
+}
+
+int32_t valve_get_fuel_valve_pos
+	(
+	void
+	)
+{
+return fuel_pos;
+}
+
+/* The valve UART link is not used */
+VALVE_STATUS valve_transmit
+	(
+	void*    tx_data_ptr ,
+	size_t   tx_data_size,
+	uint32_t timeout
+	)
+{
+return VALVE_UART_ERROR;
+}
+
+VALVE_STATUS valve_receive
+	(
+	void*    rx_data_ptr ,
+	size_t   rx_data_size,
+	uint32_t timeout
+	)
+{
+return VALVE_UART_ERROR;
+}
+
+
+/*------------------------------------------------------------------------------
+ Link model
+------------------------------------------------------------------------------*/
+typedef struct TEST_LINK
+	{
+	uint8_t               rx_stream[TEST_LINK_SIZE]; /* Bytes to the firmware */
+	size_t                rx_len;
+	size_t                rx_pos;
+	bool                  rx_fail;                   /* Receive ops fail      */
+	uint8_t               tx_stream[TEST_LINK_SIZE]; /* Bytes sent back       */
+	size_t                tx_len;
+	size_t                tx_depth;                  /* Queue entries allowed */
+	const void*           queue_data[TEST_QUEUE_DEPTH];
+	size_t                queue_size[TEST_QUEUE_DEPTH];
+	TRANSPORT_TX_CALLBACK queue_callback[TEST_QUEUE_DEPTH];
+	size_t                num_queued;
+	} TEST_LINK;
+
+static TEST_LINK link_a;
+static TEST_LINK link_b;
+
+static TRANSPORT_STATUS link_receive
+	(
+	TEST_LINK* link_ptr,
+	void*      data    ,
+	size_t     size
+	)
+{
+if ( link_ptr->rx_fail )
+	{
+	return TRANSPORT_FAIL;
+	}
+if ( link_ptr->rx_pos + size > link_ptr->rx_len )
+	{
+	return TRANSPORT_TIMEOUT;
+	}
+memcpy( data, &link_ptr->rx_stream[link_ptr->rx_pos], size );
+link_ptr->rx_pos += size;
+return TRANSPORT_OK;
+}
+
+static TRANSPORT_STATUS link_transmit_async
+	(
+	TEST_LINK*            link_ptr,
+	const void*           data    ,
+	size_t                size    ,
+	TRANSPORT_TX_CALLBACK callback
+	)
+{
+if ( link_ptr->num_queued == link_ptr->tx_depth )
+	{
+	return TRANSPORT_BUSY;
+	}
+link_ptr->queue_data[link_ptr->num_queued]     = data;
+link_ptr->queue_size[link_ptr->num_queued]     = size;
+link_ptr->queue_callback[link_ptr->num_queued] = callback;
+link_ptr->num_queued++;
+return TRANSPORT_OK;
+}
+
+/* The link sends the oldest queued buffer */
+static void link_complete
+	(
+	TEST_LINK*       link_ptr,
+	TRANSPORT_STATUS status
+	)
+{
+const void*           data     = link_ptr->queue_data[0];
+size_t                size     = link_ptr->queue_size[0];
+TRANSPORT_TX_CALLBACK callback = link_ptr->queue_callback[0];
+
+TEST_CHECK( link_ptr->num_queued > 0, "nothing queued to send" );
+if ( link_ptr->num_queued == 0 )
+	{
+	return;
+	}
+link_ptr->num_queued--;
+memmove( &link_ptr->queue_data[0], &link_ptr->queue_data[1],
+         link_ptr->num_queued*sizeof( link_ptr->queue_data[0] ) );
+memmove( &link_ptr->queue_size[0], &link_ptr->queue_size[1],
+         link_ptr->num_queued*sizeof( link_ptr->queue_size[0] ) );
+memmove( &link_ptr->queue_callback[0], &link_ptr->queue_callback[1],
+         link_ptr->num_queued*sizeof( link_ptr->queue_callback[0] ) );
+if ( status == TRANSPORT_OK )
+	{
+	memcpy( &link_ptr->tx_stream[link_ptr->tx_len], data, size );
+	link_ptr->tx_len += size;
+	}
+if ( callback != NULL )
+	{
+	callback( data, size, status );
+	}
+}
+
+/* Link A takes received bytes without waiting */
+static TRANSPORT_STATUS link_a_receive
+	(
+	void*    data   ,
+	size_t   size   ,
+	uint32_t timeout
+	)
+{
+return link_receive( &link_a, data, size );
+}
+
+static TRANSPORT_STATUS link_a_receive_async
+	(
+	void*   data    ,
+	size_t  size    ,
+	size_t* rx_count
+	)
+{
+size_t num_bytes = link_a.rx_len - link_a.rx_pos;
+
+*rx_count = 0;
+if ( link_a.rx_fail )
+	{
+	return TRANSPORT_FAIL;
+	}
+if ( num_bytes > size )
+	{
+	num_bytes = size;
+	}
+memcpy( data, &link_a.rx_stream[link_a.rx_pos], num_bytes );
+link_a.rx_pos += num_bytes;
+*rx_count      = num_bytes;
+return TRANSPORT_OK;
+}
+
+static TRANSPORT_STATUS link_a_transmit_async
+	(
+	const void*           data    ,
+	size_t                size    ,
+	TRANSPORT_TX_CALLBACK callback
+	)
+{
+return link_transmit_async( &link_a, data, size, callback );
+}
+
+/* Link B only reports how many bytes it has */
+static TRANSPORT_STATUS link_b_receive
+	(
+	void*    data   ,
+	size_t   size   ,
+	uint32_t timeout
+	)
+{
+return link_receive( &link_b, data, size );
+}
+
+static size_t link_b_available
+	(
+	void
+	)
+{
+return link_b.rx_len - link_b.rx_pos;
+}
+
+static TRANSPORT_STATUS link_b_transmit_async
+	(
+	const void*           data    ,
+	size_t                size    ,
+	TRANSPORT_TX_CALLBACK callback
+	)
+{
+return link_transmit_async( &link_b, data, size, callback );
+}
+
+static const TRANSPORT transport_a =
+	{
+	.transmit       = NULL                 ,
+	.receive        = link_a_receive       ,
+	.receive_async  = link_a_receive_async ,
+	.flush          = NULL                 ,
+	.transmit_async = link_a_transmit_async,
+	.tx_wait        = NULL                 ,
+	.available      = NULL                 ,
+	.timeout        = 10                   ,
+	.link           = TRANSPORT_LINK_USB
+	};
+
+static const TRANSPORT transport_b =
+	{
+	.transmit       = NULL                 ,
+	.receive        = link_b_receive       ,
+	.receive_async  = NULL                 ,
+	.flush          = NULL                 ,
+	.transmit_async = link_b_transmit_async,
+	.tx_wait        = NULL                 ,
+	.available      = link_b_available     ,
+	.timeout        = 10                   ,
+	.link           = TRANSPORT_LINK_RS485
+	};
+
+static void link_reset
+	(
+	TEST_LINK* link_ptr
+	)
+{
+memset( link_ptr, 0, sizeof( *link_ptr ) );
+link_ptr->tx_depth = TEST_QUEUE_DEPTH;
+}
+
+/* Bytes arrive on a link */
+static void link_send
+	(
+	TEST_LINK*     link_ptr,
+	const uint8_t* data    ,
+	size_t         size
+	)
+{
+memcpy( &link_ptr->rx_stream[link_ptr->rx_len], data, size );
+link_ptr->rx_len += size;
+}
+
+/* Start a poll of the given sensors, the poll subcommand has been read */
+static void send_setup
+	(
+	TEST_LINK*     link_ptr   ,
+	const uint8_t* sensors    ,
+	uint8_t        num_sensors
+	)
+{
+uint8_t start = SENSOR_POLL_START;
+
+link_send( link_ptr, &num_sensors, 1 );
+link_send( link_ptr, sensors, num_sensors );
+link_send( link_ptr, &start, 1 );
+}
+
+static void send_cmd
+	(
+	TEST_LINK* link_ptr,
+	uint8_t    cmd
+	)
+{
+link_send( link_ptr, &cmd, 1 );
+}
+
+/* Check reply n sent on a link, sensor bytes in poll order */
+static void check_reply
+	(
+	const char*    name       ,
+	TEST_LINK*     link_ptr   ,
+	size_t         reply_size ,
+	size_t         n          ,
+	const int32_t* values     ,
+	size_t         num_values
+	)
+{
+int32_t value;
+
+TEST_CHECK( link_ptr->tx_len >= ( n + 1 )*reply_size,
+            "%s: reply %zu missing, %zu bytes sent", name, n,
+            link_ptr->tx_len );
+if ( link_ptr->tx_len < ( n + 1 )*reply_size )
+	{
+	return;
+	}
+for ( size_t i = 0; i < num_values; ++i )
+	{
+	memcpy( &value, &link_ptr->tx_stream[n*reply_size + 4*i], 4 );
+	TEST_CHECK( value == values[i], "%s: reply %zu value %zu is %d, "
+	            "expected %d", name, n, i, value, values[i] );
+	}
+}
+
+static void reset
+	(
+	void
+	)
+{
+link_reset( &link_a );
+link_reset( &link_b );
+memset( sensor_sessions, 0, sizeof( sensor_sessions ) );
+sensor_tx_drops = 0;
+ox_pos          = TEST_OX_POS;
+fuel_pos        = TEST_FUEL_POS;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* A poll returns once its link runs dry, the setup can arrive a byte at a
+   time and the main loop finishes it */
+static void test_setup
+	(
+	void
+	)
+{
+static const uint8_t sensors[] = { SENSOR_ENCF, SENSOR_ENCO };
+static const int32_t values[]  = { TEST_FUEL_POS, TEST_OX_POS };
+uint8_t              count     = 2;
+
+reset();
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a ) ==
+            SENSOR_OK, "setup: empty link not returned" );
+TEST_CHECK( sensor_poll_active( &transport_a ) &&
+            !sensor_poll_active( &transport_b ), "setup: session not open" );
+
+link_send( &link_a, &count, 1 );
+link_send( &link_a, &sensors[0], 1 );
+TEST_CHECK( sensor_poll_service() == SENSOR_OK, "setup: partial ids" );
+TEST_CHECK( sensor_sessions[0].state == SENSOR_SESSION_IDS,
+            "setup: state %d after one id", sensor_sessions[0].state );
+link_send( &link_a, &sensors[1], 1 );
+send_cmd( &link_a, SENSOR_POLL_START );
+send_cmd( &link_a, SENSOR_POLL_REQUEST );
+TEST_CHECK( sensor_poll_service() == SENSOR_OK, "setup: request" );
+TEST_CHECK( link_a.num_queued == 1, "setup: %zu replies queued",
+            link_a.num_queued );
+link_complete( &link_a, TRANSPORT_OK );
+check_reply( "setup", &link_a, 8, 0, values, 2 );
+
+send_cmd( &link_a, SENSOR_POLL_STOP );
+TEST_CHECK( sensor_poll_service() == SENSOR_OK, "setup: stop" );
+TEST_CHECK( !sensor_poll_active( &transport_a ), "setup: not closed" );
+}
+
+/* Sessions on two links run side by side, each with its own buffers */
+static void test_concurrent
+	(
+	void
+	)
+{
+static const uint8_t ox[]   = { SENSOR_ENCO };
+static const uint8_t both[] = { SENSOR_ENCO, SENSOR_ENCF };
+int32_t              a_values[1];
+int32_t              b_values[2];
+
+reset();
+send_setup( &link_a, ox, 1 );
+send_setup( &link_b, both, 2 );
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a ) ==
+            SENSOR_OK, "concurrent: link A poll" );
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_b ) ==
+            SENSOR_OK, "concurrent: link B poll" );
+TEST_CHECK( sensor_poll_active( &transport_a ) &&
+            sensor_poll_active( &transport_b ), "concurrent: not both open" );
+
+for ( int i = 0; i < 6; ++i )
+	{
+	ox_pos   = 100 + i;
+	fuel_pos = -100 - i;
+	send_cmd( ( i % 3 ) ? &link_b : &link_a, SENSOR_POLL_REQUEST );
+	TEST_CHECK( sensor_poll_service() == SENSOR_OK, "concurrent: poll %d",
+	            i );
+	if ( i % 3 )
+		{
+		link_complete( &link_b, TRANSPORT_OK );
+		}
+	else
+		{
+		link_complete( &link_a, TRANSPORT_OK );
+		}
+	}
+
+/* Link A polled at 0 and 3, link B at the others */
+a_values[0] = 100;
+check_reply( "concurrent A", &link_a, 4, 0, a_values, 1 );
+a_values[0] = 103;
+check_reply( "concurrent A", &link_a, 4, 1, a_values, 1 );
+for ( int i = 0, n = 0; i < 6; ++i )
+	{
+	if ( i % 3 )
+		{
+		b_values[0] = 100 + i;
+		b_values[1] = -100 - i;
+		check_reply( "concurrent B", &link_b, 8, n++, b_values, 2 );
+		}
+	}
+TEST_CHECK( link_a.tx_len == 8 && link_b.tx_len == 32,
+            "concurrent: %zu and %zu bytes sent", link_a.tx_len,
+            link_b.tx_len );
+TEST_CHECK( sensor_sessions[0].transport_ptr !=
+            sensor_sessions[1].transport_ptr, "concurrent: shared slot" );
+}
+
+/* A request finding both buffers queued waits for one to be sent */
+static void test_held_request
+	(
+	void
+	)
+{
+static const uint8_t ox[] = { SENSOR_ENCO };
+int32_t              values[1];
+
+reset();
+send_setup( &link_a, ox, 1 );
+for ( int i = 0; i < 3; ++i )
+	{
+	send_cmd( &link_a, SENSOR_POLL_REQUEST );
+	}
+send_cmd( &link_a, SENSOR_POLL_STOP );
+ox_pos = 1;
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a ) ==
+            SENSOR_OK, "held: poll" );
+TEST_CHECK( link_a.num_queued == 2 && sensor_sessions[0].cmd_pending,
+            "held: %zu queued, pending %d", link_a.num_queued,
+            sensor_sessions[0].cmd_pending );
+
+/* Nothing is sent again while both buffers are out */
+ox_pos = 2;
+TEST_CHECK( sensor_poll_service() == SENSOR_OK && link_a.num_queued == 2,
+            "held: queued with both buffers busy" );
+
+link_complete( &link_a, TRANSPORT_OK );
+TEST_CHECK( sensor_poll_service() == SENSOR_OK, "held: release" );
+TEST_CHECK( !sensor_poll_active( &transport_a ) && link_a.num_queued == 2,
+            "held: request and stop not taken after release" );
+link_complete( &link_a, TRANSPORT_OK );
+link_complete( &link_a, TRANSPORT_OK );
+values[0] = 1;
+check_reply( "held", &link_a, 4, 0, values, 1 );
+check_reply( "held", &link_a, 4, 1, values, 1 );
+values[0] = 2;
+check_reply( "held", &link_a, 4, 2, values, 1 );
+TEST_CHECK( sensor_get_tx_drops() == 0, "held: %u drops",
+            sensor_get_tx_drops() );
+}
+
+/* WAIT drops everything up to RESUME */
+static void test_wait
+	(
+	void
+	)
+{
+static const uint8_t ox[] = { SENSOR_ENCO };
+
+reset();
+send_setup( &link_b, ox, 1 );
+send_cmd( &link_b, SENSOR_POLL_WAIT );
+send_cmd( &link_b, SENSOR_POLL_REQUEST );
+send_cmd( &link_b, 0x55 );
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_b ) ==
+            SENSOR_OK, "wait: poll" );
+TEST_CHECK( sensor_sessions[0].state == SENSOR_SESSION_WAIT &&
+            link_b.num_queued == 0, "wait: request taken while paused" );
+send_cmd( &link_b, SENSOR_POLL_RESUME );
+send_cmd( &link_b, SENSOR_POLL_REQUEST );
+TEST_CHECK( sensor_poll_service() == SENSOR_OK && link_b.num_queued == 1,
+            "wait: request after resume not sent" );
+}
+
+/* Full queues and failed sends are counted as drops */
+static void test_drops
+	(
+	void
+	)
+{
+static const uint8_t ox[] = { SENSOR_ENCO };
+
+reset();
+link_a.tx_depth = 1;
+send_setup( &link_a, ox, 1 );
+send_cmd( &link_a, SENSOR_POLL_REQUEST );
+send_cmd( &link_a, SENSOR_POLL_REQUEST );
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a ) ==
+            SENSOR_OK, "drops: poll" );
+TEST_CHECK( sensor_get_tx_drops() == 1 && !sensor_sessions[0].cmd_pending,
+            "drops: %u drops on a full queue", sensor_get_tx_drops() );
+link_complete( &link_a, TRANSPORT_FAIL );
+TEST_CHECK( sensor_get_tx_drops() == 2, "drops: failed send not counted" );
+TEST_CHECK( !sensor_sessions[0].tx_busy[0] &&
+            !sensor_sessions[0].tx_busy[1], "drops: buffer left busy" );
+}
+
+/* Bad commands and link errors close the session */
+static void test_errors
+	(
+	void
+	)
+{
+static const uint8_t ox[] = { SENSOR_ENCO };
+uint8_t              count;
+
+reset();
+count = SENSOR_MAX_NUM_POLL + 1;
+link_send( &link_a, &count, 1 );
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a ) ==
+            SENSOR_POLL_FAIL, "errors: too many sensors accepted" );
+TEST_CHECK( !sensor_poll_active( &transport_a ), "errors: count left open" );
+
+reset();
+count = 1;
+link_send( &link_a, &count, 1 );
+link_send( &link_a, ox, 1 );
+send_cmd( &link_a, SENSOR_POLL_REQUEST );
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a ) ==
+            SENSOR_POLL_FAIL_TO_START, "errors: missing start accepted" );
+
+reset();
+send_setup( &link_a, ox, 1 );
+send_cmd( &link_a, 0x55 );
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a ) ==
+            SENSOR_POLL_UNRECOGNIZED_CMD, "errors: bad command accepted" );
+TEST_CHECK( !sensor_poll_active( &transport_a ), "errors: bad cmd open" );
+
+/* Each link reports its own error code, the other session keeps going */
+reset();
+send_setup( &link_a, ox, 1 );
+send_setup( &link_b, ox, 1 );
+sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a );
+sensor_cmd_execute( SENSOR_POLL_CODE, &transport_b );
+send_cmd( &link_b, SENSOR_POLL_REQUEST );
+link_b.rx_fail = true;
+TEST_CHECK( sensor_poll_service() == SENSOR_RS485_ERROR,
+            "errors: RS485 failure not reported as such" );
+TEST_CHECK( sensor_poll_active( &transport_a ) &&
+            !sensor_poll_active( &transport_b ), "errors: wrong session closed" );
+link_a.rx_fail = true;
+TEST_CHECK( sensor_poll_service() == SENSOR_USB_FAIL,
+            "errors: USB failure not reported as such" );
+
+/* A fourth link finds no free slot */
+reset();
+for ( int i = 0; i < SENSOR_MAX_SESSIONS; ++i )
+	{
+	sensor_sessions[i].state         = SENSOR_SESSION_RUN;
+	sensor_sessions[i].transport_ptr = &transport_usb;
+	}
+TEST_CHECK( sensor_cmd_execute( SENSOR_POLL_CODE, &transport_a ) ==
+            SENSOR_POLL_FAIL, "errors: session opened with no free slot" );
+}
+
+
+int main
+	(
+	void
+	)
+{
+sensor_init();
+
+test_setup();
+test_concurrent();
+test_held_request();
+test_wait();
+test_drops();
+test_errors();
+
+TEST_EXIT( "test_sensor_poll" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,264 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_telemetry.c
+*
+* DESCRIPTION:
+* 		Host test for the telemetry scheduler. The flight loop publishes every
+*       channel at its target rate into the scheduler while a simulated radio
+*       drains its queue, and the packets handed to it are parsed back into
+*       records. Checks that the plan and the token bucket charge the radio's
+*       per packet overhead so the link never carries more than the budget,
+*       that the critical channel keeps its rate when the overhead pushes the
+*       low priorities out, and that LoRa packets are cut to the size the
+*       modem sends within TLM_MAX_PACKET_TIME
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../telemetry/telemetry.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Simulated run, ms */
+#define TEST_RUN_MS                 ( 60000 )
+
+/* Radio queue drain period, ms */
+#define TEST_RADIO_PERIOD_MS        ( 20 )
+
+
+/*------------------------------------------------------------------------------
+ Radio model
+------------------------------------------------------------------------------*/
+
+static uint32_t now_ms;
+static uint8_t  radio_queue;        /* Packets waiting in the radio       */
+static size_t   radio_max_payload;  /* Largest payload in time on air     */
+static uint32_t radio_bytes;        /* Payload bytes handed to the radio  */
+static uint32_t radio_packets;
+static size_t   radio_largest;      /* Largest packet handed to it        */
+static uint32_t records[TLM_NUM_CHANNELS];
+static uint32_t bad_packets;        /* Packets that do not parse          */
+
+uint32_t HAL_GetTick
+	(
+	void
+	)
+{
+return now_ms;
+}
+
+uint8_t rf_tx_pending
+	(
+	WIRELESS_MOD_CODES module
+	)
+{
+return radio_queue;
+}
+
+size_t rf_max_payload
+	(
+	WIRELESS_MOD_CODES module     ,
+	uint32_t           max_time_us
+	)
+{
+return ( module == LORA ) ? radio_max_payload : RF_MAX_PAYLOAD;
+}
+
+/* Parse the records back out of a packet */
+RF_STATUS rf_send
+	(
+	WIRELESS_MOD_CODES module   ,
+	uint64_t           dest_addr,
+	const void*        data_ptr ,
+	size_t             size
+	)
+{
+const uint8_t* packet = data_ptr;
+size_t         pos    = TLM_PACKET_HEADER_SIZE;
+
+for ( uint8_t r = 0; r < packet[6] && pos + 1 < size; ++r )
+	{
+	if ( packet[pos] < TLM_NUM_CHANNELS )
+		{
+		records[packet[pos]]++;
+		}
+	pos += TLM_RECORD_HEADER_SIZE + packet[pos + 1];
+	}
+if ( pos != size )
+	{
+	bad_packets++;
+	}
+radio_queue++;
+radio_bytes += size;
+radio_packets++;
+if ( size > radio_largest )
+	{
+	radio_largest = size;
+	}
+return RF_OK;
+}
+
+/* Start the scheduler and run the flight loop, returns the init status */
+static TLM_STATUS run
+	(
+	WIRELESS_MOD_CODES module  ,
+	uint32_t           budget  ,
+	uint16_t           size    ,
+	uint16_t           overhead
+	)
+{
+TLM_CONFIG config = { module, 0, budget, size, overhead };
+uint8_t    sample[TLM_MAX_RECORD_SIZE] = { 0 };
+uint32_t   period;
+TLM_STATUS status;
+
+now_ms        = 1000;
+radio_queue   = 0;
+radio_bytes   = 0;
+radio_packets = 0;
+radio_largest = 0;
+bad_packets   = 0;
+memset( records, 0, sizeof( records ) );
+status = tlm_init( &config );
+if ( status != TLM_OK )
+	{
+	return status;
+	}
+for ( uint32_t t = 0; t < TEST_RUN_MS; ++t )
+	{
+	now_ms++;
+	for ( uint8_t ch = 0; ch < TLM_NUM_CHANNELS; ++ch )
+		{
+		period = (uint32_t) ( 1000.0f/tlm_default_channels[ch].rate );
+		if ( now_ms % period == 0 )
+			{
+			tlm_publish( ch, sample, tlm_default_channels[ch].size );
+			}
+		}
+	if ( ( now_ms % TEST_RADIO_PERIOD_MS == 0 ) && ( radio_queue > 0 ) )
+		{
+		radio_queue--;
+		}
+	if ( now_ms % 5 == 0 )
+		{
+		tlm_update();
+		}
+	}
+return TLM_OK;
+}
+
+/* Link use including the overhead against the budget and the bucket */
+static void check_budget
+	(
+	uint32_t budget  ,
+	uint16_t size    ,
+	uint16_t overhead
+	)
+{
+float             used;
+float             planned = 0.0f;
+float             packet_rate = 0.0f;
+TLM_CHANNEL_STATS stats;
+
+used = ( radio_bytes + (float) radio_packets*overhead )*1000.0f/TEST_RUN_MS;
+for ( uint8_t ch = 0; ch < TLM_NUM_CHANNELS; ++ch )
+	{
+	tlm_get_channel_stats( ch, &stats );
+	planned += stats.planned_rate*( TLM_RECORD_HEADER_SIZE + 
+	                                channel_config[ch].size );
+	if ( stats.planned_rate > packet_rate )
+		{
+		packet_rate = stats.planned_rate;
+		}
+	}
+planned += packet_rate*( TLM_PACKET_HEADER_SIZE + overhead );
+TEST_CHECK( planned <= budget*1.001f, "%u B/s budget, %.1f B/s planned with "
+            "%u bytes of overhead", budget, planned, overhead );
+TEST_CHECK( used <= budget + 
+            1000.0f*TLM_BUCKET_PACKETS*( size + overhead )/TEST_RUN_MS,
+            "%u B/s budget, %.1f B/s used with %u bytes of overhead", budget,
+            used, overhead );
+TEST_CHECK( bad_packets == 0, "%u packets did not parse", bad_packets );
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* The overhead is paid for by the lowest priorities, the state keeps its
+   rate and the link stays within the budget */
+static void test_overhead
+	(
+	void
+	)
+{
+TLM_CHANNEL_STATS state;
+TLM_CHANNEL_STATS gps[2];
+uint16_t          overhead[2] = { 0, 18 };
+
+for ( int i = 0; i < 2; ++i )
+	{
+	TEST_CHECK( run( XBEE, 400, 100, overhead[i] ) == TLM_OK,
+	            "scheduler not started" );
+	check_budget( 400, 100, overhead[i] );
+	tlm_get_channel_stats( TLM_CH_STATE, &state );
+	tlm_get_channel_stats( TLM_CH_GPS  , &gps[i] );
+	printf( "telemetry: %u bytes overhead, %.1f B/s on the link, state "
+	        "%.2f Hz, gps planned %.2f Hz\n", overhead[i],
+	        ( radio_bytes + (float) radio_packets*overhead[i] )*1000.0f/
+	        TEST_RUN_MS, records[TLM_CH_STATE]*1000.0f/TEST_RUN_MS,
+	        gps[i].planned_rate );
+	TEST_CHECK( state.planned_rate == state.target_rate &&
+	            records[TLM_CH_STATE] >= 0.98f*state.target_rate*
+	                                     TEST_RUN_MS/1000,
+	            "state sent %u times at %.2f Hz planned",
+	            records[TLM_CH_STATE], state.planned_rate );
+	}
+TEST_CHECK( gps[1].planned_rate < gps[0].planned_rate,
+            "gps planned at %.2f Hz with the overhead, %.2f Hz without",
+            gps[1].planned_rate, gps[0].planned_rate );
+}
+
+/* LoRa packets fit the time on air, and settings too slow for a record are
+   refused */
+static void test_lora_size
+	(
+	void
+	)
+{
+radio_max_payload = 24;
+TEST_CHECK( run( LORA, 300, 100, 0 ) == TLM_OK, "scheduler not started" );
+check_budget( 300, 24, 0 );
+TEST_CHECK( radio_largest <= 24 && radio_packets > 0,
+            "%zu byte packet for a 24 byte limit", radio_largest );
+
+radio_max_payload = TLM_PACKET_HEADER_SIZE + TLM_RECORD_HEADER_SIZE;
+TEST_CHECK( run( LORA, 300, 100, 0 ) == TLM_INVALID_CONFIG,
+            "no room for a record accepted" );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_overhead();
+test_lora_size();
+
+TEST_EXIT( "test_telemetry" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
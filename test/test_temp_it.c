@@ -0,0 +1,283 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_temp_it.c
+*
+* DESCRIPTION:
+* 		Host test for the interrupt driven MCP9600 sampling. A register model
+*       finishes a conversion every conversion time of the configured ADC
+*       resolution, I2C completions are delivered from a simulated 1 ms main
+*       loop that calls temp_get_sample. Checks that every conversion is
+*       picked up while the status register is only read when a conversion
+*       is due, instead of on every call
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../temp/temp.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_RUN_MS                 ( 4000 )
+
+
+/*------------------------------------------------------------------------------
+ MCP9600 model
+------------------------------------------------------------------------------*/
+static uint8_t  regs[64];
+static uint8_t  pointer;
+static bool     pointer_loaded;
+static uint32_t ticks;
+static uint32_t conv_time;
+static uint32_t next_conv;
+static uint32_t conversions;
+static uint32_t status_reads;
+
+/* Interrupt driven transfer in flight */
+static enum { XFER_NONE, XFER_READ, XFER_WRITE } xfer;
+static uint8_t  xfer_reg;
+static uint8_t* xfer_data;
+static uint16_t xfer_size;
+static bool     xfer_fail;
+
+uint32_t HAL_GetTick
+	(
+	void
+	)
+{
+return ticks;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint8_t*           data,
+	uint16_t           size,
+	uint32_t           timeout
+	)
+{
+if ( !pointer_loaded )
+	{
+	pointer        = data[0];
+	pointer_loaded = true;
+	}
+else
+	{
+	regs[pointer]  = data[0];
+	pointer_loaded = false;
+	}
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Receive
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint8_t*           data,
+	uint16_t           size,
+	uint32_t           timeout
+	)
+{
+memcpy( data, &regs[pointer], size );
+pointer_loaded = false;
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint16_t           reg,
+	uint16_t           reg_size,
+	uint8_t*           data,
+	uint16_t           size
+	)
+{
+if ( xfer != XFER_NONE )
+	{
+	return HAL_BUSY;
+	}
+status_reads += ( reg == THERMO_STATUS_REG_ID );
+xfer      = XFER_READ;
+xfer_reg  = (uint8_t) reg;
+xfer_data = data;
+xfer_size = size;
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT
+	(
+	I2C_HandleTypeDef* hi2c,
+	uint16_t           addr,
+	uint16_t           reg,
+	uint16_t           reg_size,
+	uint8_t*           data,
+	uint16_t           size
+	)
+{
+if ( xfer != XFER_NONE )
+	{
+	return HAL_BUSY;
+	}
+xfer      = XFER_WRITE;
+xfer_reg  = (uint8_t) reg;
+xfer_data = data;
+xfer_size = size;
+return HAL_OK;
+}
+
+/* Finish conversions that are due, the hot junction reads the count */
+static void model_tick
+	(
+	void
+	)
+{
+while ( ticks >= next_conv )
+	{
+	conversions++;
+	regs[THERMO_HOT_JUNC_TEMP_REG_ID + 0] = (uint8_t) ( conversions >> 8 );
+	regs[THERMO_HOT_JUNC_TEMP_REG_ID + 1] = (uint8_t) conversions;
+	regs[THERMO_STATUS_REG_ID]           |= THERMO_STATUS_DATA_RDY_BITMASK;
+	next_conv                            += conv_time;
+	}
+}
+
+/* Deliver the I2C completion interrupts of the transfer chain */
+static void i2c_service
+	(
+	void
+	)
+{
+while ( xfer != XFER_NONE )
+	{
+	if ( xfer_fail )
+		{
+		xfer      = XFER_NONE;
+		xfer_fail = false;
+		temp_error_ISR( &hi2c1 );
+		}
+	else if ( xfer == XFER_READ )
+		{
+		memcpy( xfer_data, &regs[xfer_reg], xfer_size );
+		xfer = XFER_NONE;
+		temp_read_cplt_ISR( &hi2c1 );
+		}
+	else
+		{
+		memcpy( &regs[xfer_reg], xfer_data, xfer_size );
+		xfer = XFER_NONE;
+		temp_write_cplt_ISR( &hi2c1 );
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Main loop at 1 ms for each ADC resolution */
+static void test_paced_sampling
+	(
+	THERMO_ADC_RES res
+	)
+{
+THERMO_CONFIG config = { 0 };
+uint32_t      sample;
+uint32_t      last_sample = 0;
+uint32_t      samples     = 0;
+uint32_t      worst_age   = 0;
+
+memset( regs, 0, sizeof( regs ) );
+regs[THERMO_DEV_ID_REG_ID] = THERMO_DEV_ID;
+config.adc_resolution      = res;
+TEST_CHECK( temp_init( &config ) == THERMO_OK, "temp_init failed" );
+TEST_CHECK( regs[THERMO_DEV_CONFIG_REG_ID] == ( res << 5 ),
+            "device config 0x%02x", regs[THERMO_DEV_CONFIG_REG_ID] );
+
+conv_time         = THERMO_CONV_TIME_MS( res );
+next_conv         = ticks + conv_time;
+conversions       = 0;
+status_reads      = 0;
+temp_it_next_tick = ticks;
+temp_it_sample_valid = false;
+
+for ( uint32_t ms = 0; ms < TEST_RUN_MS; ++ms, ++ticks )
+	{
+	model_tick();
+	if ( temp_get_sample( &sample ) == THERMO_OK && sample != last_sample )
+		{
+		samples++;
+		last_sample = sample;
+		}
+	i2c_service();
+
+	/* How far the published sample lags the newest conversion */
+	if ( temp_it_sample_valid && conversions - temp_it_sample > worst_age )
+		{
+		worst_age = conversions - temp_it_sample;
+		}
+	}
+
+printf( "temp %d bit: %u conversions, %u samples, %u status reads in %d ms\n",
+        18 - 2*res, conversions, samples, status_reads, TEST_RUN_MS );
+TEST_CHECK( samples + 1 >= conversions, "missed %u of %u conversions",
+            conversions - samples, conversions );
+TEST_CHECK( worst_age <= 1, "sample lagged %u conversions", worst_age );
+TEST_CHECK( status_reads <= 2*conversions + 2,
+            "%u status reads for %u conversions", status_reads, conversions );
+}
+
+/* A failed transfer backs off and the chain resumes */
+static void test_error_recovery
+	(
+	void
+	)
+{
+uint32_t sample;
+uint32_t before;
+
+ticks += conv_time;
+model_tick();
+xfer_fail = true;
+temp_get_sample( &sample );
+i2c_service();
+TEST_CHECK( temp_it_state == THERMO_IT_IDLE, "sequence stuck after error" );
+
+/* Nothing is read again until the back off has passed */
+before = status_reads;
+temp_get_sample( &sample );
+TEST_CHECK( xfer == XFER_NONE && status_reads == before,
+            "status read right after the error" );
+ticks += conv_time/4;
+temp_get_sample( &sample );
+i2c_service();
+TEST_CHECK( status_reads == before + 1 && temp_it_sample == conversions,
+            "chain did not resume after the back off" );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_paced_sampling( THERMO_18BIT_ADC );
+test_paced_sampling( THERMO_16BIT_ADC );
+test_paced_sampling( THERMO_12BIT_ADC );
+test_error_recovery();
+
+TEST_EXIT( "test_temp_it" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
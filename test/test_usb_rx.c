@@ -0,0 +1,274 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_usb_rx.c
+*
+* DESCRIPTION:
+* 		Host test for the circular DMA receive ring of the USB UART. A
+*       simulated UART writes bursts of a numbered byte stream into the ring
+*       with half, full and idle line events while the main loop reads random
+*       amounts, and every byte must come out once and in order. Also checks
+*       that an overrun is reported and flushed, that noise, framing and
+*       transmit errors leave the ring alone, and that an error which stops
+*       the receive DMA restarts it without losing the bytes that follow
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include "test.h"
+#include "../usb/usb.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_BURSTS                 ( 100000 )
+#define TEST_MAX_BURST              ( USB_RX_BUFFER_SIZE/2 )
+#define TEST_MAX_READ               ( USB_RX_BUFFER_SIZE + 64 )
+
+
+/*------------------------------------------------------------------------------
+ UART model
+------------------------------------------------------------------------------*/
+
+static uint8_t* dma_buf;     /* Ring the receive DMA writes into      */
+static uint16_t dma_size;    /* Ring size                             */
+static bool     dma_running; /* Receive DMA enabled                   */
+static uint32_t dma_starts;  /* Receive DMA starts                    */
+static uint8_t  seq_tx;      /* Next byte of the stream on the wire   */
+static uint8_t  seq_rx;      /* Next byte expected from the reader    */
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA
+	(
+	UART_HandleTypeDef* huart,
+	uint8_t*            data ,
+	uint16_t            size
+	)
+{
+if ( huart->RxState != HAL_UART_STATE_READY )
+	{
+	return HAL_BUSY;
+	}
+huart->RxState      = HAL_UART_STATE_BUSY_RX;
+huart->hdmarx->NDTR = size;
+dma_buf             = data;
+dma_size            = size;
+dma_running         = true;
+dma_starts++;
+return HAL_OK;
+}
+
+/* Bytes on the wire, the DMA raises the half and full ring events and the
+   line goes idle after the burst */
+static void uart_burst
+	(
+	int num_bytes
+	)
+{
+DMA_HandleTypeDef* dma = USB_HUART.hdmarx;
+
+for ( int i = 0; i < num_bytes; ++i )
+	{
+	if ( !dma_running )
+		{
+		seq_tx++;
+		continue;
+		}
+	dma_buf[dma_size - dma->NDTR] = seq_tx++;
+	if ( --dma->NDTR == 0 )
+		{
+		dma->NDTR = dma_size;
+		usb_rx_event_ISR( dma_size );
+		}
+	else if ( dma->NDTR == dma_size/2 )
+		{
+		usb_rx_event_ISR( dma_size/2 );
+		}
+	}
+if ( dma_running )
+	{
+	usb_rx_event_ISR( dma_size - dma->NDTR );
+	}
+}
+
+/* A UART error interrupt. Blocking errors abort the receive DMA first */
+static void uart_error
+	(
+	uint32_t error_code,
+	bool     blocking
+	)
+{
+USB_HUART.ErrorCode = error_code;
+if ( blocking )
+	{
+	dma_running       = false;
+	USB_HUART.RxState = HAL_UART_STATE_READY;
+	}
+usb_error_ISR();
+USB_HUART.ErrorCode = HAL_UART_ERROR_NONE;
+}
+
+/* Read up to max_size bytes and check them against the stream */
+static size_t read_check
+	(
+	size_t max_size
+	)
+{
+uint8_t buffer[TEST_MAX_READ];
+size_t  num_bytes;
+
+num_bytes = usb_read( buffer, max_size );
+for ( size_t i = 0; i < num_bytes; ++i )
+	{
+	if ( buffer[i] != seq_rx )
+		{
+		TEST_CHECK( false, "read 0x%02x, expected 0x%02x", buffer[i],
+		            seq_rx );
+		seq_rx = buffer[i];
+		}
+	seq_rx++;
+	}
+return num_bytes;
+}
+
+/* Reader catches up with the wire after an expected loss */
+static void resync
+	(
+	void
+	)
+{
+uint8_t byte;
+
+TEST_CHECK( usb_peek( &byte ) == USB_EMPTY, "loss not reported" );
+seq_rx = seq_tx;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Random bursts against random reads, the reader keeps within a ring */
+static void test_bursts
+	(
+	void
+	)
+{
+uint64_t sent = 0;
+uint64_t got  = 0;
+int      burst;
+
+srand( 1 );
+TEST_CHECK( usb_init() == USB_OK, "receive DMA not started" );
+for ( int i = 0; i < TEST_BURSTS; ++i )
+	{
+	burst = rand() % TEST_MAX_BURST;
+	uart_burst( burst );
+	sent += burst;
+	got  += read_check( rand() % TEST_MAX_READ );
+	if ( usb_available() >= USB_RX_BUFFER_SIZE/2 )
+		{
+		got += read_check( TEST_MAX_READ );
+		}
+	}
+got += read_check( TEST_MAX_READ );
+printf( "usb rx: %llu bytes in %d bursts, %llu read\n",
+        (unsigned long long) sent, TEST_BURSTS, (unsigned long long) got );
+TEST_CHECK( got == sent, "%llu bytes lost",
+            (unsigned long long) ( sent - got ) );
+}
+
+/* A full ring of unread data is reported and flushed */
+static void test_overflow
+	(
+	void
+	)
+{
+uart_burst( USB_RX_BUFFER_SIZE/2 + 10 );
+uart_burst( USB_RX_BUFFER_SIZE/2 + 10 );
+resync();
+uart_burst( 100 );
+TEST_CHECK( read_check( TEST_MAX_READ ) == 100, "no data after a flush" );
+}
+
+/* Errors that leave the receive DMA running do not touch the ring */
+static void test_nonblocking_errors
+	(
+	void
+	)
+{
+uint32_t starts = dma_starts;
+
+uart_burst( 50 );
+uart_error( HAL_UART_ERROR_FE, false );
+uart_error( HAL_UART_ERROR_NE, false );
+uart_error( HAL_UART_ERROR_PE, false );
+uart_burst( 50 );
+
+/* Transmit DMA error while the receiver runs */
+USB_HUART.gState = HAL_UART_STATE_READY;
+uart_error( HAL_UART_ERROR_DMA, false );
+uart_burst( 50 );
+
+TEST_CHECK( dma_starts == starts, "receive DMA restarted %u times",
+            dma_starts - starts );
+TEST_CHECK( read_check( TEST_MAX_READ ) == 150,
+            "bytes lost across non-blocking errors" );
+}
+
+/* An overrun stops the DMA, the ring is flushed and the DMA restarted */
+static void test_blocking_error
+	(
+	void
+	)
+{
+uint32_t starts = dma_starts;
+
+uart_burst( 40 );
+uart_error( HAL_UART_ERROR_ORE, true );
+TEST_CHECK( dma_starts == starts + 1 && dma_running,
+            "receive DMA not restarted after an overrun" );
+resync();
+uart_burst( 300 );
+TEST_CHECK( read_check( TEST_MAX_READ ) == 300,
+            "bytes lost after the restart" );
+
+/* The restart can fail, the ring is left for the next error to retry */
+uart_burst( 20 );
+USB_HUART.RxState = HAL_UART_STATE_BUSY_RX;
+dma_running       = false;
+USB_HUART.ErrorCode = HAL_UART_ERROR_ORE;
+starts = dma_starts;
+usb_error_ISR();
+TEST_CHECK( dma_starts == starts && !rx_overflow,
+            "ring flagged without a restart" );
+USB_HUART.ErrorCode = HAL_UART_ERROR_NONE;
+uart_error( HAL_UART_ERROR_DMA, true );
+TEST_CHECK( dma_running, "receive DMA not restarted" );
+resync();
+uart_burst( 10 );
+TEST_CHECK( read_check( TEST_MAX_READ ) == 10, "no data after the retry" );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_bursts();
+test_overflow();
+test_nonblocking_errors();
+test_blocking_error();
+
+TEST_EXIT( "test_usb_rx" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,375 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_usb_tx.c
+*
+* DESCRIPTION:
+* 		Host test for the transmit descriptor queue of the USB UART. A
+*       simulated transmit DMA sends the queued buffers one at a time. Checks
+*       that buffers go out in order, that a full queue returns USB_BUSY, that
+*       every buffer gets exactly one callback, that a transmit error and a
+*       transfer that fails to start are reported as USB_FAIL and the queue
+*       moves on, that the transport layer hands the result to its own
+*       callbacks, and that the blocking transmit converts each HAL status
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../usb/usb.c"
+#include "../transport/transport.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_NUM_BUFFERS            ( 2*USB_TX_QUEUE_DEPTH )
+#define TEST_MAX_LOG                ( 64 )
+
+
+/*------------------------------------------------------------------------------
+ UART model
+------------------------------------------------------------------------------*/
+
+static uint8_t           buffers[TEST_NUM_BUFFERS][16];
+static const uint8_t*    dma_data;       /* Buffer the transmit DMA is on   */
+static uint16_t          dma_size;       /* Size of that buffer             */
+static uint32_t          dma_starts;     /* Transmit DMA starts             */
+static int               fail_starts;    /* Starts left to refuse           */
+static HAL_StatusTypeDef blocking_status; /* Blocking transmit result       */
+
+/* Completion log, one entry per callback */
+static const void*       log_data[TEST_MAX_LOG];
+static int               log_status[TEST_MAX_LOG];
+static int               num_log;
+
+/* Buffer a failure callback queues again, NULL for none */
+static const void*       requeue_ptr;
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA
+	(
+	UART_HandleTypeDef* huart,
+	const uint8_t*      data ,
+	uint16_t            size
+	)
+{
+if ( huart->gState != HAL_UART_STATE_READY )
+	{
+	return HAL_BUSY;
+	}
+if ( fail_starts > 0 )
+	{
+	fail_starts--;
+	return HAL_ERROR;
+	}
+huart->gState = HAL_UART_STATE_BUSY_TX;
+dma_data      = data;
+dma_size      = size;
+dma_starts++;
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit
+	(
+	UART_HandleTypeDef* huart  ,
+	const uint8_t*      data   ,
+	uint16_t            size   ,
+	uint32_t            timeout
+	)
+{
+if ( ( data == NULL ) || ( size == 0 ) )
+	{
+	return HAL_ERROR;
+	}
+return blocking_status;
+}
+
+/* The transmit DMA finishes the buffer in progress */
+static void dma_complete
+	(
+	void
+	)
+{
+USB_HUART.gState = HAL_UART_STATE_READY;
+dma_data         = NULL;
+usb_tx_complete_ISR();
+}
+
+/* A transmit DMA error, the HAL aborts the transfer before the callback */
+static void dma_error
+	(
+	void
+	)
+{
+USB_HUART.gState    = HAL_UART_STATE_READY;
+USB_HUART.ErrorCode = HAL_UART_ERROR_DMA;
+dma_data            = NULL;
+usb_error_ISR();
+USB_HUART.ErrorCode = HAL_UART_ERROR_NONE;
+}
+
+static void usb_done
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	USB_STATUS  tx_status
+	)
+{
+if ( num_log < TEST_MAX_LOG )
+	{
+	log_data[num_log]     = tx_data_ptr;
+	log_status[num_log++] = tx_status;
+	}
+if ( ( tx_status != USB_OK ) && ( requeue_ptr != NULL ) )
+	{
+	TEST_CHECK( usb_transmit_async( requeue_ptr, 16, usb_done ) == USB_OK,
+	            "requeue from the callback refused" );
+	requeue_ptr = NULL;
+	}
+}
+
+static void transport_done
+	(
+	const void*      tx_data_ptr ,
+	size_t           tx_data_size,
+	TRANSPORT_STATUS tx_status
+	)
+{
+if ( num_log < TEST_MAX_LOG )
+	{
+	log_data[num_log]     = tx_data_ptr;
+	log_status[num_log++] = tx_status;
+	}
+}
+
+static void reset
+	(
+	void
+	)
+{
+num_log     = 0;
+fail_starts = 0;
+requeue_ptr = NULL;
+}
+
+/* Check the callback of log entry n */
+static void check_log
+	(
+	const char* name  ,
+	int         n     ,
+	const void* data  ,
+	int         status
+	)
+{
+TEST_CHECK( n < num_log, "%s: callback %d missing", name, n );
+if ( n < num_log )
+	{
+	TEST_CHECK( log_data[n] == data && log_status[n] == status,
+	            "%s: callback %d for buffer %p status %d, expected %p %d",
+	            name, n, log_data[n], log_status[n], data, status );
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Buffers go out in order, a full queue is refused, each buffer is reported
+   once when it has been sent */
+static void test_queue_order
+	(
+	void
+	)
+{
+int i;
+
+reset();
+for ( i = 0; i < USB_TX_QUEUE_DEPTH; ++i )
+	{
+	TEST_CHECK( usb_transmit_async( buffers[i], 16, usb_done ) == USB_OK,
+	            "buffer %d not queued", i );
+	}
+TEST_CHECK( usb_transmit_async( buffers[i], 16, usb_done ) == USB_BUSY,
+            "full queue accepted a buffer" );
+TEST_CHECK( usb_tx_pending() == USB_TX_QUEUE_DEPTH, "%u pending",
+            (unsigned) usb_tx_pending() );
+for ( i = 0; i < USB_TX_QUEUE_DEPTH; ++i )
+	{
+	TEST_CHECK( dma_data == buffers[i], "buffer %d not on the DMA", i );
+	dma_complete();
+	check_log( "order", i, buffers[i], USB_OK );
+	}
+TEST_CHECK( num_log == USB_TX_QUEUE_DEPTH && usb_tx_pending() == 0,
+            "order: %d callbacks, %u pending", num_log,
+            (unsigned) usb_tx_pending() );
+}
+
+/* A transmit error reports the buffer as failed and starts the next one */
+static void test_tx_error
+	(
+	void
+	)
+{
+reset();
+for ( int i = 0; i < 3; ++i )
+	{
+	usb_transmit_async( buffers[i], 16, usb_done );
+	}
+dma_error();
+check_log( "tx error", 0, buffers[0], USB_FAIL );
+TEST_CHECK( dma_data == buffers[1], "next buffer not started" );
+dma_complete();
+dma_complete();
+check_log( "tx error", 1, buffers[1], USB_OK );
+check_log( "tx error", 2, buffers[2], USB_OK );
+
+/* An error interrupt with the transmitter still busy leaves it alone */
+usb_transmit_async( buffers[3], 16, usb_done );
+USB_HUART.ErrorCode = HAL_UART_ERROR_FE;
+usb_error_ISR();
+USB_HUART.ErrorCode = HAL_UART_ERROR_NONE;
+TEST_CHECK( num_log == 3 && dma_data == buffers[3],
+            "busy transfer released by a receive error" );
+dma_complete();
+check_log( "tx error", 3, buffers[3], USB_OK );
+}
+
+/* A transfer that fails to start is reported as failed, on an idle queue
+   and behind a transfer in progress */
+static void test_failed_start
+	(
+	void
+	)
+{
+reset();
+fail_starts = 1;
+TEST_CHECK( usb_transmit_async( buffers[0], 16, usb_done ) == USB_OK,
+            "buffer not queued" );
+check_log( "idle start", 0, buffers[0], USB_FAIL );
+TEST_CHECK( usb_tx_pending() == 0 && dma_data == NULL,
+            "failed buffer left in the queue" );
+
+usb_transmit_async( buffers[1], 16, usb_done );
+usb_transmit_async( buffers[2], 16, usb_done );
+usb_transmit_async( buffers[3], 16, usb_done );
+fail_starts = 1;
+dma_complete();
+check_log( "queued start", 1, buffers[1], USB_OK     );
+check_log( "queued start", 2, buffers[2], USB_FAIL   );
+TEST_CHECK( dma_data == buffers[3], "queue stalled after a failed start" );
+dma_complete();
+check_log( "queued start", 3, buffers[3], USB_OK     );
+
+/* The failure callback queues the buffer again and it starts */
+requeue_ptr = buffers[4];
+fail_starts = 1;
+usb_transmit_async( buffers[4], 16, usb_done );
+check_log( "requeue", 4, buffers[4], USB_FAIL );
+TEST_CHECK( dma_data == buffers[4] && usb_tx_pending() == 1,
+            "requeued buffer not started" );
+dma_complete();
+check_log( "requeue", 5, buffers[4], USB_OK );
+TEST_CHECK( num_log == 6, "requeue: %d callbacks", num_log );
+}
+
+/* The transport layer reports the USB result with its own status */
+static void test_transport
+	(
+	void
+	)
+{
+int i;
+
+reset();
+TEST_CHECK( transport_transmit_async( &transport_usb, buffers[0], 16,
+                                      transport_done ) == TRANSPORT_OK,
+            "transport buffer not queued" );
+TEST_CHECK( transport_transmit_async( &transport_usb, buffers[1], 16,
+                                      NULL ) == TRANSPORT_OK,
+            "transport buffer without a callback not queued" );
+TEST_CHECK( transport_transmit_async( &transport_usb, buffers[2], 16,
+                                      transport_done ) == TRANSPORT_OK,
+            "transport buffer not queued" );
+dma_error();
+dma_complete();
+dma_complete();
+check_log( "transport", 0, buffers[0], TRANSPORT_FAIL );
+check_log( "transport", 1, buffers[2], TRANSPORT_OK   );
+TEST_CHECK( num_log == 2, "transport: %d callbacks", num_log );
+
+/* A refused buffer does not take a callback entry */
+reset();
+for ( i = 0; i < USB_TX_QUEUE_DEPTH; ++i )
+	{
+	transport_transmit_async( &transport_usb, buffers[i], 16,
+	                          transport_done );
+	}
+TEST_CHECK( transport_transmit_async( &transport_usb, buffers[i], 16,
+                                      transport_done ) == TRANSPORT_BUSY,
+            "full queue accepted a transport buffer" );
+for ( i = 0; i < USB_TX_QUEUE_DEPTH; ++i )
+	{
+	dma_complete();
+	check_log( "transport busy", i, buffers[i], TRANSPORT_OK );
+	}
+TEST_CHECK( num_log == USB_TX_QUEUE_DEPTH, "transport busy: %d callbacks",
+            num_log );
+}
+
+/* The blocking transmit converts every HAL status */
+static void test_blocking_status
+	(
+	void
+	)
+{
+static const struct
+	{
+	HAL_StatusTypeDef hal_status;
+	USB_STATUS        usb_status;
+	} map[] =
+	{
+	{ HAL_OK     , USB_OK      },
+	{ HAL_TIMEOUT, USB_TIMEOUT },
+	{ HAL_BUSY   , USB_BUSY    },
+	{ HAL_ERROR  , USB_FAIL    }
+	};
+USB_STATUS usb_status;
+
+for ( size_t i = 0; i < sizeof( map )/sizeof( map[0] ); ++i )
+	{
+	blocking_status = map[i].hal_status;
+	usb_status      = usb_transmit( buffers[0], 16, 10 );
+	TEST_CHECK( usb_status == map[i].usb_status,
+	            "HAL status %d returned %d, expected %d", map[i].hal_status,
+	            usb_status, map[i].usb_status );
+	}
+blocking_status = HAL_OK;
+TEST_CHECK( usb_transmit( buffers[0], 0, 10 ) == USB_FAIL,
+            "empty blocking transmit accepted" );
+}
+
+
+int main
+	(
+	void
+	)
+{
+TEST_CHECK( usb_init() == USB_OK, "receive DMA not started" );
+
+test_queue_order();
+test_tx_error();
+test_failed_start();
+test_transport();
+test_blocking_status();
+
+TEST_EXIT( "test_usb_tx" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
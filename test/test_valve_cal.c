@@ -0,0 +1,301 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_valve_cal.c
+*
+* DESCRIPTION:
+* 		Host test for the non-blocking valve calibration. A 1 ms main loop runs
+*       valve_calibrate_task and polls VALVE_GETSTATE between the task calls,
+*       while each valve steps at the start rate towards its photogate. Checks
+*       that both valves home at the same time, that the encoder counts are
+*       zeroed once homed, that a photogate that never trips times out
+*       without holding up the other valve, and that moves and a second
+*       calibration are refused while homing
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../valve/valve.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Photogate distances from the start of homing, in ms at the start rate */
+#define TEST_LOX_GATE_MS            ( 300 )
+#define TEST_FUEL_GATE_MS           ( 700 )
+#define TEST_NO_GATE                ( UINT32_MAX )
+
+
+/*------------------------------------------------------------------------------
+ Valve and board model
+------------------------------------------------------------------------------*/
+
+typedef struct
+	{
+	TIM_HandleTypeDef* step_tim;
+	uint16_t           gate_pin;
+	bool               running;
+	uint32_t           run_ms;   /* Time stepped since homing started */
+	uint32_t           gate_ms;  /* Time to reach the photogate       */
+	} MODEL_VALVE;
+
+static MODEL_VALVE model[2] =
+	{
+	{ &( VALVE_LOX_TIM  ), LOX_PHOTOGATE_PIN  },
+	{ &( VALVE_FUEL_TIM ), FUEL_PHOTOGATE_PIN }
+	};
+
+static uint32_t ticks;
+static uint32_t delays;       /* HAL_Delay calls                   */
+static uint8_t  state_reply;  /* Last VALVE_GETSTATE reply         */
+static uint32_t state_polls;  /* VALVE_GETSTATE replies sent       */
+
+uint32_t HAL_GetTick
+	(
+	void
+	)
+{
+return ticks;
+}
+
+void HAL_Delay
+	(
+	uint32_t delay
+	)
+{
+delays++;
+ticks += delay;
+}
+
+static MODEL_VALVE* model_valve
+	(
+	TIM_HandleTypeDef* htim
+	)
+{
+return ( htim == model[0].step_tim ) ? &model[0] :
+       ( htim == model[1].step_tim ) ? &model[1] : NULL;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+if ( model_valve( htim ) )
+	{
+	model_valve( htim )->running = true;
+	}
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+if ( model_valve( htim ) )
+	{
+	model_valve( htim )->running = false;
+	}
+return HAL_OK;
+}
+
+TRANSPORT_STATUS transport_transmit
+	(
+	const TRANSPORT* transport_ptr,
+	const void*      tx_data_ptr  ,
+	size_t           tx_data_size ,
+	uint32_t         timeout
+	)
+{
+state_reply = *(const uint8_t*) tx_data_ptr;
+state_polls++;
+return TRANSPORT_OK;
+}
+
+/* Step the valves for 1 ms, a photogate reads high once its valve is
+   closed */
+static void model_tick
+	(
+	void
+	)
+{
+for ( int i = 0; i < 2; ++i )
+	{
+	if ( model[i].running )
+		{
+		model[i].run_ms++;
+		}
+	if ( model[i].run_ms >= model[i].gate_ms )
+		{
+		stub_gpio.IDR |= model[i].gate_pin;
+		}
+	}
+ticks++;
+}
+
+static void model_reset
+	(
+	uint32_t lox_gate_ms,
+	uint32_t fuel_gate_ms
+	)
+{
+for ( int i = 0; i < 2; ++i )
+	{
+	model[i].running = false;
+	model[i].run_ms  = 0;
+	}
+model[0].gate_ms = lox_gate_ms;
+model[1].gate_ms = fuel_gate_ms;
+stub_gpio.IDR    = 0;
+lox_valve_pos    = 123;
+fuel_valve_pos   = 3456;
+}
+
+/* Main loop: the calibration task, then a state poll from the host */
+static void main_loop_ms
+	(
+	uint32_t ms
+	)
+{
+for ( uint32_t i = 0; i < ms; ++i )
+	{
+	model_tick();
+	valve_calibrate_task();
+	TEST_CHECK( valve_cmd_execute( VALVE_GETSTATE_CODE, NULL ) == VALVE_OK,
+	            "state poll failed at %u ms", ticks );
+	}
+}
+
+static uint8_t lox_state
+	(
+	void
+	)
+{
+return ( state_reply >> VALVE_STATES_LOX_CAL_SHIFT ) & VALVE_STATES_CAL_MASK;
+}
+
+static uint8_t fuel_state
+	(
+	void
+	)
+{
+return ( state_reply >> VALVE_STATES_FUEL_CAL_SHIFT ) & VALVE_STATES_CAL_MASK;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Both valves home together and report their progress */
+static void test_concurrent_homing
+	(
+	void
+	)
+{
+uint32_t start;
+uint32_t polls;
+uint32_t lox_done  = 0;
+uint32_t fuel_done = 0;
+
+model_reset( TEST_LOX_GATE_MS, TEST_FUEL_GATE_MS );
+start = ticks;
+polls = state_polls;
+TEST_CHECK( valve_calibrate_valves() == VALVE_OK, "calibration not started" );
+TEST_CHECK( ticks == start && delays == 0, "calibration start blocked" );
+TEST_CHECK( model[0].running && model[1].running,
+            "valves not homing together" );
+
+/* Refused while homing */
+TEST_CHECK( valve_calibrate_valves() == VALVE_BUSY,
+            "second calibration accepted" );
+TEST_CHECK( valve_open_ox_valve() == VALVE_BUSY,
+            "move accepted while homing" );
+
+while ( ( lox_done == 0 || fuel_done == 0 ) && ticks - start < 2000 )
+	{
+	main_loop_ms( 1 );
+	if ( lox_done == 0 && lox_state() == VALVE_CAL_DONE )
+		{
+		lox_done = ticks - start;
+		}
+	if ( fuel_done == 0 && fuel_state() == VALVE_CAL_DONE )
+		{
+		fuel_done = ticks - start;
+		}
+	if ( ticks - start == TEST_LOX_GATE_MS/2 )
+		{
+		TEST_CHECK( lox_state() == VALVE_CAL_HOMING &&
+		            fuel_state() == VALVE_CAL_HOMING,
+		            "homing reported as 0x%02x", state_reply );
+		}
+	}
+
+printf( "valve cal: LOX homed at %u ms, fuel at %u ms, %u state polls "
+        "answered\n", lox_done, fuel_done, state_polls - polls );
+TEST_CHECK( lox_done  <= TEST_LOX_GATE_MS  + VALVE_CAL_SETTLE_MS + 1 &&
+            fuel_done <= TEST_FUEL_GATE_MS + VALVE_CAL_SETTLE_MS + 1,
+            "homing took %u ms and %u ms", lox_done, fuel_done );
+TEST_CHECK( !model[0].running && !model[1].running,
+            "step PWM left running" );
+TEST_CHECK( lox_valve_pos == 0 && fuel_valve_pos == 0,
+            "counts not zeroed, %d and %d", lox_valve_pos, fuel_valve_pos );
+TEST_CHECK( state_polls - polls == ticks - start,
+            "state polls dropped while homing" );
+TEST_CHECK( delays == 0, "HAL_Delay called while homing" );
+}
+
+/* A photogate that never trips times out, the other valve still homes */
+static void test_timeout
+	(
+	void
+	)
+{
+uint32_t start;
+
+model_reset( TEST_LOX_GATE_MS, TEST_NO_GATE );
+start = ticks;
+TEST_CHECK( valve_calibrate_valves() == VALVE_OK, "calibration not started" );
+main_loop_ms( VALVE_CAL_TIMEOUT_MS - 1 );
+TEST_CHECK( lox_state() == VALVE_CAL_DONE && fuel_state() == VALVE_CAL_HOMING,
+            "before the timeout reported 0x%02x", state_reply );
+TEST_CHECK( model[1].running, "fuel valve stopped before the timeout" );
+main_loop_ms( 1 );
+TEST_CHECK( fuel_state() == VALVE_CAL_TIMEOUT && !model[1].running,
+            "no timeout after %u ms, reported 0x%02x", ticks - start,
+            state_reply );
+TEST_CHECK( fuel_valve_pos == 3456, "timed out valve was zeroed" );
+
+/* A timed out valve can be calibrated again */
+model[1].gate_ms = model[1].run_ms + 50;
+TEST_CHECK( valve_calibrate_valves() == VALVE_OK, "recalibration refused" );
+main_loop_ms( 50 + VALVE_CAL_SETTLE_MS + 1 );
+TEST_CHECK( fuel_state() == VALVE_CAL_DONE && fuel_valve_pos == 0,
+            "recalibration reported 0x%02x", state_reply );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_concurrent_homing();
+test_timeout();
+
+TEST_EXIT( "test_valve_cal" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
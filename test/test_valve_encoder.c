@@ -0,0 +1,365 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_valve_encoder.c
+*
+* DESCRIPTION:
+* 		Host model of the two main valve encoder backends. A shaft turning at a
+*       constant quadrature edge rate drives a LOX valve move from closed to
+*       open. Built without VALVE_ENCODER_TIM, every edge raises the EXTI line
+*       of its channel and the CPU serves pending lines one ISR at a time, so
+*       edges that arrive faster than the ISR cost coalesce. Built with
+*       VALVE_ENCODER_TIM, the timer counts every edge that passes its input
+*       filter and the stop compare interrupt ends the move. Each build sweeps
+*       the edge rate and reports the highest rate at which the decoded count
+*       and the stop position are still exact
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../valve/valve.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Cost of one EXTI interrupt through the HAL dispatch at 480 MHz, and the
+   latency from a compare match to the stop in valve_encoder_compare_ISR */
+#define TEST_EXTI_ISR_NS            ( 800.0 )
+#define TEST_COMPARE_ISR_NS         ( 300.0 )
+
+/* Encoder timer input filter, N = 8 samples at 240 MHz */
+#define TEST_ENC_FILTER_NS          ( 33.4 )
+
+/* Fastest edge rate of a valve move at the default max step rate */
+#define TEST_VALVE_EDGE_RATE        \
+	( VALVE_DEFAULT_MAX_RATE/VALVE_STEPS_PER_COUNT )
+
+#define TEST_RATE_MIN               ( 1000.0 )
+#define TEST_RATE_MAX               ( 64.0e6 )
+#define TEST_RATE_STEP              ( 1.25 )
+
+#ifdef VALVE_ENCODER_TIM
+	#define TEST_NAME               "test_valve_encoder_tim"
+	#define TEST_BACKEND            "timer"
+#else
+	#define TEST_NAME               "test_valve_encoder"
+	#define TEST_BACKEND            "EXTI"
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Shaft and peripheral model
+------------------------------------------------------------------------------*/
+
+/* AB codes in counting order */
+static const uint8_t quad_seq[4] = { 0, 1, 3, 2 };
+
+static int      shaft_phase;     /* Index into quad_seq                    */
+static int32_t  shaft_count;     /* True count, wrapped at VALVE_ENC_CPR   */
+static bool     shaft_running;   /* Step PWM running                       */
+
+static void set_channels
+	(
+	uint8_t ab
+	)
+{
+stub_gpio.IDR = ( ( ab & 2 ) ? LOX_ENC_A_PIN : 0 ) |
+                ( ( ab & 1 ) ? LOX_ENC_B_PIN : 0 );
+}
+
+/* One quadrature edge forward, returns the channel that changed, 0 -> A */
+static int shaft_edge
+	(
+	void
+	)
+{
+uint8_t prev = quad_seq[shaft_phase];
+
+shaft_phase = ( shaft_phase + 1 ) & 3;
+shaft_count = ( shaft_count + 1 ) % VALVE_ENC_CPR;
+set_channels( quad_seq[shaft_phase] );
+return ( ( prev ^ quad_seq[shaft_phase] ) & 2 ) ? 0 : 1;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+if ( htim == &( VALVE_LOX_TIM ) )
+	{
+	shaft_running = true;
+	}
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+if ( htim == &( VALVE_LOX_TIM ) )
+	{
+	shaft_running = false;
+	}
+return HAL_OK;
+}
+
+#ifdef VALVE_ENCODER_TIM
+HAL_StatusTypeDef HAL_TIM_OC_Start_IT
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+__HAL_TIM_ENABLE_IT( htim, VALVE_ENC_TIM_STOP_IT );
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_OC_Stop_IT
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+__HAL_TIM_DISABLE_IT( htim, VALVE_ENC_TIM_STOP_IT );
+return HAL_OK;
+}
+#endif
+
+TRANSPORT_STATUS transport_transmit
+	(
+	const TRANSPORT* transport_ptr,
+	const void*      tx_data_ptr  ,
+	size_t           tx_data_size ,
+	uint32_t         timeout
+	)
+{
+return TRANSPORT_OK;
+}
+
+
+/*------------------------------------------------------------------------------
+ Backends
+------------------------------------------------------------------------------*/
+
+/* Result of one move */
+typedef struct
+	{
+	int32_t  decoded;  /* Count reported by the backend        */
+	int32_t  actual;   /* Count the shaft stopped at           */
+	uint32_t errors;   /* Illegal transitions                  */
+	double   load;     /* CPU time in encoder ISRs per move time */
+	} MOVE_RESULT;
+
+#ifndef VALVE_ENCODER_TIM
+/* Every edge pends the EXTI line of its channel, pending lines are served
+   one ISR at a time in edge order */
+static MOVE_RESULT run_move
+	(
+	double edge_rate
+	)
+{
+MOVE_RESULT result    = { 0 };
+double      edge_ns   = 1e9/edge_rate;
+double      next_edge = edge_ns;
+double      cpu_free  = 0.0;
+double      busy      = 0.0;
+double      pend_time[2];
+bool        pending[2] = { false, false };
+int         edges      = 0;
+int         line;
+uint32_t    fuel_errors;
+
+while ( shaft_running || pending[0] || pending[1] )
+	{
+	/* Earliest pending line and when the CPU can take it */
+	line = -1;
+	if ( pending[0] ) line = 0;
+	if ( pending[1] && ( line < 0 || pend_time[1] < pend_time[0] ) ) line = 1;
+
+	if ( shaft_running &&
+	     ( line < 0 || next_edge < fmax( cpu_free, pend_time[line] ) ) )
+		{
+		line = shaft_edge();
+		if ( !pending[line] )
+			{
+			pending[line]   = true;
+			pend_time[line] = next_edge;
+			}
+		next_edge += edge_ns;
+
+		/* A missed stop keeps the shaft turning, give up after a turn */
+		if ( ++edges > 2*VALVE_ENC_CPR )
+			{
+			shaft_running = false;
+			}
+		continue;
+		}
+
+	/* The ISR samples the port when it runs, not when its edge arrived */
+	cpu_free      = fmax( cpu_free, pend_time[line] ) + TEST_EXTI_ISR_NS;
+	busy         += TEST_EXTI_ISR_NS;
+	pending[line] = false;
+	if ( line == 0 ) lox_channelA_ISR();
+	else             lox_channelB_ISR();
+	}
+
+valve_get_encoder_errors( &result.errors, &fuel_errors );
+result.decoded = lox_encoder_pos();
+result.actual  = shaft_count;
+result.load    = busy/( next_edge - edge_ns );
+return result;
+}
+
+#else
+/* The timer counts every edge that passes the input filter, a compare
+   match pends the stop interrupt */
+static MOVE_RESULT run_move
+	(
+	double edge_rate
+	)
+{
+MOVE_RESULT        result     = { 0 };
+TIM_HandleTypeDef* enc_tim    = &( VALVE_LOX_ENC_TIM );
+double             edge_ns    = 1e9/edge_rate;
+double             t          = 0.0;
+double             stop_time  = -1.0;
+int                edges      = 0;
+
+while ( shaft_running )
+	{
+	t += edge_ns;
+	if ( stop_time >= 0.0 && t >= stop_time )
+		{
+		valve_encoder_compare_ISR( enc_tim );
+		continue;
+		}
+	shaft_edge();
+	if ( ++edges > 2*VALVE_ENC_CPR )
+		{
+		shaft_running = false;
+		}
+
+	/* Edges closer than the filter window never reach the counter */
+	if ( edge_ns < TEST_ENC_FILTER_NS )
+		{
+		continue;
+		}
+	enc_tim->Instance->CNT = ( enc_tim->Instance->CNT + 1 ) %
+	                         ( enc_tim->Instance->ARR + 1 );
+	if ( ( enc_tim->Instance->DIER & VALVE_ENC_TIM_STOP_IT ) &&
+	     enc_tim->Instance->CNT == enc_tim->Instance->CCR3 && stop_time < 0.0 )
+		{
+		enc_tim->Instance->SR |= VALVE_ENC_TIM_STOP_FLAG;
+		stop_time = t + TEST_COMPARE_ISR_NS;
+		}
+	}
+
+result.decoded = lox_encoder_pos();
+result.actual  = shaft_count;
+result.load    = ( stop_time >= 0.0 ) ? TEST_COMPARE_ISR_NS/t : 0.0;
+return result;
+}
+#endif /* #ifndef VALVE_ENCODER_TIM */
+
+/* Home the valve and move it from closed to open at one edge rate */
+static MOVE_RESULT open_at_rate
+	(
+	double edge_rate
+	)
+{
+shaft_phase   = 0;
+shaft_count   = 0;
+shaft_running = false;
+set_channels( quad_seq[0] );
+#ifdef VALVE_ENCODER_TIM
+	valve_encoder_start();
+#else
+	lox_valve_pos  = 0;
+	lox_enc_state  = lox_encoder_channels();
+	lox_enc_errors = 0;
+#endif
+lox_motion.moving = false;
+
+TEST_CHECK( valve_open_ox_valve() == VALVE_OK, "open command rejected" );
+TEST_CHECK( shaft_running, "open command started no step PWM" );
+return run_move( edge_rate );
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Sweep the edge rate, the count stays exact while no edge is lost and the
+   stop stays exact while the stop lands before the next edge */
+static void test_edge_rate_limit
+	(
+	void
+	)
+{
+MOVE_RESULT result;
+double      count_limit = 0.0;
+double      stop_limit  = 0.0;
+bool        count_ok    = true;
+bool        stop_ok     = true;
+
+for ( double rate = TEST_RATE_MIN;
+      ( rate <= TEST_RATE_MAX ) && ( count_ok || stop_ok );
+      rate *= TEST_RATE_STEP )
+	{
+	result    = open_at_rate( rate );
+	count_ok &= ( result.decoded == result.actual ) && ( result.errors == 0 );
+	stop_ok  &= count_ok && ( result.actual == VALVE_OPEN_POS );
+	if ( count_ok ) count_limit = rate;
+	if ( stop_ok  ) stop_limit  = rate;
+	}
+
+result = open_at_rate( TEST_VALVE_EDGE_RATE );
+printf( "%s backend: count exact up to %.0f edges/s, stop exact up to %.0f "
+        "edges/s, %.2f%% CPU at the valve max of %.0f edges/s\n", TEST_BACKEND,
+        count_limit, stop_limit, 100.0*result.load, TEST_VALVE_EDGE_RATE );
+
+TEST_CHECK( result.decoded == VALVE_OPEN_POS && result.actual == VALVE_OPEN_POS,
+            "move at the valve max rate decoded %d, stopped at %d",
+            result.decoded, result.actual );
+#ifdef VALVE_ENCODER_TIM
+	/* The counter keeps up to the input filter, the stop to the compare
+	   latency */
+	TEST_CHECK( count_limit >= 0.5e9/TEST_ENC_FILTER_NS,
+	            "timer count limit %.0f edges/s", count_limit );
+	TEST_CHECK( stop_limit >= 0.5e9/TEST_COMPARE_ISR_NS,
+	            "timer stop limit %.0f edges/s", stop_limit );
+#else
+	/* Coalescing starts once the edges outrun the ISR */
+	TEST_CHECK( stop_limit >= 0.5e9/TEST_EXTI_ISR_NS,
+	            "EXTI limit %.0f edges/s", stop_limit );
+	TEST_CHECK( count_limit <= 1.0e9/TEST_EXTI_ISR_NS,
+	            "EXTI count limit %.0f edges/s above the ISR rate", count_limit );
+#endif
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_edge_rate_limit();
+
+TEST_EXIT( TEST_NAME );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
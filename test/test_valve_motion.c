@@ -0,0 +1,316 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_valve_motion.c
+*
+* DESCRIPTION:
+* 		Host simulation of a stepper driven valve. Each step timer period moves
+*       the motor one step in the direction of the DIR pin, the encoder edges
+*       of the step are decoded by the channel ISRs and the step ISR then
+*       loads the next period. Measures the open, close and crack times of the
+*       trapezoidal profile against a fixed rate move at the start rate, and
+*       checks that moves take the short way round the encoder wrap and that
+*       crack treats a valve near the open position as open
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../valve/valve.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Longest simulated move before it counts as a runaway */
+#define TEST_MOVE_TIMEOUT_S         ( 10.0 )
+
+/* Required speedup of a full open over the fixed start rate */
+#define TEST_MIN_SPEEDUP            ( 3.0 )
+
+
+/*------------------------------------------------------------------------------
+ Stepper and encoder model
+------------------------------------------------------------------------------*/
+
+/* AB codes in counting order */
+static const uint8_t quad_seq[4] = { 0, 1, 3, 2 };
+
+static int64_t motor_steps;   /* Motor position, steps from home */
+static int32_t motor_counts;  /* Encoder count of motor_steps    */
+static bool    step_running;  /* LOX step PWM running            */
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+step_running |= ( htim == &( VALVE_LOX_TIM ) );
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+if ( htim == &( VALVE_LOX_TIM ) )
+	{
+	step_running = false;
+	}
+return HAL_OK;
+}
+
+TRANSPORT_STATUS transport_transmit
+	(
+	const TRANSPORT* transport_ptr,
+	const void*      tx_data_ptr  ,
+	size_t           tx_data_size ,
+	uint32_t         timeout
+	)
+{
+return TRANSPORT_OK;
+}
+
+/* Encoder count of a motor position, the disc turns with the valve */
+static int32_t steps_to_counts
+	(
+	int64_t steps
+	)
+{
+return (int32_t) floor( steps/VALVE_STEPS_PER_COUNT + 1e-6 );
+}
+
+static void set_channels
+	(
+	int32_t counts
+	)
+{
+uint8_t ab = quad_seq[counts & 3];
+
+stub_gpio.IDR = ( ( ab & 2 ) ? LOX_ENC_A_PIN : 0 ) |
+                ( ( ab & 1 ) ? LOX_ENC_B_PIN : 0 );
+}
+
+/* Put the valve at an encoder count and zero the decoder there */
+static void place
+	(
+	int32_t counts
+	)
+{
+motor_steps   = (int64_t) ceil( counts*VALVE_STEPS_PER_COUNT - 1e-6 );
+motor_counts  = steps_to_counts( motor_steps );
+set_channels( motor_counts );
+lox_valve_pos = counts;
+lox_enc_state = lox_encoder_channels();
+}
+
+/* Run the step timer until the move ends, returns the move time in s */
+static double run_steps
+	(
+	float* peak_rate
+	)
+{
+double   t     = 0.0;
+uint32_t period;
+int32_t  counts;
+int      dir;
+
+*peak_rate = 0.0f;
+while ( step_running && t < TEST_MOVE_TIMEOUT_S )
+	{
+	/* One step per period, in the direction the driver is set to */
+	period       = VALVE_LOX_TIM.Instance->ARR + 1;
+	t           += period/(double) VALVE_STEP_TIM_FREQ;
+	*peak_rate   = fmaxf( *peak_rate, (float) VALVE_STEP_TIM_FREQ/period );
+	dir          = ( stub_gpio.ODR & LOX_DIR_PIN ) ? -1 : 1;
+	motor_steps += dir;
+
+	/* Encoder edges of the step, the decoder may end the move */
+	counts = steps_to_counts( motor_steps );
+	while ( motor_counts != counts )
+		{
+		motor_counts += dir;
+		set_channels( motor_counts );
+		lox_channelA_ISR();
+		}
+
+	/* Update event at the end of the period */
+	if ( step_running )
+		{
+		valve_step_ISR( &( VALVE_LOX_TIM ) );
+		}
+	}
+return t;
+}
+
+/* A step is more than one count, so the motor may stop up to one count past
+   the count the decoder stopped it at */
+static bool at_pos
+	(
+	int32_t target_pos
+	)
+{
+int32_t pos   = ( ( motor_counts % VALVE_ENC_CPR ) + VALVE_ENC_CPR ) %
+                VALVE_ENC_CPR;
+int32_t delta = pos_delta( target_pos, pos );
+
+return ( delta >= -1 ) && ( delta <= 1 ) && ( lox_valve_pos == pos );
+}
+
+/* Start a move and run it to the end */
+static double run_move
+	(
+	int32_t target_pos,
+	float*  peak_rate
+	)
+{
+TEST_CHECK( valve_move_ox_valve( target_pos ) == VALVE_OK,
+            "move to %d rejected", target_pos );
+return run_steps( peak_rate );
+}
+
+/* Encoder count of the motor, wrapped to one revolution */
+static int32_t motor_pos
+	(
+	void
+	)
+{
+return ( ( motor_counts % VALVE_ENC_CPR ) + VALVE_ENC_CPR ) % VALVE_ENC_CPR;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Open, close and crack with the default profile against a fixed rate */
+static void test_move_times
+	(
+	void
+	)
+{
+static VALVE_MOTION_CONFIG fixed = { VALVE_DEFAULT_START_RATE,
+                                     VALVE_DEFAULT_START_RATE,
+                                     VALVE_DEFAULT_ACCEL };
+static VALVE_MOTION_CONFIG trap  = { VALVE_DEFAULT_START_RATE,
+                                     VALVE_DEFAULT_MAX_RATE  ,
+                                     VALVE_DEFAULT_ACCEL };
+double open_trap;
+double close_trap;
+double crack_trap;
+double open_fixed;
+double close_fixed;
+float  peak;
+
+place( VALVE_CLOSED_POS );
+TEST_CHECK( valve_set_motion_profile( &trap ) == VALVE_OK,
+            "profile rejected" );
+open_trap = run_move( VALVE_OPEN_POS, &peak );
+TEST_CHECK( at_pos( VALVE_OPEN_POS ), "open ended at %d, decoded %d",
+            motor_pos(), lox_valve_pos );
+TEST_CHECK( peak <= VALVE_DEFAULT_MAX_RATE*1.01f, "peak rate %.0f steps/s",
+            peak );
+close_trap = run_move( VALVE_CLOSED_POS, &peak );
+TEST_CHECK( at_pos( VALVE_CLOSED_POS ), "close ended at %d",
+            motor_pos() );
+crack_trap = run_move( VALVE_CRACKED_POS, &peak );
+TEST_CHECK( at_pos( VALVE_CRACKED_POS ), "crack ended at %d",
+            motor_pos() );
+run_move( VALVE_CLOSED_POS, &peak );
+
+TEST_CHECK( valve_set_motion_profile( &fixed ) == VALVE_OK,
+            "profile rejected" );
+open_fixed  = run_move( VALVE_OPEN_POS  , &peak );
+close_fixed = run_move( VALVE_CLOSED_POS, &peak );
+TEST_CHECK( at_pos( VALVE_CLOSED_POS ), "fixed close ended at %d",
+            motor_pos() );
+valve_set_motion_profile( &trap );
+
+printf( "valve: open %.3f s, close %.3f s, crack %.3f s with the profile, "
+        "open %.3f s, close %.3f s at a fixed %.0f steps/s\n", open_trap,
+        close_trap, crack_trap, open_fixed, close_fixed,
+        VALVE_DEFAULT_START_RATE );
+TEST_CHECK( open_fixed/open_trap >= TEST_MIN_SPEEDUP &&
+            close_fixed/close_trap >= TEST_MIN_SPEEDUP,
+            "profile speedup %.2fx open, %.2fx close", open_fixed/open_trap,
+            close_fixed/close_trap );
+}
+
+/* A target across the wrap is reached the short way, in both directions */
+static void test_wrap_direction
+	(
+	void
+	)
+{
+float   peak;
+int64_t start;
+
+place( 100 );
+start = motor_steps;
+run_move( VALVE_ENC_CPR - 100, &peak );
+TEST_CHECK( lox_motion.direction == STEPPER_DRIVER_CCW,
+            "100 -> 3900 went clockwise" );
+TEST_CHECK( at_pos( VALVE_ENC_CPR - 100 ),
+            "100 -> 3900 ended at %d, decoded %d", motor_pos(),
+            lox_valve_pos );
+TEST_CHECK( start - motor_steps <= 200*VALVE_STEPS_PER_COUNT + 1,
+            "100 -> 3900 took %lld steps",
+            (long long) ( start - motor_steps ) );
+
+start = motor_steps;
+run_move( 100, &peak );
+TEST_CHECK( lox_motion.direction == STEPPER_DRIVER_CW &&
+            at_pos( 100 ), "3900 -> 100 ended at %d", motor_pos() );
+TEST_CHECK( motor_steps - start <= 200*VALVE_STEPS_PER_COUNT + 1,
+            "3900 -> 100 took %lld steps",
+            (long long) ( motor_steps - start ) );
+}
+
+/* Crack leaves a valve within the tolerance of open alone */
+static void test_crack_tolerance
+	(
+	void
+	)
+{
+float peak;
+
+place( VALVE_OPEN_POS - VALVE_POS_TOLERANCE );
+TEST_CHECK( valve_crack_ox_valve() == VALVE_OK && !step_running,
+            "crack moved a valve %d counts short of open",
+            VALVE_POS_TOLERANCE );
+place( VALVE_OPEN_POS + VALVE_POS_TOLERANCE );
+TEST_CHECK( valve_crack_ox_valve() == VALVE_OK && !step_running,
+            "crack moved a valve %d counts past open", VALVE_POS_TOLERANCE );
+
+place( VALVE_OPEN_POS - 4*VALVE_POS_TOLERANCE );
+TEST_CHECK( valve_crack_ox_valve() == VALVE_OK && step_running,
+            "crack did not move a partly open valve" );
+run_steps( &peak );
+TEST_CHECK( at_pos( VALVE_CRACKED_POS ), "crack ended at %d",
+            motor_pos() );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_move_times();
+test_wrap_direction();
+test_crack_tolerance();
+
+TEST_EXIT( "test_valve_motion" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,318 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_valve_quadrature.c
+*
+* DESCRIPTION:
+* 		Host test for the table driven 4x quadrature decoder of the software
+*       encoder path. Replays recorded A/B edge sequences through the channel
+*       ISRs: a full opening stroke, a reverse run through the wrap at zero,
+*       contact bounce on one channel, and lost edges that show up as both
+*       channels changing at once. Also checks every table entry against the
+*       Gray code order and that the two valves decode independently
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include "test.h"
+#include "../valve/valve.c"
+
+
+/*------------------------------------------------------------------------------
+ Edge recordings
+------------------------------------------------------------------------------*/
+
+/* One replay step, the A/B levels after an edge and the channel whose
+   interrupt fired. 'A' and 'B' are lines, '-' is the end of a recording */
+typedef struct
+	{
+	uint8_t ab;
+	char    line;
+	} EDGE;
+
+/* Logic analyzer capture of a slow turn forward, then back through the same
+   edges, AB = ( A << 1 ) | B */
+static const EDGE rec_forward_back[] =
+	{
+	{ 1, 'B' }, { 3, 'A' }, { 2, 'B' }, { 0, 'A' }, /* +4 */
+	{ 1, 'B' }, { 3, 'A' }, { 2, 'B' }, { 0, 'A' }, /* +8 */
+	{ 2, 'A' }, { 3, 'B' }, { 1, 'A' }, { 0, 'B' }, /* +4 */
+	{ 2, 'A' }, { 3, 'B' },                         /* +2 */
+	{ 0, '-' }
+	};
+
+/* Chatter on channel A while B is steady, each bounce is a +1/-1 pair and
+   repeated reads of an unchanged code decode to no step */
+static const EDGE rec_bounce[] =
+	{
+	{ 1, 'B' },
+	{ 3, 'A' }, { 1, 'A' }, { 3, 'A' }, { 1, 'A' }, { 3, 'A' },
+	{ 3, 'A' }, { 3, 'B' },
+	{ 2, 'B' },
+	{ 0, '-' }
+	};
+
+/* Edges landing two at a time in one ISR while the shaft jitters, each
+   double step is an illegal transition and is not counted */
+static const EDGE rec_lost_edges[] =
+	{
+	{ 1, 'B' }, { 2, 'A' }, { 1, 'B' }, { 2, 'A' }, { 0, 'B' },
+	{ 0, '-' }
+	};
+
+
+/*------------------------------------------------------------------------------
+ Helpers
+------------------------------------------------------------------------------*/
+
+/* AB codes in counting order */
+static const uint8_t quad_seq[4] = { 0, 1, 3, 2 };
+
+static uint32_t pwm_stops;
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+pwm_stops += ( htim == &( VALVE_LOX_TIM ) );
+return HAL_OK;
+}
+
+TRANSPORT_STATUS transport_transmit
+	(
+	const TRANSPORT* transport_ptr,
+	const void*      tx_data_ptr  ,
+	size_t           tx_data_size ,
+	uint32_t         timeout
+	)
+{
+return TRANSPORT_OK;
+}
+
+static void set_lox
+	(
+	uint8_t ab
+	)
+{
+stub_gpio.IDR &= ~(uint32_t) ( LOX_ENC_A_PIN | LOX_ENC_B_PIN );
+stub_gpio.IDR |= ( ( ab & 2 ) ? LOX_ENC_A_PIN : 0 ) |
+                 ( ( ab & 1 ) ? LOX_ENC_B_PIN : 0 );
+}
+
+static void set_fuel
+	(
+	uint8_t ab
+	)
+{
+stub_gpio.IDR &= ~(uint32_t) ( KER_ENC_A_PIN | KER_ENC_B_PIN );
+stub_gpio.IDR |= ( ( ab & 2 ) ? KER_ENC_A_PIN : 0 ) |
+                 ( ( ab & 1 ) ? KER_ENC_B_PIN : 0 );
+}
+
+/* Zero both counts at AB = 00, as homing does */
+static void home
+	(
+	void
+	)
+{
+stub_gpio.IDR   = 0;
+lox_valve_pos   = 0;
+fuel_valve_pos  = 0;
+lox_enc_state   = lox_encoder_channels();
+fuel_enc_state  = fuel_encoder_channels();
+lox_enc_errors  = 0;
+fuel_enc_errors = 0;
+}
+
+/* Play a recording into the LOX ISRs */
+static void replay
+	(
+	const EDGE* rec
+	)
+{
+for ( ; rec->line != '-'; ++rec )
+	{
+	set_lox( rec->ab );
+	if ( rec->line == 'A' ) lox_channelA_ISR();
+	else                    lox_channelB_ISR();
+	}
+}
+
+/* Turn the LOX encoder by a number of counts, one edge per count */
+static void turn_lox
+	(
+	int32_t counts
+	)
+{
+int32_t dir = ( counts > 0 ) ? 1 : 3;
+int     phase;
+
+for ( phase = 0; quad_seq[phase] != lox_enc_state; ++phase );
+for ( int32_t i = 0; i < abs( counts ); ++i )
+	{
+	phase = ( phase + dir ) & 3;
+	set_lox( quad_seq[phase] );
+	if ( i & 1 ) lox_channelA_ISR();
+	else         lox_channelB_ISR();
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Each entry is +1 one Gray step ahead, -1 one behind, 0 for no change and
+   illegal for a two step jump */
+static void test_table
+	(
+	void
+	)
+{
+int     prev;
+int     cur;
+int     dist;
+int8_t  expected;
+
+for ( prev = 0; prev < 4; ++prev )
+	{
+	for ( cur = 0; cur < 4; ++cur )
+		{
+		dist = ( cur - prev + 4 ) & 3;
+		expected = ( dist == 0 ) ? 0 :
+		           ( dist == 1 ) ? 1 :
+		           ( dist == 3 ) ? -1 : VALVE_QUAD_ILLEGAL;
+		TEST_CHECK( quad_table[( quad_seq[prev] << 2 ) | quad_seq[cur]] ==
+		            expected, "table %d -> %d is %d, expected %d",
+		            quad_seq[prev], quad_seq[cur],
+		            quad_table[( quad_seq[prev] << 2 ) | quad_seq[cur]],
+		            expected );
+		}
+	}
+}
+
+/* Every edge on both channels counts, in both directions */
+static void test_forward_back
+	(
+	void
+	)
+{
+home();
+replay( rec_forward_back );
+TEST_CHECK( lox_valve_pos == 2 && lox_enc_errors == 0,
+            "forward/back replay at %d, %u errors", lox_valve_pos,
+            lox_enc_errors );
+TEST_CHECK( fuel_valve_pos == 0, "LOX edges moved the fuel count" );
+}
+
+/* Bounce cancels out and a repeated code is not a step */
+static void test_bounce
+	(
+	void
+	)
+{
+home();
+replay( rec_bounce );
+TEST_CHECK( lox_valve_pos == 3 && lox_enc_errors == 0,
+            "bounce replay at %d, %u errors", lox_valve_pos, lox_enc_errors );
+}
+
+/* Double edges are counted as errors and resync on the next edge */
+static void test_lost_edges
+	(
+	void
+	)
+{
+home();
+replay( rec_lost_edges );
+TEST_CHECK( lox_enc_errors == 3, "%u illegal transitions, expected 3",
+            lox_enc_errors );
+TEST_CHECK( lox_valve_pos == 2, "illegal transitions counted, at %d",
+            lox_valve_pos );
+turn_lox( 5 );
+TEST_CHECK( lox_valve_pos == 7, "no resync after errors, at %d",
+            lox_valve_pos );
+}
+
+/* Reverse through zero wraps to the top of the revolution and back */
+static void test_wrap
+	(
+	void
+	)
+{
+home();
+turn_lox( -3 );
+TEST_CHECK( lox_valve_pos == VALVE_ENC_CPR - 3, "reverse wrap at %d",
+            lox_valve_pos );
+turn_lox( 5 );
+TEST_CHECK( lox_valve_pos == 2, "forward wrap at %d", lox_valve_pos );
+turn_lox( VALVE_ENC_CPR );
+TEST_CHECK( lox_valve_pos == 2, "full turn at %d", lox_valve_pos );
+}
+
+/* A full opening stroke is 4x the cycles of the encoder disc and stops the
+   move exactly at the open position */
+static void test_open_stroke
+	(
+	void
+	)
+{
+home();
+pwm_stops = 0;
+TEST_CHECK( valve_open_ox_valve() == VALVE_OK, "open command rejected" );
+turn_lox( VALVE_OPEN_POS );
+TEST_CHECK( lox_valve_pos == VALVE_OPEN_POS && !lox_motion.moving &&
+            pwm_stops == 1, "stroke at %d, moving %d, %u stops",
+            lox_valve_pos, lox_motion.moving, pwm_stops );
+TEST_CHECK( valve_get_ox_valve_pos() == 90, "open reported as %d deg",
+            valve_get_ox_valve_pos() );
+}
+
+/* The fuel decoder keeps its own state */
+static void test_fuel_independent
+	(
+	void
+	)
+{
+uint32_t lox_errors;
+uint32_t fuel_errors;
+
+home();
+set_fuel( 1 ); fuel_channelB_ISR();
+set_fuel( 3 ); fuel_channelA_ISR();
+set_fuel( 0 ); fuel_channelB_ISR();
+turn_lox( 2 );
+valve_get_encoder_errors( &lox_errors, &fuel_errors );
+TEST_CHECK( fuel_valve_pos == 2 && lox_valve_pos == 2,
+            "fuel at %d, LOX at %d", fuel_valve_pos, lox_valve_pos );
+TEST_CHECK( fuel_errors == 1 && lox_errors == 0,
+            "errors LOX %u fuel %u", lox_errors, fuel_errors );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_table();
+test_forward_back();
+test_bounce();
+test_lost_edges();
+test_wrap();
+test_open_stroke();
+test_fuel_independent();
+
+TEST_EXIT( "test_valve_quadrature" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
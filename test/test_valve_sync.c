@@ -0,0 +1,315 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_valve_sync.c
+*
+* DESCRIPTION:
+* 		Host simulation of the synchronized step timer start. Both step timers
+*       are modeled count by count with preloaded auto-reload registers, the
+*       fuel timer waits in trigger slave mode and the LOX timer's TRGO reaches
+*       it on the next timer clock. A step is the rising edge of the step PWM
+*       at the counter reset. Sweeps the LOX lead and checks that every step of
+*       the two accelerating valves keeps the commanded skew, that the first
+*       update returns the timers to independent operation and that a later
+*       fuel move starts on its own
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include "test.h"
+#include "../valve/valve.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Steps compared per valve, through the acceleration ramp */
+#define TEST_STEPS                  ( 64 )
+
+/* Longest simulated run, timer counts */
+#define TEST_MAX_COUNTS             ( 10000000 )
+
+
+/*------------------------------------------------------------------------------
+ Step timer model
+------------------------------------------------------------------------------*/
+
+typedef struct
+	{
+	TIM_HandleTypeDef* htim;
+	uint32_t           arr_active;         /* Auto-reload shadow register */
+	uint32_t           steps;              /* Steps taken                 */
+	uint64_t           step_at[TEST_STEPS]; /* Time of each step, counts  */
+	} MODEL_TIM;
+
+static MODEL_TIM model[2] =
+	{
+	{ &( VALVE_LOX_TIM  ) },
+	{ &( VALVE_FUEL_TIM ) }
+	};
+
+static uint64_t now;          /* Timer counts since the start       */
+static bool     lox_trgo;     /* LOX TRGO on counter enable         */
+static bool     trigger_sent; /* TRGO pulse on its way to the slave */
+
+static MODEL_TIM* model_tim
+	(
+	TIM_HandleTypeDef* htim
+	)
+{
+return ( htim == model[0].htim ) ? &model[0] :
+       ( htim == model[1].htim ) ? &model[1] : NULL;
+}
+
+static void step
+	(
+	MODEL_TIM* tim
+	)
+{
+if ( tim->steps < TEST_STEPS )
+	{
+	tim->step_at[tim->steps] = now;
+	}
+tim->steps++;
+}
+
+/* Counter enable, the PWM output rises if the counter starts at zero */
+static void counter_enable
+	(
+	MODEL_TIM* tim
+	)
+{
+tim->htim->Instance->CR1 |= TIM_CR1_CEN;
+if ( tim->htim->Instance->CNT == 0 )
+	{
+	step( tim );
+	}
+}
+
+HAL_StatusTypeDef HAL_TIM_GenerateEvent
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           event
+	)
+{
+htim->Instance->CNT  = 0;
+htim->Instance->SR  |= TIM_FLAG_UPDATE;
+if ( model_tim( htim ) )
+	{
+	model_tim( htim )->arr_active = htim->Instance->ARR;
+	}
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization
+	(
+	TIM_HandleTypeDef*       htim,
+	TIM_MasterConfigTypeDef* config
+	)
+{
+lox_trgo = ( config->MasterOutputTrigger == TIM_TRGO_ENABLE );
+return HAL_OK;
+}
+
+/* A timer in trigger slave mode leaves its counter to the trigger */
+HAL_StatusTypeDef HAL_TIM_PWM_Start
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+if ( ( htim->Instance->SMCR & 0x07U ) == TIM_SLAVEMODE_TRIGGER )
+	{
+	return HAL_OK;
+	}
+counter_enable( model_tim( htim ) );
+if ( htim == &( VALVE_LOX_TIM ) && lox_trgo )
+	{
+	trigger_sent = true;
+	}
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+htim->Instance->CR1 &= ~TIM_CR1_CEN;
+return HAL_OK;
+}
+
+TRANSPORT_STATUS transport_transmit
+	(
+	const TRANSPORT* transport_ptr,
+	const void*      tx_data_ptr  ,
+	size_t           tx_data_size ,
+	uint32_t         timeout
+	)
+{
+return TRANSPORT_OK;
+}
+
+/* One timer clock. The trigger reaches the slave on the clock after the
+   master counter is enabled */
+static void tick
+	(
+	void
+	)
+{
+TIM_TypeDef* regs;
+
+if ( trigger_sent )
+	{
+	trigger_sent = false;
+	if ( ( VALVE_FUEL_TIM.Instance->SMCR & 0x07U ) == TIM_SLAVEMODE_TRIGGER )
+		{
+		counter_enable( &model[1] );
+		}
+	}
+
+now++;
+for ( int i = 0; i < 2; ++i )
+	{
+	regs = model[i].htim->Instance;
+	if ( !( regs->CR1 & TIM_CR1_CEN ) )
+		{
+		continue;
+		}
+	if ( ++regs->CNT <= model[i].arr_active )
+		{
+		continue;
+		}
+
+	/* Update event, the PWM output rises with the new period */
+	regs->CNT            = 0;
+	model[i].arr_active  = regs->ARR;
+	regs->SR            |= TIM_FLAG_UPDATE;
+	step( &model[i] );
+	if ( regs->DIER & TIM_IT_UPDATE )
+		{
+		regs->SR &= ~TIM_FLAG_UPDATE;
+		valve_step_ISR( model[i].htim );
+		}
+	}
+}
+
+/* Zero the valves and the model */
+static void model_reset
+	(
+	void
+	)
+{
+stop_motion( &lox_motion , &( VALVE_LOX_TIM  ), VALVE_LOX_TIM_CHANNEL  );
+stop_motion( &fuel_motion, &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
+for ( int i = 0; i < 2; ++i )
+	{
+	model[i].steps = 0;
+	model[i].htim->Instance->CNT = 0;
+	model[i].htim->Instance->SR  = 0;
+	}
+now            = 0;
+trigger_sent   = false;
+lox_valve_pos  = VALVE_CLOSED_POS;
+fuel_valve_pos = VALVE_CLOSED_POS;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* Every step of both ramps keeps the commanded lead */
+static void test_skew
+	(
+	void
+	)
+{
+int32_t  max_lead = VALVE_STEP_TIM_FREQ/VALVE_DEFAULT_START_RATE/2;
+int32_t  leads[]  = { -max_lead, -700, -1, 0, 1, 333, max_lead };
+int64_t  skew;
+int64_t  worst;
+uint32_t n;
+
+for ( size_t l = 0; l < sizeof( leads )/sizeof( leads[0] ); ++l )
+	{
+	model_reset();
+	TEST_CHECK( valve_move_both_valves( VALVE_OPEN_POS, VALVE_OPEN_POS,
+	                                    leads[l]/VALVE_STEP_TIM_COUNTS_PER_US )
+	            == VALVE_OK, "lead %d rejected", leads[l] );
+	while ( ( model[0].steps < TEST_STEPS || model[1].steps < TEST_STEPS ) &&
+	        now < TEST_MAX_COUNTS )
+		{
+		tick();
+		}
+
+	worst = 0;
+	n     = ( model[0].steps < model[1].steps ) ? model[0].steps :
+	                                              model[1].steps;
+	n     = ( n < TEST_STEPS ) ? n : TEST_STEPS;
+	for ( uint32_t i = 0; i < n; ++i )
+		{
+		skew = (int64_t) model[1].step_at[i] - (int64_t) model[0].step_at[i];
+		if ( llabs( skew - leads[l] ) > llabs( worst ) )
+			{
+			worst = skew - leads[l];
+			}
+		}
+	TEST_CHECK( n == TEST_STEPS, "lead %d: %u LOX and %u fuel steps",
+	            leads[l], model[0].steps, model[1].steps );
+	TEST_CHECK( worst == 0, "lead %d: skew off by %lld counts", leads[l],
+	            (long long) worst );
+	TEST_CHECK( model[1].step_at[TEST_STEPS - 1] - model[1].step_at[0] <
+	            (uint64_t) ( TEST_STEPS - 1 )*
+	            ( VALVE_STEP_TIM_FREQ/VALVE_DEFAULT_START_RATE ),
+	            "lead %d: the fuel valve did not accelerate", leads[l] );
+	TEST_CHECK( VALVE_FUEL_TIM.Instance->SMCR == 0 && !lox_trgo &&
+	            !sync_linked, "lead %d: timers left linked", leads[l] );
+	}
+printf( "valve sync: %d steps in step with the commanded lead for leads of "
+        "%d to %d us\n", TEST_STEPS, -max_lead/VALVE_STEP_TIM_COUNTS_PER_US,
+        max_lead/VALVE_STEP_TIM_COUNTS_PER_US );
+}
+
+/* After a synchronized start the fuel valve moves on its own */
+static void test_independent_after
+	(
+	void
+	)
+{
+model_reset();
+TEST_CHECK( valve_move_fuel_valve( VALVE_OPEN_POS ) == VALVE_OK,
+            "fuel move rejected" );
+TEST_CHECK( VALVE_FUEL_TIM.Instance->CR1 & TIM_CR1_CEN,
+            "fuel move left waiting for a trigger" );
+for ( uint32_t i = 0; i < 4*VALVE_STEP_TIM_FREQ/VALVE_DEFAULT_START_RATE; ++i )
+	{
+	tick();
+	}
+TEST_CHECK( model[1].steps > 4 && model[0].steps == 0,
+            "fuel only move took %u fuel and %u LOX steps", model[1].steps,
+            model[0].steps );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_skew();
+test_independent_after();
+
+TEST_EXIT( "test_valve_sync" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,358 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_valve_trace.c
+*
+* DESCRIPTION:
+* 		Host test for the valve actuation trace. Runs an open move through a
+*       stepper model with the trace timer counting the simulated time and
+*       checks the summary against the move, flags a stall while the motor is
+*       held, checks that a step ISR landing after the stop cannot add to the
+*       frozen buffer, that the trace timer only runs while a move is traced,
+*       and that a failed transfer ends the trace readout with an error
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include "test.h"
+#include "../valve/valve.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+
+/* Longest simulated move before it counts as a runaway */
+#define TEST_MOVE_TIMEOUT_US        ( 10000000.0 )
+
+/* Steps the motor is held for in the stall test */
+#define TEST_STALL_STEPS            ( VALVE_TRACE_STALL_STEPS + 4 )
+
+
+/*------------------------------------------------------------------------------
+ Stepper, encoder and trace timer model
+------------------------------------------------------------------------------*/
+
+/* AB codes in counting order */
+static const uint8_t quad_seq[4] = { 0, 1, 3, 2 };
+
+static int64_t  motor_steps;   /* Motor position, steps from home    */
+static int32_t  motor_counts;  /* Encoder count of motor_steps       */
+static bool     step_running;  /* LOX step PWM running               */
+static uint32_t hold_steps;    /* Steps the motor is held for        */
+static uint32_t hold_from;     /* Motor step count the hold starts at */
+
+/* Transfers seen by transport_transmit and the one that fails, 0 -> none */
+static uint32_t tx_calls;
+static uint32_t tx_fail_call;
+static uint32_t tx_empty;     /* Empty transfers, which the links reject */
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+step_running |= ( htim == &( VALVE_LOX_TIM ) );
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop
+	(
+	TIM_HandleTypeDef* htim,
+	uint32_t           channel
+	)
+{
+if ( htim == &( VALVE_LOX_TIM ) )
+	{
+	step_running = false;
+	}
+return HAL_OK;
+}
+
+TRANSPORT_STATUS transport_transmit
+	(
+	const TRANSPORT* transport_ptr,
+	const void*      tx_data_ptr  ,
+	size_t           tx_data_size ,
+	uint32_t         timeout
+	)
+{
+/* The links reject an empty transfer */
+if ( tx_data_size == 0 )
+	{
+	tx_empty++;
+	return TRANSPORT_FAIL;
+	}
+return ( ++tx_calls == tx_fail_call ) ? TRANSPORT_TIMEOUT : TRANSPORT_OK;
+}
+
+/* Advance the trace timer if it is running */
+static void trace_clock
+	(
+	uint32_t us
+	)
+{
+if ( VALVE_TRACE_TIM.Instance->CR1 & TIM_CR1_CEN )
+	{
+	VALVE_TRACE_TIM.Instance->CNT += us;
+	}
+}
+
+static bool trace_clock_running
+	(
+	void
+	)
+{
+return ( VALVE_TRACE_TIM.Instance->CR1 & TIM_CR1_CEN ) != 0;
+}
+
+/* Encoder count of a motor position, the disc turns with the valve */
+static int32_t steps_to_counts
+	(
+	int64_t steps
+	)
+{
+return (int32_t) floor( steps/VALVE_STEPS_PER_COUNT + 1e-6 );
+}
+
+static void set_channels
+	(
+	int32_t counts
+	)
+{
+uint8_t ab = quad_seq[counts & 3];
+
+stub_gpio.IDR = ( ( ab & 2 ) ? LOX_ENC_A_PIN : 0 ) |
+                ( ( ab & 1 ) ? LOX_ENC_B_PIN : 0 );
+}
+
+/* Put the valve at an encoder count and zero the decoder there */
+static void place
+	(
+	int32_t counts
+	)
+{
+motor_steps   = (int64_t) ceil( counts*VALVE_STEPS_PER_COUNT - 1e-6 );
+motor_counts  = steps_to_counts( motor_steps );
+set_channels( motor_counts );
+lox_valve_pos = counts;
+lox_enc_state = lox_encoder_channels();
+hold_steps    = 0;
+}
+
+/* Run the step timer until the move ends, returns the move time in us */
+static double run_steps
+	(
+	void
+	)
+{
+double   t = 0.0;
+uint32_t period;
+uint32_t step = 0;
+int32_t  counts;
+int      dir;
+
+while ( step_running && t < TEST_MOVE_TIMEOUT_US )
+	{
+	/* One step per period unless the motor is held */
+	period = ( VALVE_LOX_TIM.Instance->ARR + 1 )*1000000/VALVE_STEP_TIM_FREQ;
+	t     += period;
+	trace_clock( period );
+	dir    = ( stub_gpio.ODR & LOX_DIR_PIN ) ? -1 : 1;
+	if ( step < hold_from || step >= hold_from + hold_steps )
+		{
+		motor_steps += dir;
+		}
+	step++;
+
+	/* Encoder edges of the step, the decoder may end the move */
+	counts = steps_to_counts( motor_steps );
+	while ( motor_counts != counts )
+		{
+		motor_counts += dir;
+		set_channels( motor_counts );
+		lox_channelA_ISR();
+		}
+
+	/* Update event at the end of the period */
+	if ( step_running )
+		{
+		valve_step_ISR( &( VALVE_LOX_TIM ) );
+		}
+	}
+return t;
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* The summary of an open move matches the simulated move */
+static void test_open_summary
+	(
+	void
+	)
+{
+VALVE_TRACE_SUMMARY summary;
+double              move_us;
+
+valve_trace_init();
+place( VALVE_CLOSED_POS );
+TEST_CHECK( valve_open_ox_valve() == VALVE_OK, "open command rejected" );
+TEST_CHECK( trace_clock_running(), "trace timer not started by the move" );
+TEST_CHECK( valve_get_trace_summary( 0, &summary ) == VALVE_BUSY,
+            "summary read while the move is traced" );
+move_us = run_steps();
+
+TEST_CHECK( valve_get_trace_summary( 0, &summary ) == VALVE_OK,
+            "no summary after the move" );
+printf( "valve trace: open in %u us, cracked at %u us, %u entries, "
+        "overshoot %d\n", summary.time_to_target, summary.time_to_crack,
+        summary.num_entries, summary.overshoot );
+TEST_CHECK( summary.time_to_target <= move_us &&
+            summary.time_to_target + 1.0e6/VALVE_DEFAULT_START_RATE >= move_us,
+            "time to open %u us, move took %.0f us", summary.time_to_target,
+            move_us );
+TEST_CHECK( summary.time_to_crack > 0 &&
+            summary.time_to_crack < summary.time_to_target,
+            "time to crack %u us", summary.time_to_crack );
+TEST_CHECK( summary.stalls == 0, "%u stalls on a free move", summary.stalls );
+TEST_CHECK( summary.overshoot >= 0 && summary.overshoot <= 1,
+            "overshoot %d", summary.overshoot );
+/* A sample lands on the first step at least VALVE_TRACE_POS_STEP counts on,
+   which a step of 1.25 counts can overrun by one */
+TEST_CHECK( summary.num_entries >= VALVE_OPEN_POS/( VALVE_TRACE_POS_STEP + 1 ),
+            "%u entries for %d counts", summary.num_entries, VALVE_OPEN_POS );
+TEST_CHECK( lox_trace.entries[( lox_trace.head + VALVE_TRACE_SIZE - 1 ) %
+                              VALVE_TRACE_SIZE].event == VALVE_TRACE_EVENT_STOP,
+            "last entry is not the stop" );
+TEST_CHECK( !trace_clock_running(), "trace timer left running" );
+TEST_CHECK( !( VALVE_LOX_TIM.Instance->DIER & TIM_IT_UPDATE ),
+            "step interrupt left enabled" );
+}
+
+/* A held motor is flagged once per stall */
+static void test_stall
+	(
+	void
+	)
+{
+VALVE_TRACE_SUMMARY summary;
+
+place( VALVE_CLOSED_POS );
+hold_from  = 50;
+hold_steps = TEST_STALL_STEPS;
+TEST_CHECK( valve_open_ox_valve() == VALVE_OK, "open command rejected" );
+run_steps();
+TEST_CHECK( valve_get_trace_summary( 0, &summary ) == VALVE_OK &&
+            summary.stalls == 1, "%u stalls for one hold", summary.stalls );
+}
+
+/* A step ISR that runs after the stop leaves the frozen trace alone, and
+   the trace timer keeps running while the other valve is traced */
+static void test_late_step
+	(
+	void
+	)
+{
+uint16_t head;
+uint16_t count;
+
+valve_trace_init();
+trace_start( &lox_trace , 100, VALVE_OPEN_POS, VALVE_OPEN );
+trace_start( &fuel_trace, 100, VALVE_OPEN_POS, VALVE_OPEN );
+__HAL_TIM_ENABLE_IT( &( VALVE_LOX_TIM ), TIM_IT_UPDATE );
+trace_clock( 500 );
+trace_step( &lox_trace, 100 + VALVE_TRACE_POS_STEP, VALVE_OPEN );
+trace_stop( &lox_trace, &( VALVE_LOX_TIM ), 100 + VALVE_TRACE_POS_STEP );
+TEST_CHECK( !( VALVE_LOX_TIM.Instance->DIER & TIM_IT_UPDATE ),
+            "trace stop left the step interrupt enabled" );
+TEST_CHECK( trace_clock_running(),
+            "trace timer stopped while the fuel move is traced" );
+
+head  = lox_trace.head;
+count = lox_trace.count;
+trace_clock( 500 );
+trace_step  ( &lox_trace, 100 + 3*VALVE_TRACE_POS_STEP, VALVE_OPEN );
+trace_record( &lox_trace, VALVE_TRACE_EVENT_POS, 200, VALVE_OPEN );
+trace_stop  ( &lox_trace, &( VALVE_LOX_TIM ), 300 );
+TEST_CHECK( lox_trace.head == head && lox_trace.count == count,
+            "entries added after the stop, %u -> %u", count,
+            lox_trace.count );
+TEST_CHECK( lox_trace.time_to_target == 500,
+            "time to target moved to %u us", lox_trace.time_to_target );
+
+trace_stop( &fuel_trace, &( VALVE_FUEL_TIM ), 100 );
+TEST_CHECK( !trace_clock_running(), "trace timer left running" );
+}
+
+/* A readout sends the summary and one transfer per part of the ring and
+   stops at the first failed transfer */
+static void readout
+	(
+	uint32_t parts
+	)
+{
+VALVE_TRACE_SUMMARY summary;
+
+valve_get_trace_summary( 0, &summary );
+for ( uint32_t fail = 1; fail <= parts + 1; ++fail )
+	{
+	tx_calls     = 0;
+	tx_fail_call = fail;
+	TEST_CHECK( trace_transmit( &lox_trace, &summary, NULL ) == VALVE_ERROR,
+	            "transfer %u failed, readout returned ok", fail );
+	TEST_CHECK( tx_calls == fail, "%u transfers after transfer %u failed",
+	            tx_calls, fail );
+	}
+tx_calls     = 0;
+tx_fail_call = 0;
+tx_empty     = 0;
+TEST_CHECK( trace_transmit( &lox_trace, &summary, NULL ) == VALVE_OK &&
+            tx_calls == parts + 1 && tx_empty == 0,
+            "%u entries in %u transfers and %u empty ones", lox_trace.count,
+            tx_calls, tx_empty );
+}
+
+/* A short trace is read out in one part, a wrapped ring in two, and no
+   empty transfer is sent for the part that is not there */
+static void test_transmit_error
+	(
+	void
+	)
+{
+readout( 1 );
+
+trace_start( &lox_trace, 0, VALVE_OPEN_POS, VALVE_OPEN );
+for ( int i = 0; i < VALVE_TRACE_SIZE + 10; ++i )
+	{
+	trace_record( &lox_trace, VALVE_TRACE_EVENT_POS, i, VALVE_OPEN );
+	}
+trace_stop( &lox_trace, &( VALVE_LOX_TIM ), VALVE_TRACE_SIZE + 10 );
+TEST_CHECK( lox_trace.count == VALVE_TRACE_SIZE && lox_trace.head != 0,
+            "ring did not wrap, %u entries", lox_trace.count );
+readout( 2 );
+}
+
+int main
+	(
+	void
+	)
+{
+test_open_summary();
+test_stall();
+test_late_step();
+test_transmit_error();
+
+TEST_EXIT( "test_valve_trace" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,515 @@
+/*******************************************************************************
+*
+* FILE:
+* 		test_xbee.c
+*
+* DESCRIPTION:
+* 		Host test for the XBee API mode driver. Transmit frames are collected
+*       from the simulated UART DMA and decoded independently, received frames
+*       are escaped by the test and written into the DMA ring in random
+*       bursts. Checks that the start delimiter, escape and flow control bytes
+*       are escaped wherever they appear, length and checksum included, that
+*       the checksum brings the frame data sum to 0xFF, that a bad checksum is
+*       dropped, that the parser resynchronizes on every start delimiter, and
+*       that the blocking calls keep off the UART once API mode has started
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Includes
+------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../wireless/wireless.c"
+
+
+/*------------------------------------------------------------------------------
+ Macros
+------------------------------------------------------------------------------*/
+#define TEST_ADDR                   ( 0x0013A2007E7D1113ULL )
+#define TEST_WIRE_SIZE              ( 4096 )
+#define TEST_RX_PACKETS             ( 2000 )
+
+/* Bytes the API escapes */
+static const uint8_t specials[] = { XBEE_START, XBEE_ESCAPE, XBEE_XON,
+                                    XBEE_XOFF };
+
+
+/*------------------------------------------------------------------------------
+ UART model
+------------------------------------------------------------------------------*/
+
+static uint8_t  wire[TEST_WIRE_SIZE]; /* Bytes the transmit DMA sent        */
+static size_t   wire_size;
+static uint32_t blocking_calls;       /* Blocking UART transfers started    */
+static uint16_t ring_pos;             /* Receive DMA write position         */
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA
+	(
+	UART_HandleTypeDef* huart,
+	const uint8_t*      data ,
+	uint16_t            size
+	)
+{
+if ( huart->gState != HAL_UART_STATE_READY )
+	{
+	return HAL_BUSY;
+	}
+if ( wire_size + size <= sizeof( wire ) )
+	{
+	memcpy( &wire[wire_size], data, size );
+	wire_size += size;
+	}
+huart->gState = HAL_UART_STATE_BUSY_TX;
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit
+	(
+	UART_HandleTypeDef* huart  ,
+	const uint8_t*      data   ,
+	uint16_t            size   ,
+	uint32_t            timeout
+	)
+{
+blocking_calls++;
+return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive
+	(
+	UART_HandleTypeDef* huart  ,
+	uint8_t*            data   ,
+	uint16_t            size   ,
+	uint32_t            timeout
+	)
+{
+blocking_calls++;
+memset( data, 0, size );
+return HAL_OK;
+}
+
+/* Let the transmit DMA finish every queued frame */
+static void drain
+	(
+	void
+	)
+{
+for ( int i = 0; ( i < 1000 ) && ( rf_xbee_tx_pending() > 0 ); ++i )
+	{
+	XBEE_HUART.gState = HAL_UART_STATE_READY;
+	rf_xbee_tx_complete_ISR();
+	}
+XBEE_HUART.gState = HAL_UART_STATE_READY;
+TEST_CHECK( rf_xbee_tx_pending() == 0, "transmit queue stuck" );
+}
+
+/* Bytes arrive on the receive DMA ring with an idle line event after them */
+static void rx_burst
+	(
+	const uint8_t* data,
+	size_t         size
+	)
+{
+for ( size_t i = 0; i < size; ++i )
+	{
+	rx_buffer[ring_pos] = data[i];
+	ring_pos            = ( ring_pos + 1 ) & XBEE_RX_MASK;
+	}
+rf_xbee_rx_event_ISR( ring_pos );
+}
+
+static bool is_special
+	(
+	uint8_t byte
+	)
+{
+return memchr( specials, byte, sizeof( specials ) ) != NULL;
+}
+
+/* Escape a frame the way the module does, returns the encoded size */
+static size_t encode
+	(
+	const uint8_t* data,
+	size_t         size,
+	uint8_t*       out
+	)
+{
+uint8_t raw[3 + XBEE_RX_FRAME_MAX + 1];
+size_t  num_raw = 0;
+size_t  num_out = 0;
+uint8_t sum     = 0;
+
+raw[num_raw++] = (uint8_t) ( size >> 8 );
+raw[num_raw++] = (uint8_t) size;
+for ( size_t i = 0; i < size; ++i )
+	{
+	raw[num_raw++] = data[i];
+	sum           += data[i];
+	}
+raw[num_raw++] = 0xFF - sum;
+
+out[num_out++] = XBEE_START;
+for ( size_t i = 0; i < num_raw; ++i )
+	{
+	if ( is_special( raw[i] ) )
+		{
+		out[num_out++] = XBEE_ESCAPE;
+		out[num_out++] = raw[i] ^ XBEE_ESCAPE_XOR;
+		}
+	else
+		{
+		out[num_out++] = raw[i];
+		}
+	}
+return num_out;
+}
+
+/* Decode the frame at the start of the wire into its frame data. Returns
+   the frame data size, or -1 if the frame is malformed */
+static int decode
+	(
+	const char* name,
+	uint8_t*    data
+	)
+{
+uint8_t  raw[TEST_WIRE_SIZE];
+size_t   num_raw = 0;
+uint16_t length;
+uint8_t  sum = 0;
+
+TEST_CHECK( wire_size > 0 && wire[0] == XBEE_START, "%s: no start "
+            "delimiter", name );
+for ( size_t i = 1; i < wire_size; ++i )
+	{
+	TEST_CHECK( wire[i] != XBEE_START && wire[i] != XBEE_XON &&
+	            wire[i] != XBEE_XOFF, "%s: raw 0x%02x at byte %u", name,
+	            wire[i], (unsigned) i );
+	if ( wire[i] == XBEE_ESCAPE )
+		{
+		i++;
+		TEST_CHECK( i < wire_size && is_special( wire[i] ^ XBEE_ESCAPE_XOR ),
+		            "%s: needless escape at byte %u", name, (unsigned) i );
+		raw[num_raw++] = wire[i] ^ XBEE_ESCAPE_XOR;
+		}
+	else
+		{
+		raw[num_raw++] = wire[i];
+		}
+	}
+length = ( (uint16_t) raw[0] << 8 ) | raw[1];
+if ( num_raw != (size_t) length + 3 )
+	{
+	TEST_CHECK( false, "%s: length %u, %u bytes on the wire", name, length,
+	            (unsigned) num_raw );
+	return -1;
+	}
+for ( size_t i = 2; i < num_raw; ++i )
+	{
+	sum += raw[i];
+	}
+TEST_CHECK( sum == 0xFF, "%s: frame data and checksum sum to 0x%02x", name,
+            sum );
+memcpy( data, &raw[2], length );
+return length;
+}
+
+/* Send a payload and check the transmit request that comes out */
+static void check_send
+	(
+	const char*    name,
+	const uint8_t* data,
+	size_t         size
+	)
+{
+uint8_t frame[XBEE_TX_FRAME_SIZE];
+uint8_t frame_id;
+int     length;
+
+wire_size = 0;
+TEST_CHECK( rf_xbee_send( TEST_ADDR, data, size, &frame_id ) == RF_OK,
+            "%s: not queued", name );
+drain();
+length = decode( name, frame );
+if ( length != (int) ( XBEE_TX_HEADER_SIZE + size ) )
+	{
+	TEST_CHECK( false, "%s: frame data of %d bytes", name, length );
+	return;
+	}
+TEST_CHECK( frame[0] == XBEE_API_TX_REQUEST && frame[1] == frame_id,
+            "%s: API ID 0x%02x frame ID %u", name, frame[0], frame[1] );
+for ( int i = 0; i < 8; ++i )
+	{
+	TEST_CHECK( frame[2 + i] == (uint8_t) ( TEST_ADDR >> ( 56 - 8*i ) ),
+	            "%s: address byte %d", name, i );
+	}
+TEST_CHECK( memcmp( &frame[XBEE_TX_HEADER_SIZE], data, size ) == 0,
+            "%s: payload changed", name );
+}
+
+/* Frame data of a receive packet from TEST_ADDR */
+static size_t rx_packet_frame
+	(
+	const uint8_t* data,
+	size_t         size,
+	uint8_t*       frame
+	)
+{
+frame[0] = XBEE_API_RX_PACKET;
+for ( int i = 0; i < 8; ++i )
+	{
+	frame[1 + i] = (uint8_t) ( TEST_ADDR >> ( 56 - 8*i ) );
+	}
+frame[9]  = 0x7D;   /* 16-bit address, escaped on the wire */
+frame[10] = 0x33;
+frame[11] = 0x01;   /* Acknowledged */
+memcpy( &frame[XBEE_RX_HEADER_SIZE], data, size );
+return XBEE_RX_HEADER_SIZE + size;
+}
+
+static void check_packet
+	(
+	const char*    name,
+	const uint8_t* data,
+	size_t         size
+	)
+{
+RF_PACKET packet;
+
+TEST_CHECK( rf_xbee_receive_packet( &packet ) == RF_OK, "%s: no packet",
+            name );
+TEST_CHECK( packet.source == TEST_ADDR && packet.options == 0x01 &&
+            packet.length == size &&
+            memcmp( packet.payload, data, size ) == 0,
+            "%s: packet of %u bytes from %llx differs", name, packet.length,
+            (unsigned long long) packet.source );
+}
+
+
+/*------------------------------------------------------------------------------
+ Tests
+------------------------------------------------------------------------------*/
+
+/* The blocking calls use the UART until API mode starts, then return
+   RF_BUSY without touching it */
+static void test_blocking_calls
+	(
+	void
+	)
+{
+uint8_t byte = 0x55;
+uint8_t buffer[4];
+
+TEST_CHECK( rf_xbee_transmit_byte( byte ) == RF_OK &&
+            rf_xbee_transmit( buffer, sizeof( buffer ) ) == RF_OK &&
+            rf_xbee_receive_byte( &byte ) == RF_OK &&
+            rf_xbee_receive( buffer, sizeof( buffer ) ) == RF_OK &&
+            blocking_calls == 4, "blocking calls before API mode failed" );
+
+TEST_CHECK( rf_xbee_init() == RF_OK, "API mode not started" );
+blocking_calls = 0;
+TEST_CHECK( rf_xbee_transmit_byte( byte ) == RF_BUSY &&
+            rf_xbee_transmit( buffer, sizeof( buffer ) ) == RF_BUSY &&
+            rf_xbee_receive_byte( &byte ) == RF_BUSY &&
+            rf_xbee_receive( buffer, sizeof( buffer ) ) == RF_BUSY,
+            "blocking call accepted in API mode" );
+TEST_CHECK( blocking_calls == 0, "%u blocking transfers in API mode",
+            blocking_calls );
+}
+
+/* Every special byte is escaped, in the address, length, payload and
+   checksum, and the checksum is 0xFF less the frame data sum */
+static void test_tx_escape
+	(
+	void
+	)
+{
+static const uint8_t neighbours[] = { 0x7E, 0x7D, 0x11, 0x13, 0x5E, 0x5D,
+                                      0x31, 0x33, 0x7F, 0x10, 0x12, 0x14,
+                                      0x00, 0xFF, 0x20, 0x7C };
+uint8_t data[RF_MAX_PAYLOAD];
+uint8_t frame_id;
+uint8_t sum;
+
+/* Payload of special bytes and their neighbours */
+memcpy( data, neighbours, sizeof( neighbours ) );
+check_send( "specials", data, sizeof( neighbours ) );
+
+/* Length LSB of 0x11 */
+check_send( "length", data, 0x11 - XBEE_TX_HEADER_SIZE );
+
+/* A last byte that makes each special byte the checksum */
+for ( size_t s = 0; s < sizeof( specials ); ++s )
+	{
+	frame_id = tx_frame_id + 1;
+	if ( frame_id == 0 )
+		{
+		frame_id = 1;
+		}
+	sum = XBEE_API_TX_REQUEST + frame_id;
+	for ( int i = 0; i < 8; ++i )
+		{
+		sum += (uint8_t) ( TEST_ADDR >> ( 56 - 8*i ) );
+		}
+	sum += 0xFF + 0xFE;
+	for ( int i = 0; i < 4; ++i )
+		{
+		sum += data[i];
+		}
+	data[4] = (uint8_t) ( 0xFF - specials[s] - sum );
+	check_send( "checksum", data, 5 );
+	TEST_CHECK( wire_size >= 2 && wire[wire_size - 2] == XBEE_ESCAPE &&
+	            wire[wire_size - 1] == ( specials[s] ^ XBEE_ESCAPE_XOR ),
+	            "checksum 0x%02x not escaped", specials[s] );
+	}
+
+/* Longest payload, sent in CTS chunks */
+for ( int i = 0; i < RF_MAX_PAYLOAD; ++i )
+	{
+	data[i] = (uint8_t) ( 0x7B + i % 8 );
+	}
+check_send( "full", data, RF_MAX_PAYLOAD );
+}
+
+/* Escaped receive packets split into random bursts across the ring wrap */
+static void test_rx_packets
+	(
+	void
+	)
+{
+uint8_t data[RF_MAX_PAYLOAD];
+uint8_t frame[XBEE_RX_FRAME_MAX];
+uint8_t encoded[2*( XBEE_RX_FRAME_MAX + 3 ) + 1];
+size_t  size;
+size_t  num_encoded;
+size_t  pos;
+size_t  burst;
+
+srand( 3 );
+for ( int n = 0; n < TEST_RX_PACKETS; ++n )
+	{
+	size = 1 + rand() % RF_MAX_PAYLOAD;
+	for ( size_t i = 0; i < size; ++i )
+		{
+		data[i] = ( rand() & 1 ) ? (uint8_t) rand() :
+		          specials[rand() % sizeof( specials )];
+		}
+	num_encoded = encode( frame, rx_packet_frame( data, size, frame ),
+	                      encoded );
+	for ( pos = 0; pos < num_encoded; pos += burst )
+		{
+		burst = 1 + rand() % 40;
+		if ( burst > num_encoded - pos )
+			{
+			burst = num_encoded - pos;
+			}
+		rx_burst( &encoded[pos], burst );
+		}
+	check_packet( "rx", data, size );
+	}
+TEST_CHECK( xbee_stats.rx_errors == 0 && xbee_stats.rx_packets ==
+            TEST_RX_PACKETS, "rx: %u packets, %u errors",
+            xbee_stats.rx_packets, xbee_stats.rx_errors );
+printf( "xbee rx: %u packets, ring at %u\n", xbee_stats.rx_packets,
+        ring_pos );
+}
+
+/* A bad checksum drops the frame, the parser then resynchronizes on every
+   start delimiter, also one that cuts a frame short */
+static void test_resync
+	(
+	void
+	)
+{
+static const uint8_t data[] = { 0x10, 0x7E, 0x20 };
+uint8_t  frame[XBEE_RX_FRAME_MAX];
+uint8_t  encoded[2*( XBEE_RX_FRAME_MAX + 3 ) + 1];
+uint8_t  garbage[] = { 0x00, 0x7D, 0x13, 0xFF, 0x11 };
+size_t   num_encoded;
+uint32_t errors = xbee_stats.rx_errors;
+RF_PACKET packet;
+
+num_encoded = encode( frame, rx_packet_frame( data, sizeof( data ), frame ),
+                      encoded );
+
+/* Bad checksum */
+encoded[num_encoded - 1] ^= 0x01;
+rx_burst( encoded, num_encoded );
+encoded[num_encoded - 1] ^= 0x01;
+TEST_CHECK( rf_xbee_receive_packet( &packet ) == RF_EMPTY &&
+            xbee_stats.rx_errors == errors + 1, "bad checksum accepted" );
+
+/* Line noise before a frame is skipped */
+rx_burst( garbage, sizeof( garbage ) );
+rx_burst( encoded, num_encoded );
+check_packet( "noise", data, sizeof( data ) );
+
+/* A frame cut short by the next start delimiter is dropped, the next one
+   is read */
+rx_burst( encoded, num_encoded/2 );
+rx_burst( encoded, num_encoded );
+check_packet( "cut short", data, sizeof( data ) );
+TEST_CHECK( rf_xbee_receive_packet( &packet ) == RF_EMPTY,
+            "cut short frame delivered" );
+TEST_CHECK( xbee_stats.rx_errors == errors + 2, "%u errors, expected %u",
+            xbee_stats.rx_errors, errors + 2 );
+
+/* A length over the frame limit waits for the next start delimiter */
+frame[0] = XBEE_START;
+frame[1] = (uint8_t) ( ( XBEE_RX_FRAME_MAX + 1 ) >> 8 );
+frame[2] = (uint8_t) ( XBEE_RX_FRAME_MAX + 1 );
+rx_burst( frame, 3 );
+rx_burst( encoded, num_encoded );
+check_packet( "long length", data, sizeof( data ) );
+}
+
+/* A transmit status frame reports the delivery of a sent packet */
+static void test_delivery
+	(
+	void
+	)
+{
+uint8_t frame[7];
+uint8_t encoded[2*sizeof( frame ) + 4];
+uint8_t frame_id;
+uint8_t status;
+
+wire_size = 0;
+rf_xbee_send( TEST_ADDR, "x", 1, &frame_id );
+drain();
+TEST_CHECK( rf_xbee_get_delivery( frame_id, &status ) == RF_PENDING,
+            "delivery reported early" );
+frame[0] = XBEE_API_TX_STATUS;
+frame[1] = frame_id;
+frame[2] = 0xFF;
+frame[3] = 0xFE;
+frame[4] = 0x00;
+frame[5] = XBEE_DELIVERY_NO_ACK;
+frame[6] = 0x00;
+rx_burst( encoded, encode( frame, sizeof( frame ), encoded ) );
+TEST_CHECK( rf_xbee_get_delivery( frame_id, &status ) == RF_OK &&
+            status == XBEE_DELIVERY_NO_ACK, "delivery status 0x%02x",
+            status );
+}
+
+
+int main
+	(
+	void
+	)
+{
+test_blocking_calls();
+test_tx_escape();
+test_rx_packets();
+test_resync();
+test_delivery();
+
+TEST_EXIT( "test_xbee" );
+}
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
@@ -0,0 +1,820 @@
+/*******************************************************************************
+*
+* FILE: 
+* 		transport.c
+*
+* DESCRIPTION: 
+* 		Contains a common interface to the serial links commands arrive on.
+*       Command handlers send and receive through the transport passed in
+*       by the caller instead of choosing a port themselves, so one board 
+*       can serve commands from several links at the same time
+*
+*******************************************************************************/
+
+
+/*------------------------------------------------------------------------------
+ Standard Includes                                                              
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+/*------------------------------------------------------------------------------
+ Project Includes                                                               
+------------------------------------------------------------------------------*/
+#if   defined( VALVE_CONTROLLER  )
+	#include "sdr_pin_defines_L0005.h"
+#elif defined( ENGINE_CONTROLLER )
+	#include "sdr_pin_defines_L0002.h"
+#endif
+#include "main.h"
+#include "transport.h"
+#include "usb.h"
+#if defined( VALVE_CONTROLLER ) || defined( ENGINE_CONTROLLER )
+	#include "valve.h"
+#endif
+#ifdef USE_RS485
+	#include "rs485.h"
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Preprocesor Directives 
+------------------------------------------------------------------------------*/
+
+/* USB transmit callback queue index mask */
+#define USB_LINK_TX_MASK       ( USB_TX_QUEUE_DEPTH - 1 )
+
+
+/*------------------------------------------------------------------------------
+ Internal function prototypes 
+------------------------------------------------------------------------------*/
+
+/* USB serial port operations */
+static TRANSPORT_STATUS usb_link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	);
+
+static TRANSPORT_STATUS usb_link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	);
+
+static TRANSPORT_STATUS usb_link_receive_async
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	size_t*     rx_count
+	);
+
+static TRANSPORT_STATUS usb_link_transmit_async
+	(
+	const void*           tx_data_ptr ,
+	size_t                tx_data_size,
+	TRANSPORT_TX_CALLBACK callback
+	);
+
+static TRANSPORT_STATUS usb_link_tx_wait
+	(
+	size_t      max_pending,
+	uint32_t    timeout
+	);
+
+/* USB transmit completion, hands the result to the transport callback */
+static void usb_link_tx_done
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	USB_STATUS  tx_status
+	);
+
+/* Convert a USB return code */
+static TRANSPORT_STATUS usb_link_status
+	(
+	USB_STATUS usb_status
+	);
+
+#if defined( VALVE_CONTROLLER ) || defined( ENGINE_CONTROLLER )
+/* Valve controller serial port operations */
+static TRANSPORT_STATUS valve_link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	);
+
+static TRANSPORT_STATUS valve_link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	);
+
+static size_t valve_link_available
+	(
+	void
+	);
+#endif
+
+#ifdef USE_RS485
+/* RS485 bus operations */
+static TRANSPORT_STATUS rs485_link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	);
+
+static TRANSPORT_STATUS rs485_link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	);
+
+static size_t rs485_link_available
+	(
+	void
+	);
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Global Variables 
+------------------------------------------------------------------------------*/
+
+/* Transport callbacks of the queued USB buffers, in queue order. The USB 
+   transmit queue completes in order, so each USB completion takes the 
+   oldest entry */
+static TRANSPORT_TX_CALLBACK usb_link_callbacks[USB_TX_QUEUE_DEPTH];
+volatile static uint8_t      usb_link_cb_head = 0; /* Next free entry     */
+volatile static uint8_t      usb_link_cb_tail = 0; /* Oldest queued entry */
+
+/* USB serial port, receive ring and transmit queue from the usb module */
+const TRANSPORT transport_usb = 
+	{
+	.transmit       = usb_link_transmit      ,
+	.receive        = usb_link_receive       ,
+	.receive_async  = usb_link_receive_async ,
+	.flush          = usb_flush              ,
+	.transmit_async = usb_link_transmit_async,
+	.tx_wait        = usb_link_tx_wait       ,
+	.available      = usb_available          ,
+	.timeout        = HAL_DEFAULT_TIMEOUT    ,
+	.link           = TRANSPORT_LINK_USB
+	};
+
+/* Valve controller serial port, blocking only */
+#if defined( VALVE_CONTROLLER ) || defined( ENGINE_CONTROLLER )
+	const TRANSPORT transport_valve = 
+		{
+		.transmit       = valve_link_transmit ,
+		.receive        = valve_link_receive  ,
+		.receive_async  = NULL                ,
+		.flush          = NULL                ,
+		.transmit_async = NULL                ,
+		.tx_wait        = NULL                ,
+		.available      = valve_link_available,
+		.timeout        = HAL_DEFAULT_TIMEOUT ,
+		.link           = TRANSPORT_LINK_UART
+		};
+#endif
+
+/* RS485 point to point, blocking only. Not usable once the bus layer is 
+   started, see rs485.h */
+#ifdef USE_RS485
+	const TRANSPORT transport_rs485 = 
+		{
+		.transmit       = rs485_link_transmit ,
+		.receive        = rs485_link_receive  ,
+		.receive_async  = NULL                ,
+		.flush          = NULL                ,
+		.transmit_async = NULL                ,
+		.tx_wait        = NULL                ,
+		.available      = rs485_link_available ,
+		.timeout        = RS485_DEFAULT_TIMEOUT,
+		.link           = TRANSPORT_LINK_RS485
+		};
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		transport_transmit                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Transmit bytes on a link, blocking                                     *
+*                                                                              *
+*******************************************************************************/
+TRANSPORT_STATUS transport_transmit
+	(
+	const TRANSPORT* transport_ptr, /* Link to send on        */
+	const void*      tx_data_ptr  , /* Data to be sent        */
+	size_t           tx_data_size , /* Size of transmit data  */
+	uint32_t         timeout        /* Timeout in ms          */
+	)
+{
+return transport_ptr->transmit( tx_data_ptr, tx_data_size, timeout );
+} /* transport_transmit */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		transport_receive                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Receive bytes from a link, blocking                                    *
+*                                                                              *
+*******************************************************************************/
+TRANSPORT_STATUS transport_receive
+	(
+	const TRANSPORT* transport_ptr, /* Link to receive on               */
+	void*            rx_data_ptr  , /* Buffer to export data to         */
+	size_t           rx_data_size , /* Size of the data to be received  */
+	uint32_t         timeout        /* Timeout in ms                    */
+	)
+{
+return transport_ptr->receive( rx_data_ptr, rx_data_size, timeout );
+} /* transport_receive */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		transport_receive_async                                                *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Take the bytes received so far, up to rx_data_size, without waiting.   *
+*       Links without a receive ring take the bytes they report as waiting     *
+*                                                                              *
+*******************************************************************************/
+TRANSPORT_STATUS transport_receive_async
+	(
+	const TRANSPORT* transport_ptr, /* Link to receive on               */
+	void*            rx_data_ptr  , /* Buffer to export data to         */
+	size_t           rx_data_size , /* Size of the buffer               */
+	size_t*          rx_count       /* Number of bytes received         */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+size_t           num_bytes;        /* Bytes waiting on the link */
+TRANSPORT_STATUS transport_status; /* Blocking receive result   */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+if ( transport_ptr->receive_async != NULL )
+	{
+	return transport_ptr->receive_async( rx_data_ptr, rx_data_size, rx_count );
+	}
+
+*rx_count = 0;
+num_bytes = transport_available( transport_ptr );
+if ( num_bytes > rx_data_size )
+	{
+	num_bytes = rx_data_size;
+	}
+if ( num_bytes == 0 )
+	{
+	return TRANSPORT_OK;
+	}
+transport_status = transport_ptr->receive( rx_data_ptr, num_bytes, 
+                                           transport_ptr->timeout );
+if ( transport_status == TRANSPORT_OK )
+	{
+	*rx_count = num_bytes;
+	}
+return transport_status;
+} /* transport_receive_async */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		transport_flush                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Discard received data, does nothing on links without a receive buffer  *
+*                                                                              *
+*******************************************************************************/
+void transport_flush
+	(
+	const TRANSPORT* transport_ptr
+	)
+{
+if ( transport_ptr->flush != NULL )
+	{
+	transport_ptr->flush();
+	}
+} /* transport_flush */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		transport_transmit_async                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Queue a buffer for transmission without copying. Links without a       *
+*       transmit queue send it right away and run the callback before returning*
+*                                                                              *
+*******************************************************************************/
+TRANSPORT_STATUS transport_transmit_async
+	(
+	const TRANSPORT*      transport_ptr, /* Link to send on               */
+	const void*           tx_data_ptr  , /* Data to be sent               */
+	size_t                tx_data_size , /* Size of transmit data         */
+	TRANSPORT_TX_CALLBACK callback       /* Completion callback, or NULL  */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+TRANSPORT_STATUS transport_status; /* Blocking transmit result */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+if ( transport_ptr->transmit_async != NULL )
+	{
+	return transport_ptr->transmit_async( tx_data_ptr, tx_data_size, callback );
+	}
+
+transport_status = transport_ptr->transmit( tx_data_ptr , 
+                                            tx_data_size, 
+                                            transport_ptr->timeout );
+if ( ( transport_status == TRANSPORT_OK ) && ( callback != NULL ) )
+	{
+	callback( tx_data_ptr, tx_data_size, TRANSPORT_OK );
+	}
+return transport_status;
+} /* transport_transmit_async */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		transport_tx_wait                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Wait until at most max_pending queued buffers remain. Links without a  *
+*       transmit queue never have anything pending                             *
+*                                                                              *
+*******************************************************************************/
+TRANSPORT_STATUS transport_tx_wait
+	(
+	const TRANSPORT* transport_ptr, /* Link to wait on          */
+	size_t           max_pending  , /* Queue depth to wait for  */
+	uint32_t         timeout        /* Timeout in ms            */
+	)
+{
+if ( transport_ptr->tx_wait != NULL )
+	{
+	return transport_ptr->tx_wait( max_pending, timeout );
+	}
+return TRANSPORT_OK;
+} /* transport_tx_wait */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		transport_available                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Number of received bytes waiting. Links without a receive buffer only  *
+*       report whether a byte is waiting in the UART                           *
+*                                                                              *
+*******************************************************************************/
+size_t transport_available
+	(
+	const TRANSPORT* transport_ptr
+	)
+{
+if ( transport_ptr->available != NULL )
+	{
+	return transport_ptr->available();
+	}
+return 0;
+} /* transport_available */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		transport_transmit_frame                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Encode and transmit a frame of the framed command protocol             *
+*                                                                              *
+*******************************************************************************/
+TRANSPORT_STATUS transport_transmit_frame
+	(
+	const TRANSPORT*    transport_ptr, /* Link to send on                   */
+	const FRAME_HEADER* header_ptr   , /* Header, length is payload size   */
+	const void*         payload_ptr  , /* Payload, may be NULL if empty     */
+	uint32_t            timeout        /* Timeout in ms                     */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t tx_buffer[FRAME_MAX_ENCODED_SIZE]; /* Encoded frame      */
+size_t  tx_size;                           /* Encoded frame size */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+if ( frame_encode( header_ptr         , 
+                   payload_ptr        , 
+                   &( tx_buffer[0] )  , 
+                   sizeof( tx_buffer ), 
+                   &tx_size ) != FRAME_OK )
+	{
+	return TRANSPORT_FAIL;
+	}
+return transport_ptr->transmit( &( tx_buffer[0] ), tx_size, timeout );
+} /* transport_transmit_frame */
+
+
+/*------------------------------------------------------------------------------
+ Internal procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_link_transmit                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       USB serial port blocking transmit                                      *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS usb_link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	)
+{
+return usb_link_status( usb_transmit( (void*) tx_data_ptr, tx_data_size, 
+                                       timeout ) );
+} /* usb_link_transmit */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_link_receive                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       USB serial port blocking receive                                       *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS usb_link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	)
+{
+return usb_link_status( usb_receive( rx_data_ptr, rx_data_size, timeout ) );
+} /* usb_link_receive */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_link_receive_async                                                 *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       USB serial port receive without waiting, takes what is in the ring     *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS usb_link_receive_async
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	size_t*     rx_count
+	)
+{
+*rx_count = usb_read( rx_data_ptr, rx_data_size );
+return TRANSPORT_OK;
+} /* usb_link_receive_async */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_link_transmit_async                                                *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       USB serial port queued transmit. The transport callback is kept in a   *
+*       queue next to the USB one, its entry is claimed before the buffer is   *
+*       queued since a transfer that fails to start completes right away       *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS usb_link_transmit_async
+	(
+	const void*           tx_data_ptr ,
+	size_t                tx_data_size,
+	TRANSPORT_TX_CALLBACK callback
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t   primask;    /* Interrupt mask state at entry */
+USB_STATUS usb_status; /* Queue result                  */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+primask = __get_PRIMASK();
+__disable_irq();
+usb_link_callbacks[usb_link_cb_head & USB_LINK_TX_MASK] = callback;
+usb_link_cb_head++;
+usb_status = usb_transmit_async( tx_data_ptr, tx_data_size, usb_link_tx_done );
+if ( usb_status != USB_OK )
+	{
+	usb_link_cb_head--;
+	}
+__set_PRIMASK( primask );
+return usb_link_status( usb_status );
+} /* usb_link_transmit_async */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_link_tx_done                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       USB transmit completion, hands the result to the transport callback of *
+*       the oldest queued buffer                                               *
+*                                                                              *
+*******************************************************************************/
+static void usb_link_tx_done
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	USB_STATUS  tx_status
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+TRANSPORT_TX_CALLBACK callback; /* Transport callback of the buffer */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+callback = usb_link_callbacks[usb_link_cb_tail & USB_LINK_TX_MASK];
+usb_link_cb_tail++;
+if ( callback != NULL )
+	{
+	callback( tx_data_ptr, tx_data_size, usb_link_status( tx_status ) );
+	}
+} /* usb_link_tx_done */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_link_tx_wait                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       USB serial port transmit queue wait                                    *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS usb_link_tx_wait
+	(
+	size_t      max_pending,
+	uint32_t    timeout
+	)
+{
+return usb_link_status( usb_tx_wait( max_pending, timeout ) );
+} /* usb_link_tx_wait */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_link_status                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Convert a USB return code                                              *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS usb_link_status
+	(
+	USB_STATUS usb_status
+	)
+{
+switch ( usb_status )
+	{
+	case USB_OK:
+		{
+		return TRANSPORT_OK;
+		}
+	case USB_TIMEOUT:
+		{
+		return TRANSPORT_TIMEOUT;
+		}
+	case USB_BUSY:
+		{
+		return TRANSPORT_BUSY;
+		}
+	default:
+		{
+		return TRANSPORT_FAIL;
+		}
+	}
+} /* usb_link_status */
+
+
+#if defined( VALVE_CONTROLLER ) || defined( ENGINE_CONTROLLER )
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_link_transmit                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Valve controller serial port blocking transmit                         *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS valve_link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	)
+{
+if ( valve_transmit( (void*) tx_data_ptr, tx_data_size, timeout ) != VALVE_OK )
+	{
+	return TRANSPORT_FAIL;
+	}
+return TRANSPORT_OK;
+} /* valve_link_transmit */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_link_receive                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Valve controller serial port blocking receive                          *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS valve_link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	)
+{
+if ( valve_receive( rx_data_ptr, rx_data_size, timeout ) != VALVE_OK )
+	{
+	return TRANSPORT_FAIL;
+	}
+return TRANSPORT_OK;
+} /* valve_link_receive */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_link_available                                                   *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Valve controller serial port, 1 if a byte is waiting in the UART       *
+*                                                                              *
+*******************************************************************************/
+static size_t valve_link_available
+	(
+	void
+	)
+{
+return __HAL_UART_GET_FLAG( &( VALVE_HUART ), UART_FLAG_RXNE ) ? 1 : 0;
+} /* valve_link_available */
+#endif /* #if defined( VALVE_CONTROLLER ) || defined( ENGINE_CONTROLLER ) */
+
+
+#ifdef USE_RS485
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_link_transmit                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       RS485 bus blocking transmit                                            *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS rs485_link_transmit
+	(
+	const void* tx_data_ptr ,
+	size_t      tx_data_size,
+	uint32_t    timeout
+	)
+{
+switch ( rs485_transmit( (void*) tx_data_ptr, tx_data_size, timeout ) )
+	{
+	case RS485_OK:
+		{
+		return TRANSPORT_OK;
+		}
+	case RS485_TIMEOUT:
+		{
+		return TRANSPORT_TIMEOUT;
+		}
+	default:
+		{
+		return TRANSPORT_FAIL;
+		}
+	}
+} /* rs485_link_transmit */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_link_receive                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       RS485 bus blocking receive                                             *
+*                                                                              *
+*******************************************************************************/
+static TRANSPORT_STATUS rs485_link_receive
+	(
+	void*       rx_data_ptr ,
+	size_t      rx_data_size,
+	uint32_t    timeout
+	)
+{
+switch ( rs485_receive( rx_data_ptr, rx_data_size, timeout ) )
+	{
+	case RS485_OK:
+		{
+		return TRANSPORT_OK;
+		}
+	case RS485_TIMEOUT:
+		{
+		return TRANSPORT_TIMEOUT;
+		}
+	default:
+		{
+		return TRANSPORT_FAIL;
+		}
+	}
+} /* rs485_link_receive */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rs485_link_available                                                   *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       RS485 bus, 1 if a byte is waiting in the UART. Always 0 once the bus   *
+*       layer owns the UART, its traffic is read with rs485_bus_receive        *
+*                                                                              *
+*******************************************************************************/
+static size_t rs485_link_available
+	(
+	void
+	)
+{
+if ( rs485_bus_active() )
+	{
+	return 0;
+	}
+return __HAL_UART_GET_FLAG( &( RS485_HUART ), UART_FLAG_RXNE ) ? 1 : 0;
+} /* rs485_link_available */
+#endif /* #ifdef USE_RS485 */
+
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
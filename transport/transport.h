@@ -0,0 +1,221 @@
+/*******************************************************************************
+*
+* FILE: 
+* 		transport.h
+*
+* DESCRIPTION: 
+* 		Contains a common interface to the serial links commands arrive on.
+*       Command handlers send and receive through the transport passed in
+*       by the caller instead of choosing a port themselves, so one board 
+*       can serve commands from several links at the same time
+*
+*******************************************************************************/
+
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Includes 
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "frame.h"
+
+
+/*------------------------------------------------------------------------------
+ Typdefs 
+------------------------------------------------------------------------------*/
+
+/* Transport return codes */
+typedef enum _TRANSPORT_STATUS
+	{
+	TRANSPORT_OK          = 0,
+	TRANSPORT_FAIL           ,
+	TRANSPORT_TIMEOUT        ,
+	TRANSPORT_BUSY              /* Transmit queue full */
+	} TRANSPORT_STATUS;
+
+/* Kind of serial link, tells a command which error code to report when the
+   link fails */
+typedef enum _TRANSPORT_LINK
+	{
+	TRANSPORT_LINK_USB  = 0,
+	TRANSPORT_LINK_UART    ,
+	TRANSPORT_LINK_RS485   ,
+	TRANSPORT_NUM_LINKS
+	} TRANSPORT_LINK;
+
+/* Transmit completion callback, the buffer may be reused once it runs. The
+   status is TRANSPORT_OK if the buffer was sent */
+typedef void ( *TRANSPORT_TX_CALLBACK )
+	(
+	const void*      tx_data_ptr , /* Buffer that was sent */
+	size_t           tx_data_size, /* Number of bytes sent */
+	TRANSPORT_STATUS tx_status     /* Transfer result      */
+	);
+
+/* Serial link operations. Optional operations are NULL when the link does 
+   not support them, the transport_ functions supply the fallback */
+typedef struct _TRANSPORT
+	{
+	/* Blocking transmit */
+	TRANSPORT_STATUS ( *transmit )
+		(
+		const void* tx_data_ptr ,
+		size_t      tx_data_size,
+		uint32_t    timeout
+		);
+
+	/* Blocking receive */
+	TRANSPORT_STATUS ( *receive )
+		(
+		void*       rx_data_ptr ,
+		size_t      rx_data_size,
+		uint32_t    timeout
+		);
+
+	/* Take up to rx_data_size received bytes without waiting, optional */
+	TRANSPORT_STATUS ( *receive_async )
+		(
+		void*       rx_data_ptr ,
+		size_t      rx_data_size,
+		size_t*     rx_count
+		);
+
+	/* Discard received data, optional */
+	void ( *flush )
+		(
+		void
+		);
+
+	/* Queue a buffer for transmission without copying, optional */
+	TRANSPORT_STATUS ( *transmit_async )
+		(
+		const void*           tx_data_ptr ,
+		size_t                tx_data_size,
+		TRANSPORT_TX_CALLBACK callback
+		);
+
+	/* Wait until at most max_pending queued buffers remain, optional */
+	TRANSPORT_STATUS ( *tx_wait )
+		(
+		size_t      max_pending,
+		uint32_t    timeout
+		);
+
+	/* Number of received bytes waiting, optional */
+	size_t ( *available )
+		(
+		void
+		);
+
+	uint32_t       timeout; /* Default timeout for the link, ms */
+	TRANSPORT_LINK link;    /* Kind of link, for error reporting */
+	} TRANSPORT;
+
+
+/*------------------------------------------------------------------------------
+ Global Variables 
+------------------------------------------------------------------------------*/
+
+/* USB serial port */
+extern const TRANSPORT transport_usb;
+
+/* Valve controller serial port */
+#if defined( VALVE_CONTROLLER ) || defined( ENGINE_CONTROLLER )
+	extern const TRANSPORT transport_valve;
+#endif
+
+/* RS485 bus */
+#ifdef USE_RS485
+	extern const TRANSPORT transport_rs485;
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Function Prototypes 
+------------------------------------------------------------------------------*/
+
+/* Transmit bytes, blocking */
+TRANSPORT_STATUS transport_transmit
+	(
+	const TRANSPORT* transport_ptr, /* Link to send on        */
+	const void*      tx_data_ptr  , /* Data to be sent        */
+	size_t           tx_data_size , /* Size of transmit data  */
+	uint32_t         timeout        /* Timeout in ms          */
+	);
+
+/* Receive bytes, blocking */
+TRANSPORT_STATUS transport_receive
+	(
+	const TRANSPORT* transport_ptr, /* Link to receive on               */
+	void*            rx_data_ptr  , /* Buffer to export data to         */
+	size_t           rx_data_size , /* Size of the data to be received  */
+	uint32_t         timeout        /* Timeout in ms                    */
+	);
+
+/* Take the bytes received so far, up to rx_data_size, without waiting */
+TRANSPORT_STATUS transport_receive_async
+	(
+	const TRANSPORT* transport_ptr, /* Link to receive on               */
+	void*            rx_data_ptr  , /* Buffer to export data to         */
+	size_t           rx_data_size , /* Size of the buffer               */
+	size_t*          rx_count       /* Number of bytes received         */
+	);
+
+/* Discard received data */
+void transport_flush
+	(
+	const TRANSPORT* transport_ptr
+	);
+
+/* Queue a buffer for transmission without copying. Links without a transmit
+   queue send it right away and run the callback before returning */
+TRANSPORT_STATUS transport_transmit_async
+	(
+	const TRANSPORT*      transport_ptr, /* Link to send on               */
+	const void*           tx_data_ptr  , /* Data to be sent               */
+	size_t                tx_data_size , /* Size of transmit data         */
+	TRANSPORT_TX_CALLBACK callback       /* Completion callback, or NULL  */
+	);
+
+/* Wait until at most max_pending queued buffers remain */
+TRANSPORT_STATUS transport_tx_wait
+	(
+	const TRANSPORT* transport_ptr, /* Link to wait on          */
+	size_t           max_pending  , /* Queue depth to wait for  */
+	uint32_t         timeout        /* Timeout in ms            */
+	);
+
+/* Number of received bytes waiting, a lower bound on links that can only
+   tell whether a byte is waiting */
+size_t transport_available
+	(
+	const TRANSPORT* transport_ptr
+	);
+
+/* Encode and transmit a frame of the framed command protocol */
+TRANSPORT_STATUS transport_transmit_frame
+	(
+	const TRANSPORT*    transport_ptr, /* Link to send on                   */
+	const FRAME_HEADER* header_ptr   , /* Header, length is payload size   */
+	const void*         payload_ptr  , /* Payload, may be NULL if empty     */
+	uint32_t            timeout        /* Timeout in ms                     */
+	);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* TRANSPORT_H */
+
+/*******************************************************************************
+* END OF FILE                                                                  *
+*******************************************************************************/
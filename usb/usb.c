@@ -13,6 +13,7 @@
  Standard Includes  
 ------------------------------------------------------------------------------*/
 #include <stdbool.h>
+#include <string.h>
 
 
 /*------------------------------------------------------------------------------
@@ -42,11 +43,72 @@
  Preprocesor Directives 
 ------------------------------------------------------------------------------*/
 
+/* Receive ring index mask */
+#define USB_RX_MASK            ( USB_RX_BUFFER_SIZE - 1 )
+
+/* Transmit queue index mask */
+#define USB_TX_MASK            ( USB_TX_QUEUE_DEPTH - 1 )
+
+/* Data cache line size */
+#define USB_CACHE_LINE         ( 32 )
+
 
 /*------------------------------------------------------------------------------
 Global Variables                                                                  
 ------------------------------------------------------------------------------*/
 
+/* Receive ring, written by the UART DMA stream in circular mode. Aligned to
+   a cache line so it can be invalidated without touching other data */
+static uint8_t           rx_buffer[USB_RX_BUFFER_SIZE] __attribute__(( aligned( 32 ) ));
+volatile static uint32_t rx_count     = 0;     /* Bytes received at last event */
+volatile static uint16_t rx_event_pos = 0;     /* Ring position at last event  */
+volatile static bool     rx_overflow  = false; /* Unread data was overwritten  */
+static uint32_t          read_count   = 0;     /* Bytes consumed               */
+static uint16_t          read_pos     = 0;     /* Ring read index              */
+
+/* Transmit descriptor queue. Buffers are queued by the application and
+   released by the transmit complete interrupt. The DMA must be able to
+   reach the queued buffers, so they cannot live in DTCM */
+static USB_TX_DESC       tx_queue[USB_TX_QUEUE_DEPTH];
+volatile static uint8_t  tx_head      = 0;     /* Next free descriptor         */
+volatile static uint8_t  tx_tail      = 0;     /* Descriptor being sent        */
+volatile static bool     tx_active    = false; /* DMA transfer in progress     */
+
+
+/*------------------------------------------------------------------------------
+ Internal function prototypes 
+------------------------------------------------------------------------------*/
+
+/* Current DMA write position in the receive ring */
+static uint16_t rx_write_pos
+	(
+	void
+	);
+
+/* Flush the receive ring if it overflowed, returns true if it did */
+static bool rx_check_overflow
+	(
+	void
+	);
+
+/* Invalidate the receive ring in the data cache before the CPU reads it */
+static void rx_invalidate
+	(
+	void
+	);
+
+/* Start the DMA transfer of the descriptor at the tail of the queue */
+static void tx_start
+	(
+	void
+	);
+
+/* Release the descriptor in progress and report its result */
+static void tx_finish
+	(
+	USB_STATUS tx_status
+	);
+
 
 /*------------------------------------------------------------------------------
  Procedures 
@@ -79,23 +141,169 @@ HAL_StatusTypeDef usb_status;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The HAL transfer length is 16 bits */
+if ( ( tx_data_size == 0 ) || ( tx_data_size > UINT16_MAX ) )
+	{
+	return USB_FAIL;
+	}
+
+/* Let queued buffers go first so bytes stay in order */
+if ( usb_tx_wait( 0, timeout ) != USB_OK )
+	{
+	return USB_TIMEOUT;
+	}
+
 /* Transmit byte */
 usb_status = HAL_UART_Transmit( &( USB_HUART ),
                                 tx_data_ptr   , 
                                 tx_data_size  , 
                                 timeout );
 
-/* Return HAL status */
-if ( usb_status != HAL_OK )
+/* Convert the HAL status */
+switch ( usb_status )
 	{
-	return usb_status;
+	case HAL_OK:
+		{
+		return USB_OK;
+		}
+	case HAL_TIMEOUT:
+		{
+		return USB_TIMEOUT;
+		}
+	case HAL_BUSY:
+		{
+		return USB_BUSY;
+		}
+	default:
+		{
+		return USB_FAIL;
+		}
 	}
-else
+
+} /* usb_transmit */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_transmit_async                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Queue a buffer for DMA transmission without copying it. Returns        *
+*       USB_BUSY if the queue is full, the caller can retry or drop the data.  *
+*       The buffer must stay valid until its callback runs                     *
+*                                                                              *
+*******************************************************************************/
+USB_STATUS usb_transmit_async
+	(
+	const void*     tx_data_ptr , /* Data to be sent               */
+	size_t          tx_data_size, /* Size of transmit data         */
+	USB_TX_CALLBACK callback      /* Completion callback, or NULL  */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t     primask;  /* Interrupt mask state at entry */
+USB_TX_DESC* desc_ptr; /* Descriptor to fill            */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+
+/* The HAL transfer length is 16 bits */
+if ( ( tx_data_size == 0 ) || ( tx_data_size > UINT16_MAX ) )
 	{
-	return USB_OK;
+	return USB_FAIL;
 	}
 
-} /* usb_transmit */
+/* Write the buffer back to memory before the DMA reads it. Cleaning the 
+   whole cache lines around the buffer is harmless */
+#if defined( __DCACHE_PRESENT ) && ( __DCACHE_PRESENT == 1U )
+	SCB_CleanDCache_by_Addr( 
+		(void*) ( (uintptr_t) tx_data_ptr & ~( USB_CACHE_LINE - 1 ) ),
+		(int32_t) ( tx_data_size + ( (uintptr_t) tx_data_ptr & 
+		                             ( USB_CACHE_LINE - 1 ) ) ) );
+#endif
+
+/* Check for space, fill the descriptor, publish it and start the DMA if 
+   idle in one critical section. Callers in the main loop and in completion
+   callbacks can then not claim the same slot or overrun the queue */
+primask = __get_PRIMASK();
+__disable_irq();
+if ( usb_tx_pending() >= USB_TX_QUEUE_DEPTH )
+	{
+	__set_PRIMASK( primask );
+	return USB_BUSY;
+	}
+desc_ptr           = &( tx_queue[tx_head & USB_TX_MASK] );
+desc_ptr->data_ptr = tx_data_ptr;
+desc_ptr->size     = tx_data_size;
+desc_ptr->callback = callback;
+tx_head++;
+if ( !tx_active )
+	{
+	tx_start();
+	}
+__set_PRIMASK( primask );
+return USB_OK;
+} /* usb_transmit_async */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_tx_pending                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Number of queued buffers not yet sent, including the one in progress   *
+*                                                                              *
+*******************************************************************************/
+size_t usb_tx_pending
+	(
+	void
+	)
+{
+return (uint8_t) ( tx_head - tx_tail );
+} /* usb_tx_pending */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_tx_wait                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Wait until at most max_pending buffers remain in the transmit queue    *
+*                                                                              *
+*******************************************************************************/
+USB_STATUS usb_tx_wait
+	(
+	size_t   max_pending, /* Queue depth to wait for */
+	uint32_t timeout      /* Timeout in ms           */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t start_tick; /* HAL tick at the call */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+start_tick = HAL_GetTick();
+while ( usb_tx_pending() > max_pending )
+	{
+	if ( ( timeout != HAL_MAX_DELAY                  ) && 
+	     ( ( HAL_GetTick() - start_tick ) >= timeout ) )
+		{
+		return USB_TIMEOUT;
+		}
+	}
+return USB_OK;
+} /* usb_tx_wait */
 
 
 /*******************************************************************************
@@ -117,40 +325,247 @@ USB_STATUS usb_receive
 /*------------------------------------------------------------------------------
  Local Variables
 ------------------------------------------------------------------------------*/
-HAL_StatusTypeDef usb_status;
+uint8_t* rx_byte_ptr; /* Next byte of the export buffer */
+uint32_t start_tick;  /* HAL tick at the call           */
+size_t   num_read;    /* Bytes read from the ring       */
 
 
 /*------------------------------------------------------------------------------
- API Function Implementation 
+ Initializations 
 ------------------------------------------------------------------------------*/
+rx_byte_ptr = rx_data_ptr;
+start_tick  = HAL_GetTick();
 
-/* Transmit byte */
-usb_status = HAL_UART_Receive( &( USB_HUART ),
-                               rx_data_ptr   , 
-                               rx_data_size  , 
-                               timeout );
 
-/* Return HAL status */
-switch ( usb_status )
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+
+/* Drain the ring until the request is filled or the timeout expires */
+while ( rx_data_size > 0 )
 	{
-	case HAL_TIMEOUT:
+	if ( rx_check_overflow() )
+		{
+		return USB_OVERFLOW;
+		}
+
+	num_read      = usb_read( rx_byte_ptr, rx_data_size );
+	rx_byte_ptr  += num_read;
+	rx_data_size -= num_read;
+
+	if ( ( rx_data_size > 0                            ) && 
+	     ( timeout != HAL_MAX_DELAY                    ) && 
+	     ( ( HAL_GetTick() - start_tick ) >= timeout ) )
 		{
 		return USB_TIMEOUT;
-		break;
 		}
-	case HAL_OK:
+	}
+
+return USB_OK;
+} /* usb_receive */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_init                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start receiving into the circular DMA ring. The UART receive DMA       *
+*       stream must be configured in circular mode                             *
+*                                                                              *
+*******************************************************************************/
+USB_STATUS usb_init
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+rx_count     = 0;
+rx_event_pos = 0;
+rx_overflow  = false;
+read_count   = 0;
+read_pos     = 0;
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+if ( HAL_UARTEx_ReceiveToIdle_DMA( &( USB_HUART ), 
+                                   rx_buffer   , 
+                                   USB_RX_BUFFER_SIZE ) != HAL_OK )
+	{
+	return USB_FAIL;
+	}
+return USB_OK;
+} /* usb_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_available                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Number of received bytes waiting to be read. Uses the live DMA counter *
+*       so bytes are visible before the next idle line event                   *
+*                                                                              *
+*******************************************************************************/
+size_t usb_available
+	(
+	void
+	)
+{
+return ( rx_write_pos() - read_pos ) & USB_RX_MASK;
+} /* usb_available */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_peek                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the next received byte without removing it                         *
+*                                                                              *
+*******************************************************************************/
+USB_STATUS usb_peek
+	(
+	uint8_t* byte_ptr
+	)
+{
+if ( rx_check_overflow() || ( usb_available() == 0 ) )
+	{
+	return USB_EMPTY;
+	}
+
+rx_invalidate();
+*byte_ptr = rx_buffer[read_pos];
+return USB_OK;
+} /* usb_peek */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_read                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Read up to max_size received bytes without blocking, returns the number*
+*       of bytes read                                                          *
+*                                                                              *
+*******************************************************************************/
+size_t usb_read
+	(
+	void*  rx_data_ptr, /* Buffer to export data to */
+	size_t max_size     /* Size of the buffer       */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+size_t num_bytes; /* Bytes to read                */
+size_t num_first; /* Bytes before the end of ring */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+if ( rx_check_overflow() )
+	{
+	return 0;
+	}
+num_bytes = usb_available();
+if ( num_bytes > max_size )
+	{
+	num_bytes = max_size;
+	}
+num_first = USB_RX_BUFFER_SIZE - read_pos;
+if ( num_first > num_bytes )
+	{
+	num_first = num_bytes;
+	}
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+rx_invalidate();
+memcpy( rx_data_ptr, &( rx_buffer[read_pos] ), num_first );
+memcpy( (uint8_t*) rx_data_ptr + num_first, &( rx_buffer[0] ), 
+        num_bytes - num_first );
+read_pos    = ( read_pos + num_bytes ) & USB_RX_MASK;
+read_count += num_bytes;
+return num_bytes;
+} /* usb_read */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_wait                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Wait until num_bytes are available or the HAL tick reaches deadline    *
+*                                                                              *
+*******************************************************************************/
+USB_STATUS usb_wait
+	(
+	size_t   num_bytes, /* Number of bytes to wait for    */
+	uint32_t deadline   /* Absolute HAL tick to give up at */
+	)
+{
+while ( usb_available() < num_bytes )
+	{
+	if ( rx_check_overflow() )
 		{
-		return USB_OK;
-		break;
+		return USB_OVERFLOW;
 		}
-	default:
+	if ( (int32_t) ( HAL_GetTick() - deadline ) >= 0 )
 		{
-		return USB_FAIL;
-		break;
-        }
+		return USB_TIMEOUT;
+		}
 	}
+return USB_OK;
+} /* usb_wait */
 
-} /* usb_receive */
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_flush                                                              *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Remove garbage USB data by discarding everything in the receive ring   *
+*                                                                              *
+*******************************************************************************/
+void usb_flush
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t primask;   /* Interrupt mask state at entry */
+uint16_t write_pos; /* DMA write position            */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+
+/* Resynchronize the read side with the DMA without racing the RX event ISR */
+primask = __get_PRIMASK();
+__disable_irq();
+write_pos   = rx_write_pos();
+read_count  = rx_count + ( ( write_pos - rx_event_pos ) & USB_RX_MASK );
+read_pos    = write_pos;
+rx_overflow = false;
+__set_PRIMASK( primask );
+} /* usb_flush */
 
 
 #if defined( A0002_REV2           ) || \
@@ -203,6 +618,256 @@ else
 #endif /* #if defined( A0002_REV2 ) || defined( FLIGHT_COMPUTER_LITE ) */
 
 
+/*------------------------------------------------------------------------------
+ Interrupt Service Routines 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_tx_complete_ISR                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       UART transmit complete interrupt, call from HAL_UART_TxCpltCallback.   *
+*       Releases the sent buffer to its owner and starts the next one          *
+*                                                                              *
+*******************************************************************************/
+void usb_tx_complete_ISR
+	(
+	void
+	)
+{
+tx_finish( USB_OK );
+} /* usb_tx_complete_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_rx_event_ISR                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       UART receive event interrupt, call from HAL_UARTEx_RxEventCallback.    *
+*       Runs on idle line, half and full ring events and flags an overflow once*
+*       the DMA has caught up with unread data                                 *
+*                                                                              *
+*******************************************************************************/
+void usb_rx_event_ISR
+	(
+	uint16_t rx_pos     /* Write position in the DMA ring */
+	)
+{
+rx_pos       &= USB_RX_MASK;
+rx_count     += ( rx_pos - rx_event_pos ) & USB_RX_MASK;
+rx_event_pos  = rx_pos;
+if ( (int32_t) ( rx_count - read_count ) >= USB_RX_BUFFER_SIZE )
+	{
+	rx_overflow = true;
+	}
+} /* usb_rx_event_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		usb_error_ISR                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       UART error interrupt, call from HAL_UART_ErrorCallback. An overrun,    *
+*       receive DMA or receiver timeout error stops the receive DMA, restart it*
+*       and flag the ring for a flush. Noise, framing and parity errors and    *
+*       transmit errors leave the receive DMA running and the ring intact. A   *
+*       failed transmit is released to its owner with USB_FAIL                 *
+*                                                                              *
+*******************************************************************************/
+void usb_error_ISR
+	(
+	void
+	)
+{
+/* The HAL leaves the receiver ready once it has aborted the receive DMA */
+if ( ( USB_HUART.ErrorCode != HAL_UART_ERROR_NONE  ) && 
+     ( USB_HUART.RxState   == HAL_UART_STATE_READY ) )
+	{
+	if ( HAL_UARTEx_ReceiveToIdle_DMA( &( USB_HUART ), 
+	                                   rx_buffer   , 
+	                                   USB_RX_BUFFER_SIZE ) == HAL_OK )
+		{
+		rx_event_pos = 0;
+		rx_overflow  = true;
+		}
+	}
+
+/* A transmit DMA error ends the transfer, report it and move on */
+if ( tx_active && ( USB_HUART.gState == HAL_UART_STATE_READY ) )
+	{
+	tx_finish( USB_FAIL );
+	}
+} /* usb_error_ISR */
+
+
+/*------------------------------------------------------------------------------
+ Internal procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rx_write_pos                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Current DMA write position in the receive ring                         *
+*                                                                              *
+*******************************************************************************/
+static uint16_t rx_write_pos
+	(
+	void
+	)
+{
+return ( USB_RX_BUFFER_SIZE - __HAL_DMA_GET_COUNTER( USB_HUART.hdmarx ) ) & 
+       USB_RX_MASK;
+} /* rx_write_pos */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rx_check_overflow                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Flush the receive ring if it overflowed, returns true if it did        *
+*                                                                              *
+*******************************************************************************/
+static bool rx_check_overflow
+	(
+	void
+	)
+{
+if ( rx_overflow )
+	{
+	usb_flush();
+	return true;
+	}
+return false;
+} /* rx_check_overflow */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rx_invalidate                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Invalidate the receive ring in the data cache before the CPU reads it  *
+*                                                                              *
+*******************************************************************************/
+static void rx_invalidate
+	(
+	void
+	)
+{
+#if defined( __DCACHE_PRESENT ) && ( __DCACHE_PRESENT == 1U )
+	SCB_InvalidateDCache_by_Addr( rx_buffer, USB_RX_BUFFER_SIZE );
+#endif
+} /* rx_invalidate */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tx_start                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start the DMA transfer of the descriptor at the tail of the queue. A   *
+*       transfer that fails to start is reported to its owner as failed and    *
+*       dropped so the queue keeps moving. Call with interrupts masked or from *
+*       the UART interrupt                                                     *
+*                                                                              *
+*******************************************************************************/
+static void tx_start
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+USB_TX_DESC desc; /* Descriptor to send */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* A failure callback may queue another buffer and start it itself, so 
+   check for a transfer in progress on every pass */
+while ( !tx_active && ( tx_head != tx_tail ) )
+	{
+	desc = tx_queue[tx_tail & USB_TX_MASK];
+	if ( HAL_UART_Transmit_DMA( &( USB_HUART )           , 
+	                            (const uint8_t*) desc.data_ptr, 
+	                            (uint16_t) desc.size ) == HAL_OK )
+		{
+		tx_active = true;
+		}
+	else
+		{
+		tx_tail++;
+		if ( desc.callback != NULL )
+			{
+			desc.callback( desc.data_ptr, desc.size, USB_FAIL );
+			}
+		}
+	}
+} /* tx_start */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		tx_finish                                                              *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Release the descriptor in progress, report the result of the transfer  *
+*       to its owner and start the next one. Call from the UART interrupt      *
+*                                                                              *
+*******************************************************************************/
+static void tx_finish
+	(
+	USB_STATUS tx_status /* Result of the transfer in progress */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+USB_TX_DESC desc; /* Descriptor that finished */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( !tx_active )
+	{
+	return;
+	}
+
+desc      = tx_queue[tx_tail & USB_TX_MASK];
+tx_tail++;
+tx_active = false;
+
+/* Report before starting the next buffer, a start that fails reports too 
+   and the callbacks must run in queue order. The callback may queue and 
+   start another buffer itself */
+if ( desc.callback != NULL )
+	{
+	desc.callback( desc.data_ptr, desc.size, tx_status );
+	}
+tx_start();
+} /* tx_finish */
+
+
 /*******************************************************************************
 * END OF FILE                                                                  * 
 *******************************************************************************/
\ No newline at end of file
@@ -24,6 +24,18 @@ extern "C" {
 #include <stdbool.h>
 
 
+/*------------------------------------------------------------------------------
+ Macros 
+------------------------------------------------------------------------------*/
+
+/* Receive ring size. The UART DMA stream runs in circular mode over the
+   ring, must be a power of two */
+#define USB_RX_BUFFER_SIZE     ( 512 )
+
+/* Maximum number of queued transmit buffers, must be a power of two */
+#define USB_TX_QUEUE_DEPTH     ( 8   )
+
+
 /*------------------------------------------------------------------------------
  Typdefs 
 ------------------------------------------------------------------------------*/
@@ -33,9 +45,30 @@ typedef enum USB_STATUS
 	{
 	USB_OK = 0,
     USB_FAIL  ,
-	USB_TIMEOUT
+	USB_TIMEOUT,
+	USB_EMPTY  ,    /* No received bytes available          */
+	USB_OVERFLOW,   /* Receive ring overrun, ring flushed   */
+	USB_BUSY        /* Transmit queue full                  */
 	} USB_STATUS;
 
+/* Transmit completion callback, called from the UART interrupt once the
+   transfer has ended and the buffer may be reused. The status is USB_OK if
+   the buffer was sent and USB_FAIL if the transfer failed */
+typedef void ( *USB_TX_CALLBACK )
+	(
+	const void* tx_data_ptr , /* Buffer that was sent   */
+	size_t      tx_data_size, /* Number of bytes sent   */
+	USB_STATUS  tx_status     /* Transfer result        */
+	);
+
+/* Transmit queue entry */
+typedef struct _USB_TX_DESC
+	{
+	const void*     data_ptr; /* Caller owned buffer, not copied    */
+	size_t          size;     /* Number of bytes to send            */
+	USB_TX_CALLBACK callback; /* Completion callback, may be NULL   */
+	} USB_TX_DESC;
+
 
 /*------------------------------------------------------------------------------
  Function Prototypes 
@@ -49,6 +82,28 @@ USB_STATUS usb_transmit
 	uint32_t timeout       /* UART timeout          */
 	);
 
+/* Queue a buffer for DMA transmission without copying it. The buffer must
+   stay valid until its callback runs */
+USB_STATUS usb_transmit_async
+	(
+	const void*     tx_data_ptr , /* Data to be sent               */
+	size_t          tx_data_size, /* Size of transmit data         */
+	USB_TX_CALLBACK callback      /* Completion callback, or NULL  */
+	);
+
+/* Number of queued buffers not yet sent */
+size_t usb_tx_pending
+	(
+	void
+	);
+
+/* Wait until at most max_pending buffers remain in the transmit queue */
+USB_STATUS usb_tx_wait
+	(
+	size_t   max_pending, /* Queue depth to wait for */
+	uint32_t timeout      /* Timeout in ms           */
+	);
+
 /* Receives bytes from the USB port */
 USB_STATUS usb_receive 
 	(
@@ -57,6 +112,57 @@ USB_STATUS usb_receive
 	uint32_t timeout       /* UART timeout */
 	);
 
+/* Start receiving into the circular DMA ring */
+USB_STATUS usb_init
+	(
+	void
+	);
+
+/* Number of received bytes waiting to be read */
+size_t usb_available
+	(
+	void
+	);
+
+/* Get the next received byte without removing it */
+USB_STATUS usb_peek
+	(
+	uint8_t* byte_ptr
+	);
+
+/* Read up to max_size received bytes without blocking, returns the number
+   of bytes read */
+size_t usb_read
+	(
+	void*  rx_data_ptr, /* Buffer to export data to */
+	size_t max_size     /* Size of the buffer       */
+	);
+
+/* Wait until num_bytes are available or the HAL tick reaches deadline */
+USB_STATUS usb_wait
+	(
+	size_t   num_bytes, /* Number of bytes to wait for    */
+	uint32_t deadline   /* Absolute HAL tick to give up at */
+	);
+
+/* UART receive event interrupt, call from HAL_UARTEx_RxEventCallback */
+void usb_rx_event_ISR
+	(
+	uint16_t rx_pos     /* Write position in the DMA ring */
+	);
+
+/* UART transmit complete interrupt, call from HAL_UART_TxCpltCallback */
+void usb_tx_complete_ISR
+	(
+	void
+	);
+
+/* UART error interrupt, call from HAL_UART_ErrorCallback */
+void usb_error_ISR
+	(
+	void
+	);
+
 /* Checks for an active USB connection */
 #if defined( A0002_REV2           ) || \
     defined( FLIGHT_COMPUTER_LITE ) || \
@@ -68,8 +174,7 @@ bool usb_detect
 	);
 #endif /* #if defined( A0002_REV2 ) || defined( FLIGHT_COMPUTER_LITE ) */
 
-/* Remove garbage USB data by cycling receiving data until a timeout condition 
-   is encountered */
+/* Remove garbage USB data by discarding everything in the receive ring */
 void usb_flush
 	(
 	void
@@ -12,6 +12,7 @@
  Standard Includes                                                              
 ------------------------------------------------------------------------------*/
 #include <stdbool.h>
+#include <math.h>
 
 
 /*------------------------------------------------------------------------------
@@ -26,6 +27,43 @@
 #include "main.h"
 #include "valve.h"
 #include "usb.h"
+#include "transport.h"
+
+
+/*------------------------------------------------------------------------------
+ Board Checks 
+------------------------------------------------------------------------------*/
+#ifdef VALVE_CONTROLLER
+#ifndef VALVE_STEP_TIM_FREQ
+	#error VALVE_STEP_TIM_FREQ is not defined in the board pin definitions
+#endif
+#ifndef VALVE_STEPS_PER_REV
+	#error VALVE_STEPS_PER_REV is not defined in the board pin definitions
+#endif
+#ifndef VALVE_DEFAULT_START_RATE
+	#error VALVE_DEFAULT_START_RATE is not defined in the board pin definitions
+#endif
+#ifndef VALVE_DEFAULT_MAX_RATE
+	#error VALVE_DEFAULT_MAX_RATE is not defined in the board pin definitions
+#endif
+#ifndef VALVE_DEFAULT_ACCEL
+	#error VALVE_DEFAULT_ACCEL is not defined in the board pin definitions
+#endif
+#ifndef VALVE_TRACE_TIM
+	#error VALVE_TRACE_TIM is not defined in the board pin definitions
+#endif
+#ifdef VALVE_ENCODER_TIM
+#ifndef VALVE_LOX_ENC_TIM
+	#error VALVE_LOX_ENC_TIM is not defined in the board pin definitions
+#endif
+#ifndef VALVE_FUEL_ENC_TIM
+	#error VALVE_FUEL_ENC_TIM is not defined in the board pin definitions
+#endif
+#endif /* #ifdef VALVE_ENCODER_TIM */
+#ifndef VALVE_SYNC_ITR
+	#error VALVE_SYNC_ITR is not defined in the board pin definitions
+#endif
+#endif /* #ifdef VALVE_CONTROLLER */
 
 
 /*------------------------------------------------------------------------------
@@ -33,29 +71,53 @@
 ------------------------------------------------------------------------------*/
 
 #ifdef VALVE_CONTROLLER
+#ifndef VALVE_ENCODER_TIM
 /* Encoder variables */
 volatile static int32_t  lox_valve_pos       = 0;  /* LOX Valve Encoder count  */
-volatile static bool     lox_channelA_state  = ENCODER_LOW; /* Voltage on channel 
-                                                             A pin */
-volatile static bool     lox_channelB_state  = ENCODER_LOW; /* Voltage on Channel 
-                                                             B pin */
+volatile static uint8_t  lox_enc_state       = 0;  /* Last LOX AB code         */
+volatile static uint32_t lox_enc_errors      = 0;  /* LOX illegal transitions  */
 volatile static int32_t  fuel_valve_pos      = 0;  /* Fuel Valve Encoder count */
-volatile static bool     fuel_channelA_state = ENCODER_LOW; /* Voltage on channel 
-                                                             A pin */
-volatile static bool     fuel_channelB_state = ENCODER_LOW; /* Voltage on Channel 
-                                                             B pin */
+volatile static uint8_t  fuel_enc_state      = 0;  /* Last fuel AB code        */
+volatile static uint32_t fuel_enc_errors     = 0;  /* Fuel illegal transitions */
+
+/* Quadrature decoder, indexed by ( previous AB << 2 ) | current AB with
+   AB = ( A << 1 ) | B. The count increases along 00 -> 01 -> 11 -> 10 */
+static const int8_t quad_table[16] = 
+	{
+	 0,  1, -1, VALVE_QUAD_ILLEGAL,  /* 00 -> 00, 01, 10, 11 */
+	-1,  0, VALVE_QUAD_ILLEGAL,  1,  /* 01 -> 00, 01, 10, 11 */
+	 1, VALVE_QUAD_ILLEGAL,  0, -1,  /* 10 -> 00, 01, 10, 11 */
+	VALVE_QUAD_ILLEGAL, -1,  1,  0   /* 11 -> 00, 01, 10, 11 */
+	};
+#endif /* #ifndef VALVE_ENCODER_TIM */
 
 /* Stepper Driver States */
 static STEPPER_DRIVER_STATE lox_driver_state;
 static STEPPER_DRIVER_STATE fuel_driver_state;
 
-/* Valve openining/closing states */
-volatile static bool ox_valve_closing    = false; /* LOX valve is closing   */
-volatile static bool ox_valve_opening    = false; /* LOX valve is opening   */
-volatile static bool fuel_valve_closing  = false; /* Fuel valve is closing  */
-volatile static bool fuel_valve_opening  = false; /* Fuel valve is opening  */
-volatile static bool ox_valve_cracking   = false; /* LOX valve is cracking  */
-volatile static bool fuel_valve_cracking = false; /* Fuel valve is cracking */
+/* Stepper motion profile */
+static VALVE_MOTION_CONFIG motion_config = { VALVE_DEFAULT_START_RATE, 
+                                             VALVE_DEFAULT_MAX_RATE  ,
+                                             VALVE_DEFAULT_ACCEL };
+
+/* Valve moves in progress */
+volatile static VALVE_MOTION_STATE lox_motion;  /* LOX valve move  */
+volatile static VALVE_MOTION_STATE fuel_motion; /* Fuel valve move */
+
+/* Step timers linked for a synchronized start until the first step ISR,
+   and the step timer of the lagging valve whose preloaded counter wraps at
+   its first step */
+volatile static bool               sync_linked   = false;
+static TIM_HandleTypeDef* volatile sync_wrap_tim = NULL;
+
+/* Valve calibration */
+static VALVE_CAL lox_cal;  /* LOX valve calibration  */
+static VALVE_CAL fuel_cal; /* Fuel valve calibration */
+
+/* Actuation traces, written by the step and encoder ISRs while a valve is
+   moving */
+static VALVE_TRACE lox_trace;  /* LOX valve trace  */
+static VALVE_TRACE fuel_trace; /* Fuel valve trace */
 #endif /* #ifdef VALVE_CONTROLLER */
 
 
@@ -100,32 +162,183 @@ static VALVE_STATUS fuel_driver_set_direction
 	STEPPER_DRIVER_DIR_STATE direction
 	);
 
-/* Increase the lox encoder count by one */
-static void inc_lox_encoder
+/* Get the shortest signed distance between two encoder counts */
+static int32_t pos_delta
+	(
+	int32_t from_pos,
+	int32_t to_pos
+	);
+
+/* Check that a valve can start a move to a target */
+static VALVE_STATUS move_check
+	(
+	volatile VALVE_MOTION_STATE* motion_ptr,
+	VALVE_CAL*                   cal_ptr   ,
+	int32_t                      target_pos
+	);
+
+/* Arm a lox valve move without starting the step PWM */
+static VALVE_STATUS prepare_lox_move
+	(
+	int32_t target_pos,
+	bool*   armed_ptr
+	);
+
+/* Arm a fuel valve move without starting the step PWM */
+static VALVE_STATUS prepare_fuel_move
+	(
+	int32_t target_pos,
+	bool*   armed_ptr
+	);
+
+/* Start both armed step timers together through the master/slave trigger */
+static void sync_start
+	(
+	int32_t lead_counts
+	);
+
+/* Return the step timers to independent operation after a synchronized
+   start */
+static void sync_end
 	(
 	void
 	);
 
+/* Load the step timer for the start of a valve move */
+static void prepare_motion
+	(
+	volatile VALVE_MOTION_STATE* motion_ptr,
+	TIM_HandleTypeDef*           step_tim_ptr,
+	uint32_t                     step_channel
+	);
+
+/* Stop the step PWM and end a valve move */
+static void stop_motion
+	(
+	volatile VALVE_MOTION_STATE* motion_ptr,
+	TIM_HandleTypeDef*           step_tim_ptr,
+	uint32_t                     step_channel
+	);
+
+/* Advance a valve move by one step */
+static void motion_step
+	(
+	volatile VALVE_MOTION_STATE* motion_ptr,
+	TIM_HandleTypeDef*           step_tim_ptr,
+	uint32_t                     step_channel,
+	int32_t                      pos
+	);
+
+/* Set the step PWM rate of a valve */
+static void set_step_rate
+	(
+	TIM_HandleTypeDef* step_tim_ptr,
+	uint32_t           step_channel,
+	float              step_rate
+	);
+
+/* Advance the calibration of one valve, returns true once it is homed */
+static bool cal_update
+	(
+	VALVE_CAL*         cal_ptr     ,
+	VALVE_STATE        photogate   ,
+	TIM_HandleTypeDef* step_tim_ptr,
+	uint32_t           step_channel,
+	uint32_t           tick
+	);
+
+/* Get the calibration state reported in MAIN_VALVE_STATES */
+static uint8_t cal_report
+	(
+	VALVE_CAL_STATE cal_state
+	);
+
+/* Start the actuation trace of a valve move */
+static void trace_start
+	(
+	VALVE_TRACE* trace_ptr ,
+	int32_t      pos       ,
+	int32_t      target_pos,
+	VALVE_STATE  photogate
+	);
+
+/* Record one step of a valve move in its actuation trace */
+static void trace_step
+	(
+	VALVE_TRACE* trace_ptr,
+	int32_t      pos      ,
+	VALVE_STATE  photogate
+	);
+
+/* End the actuation trace of a valve move */
+static void trace_stop
+	(
+	VALVE_TRACE*       trace_ptr   ,
+	TIM_HandleTypeDef* step_tim_ptr,
+	int32_t            pos
+	);
+
+/* Add an entry to an actuation trace */
+static void trace_record
+	(
+	VALVE_TRACE* trace_ptr,
+	uint8_t      event    ,
+	int32_t      pos      ,
+	uint8_t      photogate
+	);
+
+/* Send an actuation trace summary followed by its entries */
+static VALVE_STATUS trace_transmit
+	(
+	VALVE_TRACE*         trace_ptr    ,
+	VALVE_TRACE_SUMMARY* summary_ptr  ,
+	const TRANSPORT*     transport_ptr
+	);
+
+/* Get the lox encoder count */
+static int32_t lox_encoder_pos
+	(
+	void
+	);
 
-/* Increase the fuel encoder count by one */
-static void inc_fuel_encoder
+/* Get the fuel encoder count */
+static int32_t fuel_encoder_pos
 	(
 	void
 	);
 
+#ifdef VALVE_ENCODER_TIM
+/* Arm the encoder timer compare to stop the valve at a position */
+static void arm_stop_compare
+	(
+	TIM_HandleTypeDef* enc_tim_ptr,
+	int32_t            stop_pos
+	);
+#else
+/* Read the lox encoder AB code */
+static uint8_t lox_encoder_channels
+	(
+	void
+	);
 
-/* Decrease the lox encoder count by one */
-static void dec_lox_encoder
+/* Read the fuel encoder AB code */
+static uint8_t fuel_encoder_channels
 	(
 	void
 	);
 
+/* Decode a lox encoder edge and stop the valve at its target */
+static void lox_encoder_update
+	(
+	void
+	);
 
-/* Decrease the fuel encoder count by one */
-static void dec_fuel_encoder
+/* Decode a fuel encoder edge and stop the valve at its target */
+static void fuel_encoder_update
 	(
 	void
 	);
+#endif /* #ifdef VALVE_ENCODER_TIM */
 
 #endif
 
@@ -146,15 +359,17 @@ static void dec_fuel_encoder
 *******************************************************************************/
 VALVE_STATUS valve_cmd_execute
 	(
-	uint8_t subcommand
+	uint8_t          subcommand   , /* sdec subcommand            */
+	const TRANSPORT* transport_ptr  /* Link the command came from */
 	)
 {
 /*------------------------------------------------------------------------------
  Local Variables
 ------------------------------------------------------------------------------*/
-uint8_t           valve_num;         /* Valve number, 0 -> ox, 1 -> fuel   */
-VALVE_STATUS      valve_status[2];   /* Valve return codes                 */
-MAIN_VALVE_STATES main_valve_states; /* Main valve open/close states       */
+uint8_t             valve_num;         /* Valve number, 0 -> ox, 1 -> fuel */
+VALVE_STATUS        valve_status[2];   /* Valve return codes               */
+MAIN_VALVE_STATES   main_valve_states; /* Main valve open/close states     */
+VALVE_TRACE_SUMMARY trace_summary;     /* Actuation trace summary          */
 
 
 /*------------------------------------------------------------------------------
@@ -246,9 +461,10 @@ switch( subcommand )
 	--------------------------------------------------------------------------*/
 	case VALVE_RESET_CODE:
 		{
-		valve_status[0] = valve_close_ox_valve  ();
-		valve_status[1] = valve_close_fuel_valve();
-		if ( ( valve_status[0] != VALVE_OK ) || ( valve_status[1] != VALVE_OK ) )
+		valve_status[0] = valve_move_both_valves( VALVE_CLOSED_POS  , 
+		                                          VALVE_CLOSED_POS  , 
+		                                          VALVE_SYNC_LEAD_US );
+		if ( valve_status[0] != VALVE_OK )
 			{
 			return VALVE_ERROR;
 			}
@@ -263,9 +479,10 @@ switch( subcommand )
 	--------------------------------------------------------------------------*/
 	case VALVE_OPENALL_CODE:
 		{
-		valve_status[0] = valve_open_ox_valve  ();
-		valve_status[1] = valve_open_fuel_valve();
-		if ( ( valve_status[0] != VALVE_OK ) || ( valve_status[1] != VALVE_OK ) )
+		valve_status[0] = valve_move_both_valves( VALVE_OPEN_POS    , 
+		                                          VALVE_OPEN_POS    , 
+		                                          VALVE_SYNC_LEAD_US );
+		if ( valve_status[0] != VALVE_OK )
 			{
 			return VALVE_ERROR;
 			}
@@ -281,16 +498,32 @@ switch( subcommand )
 	case VALVE_GETSTATE_CODE:
 		{
 		main_valve_states = valve_get_valve_states();
-		#if defined( HOTFIRE )
-			valve_transmit( &main_valve_states         , 
-			                sizeof( main_valve_states ), 
-							HAL_DEFAULT_TIMEOUT );
-		#elif defined( TERMINAL )
-			usb_transmit( &main_valve_states, 
-			              sizeof( main_valve_states ),
-						  HAL_DEFAULT_TIMEOUT );
-		#endif
-		}
+		transport_transmit( transport_ptr              , 
+		                    &main_valve_states         , 
+		                    sizeof( main_valve_states ), 
+		                    HAL_DEFAULT_TIMEOUT );
+		return VALVE_OK;
+		} /* VALVE_GETSTATE_CODE */
+
+	/*--------------------------------------------------------------------------
+	 VALVE TRACE 
+	--------------------------------------------------------------------------*/
+	case VALVE_TRACE_CODE:
+		{
+		valve_status[0] = valve_get_trace_summary( valve_num, &trace_summary );
+		if ( valve_status[0] != VALVE_OK )
+			{
+			return valve_status[0];
+			}
+		if ( valve_num )
+			{
+			return trace_transmit( &fuel_trace, &trace_summary, transport_ptr );
+			}
+		else
+			{
+			return trace_transmit( &lox_trace , &trace_summary, transport_ptr );
+			}
+		} /* VALVE_TRACE_CODE */
 
 	/*--------------------------------------------------------------------------
 	 UNRECOGNIZED SUBCOMMAND 
@@ -475,7 +708,7 @@ fuel_driver_disable();
 * 		valve_open_ox_valve                                                    *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-* 		Open the main oxidizer valve                                           *
+*       Open the main oxidizer valve                                           *
 *                                                                              *
 *******************************************************************************/
 VALVE_STATUS valve_open_ox_valve
@@ -483,52 +716,74 @@ VALVE_STATUS valve_open_ox_valve
 	void
 	)
 {
-/*------------------------------------------------------------------------------
- Local Variables
-------------------------------------------------------------------------------*/
-VALVE_STATUS valve_status; /* Status return codes from valve API */
-
+return valve_move_ox_valve( VALVE_OPEN_POS );
+} /* valve_open_ox_valve */
 
-/*------------------------------------------------------------------------------
- Initializations 
-------------------------------------------------------------------------------*/
-valve_status = VALVE_OK;
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_open_fuel_valve                                                  *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Open the main fuel valve                                               *
+*                                                                              *
+*******************************************************************************/
+VALVE_STATUS valve_open_fuel_valve
+	(
+	void
+	)
+{
+return valve_move_fuel_valve( VALVE_OPEN_POS );
+} /* valve_open_fuel_valve */
 
-/*------------------------------------------------------------------------------
- Implementation 
-------------------------------------------------------------------------------*/
 
-/* Check if valve is already open */
-if ( lox_valve_pos == VALVE_OPEN_POS )
-	{
-	return VALVE_OK;
-	}
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_close_ox_valve                                                   *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Close the main oxidizer valve                                          *
+*                                                                              *
+*******************************************************************************/
+VALVE_STATUS valve_close_ox_valve
+	(
+	void
+	)
+{
+return valve_move_ox_valve( VALVE_CLOSED_POS );
+} /* valve_close_ox_valve */
 
-/* Set the direction   */
-valve_status = lox_driver_set_direction( STEPPER_DRIVER_CW );
-if ( valve_status != VALVE_OK )
-	{
-	return valve_status;
-	}
 
-/* Actuate the valve   */
-ox_valve_opening = true;
-HAL_TIM_PWM_Start( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
-return VALVE_OK;
-} /* valve_open_ox_valve */
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_close_fuel_valve                                                 *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Close the main fuel valve                                              *
+*                                                                              *
+*******************************************************************************/
+VALVE_STATUS valve_close_fuel_valve
+	(
+	void
+	)
+{
+return valve_move_fuel_valve( VALVE_CLOSED_POS );
+} /* valve_close_fuel_valve */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		valve_open_fuel_valve                                                  *
+* 		valve_crack_ox_valve                                                   *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-* 		Open the main fuel valve                                               *
+*       Slightly open the main oxidizer valve                                  *
 *                                                                              *
 *******************************************************************************/
-VALVE_STATUS valve_open_fuel_valve
+VALVE_STATUS valve_crack_ox_valve
 	(
 	void
 	)
@@ -536,13 +791,7 @@ VALVE_STATUS valve_open_fuel_valve
 /*------------------------------------------------------------------------------
  Local Variables
 ------------------------------------------------------------------------------*/
-VALVE_STATUS valve_status; /* Status return codes from valve API */
-
-
-/*------------------------------------------------------------------------------
- Initializations 
-------------------------------------------------------------------------------*/
-valve_status = VALVE_OK;
+int32_t delta; /* Counts from the open position */
 
 
 /*------------------------------------------------------------------------------
@@ -550,35 +799,26 @@ valve_status = VALVE_OK;
 ------------------------------------------------------------------------------*/
 
 /* Check if valve is already open */
-if ( fuel_valve_pos == VALVE_OPEN_POS )
+delta = pos_delta( lox_encoder_pos(), VALVE_OPEN_POS );
+if ( ( delta >= -VALVE_POS_TOLERANCE ) && ( delta <= VALVE_POS_TOLERANCE ) )
 	{
 	return VALVE_OK;
 	}
 
-/* Set the direction   */
-valve_status = fuel_driver_set_direction( STEPPER_DRIVER_CW );
-if ( valve_status != VALVE_OK )
-	{
-	return valve_status;
-	}
-
-/* Actuate the valve   */
-fuel_valve_opening = true;
-HAL_TIM_PWM_Start( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
-return VALVE_OK;
-} /* valve_open_fuel_valve */
+return valve_move_ox_valve( VALVE_CRACKED_POS );
+} /* valve_crack_ox_valve */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		valve_close_ox_valve                                                   *
+* 		valve_crack_fuel_valve                                                 *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Close the main oxidizer valve                                          *
+*       Slightly open the main fuel valve                                      *
 *                                                                              *
 *******************************************************************************/
-VALVE_STATUS valve_close_ox_valve
+VALVE_STATUS valve_crack_fuel_valve
 	(
 	void
 	)
@@ -586,190 +826,225 @@ VALVE_STATUS valve_close_ox_valve
 /*------------------------------------------------------------------------------
  Local Variables
 ------------------------------------------------------------------------------*/
-VALVE_STATUS valve_status; /* Status return codes from valve API */
-
-
-/*------------------------------------------------------------------------------
- Initializations 
-------------------------------------------------------------------------------*/
-valve_status = VALVE_OK;
+int32_t delta; /* Counts from the open position */
 
 
 /*------------------------------------------------------------------------------
  Implementation 
 ------------------------------------------------------------------------------*/
 
-/* Check if valve is already closed */
-if ( lox_valve_pos == VALVE_CLOSED_POS )
+/* Check if valve is already open */
+delta = pos_delta( fuel_encoder_pos(), VALVE_OPEN_POS );
+if ( ( delta >= -VALVE_POS_TOLERANCE ) && ( delta <= VALVE_POS_TOLERANCE ) )
 	{
 	return VALVE_OK;
 	}
 
-/* Set the direction   */
-valve_status = lox_driver_set_direction( STEPPER_DRIVER_CCW );
-if ( valve_status != VALVE_OK )
-	{
-	return valve_status;
-	}
-
-/* Actuate the valve   */
-ox_valve_closing = true;
-HAL_TIM_PWM_Start( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
-return VALVE_OK;
-} /* valve_close_ox_valve */
+return valve_move_fuel_valve( VALVE_CRACKED_POS );
+} /* valve_crack_fuel_valve */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		valve_close_fuel_valve                                                 *
+* 		valve_move_ox_valve                                                    *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Close the main fuel valve                                              *
+*       Move the main oxidizer valve to an encoder position with a             *
+*       trapezoidal step rate profile. Positions increase in the clockwise     *
+*       direction                                                              *
 *                                                                              *
 *******************************************************************************/
-VALVE_STATUS valve_close_fuel_valve
+VALVE_STATUS valve_move_ox_valve
 	(
-	void
+	int32_t target_pos
 	)
 {
 /*------------------------------------------------------------------------------
  Local Variables
 ------------------------------------------------------------------------------*/
 VALVE_STATUS valve_status; /* Status return codes from valve API */
-
-
-/*------------------------------------------------------------------------------
- Initializations 
-------------------------------------------------------------------------------*/
-valve_status = VALVE_OK;
+bool         armed;        /* Move armed, valve not at target    */
 
 
 /*------------------------------------------------------------------------------
  Implementation 
 ------------------------------------------------------------------------------*/
-
-/* check if valve is already closed */
-if ( fuel_valve_pos == VALVE_CLOSED_POS )
-	{
-	return VALVE_OK;
-	}
-
-/* Set the direction   */
-valve_status = fuel_driver_set_direction( STEPPER_DRIVER_CCW );
-if ( valve_status != VALVE_OK )
+valve_status = prepare_lox_move( target_pos, &armed );
+if ( ( valve_status == VALVE_OK ) && armed )
 	{
-	return valve_status;
+	HAL_TIM_PWM_Start( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
 	}
-
-/* Actuate the valve */
-fuel_valve_closing = true;
-HAL_TIM_PWM_Start( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
-return VALVE_OK;
-} /* valve_close_fuel_valve */
+return valve_status;
+} /* valve_move_ox_valve */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		valve_crack_ox_valve                                                   *
+* 		valve_move_fuel_valve                                                  *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-* 		Slightly open the main oxidizer valve                                  *
+*       Move the main fuel valve to an encoder position with a                 *
+*       trapezoidal step rate profile. Positions increase in the clockwise     *
+*       direction                                                              *
 *                                                                              *
 *******************************************************************************/
-VALVE_STATUS valve_crack_ox_valve
+VALVE_STATUS valve_move_fuel_valve
 	(
-	void
+	int32_t target_pos
 	)
 {
 /*------------------------------------------------------------------------------
  Local Variables
 ------------------------------------------------------------------------------*/
 VALVE_STATUS valve_status; /* Status return codes from valve API */
-
-
-/*------------------------------------------------------------------------------
- Initializations 
-------------------------------------------------------------------------------*/
-valve_status = VALVE_OK;
+bool         armed;        /* Move armed, valve not at target    */
 
 
 /*------------------------------------------------------------------------------
  Implementation 
 ------------------------------------------------------------------------------*/
-
-/* Check if valve is already open */
-if ( lox_valve_pos == VALVE_OPEN_POS )
-	{
-	return VALVE_OK;
-	}
-
-/* Set the direction   */
-valve_status = lox_driver_set_direction( STEPPER_DRIVER_CW );
-if ( valve_status != VALVE_OK )
+valve_status = prepare_fuel_move( target_pos, &armed );
+if ( ( valve_status == VALVE_OK ) && armed )
 	{
-	return valve_status;
+	HAL_TIM_PWM_Start( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
 	}
-
-/* Actuate the valve   */
-ox_valve_cracking = true;
-HAL_TIM_PWM_Start( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
-return VALVE_OK;
-} /* valve_crack_ox_valve */
+return valve_status;
+} /* valve_move_fuel_valve */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		valve_crack_fuel_valve                                                 *
+* 		valve_move_both_valves                                                 *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-* 		Slightly open the main fuel valve                                      *
+*       Move both main valves with synchronized step timer starts. The fuel    *
+*       step timer is started by the LOX step timer in hardware, so the skew   *
+*       between the first steps is lox_lead_us rather than software dependent  *
 *                                                                              *
 *******************************************************************************/
-VALVE_STATUS valve_crack_fuel_valve
+VALVE_STATUS valve_move_both_valves
 	(
-	void
+	int32_t lox_target_pos , /* LOX target encoder count          */
+	int32_t fuel_target_pos, /* Fuel target encoder count         */
+	int32_t lox_lead_us      /* LOX lead over fuel, negative lags */
 	)
 {
 /*------------------------------------------------------------------------------
  Local Variables
 ------------------------------------------------------------------------------*/
-VALVE_STATUS valve_status; /* Status return codes from valve API */
+VALVE_STATUS valve_status; /* Status return codes from valve API     */
+bool         lox_armed;    /* LOX move armed                         */
+bool         fuel_armed;   /* Fuel move armed                        */
+int32_t      lead_counts;  /* Lead in step timer counts              */
+int32_t      max_lead;     /* Largest lead the counter preload gives */
 
 
 /*------------------------------------------------------------------------------
  Initializations 
 ------------------------------------------------------------------------------*/
-valve_status = VALVE_OK;
+lead_counts = lox_lead_us*VALVE_STEP_TIM_COUNTS_PER_US;
+max_lead    = (int32_t) ( VALVE_STEP_TIM_FREQ/motion_config.start_rate );
+max_lead   -= max_lead/2;
 
 
 /*------------------------------------------------------------------------------
  Implementation 
 ------------------------------------------------------------------------------*/
 
-/* Check if valve is already open */
-if ( fuel_valve_pos == VALVE_OPEN_POS )
+/* Check both moves before arming either valve */
+if ( ( lead_counts > max_lead ) || ( lead_counts < -max_lead ) )
 	{
-	return VALVE_OK;
+	return VALVE_INVALID_SKEW;
 	}
-
-/* Set the direction   */
-valve_status = fuel_driver_set_direction( STEPPER_DRIVER_CW );
+valve_status = move_check( &lox_motion, &lox_cal, lox_target_pos );
+if ( valve_status != VALVE_OK )
+	{
+	return valve_status;
+	}
+valve_status = move_check( &fuel_motion, &fuel_cal, fuel_target_pos );
 if ( valve_status != VALVE_OK )
 	{
 	return valve_status;
 	}
 
-/* Actuate the valve   */
-fuel_valve_cracking = true;
-HAL_TIM_PWM_Start( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
-return VALVE_OK;
-} /* valve_crack_ox_valve */
-
-
-/*******************************************************************************
+/* Arm both valves, a failed fuel setup stops the armed LOX valve so neither
+   moves */
+valve_status = prepare_lox_move( lox_target_pos, &lox_armed );
+if ( valve_status != VALVE_OK )
+	{
+	return valve_status;
+	}
+valve_status = prepare_fuel_move( fuel_target_pos, &fuel_armed );
+if ( valve_status != VALVE_OK )
+	{
+	if ( lox_armed )
+		{
+		stop_motion( &lox_motion, &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
+		#ifdef VALVE_ENCODER_TIM
+			HAL_TIM_OC_Stop_IT( &( VALVE_LOX_ENC_TIM ), 
+			                    VALVE_ENC_TIM_STOP_CHANNEL );
+		#endif
+		trace_stop( &lox_trace, &( VALVE_LOX_TIM ), lox_encoder_pos() );
+		}
+	return valve_status;
+	}
+
+/* Start the step timers */
+if      ( lox_armed && fuel_armed )
+	{
+	sync_start( lead_counts );
+	}
+else if ( lox_armed  )
+	{
+	HAL_TIM_PWM_Start( &( VALVE_LOX_TIM  ), VALVE_LOX_TIM_CHANNEL  );
+	}
+else if ( fuel_armed )
+	{
+	HAL_TIM_PWM_Start( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
+	}
+
+return VALVE_OK;
+} /* valve_move_both_valves */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_set_motion_profile                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Set the stepper motion profile used by all valve moves                 *
+*                                                                              *
+*******************************************************************************/
+VALVE_STATUS valve_set_motion_profile
+	(
+	VALVE_MOTION_CONFIG* config_ptr
+	)
+{
+/* Validate the profile */
+if ( ( config_ptr->start_rate   <= 0.0f                   ) ||
+     ( config_ptr->max_rate     <  config_ptr->start_rate ) || 
+     ( config_ptr->acceleration <= 0.0f                   ) || 
+     ( ( VALVE_STEP_TIM_FREQ/config_ptr->start_rate ) > UINT16_MAX ) )
+	{
+	return VALVE_INVALID_PROFILE;
+	}
+
+/* The step ISRs read the profile */
+if ( lox_motion.moving || fuel_motion.moving )
+	{
+	return VALVE_BUSY;
+	}
+
+motion_config = *config_ptr;
+return VALVE_OK;
+} /* valve_set_motion_profile */
+
+
+/*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
 * 		valve_get_ox_valve_pos                                                 *
@@ -783,7 +1058,7 @@ int32_t valve_get_ox_valve_pos
 	void
 	)
 {
-return lox_valve_pos*360/1000;
+return lox_encoder_pos()*360/VALVE_ENC_CPR;
 } /* valve_get_ox_valve_pos */
 
 
@@ -801,10 +1076,32 @@ int32_t valve_get_fuel_valve_pos
 	void
 	)
 {
-return fuel_valve_pos*360/1000;
+return fuel_encoder_pos()*360/VALVE_ENC_CPR;
 } /* valve_get_fuel_valve_pos */
 
 
+#ifndef VALVE_ENCODER_TIM
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_get_encoder_errors                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the number of illegal quadrature transitions seen on each encoder  *
+*                                                                              *
+*******************************************************************************/
+void valve_get_encoder_errors
+	(
+	uint32_t* lox_errors_ptr ,
+	uint32_t* fuel_errors_ptr
+	)
+{
+*lox_errors_ptr  = lox_enc_errors;
+*fuel_errors_ptr = fuel_enc_errors;
+} /* valve_get_encoder_errors */
+#endif /* #ifndef VALVE_ENCODER_TIM */
+
+
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
@@ -861,7 +1158,9 @@ else
 * 		valve_calibrate_valves                                                 *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Calibrate initial valve positions                                      *
+*       Start homing both valves against their photogates. Homing runs in      *
+*       valve_calibrate_task so the controller stays responsive, progress is   *
+*       reported through VALVE_GETSTATE                                        *
 *                                                                              *
 *******************************************************************************/
 VALVE_STATUS valve_calibrate_valves
@@ -869,306 +1168,494 @@ VALVE_STATUS valve_calibrate_valves
 	void
 	)
 {
-/* Calibrate the oxidizer valve  */
-lox_driver_enable();
-lox_driver_set_direction( STEPPER_DRIVER_CW );
-while ( valve_get_ox_valve_state() == VALVE_OPEN )
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t tick; /* Current HAL tick */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+tick = HAL_GetTick();
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Calibration or a move already in progress */
+if ( ( lox_cal.state  == VALVE_CAL_HOMING   ) || 
+     ( lox_cal.state  == VALVE_CAL_SETTLING ) ||
+     ( fuel_cal.state == VALVE_CAL_HOMING   ) || 
+     ( fuel_cal.state == VALVE_CAL_SETTLING ) ||
+     lox_motion.moving || fuel_motion.moving )
 	{
-	HAL_TIM_PWM_Start( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
+	return VALVE_BUSY;
 	}
 
-HAL_Delay( 5 );
-HAL_TIM_PWM_Stop( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
-lox_valve_pos = 0;
+/* Start homing the oxidizer valve */
+lox_driver_enable();
+lox_driver_set_direction( STEPPER_DRIVER_CW );
+set_step_rate( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL, 
+               motion_config.start_rate );
+lox_cal.state      = VALVE_CAL_HOMING;
+lox_cal.start_tick = tick;
+HAL_TIM_PWM_Start( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
 
-/* Calibrate the fuel valve      */
+/* Start homing the fuel valve     */
 fuel_driver_enable();
 fuel_driver_set_direction( STEPPER_DRIVER_CCW );
-while ( valve_get_fuel_valve_state() == VALVE_OPEN )
-	{
-	HAL_TIM_PWM_Start( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
-	}
-HAL_Delay( 5 );
-HAL_TIM_PWM_Stop( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
-fuel_valve_pos = 0;
+set_step_rate( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL, 
+               motion_config.start_rate );
+fuel_cal.state      = VALVE_CAL_HOMING;
+fuel_cal.start_tick = tick;
+HAL_TIM_PWM_Start( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
 
 return VALVE_OK;
 } /* valve_calibrate_valves */
-#endif /* #ifdef VALVE_CONTROLLER */
 
-/*------------------------------------------------------------------------------
- Interrupt Service Routines 
-------------------------------------------------------------------------------*/
 
-#ifdef VALVE_CONTROLLER
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		lox_channelA_ISR                                                       *
+* 		valve_calibrate_task                                                   *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       LOX Main Valve Encoder Channel A Interrupt                             *
+*       Advance valve calibration, call from the main loop. Each valve stops   *
+*       and zeroes its encoder count VALVE_CAL_SETTLE_MS after its photogate   *
+*       trips                                                                  *
 *                                                                              *
 *******************************************************************************/
-void lox_channelA_ISR
+void valve_calibrate_task
 	(
 	void
 	)
 {
-/* Low to High Transition */
-if ( HAL_GPIO_ReadPin( LOX_ENC_GPIO_PORT, LOX_ENC_A_PIN ) )
-	{
-	lox_channelA_state = ENCODER_HIGH;
-	if ( !lox_channelB_state )
-		{
-		//lox_valve_pos -= 1;
-		dec_lox_encoder();
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t tick; /* Current HAL tick */
 
-		/* Detect valve closed position */
-		if ( ox_valve_closing && ( lox_valve_pos == VALVE_CLOSED_POS ) )
-			{
-			HAL_TIM_PWM_Stop( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
-			ox_valve_closing = false;
-			}
-		/*
-		if ( ox_valve_closing && ( valve_get_ox_valve_state() == VALVE_CLOSED ) )
-			{
-			HAL_TIM_PWM_Stop( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
-			ox_valve_closing = false;
-			lox_valve_pos = 0;
-			}
-		*/
-		}
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+tick = HAL_GetTick();
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Oxidizer valve */
+if ( cal_update( &lox_cal, valve_get_ox_valve_state(), &( VALVE_LOX_TIM ), 
+                 VALVE_LOX_TIM_CHANNEL, tick ) )
+	{
+	#ifdef VALVE_ENCODER_TIM
+		__HAL_TIM_SET_COUNTER( &( VALVE_LOX_ENC_TIM ), 0 );
+	#else
+		lox_valve_pos = 0;
+		lox_enc_state = lox_encoder_channels();
+	#endif
 	}
-/* High to Low Transition */
-else
+
+/* Fuel valve     */
+if ( cal_update( &fuel_cal, valve_get_fuel_valve_state(), &( VALVE_FUEL_TIM ), 
+                 VALVE_FUEL_TIM_CHANNEL, tick ) )
 	{
-	lox_channelA_state = ENCODER_LOW;
+	#ifdef VALVE_ENCODER_TIM
+		__HAL_TIM_SET_COUNTER( &( VALVE_FUEL_ENC_TIM ), 0 );
+	#else
+		fuel_valve_pos = 0;
+		fuel_enc_state = fuel_encoder_channels();
+	#endif
 	}
-} /* lox_channelA_ISR */
+
+} /* valve_calibrate_task */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		lox_channelB_ISR                                                       *
+* 		valve_trace_init                                                       *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       LOX Main Valve Encoder Channel B Interrupt                             *
+*       Reset the actuation trace timer. The timer is started by the first     *
+*       traced move and stopped once no move is being traced                   *
 *                                                                              *
 *******************************************************************************/
-void lox_channelB_ISR
+void valve_trace_init
 	(
 	void
 	)
 {
-/* Low to High Transition */
-if ( HAL_GPIO_ReadPin( LOX_ENC_GPIO_PORT, LOX_ENC_B_PIN ) )
-	{
-	lox_channelB_state = ENCODER_HIGH;
-	if ( !lox_channelA_state )
-		{
-		//lox_valve_pos += 1;
-		inc_lox_encoder();
+HAL_TIM_Base_Stop    ( &( VALVE_TRACE_TIM )    );
+__HAL_TIM_SET_COUNTER( &( VALVE_TRACE_TIM ), 0 );
+} /* valve_trace_init */
 
-		/* Detect valve open */
-		if ( ox_valve_opening && ( lox_valve_pos == VALVE_OPEN_POS ) )
-			{
-			HAL_TIM_PWM_Stop( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
-			ox_valve_opening = false;
-			}
-		/* Detect valve cracked */
-		else if ( ox_valve_cracking && ( lox_valve_pos == VALVE_CRACKED_POS ) )
-			{
-			HAL_TIM_PWM_Stop( &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL  );
-			ox_valve_cracking = false;
-			}
-		}
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		valve_get_trace_summary                                                *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the actuation trace summary of the last move of a valve            *
+*                                                                              *
+*******************************************************************************/
+VALVE_STATUS valve_get_trace_summary
+	(
+	uint8_t              valve_num  , /* 0 -> ox, 1 -> fuel */
+	VALVE_TRACE_SUMMARY* summary_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+VALVE_TRACE* trace_ptr; /* Trace of the selected valve  */
+int32_t      pos;       /* Current encoder count        */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+if ( valve_num )
+	{
+	trace_ptr = &fuel_trace;
+	pos       = fuel_encoder_pos();
 	}
-/* High to Low Transition */
 else
 	{
-	lox_channelB_state = ENCODER_LOW;
+	trace_ptr = &lox_trace;
+	pos       = lox_encoder_pos();
 	}
 
-} /* lox_channelB_ISR */
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* The trace is written by the ISRs until the move ends */
+if ( trace_ptr->active )
+	{
+	return VALVE_BUSY;
+	}
+
+summary_ptr->time_to_crack  = trace_ptr->time_to_crack;
+summary_ptr->time_to_target = trace_ptr->time_to_target;
+summary_ptr->start_pos      = trace_ptr->start_pos;
+summary_ptr->target_pos     = trace_ptr->target_pos;
+summary_ptr->stalls         = trace_ptr->stalls;
+summary_ptr->num_entries    = trace_ptr->count;
+
+/* Overshoot in the direction of the move */
+summary_ptr->overshoot = pos_delta( trace_ptr->target_pos, pos );
+if ( pos_delta( trace_ptr->start_pos, trace_ptr->target_pos ) < 0 )
+	{
+	summary_ptr->overshoot = -summary_ptr->overshoot;
+	}
+
+return VALVE_OK;
+} /* valve_get_trace_summary */
 
 
+#ifdef VALVE_ENCODER_TIM
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		fuel_channelA_ISR                                                      *
+* 		valve_encoder_start                                                    *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Fuel Main Valve Encoder Channel A Interrupt                            *
+*       Start the hardware encoder timers. The auto-reload is set so that the  *
+*       timer count wraps at one valve revolution                              *
 *                                                                              *
 *******************************************************************************/
-void fuel_channelA_ISR
+void valve_encoder_start
 	(
 	void
 	)
 {
-/* Low to High Transition */
-if ( HAL_GPIO_ReadPin( KER_ENC_GPIO_PORT, KER_ENC_A_PIN ) )
-	{
-	fuel_channelA_state = ENCODER_HIGH;
-	if ( !fuel_channelB_state )
-		{
-		//fuel_valve_pos -= 1;
-		dec_fuel_encoder();
-
-		/* Detect valve closed */
-		if ( fuel_valve_closing && ( fuel_valve_pos == VALVE_CLOSED_POS ) )
-			{
-			HAL_TIM_PWM_Stop( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
-			fuel_valve_closing = false;
-			}
-		}
-	}
-/* High to Low Transition */
-else
-	{
-	fuel_channelA_state = ENCODER_LOW;
-	}
-} /* fuel_channelA_ISR */
+/* LOX valve encoder  */
+__HAL_TIM_SET_AUTORELOAD( &( VALVE_LOX_ENC_TIM ), 
+                          VALVE_ENC_CPR - 1 );
+__HAL_TIM_SET_COUNTER   ( &( VALVE_LOX_ENC_TIM ), 0 );
+HAL_TIM_Encoder_Start   ( &( VALVE_LOX_ENC_TIM ), TIM_CHANNEL_ALL );
+
+/* Fuel valve encoder */
+__HAL_TIM_SET_AUTORELOAD( &( VALVE_FUEL_ENC_TIM ), 
+                          VALVE_ENC_CPR - 1 );
+__HAL_TIM_SET_COUNTER   ( &( VALVE_FUEL_ENC_TIM ), 0 );
+HAL_TIM_Encoder_Start   ( &( VALVE_FUEL_ENC_TIM ), TIM_CHANNEL_ALL );
+
+} /* valve_encoder_start */
+#endif /* #ifdef VALVE_ENCODER_TIM */
+#endif /* #ifdef VALVE_CONTROLLER */
 
+/*------------------------------------------------------------------------------
+ Interrupt Service Routines 
+------------------------------------------------------------------------------*/
 
+#ifdef VALVE_CONTROLLER
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		fuel_channelB_ISR                                                      *
+* 		valve_step_ISR                                                         *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Fuel Main Valve Encoder Channel B Interrupt                            *
+*       Step timer update interrupt, call from HAL_TIM_PeriodElapsedCallback.  *
+*       Runs once per step pulse and sets the period of the next one           *
 *                                                                              *
 *******************************************************************************/
-void fuel_channelB_ISR
+void valve_step_ISR
 	(
-	void
+	TIM_HandleTypeDef* htim
 	)
 {
-/* Low to High Transition */
-if ( HAL_GPIO_ReadPin( KER_ENC_GPIO_PORT, KER_ENC_B_PIN ) )
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+int32_t pos; /* Encoder count */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* First update of a synchronized start, the fuel timer is running. The
+   lagging valve's preloaded counter wraps at its first step, which the
+   leading valve takes at the counter start without an update, so that
+   update does not advance the move */
+if ( sync_linked )
 	{
-	fuel_channelB_state = ENCODER_HIGH;
-	if ( !fuel_channelA_state )
+	sync_end();
+	if ( htim == sync_wrap_tim )
 		{
-		//fuel_valve_pos += 1;
-		inc_fuel_encoder();
+		return;
+		}
+	}
 
-		/* Detect valve open */
-		if      ( fuel_valve_opening && ( fuel_valve_pos == VALVE_OPEN_POS ) )
-			{
-			HAL_TIM_PWM_Stop( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
-			fuel_valve_opening = false;
-			}
-		/* Detect valve crakced */
-		else if ( fuel_valve_cracking && ( fuel_valve_pos == VALVE_CRACKED_POS ) )
-			{
-			HAL_TIM_PWM_Stop( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
-			fuel_valve_cracking = false;
-			}
+if      ( htim == &( VALVE_LOX_TIM  ) )
+	{
+	pos = lox_encoder_pos();
+	trace_step ( &lox_trace, pos, valve_get_ox_valve_state() );
+	motion_step( &lox_motion, htim, VALVE_LOX_TIM_CHANNEL, pos );
+	if ( !lox_motion.moving )
+		{
+		trace_stop( &lox_trace, htim, pos );
 		}
 	}
-/* High to Low Transition */
-else
+else if ( htim == &( VALVE_FUEL_TIM ) )
 	{
-	fuel_channelB_state = ENCODER_LOW;
+	pos = fuel_encoder_pos();
+	trace_step ( &fuel_trace, pos, valve_get_fuel_valve_state() );
+	motion_step( &fuel_motion, htim, VALVE_FUEL_TIM_CHANNEL, pos );
+	if ( !fuel_motion.moving )
+		{
+		trace_stop( &fuel_trace, htim, pos );
+		}
 	}
-
-} /* fuel_channelB_ISR */
+} /* valve_step_ISR */
 
 
+#ifdef VALVE_ENCODER_TIM
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		lox_driver_enable                                                      *
+* 		valve_encoder_compare_ISR                                              *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Enable the lox stepper motor driver                                    *
+*       Encoder timer stop position compare interrupt, call from               *
+*       HAL_TIM_OC_DelayElapsedCallback. The compare is armed with the target  *
+*       position when a valve move starts, so a match always ends the move     *
 *                                                                              *
 *******************************************************************************/
-static void lox_driver_enable
+void valve_encoder_compare_ISR
 	(
-	void
+	TIM_HandleTypeDef* htim
 	)
 {
-/* Set GPIO State      */
-HAL_GPIO_WritePin( LOX_EN_GPIO_PORT, LOX_EN_PIN, GPIO_PIN_SET );
-
-/* Update global state */
-lox_driver_state.enable = STEPPER_DRIVER_ENABLED;
-
-} /* lox_driver_enable */
+/* LOX valve reached its stop position  */
+if      ( htim == &( VALVE_LOX_ENC_TIM  ) )
+	{
+	stop_motion( &lox_motion, &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
+	HAL_TIM_OC_Stop_IT( htim, VALVE_ENC_TIM_STOP_CHANNEL );
+	trace_stop( &lox_trace, &( VALVE_LOX_TIM ), lox_encoder_pos() );
+	}
+/* Fuel valve reached its stop position */
+else if ( htim == &( VALVE_FUEL_ENC_TIM ) )
+	{
+	stop_motion( &fuel_motion, &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
+	HAL_TIM_OC_Stop_IT( htim, VALVE_ENC_TIM_STOP_CHANNEL );
+	trace_stop( &fuel_trace, &( VALVE_FUEL_TIM ), fuel_encoder_pos() );
+	}
 
+} /* valve_encoder_compare_ISR */
 
+#else
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		fuel_driver_enable                                                     *
+* 		lox_channelA_ISR                                                       *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Enable the fuel stepper motor driver                                   *
+*       LOX Main Valve Encoder Channel A Interrupt                             *
 *                                                                              *
 *******************************************************************************/
-static void fuel_driver_enable
+void lox_channelA_ISR
 	(
 	void
 	)
 {
-/* Set GPIO level           */
-HAL_GPIO_WritePin( KER_EN_GPIO_PORT, KER_EN_PIN, GPIO_PIN_RESET );
-
-/* Update the globale state */
-fuel_driver_state.enable = STEPPER_DRIVER_ENABLED;
-
-} /* fuel_driver_enable */
+lox_encoder_update();
+} /* lox_channelA_ISR */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		lox_driver_disable                                                     *
+* 		lox_channelB_ISR                                                       *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Disable the lox stepper motor driver                                   *
+*       LOX Main Valve Encoder Channel B Interrupt                             *
 *                                                                              *
 *******************************************************************************/
-static void lox_driver_disable
+void lox_channelB_ISR
 	(
 	void
 	)
 {
-/* Set GPIO Level          */
-HAL_GPIO_WritePin( LOX_EN_GPIO_PORT, LOX_EN_PIN, GPIO_PIN_SET );
-
-/* Update the global state */
-lox_driver_state.enable = STEPPER_DRIVER_DISABLED;
-
-} /* lox_driver_disable */
+lox_encoder_update();
+} /* lox_channelB_ISR */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		fuel_driver_disable                                                    *
+* 		fuel_channelA_ISR                                                      *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Disable the fuel stepper motor driver                                  *
+*       Fuel Main Valve Encoder Channel A Interrupt                            *
 *                                                                              *
 *******************************************************************************/
-static void fuel_driver_disable
+void fuel_channelA_ISR
 	(
 	void
 	)
 {
-/* Set GPIO level          */
-HAL_GPIO_WritePin( KER_EN_GPIO_PORT, KER_EN_PIN, GPIO_PIN_SET );
+fuel_encoder_update();
+} /* fuel_channelA_ISR */
 
-/* Update the global state */
-fuel_driver_state.enable = STEPPER_DRIVER_DISABLED;
 
-} /* fuel_driver_disable */
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		fuel_channelB_ISR                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Fuel Main Valve Encoder Channel B Interrupt                            *
+*                                                                              *
+*******************************************************************************/
+void fuel_channelB_ISR
+	(
+	void
+	)
+{
+fuel_encoder_update();
+} /* fuel_channelB_ISR */
+#endif /* #ifdef VALVE_ENCODER_TIM */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lox_driver_enable                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Enable the lox stepper motor driver                                    *
+*                                                                              *
+*******************************************************************************/
+static void lox_driver_enable
+	(
+	void
+	)
+{
+/* Set GPIO State      */
+HAL_GPIO_WritePin( LOX_EN_GPIO_PORT, LOX_EN_PIN, GPIO_PIN_SET );
+
+/* Update global state */
+lox_driver_state.enable = STEPPER_DRIVER_ENABLED;
+
+} /* lox_driver_enable */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		fuel_driver_enable                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Enable the fuel stepper motor driver                                   *
+*                                                                              *
+*******************************************************************************/
+static void fuel_driver_enable
+	(
+	void
+	)
+{
+/* Set GPIO level           */
+HAL_GPIO_WritePin( KER_EN_GPIO_PORT, KER_EN_PIN, GPIO_PIN_RESET );
+
+/* Update the globale state */
+fuel_driver_state.enable = STEPPER_DRIVER_ENABLED;
+
+} /* fuel_driver_enable */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lox_driver_disable                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Disable the lox stepper motor driver                                   *
+*                                                                              *
+*******************************************************************************/
+static void lox_driver_disable
+	(
+	void
+	)
+{
+/* Set GPIO Level          */
+HAL_GPIO_WritePin( LOX_EN_GPIO_PORT, LOX_EN_PIN, GPIO_PIN_SET );
+
+/* Update the global state */
+lox_driver_state.enable = STEPPER_DRIVER_DISABLED;
+
+} /* lox_driver_disable */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		fuel_driver_disable                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Disable the fuel stepper motor driver                                  *
+*                                                                              *
+*******************************************************************************/
+static void fuel_driver_disable
+	(
+	void
+	)
+{
+/* Set GPIO level          */
+HAL_GPIO_WritePin( KER_EN_GPIO_PORT, KER_EN_PIN, GPIO_PIN_SET );
+
+/* Update the global state */
+fuel_driver_state.enable = STEPPER_DRIVER_DISABLED;
+
+} /* fuel_driver_disable */
 
 
 /*******************************************************************************
@@ -1282,6 +1769,10 @@ if ( valve_get_fuel_valve_state() == VALVE_OPEN )
 	main_valve_states |= ( 1 << 6 );
 	}
 
+/* Calibration progress */
+main_valve_states |= cal_report( lox_cal.state  ) << VALVE_STATES_LOX_CAL_SHIFT;
+main_valve_states |= cal_report( fuel_cal.state ) << VALVE_STATES_FUEL_CAL_SHIFT;
+
 return main_valve_states;
 } /* valve_get_valve_states */
 
@@ -1289,104 +1780,1123 @@ return main_valve_states;
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		inc_lox_encoder                                                        *
+* 		pos_delta                                                              *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Increase the lox encoder count by one                                  *
+*       Get the shortest signed distance from one encoder count to another.    *
+*       The count wraps at one revolution, so the result is in                 *
+*       ( -VALVE_ENC_CPR/2, VALVE_ENC_CPR/2 ]                                  *
 *                                                                              *
 *******************************************************************************/
-static void inc_lox_encoder
+static int32_t pos_delta
 	(
-	void
+	int32_t from_pos,
+	int32_t to_pos
 	)
 {
-if ( lox_valve_pos == 999 )
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+int32_t delta; /* Distance modulo one revolution */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+delta = ( to_pos - from_pos ) % VALVE_ENC_CPR;
+if      ( delta >  VALVE_ENC_CPR/2 )
 	{
-	lox_valve_pos = 0;
+	delta -= VALVE_ENC_CPR;
 	}
-else
+else if ( delta <= -VALVE_ENC_CPR/2 )
 	{
-	lox_valve_pos += 1;
+	delta += VALVE_ENC_CPR;
 	}
-} /* inc_lox_encoder */
+return delta;
+} /* pos_delta */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		inc_fuel_encoder                                                       *
+* 		move_check                                                             *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Increase the fuel encoder count by one                                 *
+*       Check that a valve can start a move to a target                        *
 *                                                                              *
 *******************************************************************************/
-static void inc_fuel_encoder
+static VALVE_STATUS move_check
 	(
-	void
+	volatile VALVE_MOTION_STATE* motion_ptr,
+	VALVE_CAL*                   cal_ptr   ,
+	int32_t                      target_pos
 	)
 {
-if ( fuel_valve_pos == 999 )
+if ( ( target_pos < 0 ) || ( target_pos >= VALVE_ENC_CPR ) )
 	{
-	fuel_valve_pos = 0;
+	return VALVE_INVALID_POS;
 	}
-else
+if ( motion_ptr->moving                      || 
+     ( cal_ptr->state == VALVE_CAL_HOMING   ) || 
+     ( cal_ptr->state == VALVE_CAL_SETTLING ) )
+	{
+	return VALVE_BUSY;
+	}
+return VALVE_OK;
+} /* move_check */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		prepare_lox_move                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Arm a lox valve move without starting the step PWM. armed_ptr is set   *
+*       false if the valve is already at the target                            *
+*                                                                              *
+*******************************************************************************/
+static VALVE_STATUS prepare_lox_move
+	(
+	int32_t target_pos,
+	bool*   armed_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+VALVE_STATUS             valve_status; /* Status return codes from valve API */
+int32_t                  pos;          /* Current encoder count              */
+int32_t                  delta;        /* Shortest distance to the target    */
+STEPPER_DRIVER_DIR_STATE direction;    /* Direction of the move              */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+pos        = lox_encoder_pos();
+delta      = pos_delta( pos, target_pos );
+*armed_ptr = false;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Check the target and if the valve is already there */
+valve_status = move_check( &lox_motion, &lox_cal, target_pos );
+if ( valve_status != VALVE_OK )
+	{
+	return valve_status;
+	}
+if ( delta == 0 )
+	{
+	return VALVE_OK;
+	}
+
+/* Set the direction, the count wraps so take the short way round */
+direction    = ( delta > 0 ) ? STEPPER_DRIVER_CW : STEPPER_DRIVER_CCW;
+valve_status = lox_driver_set_direction( direction );
+if ( valve_status != VALVE_OK )
 	{
-	fuel_valve_pos += 1;
+	return valve_status;
 	}
 
-} /* inc_fuel_encoder */
+/* Arm the valve       */
+lox_motion.target    = target_pos;
+lox_motion.direction = direction;
+trace_start( &lox_trace, pos, target_pos, valve_get_ox_valve_state() );
+#ifdef VALVE_ENCODER_TIM
+	arm_stop_compare( &( VALVE_LOX_ENC_TIM ), target_pos );
+#endif
+prepare_motion( &lox_motion, &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
+*armed_ptr = true;
+return VALVE_OK;
+} /* prepare_lox_move */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		dec_lox_encoder                                                        *
+* 		prepare_fuel_move                                                      *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Decrease the lox encoder count by one                                  *
+*       Arm a fuel valve move without starting the step PWM. armed_ptr is set  *
+*       false if the valve is already at the target                            *
 *                                                                              *
 *******************************************************************************/
-static void dec_lox_encoder
+static VALVE_STATUS prepare_fuel_move
 	(
-	void
+	int32_t target_pos,
+	bool*   armed_ptr
 	)
 {
-if ( lox_valve_pos == 0 )
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+VALVE_STATUS             valve_status; /* Status return codes from valve API */
+int32_t                  pos;          /* Current encoder count              */
+int32_t                  delta;        /* Shortest distance to the target    */
+STEPPER_DRIVER_DIR_STATE direction;    /* Direction of the move              */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+pos        = fuel_encoder_pos();
+delta      = pos_delta( pos, target_pos );
+*armed_ptr = false;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Check the target and if the valve is already there */
+valve_status = move_check( &fuel_motion, &fuel_cal, target_pos );
+if ( valve_status != VALVE_OK )
 	{
-	lox_valve_pos = 999;
+	return valve_status;
 	}
-else
+if ( delta == 0 )
+	{
+	return VALVE_OK;
+	}
+
+/* Set the direction, the count wraps so take the short way round */
+direction    = ( delta > 0 ) ? STEPPER_DRIVER_CW : STEPPER_DRIVER_CCW;
+valve_status = fuel_driver_set_direction( direction );
+if ( valve_status != VALVE_OK )
+	{
+	return valve_status;
+	}
+
+/* Arm the valve       */
+fuel_motion.target    = target_pos;
+fuel_motion.direction = direction;
+trace_start( &fuel_trace, pos, target_pos, valve_get_fuel_valve_state() );
+#ifdef VALVE_ENCODER_TIM
+	arm_stop_compare( &( VALVE_FUEL_ENC_TIM ), target_pos );
+#endif
+prepare_motion( &fuel_motion, &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
+*armed_ptr = true;
+return VALVE_OK;
+} /* prepare_fuel_move */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		sync_start                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start both armed step timers together. The fuel timer is put in trigger*
+*       slave mode on the LOX timer counter enable and the lagging valve's     *
+*       counter is preloaded into the idle half of its first step period. The  *
+*       timers stay linked until the first step ISR, see sync_end              *
+*                                                                              *
+*******************************************************************************/
+static void sync_start
+	(
+	int32_t lead_counts
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+TIM_MasterConfigTypeDef master_config; /* LOX step timer trigger output  */
+TIM_SlaveConfigTypeDef  slave_config;  /* Fuel step timer trigger input  */
+uint32_t                period;        /* First step period, timer counts */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+master_config.MasterOutputTrigger  = TIM_TRGO_ENABLE;
+master_config.MasterOutputTrigger2 = TIM_TRGO2_RESET;
+master_config.MasterSlaveMode      = TIM_MASTERSLAVEMODE_ENABLE;
+slave_config.SlaveMode             = TIM_SLAVEMODE_TRIGGER;
+slave_config.InputTrigger          = VALVE_SYNC_ITR;
+slave_config.TriggerPolarity       = TIM_TRIGGERPOLARITY_RISING;
+slave_config.TriggerPrescaler      = TIM_TRIGGERPRESCALER_DIV1;
+slave_config.TriggerFilter         = 0;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Fuel step timer waits for the LOX step timer */
+HAL_TIM_SlaveConfigSynchro           ( &( VALVE_FUEL_TIM ), &slave_config  );
+HAL_TIMEx_MasterConfigSynchronization( &( VALVE_LOX_TIM  ), &master_config );
+
+/* Delay the lagging valve */
+sync_wrap_tim = NULL;
+if      ( lead_counts > 0 )
+	{
+	period = __HAL_TIM_GET_AUTORELOAD( &( VALVE_FUEL_TIM ) ) + 1;
+	__HAL_TIM_SET_COUNTER( &( VALVE_FUEL_TIM ), period - lead_counts );
+	sync_wrap_tim = &( VALVE_FUEL_TIM );
+	}
+else if ( lead_counts < 0 )
 	{
-	lox_valve_pos -= 1;
+	period = __HAL_TIM_GET_AUTORELOAD( &( VALVE_LOX_TIM  ) ) + 1;
+	__HAL_TIM_SET_COUNTER( &( VALVE_LOX_TIM  ), period + lead_counts );
+	sync_wrap_tim = &( VALVE_LOX_TIM  );
 	}
 
-} /* dec_lox_encoder */
+/* No update may be pending once the counters are loaded, or the first step
+   ISR runs before the first step */
+__HAL_TIM_CLEAR_FLAG( &( VALVE_FUEL_TIM ), TIM_FLAG_UPDATE );
+__HAL_TIM_CLEAR_FLAG( &( VALVE_LOX_TIM  ), TIM_FLAG_UPDATE );
+
+/* Arm the fuel output, then start both counters with the LOX timer */
+sync_linked = true;
+HAL_TIM_PWM_Start( &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
+HAL_TIM_PWM_Start( &( VALVE_LOX_TIM  ), VALVE_LOX_TIM_CHANNEL  );
+} /* sync_start */
 
 
 /*******************************************************************************
 *                                                                              *
 * PROCEDURE:                                                                   *
-* 		dec_fuel_encoder                                                       *
+* 		sync_end                                                               *
 *                                                                              *
 * DESCRIPTION:                                                                 *
-*       Decrease the fuel encoder count by one                                 *
+*       Return the step timers to independent operation after a synchronized   *
+*       start. Called from the first step ISR of either valve, by which time   *
+*       the trigger has reached the fuel timer, and when a move is stopped so a*
+*       later fuel move is not left waiting for a trigger                      *
 *                                                                              *
 *******************************************************************************/
-static void dec_fuel_encoder
+static void sync_end
 	(
 	void
 	)
 {
-if ( fuel_valve_pos == 0 )
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+TIM_MasterConfigTypeDef master_config; /* LOX step timer trigger output  */
+TIM_SlaveConfigTypeDef  slave_config;  /* Fuel step timer trigger input  */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+master_config.MasterOutputTrigger  = TIM_TRGO_RESET;
+master_config.MasterOutputTrigger2 = TIM_TRGO2_RESET;
+master_config.MasterSlaveMode      = TIM_MASTERSLAVEMODE_DISABLE;
+slave_config.SlaveMode             = TIM_SLAVEMODE_DISABLE;
+slave_config.InputTrigger          = VALVE_SYNC_ITR;
+slave_config.TriggerPolarity       = TIM_TRIGGERPOLARITY_RISING;
+slave_config.TriggerPrescaler      = TIM_TRIGGERPRESCALER_DIV1;
+slave_config.TriggerFilter         = 0;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( !sync_linked )
 	{
-	fuel_valve_pos = 999;
+	return;
 	}
-else
+sync_linked = false;
+HAL_TIM_SlaveConfigSynchro           ( &( VALVE_FUEL_TIM ), &slave_config  );
+HAL_TIMEx_MasterConfigSynchronization( &( VALVE_LOX_TIM  ), &master_config );
+} /* sync_end */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		prepare_motion                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Load the step timer for the start of a valve move at the start rate.   *
+*       An update event loads the period into the active registers and clears  *
+*       the counter before the step PWM is started                             *
+*                                                                              *
+*******************************************************************************/
+static void prepare_motion
+	(
+	volatile VALVE_MOTION_STATE* motion_ptr,
+	TIM_HandleTypeDef*           step_tim_ptr,
+	uint32_t                     step_channel
+	)
+{
+motion_ptr->rate_sq = motion_config.start_rate*motion_config.start_rate;
+motion_ptr->moving  = true;
+set_step_rate        ( step_tim_ptr, step_channel, motion_config.start_rate );
+HAL_TIM_GenerateEvent( step_tim_ptr, TIM_EVENTSOURCE_UPDATE );
+__HAL_TIM_CLEAR_FLAG ( step_tim_ptr, TIM_FLAG_UPDATE );
+__HAL_TIM_ENABLE_IT  ( step_tim_ptr, TIM_IT_UPDATE   );
+} /* prepare_motion */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		stop_motion                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Stop the step PWM and end a valve move                                 *
+*                                                                              *
+*******************************************************************************/
+static void stop_motion
+	(
+	volatile VALVE_MOTION_STATE* motion_ptr,
+	TIM_HandleTypeDef*           step_tim_ptr,
+	uint32_t                     step_channel
+	)
+{
+HAL_TIM_PWM_Stop     ( step_tim_ptr, step_channel  );
+__HAL_TIM_DISABLE_IT( step_tim_ptr, TIM_IT_UPDATE );
+motion_ptr->moving = false;
+sync_end();
+} /* stop_motion */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		motion_step                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Advance a valve move by one step. The step rate is tracked squared so  *
+*       that constant acceleration is a constant change of 2a per step. The    *
+*       move decelerates once the remaining distance is within the distance    *
+*       needed to slow back down to the start rate                             *
+*                                                                              *
+*******************************************************************************/
+static void motion_step
+	(
+	volatile VALVE_MOTION_STATE* motion_ptr,
+	TIM_HandleTypeDef*           step_tim_ptr,
+	uint32_t                     step_channel,
+	int32_t                      pos
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+float remaining; /* Steps left to the target                 */
+float stop_dist; /* Steps needed to decelerate to start rate */
+float rate_sq;   /* Step rate squared                        */
+float min_sq;    /* Start rate squared                       */
+float max_sq;    /* Max rate squared                         */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+remaining = (float) pos_delta( pos, motion_ptr->target );
+rate_sq   = motion_ptr->rate_sq;
+min_sq    = motion_config.start_rate*motion_config.start_rate;
+max_sq    = motion_config.max_rate  *motion_config.max_rate;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Stopped by the encoder */
+if ( !motion_ptr->moving )
+	{
+	stop_motion( motion_ptr, step_tim_ptr, step_channel );
+	return;
+	}
+
+/* Target reached or passed */
+if ( motion_ptr->direction == STEPPER_DRIVER_CCW )
+	{
+	remaining = -remaining;
+	}
+if ( remaining <= 0.0f )
+	{
+	stop_motion( motion_ptr, step_tim_ptr, step_channel );
+	return;
+	}
+
+/* Accelerate, cruise or decelerate */
+remaining *= VALVE_STEPS_PER_COUNT;
+stop_dist  = ( rate_sq - min_sq )/( 2.0f*motion_config.acceleration );
+if      ( stop_dist >= remaining )
+	{
+	rate_sq -= 2.0f*motion_config.acceleration;
+	if ( rate_sq < min_sq )
+		{
+		rate_sq = min_sq;
+		}
+	}
+else if ( rate_sq < max_sq )
+	{
+	rate_sq += 2.0f*motion_config.acceleration;
+	if ( rate_sq > max_sq )
+		{
+		rate_sq = max_sq;
+		}
+	}
+
+motion_ptr->rate_sq = rate_sq;
+set_step_rate( step_tim_ptr, step_channel, sqrtf( rate_sq ) );
+} /* motion_step */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		set_step_rate                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Set the step PWM rate of a valve. The auto-reload is preloaded so the  *
+*       new period starts with the next step                                   *
+*                                                                              *
+*******************************************************************************/
+static void set_step_rate
+	(
+	TIM_HandleTypeDef* step_tim_ptr,
+	uint32_t           step_channel,
+	float              step_rate
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t period; /* Step period in timer counts */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+period = (uint32_t) ( VALVE_STEP_TIM_FREQ/step_rate );
+__HAL_TIM_SET_AUTORELOAD( step_tim_ptr, period - 1 );
+__HAL_TIM_SET_COMPARE   ( step_tim_ptr, step_channel, period/2 );
+} /* set_step_rate */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		trace_start                                                            *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start the actuation trace of a valve move, called before the step PWM  *
+*       starts                                                                 *
+*                                                                              *
+*******************************************************************************/
+static void trace_start
+	(
+	VALVE_TRACE* trace_ptr ,
+	int32_t      pos       ,
+	int32_t      target_pos,
+	VALVE_STATE  photogate
+	)
+{
+/* The trace timer only runs while a move is being traced */
+if ( !lox_trace.active && !fuel_trace.active )
+	{
+	HAL_TIM_Base_Start( &( VALVE_TRACE_TIM ) );
+	}
+
+trace_ptr->head           = 0;
+trace_ptr->count          = 0;
+trace_ptr->start_time     = __HAL_TIM_GET_COUNTER( &( VALVE_TRACE_TIM ) );
+trace_ptr->start_pos      = pos;
+trace_ptr->target_pos     = target_pos;
+trace_ptr->last_pos       = pos;
+trace_ptr->stall_steps    = 0;
+trace_ptr->stalls         = 0;
+trace_ptr->time_to_crack  = 0;
+trace_ptr->time_to_target = 0;
+trace_ptr->active         = true;
+trace_record( trace_ptr, VALVE_TRACE_EVENT_START, pos, photogate );
+} /* trace_start */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		trace_step                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Record one step of a valve move. Position samples are decimated to     *
+*       every VALVE_TRACE_POS_STEP counts, photogate transitions and stalls are*
+*       always recorded                                                        *
+*                                                                              *
+*******************************************************************************/
+static void trace_step
+	(
+	VALVE_TRACE* trace_ptr,
+	int32_t      pos      ,
+	VALVE_STATE  photogate
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+int32_t delta; /* Counts since the last position sample */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( !trace_ptr->active )
+	{
+	return;
+	}
+
+/* Photogate transition */
+if ( photogate != trace_ptr->photogate )
+	{
+	trace_record( trace_ptr, VALVE_TRACE_EVENT_GATE, pos, photogate );
+	}
+
+/* Stall detection */
+if ( pos == trace_ptr->last_pos )
+	{
+	if ( ++trace_ptr->stall_steps == VALVE_TRACE_STALL_STEPS )
+		{
+		trace_ptr->stalls++;
+		trace_record( trace_ptr, VALVE_TRACE_EVENT_STALL, pos, photogate );
+		}
+	return;
+	}
+trace_ptr->stall_steps = 0;
+trace_ptr->last_pos    = pos;
+
+/* Time to crack */
+if ( ( trace_ptr->time_to_crack == 0                                 ) && 
+     ( ( trace_ptr->start_pos < VALVE_CRACKED_POS ) != 
+       ( pos                  < VALVE_CRACKED_POS ) ) )
+	{
+	trace_ptr->time_to_crack = __HAL_TIM_GET_COUNTER( &( VALVE_TRACE_TIM ) ) - 
+	                           trace_ptr->start_time;
+	}
+
+/* Decimated position sample */
+delta = pos - trace_ptr->sample_pos;
+if ( ( delta >= VALVE_TRACE_POS_STEP ) || ( delta <= -VALVE_TRACE_POS_STEP ) )
+	{
+	trace_record( trace_ptr, VALVE_TRACE_EVENT_POS, pos, photogate );
+	}
+
+} /* trace_step */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		trace_stop                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       End the actuation trace of a valve move. Safe to call more than once   *
+*       per move, only the first call records the stop. The step interrupt of  *
+*       the valve is stopped first and the buffer is frozen with interrupts    *
+*       masked, so a step ISR cannot add entries after the stop entry          *
+*                                                                              *
+*******************************************************************************/
+static void trace_stop
+	(
+	VALVE_TRACE*       trace_ptr   ,
+	TIM_HandleTypeDef* step_tim_ptr,
+	int32_t            pos
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t primask; /* Interrupt mask on entry */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+__HAL_TIM_DISABLE_IT( step_tim_ptr, TIM_IT_UPDATE );
+primask = __get_PRIMASK();
+__disable_irq();
+if ( !trace_ptr->active )
+	{
+	__set_PRIMASK( primask );
+	return;
+	}
+
+trace_record( trace_ptr, VALVE_TRACE_EVENT_STOP, pos, trace_ptr->photogate );
+trace_ptr->time_to_target = trace_ptr->entries[( trace_ptr->head + 
+                                                 VALVE_TRACE_SIZE - 1 ) % 
+                                               VALVE_TRACE_SIZE].time;
+trace_ptr->active         = false;
+
+/* Stop the trace timer once neither valve is being traced */
+if ( !lox_trace.active && !fuel_trace.active )
+	{
+	HAL_TIM_Base_Stop( &( VALVE_TRACE_TIM ) );
+	}
+__set_PRIMASK( primask );
+} /* trace_stop */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		trace_record                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Add an entry to an actuation trace, overwriting the oldest entry once  *
+*       the ring is full. Entries are only added while the trace is active and *
+*       each entry is written with interrupts masked                           *
+*                                                                              *
+*******************************************************************************/
+static void trace_record
+	(
+	VALVE_TRACE* trace_ptr,
+	uint8_t      event    ,
+	int32_t      pos      ,
+	uint8_t      photogate
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+VALVE_TRACE_ENTRY* entry_ptr; /* Entry to write          */
+uint32_t           primask;   /* Interrupt mask on entry */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+primask = __get_PRIMASK();
+__disable_irq();
+if ( !trace_ptr->active )
+	{
+	__set_PRIMASK( primask );
+	return;
+	}
+
+entry_ptr            = &( trace_ptr->entries[trace_ptr->head] );
+entry_ptr->time      = __HAL_TIM_GET_COUNTER( &( VALVE_TRACE_TIM ) ) - 
+                       trace_ptr->start_time;
+entry_ptr->pos       = (int16_t) pos;
+entry_ptr->event     = event;
+entry_ptr->photogate = photogate;
+
+trace_ptr->head       = ( trace_ptr->head + 1 ) % VALVE_TRACE_SIZE;
+trace_ptr->sample_pos = pos;
+trace_ptr->photogate  = photogate;
+if ( trace_ptr->count < VALVE_TRACE_SIZE )
+	{
+	trace_ptr->count++;
+	}
+__set_PRIMASK( primask );
+} /* trace_record */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		trace_transmit                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Send an actuation trace summary followed by its entries, oldest first. *
+*       Stops at the first failed transfer                                     *
+*                                                                              *
+*******************************************************************************/
+static VALVE_STATUS trace_transmit
+	(
+	VALVE_TRACE*         trace_ptr    ,
+	VALVE_TRACE_SUMMARY* summary_ptr  ,
+	const TRANSPORT*     transport_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint16_t first;     /* Index of the oldest entry           */
+uint16_t num_first; /* Entries from the oldest to ring end */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+first     = ( trace_ptr->head + VALVE_TRACE_SIZE - trace_ptr->count ) % 
+            VALVE_TRACE_SIZE;
+num_first = VALVE_TRACE_SIZE - first;
+if ( num_first > trace_ptr->count )
+	{
+	num_first = trace_ptr->count;
+	}
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( transport_transmit( transport_ptr, summary_ptr, 
+                        sizeof( VALVE_TRACE_SUMMARY ), 
+                        VALVE_TRACE_TX_TIMEOUT ) != TRANSPORT_OK )
+	{
+	return VALVE_ERROR;
+	}
+
+/* The links reject empty transfers, so an empty trace or the second part of
+   a ring that has not wrapped is skipped */
+if ( ( num_first > 0 ) &&
+     ( transport_transmit( transport_ptr, &( trace_ptr->entries[first] ), 
+                           num_first*sizeof( VALVE_TRACE_ENTRY ),
+                           VALVE_TRACE_TX_TIMEOUT ) != TRANSPORT_OK ) )
+	{
+	return VALVE_ERROR;
+	}
+if ( ( trace_ptr->count > num_first ) &&
+     ( transport_transmit( transport_ptr, &( trace_ptr->entries[0] ), 
+                           ( trace_ptr->count - num_first )*
+                           sizeof( VALVE_TRACE_ENTRY ),
+                           VALVE_TRACE_TX_TIMEOUT ) != TRANSPORT_OK ) )
+	{
+	return VALVE_ERROR;
+	}
+return VALVE_OK;
+} /* trace_transmit */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cal_update                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Advance the calibration of one valve, returns true on the call where   *
+*       the valve finishes homing so the caller can zero its encoder count     *
+*                                                                              *
+*******************************************************************************/
+static bool cal_update
+	(
+	VALVE_CAL*         cal_ptr     ,
+	VALVE_STATE        photogate   ,
+	TIM_HandleTypeDef* step_tim_ptr,
+	uint32_t           step_channel,
+	uint32_t           tick
+	)
+{
+switch ( cal_ptr->state )
+	{
+	/* Step until the photogate trips or the timeout expires */
+	case VALVE_CAL_HOMING:
+		{
+		if      ( photogate == VALVE_CLOSED )
+			{
+			cal_ptr->state      = VALVE_CAL_SETTLING;
+			cal_ptr->start_tick = tick;
+			}
+		else if ( ( tick - cal_ptr->start_tick ) >= VALVE_CAL_TIMEOUT_MS )
+			{
+			HAL_TIM_PWM_Stop( step_tim_ptr, step_channel );
+			cal_ptr->state = VALVE_CAL_TIMEOUT;
+			}
+		return false;
+		}
+
+	/* Keep stepping past the photogate edge */
+	case VALVE_CAL_SETTLING:
+		{
+		if ( ( tick - cal_ptr->start_tick ) >= VALVE_CAL_SETTLE_MS )
+			{
+			HAL_TIM_PWM_Stop( step_tim_ptr, step_channel );
+			cal_ptr->state = VALVE_CAL_DONE;
+			return true;
+			}
+		return false;
+		}
+
+	default:
+		{
+		return false;
+		}
+	}
+
+} /* cal_update */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		cal_report                                                             *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the calibration state reported in MAIN_VALVE_STATES                *
+*                                                                              *
+*******************************************************************************/
+static uint8_t cal_report
+	(
+	VALVE_CAL_STATE cal_state
+	)
+{
+if ( cal_state == VALVE_CAL_SETTLING )
+	{
+	return VALVE_CAL_HOMING;
+	}
+else
+	{
+	return cal_state;
+	}
+} /* cal_report */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lox_encoder_pos                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the lox encoder count                                              *
+*                                                                              *
+*******************************************************************************/
+static int32_t lox_encoder_pos
+	(
+	void
+	)
+{
+#ifdef VALVE_ENCODER_TIM
+	return __HAL_TIM_GET_COUNTER( &( VALVE_LOX_ENC_TIM ) );
+#else
+	return lox_valve_pos;
+#endif
+} /* lox_encoder_pos */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		fuel_encoder_pos                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the fuel encoder count                                             *
+*                                                                              *
+*******************************************************************************/
+static int32_t fuel_encoder_pos
+	(
+	void
+	)
+{
+#ifdef VALVE_ENCODER_TIM
+	return __HAL_TIM_GET_COUNTER( &( VALVE_FUEL_ENC_TIM ) );
+#else
+	return fuel_valve_pos;
+#endif
+} /* fuel_encoder_pos */
+
+
+#ifdef VALVE_ENCODER_TIM
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		arm_stop_compare                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Arm the encoder timer compare to stop the valve at a position. The     *
+*       compare matches whichever direction the count reaches the target from  *
+*                                                                              *
+*******************************************************************************/
+static void arm_stop_compare
+	(
+	TIM_HandleTypeDef* enc_tim_ptr,
+	int32_t            stop_pos
+	)
+{
+__HAL_TIM_SET_COMPARE( enc_tim_ptr, VALVE_ENC_TIM_STOP_CHANNEL, stop_pos );
+__HAL_TIM_CLEAR_FLAG ( enc_tim_ptr, VALVE_ENC_TIM_STOP_FLAG );
+HAL_TIM_OC_Start_IT  ( enc_tim_ptr, VALVE_ENC_TIM_STOP_CHANNEL );
+} /* arm_stop_compare */
+
+#else
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lox_encoder_channels                                                   *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Read the lox encoder AB code                                           *
+*                                                                              *
+*******************************************************************************/
+static uint8_t lox_encoder_channels
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t port_state; /* Encoder GPIO input data register */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Both channels share a port, sample them together */
+port_state = LOX_ENC_GPIO_PORT->IDR;
+return ( ( ( port_state & LOX_ENC_A_PIN ) != 0 ) << 1 ) | 
+         ( ( port_state & LOX_ENC_B_PIN ) != 0 );
+} /* lox_encoder_channels */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		fuel_encoder_channels                                                  *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Read the fuel encoder AB code                                          *
+*                                                                              *
+*******************************************************************************/
+static uint8_t fuel_encoder_channels
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t port_state; /* Encoder GPIO input data register */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Both channels share a port, sample them together */
+port_state = KER_ENC_GPIO_PORT->IDR;
+return ( ( ( port_state & KER_ENC_A_PIN ) != 0 ) << 1 ) | 
+         ( ( port_state & KER_ENC_B_PIN ) != 0 );
+} /* fuel_encoder_channels */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lox_encoder_update                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Decode a lox encoder edge with the quadrature table and                *
+*       stop the valve once it reaches the target of the current move          *
+*                                                                              *
+*******************************************************************************/
+static void lox_encoder_update
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t enc_state; /* Current AB code           */
+int8_t  step;      /* Decoded count change      */
+int32_t pos;       /* Updated encoder count     */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+enc_state = lox_encoder_channels();
+step      = quad_table[( lox_enc_state << 2 ) | enc_state];
+lox_enc_state = enc_state;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Both channels changed, the direction of the missed edges is unknown */
+if ( step == VALVE_QUAD_ILLEGAL )
+	{
+	lox_enc_errors++;
+	return;
+	}
+
+/* Update the count, wrapping at one revolution */
+pos = lox_valve_pos + step;
+if      ( pos < 0              )
+	{
+	pos += VALVE_ENC_CPR;
+	}
+else if ( pos >= VALVE_ENC_CPR )
+	{
+	pos -= VALVE_ENC_CPR;
+	}
+lox_valve_pos = pos;
+
+/* Detect the end of the current move */
+if ( lox_motion.moving && ( pos == lox_motion.target ) )
+	{
+	stop_motion( &lox_motion, &( VALVE_LOX_TIM ), VALVE_LOX_TIM_CHANNEL );
+	trace_stop ( &lox_trace, &( VALVE_LOX_TIM ), pos );
+	}
+
+} /* lox_encoder_update */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		fuel_encoder_update                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Decode a fuel encoder edge with the quadrature table and               *
+*       stop the valve once it reaches the target of the current move          *
+*                                                                              *
+*******************************************************************************/
+static void fuel_encoder_update
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t enc_state; /* Current AB code           */
+int8_t  step;      /* Decoded count change      */
+int32_t pos;       /* Updated encoder count     */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+enc_state = fuel_encoder_channels();
+step      = quad_table[( fuel_enc_state << 2 ) | enc_state];
+fuel_enc_state = enc_state;
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Both channels changed, the direction of the missed edges is unknown */
+if ( step == VALVE_QUAD_ILLEGAL )
+	{
+	fuel_enc_errors++;
+	return;
+	}
+
+/* Update the count, wrapping at one revolution */
+pos = fuel_valve_pos + step;
+if      ( pos < 0              )
+	{
+	pos += VALVE_ENC_CPR;
+	}
+else if ( pos >= VALVE_ENC_CPR )
+	{
+	pos -= VALVE_ENC_CPR;
+	}
+fuel_valve_pos = pos;
+
+/* Detect the end of the current move */
+if ( fuel_motion.moving && ( pos == fuel_motion.target ) )
 	{
-	fuel_valve_pos -= 1;
+	stop_motion( &fuel_motion, &( VALVE_FUEL_TIM ), VALVE_FUEL_TIM_CHANNEL );
+	trace_stop ( &fuel_trace, &( VALVE_FUEL_TIM ), pos );
 	}
 
-} /* dec_fuel_encoder */
+} /* fuel_encoder_update */
+#endif /* #ifdef VALVE_ENCODER_TIM */
 #endif /* #ifdef VALVE_CONTROLLER */
 
 
@@ -16,23 +16,88 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+#include "transport.h"
+
 
 /*------------------------------------------------------------------------------
  Macros 
 ------------------------------------------------------------------------------*/
 
-/* Encoder states */
-#define ENCODER_HIGH              true
-#define ENCODER_LOW               false
+/* Quadrature decoder table entry for a transition where both encoder
+   channels changed, meaning at least one edge was missed */
+#define VALVE_QUAD_ILLEGAL        ( 2 )
 
 /* Photogate states */
 #define PHOTOGATE_STATE_LOW       GPIO_PIN_RESET
 #define PHOTOGATE_STATE_HIGH      GPIO_PIN_SET
 
-/* Valve open/close positions */
+/* Valve open/close positions, in 4x decoded encoder counts */
 #define VALVE_CLOSED_POS          0
-#define VALVE_OPEN_POS            250
-#define VALVE_CRACKED_POS         71 /* 29% */
+#define VALVE_OPEN_POS            1000
+#define VALVE_CRACKED_POS         284 /* 29% */
+
+/* Encoder counts per valve revolution, counting every edge of both
+   channels */
+#define VALVE_ENC_CPR             4000
+
+/* Distance from a preset position, in counts, within which the valve is
+   taken to be at that position */
+#define VALVE_POS_TOLERANCE       ( 8 )
+
+/* Stepper motion profile. The board pin definitions give the counter clock
+   of the step PWM timers after the prescaler (VALVE_STEP_TIM_FREQ), the
+   motor steps per valve revolution (VALVE_STEPS_PER_REV) and the default
+   profile (VALVE_DEFAULT_START_RATE, VALVE_DEFAULT_MAX_RATE in steps/s and
+   VALVE_DEFAULT_ACCEL in steps/s^2) */
+#define VALVE_STEPS_PER_COUNT     ( VALVE_STEPS_PER_REV/VALVE_ENC_CPR )
+
+/* Synchronized actuation. The LOX step timer is the master and starts the
+   fuel step timer through its TRGO on the internal trigger VALVE_SYNC_ITR,
+   defined with the timer handles in the pin definitions. A lead or lag is
+   applied by preloading the counter of the lagging valve, which limits it
+   to half a step period at the start rate */
+#define VALVE_STEP_TIM_COUNTS_PER_US ( VALVE_STEP_TIM_FREQ/1000000 )
+#define VALVE_SYNC_LEAD_US           ( 0 ) /* LOX lead used by OPENALL and
+                                              RESET, us */
+
+/* Calibration timing. A valve that has not reached its photogate within
+   VALVE_CAL_TIMEOUT_MS is stopped and reported as timed out. Once the
+   photogate trips the valve keeps stepping for VALVE_CAL_SETTLE_MS */
+#define VALVE_CAL_TIMEOUT_MS      ( 10000 )
+#define VALVE_CAL_SETTLE_MS       ( 5     )
+
+/* Actuation trace. VALVE_TRACE_TIM is a 32 bit timer counting microseconds
+   that runs while a move is being traced. A position sample is recorded every VALVE_TRACE_POS_STEP
+   encoder counts and a stall is flagged after VALVE_TRACE_STALL_STEPS steps
+   without an encoder count */
+#define VALVE_TRACE_SIZE          ( 256 )
+#define VALVE_TRACE_POS_STEP      ( 8   )
+#define VALVE_TRACE_STALL_STEPS   ( 16  )
+#define VALVE_TRACE_TX_TIMEOUT    ( 1000 ) /* ms, trace readout timeout */
+
+/* Trace entry events */
+#define VALVE_TRACE_EVENT_START   ( 0x00 ) /* Move commanded           */
+#define VALVE_TRACE_EVENT_POS     ( 0x01 ) /* Position sample          */
+#define VALVE_TRACE_EVENT_GATE    ( 0x02 ) /* Photogate transition     */
+#define VALVE_TRACE_EVENT_STALL   ( 0x03 ) /* Steps without an encoder 
+                                              count                    */
+#define VALVE_TRACE_EVENT_STOP    ( 0x04 ) /* Move ended               */
+
+/* Calibration state fields of MAIN_VALVE_STATES */
+#define VALVE_STATES_LOX_CAL_SHIFT  ( 2    )
+#define VALVE_STATES_FUEL_CAL_SHIFT ( 0    )
+#define VALVE_STATES_CAL_MASK       ( 0x03 )
+
+#ifdef VALVE_ENCODER_TIM
+/* Hardware encoder backend. VALVE_LOX_ENC_TIM and VALVE_FUEL_ENC_TIM run in
+   encoder mode TI12 with channels 1 and 2 as the A/B inputs, which counts
+   every edge of both channels like the software decoder. The stop position
+   is detected with an output compare on channel 3 */
+#define VALVE_ENC_TIM_STOP_CHANNEL TIM_CHANNEL_3
+#define VALVE_ENC_TIM_STOP_IT     TIM_IT_CC3
+#define VALVE_ENC_TIM_STOP_FLAG   TIM_FLAG_CC3
+#endif
 
 /* Subcommand codes */
 #define VALVE_ENABLE_CODE         0x00
@@ -44,6 +109,7 @@ extern "C" {
 #define VALVE_RESET_CODE          0x10
 #define VALVE_OPENALL_CODE        0x12
 #define VALVE_GETSTATE_CODE       0x14
+#define VALVE_TRACE_CODE          0x16
 
 
 /*------------------------------------------------------------------------------
@@ -58,7 +124,11 @@ typedef enum _VALVE_STATUS
 	VALVE_UNRECOGNIZED_SUBCOMMAND,    /* Unrecognized subcommand    */
 	VALVE_UART_ERROR             ,    /* Unknown UART error         */
 	VALVE_UART_TIMEOUT           ,    /* Valve control UART timeout */
-	VALVE_ERROR
+	VALVE_ERROR                  ,
+	VALVE_INVALID_POS            ,    /* Target outside one rev     */
+	VALVE_INVALID_PROFILE        ,    /* Invalid motion profile     */
+	VALVE_BUSY                   ,    /* Valve is moving            */
+	VALVE_INVALID_SKEW                /* Lead/lag out of range      */
 	} VALVE_STATUS;
 
 /* Stepper driver enable states */
@@ -82,6 +152,41 @@ typedef struct _STEPPER_DRIVER_STATE
 	STEPPER_DRIVER_DIR_STATE direction; /* Rotation Direction */
 	} STEPPER_DRIVER_STATE; 
 
+/* Trapezoidal motion profile, rates in steps/s */
+typedef struct _VALVE_MOTION_CONFIG
+	{
+	float start_rate;   /* Step rate at the start and end of a move */
+	float max_rate;     /* Cruise step rate                         */
+	float acceleration; /* Acceleration and deceleration, steps/s^2 */
+	} VALVE_MOTION_CONFIG;
+
+/* State of a valve move in progress */
+typedef struct _VALVE_MOTION_STATE
+	{
+	bool                     moving;    /* Move in progress               */
+	int32_t                  target;    /* Target encoder count           */
+	STEPPER_DRIVER_DIR_STATE direction; /* Rotation direction             */
+	float                    rate_sq;   /* Current step rate squared      */
+	} VALVE_MOTION_STATE;
+
+/* Valve calibration progress. The first four states are reported in
+   MAIN_VALVE_STATES, settling is reported as homing */
+typedef enum _VALVE_CAL_STATE
+	{
+	VALVE_CAL_IDLE     = 0, /* Not calibrated                       */
+	VALVE_CAL_HOMING   = 1, /* Stepping towards the photogate       */
+	VALVE_CAL_DONE     = 2, /* Homed, encoder count zeroed          */
+	VALVE_CAL_TIMEOUT  = 3, /* Photogate not reached before timeout */
+	VALVE_CAL_SETTLING      /* Photogate tripped, finishing homing  */
+	} VALVE_CAL_STATE;
+
+/* Calibration state of one valve */
+typedef struct _VALVE_CAL
+	{
+	VALVE_CAL_STATE state;      /* Calibration progress                  */
+	uint32_t        start_tick; /* HAL tick the current state started at */
+	} VALVE_CAL;
+
 /* Valve States */
 typedef enum _VALVE_STATE
 	{
@@ -89,10 +194,56 @@ typedef enum _VALVE_STATE
 	VALVE_CLOSED
 	} VALVE_STATE;
 
+/* Actuation trace entry, times are in us from the move command */
+typedef struct _VALVE_TRACE_ENTRY
+	{
+	uint32_t time;      /* Time since the move command, us */
+	int16_t  pos;       /* Encoder count                   */
+	uint8_t  event;     /* VALVE_TRACE_EVENT code          */
+	uint8_t  photogate; /* VALVE_STATE from the photogate  */
+	} VALVE_TRACE_ENTRY;
+
+/* Actuation trace of the last move of one valve */
+typedef struct _VALVE_TRACE
+	{
+	VALVE_TRACE_ENTRY entries[VALVE_TRACE_SIZE]; /* Entry ring            */
+	uint16_t          head;           /* Next entry to write              */
+	uint16_t          count;          /* Number of valid entries          */
+	bool              active;         /* Move being traced                */
+	uint32_t          start_time;     /* Trace timer at the move command  */
+	int32_t           start_pos;      /* Encoder count at the command     */
+	int32_t           target_pos;     /* Target encoder count             */
+	int32_t           last_pos;       /* Encoder count at the last step   */
+	int32_t           sample_pos;     /* Last recorded position sample    */
+	uint8_t           photogate;      /* Last recorded photogate state    */
+	uint16_t          stall_steps;    /* Steps since the last count       */
+	uint16_t          stalls;         /* Number of stall events           */
+	uint32_t          time_to_crack;  /* us to cross VALVE_CRACKED_POS    */
+	uint32_t          time_to_target; /* us to the end of the move        */
+	} VALVE_TRACE;
+
+/* Actuation trace summary, sent ahead of the trace entries by
+   VALVE_TRACE_CODE. time_to_target is the time-to-open of an open
+   command, time_to_crack is 0 if the move did not cross the cracked
+   position. overshoot is the count past the target in the direction of
+   the move when the trace is read */
+typedef struct _VALVE_TRACE_SUMMARY
+	{
+	uint32_t time_to_crack;  /* us from command to VALVE_CRACKED_POS */
+	uint32_t time_to_target; /* us from command to the end of move   */
+	int32_t  start_pos;      /* Encoder count at the command         */
+	int32_t  target_pos;     /* Target encoder count                 */
+	int32_t  overshoot;      /* Counts past the target               */
+	uint16_t stalls;         /* Number of stall events               */
+	uint16_t num_entries;    /* Number of trace entries that follow  */
+	} VALVE_TRACE_SUMMARY;
+
 /* Encoding for communicating the state of both valves */
-/* bit    7: Main fuel valve (1 open/0 closed)
-   bit    6: Main lox valve  (1 open/0 closed) 
-   bits 5-0: Unused */
+/* bit    7: Main lox valve  (1 open/0 closed)
+   bit    6: Main fuel valve (1 open/0 closed) 
+   bits 5-4: Unused
+   bits 3-2: Main lox valve  calibration state (VALVE_CAL_STATE)
+   bits 1-0: Main fuel valve calibration state (VALVE_CAL_STATE) */
 typedef uint8_t MAIN_VALVE_STATES;
 
 
@@ -104,7 +255,8 @@ typedef uint8_t MAIN_VALVE_STATES;
 /* Execute a valve subcommand */
 VALVE_STATUS valve_cmd_execute
 	(
-	uint8_t    subcommand    /* sdec subcommand  */
+	uint8_t          subcommand   , /* sdec subcommand            */
+	const TRANSPORT* transport_ptr  /* Link the command came from */
 	);
 #endif
 
@@ -161,6 +313,38 @@ VALVE_STATUS valve_close_fuel_valve
 	void
 	);
 
+/* Move the main oxidizer valve to an encoder position */
+VALVE_STATUS valve_move_ox_valve
+	(
+	int32_t target_pos
+	);
+
+/* Move the main fuel valve to an encoder position */
+VALVE_STATUS valve_move_fuel_valve
+	(
+	int32_t target_pos
+	);
+
+/* Move both main valves with synchronized step timer starts */
+VALVE_STATUS valve_move_both_valves
+	(
+	int32_t lox_target_pos , /* LOX target encoder count          */
+	int32_t fuel_target_pos, /* Fuel target encoder count         */
+	int32_t lox_lead_us      /* LOX lead over fuel, negative lags */
+	);
+
+/* Set the stepper motion profile used by all valve moves */
+VALVE_STATUS valve_set_motion_profile
+	(
+	VALVE_MOTION_CONFIG* config_ptr
+	);
+
+/* Step timer update interrupt, advances the motion profile by one step */
+void valve_step_ISR
+	(
+	TIM_HandleTypeDef* htim
+	);
+
 /* Crack the oxidizer valve */
 VALVE_STATUS valve_crack_ox_valve
 	(
@@ -173,6 +357,19 @@ VALVE_STATUS valve_crack_fuel_valve
 	void
 	);
 
+#ifdef VALVE_ENCODER_TIM
+/* Start the hardware encoder timers */
+void valve_encoder_start
+	(
+	void
+	);
+
+/* Encoder timer stop position compare interrupt */
+void valve_encoder_compare_ISR
+	(
+	TIM_HandleTypeDef* htim
+	);
+#else
 /* LOX Main Valve Encoder Channel A Interrupt */
 void lox_channelA_ISR
 	(
@@ -197,6 +394,14 @@ void fuel_channelB_ISR
 	void
 	);
 
+/* Get the number of illegal quadrature transitions seen on each encoder */
+void valve_get_encoder_errors
+	(
+	uint32_t* lox_errors_ptr ,
+	uint32_t* fuel_errors_ptr
+	);
+#endif /* #ifdef VALVE_ENCODER_TIM */
+
 /* Get the position of the main oxidizer valve */
 int32_t valve_get_ox_valve_pos
 	(
@@ -227,12 +432,31 @@ VALVE_STATE valve_get_fuel_valve_state
 	void
 	);
 
-/* Calibrate initial valve positions */
+/* Start homing both valves against their photogates */
 VALVE_STATUS valve_calibrate_valves
 	(
 	void
 	);
 
+/* Advance valve calibration, call from the main loop */
+void valve_calibrate_task
+	(
+	void
+	);
+
+/* Reset the actuation trace timer */
+void valve_trace_init
+	(
+	void
+	);
+
+/* Get the actuation trace summary of the last move of a valve */
+VALVE_STATUS valve_get_trace_summary
+	(
+	uint8_t              valve_num  , /* 0 -> ox, 1 -> fuel */
+	VALVE_TRACE_SUMMARY* summary_ptr
+	);
+
 /* Get the state of both main valves */
 MAIN_VALVE_STATES valve_get_valve_states
 	(
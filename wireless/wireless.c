@@ -5,7 +5,9 @@
 *
 * DESCRIPTION: 
 * 		Contains API functions to transmit data wirelessly using the XBee and 
-*       and LoRa modules 
+*       and LoRa modules. The XBee runs in API mode over a UART, the LoRa 
+*       driver targets the SX127x over SPI and is built on boards that define
+*       LORA_SPI 
 *
 *******************************************************************************/
 
@@ -19,6 +21,8 @@
 	#include "sdr_pin_defines_L0002.h"
 #endif
 
+#include <string.h>
+
 /*------------------------------------------------------------------------------
  Project Includes                                                                     
 ------------------------------------------------------------------------------*/
@@ -26,10 +30,202 @@
 #include "wireless.h"
 
 
+/*------------------------------------------------------------------------------
+ Board Checks 
+------------------------------------------------------------------------------*/
+#ifdef LORA_SPI
+#ifndef LORA_SS_GPIO_PORT
+	#error LORA_SS_GPIO_PORT is not defined in the board pin definitions
+#endif
+#ifndef LORA_RST_GPIO_PORT
+	#error LORA_RST_GPIO_PORT is not defined in the board pin definitions
+#endif
+#ifndef LORA_DIO0_IRQn
+	#error LORA_DIO0_IRQn is not defined in the board pin definitions
+#endif
+#endif /* #ifdef LORA_SPI */
+
+
+/*------------------------------------------------------------------------------
+ Preprocesor Directives 
+------------------------------------------------------------------------------*/
+
+/* Transmit request frame data ahead of the payload: API ID, frame ID, 64-bit 
+   and 16-bit destination, broadcast radius and options */
+#define XBEE_TX_HEADER_SIZE     ( 14 )
+
+/* Receive packet frame data ahead of the payload: API ID, 64-bit and 16-bit 
+   source and options */
+#define XBEE_RX_HEADER_SIZE     ( 12 )
+
+/* Worst case escaped transmit frame, rounded to whole cache lines */
+#define XBEE_TX_FRAME_SIZE      ( ( ( 1 + 2*( 2 + XBEE_TX_HEADER_SIZE +       \
+                                  RF_MAX_PAYLOAD + 1 ) ) + 31 ) & ~31 )
+
+/* Largest frame data accepted by the receive parser */
+#define XBEE_RX_FRAME_MAX       ( XBEE_RX_HEADER_SIZE + RF_MAX_PAYLOAD )
+
+/* Ring and queue index masks */
+#define XBEE_TX_MASK            ( XBEE_TX_QUEUE_DEPTH - 1 )
+#define XBEE_RX_MASK            ( XBEE_RX_BUFFER_SIZE - 1 )
+#define XBEE_RX_QUEUE_MASK      ( XBEE_RX_QUEUE_DEPTH - 1 )
+
+/* LoRa queue index masks */
+#define LORA_TX_MASK            ( LORA_TX_QUEUE_DEPTH - 1 )
+#define LORA_RX_QUEUE_MASK      ( LORA_RX_QUEUE_DEPTH - 1 )
+
+/* SPI write flag on the LoRa register address */
+#define LORA_SPI_WRITE          ( 0x80 )
+
+/* Receive parser states */
+typedef enum _XBEE_RX_STATE
+	{
+	XBEE_RX_WAIT_START = 0,
+	XBEE_RX_LENGTH_MSB    ,
+	XBEE_RX_LENGTH_LSB    ,
+	XBEE_RX_DATA          ,
+	XBEE_RX_CHECKSUM
+	} XBEE_RX_STATE;
+
+
 /*------------------------------------------------------------------------------
 Global Variables                                                                  
 ------------------------------------------------------------------------------*/
 
+/* Escaped transmit frames, written by rf_xbee_send, sent by the DMA */
+static uint8_t           tx_frames[XBEE_TX_QUEUE_DEPTH][XBEE_TX_FRAME_SIZE] 
+                             __attribute__(( aligned( 32 ) ));
+static uint16_t          tx_sizes[XBEE_TX_QUEUE_DEPTH];
+volatile static uint8_t  tx_head   = 0;     /* Next free frame             */
+volatile static uint8_t  tx_tail   = 0;     /* Frame being sent            */
+volatile static uint16_t tx_offset = 0;     /* Bytes of the tail frame sent*/
+volatile static uint16_t tx_chunk  = 0;     /* Bytes in the active DMA     */
+volatile static bool     tx_active = false; /* DMA transfer in progress    */
+volatile static bool     tx_retry  = false; /* DMA start refused by the HAL*/
+static uint8_t           tx_frame_id = 0;   /* Last frame ID handed out    */
+
+/* Delivery status by frame ID */
+volatile static uint8_t  tx_delivery[256];
+
+/* Circular DMA receive ring and parser */
+static uint8_t           rx_buffer[XBEE_RX_BUFFER_SIZE] __attribute__(( aligned( 32 ) ));
+static uint16_t          rx_pos_parsed = 0;
+static XBEE_RX_STATE     rx_state      = XBEE_RX_WAIT_START;
+static bool              rx_escape     = false;
+static uint16_t          rx_length     = 0;
+static uint16_t          rx_count      = 0;
+static uint8_t           rx_sum        = 0;
+static uint8_t           rx_frame[XBEE_RX_FRAME_MAX];
+
+/* Received packet queue, filled by the receive ISR, emptied by the 
+   application */
+static RF_PACKET         rx_queue[XBEE_RX_QUEUE_DEPTH];
+volatile static uint8_t  rx_head = 0;
+volatile static uint8_t  rx_tail = 0;
+
+/* Driver statistics */
+static RF_XBEE_STATS     xbee_stats;
+
+/* API mode driver started, the UART belongs to its DMA streams */
+static bool              xbee_api_active = false;
+
+#ifdef LORA_SPI
+/* LoRa signal bandwidth by RF_LORA_BW code, Hz */
+static const uint32_t    lora_bw_hz[] = { 7800  , 10400 , 15600 , 20800 , 
+                                          31250 , 41700 , 62500 , 125000, 
+                                          250000, 500000 };
+
+/* LoRa modem configuration */
+static RF_LORA_CONFIG    lora_config;
+
+/* LoRa transmit queue, written by rf_lora_send, sent from the DIO0 ISR */
+static uint8_t           lora_tx_data[LORA_TX_QUEUE_DEPTH][RF_MAX_PAYLOAD];
+static uint8_t           lora_tx_size[LORA_TX_QUEUE_DEPTH];
+volatile static uint8_t  lora_tx_head   = 0;
+volatile static uint8_t  lora_tx_tail   = 0;
+volatile static bool     lora_tx_active = false;
+
+/* LoRa received packet queue */
+static RF_PACKET         lora_rx_queue[LORA_RX_QUEUE_DEPTH];
+volatile static uint8_t  lora_rx_head = 0;
+volatile static uint8_t  lora_rx_tail = 0;
+
+/* LoRa driver statistics */
+static RF_LORA_STATS     lora_stats;
+#endif /* #ifdef LORA_SPI */
+
+
+/*------------------------------------------------------------------------------
+ Internal function prototypes 
+------------------------------------------------------------------------------*/
+
+/* Append a byte to a transmit frame, escaping it if needed */
+static uint16_t xbee_put
+	(
+	uint8_t* frame_ptr,
+	uint16_t pos      ,
+	uint8_t  byte
+	);
+
+/* Start or continue the DMA transfer of the oldest queued frame */
+static void xbee_tx_start
+	(
+	void
+	);
+
+/* Feed one received byte to the API frame parser */
+static void xbee_parse_byte
+	(
+	uint8_t byte
+	);
+
+/* Handle a received API frame */
+static void xbee_frame_received
+	(
+	void
+	);
+
+#ifdef LORA_SPI
+/* Write a LoRa register */
+static RF_STATUS lora_write_reg
+	(
+	uint8_t reg  ,
+	uint8_t value
+	);
+
+/* Read a LoRa register */
+static uint8_t lora_read_reg
+	(
+	uint8_t reg
+	);
+
+/* Burst access to the LoRa FIFO */
+static void lora_fifo_access
+	(
+	uint8_t* data_ptr,
+	uint8_t  size    ,
+	bool     write
+	);
+
+/* Load the oldest queued packet and start transmitting it */
+static void lora_tx_start
+	(
+	void
+	);
+
+/* Return to continuous receive */
+static void lora_rx_start
+	(
+	void
+	);
+
+/* Read a received packet out of the FIFO */
+static void lora_rx_packet
+	(
+	uint8_t irq_flags
+	);
+#endif /* #ifdef LORA_SPI */
+
 
 /*------------------------------------------------------------------------------
  Procedures 
@@ -43,6 +239,7 @@ Global Variables
 *                                                                              *
 * DESCRIPTION:                                                                 *
 * 		transmits a byte wirelessly using the xbee module                      *
+*       Returns RF_BUSY once rf_xbee_init has started API mode                 *
 *                                                                              *
 *******************************************************************************/
 RF_STATUS rf_xbee_transmit_byte 
@@ -66,6 +263,12 @@ hal_status = HAL_OK;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The API mode driver owns the UART */
+if ( xbee_api_active )
+	{
+	return RF_BUSY;
+	}
+
 /* Wait for Clear to send signal */
 #ifdef GROUND_STATION
 while ( HAL_GPIO_ReadPin( XBEE_CTS_GPIO_PORT, XBEE_CTS_PIN ) != GPIO_PIN_RESET )
@@ -99,6 +302,7 @@ else
 *                                                                              *
 * DESCRIPTION:                                                                 *
 * 		transmits a buffer of bytes wirelessly using the xbee module           *
+*       Returns RF_BUSY once rf_xbee_init has started API mode                 *
 *                                                                              *
 *******************************************************************************/
 RF_STATUS rf_xbee_transmit
@@ -125,6 +329,12 @@ timeout    = RF_POLL_TIMEOUT*buffer_size;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The API mode driver owns the UART */
+if ( xbee_api_active )
+	{
+	return RF_BUSY;
+	}
+
 /* Transmit byte */
 hal_status = HAL_UART_Transmit( &( XBEE_HUART ),
                                 tx_buffer_ptr  , 
@@ -151,6 +361,7 @@ else
 *                                                                              *
 * DESCRIPTION:                                                                 *
 * 		Receives a byte from the xbee module                                   *
+*       Returns RF_BUSY once rf_xbee_init has started API mode                 *
 *                                                                              *
 *******************************************************************************/
 RF_STATUS rf_xbee_receive_byte 
@@ -174,6 +385,12 @@ hal_status = HAL_OK;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The API mode driver owns the UART */
+if ( xbee_api_active )
+	{
+	return RF_BUSY;
+	}
+
 /* Set the Ready to Send Signal */
 #ifdef GROUND_STATION
 HAL_GPIO_WritePin( XBEE_RTS_GPIO_PORT, XBEE_RTS_PIN, GPIO_PIN_RESET );
@@ -216,6 +433,7 @@ switch ( hal_status )
 *                                                                              *
 * DESCRIPTION:                                                                 *
 * 		Receives data from the xbee module and outputs to a buffer             *
+*       Returns RF_BUSY once rf_xbee_init has started API mode                 *
 *                                                                              *
 *******************************************************************************/
 RF_STATUS rf_xbee_receive
@@ -242,11 +460,17 @@ timeout    = rx_buffer_size*RF_POLL_TIMEOUT;
  API Function Implementation 
 ------------------------------------------------------------------------------*/
 
+/* The API mode driver owns the UART */
+if ( xbee_api_active )
+	{
+	return RF_BUSY;
+	}
+
 /* Receive data */
 hal_status = HAL_UART_Receive( &( XBEE_HUART ),
                                rx_buffer_ptr  , 
-                               timeout        , 
-                               RF_POLL_TIMEOUT );
+                               rx_buffer_size , 
+                               timeout );
 
 /* Return HAL status */
 switch ( hal_status )
@@ -267,6 +491,1537 @@ switch ( hal_status )
 } /* rf_xbee_receive */
 
 
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_init                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start the XBee API mode driver. The module must be configured for API  *
+*       mode with escaping (AP=2). Receives through a circular DMA ring and    *
+*       holds RTS asserted, the ring is drained from the receive interrupt     *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_xbee_init
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+tx_head       = 0;
+tx_tail       = 0;
+tx_offset     = 0;
+tx_active     = false;
+tx_retry      = false;
+rx_head       = 0;
+rx_tail       = 0;
+rx_pos_parsed = 0;
+rx_state      = XBEE_RX_WAIT_START;
+rx_escape     = false;
+memset( (void*) &tx_delivery[0], XBEE_DELIVERY_PENDING, sizeof( tx_delivery ) );
+memset( &xbee_stats, 0, sizeof( xbee_stats ) );
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+if ( HAL_UARTEx_ReceiveToIdle_DMA( &( XBEE_HUART ), 
+                                   rx_buffer      , 
+                                   XBEE_RX_BUFFER_SIZE ) != HAL_OK )
+	{
+	return RF_ERROR;
+	}
+
+/* Ready to receive, the blocking calls are locked out from here on */
+xbee_api_active = true;
+#ifdef GROUND_STATION
+	HAL_GPIO_WritePin( XBEE_RTS_GPIO_PORT, XBEE_RTS_PIN, GPIO_PIN_RESET );
+#endif
+return RF_OK;
+} /* rf_xbee_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_send                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Queue a packet as an XBee transmit request and return without waiting  *
+*       for the radio. The frame ID identifies the transmit status the module  *
+*       returns once the packet is delivered or given up on                    *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_xbee_send
+	(
+	uint64_t    dest_addr   ,   /* 64-bit destination address       */
+	const void* data_ptr    ,   /* Payload                          */
+	size_t      size        ,   /* Payload size                     */
+	uint8_t*    frame_id_ptr    /* Frame ID for the delivery status */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t*       frame_ptr;  /* Frame being written            */
+const uint8_t* byte_ptr;   /* Payload bytes                  */
+uint16_t       pos;        /* Write position in the frame    */
+uint16_t       length;     /* Frame data length              */
+uint8_t        sum;        /* Frame data sum                 */
+uint8_t        header[XBEE_TX_HEADER_SIZE]; /* Frame data header */
+uint8_t        i;          /* Loop counter                   */
+size_t         j;          /* Payload index                  */
+uint32_t       primask;    /* Interrupt mask state at entry  */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+if ( size > RF_MAX_PAYLOAD )
+	{
+	return RF_TOO_LONG;
+	}
+if ( rf_xbee_tx_pending() >= XBEE_TX_QUEUE_DEPTH )
+	{
+	/* rf_xbee_tx_pending restarted a refused transfer */
+	return RF_BUSY;
+	}
+
+/* Frame ID 0 asks for no status, skip it */
+tx_frame_id++;
+if ( tx_frame_id == 0 )
+	{
+	tx_frame_id = 1;
+	}
+tx_delivery[tx_frame_id] = XBEE_DELIVERY_PENDING;
+
+header[0] = XBEE_API_TX_REQUEST;
+header[1] = tx_frame_id;
+for ( i = 0; i < 8; ++i )
+	{
+	header[2 + i] = (uint8_t) ( dest_addr >> ( 56 - 8*i ) );
+	}
+header[10] = 0xFF;  /* 16-bit address unknown */
+header[11] = 0xFE;
+header[12] = 0x00;  /* Maximum broadcast radius */
+header[13] = 0x00;  /* Module default options  */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+
+/* Only the application writes the head, build the frame in place */
+frame_ptr    = &( tx_frames[tx_head & XBEE_TX_MASK][0] );
+byte_ptr     = data_ptr;
+length       = XBEE_TX_HEADER_SIZE + size;
+sum          = 0;
+frame_ptr[0] = XBEE_START;
+pos          = xbee_put( frame_ptr, 1  , (uint8_t) ( length >> 8 ) );
+pos          = xbee_put( frame_ptr, pos, (uint8_t) length          );
+for ( i = 0; i < XBEE_TX_HEADER_SIZE; ++i )
+	{
+	sum += header[i];
+	pos  = xbee_put( frame_ptr, pos, header[i] );
+	}
+for ( j = 0; j < size; ++j )
+	{
+	sum += byte_ptr[j];
+	pos  = xbee_put( frame_ptr, pos, byte_ptr[j] );
+	}
+pos = xbee_put( frame_ptr, pos, 0xFF - sum );
+tx_sizes[tx_head & XBEE_TX_MASK] = pos;
+
+#if defined( __DCACHE_PRESENT ) && ( __DCACHE_PRESENT == 1U )
+	SCB_CleanDCache_by_Addr( frame_ptr, XBEE_TX_FRAME_SIZE );
+#endif
+
+/* Publish and start the DMA if idle, without racing the complete ISR */
+primask = __get_PRIMASK();
+__disable_irq();
+tx_head++;
+if ( !tx_active )
+	{
+	xbee_tx_start();
+	}
+__set_PRIMASK( primask );
+
+if ( frame_id_ptr != NULL )
+	{
+	*frame_id_ptr = tx_frame_id;
+	}
+return RF_OK;
+} /* rf_xbee_send */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_get_delivery                                                   *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the delivery status of a sent packet. Returns RF_PENDING until the *
+*       module reports the transmit status. Frame IDs wrap after 255 packets   *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_xbee_get_delivery
+	(
+	uint8_t  frame_id  ,   /* Frame ID from rf_xbee_send  */
+	uint8_t* status_ptr    /* XBee delivery status code   */
+	)
+{
+*status_ptr = tx_delivery[frame_id];
+if ( *status_ptr == XBEE_DELIVERY_PENDING )
+	{
+	return RF_PENDING;
+	}
+return RF_OK;
+} /* rf_xbee_get_delivery */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_receive_packet                                                 *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the oldest received packet. Lock free, must only be called from one*
+*       context                                                                *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_xbee_receive_packet
+	(
+	RF_PACKET* packet_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t tail; /* Local copy of the queue tail */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+tail = rx_tail;
+if ( tail == rx_head )
+	{
+	return RF_EMPTY;
+	}
+
+/* Copy out before handing the entry back to the ISR */
+*packet_ptr = rx_queue[tail & XBEE_RX_QUEUE_MASK];
+__DMB();
+rx_tail     = tail + 1;
+return RF_OK;
+} /* rf_xbee_receive_packet */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_tx_pending                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Number of queued packets not yet written to the module, including the  *
+*       one in progress. Restarts a transfer the HAL refused to start, so a    *
+*       caller waiting for the queue to drain cannot wait forever              *
+*                                                                              *
+*******************************************************************************/
+uint8_t rf_xbee_tx_pending
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t primask; /* Interrupt mask state at entry */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+if ( tx_retry )
+	{
+	primask = __get_PRIMASK();
+	__disable_irq();
+	xbee_tx_start();
+	__set_PRIMASK( primask );
+	}
+return (uint8_t) ( tx_head - tx_tail );
+} /* rf_xbee_tx_pending */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_get_stats                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the XBee API driver statistics                                     *
+*                                                                              *
+*******************************************************************************/
+void rf_xbee_get_stats
+	(
+	RF_XBEE_STATS* stats_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t primask; /* Interrupt mask state at entry */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+primask = __get_PRIMASK();
+__disable_irq();
+*stats_ptr = xbee_stats;
+__set_PRIMASK( primask );
+} /* rf_xbee_get_stats */
+
+
+#ifdef LORA_SPI
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_lora_init                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start the LoRa driver. Resets the radio, checks the silicon revision,  *
+*       programs the modem and enters continuous receive with DIO0 signalling  *
+*       receive done. Spreading factor 6 needs implicit headers and is not     *
+*       supported                                                              *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_lora_init
+	(
+	const RF_LORA_CONFIG* config_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint64_t  frf;        /* Carrier frequency register value        */
+uint32_t  symbol_us;  /* Symbol time, us                         */
+uint8_t   modem_cfg3; /* Modem config 3, AGC and LDRO            */
+RF_STATUS status;     /* Register write status                   */
+
+
+/*------------------------------------------------------------------------------
+ Initializations 
+------------------------------------------------------------------------------*/
+if ( ( config_ptr->spreading_factor < 7  ) || 
+     ( config_ptr->spreading_factor > 12 ) || 
+     ( config_ptr->bandwidth > RF_LORA_BW_500K ) || 
+     ( config_ptr->coding_rate < 1 ) || ( config_ptr->coding_rate > 4 ) || 
+     ( config_ptr->preamble_length < 6 ) || 
+     ( config_ptr->tx_power < 2 ) || ( config_ptr->tx_power > 20 ) )
+	{
+	return RF_ERROR;
+	}
+lora_config    = *config_ptr;
+lora_tx_head   = 0;
+lora_tx_tail   = 0;
+lora_tx_active = false;
+lora_rx_head   = 0;
+lora_rx_tail   = 0;
+memset( &lora_stats, 0, sizeof( lora_stats ) );
+frf        = ( (uint64_t) lora_config.frequency << 19 ) / LORA_FXOSC;
+symbol_us  = (uint32_t) ( ( 1000000ULL << lora_config.spreading_factor ) / 
+                          lora_bw_hz[lora_config.bandwidth] );
+modem_cfg3 = 0x04; /* AGC on */
+if ( symbol_us > LORA_LDRO_SYMBOL_TIME )
+	{
+	modem_cfg3 |= 0x08;
+	}
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+
+/* Hardware reset */
+HAL_GPIO_WritePin( LORA_RST_GPIO_PORT, LORA_RST_PIN, GPIO_PIN_RESET );
+HAL_Delay( 1 );
+HAL_GPIO_WritePin( LORA_RST_GPIO_PORT, LORA_RST_PIN, GPIO_PIN_SET   );
+HAL_Delay( 10 );
+if ( lora_read_reg( LORA_REG_VERSION ) != LORA_VERSION )
+	{
+	return RF_ERROR;
+	}
+
+/* The LoRa modem can only be selected in sleep */
+status  = lora_write_reg( LORA_REG_OP_MODE, LORA_MODE_SLEEP );
+status |= lora_write_reg( LORA_REG_OP_MODE, 
+                          LORA_MODE_LONG_RANGE | LORA_MODE_SLEEP );
+
+/* Carrier and the whole FIFO for each direction, one is used at a time */
+status |= lora_write_reg( LORA_REG_FRF_MSB, (uint8_t) ( frf >> 16 ) );
+status |= lora_write_reg( LORA_REG_FRF_MID, (uint8_t) ( frf >> 8  ) );
+status |= lora_write_reg( LORA_REG_FRF_LSB, (uint8_t) ( frf       ) );
+status |= lora_write_reg( LORA_REG_FIFO_TX_BASE_ADDR, 0 );
+status |= lora_write_reg( LORA_REG_FIFO_RX_BASE_ADDR, 0 );
+
+/* PA_BOOST output, the high power DAC and a higher current limit above 
+   17 dBm */
+if ( lora_config.tx_power > 17 )
+	{
+	status |= lora_write_reg( LORA_REG_PA_DAC   , 0x87 );
+	status |= lora_write_reg( LORA_REG_OCP      , 0x31 );
+	status |= lora_write_reg( LORA_REG_PA_CONFIG, 
+	                          0x80 | ( lora_config.tx_power - 5 ) );
+	}
+else
+	{
+	status |= lora_write_reg( LORA_REG_PA_DAC   , 0x84 );
+	status |= lora_write_reg( LORA_REG_OCP      , 0x2B );
+	status |= lora_write_reg( LORA_REG_PA_CONFIG, 
+	                          0x80 | ( lora_config.tx_power - 2 ) );
+	}
+status |= lora_write_reg( LORA_REG_LNA, 0x23 ); /* Max gain, LNA boost */
+
+/* Modem, explicit header with payload CRC */
+status |= lora_write_reg( LORA_REG_MODEM_CONFIG_1, 
+                          ( lora_config.bandwidth   << 4 ) | 
+                          ( lora_config.coding_rate << 1 ) );
+status |= lora_write_reg( LORA_REG_MODEM_CONFIG_2, 
+                          ( lora_config.spreading_factor << 4 ) | 0x04 );
+status |= lora_write_reg( LORA_REG_MODEM_CONFIG_3, modem_cfg3 );
+status |= lora_write_reg( LORA_REG_PREAMBLE_MSB, 
+                          (uint8_t) ( lora_config.preamble_length >> 8 ) );
+status |= lora_write_reg( LORA_REG_PREAMBLE_LSB, 
+                          (uint8_t) ( lora_config.preamble_length      ) );
+status |= lora_write_reg( LORA_REG_DETECT_OPTIMIZE , 0xC3 );
+status |= lora_write_reg( LORA_REG_DETECT_THRESHOLD, 0x0A );
+status |= lora_write_reg( LORA_REG_SYNC_WORD, lora_config.sync_word );
+status |= lora_write_reg( LORA_REG_OP_MODE, 
+                          LORA_MODE_LONG_RANGE | LORA_MODE_STDBY );
+if ( status != RF_OK )
+	{
+	return RF_ERROR;
+	}
+
+lora_rx_start();
+return RF_OK;
+} /* rf_lora_init */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_lora_send                                                           *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Queue a packet for transmission and return without waiting for the     *
+*       radio. Queued packets go out back to back from the transmit done       *
+*       interrupt, the radio returns to receive once the queue is empty        *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_lora_send
+	(
+	const void* data_ptr,   /* Payload          */
+	size_t      size        /* Payload size     */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t  slot;    /* Queue entry to fill            */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+if ( size == 0 )
+	{
+	return RF_ERROR;
+	}
+if ( size > RF_MAX_PAYLOAD )
+	{
+	return RF_TOO_LONG;
+	}
+if ( rf_lora_tx_pending() >= LORA_TX_QUEUE_DEPTH )
+	{
+	return RF_BUSY;
+	}
+
+/* Only the application writes the head, fill the entry first */
+slot = lora_tx_head & LORA_TX_MASK;
+memcpy( &( lora_tx_data[slot][0] ), data_ptr, size );
+lora_tx_size[slot] = (uint8_t) size;
+
+/* Publish and start the radio if idle. The DIO0 interrupt also drives the 
+   SPI bus, mask it alone while the FIFO is loaded so the rest of the system
+   keeps running through the blocking transfers */
+HAL_NVIC_DisableIRQ( LORA_DIO0_IRQn );
+lora_tx_head++;
+if ( !lora_tx_active )
+	{
+	lora_tx_start();
+	}
+HAL_NVIC_EnableIRQ( LORA_DIO0_IRQn );
+return RF_OK;
+} /* rf_lora_send */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_lora_receive_packet                                                 *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the oldest received LoRa packet. LoRa has no addressing, the source*
+*       is always 0. Lock free, must only be called from one context           *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_lora_receive_packet
+	(
+	RF_PACKET* packet_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t tail; /* Local copy of the queue tail */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+tail = lora_rx_tail;
+if ( tail == lora_rx_head )
+	{
+	return RF_EMPTY;
+	}
+*packet_ptr  = lora_rx_queue[tail & LORA_RX_QUEUE_MASK];
+__DMB();
+lora_rx_tail = tail + 1;
+return RF_OK;
+} /* rf_lora_receive_packet */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_lora_tx_pending                                                     *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Number of queued LoRa packets not yet sent, including the one on air   *
+*                                                                              *
+*******************************************************************************/
+uint8_t rf_lora_tx_pending
+	(
+	void
+	)
+{
+return (uint8_t) ( lora_tx_head - lora_tx_tail );
+} /* rf_lora_tx_pending */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_lora_time_on_air                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Time on air of a packet with the configured modem settings, following  *
+*       the SX127x datasheet for an explicit header and payload CRC. Used to   *
+*       size telemetry batches to the channel time available                   *
+*                                                                              *
+*******************************************************************************/
+uint32_t rf_lora_time_on_air
+	(
+	size_t size     /* Payload size */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t  sf;           /* Spreading factor                        */
+uint8_t  de;           /* Low data rate optimization              */
+uint64_t symbol_ns;    /* Symbol time, ns                         */
+int32_t  num;          /* Payload symbol numerator                */
+int32_t  den;          /* Payload symbol denominator              */
+uint32_t num_symbols;  /* Payload symbols                         */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+sf        = lora_config.spreading_factor;
+symbol_ns = ( 1000000000ULL << sf ) / lora_bw_hz[lora_config.bandwidth];
+de        = ( symbol_ns > LORA_LDRO_SYMBOL_TIME*1000ULL ) ? 1 : 0;
+
+/* 8 + max( ceil( ( 8PL - 4SF + 28 + 16 ) / 4( SF - 2DE ) )( CR + 4 ), 0 ) */
+num         = 8*(int32_t) size - 4*sf + 28 + 16;
+den         = 4*( sf - 2*de );
+num_symbols = 8;
+if ( num > 0 )
+	{
+	num_symbols += ( ( num + den - 1 )/den )*( lora_config.coding_rate + 4 );
+	}
+
+/* Preamble adds 4.25 symbols of sync */
+return (uint32_t) ( ( symbol_ns*( 4*( lora_config.preamble_length + 
+                                      num_symbols ) + 17 ) )/4000 );
+} /* rf_lora_time_on_air */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_lora_max_payload                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Largest payload whose time on air fits a budget, 0 if none fits        *
+*                                                                              *
+*******************************************************************************/
+size_t rf_lora_max_payload
+	(
+	uint32_t max_time_us
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+size_t low;  /* Largest size known to fit        */
+size_t high; /* Smallest size known not to fit   */
+size_t mid;  /* Size under test                  */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+
+/* Time on air grows with size, binary search */
+if ( rf_lora_time_on_air( RF_MAX_PAYLOAD ) <= max_time_us )
+	{
+	return RF_MAX_PAYLOAD;
+	}
+low  = 0;
+high = RF_MAX_PAYLOAD;
+while ( high - low > 1 )
+	{
+	mid = ( low + high )/2;
+	if ( rf_lora_time_on_air( mid ) <= max_time_us )
+		{
+		low = mid;
+		}
+	else
+		{
+		high = mid;
+		}
+	}
+if ( ( low == 0 ) && ( rf_lora_time_on_air( 1 ) <= max_time_us ) )
+	{
+	low = 1;
+	}
+return low;
+} /* rf_lora_max_payload */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_lora_get_stats                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the LoRa driver statistics                                         *
+*                                                                              *
+*******************************************************************************/
+void rf_lora_get_stats
+	(
+	RF_LORA_STATS* stats_ptr
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint32_t primask; /* Interrupt mask state at entry */
+
+
+/*------------------------------------------------------------------------------
+ API Function Implementation 
+------------------------------------------------------------------------------*/
+primask = __get_PRIMASK();
+__disable_irq();
+*stats_ptr = lora_stats;
+__set_PRIMASK( primask );
+} /* rf_lora_get_stats */
+#endif /* #ifdef LORA_SPI */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_send                                                                *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Queue a packet on a radio. The XBee sends to dest_addr, LoRa has no    *
+*       addressing and every receiver in range gets the packet                 *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_send
+	(
+	WIRELESS_MOD_CODES module   ,
+	uint64_t           dest_addr,
+	const void*        data_ptr ,
+	size_t             size
+	)
+{
+switch ( module )
+	{
+#ifdef LORA_SPI
+	case LORA:
+		{
+		return rf_lora_send( data_ptr, size );
+		}
+#endif
+	case XBEE:
+		{
+		return rf_xbee_send( dest_addr, data_ptr, size, NULL );
+		}
+	default:
+		{
+		return RF_ERROR;
+		}
+	}
+} /* rf_send */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_receive_packet                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Get the oldest packet received by a radio                              *
+*                                                                              *
+*******************************************************************************/
+RF_STATUS rf_receive_packet
+	(
+	WIRELESS_MOD_CODES module    ,
+	RF_PACKET*         packet_ptr
+	)
+{
+switch ( module )
+	{
+#ifdef LORA_SPI
+	case LORA:
+		{
+		return rf_lora_receive_packet( packet_ptr );
+		}
+#endif
+	case XBEE:
+		{
+		return rf_xbee_receive_packet( packet_ptr );
+		}
+	default:
+		{
+		return RF_ERROR;
+		}
+	}
+} /* rf_receive_packet */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_tx_pending                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Number of packets queued on a radio and not yet sent                   *
+*                                                                              *
+*******************************************************************************/
+uint8_t rf_tx_pending
+	(
+	WIRELESS_MOD_CODES module
+	)
+{
+switch ( module )
+	{
+#ifdef LORA_SPI
+	case LORA:
+		{
+		return rf_lora_tx_pending();
+		}
+#endif
+	case XBEE:
+		{
+		return rf_xbee_tx_pending();
+		}
+	default:
+		{
+		return 0;
+		}
+	}
+} /* rf_tx_pending */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_max_payload                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Largest payload a radio sends within a time on air. LoRa time on air   *
+*       follows the modem settings, the XBee is taken as RF_MAX_PAYLOAD        *
+*                                                                              *
+*******************************************************************************/
+size_t rf_max_payload
+	(
+	WIRELESS_MOD_CODES module     ,
+	uint32_t           max_time_us
+	)
+{
+switch ( module )
+	{
+#ifdef LORA_SPI
+	case LORA:
+		{
+		return rf_lora_max_payload( max_time_us );
+		}
+#endif
+	case XBEE:
+		{
+		return RF_MAX_PAYLOAD;
+		}
+	default:
+		{
+		return 0;
+		}
+	}
+} /* rf_max_payload */
+
+
+/*------------------------------------------------------------------------------
+ Interrupt Service Routines 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_tx_complete_ISR                                                *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Transmit complete interrupt, call from HAL_UART_TxCpltCallback. Moves  *
+*       on to the next chunk or frame                                          *
+*                                                                              *
+*******************************************************************************/
+void rf_xbee_tx_complete_ISR
+	(
+	void
+	)
+{
+if ( !tx_active )
+	{
+	return;
+	}
+tx_active  = false;
+tx_offset += tx_chunk;
+if ( tx_offset >= tx_sizes[tx_tail & XBEE_TX_MASK] )
+	{
+	xbee_stats.tx_frames++;
+	tx_offset = 0;
+	tx_tail++;
+	}
+xbee_tx_start();
+} /* rf_xbee_tx_complete_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_cts_ISR                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       CTS interrupt, call from HAL_GPIO_EXTI_Callback on the falling edge of *
+*       the XBee CTS pin. Resumes a transfer held back by flow control         *
+*                                                                              *
+*******************************************************************************/
+void rf_xbee_cts_ISR
+	(
+	void
+	)
+{
+if ( !tx_active )
+	{
+	xbee_tx_start();
+	}
+} /* rf_xbee_cts_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_rx_event_ISR                                                   *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Receive event interrupt, call from HAL_UARTEx_RxEventCallback. Parses  *
+*       every byte received since the last half, full or idle line event       *
+*                                                                              *
+*******************************************************************************/
+void rf_xbee_rx_event_ISR
+	(
+	uint16_t rx_pos     /* Write position in the DMA ring */
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint16_t pos; /* Ring read position */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+rx_pos &= XBEE_RX_MASK;
+pos     = rx_pos_parsed;
+if ( pos == rx_pos )
+	{
+	return;
+	}
+#if defined( __DCACHE_PRESENT ) && ( __DCACHE_PRESENT == 1U )
+	SCB_InvalidateDCache_by_Addr( rx_buffer, XBEE_RX_BUFFER_SIZE );
+#endif
+while ( pos != rx_pos )
+	{
+	xbee_parse_byte( rx_buffer[pos] );
+	pos = ( pos + 1 ) & XBEE_RX_MASK;
+	}
+rx_pos_parsed = pos;
+} /* rf_xbee_rx_event_ISR */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_xbee_error_ISR                                                      *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       UART error interrupt, call from HAL_UART_ErrorCallback. An error that  *
+*       stopped the receive DMA restarts the ring and the parser, noise,       *
+*       framing and parity errors leave both running and the frame checksum    *
+*       catches the damaged byte. A failed transmit chunk is resent            *
+*                                                                              *
+*******************************************************************************/
+void rf_xbee_error_ISR
+	(
+	void
+	)
+{
+if ( XBEE_HUART.ErrorCode == HAL_UART_ERROR_NONE )
+	{
+	return;
+	}
+
+/* The HAL leaves the receiver ready once it has aborted the receive DMA */
+if ( ( XBEE_HUART.ErrorCode & ( HAL_UART_ERROR_PE  | HAL_UART_ERROR_NE  | 
+                                HAL_UART_ERROR_FE  | HAL_UART_ERROR_ORE | 
+                                HAL_UART_ERROR_RTO ) ) || 
+     ( XBEE_HUART.RxState == HAL_UART_STATE_READY    ) )
+	{
+	xbee_stats.uart_rx_errors++;
+	}
+if ( ( XBEE_HUART.RxState == HAL_UART_STATE_READY ) && 
+     ( HAL_UARTEx_ReceiveToIdle_DMA( &( XBEE_HUART ), rx_buffer, 
+                                     XBEE_RX_BUFFER_SIZE ) == HAL_OK ) )
+	{
+	rx_pos_parsed = 0;
+	rx_state      = XBEE_RX_WAIT_START;
+	rx_escape     = false;
+	}
+
+/* The transmit DMA was aborted, send the chunk again */
+if ( tx_active && ( XBEE_HUART.gState == HAL_UART_STATE_READY ) )
+	{
+	xbee_stats.uart_tx_errors++;
+	tx_active = false;
+	xbee_tx_start();
+	}
+} /* rf_xbee_error_ISR */
+
+
+#ifdef LORA_SPI
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		rf_lora_dio0_ISR                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       DIO0 interrupt, call from HAL_GPIO_EXTI_Callback on the rising edge of *
+*       the LoRa DIO0 pin. Signals transmit done while sending and receive done*
+*       while listening                                                        *
+*                                                                              *
+*******************************************************************************/
+void rf_lora_dio0_ISR
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t irq_flags; /* Radio interrupt flags */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+irq_flags = lora_read_reg( LORA_REG_IRQ_FLAGS );
+lora_write_reg( LORA_REG_IRQ_FLAGS, irq_flags );
+
+if ( lora_tx_active )
+	{
+	/* A packet that ended as the transmit started was overwritten by it */
+	if ( irq_flags & LORA_IRQ_RX_DONE )
+		{
+		lora_stats.rx_lost++;
+		}
+	if ( irq_flags & LORA_IRQ_TX_DONE )
+		{
+		lora_stats.tx_packets++;
+		lora_tx_active = false;
+		lora_tx_tail++;
+		if ( lora_tx_head != lora_tx_tail )
+			{
+			lora_tx_start();
+			}
+		else
+			{
+			lora_rx_start();
+			}
+		}
+	}
+else if ( irq_flags & LORA_IRQ_RX_DONE )
+	{
+	lora_rx_packet( irq_flags );
+	}
+} /* rf_lora_dio0_ISR */
+#endif /* #ifdef LORA_SPI */
+
+
+/*------------------------------------------------------------------------------
+ Internal procedures 
+------------------------------------------------------------------------------*/
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		xbee_put                                                               *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Append a byte to a transmit frame, escaping the start delimiter, escape*
+*       and software flow control characters. Returns the next write position  *
+*                                                                              *
+*******************************************************************************/
+static uint16_t xbee_put
+	(
+	uint8_t* frame_ptr,
+	uint16_t pos      ,
+	uint8_t  byte
+	)
+{
+if ( ( byte == XBEE_START ) || ( byte == XBEE_ESCAPE ) || 
+     ( byte == XBEE_XON   ) || ( byte == XBEE_XOFF   ) )
+	{
+	frame_ptr[pos++] = XBEE_ESCAPE;
+	byte            ^= XBEE_ESCAPE_XOR;
+	}
+frame_ptr[pos++] = byte;
+return pos;
+} /* xbee_put */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		xbee_tx_start                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Start or continue the DMA transfer of the oldest queued frame. With CTS*
+*       flow control the frame goes out in chunks and a chunk only starts while*
+*       CTS is asserted, otherwise the CTS interrupt resumes the transfer. Must*
+*       be called with the transmit complete interrupt unable to preempt       *
+*                                                                              *
+*******************************************************************************/
+static void xbee_tx_start
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t  slot;  /* Frame being sent  */
+uint16_t chunk; /* Bytes to send     */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( tx_active || ( tx_head == tx_tail ) )
+	{
+	return;
+	}
+slot  = tx_tail & XBEE_TX_MASK;
+chunk = tx_sizes[slot] - tx_offset;
+
+#ifdef GROUND_STATION
+	/* Module buffer full, wait for the CTS interrupt */
+	if ( HAL_GPIO_ReadPin( XBEE_CTS_GPIO_PORT, XBEE_CTS_PIN ) != GPIO_PIN_RESET )
+		{
+		xbee_stats.cts_stalls++;
+		return;
+		}
+	if ( chunk > XBEE_CTS_CHUNK )
+		{
+		chunk = XBEE_CTS_CHUNK;
+		}
+#endif
+
+tx_chunk  = chunk;
+tx_active = true;
+tx_retry  = false;
+if ( HAL_UART_Transmit_DMA( &( XBEE_HUART )                 , 
+                            &( tx_frames[slot][tx_offset] ), 
+                            chunk ) != HAL_OK )
+	{
+	/* Retried by rf_xbee_tx_pending, the next send or a CTS edge */
+	tx_active = false;
+	tx_retry  = true;
+	}
+} /* xbee_tx_start */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		xbee_parse_byte                                                        *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Feed one received byte to the API frame parser. A start delimiter      *
+*       always begins a new frame, so a corrupt frame costs at most itself     *
+*                                                                              *
+*******************************************************************************/
+static void xbee_parse_byte
+	(
+	uint8_t byte
+	)
+{
+/* Resynchronize on every start delimiter */
+if ( byte == XBEE_START )
+	{
+	if ( rx_state != XBEE_RX_WAIT_START )
+		{
+		xbee_stats.rx_errors++;
+		}
+	rx_state  = XBEE_RX_LENGTH_MSB;
+	rx_escape = false;
+	return;
+	}
+if ( rx_state == XBEE_RX_WAIT_START )
+	{
+	return;
+	}
+if ( byte == XBEE_ESCAPE )
+	{
+	rx_escape = true;
+	return;
+	}
+if ( rx_escape )
+	{
+	byte     ^= XBEE_ESCAPE_XOR;
+	rx_escape = false;
+	}
+
+switch ( rx_state )
+	{
+	case XBEE_RX_LENGTH_MSB:
+		{
+		rx_length = (uint16_t) byte << 8;
+		rx_state  = XBEE_RX_LENGTH_LSB;
+		break;
+		}
+	case XBEE_RX_LENGTH_LSB:
+		{
+		rx_length |= byte;
+		rx_count   = 0;
+		rx_sum     = 0;
+		if ( ( rx_length == 0 ) || ( rx_length > XBEE_RX_FRAME_MAX ) )
+			{
+			xbee_stats.rx_errors++;
+			rx_state = XBEE_RX_WAIT_START;
+			}
+		else
+			{
+			rx_state = XBEE_RX_DATA;
+			}
+		break;
+		}
+	case XBEE_RX_DATA:
+		{
+		rx_frame[rx_count++] = byte;
+		rx_sum              += byte;
+		if ( rx_count == rx_length )
+			{
+			rx_state = XBEE_RX_CHECKSUM;
+			}
+		break;
+		}
+	case XBEE_RX_CHECKSUM:
+		{
+		rx_state = XBEE_RX_WAIT_START;
+		if ( (uint8_t) ( rx_sum + byte ) != 0xFF )
+			{
+			xbee_stats.rx_errors++;
+			}
+		else
+			{
+			xbee_frame_received();
+			}
+		break;
+		}
+	default:
+		{
+		rx_state = XBEE_RX_WAIT_START;
+		break;
+		}
+	}
+} /* xbee_parse_byte */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		xbee_frame_received                                                    *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Handle a received API frame. Transmit status frames update the delivery*
+*       table, receive packets are queued for the application and other frame  *
+*       types are ignored                                                      *
+*                                                                              *
+*******************************************************************************/
+static void xbee_frame_received
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+RF_PACKET* packet_ptr; /* Queue entry   */
+uint8_t    i;          /* Address byte  */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+switch ( rx_frame[0] )
+	{
+	/* API ID, frame ID, 16-bit address, retries, delivery, discovery */
+	case XBEE_API_TX_STATUS:
+		{
+		if ( rx_length < 7 )
+			{
+			xbee_stats.rx_errors++;
+			break;
+			}
+		tx_delivery[rx_frame[1]] = rx_frame[5];
+		if ( rx_frame[5] == XBEE_DELIVERY_SUCCESS )
+			{
+			xbee_stats.tx_delivered++;
+			}
+		else
+			{
+			xbee_stats.tx_failed++;
+			}
+		break;
+		}
+
+	case XBEE_API_RX_PACKET:
+		{
+		if ( rx_length < XBEE_RX_HEADER_SIZE )
+			{
+			xbee_stats.rx_errors++;
+			break;
+			}
+		if ( (uint8_t) ( rx_head - rx_tail ) >= XBEE_RX_QUEUE_DEPTH )
+			{
+			xbee_stats.rx_drops++;
+			break;
+			}
+		packet_ptr         = &( rx_queue[rx_head & XBEE_RX_QUEUE_MASK] );
+		packet_ptr->source = 0;
+		for ( i = 0; i < 8; ++i )
+			{
+			packet_ptr->source = ( packet_ptr->source << 8 ) | rx_frame[1 + i];
+			}
+		packet_ptr->options = rx_frame[11];
+		packet_ptr->length  = rx_length - XBEE_RX_HEADER_SIZE;
+		memcpy( &( packet_ptr->payload[0] ), &( rx_frame[XBEE_RX_HEADER_SIZE] ), 
+		        packet_ptr->length );
+		__DMB();
+		rx_head++;
+		xbee_stats.rx_packets++;
+		break;
+		}
+
+	default:
+		{
+		break;
+		}
+	}
+} /* xbee_frame_received */
+
+
+#ifdef LORA_SPI
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lora_write_reg                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Write a LoRa register                                                  *
+*                                                                              *
+*******************************************************************************/
+static RF_STATUS lora_write_reg
+	(
+	uint8_t reg  ,
+	uint8_t value
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+HAL_StatusTypeDef hal_status;  /* Status code returned by SPI HAL */
+uint8_t           tx_data[2];  /* Address and value               */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+tx_data[0] = reg | LORA_SPI_WRITE;
+tx_data[1] = value;
+HAL_GPIO_WritePin( LORA_SS_GPIO_PORT, LORA_SS_PIN, GPIO_PIN_RESET );
+hal_status = HAL_SPI_Transmit( &( LORA_SPI ), tx_data, sizeof( tx_data ), 
+                               HAL_DEFAULT_TIMEOUT );
+HAL_GPIO_WritePin( LORA_SS_GPIO_PORT, LORA_SS_PIN, GPIO_PIN_SET   );
+if ( hal_status != HAL_OK )
+	{
+	return RF_ERROR;
+	}
+return RF_OK;
+} /* lora_write_reg */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lora_read_reg                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Read a LoRa register                                                   *
+*                                                                              *
+*******************************************************************************/
+static uint8_t lora_read_reg
+	(
+	uint8_t reg
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t value; /* Register value */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+value = 0;
+HAL_GPIO_WritePin( LORA_SS_GPIO_PORT, LORA_SS_PIN, GPIO_PIN_RESET );
+HAL_SPI_Transmit( &( LORA_SPI ), &reg  , sizeof( reg   ), HAL_DEFAULT_TIMEOUT );
+HAL_SPI_Receive ( &( LORA_SPI ), &value, sizeof( value ), HAL_DEFAULT_TIMEOUT );
+HAL_GPIO_WritePin( LORA_SS_GPIO_PORT, LORA_SS_PIN, GPIO_PIN_SET   );
+return value;
+} /* lora_read_reg */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lora_fifo_access                                                       *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Burst read or write of the LoRa FIFO at the current FIFO pointer       *
+*                                                                              *
+*******************************************************************************/
+static void lora_fifo_access
+	(
+	uint8_t* data_ptr,
+	uint8_t  size    ,
+	bool     write
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t addr; /* FIFO register address with the access flag */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+addr = write ? ( LORA_REG_FIFO | LORA_SPI_WRITE ) : LORA_REG_FIFO;
+HAL_GPIO_WritePin( LORA_SS_GPIO_PORT, LORA_SS_PIN, GPIO_PIN_RESET );
+HAL_SPI_Transmit( &( LORA_SPI ), &addr, sizeof( addr ), HAL_DEFAULT_TIMEOUT );
+if ( write )
+	{
+	HAL_SPI_Transmit( &( LORA_SPI ), data_ptr, size, HAL_DEFAULT_TIMEOUT );
+	}
+else
+	{
+	HAL_SPI_Receive ( &( LORA_SPI ), data_ptr, size, HAL_DEFAULT_TIMEOUT );
+	}
+HAL_GPIO_WritePin( LORA_SS_GPIO_PORT, LORA_SS_PIN, GPIO_PIN_SET   );
+} /* lora_fifo_access */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lora_tx_start                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Load the oldest queued packet into the FIFO and start transmitting it, *
+*       DIO0 signals transmit done. Coming out of receive, a packet that       *
+*       arrived while DIO0 was masked is read first. Must be called with the   *
+*       DIO0 interrupt unable to preempt                                       *
+*                                                                              *
+*******************************************************************************/
+static void lora_tx_start
+	(
+	void
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+uint8_t slot;      /* Queue entry to send    */
+uint8_t irq_flags; /* Radio interrupt flags  */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+slot = lora_tx_tail & LORA_TX_MASK;
+lora_write_reg( LORA_REG_OP_MODE, LORA_MODE_LONG_RANGE | LORA_MODE_STDBY );
+
+/* The transmit reuses the FIFO, read a packet received while DIO0 was 
+   masked before it is overwritten */
+if ( !lora_tx_active )
+	{
+	irq_flags = lora_read_reg( LORA_REG_IRQ_FLAGS );
+	if ( irq_flags & LORA_IRQ_RX_DONE )
+		{
+		lora_write_reg( LORA_REG_IRQ_FLAGS, irq_flags );
+		lora_rx_packet( irq_flags );
+		}
+	}
+lora_write_reg( LORA_REG_FIFO_ADDR_PTR, 0 );
+lora_fifo_access( &( lora_tx_data[slot][0] ), lora_tx_size[slot], true );
+lora_write_reg( LORA_REG_PAYLOAD_LENGTH, lora_tx_size[slot] );
+lora_write_reg( LORA_REG_DIO_MAPPING_1, LORA_DIO0_TX_DONE );
+lora_tx_active = true;
+lora_write_reg( LORA_REG_OP_MODE, LORA_MODE_LONG_RANGE | LORA_MODE_TX );
+} /* lora_tx_start */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lora_rx_start                                                          *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Return to continuous receive with DIO0 signalling receive done         *
+*                                                                              *
+*******************************************************************************/
+static void lora_rx_start
+	(
+	void
+	)
+{
+lora_write_reg( LORA_REG_DIO_MAPPING_1, LORA_DIO0_RX_DONE );
+lora_write_reg( LORA_REG_FIFO_ADDR_PTR, 0 );
+lora_write_reg( LORA_REG_OP_MODE, 
+                LORA_MODE_LONG_RANGE | LORA_MODE_RX_CONTINUOUS );
+} /* lora_rx_start */
+
+
+/*******************************************************************************
+*                                                                              *
+* PROCEDURE:                                                                   *
+* 		lora_rx_packet                                                         *
+*                                                                              *
+* DESCRIPTION:                                                                 *
+*       Read a received packet out of the FIFO into the receive queue along    *
+*       with its signal quality. Packets failing the CRC are discarded         *
+*                                                                              *
+*******************************************************************************/
+static void lora_rx_packet
+	(
+	uint8_t irq_flags
+	)
+{
+/*------------------------------------------------------------------------------
+ Local Variables
+------------------------------------------------------------------------------*/
+RF_PACKET* packet_ptr; /* Queue entry            */
+uint8_t    size;       /* Received payload size  */
+
+
+/*------------------------------------------------------------------------------
+ Implementation 
+------------------------------------------------------------------------------*/
+if ( irq_flags & LORA_IRQ_CRC_ERROR )
+	{
+	lora_stats.rx_crc_errors++;
+	return;
+	}
+
+/* Signal quality, the RSSI offset depends on the RF port in use */
+lora_stats.last_snr  = (int8_t) lora_read_reg( LORA_REG_PKT_SNR_VALUE )/4;
+lora_stats.last_rssi = lora_read_reg( LORA_REG_PKT_RSSI_VALUE ) + 
+                       ( ( lora_config.frequency < LORA_LF_MAX_FREQ ) ? 
+                         LORA_RSSI_OFFSET_LF : LORA_RSSI_OFFSET_HF );
+
+if ( (uint8_t) ( lora_rx_head - lora_rx_tail ) >= LORA_RX_QUEUE_DEPTH )
+	{
+	lora_stats.rx_drops++;
+	return;
+	}
+size       = lora_read_reg( LORA_REG_RX_NB_BYTES );
+packet_ptr = &( lora_rx_queue[lora_rx_head & LORA_RX_QUEUE_MASK] );
+lora_write_reg( LORA_REG_FIFO_ADDR_PTR, 
+                lora_read_reg( LORA_REG_FIFO_RX_CURRENT ) );
+lora_fifo_access( &( packet_ptr->payload[0] ), size, false );
+packet_ptr->source  = 0;
+packet_ptr->options = 0;
+packet_ptr->length  = size;
+__DMB();
+lora_rx_head++;
+lora_stats.rx_packets++;
+} /* lora_rx_packet */
+#endif /* #ifdef LORA_SPI */
+
+
 /*******************************************************************************
 * END OF FILE                                                                  *
 *******************************************************************************/
\ No newline at end of file
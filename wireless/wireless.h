@@ -5,7 +5,8 @@
 *
 * DESCRIPTION: 
 * 		Contains API functions to transmit data wirelessly using the XBee and 
-*       and LoRa modules 
+*       and LoRa modules. The XBee runs in API mode over a UART, the LoRa 
+*       driver targets the SX127x over SPI 
 *
 *******************************************************************************/
 
@@ -19,6 +20,14 @@ extern "C" {
 #endif
 
 
+/*------------------------------------------------------------------------------
+ Includes 
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
 /*------------------------------------------------------------------------------
  Typdefs 
 ------------------------------------------------------------------------------*/
@@ -28,7 +37,11 @@ typedef enum RF_STATUS
 	{
 	RF_OK = 0,
     RF_ERROR ,
-	RF_TIMEOUT
+	RF_TIMEOUT,
+	RF_BUSY,       /* Queue full, or UART in XBee API mode   */
+	RF_PENDING,    /* No delivery status received yet        */
+	RF_TOO_LONG,   /* Payload over RF_MAX_PAYLOAD            */
+	RF_EMPTY       /* No received packet                     */
 	} RF_STATUS;
 
 /* Wireless Module Codes */
@@ -46,13 +59,188 @@ typedef enum WIRELESS_MOD_CODES
 /* HAL Settings*/
 #define RF_POLL_TIMEOUT		( 100 )
 
+/* Largest packet payload. Some XBee modules accept less, check ATNP, larger 
+   packets come back with XBEE_DELIVERY_TOO_LARGE */
+#define RF_MAX_PAYLOAD          ( 255 )
+
+/* XBee API mode 2 framing */
+#define XBEE_START              ( 0x7E )
+#define XBEE_ESCAPE             ( 0x7D )
+#define XBEE_XON                ( 0x11 )
+#define XBEE_XOFF               ( 0x13 )
+#define XBEE_ESCAPE_XOR         ( 0x20 )
+
+/* XBee API frame types */
+#define XBEE_API_TX_REQUEST     ( 0x10 )
+#define XBEE_API_TX_STATUS      ( 0x8B )
+#define XBEE_API_RX_PACKET      ( 0x90 )
+
+/* XBee 64-bit destination addresses */
+#define XBEE_ADDR_COORDINATOR   ( 0x0000000000000000ULL )
+#define XBEE_ADDR_BROADCAST     ( 0x000000000000FFFFULL )
+
+/* XBee delivery status codes from the transmit status frame, 
+   XBEE_DELIVERY_PENDING is local and means no status has arrived yet */
+#define XBEE_DELIVERY_SUCCESS   ( 0x00 )
+#define XBEE_DELIVERY_NO_ACK    ( 0x01 )
+#define XBEE_DELIVERY_TOO_LARGE ( 0x74 )
+#define XBEE_DELIVERY_PENDING   ( 0xFF )
+
+/* API driver queue depths, powers of two */
+#define XBEE_TX_QUEUE_DEPTH     ( 4   )
+#define XBEE_RX_QUEUE_DEPTH     ( 4   )
+
+/* Circular DMA receive ring size, power of two */
+#define XBEE_RX_BUFFER_SIZE     ( 512 )
+
+/* Largest transmit chunk while CTS flow control is in use. The XBee drops 
+   CTS with 17 bytes of buffer left, so one chunk in flight always fits */
+#define XBEE_CTS_CHUNK          ( 16  )
+
+/* SX127x LoRa registers */
+#define LORA_REG_FIFO               ( 0x00 )
+#define LORA_REG_OP_MODE            ( 0x01 )
+#define LORA_REG_FRF_MSB            ( 0x06 )
+#define LORA_REG_FRF_MID            ( 0x07 )
+#define LORA_REG_FRF_LSB            ( 0x08 )
+#define LORA_REG_PA_CONFIG          ( 0x09 )
+#define LORA_REG_OCP                ( 0x0B )
+#define LORA_REG_LNA                ( 0x0C )
+#define LORA_REG_FIFO_ADDR_PTR      ( 0x0D )
+#define LORA_REG_FIFO_TX_BASE_ADDR  ( 0x0E )
+#define LORA_REG_FIFO_RX_BASE_ADDR  ( 0x0F )
+#define LORA_REG_FIFO_RX_CURRENT    ( 0x10 )
+#define LORA_REG_IRQ_FLAGS          ( 0x12 )
+#define LORA_REG_RX_NB_BYTES        ( 0x13 )
+#define LORA_REG_PKT_SNR_VALUE      ( 0x19 )
+#define LORA_REG_PKT_RSSI_VALUE     ( 0x1A )
+#define LORA_REG_MODEM_CONFIG_1     ( 0x1D )
+#define LORA_REG_MODEM_CONFIG_2     ( 0x1E )
+#define LORA_REG_PREAMBLE_MSB       ( 0x20 )
+#define LORA_REG_PREAMBLE_LSB       ( 0x21 )
+#define LORA_REG_PAYLOAD_LENGTH     ( 0x22 )
+#define LORA_REG_MODEM_CONFIG_3     ( 0x26 )
+#define LORA_REG_DETECT_OPTIMIZE    ( 0x31 )
+#define LORA_REG_DETECT_THRESHOLD   ( 0x37 )
+#define LORA_REG_SYNC_WORD          ( 0x39 )
+#define LORA_REG_DIO_MAPPING_1      ( 0x40 )
+#define LORA_REG_VERSION            ( 0x42 )
+#define LORA_REG_PA_DAC             ( 0x4D )
+
+/* SX127x operating modes, LORA_MODE_LONG_RANGE selects the LoRa modem */
+#define LORA_MODE_LONG_RANGE        ( 0x80 )
+#define LORA_MODE_SLEEP             ( 0x00 )
+#define LORA_MODE_STDBY             ( 0x01 )
+#define LORA_MODE_TX                ( 0x03 )
+#define LORA_MODE_RX_CONTINUOUS     ( 0x05 )
+
+/* SX127x interrupt flags */
+#define LORA_IRQ_RX_DONE            ( 0x40 )
+#define LORA_IRQ_CRC_ERROR          ( 0x20 )
+#define LORA_IRQ_TX_DONE            ( 0x08 )
+
+/* DIO0 mapping in LORA_REG_DIO_MAPPING_1 */
+#define LORA_DIO0_RX_DONE           ( 0x00 )
+#define LORA_DIO0_TX_DONE           ( 0x40 )
+
+/* Silicon revision read from LORA_REG_VERSION */
+#define LORA_VERSION                ( 0x12 )
+
+/* Crystal frequency, Hz */
+#define LORA_FXOSC                  ( 32000000UL )
+
+/* Packet RSSI offsets of the low (below LORA_LF_MAX_FREQ) and high frequency 
+   RF ports, dBm */
+#define LORA_LF_MAX_FREQ            ( 779000000UL )
+#define LORA_RSSI_OFFSET_LF         ( -164 )
+#define LORA_RSSI_OFFSET_HF         ( -157 )
+
+/* Symbol time above which low data rate optimization is required, us */
+#define LORA_LDRO_SYMBOL_TIME       ( 16000 )
+
+/* LoRa transmit queue depth, power of two */
+#define LORA_TX_QUEUE_DEPTH         ( 4   )
+
+/* LoRa received packet queue depth, power of two */
+#define LORA_RX_QUEUE_DEPTH         ( 4   )
+
+
+/*------------------------------------------------------------------------------
+ Typdefs 
+------------------------------------------------------------------------------*/
+
+/* Received radio packet */
+typedef struct _RF_PACKET
+	{
+	uint64_t source;                  /* Sender 64-bit address      */
+	uint8_t  options;                 /* Receive options            */
+	uint16_t length;                  /* Payload length             */
+	uint8_t  payload[RF_MAX_PAYLOAD];
+	} RF_PACKET;
+
+/* XBee API driver statistics */
+typedef struct _RF_XBEE_STATS
+	{
+	uint32_t tx_frames;        /* Frames written to the module           */
+	uint32_t tx_delivered;     /* Transmit status success                */
+	uint32_t tx_failed;        /* Transmit status failure                */
+	uint32_t rx_packets;       /* Packets received                       */
+	uint32_t rx_drops;         /* Packets dropped on a full queue        */
+	uint32_t rx_errors;        /* Checksum, length or framing errors     */
+	uint32_t uart_rx_errors;   /* UART receive errors                    */
+	uint32_t uart_tx_errors;   /* Transmit chunks aborted and resent     */
+	uint32_t cts_stalls;       /* Transmit chunks held back by CTS       */
+	} RF_XBEE_STATS;
+
+/* LoRa signal bandwidth, register encoding */
+typedef enum _RF_LORA_BW
+	{
+	RF_LORA_BW_7K8   = 0,
+	RF_LORA_BW_10K4     ,
+	RF_LORA_BW_15K6     ,
+	RF_LORA_BW_20K8     ,
+	RF_LORA_BW_31K25    ,
+	RF_LORA_BW_41K7     ,
+	RF_LORA_BW_62K5     ,
+	RF_LORA_BW_125K     ,
+	RF_LORA_BW_250K     ,
+	RF_LORA_BW_500K
+	} RF_LORA_BW;
+
+/* LoRa modem configuration. Spreading factor 7 to 12, coding rate 1 to 4 
+   for 4/5 to 4/8. Transmit power 2 to 20 dBm on the PA_BOOST pin */
+typedef struct _RF_LORA_CONFIG
+	{
+	uint32_t   frequency;        /* Carrier frequency, Hz       */
+	RF_LORA_BW bandwidth;
+	uint8_t    spreading_factor;
+	uint8_t    coding_rate;
+	uint16_t   preamble_length;  /* Preamble symbols            */
+	int8_t     tx_power;         /* Transmit power, dBm         */
+	uint8_t    sync_word;
+	} RF_LORA_CONFIG;
+
+/* LoRa driver statistics */
+typedef struct _RF_LORA_STATS
+	{
+	uint32_t tx_packets;       /* Packets sent                           */
+	uint32_t rx_packets;       /* Packets received                       */
+	uint32_t rx_crc_errors;    /* Packets failing the payload CRC        */
+	uint32_t rx_drops;         /* Packets dropped on a full queue        */
+	uint32_t rx_lost;          /* Packets overwritten by a transmit      */
+	int16_t  last_rssi;        /* RSSI of the last packet, dBm           */
+	int8_t   last_snr;         /* SNR of the last packet, dB             */
+	} RF_LORA_STATS;
+
 
 /*------------------------------------------------------------------------------
  Function Prototypes 
 ------------------------------------------------------------------------------*/
 
 
-/* Transmits a byte wirelessly using the xbee module */
+/* Transmits a byte wirelessly using the xbee module, blocking. Returns
+   RF_BUSY once rf_xbee_init has started API mode, as do the other blocking
+   xbee calls */
 RF_STATUS rf_xbee_transmit_byte 
 	(
     uint8_t tx_byte	
@@ -79,6 +267,150 @@ RF_STATUS rf_xbee_receive
 	size_t rx_buffer_size   /* Number of bytes to recevie    */
 	);
 
+/* Start the XBee API mode driver, the module must be set to AP=2 */
+RF_STATUS rf_xbee_init
+	(
+	void
+	);
+
+/* Queue a packet for transmission, returns without waiting for the radio */
+RF_STATUS rf_xbee_send
+	(
+	uint64_t    dest_addr   ,   /* 64-bit destination address       */
+	const void* data_ptr    ,   /* Payload                          */
+	size_t      size        ,   /* Payload size                     */
+	uint8_t*    frame_id_ptr    /* Frame ID for the delivery status */
+	);
+
+/* Get the delivery status of a sent packet */
+RF_STATUS rf_xbee_get_delivery
+	(
+	uint8_t  frame_id  ,   /* Frame ID from rf_xbee_send  */
+	uint8_t* status_ptr    /* XBee delivery status code   */
+	);
+
+/* Get the oldest received packet */
+RF_STATUS rf_xbee_receive_packet
+	(
+	RF_PACKET* packet_ptr
+	);
+
+/* Number of queued packets not yet written to the module, restarts a
+   transfer the HAL refused */
+uint8_t rf_xbee_tx_pending
+	(
+	void
+	);
+
+/* Get the XBee API driver statistics */
+void rf_xbee_get_stats
+	(
+	RF_XBEE_STATS* stats_ptr
+	);
+
+/* Transmit complete interrupt, call from HAL_UART_TxCpltCallback */
+void rf_xbee_tx_complete_ISR
+	(
+	void
+	);
+
+/* CTS interrupt, call from HAL_GPIO_EXTI_Callback for the XBee CTS pin */
+void rf_xbee_cts_ISR
+	(
+	void
+	);
+
+/* Receive event interrupt, call from HAL_UARTEx_RxEventCallback */
+void rf_xbee_rx_event_ISR
+	(
+	uint16_t rx_pos     /* Write position in the DMA ring */
+	);
+
+/* UART error interrupt, call from HAL_UART_ErrorCallback */
+void rf_xbee_error_ISR
+	(
+	void
+	);
+
+/* Start the LoRa driver and enter continuous receive */
+RF_STATUS rf_lora_init
+	(
+	const RF_LORA_CONFIG* config_ptr
+	);
+
+/* Queue a packet for transmission, returns without waiting for the radio */
+RF_STATUS rf_lora_send
+	(
+	const void* data_ptr,   /* Payload          */
+	size_t      size        /* Payload size     */
+	);
+
+/* Get the oldest received LoRa packet */
+RF_STATUS rf_lora_receive_packet
+	(
+	RF_PACKET* packet_ptr
+	);
+
+/* Number of queued LoRa packets not yet sent, including the one on air */
+uint8_t rf_lora_tx_pending
+	(
+	void
+	);
+
+/* Time on air of a packet with the configured modem settings, us */
+uint32_t rf_lora_time_on_air
+	(
+	size_t size     /* Payload size */
+	);
+
+/* Largest payload whose time on air fits a budget, 0 if none fits */
+size_t rf_lora_max_payload
+	(
+	uint32_t max_time_us
+	);
+
+/* Get the LoRa driver statistics */
+void rf_lora_get_stats
+	(
+	RF_LORA_STATS* stats_ptr
+	);
+
+/* DIO0 interrupt, call from HAL_GPIO_EXTI_Callback for the LoRa DIO0 pin */
+void rf_lora_dio0_ISR
+	(
+	void
+	);
+
+/* Queue a packet on a radio. The XBee sends to dest_addr, LoRa broadcasts */
+RF_STATUS rf_send
+	(
+	WIRELESS_MOD_CODES module   ,
+	uint64_t           dest_addr,
+	const void*        data_ptr ,
+	size_t             size
+	);
+
+/* Get the oldest packet received by a radio */
+RF_STATUS rf_receive_packet
+	(
+	WIRELESS_MOD_CODES module    ,
+	RF_PACKET*         packet_ptr
+	);
+
+/* Number of packets queued on a radio and not yet sent */
+uint8_t rf_tx_pending
+	(
+	WIRELESS_MOD_CODES module
+	);
+
+/* Largest payload a radio sends within a time on air, us. The XBee takes 
+   RF_MAX_PAYLOAD whatever the time */
+size_t rf_max_payload
+	(
+	WIRELESS_MOD_CODES module     ,
+	uint32_t           max_time_us
+	);
+
 
 #ifdef __cplusplus
 }